@@ -152,6 +152,11 @@ void renderer_receive_frame(WhistRenderer* whist_renderer, WhistPacketType packe
     }
 }
 
+void renderer_receive_video_slices(WhistRenderer* whist_renderer, void* frame_prefix, int size) {
+    receive_video_slices(whist_renderer->video_context, (VideoFrame*)frame_prefix, size);
+    whist_post_semaphore(whist_renderer->video_semaphore);
+}
+
 void destroy_renderer(WhistRenderer* whist_renderer) {
     // Wait to close the renderer thread
     whist_renderer->run_renderer_threads = false;
@@ -91,6 +91,25 @@ bool renderer_wants_frame(WhistRenderer* renderer, WhistPacketType packet_type,
 void renderer_receive_frame(WhistRenderer* renderer, WhistPacketType packet_type, void* frame,
                             int size);
 
+/**
+ * @brief                          Receive the start of a video frame that's still being received,
+ *                                 so that the slices in it can be decoded before the rest of the
+ *                                 frame arrives
+ *
+ * @param renderer                 The renderer context to give the start of a frame to
+ *
+ * @param frame_prefix             The start of the VideoFrame
+ *
+ * @param size                     The number of bytes of the frame in frame_prefix
+ *
+ * @note                           This function is guaranteed to return virtually instantly.
+ *                                 It may be used in any hotpaths.
+ *
+ * @note                           Like with renderer_receive_frame, the data in frame_prefix must
+ *                                 be kept alive until renderer_wants_frame later returns True
+ */
+void renderer_receive_video_slices(WhistRenderer* renderer, void* frame_prefix, int size);
+
 /**
  * @brief                          Destroy the given whist renderer
  *
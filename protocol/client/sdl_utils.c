@@ -25,6 +25,7 @@ Includes
 #include <whist/logging/log_statistic.h>
 #include <whist/utils/command_line.h>
 #include <whist/network/network_algorithm.h>
+#include <whist/network/network.h>
 
 #include <whist/utils/color.h>
 #include "client_utils.h"
@@ -33,6 +34,8 @@ Includes
 #include "whist/debug/plotter.h"
 #include "whist/utils/clock.h"
 
+extern SocketContext packet_udp_context;
+
 static WhistMutex frontend_render_mutex;
 
 // pending render Update
@@ -361,7 +364,7 @@ static void sdl_present_pending_framebuffer(WhistFrontend* frontend) {
     whist_lock_mutex(frontend_render_mutex);
 
     // Render the error message immediately during state transition to insufficient bandwidth
-    if (network_algo_is_insufficient_bandwidth()) {
+    if (udp_is_insufficient_bandwidth(&packet_udp_context)) {
         if (insufficient_bandwidth == false) {
             pending_render = true;
         }
@@ -54,9 +54,10 @@ static bool run_sync_packets_threads;
 Public Function Implementations
 ============================
 */
-// This function polls for UDP packets from the server
+// This function processes the UDP packets from the server,
+// which the UDP receive thread pulls from the socket and decrypts.
 // NOTE: This contains a very sensitive hotpath,
-// as recvp will potentially receive tens of thousands packets per second.
+// as we will potentially receive tens of thousands packets per second.
 // The total execution time of inner for loop must not take longer than 0.01ms-0.1ms
 // i.e., this function should not take any more than 10,000 assembly instructions per loop.
 // Please do not put any for loops, and do not make any non-trivial system calls.
@@ -85,9 +86,19 @@ static int multithreaded_sync_udp_packets(void* opaque) {
     udp_register_ring_buffer(udp_context, PACKET_VIDEO, LARGEST_VIDEOFRAME_SIZE, 256);
     udp_register_ring_buffer(udp_context, PACKET_AUDIO, LARGEST_AUDIOFRAME_SIZE, 256);
     udp_register_ring_buffer(udp_context, PACKET_GPU, LARGEST_GPUFRAME_SIZE, 256);
+    // Pull packets from the socket and decrypt them on a thread of their own,
+    // so that the socket keeps getting drained while we're busy reassembling or rendering frames
+    udp_start_receive_thread(udp_context);
 
     WhistPacket* last_whist_packet[NUM_PACKET_TYPES] = {0};
 
+    // The start of the next video frame, while it's still being received,
+    // which the renderer decodes the slices of before the rest of the frame arrives
+    int partial_video_frame_capacity = (int)offsetof(WhistPacket, data) + LARGEST_VIDEOFRAME_SIZE;
+    char* partial_video_frame = (char*)safe_malloc(partial_video_frame_capacity);
+    int partial_video_frame_id = -1;
+    int partial_video_frame_size = 0;
+
     while (run_sync_packets_threads) {
         if (PLOT_CLIENT_UDP_SOCKET_RECV_QUEUE) {
             double current_time = get_timestamp_sec();
@@ -147,11 +158,30 @@ static int multithreaded_sync_udp_packets(void* opaque) {
                     // Store the pointer so we can free it later,
                     // While still keeping it alive for the renderer to render it
                     last_whist_packet[packet_type] = whist_packet;
+                } else if (packet_type == PACKET_VIDEO) {
+                    // Otherwise, pass on whatever more of the next frame has arrived, so that
+                    // its slices get decoded while the rest of it is still on the way
+                    int id = udp_get_next_frame_id(udp_context, PACKET_VIDEO);
+                    if (id != partial_video_frame_id) {
+                        partial_video_frame_id = id;
+                        partial_video_frame_size = 0;
+                    }
+                    int size = udp_read_frame_prefix(udp_context, PACKET_VIDEO, id,
+                                                     partial_video_frame, partial_video_frame_size);
+                    int header_size = (int)offsetof(WhistPacket, data);
+                    if (size > partial_video_frame_size && size > header_size) {
+                        partial_video_frame_size = size;
+                        renderer_receive_video_slices(
+                            whist_renderer, ((WhistPacket*)partial_video_frame)->data,
+                            size - header_size);
+                    }
                 }
             }
         }
     }
 
+    free(partial_video_frame);
+
     return 0;
 }
 
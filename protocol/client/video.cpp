@@ -82,6 +82,14 @@ struct VideoContext {
     VideoFrame* render_context;
     std::atomic<bool> pending_render_context;
 
+    // The start of the next frame, whose slices are decoded while the rest of it is received
+    VideoFrame* slices_context;
+    int slices_context_size;
+    std::atomic<bool> pending_slices_context;
+    // The frame whose first slices have been sent to the decoder, and how many of them
+    uint32_t sliced_frame_id;
+    int num_slices_sent;
+
     WhistCursorCache* cursor_cache;
 };
 
@@ -102,6 +110,14 @@ Private Functions
  */
 static void sync_decoder_parameters(VideoContext* video_context, VideoFrame* frame);
 
+/**
+ * @brief                          Sends the slices in video_context->slices_context that have
+ *                                 arrived completely, and weren't sent yet, to the decoder
+ *
+ * @param video_context            The video context being used
+ */
+static void send_received_slices(VideoContext* video_context);
+
 /**
  * @brief                          Destroys an ffmpeg decoder on another thread
  *
@@ -124,6 +140,9 @@ VideoContext* init_video(WhistFrontend* frontend, int initial_width, int initial
     video_context->render_context = NULL;
     video_context->frontend = frontend;
     video_context->pending_render_context = false;
+    video_context->slices_context = NULL;
+    video_context->pending_slices_context = false;
+    video_context->num_slices_sent = 0;
 
     VideoDecoderParams params = {
         .codec_type = CODEC_TYPE_H264,
@@ -192,6 +211,19 @@ void receive_video(VideoContext* video_context, VideoFrame* video_frame) {
     }
 }
 
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+void receive_video_slices(VideoContext* video_context, VideoFrame* frame_prefix, int prefix_size) {
+    if (!video_context->pending_render_context && !video_context->pending_slices_context) {
+        video_context->slices_context = frame_prefix;
+        video_context->slices_context_size = prefix_size;
+        video_context->pending_slices_context = true;
+    } else {
+        LOG_ERROR("We tried to send the video context slices when it wasn't ready!");
+    }
+}
+
 int render_video(VideoContext* video_context) {
     WhistTimer statistics_timer;
 
@@ -205,6 +237,12 @@ int render_video(VideoContext* video_context) {
     static timestamp_us client_input_timestamp = 0;
     static timestamp_us last_rendered_time = 0;
 
+    // Decode the slices of the next frame that have arrived so far
+    if (video_context->pending_slices_context) {
+        send_received_slices(video_context);
+        video_context->pending_slices_context = false;
+    }
+
     // Receive and process a render context that's being pushed
     if (video_context->pending_render_context) {
         // Grab and consume the actual frame
@@ -246,10 +284,20 @@ int render_video(VideoContext* video_context) {
             int ret;
             server_timestamp = frame->server_timestamp;
             client_input_timestamp = frame->client_input_timestamp;
-            TIME_RUN(ret = video_decoder_send_packets(
-                         video_context->decoder, get_frame_videodata(frame),
-                         frame->videodata_length, frame->frame_type == VIDEO_FRAME_TYPE_INTRA),
-                     VIDEO_DECODE_SEND_PACKET_TIME, statistics_timer);
+            if (video_context->num_slices_sent > 0 &&
+                video_context->sliced_frame_id == frame->frame_id) {
+                // Only the slices that weren't sent while the frame was being received are left
+                TIME_RUN(ret = video_decoder_send_received_packets(
+                             video_context->decoder, get_frame_videodata(frame),
+                             frame->videodata_length, video_context->num_slices_sent),
+                         VIDEO_DECODE_SEND_PACKET_TIME, statistics_timer);
+            } else {
+                TIME_RUN(ret = video_decoder_send_packets(
+                             video_context->decoder, get_frame_videodata(frame),
+                             frame->videodata_length, frame->frame_type == VIDEO_FRAME_TYPE_INTRA),
+                         VIDEO_DECODE_SEND_PACKET_TIME, statistics_timer);
+            }
+            video_context->num_slices_sent = 0;
             if (ret < 0) {
                 LOG_ERROR("Failed to send packets to decoder, unable to render frame");
                 video_context->pending_render_context = false;
@@ -477,6 +525,7 @@ void sync_decoder_parameters(VideoContext* video_context, VideoFrame* frame) {
         whist_detach_thread(destroy_decoder_thread);
         video_context->decoder = NULL;
     }
+    video_context->num_slices_sent = 0;
 
     VideoDecoderParams params = {
         .codec_type = frame->codec_type,
@@ -501,10 +550,54 @@ void sync_decoder_parameters(VideoContext* video_context, VideoFrame* frame) {
     video_context->last_frame_codec = frame->codec_type;
 }
 
+void send_received_slices(VideoContext* video_context) {
+    VideoFrame* frame = video_context->slices_context;
+    int size = video_context->slices_context_size;
+
+    // Only frames that the decoder is already set up for can be started on early
+    if (size < (int)sizeof(VideoFrame) || frame->is_empty_frame ||
+        video_context->decoder == NULL || frame->width != video_context->last_frame_width ||
+        frame->height != video_context->last_frame_height ||
+        frame->codec_type != video_context->last_frame_codec) {
+        return;
+    }
+
+    // If slices of a different frame were sent, that frame was skipped before it arrived in full.
+    // The decoder drops its incomplete picture once the next frame starts, and the stream only
+    // skips ahead to recovery points, which don't reference the dropped frame.
+    if (video_context->num_slices_sent == 0 || video_context->sliced_frame_id != frame->frame_id) {
+        video_context->sliced_frame_id = frame->frame_id;
+        video_context->num_slices_sent = 0;
+    }
+
+    // The videodata is behind the cursor, so the whole cursor has to have arrived to find it
+    int videodata_offset = (int)sizeof(VideoFrame);
+    if (frame->has_cursor) {
+        if (size < videodata_offset + (int)sizeof(WhistCursorInfo)) {
+            return;
+        }
+        videodata_offset += (int)whist_cursor_info_get_size(get_frame_cursor_info(frame));
+    }
+    if (size <= videodata_offset) {
+        return;
+    }
+
+    int ret = video_decoder_send_received_packets(
+        video_context->decoder, get_frame_videodata(frame),
+        min(size - videodata_offset, frame->videodata_length), video_context->num_slices_sent);
+    if (ret < 0) {
+        LOG_WARNING("Failed to send slices of frame %u to decoder", frame->frame_id);
+        return;
+    }
+    video_context->num_slices_sent = ret;
+}
+
 int32_t multithreaded_destroy_decoder(void* opaque) {
     VideoDecoder* decoder = (VideoDecoder*)opaque;
     destroy_video_decoder(decoder);
     return 0;
 }
 
-bool video_ready_for_frame(VideoContext* context) { return !context->pending_render_context; }
+bool video_ready_for_frame(VideoContext* context) {
+    return !context->pending_render_context && !context->pending_slices_context;
+}
@@ -79,6 +79,26 @@ VideoContext* init_video(WhistFrontend* frontend, int initial_width, int initial
  */
 void receive_video(VideoContext* video_context, VideoFrame* video_frame);
 
+/**
+ * @brief                          Receive the start of the next video frame, while the rest of it
+ *                                 is still on the way. The slices in it that have arrived
+ *                                 completely are decoded right away, and only the rest of the
+ *                                 frame is decoded once the whole frame is given to receive_video.
+ *
+ * @param video_context            The video context to give the start of a frame to
+ *
+ * @param frame_prefix             The start of the video frame
+ *
+ * @param prefix_size              The number of bytes of the frame in frame_prefix
+ *
+ * @note                           This function is guaranteed to return virtually instantly.
+ *                                 It may be used in any hotpaths.
+ *                                 Like receive_video, it must only be called when
+ *                                 video_ready_for_frame, and frame_prefix must be kept alive until
+ *                                 video_ready_for_frame returns true again.
+ */
+void receive_video_slices(VideoContext* video_context, VideoFrame* frame_prefix, int prefix_size);
+
 /**
  * @brief                          Render the video frame (If any are available to render)
  *
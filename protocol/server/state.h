@@ -89,10 +89,10 @@ typedef struct WhistServerState {
 
     // Whether the stream needs to be restarted with new parameter sets
     // and an intra frame.
-    bool stream_needs_restart;
+    volatile bool stream_needs_restart;
     // Whether the stream needs to be recovered (but does not require
     // new parameter sets and an intra frame).
-    bool stream_needs_recovery;
+    volatile bool stream_needs_recovery;
 
     // Long-term reference state.
     LTRState* ltr_context;
@@ -7,8 +7,17 @@
 Usage
 ============================
 
-multithreaded_send_video() is called on its own thread and loops repeatedly to capture and send
-video.
+multithreaded_send_video() is called on its own thread and loops repeatedly to capture video.
+Video goes through a pipeline of three threads, so that each frame's capture overlaps the previous
+frame's encode, and that frame's send:
+
+- The capture thread (multithreaded_send_video) owns the capture device. It captures the screen,
+  copies what changed into a free slot of capture_queue, and publishes it.
+- The encode thread (multithreaded_encode_video) owns the encoder. It takes the latest published
+  frame, encodes it, and hands it to the send thread. If it falls behind, the capture thread
+  replaces the queued frame rather than waiting, so the encoder always gets the newest frame.
+- The send thread (multithreaded_send_video_packets) sends each encoded frame, and handles nacks
+  between frames.
 */
 
 /*
@@ -36,11 +45,13 @@ Includes
 #include <whist/video/transfercapture.h>
 #include <whist/video/capture/capture.h>
 #include <whist/video/codec/encode.h>
+#include <whist/video/tile_hash/tile_hash.h>
 #include <whist/utils/avpacket_buffer.h>
 #include <whist/logging/log_statistic.h>
 #include <whist/network/network_algorithm.h>
 #include <whist/network/throttle.h>
 #include <whist/utils/linked_list.h>
+#include <whist/utils/triple_buffer.h>
 #include "whist/core/features.h"
 #include "client.h"
 #include "network.h"
@@ -63,15 +74,78 @@ Includes
 // Please note that this number will be multiplied by BURST_BITRATE_RATIO to get the VBV size in sec
 #define VBV_IN_SEC_BY_BURST_BITRATE_RATIO 0.2
 
+// Damage that covers more than this ratio of the frame isn't hashed, since hashing it would cost
+// more than the copying and encoding that it could save
+#define DAMAGE_HASH_MAX_COVERAGE 0.75
+// Once hashing hasn't narrowed the damage down for this many captures in a row, like during video
+// playback, the next DAMAGE_HASH_BACKOFF_CAPTURES captures aren't hashed
+#define DAMAGE_HASH_MAX_FRUITLESS_CAPTURES 8
+#define DAMAGE_HASH_BACKOFF_CAPTURES 60
+
 static WhistSemaphore consumer;
 static WhistSemaphore producer;
 // send_populated_frames/send_empty_frame will populate one of the frame_buf's, and then wait
 // While multithreaded_send_video_packets is working to send the other frame_buf over the network
 static char encoded_frame_buf[2][LARGEST_VIDEOFRAME_SIZE];
+// The encoded packets of each encoded_frame_buf. encoded_frame_buf only holds the frame struct and
+// the packet sizes, while the packet data is sent straight out of these references,
+// rather than being copied into encoded_frame_buf first
+static AVPacket* encoded_frame_packets[2][MAX_ENCODER_PACKETS];
+static int encoded_frame_num_packets[2];
 static bool run_multithreaded_send_video_packets;
 static int send_frame_id;
 static int currently_sending_index;
 static NetworkSettings network_settings;
+
+// A captured frame, waiting in capture_queue to be encoded
+typedef struct {
+    CapturedFrame frame;
+    // Send an empty frame instead of encoding this one
+    bool is_empty_frame;
+    // Whether frame_data is the capture device's GPU texture, rather than pixels
+    bool is_on_gpu;
+    // The CPU copy of the captured pixels, which frame_data points to if !is_on_gpu
+    uint8_t* pixels;
+    size_t pixels_size;
+    // The regions of pixels that are older than the screen. Only touched by the capture thread,
+    // which adds each capture's damage to every slot, even the ones that it doesn't own
+    int num_stale_rects;
+    WhistRect stale_rects[MAX_DIRTY_RECTS];
+    bool is_stale;
+    WhistWindow window_data[MAX_WINDOWS];
+    WhistRGBColor corner_color;
+    WhistCursorInfo* cursor;
+    NetworkSettings network_settings;
+    timestamp_us server_timestamp;
+    timestamp_us client_input_timestamp;
+    timestamp_us capture_timestamp;
+    timestamp_us publish_timestamp;
+} CaptureSlot;
+
+static CaptureSlot capture_slots[TRIPLE_BUFFER_SLOTS];
+static TripleBuffer* capture_queue;
+// The regions that changed since the last published frame
+static int num_new_rects;
+static WhistRect new_rects[MAX_DIRTY_RECTS];
+// The regions that changed since the last frame that's known to have reached the encoder
+static int num_unencoded_rects;
+static WhistRect unencoded_rects[MAX_DIRTY_RECTS];
+// The hashes of the tiles of the capture device's frame, to tell which damage changed any pixels
+static TileHasher* tile_hasher;
+// How many captures in a row hashing didn't narrow the damage down for, and how many more captures
+// to skip hashing for
+static int num_fruitless_damage_hashes;
+static int num_damage_hash_backoff_captures;
+// Posted by the encode thread once it's done with a frame that's on the GPU, since the capture
+// device overwrites its texture on every capture
+static WhistSemaphore gpu_frame_released;
+static bool gpu_frame_in_flight;
+// The capture thread asks the encode thread to flush before changing the capture device
+static WhistSemaphore encode_flush_done;
+static volatile bool encode_flush_requested;
+static volatile bool encode_flush_releases_encoder;
+static volatile bool run_multithreaded_encode_video;
+static volatile bool encode_failed;
 /*
 ============================
 Private Functions
@@ -80,6 +154,7 @@ Private Functions
 
 static int32_t multithreaded_encoder_factory(void* opaque);
 static int32_t multithreaded_destroy_encoder(void* opaque);
+static int32_t multithreaded_encode_video(void* opaque);
 
 /*
 ============================
@@ -114,15 +189,13 @@ static int32_t multithreaded_destroy_encoder(void* opaque) {
  * @param statistics_timer  Pointer to statistics timer used for logging
  * @param device            CaptureDevice pointer
  * @param rdevice           CaptureDevice pointer
- * @param encoder           VideoEncoder pointer
  * @param true_width        True width of client screen
  * @param true_height       True height of client screen
  * @return                  On success, 0. On failure, -1.
  */
 static int32_t create_new_device(WhistServerState* state, WhistTimer* statistics_timer,
                                  CaptureDevice** device, CaptureDevice* rdevice,
-                                 VideoEncoder** encoder, uint32_t true_width,
-                                 uint32_t true_height) {
+                                 uint32_t true_width, uint32_t true_height) {
     start_timer(statistics_timer);
     *device = rdevice;
     if (create_capture_device(*device, true_width, true_height, state->client_dpi) < 0) {
@@ -137,15 +210,9 @@ static int32_t create_new_device(WhistServerState* state, WhistTimer* statistics
     LOG_INFO("Created a new Capture Device of dimensions %dx%d with DPI %d", (*device)->width,
              (*device)->height, state->client_dpi);
 
-    // If an encoder is pending, while capture_device is updating, then we should wait
-    // for it to be created
-    while (state->pending_encoder) {
-        if (state->encoder_finished) {
-            *encoder = state->encoder_factory_result;
-            state->pending_encoder = false;
-            break;
-        }
-        whist_sleep(1);
+    // The queued frames' pixels came from the old device
+    for (int i = 0; i < TRIPLE_BUFFER_SLOTS; i++) {
+        capture_slots[i].is_stale = true;
     }
 
     // Next, we should update our ffmpeg encoder
@@ -157,28 +224,15 @@ static int32_t create_new_device(WhistServerState* state, WhistTimer* statistics
 }
 
 /**
- * @brief                           Sends the populated video frames to the
- *                                  client
+ * @brief                           Hands the frame that was just encoded to the send thread
  *
- * @param state						server state
- * @param statistics_timer          Pointer to statistics timer used for logging
- * @param server_frame_timer        Pointer to server_frame_timer
- * @param device                    CaptureDevice pointer
+ * @param state                     server state
  * @param encoder                   VideoEncoder pointer
- * @param id                        Pointer to frame id
- * @param client_input_timestamp    Estimated client timestamp at which user input is sent
- * @param server_timestamp          Server timestamp at which this frame is captured
+ * @param slot                      The captured frame that was encoded
+ * @param id                        The frame id
  */
-static void send_populated_frames(WhistServerState* state, WhistTimer* statistics_timer,
-                                  WhistTimer* server_frame_timer, CaptureDevice* device,
-                                  VideoEncoder* encoder, int id,
-                                  timestamp_us client_input_timestamp,
-                                  timestamp_us server_timestamp) {
-    // transfer the capture of the latest frame from the device to
-    // the encoder,
-    // This function will try to CUDA/OpenGL optimize the transfer by
-    // only passing a GPU reference rather than copy to/from the CPU
-
+static void send_populated_frames(WhistServerState* state, VideoEncoder* encoder,
+                                  const CaptureSlot* slot, int id) {
     // Create frame struct with compressed frame data and
     // metadata
 
@@ -188,15 +242,14 @@ static void send_populated_frames(WhistServerState* state, WhistTimer* statistic
     frame->codec_type = encoder->codec_type;
     frame->is_empty_frame = false;
     frame->is_window_visible = true;
-    memcpy(frame->window_data, device->window_data, sizeof(frame->window_data));
-    frame->corner_color = device->corner_color;
-    frame->server_timestamp = server_timestamp;
-    frame->client_input_timestamp = client_input_timestamp;
+    memcpy(frame->window_data, slot->window_data, sizeof(frame->window_data));
+    frame->corner_color = slot->corner_color;
+    frame->server_timestamp = slot->server_timestamp;
+    frame->client_input_timestamp = slot->client_input_timestamp;
 
-    start_timer(statistics_timer);
-    WhistCursorInfo* current_cursor = whist_cursor_capture();
+    // The cursor was captured along with the frame
+    WhistCursorInfo* current_cursor = slot->cursor;
     FATAL_ASSERT(current_cursor != NULL);
-    log_double_statistic(VIDEO_GET_CURSOR_TIME, get_timer(statistics_timer) * MS_IN_SECOND);
 
     // Client needs to know about frame type to find recovery points.
     frame->frame_type = encoder->frame_type;
@@ -236,11 +289,31 @@ static void send_populated_frames(WhistServerState* state, WhistTimer* statistic
         }
         state->last_cursor_hash = current_cursor->hash;
     }
-    free(current_cursor);
 
-    // Write frame data to the frame struct
-    write_avpackets_to_buffer(encoder->num_packets, encoder->packets, get_frame_videodata(frame));
+    // Write the packet sizes to the frame struct, and keep references to the packets themselves,
+    // since the encoder will reuse them while the send thread is still sending this frame
+    int frame_buf_index = 1 - currently_sending_index;
+    write_avpackets_header_to_buffer(encoder->num_packets, encoder->packets,
+                                     get_frame_videodata(frame));
+    for (int i = 0; i < encoder->num_packets; i++) {
+        if (encoded_frame_packets[frame_buf_index][i] == NULL) {
+            encoded_frame_packets[frame_buf_index][i] = av_packet_alloc();
+            FATAL_ASSERT(encoded_frame_packets[frame_buf_index][i] != NULL);
+        } else {
+            av_packet_unref(encoded_frame_packets[frame_buf_index][i]);
+        }
+        // This only copies the data if the encoder's packet isn't refcounted
+        int res = av_packet_ref(encoded_frame_packets[frame_buf_index][i], encoder->packets[i]);
+        FATAL_ASSERT(res == 0);
+    }
+    encoded_frame_num_packets[frame_buf_index] = encoder->num_packets;
+
+    // Wait for the send thread to finish with the previous frame. The capture thread keeps
+    // capturing meanwhile, so we don't need to hold off the next capture until this frame is out.
+    WhistTimer wait_timer;
+    start_timer(&wait_timer);
     whist_wait_semaphore(consumer);
+    log_double_statistic(VIDEO_SEND_WAIT_TIME, get_timer(&wait_timer) * MS_IN_SECOND);
     send_frame_id = id;
     currently_sending_index = 1 - currently_sending_index;
 
@@ -250,14 +323,53 @@ static void send_populated_frames(WhistServerState* state, WhistTimer* statistic
     }
 
     whist_post_semaphore(producer);
-    timestamp_us time_to_transmit =
-        ((uint64_t)get_total_frame_size(frame) * BITS_IN_BYTE * US_IN_SECOND) /
-        network_settings.burst_bitrate;
-    // If the time to transmit this frame is more than one frame duration, then sleep for remaining
-    // time to reduce the latency of next frame. If we capture the next frame early anyways network
-    // throttler will make us wait thus increasing its latency(time from capture to render).
-    if (time_to_transmit > AVG_FRAME_DURATION_IN_US) {
-        whist_usleep((uint32_t)(time_to_transmit - AVG_FRAME_DURATION_IN_US));
+}
+
+/**
+ * @brief                   Describes the frame in encoded_frame_buf[frame_buf_index] as a list of
+ *                          pieces, so that it can be sent without assembling it first.
+ *                          The first piece is the frame struct, cursor and packet sizes in
+ *                          encoded_frame_buf, followed by the data of each encoded packet.
+ *
+ * @param frame_buf_index   The index of the encoded_frame_buf to describe
+ * @param frame_iov         The array to write the pieces to,
+ *                          which must have room for 1 + MAX_ENCODER_PACKETS pieces
+ *
+ * @returns                 The number of pieces written to frame_iov
+ */
+static int get_encoded_frame_iov(int frame_buf_index, WhistIOVec* frame_iov) {
+    VideoFrame* frame = (VideoFrame*)encoded_frame_buf[frame_buf_index];
+    int header_size = get_total_frame_size(frame);
+    int num_packets = encoded_frame_num_packets[frame_buf_index];
+    for (int i = 0; i < num_packets; i++) {
+        AVPacket* pkt = encoded_frame_packets[frame_buf_index][i];
+        frame_iov[i + 1].data = pkt->data;
+        frame_iov[i + 1].size = pkt->size;
+        header_size -= pkt->size;
+    }
+    FATAL_ASSERT(header_size > 0);
+    frame_iov[0].data = frame;
+    frame_iov[0].size = header_size;
+    return 1 + num_packets;
+}
+
+/**
+ * @brief                   Makes the encode thread drop the queued frame, if any, and finish
+ *                          with the frame that it's encoding, so that the capture device can be
+ *                          changed. Called by the capture thread.
+ *
+ * @param release_encoder   Whether the encode thread should also destroy an Nvidia encoder,
+ *                          because the capture device is about to be destroyed
+ */
+static void flush_encode_thread(bool release_encoder) {
+    encode_flush_releases_encoder = release_encoder;
+    encode_flush_requested = true;
+    triple_buffer_wake(capture_queue);
+    whist_wait_semaphore(encode_flush_done);
+    // The encode thread is done with the GPU frame now, whether it encoded it or dropped it
+    if (gpu_frame_in_flight) {
+        whist_wait_semaphore(gpu_frame_released);
+        gpu_frame_in_flight = false;
     }
 }
 
@@ -267,20 +379,17 @@ static void send_populated_frames(WhistServerState* state, WhistTimer* statistic
  *
  * @param state		the Whist server state
  * @param device    pointer to a CaptureDevice pointer (will be set to NULL)
- * @param encoder   pointer to a VideoEncoder pointer (may be set to NULL)
  */
-static void retry_capture_screen(WhistServerState* state, CaptureDevice** device,
-                                 VideoEncoder** encoder) {
+static void retry_capture_screen(WhistServerState* state, CaptureDevice** device) {
     LOG_WARNING("Failed to capture screen");
-    FATAL_ASSERT(device != NULL && encoder != NULL);
+    FATAL_ASSERT(device != NULL);
     // The Nvidia Encoder must be wrapped in the lifetime of the capture device
-    if (*encoder != NULL && (*encoder)->active_encoder == NVIDIA_ENCODER) {
-        multithreaded_destroy_encoder(*encoder);
-        *encoder = NULL;
-    }
+    flush_encode_thread(true);
     destroy_capture_device(*device);
     *device = NULL;
     state->update_device = true;
+    // The next device's frame hasn't been hashed
+    tile_hasher_reset(tile_hasher);
 
     whist_sleep(100);
 }
@@ -292,12 +401,11 @@ static void retry_capture_screen(WhistServerState* state, CaptureDevice** device
  * @param state			   The server state
  * @param statistics_timer Pointer to the timer used for statistics logging
  * @param device           CaptureDevice pointer
- * @param encoder          VideoEncoder pointer
  * @param true_width       True width of client screen
  * @param true_height      True height of client screen
  */
 static void update_current_device(WhistServerState* state, WhistTimer* statistics_timer,
-                                  CaptureDevice* device, VideoEncoder* encoder, uint32_t true_width,
+                                  CaptureDevice* device, uint32_t true_width,
                                   uint32_t true_height) {
     state->update_device = false;
     start_timer(statistics_timer);
@@ -307,6 +415,11 @@ static void update_current_device(WhistServerState* state, WhistTimer* statistic
 
     // If a device already exists, we should reconfigure or destroy it
     if (device != NULL) {
+        // The encode thread may still be using the device's texture
+        flush_encode_thread(false);
+        for (int i = 0; i < TRIPLE_BUFFER_SLOTS; i++) {
+            capture_slots[i].is_stale = true;
+        }
         if (reconfigure_capture_device(device, true_width, true_height, state->client_dpi)) {
             // Reconfigured the capture device!
             // No need to recreate it, the device has now been updated
@@ -333,7 +446,7 @@ static void update_current_device(WhistServerState* state, WhistTimer* statistic
  * @brief                         Sends an empty frame to the client
  *
  * @param state		the Whist server state
- * @param id        Pointer to the frame id
+ * @param id        The frame id
  */
 static void send_empty_frame(WhistServerState* state, int id) {
     // If we don't have a new frame to send, let's just send an empty one
@@ -345,6 +458,8 @@ static void send_empty_frame(WhistServerState* state, int id) {
     frame->is_window_visible = !state->stop_streaming;
     // We don't need to fill out the rest of the fields of the VideoFrame because
     // is_empty_frame is true, so it will just be ignored by the client.
+    // The whole frame is sent straight out of encoded_frame_buf
+    encoded_frame_num_packets[1 - currently_sending_index] = 0;
 
     whist_wait_semaphore(consumer);
     // Increase the size of empty size frames during saturate bandwidth to prevent sending lot of
@@ -364,15 +479,16 @@ static void send_empty_frame(WhistServerState* state, int id) {
  *
  * @param state		The Whist server state
  * @param encoder   The previous VideoEncoder
- * @param device    The CaptureDevice
+ * @param width     The width of the captured frames
+ * @param height    The height of the captured frames
  * @param bitrate   The bitrate to encode at
  * @param codec     The codec to use
- * @param fps       The FPS to use
+ * @param vbv_size  The VBV buffer size to use
  *
  * @returns         The new encoder
  */
 static VideoEncoder* update_video_encoder(WhistServerState* state, VideoEncoder* encoder,
-                                          CaptureDevice* device, int bitrate, CodecType codec,
+                                          int width, int height, int bitrate, CodecType codec,
                                           int vbv_size) {
     // If this is a new update encoder request, log it
     if (!state->pending_encoder) {
@@ -382,10 +498,10 @@ static VideoEncoder* update_video_encoder(WhistServerState* state, VideoEncoder*
     // First, try to simply reconfigure the encoder to
     // handle the update_encoder event
     if (encoder != NULL) {
-        if (reconfigure_encoder(encoder, device->width, device->height, bitrate, vbv_size, codec)) {
+        if (reconfigure_encoder(encoder, width, height, bitrate, vbv_size, codec)) {
             // If we could update the encoder in-place, then we're done updating the encoder
-            LOG_INFO("Reconfigured Encoder to %dx%d using Bitrate: %d, and Codec %d", device->width,
-                     device->height, bitrate, (int)codec);
+            LOG_INFO("Reconfigured Encoder to %dx%d using Bitrate: %d, and Codec %d", width, height,
+                     bitrate, (int)codec);
             state->update_encoder = false;
         } else {
             // TODO: Make LOG_ERROR after ffmpeg reconfiguration is implemented
@@ -417,10 +533,10 @@ static VideoEncoder* update_video_encoder(WhistServerState* state, VideoEncoder*
             LOG_INFO(
                 "Creating a new Encoder of dimensions %dx%d using Bitrate: %d, and "
                 "Codec %d",
-                device->width, device->height, bitrate, (int)codec);
+                width, height, bitrate, (int)codec);
             state->encoder_finished = false;
-            state->encoder_factory_server_w = device->width;
-            state->encoder_factory_server_h = device->height;
+            state->encoder_factory_server_w = width;
+            state->encoder_factory_server_h = height;
             state->encoder_factory_client_w = (int)state->client_width;
             state->encoder_factory_client_h = (int)state->client_height;
             state->encoder_factory_codec_type = codec;
@@ -456,6 +572,462 @@ static VideoEncoder* update_video_encoder(WhistServerState* state, VideoEncoder*
     return encoder;
 }
 
+/**
+ * @brief                   Narrows the damage of the latest capture down to the tiles whose pixels
+ *                          actually changed, since damage is also reported for redraws that leave
+ *                          the pixels as they were, like cursor blinks and compositor repaints.
+ *                          Damage that hashing can't pay off for is left as it is.
+ *                          Called by the capture thread.
+ *
+ * @param device            The capture device, right after a capture_screen() that returned frames
+ *
+ * @returns                 Whether any pixels changed
+ */
+static bool filter_captured_damage(CaptureDevice* device) {
+#if OS_IS(OS_LINUX)
+    if (device->last_capture_device != X11_DEVICE) {
+        // GPU captures aren't on the CPU to be hashed, so the hashes don't know about this one
+        tile_hasher_reset(tile_hasher);
+        return true;
+    }
+    int64_t damage_area = dirty_rects_area(device->dirty_rects, device->num_dirty_rects);
+    if (num_damage_hash_backoff_captures > 0 ||
+        damage_area > (int64_t)device->width * device->height * DAMAGE_HASH_MAX_COVERAGE) {
+        // The damage is taken as it is, so the hashes of its tiles go stale
+        if (num_damage_hash_backoff_captures > 0) {
+            num_damage_hash_backoff_captures--;
+        }
+        tile_hasher_reset(tile_hasher);
+        return true;
+    }
+    WhistTimer statistics_timer;
+    start_timer(&statistics_timer);
+    int num_changed_tiles =
+        tile_hasher_update(tile_hasher, device->frame_data, device->pitch, device->width,
+                           device->height, device->dirty_rects, &device->num_dirty_rects);
+    log_double_statistic(VIDEO_TILE_HASH_TIME, get_timer(&statistics_timer) * MS_IN_SECOND);
+    log_double_statistic(VIDEO_CHANGED_TILE_PERCENTAGE,
+                         100.0 * num_changed_tiles / tile_hasher_get_num_tiles(tile_hasher));
+    if (dirty_rects_area(device->dirty_rects, device->num_dirty_rects) < damage_area) {
+        num_fruitless_damage_hashes = 0;
+    } else if (++num_fruitless_damage_hashes >= DAMAGE_HASH_MAX_FRUITLESS_CAPTURES) {
+        num_fruitless_damage_hashes = 0;
+        num_damage_hash_backoff_captures = DAMAGE_HASH_BACKOFF_CAPTURES;
+    }
+    return num_changed_tiles > 0;
+#else
+    // Windows captures only reach the CPU in transfer_screen()
+    return true;
+#endif
+}
+
+/**
+ * @brief                   Records the regions that the latest capture changed, so that the next
+ *                          frames copy and encode them. Called by the capture thread.
+ *
+ * @param device            The capture device, right after a capture_screen() that returned frames
+ */
+static void add_captured_damage(CaptureDevice* device) {
+    for (int i = 0; i < device->num_dirty_rects; i++) {
+        WhistRect rect = device->dirty_rects[i];
+        for (int j = 0; j < TRIPLE_BUFFER_SLOTS; j++) {
+            dirty_rects_add(capture_slots[j].stale_rects, &capture_slots[j].num_stale_rects, rect,
+                            device->width, device->height);
+        }
+        dirty_rects_add(new_rects, &num_new_rects, rect, device->width, device->height);
+    }
+}
+
+/**
+ * @brief                   Brings the pixels of a slot up to date with the capture device's CPU
+ *                          buffer, by copying only the regions that changed since the slot was last
+ *                          written. Called by the capture thread.
+ *
+ * @param device            The capture device, after transfer_screen()
+ * @param slot              The slot to copy into
+ */
+static void copy_captured_pixels(CaptureDevice* device, CaptureSlot* slot) {
+    size_t size = (size_t)device->pitch * device->height;
+    if (slot->frame.width != device->width || slot->frame.height != device->height ||
+        slot->frame.pitch != device->pitch || slot->pixels_size != size) {
+        free(slot->pixels);
+        slot->pixels = safe_malloc(size);
+        slot->pixels_size = size;
+        slot->is_stale = true;
+    }
+    if (slot->is_stale) {
+        slot->num_stale_rects = 1;
+        slot->stale_rects[0] = (WhistRect){0, 0, device->width, device->height};
+        slot->is_stale = false;
+    }
+
+    const uint8_t* src = device->frame_data;
+    for (int i = 0; i < slot->num_stale_rects; i++) {
+        const WhistRect* rect = &slot->stale_rects[i];
+        size_t offset = (size_t)rect->y * device->pitch + (size_t)rect->x * 4;
+        for (int y = 0; y < rect->height; y++) {
+            memcpy(slot->pixels + offset, src + offset, (size_t)rect->width * 4);
+            offset += device->pitch;
+        }
+    }
+    slot->num_stale_rects = 0;
+}
+
+/**
+ * @brief                           Fills the capture queue's write slot with the latest capture, or
+ *                                  with an empty frame, and publishes it to the encode thread.
+ *                                  Called by the capture thread.
+ *
+ * @param state                     The Whist server state
+ * @param device                    The capture device
+ * @param is_empty_frame            Whether to send an empty frame instead of the capture
+ * @param client_input_timestamp    Estimated client timestamp at which user input is sent
+ * @param server_timestamp          Server timestamp at which this frame is captured
+ * @param capture_timestamp         Server timestamp at which the capture finished
+ */
+static void queue_captured_frame(WhistServerState* state, CaptureDevice* device,
+                                 bool is_empty_frame, timestamp_us client_input_timestamp,
+                                 timestamp_us server_timestamp, timestamp_us capture_timestamp) {
+    CaptureSlot* slot = &capture_slots[triple_buffer_get_write_slot(capture_queue)];
+    // If this slot's previous frame was never encoded, its cursor is still here
+    free(slot->cursor);
+    slot->cursor = NULL;
+    slot->is_empty_frame = is_empty_frame;
+    slot->is_on_gpu = false;
+    slot->network_settings = udp_get_network_settings(&state->client->udp_context);
+    slot->server_timestamp = server_timestamp;
+    slot->client_input_timestamp = client_input_timestamp;
+    slot->capture_timestamp = capture_timestamp;
+
+    if (!is_empty_frame) {
+        WhistTimer statistics_timer;
+        start_timer(&statistics_timer);
+        transfer_screen(device);
+#if OS_IS(OS_LINUX)
+        slot->is_on_gpu = device->last_capture_device == NVIDIA_DEVICE;
+        slot->frame.device_type = device->last_capture_device;
+#else
+        // Only Linux captures to the GPU, so the frame is always a CPU buffer
+        slot->frame.device_type = X11_DEVICE;
+#endif
+        if (slot->is_on_gpu) {
+            // The texture isn't copied, so don't capture again until the encoder is done with it
+            slot->frame.frame_data = device->frame_data;
+            slot->is_stale = true;
+            gpu_frame_in_flight = true;
+        } else {
+            copy_captured_pixels(device, slot);
+            slot->frame.frame_data = slot->pixels;
+            log_double_statistic(VIDEO_CAPTURE_COPY_TIME,
+                                 get_timer(&statistics_timer) * MS_IN_SECOND);
+        }
+        slot->frame.width = device->width;
+        slot->frame.height = device->height;
+        slot->frame.pitch = device->pitch;
+
+        // The encoder needs everything that changed since the last frame that it got
+        slot->frame.num_dirty_rects = num_unencoded_rects;
+        memcpy(slot->frame.dirty_rects, unencoded_rects, sizeof(unencoded_rects));
+        for (int i = 0; i < num_new_rects; i++) {
+            dirty_rects_add(slot->frame.dirty_rects, &slot->frame.num_dirty_rects, new_rects[i],
+                            device->width, device->height);
+        }
+
+        memcpy(slot->window_data, device->window_data, sizeof(slot->window_data));
+        slot->corner_color = device->corner_color;
+
+        start_timer(&statistics_timer);
+        slot->cursor = whist_cursor_capture();
+        FATAL_ASSERT(slot->cursor != NULL);
+        log_double_statistic(VIDEO_GET_CURSOR_TIME, get_timer(&statistics_timer) * MS_IN_SECOND);
+    }
+
+    slot->publish_timestamp = current_time_us();
+    bool replaced_frame = triple_buffer_publish(capture_queue);
+    if (replaced_frame) {
+        // The encode thread fell behind, so the previous frame was replaced by this one
+        log_double_statistic(VIDEO_FRAMES_DROPPED_IN_QUEUE, 1.0);
+    }
+    // Empty frames don't carry any changes
+    if (!is_empty_frame) {
+        if (replaced_frame) {
+            for (int i = 0; i < num_new_rects; i++) {
+                dirty_rects_add(unencoded_rects, &num_unencoded_rects, new_rects[i],
+                                device->width, device->height);
+            }
+        } else {
+            // The previous frame reached the encode thread, so only this frame's changes are new
+            // to the encoder
+            num_unencoded_rects = num_new_rects;
+            memcpy(unencoded_rects, new_rects, sizeof(new_rects));
+        }
+        num_new_rects = 0;
+    }
+}
+
+/**
+ * @brief                   Encodes a captured frame, and hands it to the send thread.
+ *                          Called by the encode thread.
+ *
+ * @param state             The Whist server state
+ * @param encoder           Pointer to the VideoEncoder pointer, which may be updated
+ * @param slot              The captured frame
+ * @param id                The frame id
+ * @param last_network_settings The network settings that the encoder was last updated for
+ * @param fp                The file to save the encoded video to, if SAVE_VIDEO_OUTPUT
+ *
+ * @returns                 0 on success, -1 if encoding failed and the server should exit
+ */
+static int encode_captured_frame(WhistServerState* state, VideoEncoder** encoder,
+                                 CaptureSlot* slot, int id,
+                                 NetworkSettings* last_network_settings, FILE* fp) {
+    WhistTimer statistics_timer;
+
+    timestamp_us encode_start_timestamp = current_time_us();
+    log_double_statistic(VIDEO_FRAME_QUEUE_TIME,
+                         (double)(encode_start_timestamp - slot->publish_timestamp) / US_IN_MS);
+
+    network_settings = slot->network_settings;
+
+    if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
+        // If any frame acks have been received, tell the frame type
+        // decision logic about them.
+        if (state->update_frame_ack) {
+            ltr_mark_frame_received(state->ltr_context, state->frame_ack_id);
+            state->update_frame_ack = false;
+        }
+    }
+
+    if (slot->is_empty_frame) {
+        // Send an empty frame
+        send_empty_frame(state, id);
+        return 0;
+    }
+
+    int video_bitrate = network_settings.video_bitrate * (1.0 - network_settings.video_fec_ratio);
+    FATAL_ASSERT(video_bitrate > 0);
+    CodecType video_codec = network_settings.desired_codec;
+
+    if (memcmp(&network_settings, last_network_settings, sizeof(NetworkSettings)) != 0) {
+        // Mark to update the encode, if the network settings have been updated
+        state->update_encoder = true;
+        *last_network_settings = network_settings;
+    }
+
+    // A new encoder is needed after an Nvidia encoder was released along with the capture device
+    if (*encoder == NULL) {
+        state->update_encoder = true;
+    }
+
+    // Update encoder with new parameters
+    if (state->update_encoder) {
+        start_timer(&statistics_timer);
+        double burst_bitrate_ratio =
+            (double)network_settings.burst_bitrate / network_settings.video_bitrate;
+        int vbv_size = (VBV_IN_SEC_BY_BURST_BITRATE_RATIO * video_bitrate * burst_bitrate_ratio);
+        *encoder = update_video_encoder(state, *encoder, slot->frame.width, slot->frame.height,
+                                        video_bitrate, video_codec, vbv_size);
+        log_double_statistic(VIDEO_ENCODER_UPDATE_TIME,
+                             get_timer(&statistics_timer) * MS_IN_SECOND);
+    }
+
+    // transfer the capture of the latest frame to the encoder,
+    // This function will try to CUDA/OpenGL optimize the transfer by
+    // only passing a GPU reference rather than copy to/from the CPU
+    start_timer(&statistics_timer);
+    bool force_iframe = false;
+    if (transfer_capture(&slot->frame, *encoder, &force_iframe) != 0) {
+        // If there was a failure, exit
+        LOG_ERROR("transfer_capture failed! Exiting!");
+        return -1;
+    }
+    if (force_iframe) {
+        state->stream_needs_restart = true;
+    }
+    log_double_statistic(VIDEO_CAPTURE_TRANSFER_TIME, get_timer(&statistics_timer) * MS_IN_SECOND);
+
+    VideoFrameType frame_type;
+    if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
+        if (state->stream_needs_restart || state->stream_needs_recovery) {
+            if (state->stream_needs_restart) {
+                ltr_force_intra(state->ltr_context);
+            } else {
+                ltr_mark_stream_broken(state->ltr_context);
+            }
+            state->stream_needs_restart = false;
+            state->stream_needs_recovery = false;
+        }
+
+        LTRAction ltr_action;
+        ltr_get_next_action(state->ltr_context, &ltr_action, id);
+
+        if (LOG_LONG_TERM_REFERENCE_FRAMES) {
+            LOG_INFO("LTR action for frame ID %d: { %s, %d }", id,
+                     video_frame_type_string(ltr_action.frame_type),
+                     ltr_action.long_term_frame_index);
+        }
+
+        video_encoder_set_ltr_action(*encoder, &ltr_action);
+        frame_type = ltr_action.frame_type;
+    } else {
+        if (state->stream_needs_restart || state->stream_needs_recovery) {
+            video_encoder_set_iframe(*encoder);
+            frame_type = VIDEO_FRAME_TYPE_INTRA;
+        } else {
+            frame_type = VIDEO_FRAME_TYPE_NORMAL;
+        }
+        state->stream_needs_restart = false;
+        state->stream_needs_recovery = false;
+    }
+
+    start_timer(&statistics_timer);
+
+    int res = video_encoder_encode(*encoder);
+    if (res < 0) {
+        // bad boy error
+        LOG_ERROR("Error encoding video frame!");
+        return -1;
+    } else if (res > 0) {
+        // filter graph is empty
+        LOG_ERROR("video_encoder_encode filter graph failed! Exiting!");
+        return -1;
+    }
+    if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
+        // Ensure that the encoder actually generated the
+        // frame type we expected.  If it didn't then
+        // something has gone horribly wrong.
+        FATAL_ASSERT((*encoder)->frame_type == frame_type);
+    }
+    log_double_statistic(VIDEO_ENCODE_TIME, get_timer(&statistics_timer) * MS_IN_SECOND);
+
+    if ((*encoder)->encoded_frame_size != 0) {
+        if ((*encoder)->encoded_frame_size > MAX_VIDEOFRAME_DATA_SIZE) {
+            // Please make MAX_VIDEOFRAME_DATA_SIZE larger if this error happens
+            LOG_ERROR("Frame of size %zu bytes is too large! Dropping Frame.",
+                      (*encoder)->encoded_frame_size);
+        } else {
+            if (SAVE_VIDEO_OUTPUT) {
+                for (int i = 0; i < (*encoder)->num_packets; i++) {
+                    fwrite((*encoder)->packets[i]->data, (*encoder)->packets[i]->size, 1, fp);
+                }
+                fflush(fp);
+            }
+            send_populated_frames(state, *encoder, slot, id);
+
+            log_double_statistic(VIDEO_FPS_SENT, 1.0);
+            log_double_statistic(VIDEO_FRAME_SIZE, (*encoder)->encoded_frame_size);
+            // From the end of the capture to the hand-off to the send thread
+            log_double_statistic(VIDEO_FRAME_PROCESSING_TIME,
+                                 (double)(current_time_us() - slot->capture_timestamp) / US_IN_MS);
+            if (VIDEO_FRAME_TYPE_IS_RECOVERY_POINT((*encoder)->frame_type))
+                log_double_statistic(VIDEO_NUM_RECOVERY_FRAMES, 1.0);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief                   Finishes a flush that the capture thread asked for with
+ *                          flush_encode_thread(). Called by the encode thread.
+ *
+ * @param state             The Whist server state
+ * @param encoder           Pointer to the VideoEncoder pointer, which may be set to NULL
+ */
+static void handle_encode_flush(WhistServerState* state, VideoEncoder** encoder) {
+    encode_flush_requested = false;
+    // Drop the queued frame, which came from the capture device that's about to change
+    int slot_index = triple_buffer_acquire(capture_queue);
+    if (slot_index >= 0 && capture_slots[slot_index].is_on_gpu) {
+        whist_post_semaphore(gpu_frame_released);
+    }
+    if (encode_flush_releases_encoder) {
+        // If an encoder is pending, then we should wait for it to be created
+        while (state->pending_encoder) {
+            if (state->encoder_finished) {
+                if (*encoder != NULL) {
+                    multithreaded_destroy_encoder(*encoder);
+                }
+                *encoder = state->encoder_factory_result;
+                state->pending_encoder = false;
+                break;
+            }
+            whist_sleep(1);
+        }
+        // The Nvidia Encoder must be wrapped in the lifetime of the capture device
+        if (*encoder != NULL && (*encoder)->active_encoder == NVIDIA_ENCODER) {
+            multithreaded_destroy_encoder(*encoder);
+            *encoder = NULL;
+        }
+    }
+    whist_post_semaphore(encode_flush_done);
+}
+
+// Encoding is done on a separate thread, so that the capture thread can capture the next frame
+// while this one is being encoded.
+static int32_t multithreaded_encode_video(void* opaque) {
+    WhistServerState* state = (WhistServerState*)opaque;
+
+    whist_set_thread_priority(WHIST_THREAD_PRIORITY_REALTIME);
+
+    // When SAVE_VIDEO_OUTPUT is enabled the encoded video output is stored as per the filepath
+    // passed to fopen(). This is primarily used for debugging the protocol testing framework, where
+    // the client also runs in cloud. The saved h264 file can be transferred to the laptop and can
+    // be converted to mp4 using the ffmpeg command below. "ffmpeg -i output.h264 -c copy
+    // output.mp4" The mp4 output can be played in VLC media player (or any other player of your
+    // choice)
+    FILE* fp = NULL;
+    if (SAVE_VIDEO_OUTPUT) {
+        fp = fopen("/var/log/whist/output.h264", "wb");
+    }
+
+    VideoEncoder* encoder = NULL;
+    NetworkSettings last_network_settings = {0};
+    int id = 1;
+
+    while (true) {
+        triple_buffer_wait(capture_queue, -1);
+        if (encode_flush_requested) {
+            handle_encode_flush(state, &encoder);
+            continue;
+        }
+        if (!run_multithreaded_encode_video) {
+            break;
+        }
+        int slot_index = triple_buffer_acquire(capture_queue);
+        if (slot_index < 0) {
+            continue;
+        }
+        CaptureSlot* slot = &capture_slots[slot_index];
+
+        // Increment the Frame ID so that each frame we send gets its own unique ID.
+        // The decoder will ensure to decode frames in the order of these IDs,
+        // _Or_ skip to the next I-Frame.
+        id++;
+
+        // After a failure, keep taking frames until the capture thread stops, so that it never
+        // waits for us
+        if (!encode_failed &&
+            encode_captured_frame(state, &encoder, slot, id, &last_network_settings, fp) != 0) {
+            encode_failed = true;
+            state->exiting = true;
+        }
+        if (slot->is_on_gpu) {
+            whist_post_semaphore(gpu_frame_released);
+        }
+    }
+
+    if (SAVE_VIDEO_OUTPUT) {
+        fclose(fp);
+    }
+    // The Nvidia Encoder must be wrapped in the lifetime of the capture device,
+    // So the capture thread only destroys the device once we've destroyed the encoder
+    if (encoder) {
+        multithreaded_destroy_encoder(encoder);
+        encoder = NULL;
+    }
+    return 0;
+}
+
 // Video packet sending over UDP is done a separate thread to maximally utilize the available
 // bandwidth, without dropping frames.
 static int32_t multithreaded_send_video_packets(void* opaque) {
@@ -520,9 +1092,12 @@ static int32_t multithreaded_send_video_packets(void* opaque) {
         VideoFrame* frame = (VideoFrame*)encoded_frame_buf[currently_sending_index];
         ClientLock* client_lock = client_active_trylock(state->client);
         if (client_lock != NULL) {
-            packet_sent = send_packet(&state->client->udp_context, PACKET_VIDEO, frame,
-                                      get_total_frame_size(frame), send_frame_id,
-                                      VIDEO_FRAME_TYPE_IS_RECOVERY_POINT(frame->frame_type));
+            WhistIOVec frame_iov[1 + MAX_ENCODER_PACKETS];
+            int frame_iov_count = get_encoded_frame_iov(currently_sending_index, frame_iov);
+            packet_sent =
+                udp_send_packet_iov(&state->client->udp_context, PACKET_VIDEO, frame_iov,
+                                    frame_iov_count, send_frame_id,
+                                    VIDEO_FRAME_TYPE_IS_RECOVERY_POINT(frame->frame_type));
             if (packet_sent != 0) {
                 LOG_WARNING("Failed to send the video packet!");
             }
@@ -561,34 +1136,22 @@ int32_t multithreaded_send_video(void* opaque) {
     SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE);
 #endif
 
-    // When SAVE_VIDEO_OUTPUT is enabled the encoded video output is stored as per the filepath
-    // passed to fopen(). This is primarily used for debugging the protocol testing framework, where
-    // the client also runs in cloud. The saved h264 file can be transferred to the laptop and can
-    // be converted to mp4 using the ffmpeg command below. "ffmpeg -i output.h264 -c copy
-    // output.mp4" The mp4 output can be played in VLC media player (or any other player of your
-    // choice)
-    FILE* fp;
-    if (SAVE_VIDEO_OUTPUT) {
-        fp = fopen("/var/log/whist/output.h264", "wb");
-    }
-
     // Capture Device
     CaptureDevice rdevice;
     CaptureDevice* device = NULL;
 
     whist_cursor_capture_init();
 
-    VideoEncoder* encoder = NULL;
-
     WhistTimer world_timer;
     start_timer(&world_timer);
 
     WhistTimer statistics_timer;
 
-    int id = 1;
     state->update_device = true;
 
-    int start_frame_id = id;
+    // The number of frames queued for the encode thread, to keep up with min_fps
+    int queued_frames = 0;
+    int start_queued_frames = queued_frames;
     WhistTimer start_frame_timer;
     start_timer(&start_frame_timer);
     WhistTimer last_frame_timer;
@@ -597,8 +1160,6 @@ int32_t multithreaded_send_video(void* opaque) {
     state->pending_encoder = false;
     state->encoder_finished = false;
 
-    NetworkSettings last_network_settings = {0};
-
     // Create producer-consumer semaphore pair with queue size of 1
     producer = whist_create_semaphore(0);
     consumer = whist_create_semaphore(1);
@@ -606,6 +1167,22 @@ int32_t multithreaded_send_video(void* opaque) {
     WhistThread video_send_packets = whist_create_thread(multithreaded_send_video_packets,
                                                          "multithreaded_send_video_packets", state);
 
+    // Create the capture queue, and the encode thread that takes frames from it
+    capture_queue = triple_buffer_create();
+    FATAL_ASSERT(capture_queue != NULL);
+    tile_hasher = create_tile_hasher();
+    memset(capture_slots, 0, sizeof(capture_slots));
+    num_new_rects = 0;
+    num_unencoded_rects = 0;
+    gpu_frame_released = whist_create_semaphore(0);
+    gpu_frame_in_flight = false;
+    encode_flush_done = whist_create_semaphore(0);
+    encode_flush_requested = false;
+    encode_failed = false;
+    run_multithreaded_encode_video = true;
+    WhistThread video_encode =
+        whist_create_thread(multithreaded_encode_video, "multithreaded_encode_video", state);
+
     int consecutive_identical_frames = 0;
 
     // Wait for the client to lock
@@ -622,6 +1199,11 @@ int32_t multithreaded_send_video(void* opaque) {
             break;
         }
 
+        // If encoding failed, the server is exiting
+        if (encode_failed) {
+            break;
+        }
+
         // If a new connection occured, restart the stream
         if (previous_connection_id != state->client->connection_id) {
             state->stream_needs_restart = true;
@@ -660,55 +1242,19 @@ int32_t multithreaded_send_video(void* opaque) {
 
         // If we got an update device request, we should update the device
         if (state->update_device) {
-            update_current_device(state, &statistics_timer, device, encoder, true_width,
-                                  true_height);
+            update_current_device(state, &statistics_timer, device, true_width, true_height);
             state->stream_needs_restart = true;
         }
 
         // If no device is set, we need to create one
         if (device == NULL) {
-            if (create_new_device(state, &statistics_timer, &device, &rdevice, &encoder, true_width,
+            if (create_new_device(state, &statistics_timer, &device, &rdevice, true_width,
                                   true_height) < 0) {
                 continue;
             }
             state->stream_needs_restart = true;
         }
 
-        network_settings = udp_get_network_settings(&state->client->udp_context);
-
-        int video_bitrate =
-            network_settings.video_bitrate * (1.0 - network_settings.video_fec_ratio);
-        FATAL_ASSERT(video_bitrate > 0);
-        CodecType video_codec = network_settings.desired_codec;
-
-        if (memcmp(&network_settings, &last_network_settings, sizeof(NetworkSettings)) != 0) {
-            // Mark to update the encode, if the network settings have been updated
-            state->update_encoder = true;
-            last_network_settings = network_settings;
-        }
-
-        // Update encoder with new parameters
-        if (state->update_encoder) {
-            start_timer(&statistics_timer);
-            double burst_bitrate_ratio =
-                (double)network_settings.burst_bitrate / network_settings.video_bitrate;
-            int vbv_size =
-                (VBV_IN_SEC_BY_BURST_BITRATE_RATIO * video_bitrate * burst_bitrate_ratio);
-            encoder =
-                update_video_encoder(state, encoder, device, video_bitrate, video_codec, vbv_size);
-            log_double_statistic(VIDEO_ENCODER_UPDATE_TIME,
-                                 get_timer(&statistics_timer) * MS_IN_SECOND);
-        }
-
-        if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
-            // If any frame acks have been received, tell the frame type
-            // decision logic about them.
-            if (state->update_frame_ack) {
-                ltr_mark_frame_received(state->ltr_context, state->frame_ack_id);
-                state->update_frame_ack = false;
-            }
-        }
-
         // Get this timestamp before we capture the screen,
         // To measure the full pre-capture to post-render E2E latency
         timestamp_us server_timestamp = current_time_us();
@@ -724,16 +1270,21 @@ int32_t multithreaded_send_video(void* opaque) {
 
         // SENDING LOGIC:
         // first, we call capture_screen, which returns how many frames have passed since the last
-        // call to capture_screen, If we are using Nvidia, the captured frame is also
-        // hardware-encoded. Otherwise, we pass the most recent frame to our encoder and call
-        // video_encoder_encode_frame on it. Then, we send encoded frames to the client. If the
-        // frames we encode + send are a subset of the frames we capture, that means we are dropping
-        // frames, which is suboptimal and should be investigated.
+        // call to capture_screen. Then we queue the most recent frame for the encode thread, which
+        // encodes it and hands it to the send thread, while we go on to capture the next one. If
+        // the frames we encode + send are a subset of the frames we capture, that means we are
+        // dropping frames, which is suboptimal and should be investigated.
 
         // Accumulated_frames is equal to how many frames have passed since the
         // last call to CaptureScreen
         int accumulated_frames = 0;
         if ((!state->stop_streaming || state->stream_needs_restart)) {
+            // The device overwrites its texture on every capture, so wait for the encode thread to
+            // be done with the last one
+            if (gpu_frame_in_flight) {
+                whist_wait_semaphore(gpu_frame_released);
+                gpu_frame_in_flight = false;
+            }
             start_timer(&statistics_timer);
             accumulated_frames = capture_screen(device);
             if (accumulated_frames > 1) {
@@ -745,19 +1296,25 @@ int32_t multithreaded_send_video(void* opaque) {
             }
             // If capture screen failed, we should try again
             if (accumulated_frames < 0) {
-                retry_capture_screen(state, &device, &encoder);
+                retry_capture_screen(state, &device);
                 continue;
             }
-            // Immediately bring consecutives to 0, when a new frame is captured
             if (accumulated_frames > 0) {
-                consecutive_identical_frames = 0;
                 log_double_statistic(VIDEO_CAPTURE_SCREEN_TIME,
                                      get_timer(&statistics_timer) * MS_IN_SECOND);
+                // Damage that didn't change any pixels doesn't make a new frame, so that the
+                // encoder still idles through it
+                if (!filter_captured_damage(device)) {
+                    accumulated_frames = 0;
+                }
+            }
+            // Immediately bring consecutives to 0, when a new frame is captured
+            if (accumulated_frames > 0) {
+                consecutive_identical_frames = 0;
+                add_captured_damage(device);
             }
         }
-
-        WhistTimer server_frame_timer;
-        start_timer(&server_frame_timer);
+        timestamp_us capture_timestamp = current_time_us();
 
         // Disable the encoder when we've sent enough identical frames,
         // And no iframe is being requested at this time.
@@ -773,14 +1330,15 @@ int32_t multithreaded_send_video(void* opaque) {
         // situation, such as network throttling)
         if (get_timer(&start_frame_timer) > AVG_FPS_DURATION) {
             start_timer(&start_frame_timer);
-            start_frame_id = id;
+            start_queued_frames = queued_frames;
         }
 
         // This outer loop potentially runs 10s of thousands of times per second, every ~1usec
 
         // Send a frame if we have a real frame to send, or we need to keep up with min_fps
         if ((accumulated_frames > 0 || state->stream_needs_restart ||
-             (get_timer(&start_frame_timer) > (double)(id - start_frame_id) / min_fps &&
+             (get_timer(&start_frame_timer) >
+                  (double)(queued_frames - start_queued_frames) / min_fps &&
               get_timer(&last_frame_timer) > 1.0 / min_fps))) {
             // This loop only runs ~1/current_fps times per second, every 16-100ms
             start_timer(&last_frame_timer);
@@ -793,111 +1351,13 @@ int32_t multithreaded_send_video(void* opaque) {
                 LOG_INFO("Accumulated Frames: %d", accumulated_frames);
             }
 
-            // Increment the Frame ID so that each frame we send gets its own unique ID.
-            // The decoder will ensure to decode frames in the order of these IDs,
-            // _Or_ skip to the next I-Frame.
-            id++;
-
-            if (disable_encoder) {
-                // Send an empty frame
-                send_empty_frame(state, id);
-            } else {
-                // transfer the capture of the latest frame from the device to
-                // the encoder,
-                // This function will try to CUDA/OpenGL optimize the transfer by
-                // only passing a GPU reference rather than copy to/from the CPU
-                start_timer(&statistics_timer);
-                if (transfer_capture(device, encoder, &state->stream_needs_restart) != 0) {
-                    // If there was a failure, exit
-                    LOG_ERROR("transfer_capture failed! Exiting!");
-                    state->exiting = true;
-                    break;
-                }
-                log_double_statistic(VIDEO_CAPTURE_TRANSFER_TIME,
-                                     get_timer(&statistics_timer) * MS_IN_SECOND);
-
-                VideoFrameType frame_type;
-                if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
-                    if (state->stream_needs_restart || state->stream_needs_recovery) {
-                        if (state->stream_needs_restart) {
-                            ltr_force_intra(state->ltr_context);
-                        } else {
-                            ltr_mark_stream_broken(state->ltr_context);
-                        }
-                        state->stream_needs_restart = false;
-                        state->stream_needs_recovery = false;
-                    }
-
-                    LTRAction ltr_action;
-                    ltr_get_next_action(state->ltr_context, &ltr_action, id);
-
-                    if (LOG_LONG_TERM_REFERENCE_FRAMES) {
-                        LOG_INFO("LTR action for frame ID %d: { %s, %d }", id,
-                                 video_frame_type_string(ltr_action.frame_type),
-                                 ltr_action.long_term_frame_index);
-                    }
-
-                    video_encoder_set_ltr_action(encoder, &ltr_action);
-                    frame_type = ltr_action.frame_type;
-                } else {
-                    if (state->stream_needs_restart || state->stream_needs_recovery) {
-                        video_encoder_set_iframe(encoder);
-                        frame_type = VIDEO_FRAME_TYPE_INTRA;
-                    } else {
-                        frame_type = VIDEO_FRAME_TYPE_NORMAL;
-                    }
-                    state->stream_needs_restart = false;
-                    state->stream_needs_recovery = false;
-                }
-
-                start_timer(&statistics_timer);
-
-                int res = video_encoder_encode(encoder);
-                if (res < 0) {
-                    // bad boy error
-                    LOG_ERROR("Error encoding video frame!");
-                    state->exiting = true;
-                    break;
-                } else if (res > 0) {
-                    // filter graph is empty
-                    LOG_ERROR("video_encoder_encode filter graph failed! Exiting!");
-                    state->exiting = true;
-                    break;
-                }
-                if (FEATURE_ENABLED(LONG_TERM_REFERENCE_FRAMES)) {
-                    // Ensure that the encoder actually generated the
-                    // frame type we expected.  If it didn't then
-                    // something has gone horribly wrong.
-                    FATAL_ASSERT(encoder->frame_type == frame_type);
-                }
-                log_double_statistic(VIDEO_ENCODE_TIME,
-                                     get_timer(&statistics_timer) * MS_IN_SECOND);
-
-                if (encoder->encoded_frame_size != 0) {
-                    if (encoder->encoded_frame_size > MAX_VIDEOFRAME_DATA_SIZE) {
-                        // Please make MAX_VIDEOFRAME_DATA_SIZE larger if this error happens
-                        LOG_ERROR("Frame of size %zu bytes is too large! Dropping Frame.",
-                                  encoder->encoded_frame_size);
-                        continue;
-                    } else {
-                        if (SAVE_VIDEO_OUTPUT) {
-                            for (int i = 0; i < encoder->num_packets; i++) {
-                                fwrite(encoder->packets[i]->data, encoder->packets[i]->size, 1, fp);
-                            }
-                            fflush(fp);
-                        }
-                        send_populated_frames(state, &statistics_timer, &server_frame_timer, device,
-                                              encoder, id, client_input_timestamp,
-                                              server_timestamp);
-
-                        log_double_statistic(VIDEO_FPS_SENT, 1.0);
-                        log_double_statistic(VIDEO_FRAME_SIZE, encoder->encoded_frame_size);
-                        log_double_statistic(VIDEO_FRAME_PROCESSING_TIME,
-                                             get_timer(&server_frame_timer) * MS_IN_SECOND);
-                        if (VIDEO_FRAME_TYPE_IS_RECOVERY_POINT(encoder->frame_type))
-                            log_double_statistic(VIDEO_NUM_RECOVERY_FRAMES, 1.0);
-                    }
-                }
+            // An empty frame must not replace a real frame that the encode thread hasn't taken
+            // yet, or that frame's changes would never be encoded. The queued frame is sent soon
+            // anyway, which keeps up with min_fps just the same.
+            if (!disable_encoder || !triple_buffer_is_pending(capture_queue)) {
+                queue_captured_frame(state, device, disable_encoder, client_input_timestamp,
+                                     server_timestamp, capture_timestamp);
+                queued_frames++;
             }
         } else {
             whist_usleep(100);  // Sleep for 0.1ms before trying again.
@@ -909,22 +1369,36 @@ int32_t multithreaded_send_video(void* opaque) {
         client_active_unlock(client_lock);
     }
 
+    // Stop the encode thread, which destroys the encoder
+    run_multithreaded_encode_video = false;
+    triple_buffer_wake(capture_queue);
+    whist_wait_thread(video_encode, NULL);
+    triple_buffer_destroy(capture_queue);
+    capture_queue = NULL;
+    destroy_tile_hasher(tile_hasher);
+    tile_hasher = NULL;
+    whist_destroy_semaphore(gpu_frame_released);
+    whist_destroy_semaphore(encode_flush_done);
+    for (int i = 0; i < TRIPLE_BUFFER_SLOTS; i++) {
+        free(capture_slots[i].pixels);
+        free(capture_slots[i].cursor);
+    }
+    memset(capture_slots, 0, sizeof(capture_slots));
+
     whist_cursor_capture_destroy();
 
-    if (SAVE_VIDEO_OUTPUT) {
-        fclose(fp);
-    }
     // Post this to unblock `multithreaded_send_video_packets()` semaphore waits
     run_multithreaded_send_video_packets = false;
     whist_post_semaphore(producer);
     whist_wait_thread(video_send_packets, NULL);
     whist_destroy_semaphore(consumer);
     whist_destroy_semaphore(producer);
-    // The Nvidia Encoder must be wrapped in the lifetime of the capture device,
-    // So we destroy the encoder first
-    if (encoder) {
-        multithreaded_destroy_encoder(encoder);
-        encoder = NULL;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < MAX_ENCODER_PACKETS; j++) {
+            // av_packet_free ignores packets that were never allocated
+            av_packet_free(&encoded_frame_packets[i][j]);
+        }
+        encoded_frame_num_packets[i] = 0;
     }
     if (device) {
         destroy_capture_device(device);
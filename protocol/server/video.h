@@ -20,9 +20,11 @@ Public Functions
 */
 
 /**
- * @brief                          This loops and captures video frames, encodes
- *                                 them if needed, and sends them to the client
- *                                 along with cursor images if necessary
+ * @brief                          This loops and captures video frames, and
+ *                                 queues them for its encode thread, which
+ *                                 encodes them if needed and has them sent to
+ *                                 the client along with cursor images if
+ *                                 necessary
  */
 int32_t multithreaded_send_video(void* opaque);
 
@@ -12,6 +12,9 @@ extern "C" {
 #include "whist/video/codec/decode.h"
 #include "whist/video/capture/capture.h"
 #include "whist/video/ltr.h"
+#include "whist/video/dirty_rects.h"
+#include "whist/video/rgb_to_yuv/rgb_to_yuv.h"
+#include "whist/video/tile_hash/tile_hash.h"
 }
 
 class CodecTest : public CaptureStdoutFixture {};
@@ -232,6 +235,76 @@ TEST_F(CodecTest, EncodeDecodeTest) {
     free(packet_buffer);
 }
 
+// Encode with dirty rect hints that only cover the blocks of the image which changed.
+TEST_F(CodecTest, DirtyRectEncodeTest) {
+    int width = 1280;
+    int height = 720;
+    int pitch = 4 * width;
+    int bitrate = 1000000;
+    uint8_t *image_rgb_in = (uint8_t *)malloc(pitch * height);
+    EXPECT_TRUE(image_rgb_in);
+
+    size_t packet_buffer_size = 4 * 1024 * 1024;
+    uint8_t *packet_buffer = (uint8_t *)malloc(packet_buffer_size);
+    EXPECT_TRUE(packet_buffer);
+
+    VideoEncoder *enc =
+        create_video_encoder(width, height, bitrate, bitrate / MAX_FPS, CODEC_TYPE_H264);
+    EXPECT_TRUE(enc);
+
+    VideoDecoder *dec = create_video_decoder(width, height, false, CODEC_TYPE_H264);
+    EXPECT_TRUE(dec);
+
+    int ret;
+    for (int frame = 0; frame < 30; frame++) {
+        test_write_image(image_rgb_in, width, height, pitch, frame);
+
+        // Each bit of the value is a block of the image, so mark the blocks whose bit flipped.
+        WhistRect rects[MAX_DIRTY_RECTS];
+        int num_rects = 0;
+        int changed_bits = frame == 0 ? 0xffff : frame ^ (frame - 1);
+        for (int bit = 0; bit < 16; bit++) {
+            if (changed_bits & (1 << bit)) {
+                WhistRect block = {bit % 4 * width / 4, bit / 4 * height / 4, width / 4,
+                                   height / 4};
+                dirty_rects_add(rects, &num_rects, block, width, height);
+            }
+        }
+
+        ret = ffmpeg_encoder_frame_intake(enc->ffmpeg_encoder, image_rgb_in, pitch);
+        EXPECT_EQ(ret, 0);
+        ffmpeg_encoder_set_dirty_rects(enc->ffmpeg_encoder, rects, num_rects);
+
+        ret = video_encoder_encode(enc);
+        EXPECT_EQ(ret, 0);
+        EXPECT_LT(enc->encoded_frame_size, packet_buffer_size);
+
+        write_avpackets_to_buffer(enc->num_packets, enc->packets, packet_buffer);
+
+        ret = video_decoder_send_packets(dec, packet_buffer, enc->encoded_frame_size, frame == 0);
+        EXPECT_EQ(ret, 0);
+
+        ret = video_decoder_decode_frame(dec);
+        EXPECT_EQ(ret, 0);
+
+        DecodedFrameData decode_out = video_decoder_get_last_decoded_frame(dec);
+
+        // The static blocks are still right, having been skipped rather than coded coarsely.
+        AVFrame *frame_out = decode_out.decoded_frame;
+        int value =
+            test_read_image(frame_out->data[0], width, height, frame_out->linesize[0], false);
+        EXPECT_EQ(value, frame);
+
+        video_decoder_free_decoded_frame(&decode_out);
+    }
+
+    destroy_video_encoder(enc);
+    destroy_video_decoder(dec);
+
+    free(image_rgb_in);
+    free(packet_buffer);
+}
+
 // Capture a stream from an MP4 file.
 TEST_F(CodecTest, CaptureMP4Test) {
     file_capture_set_input_filename("assets/100-frames-h264.mp4");
@@ -454,3 +527,203 @@ TEST_F(CodecTest, LTRRecoveryTest) {
 
     ltr_destroy(ltr);
 }
+
+TEST_F(CodecTest, DirtyRectsTest) {
+    WhistRect rects[MAX_DIRTY_RECTS];
+    int num_rects = 0;
+
+    // Rectangles are clipped to the frame, and empty ones are dropped.
+    dirty_rects_add(rects, &num_rects, {-10, -10, 20, 30}, 100, 100);
+    EXPECT_EQ(num_rects, 1);
+    EXPECT_EQ(rects[0].x, 0);
+    EXPECT_EQ(rects[0].y, 0);
+    EXPECT_EQ(rects[0].width, 10);
+    EXPECT_EQ(rects[0].height, 20);
+    dirty_rects_add(rects, &num_rects, {100, 0, 10, 10}, 100, 100);
+    EXPECT_EQ(num_rects, 1);
+
+    // Side-by-side rectangles of the same height merge without covering anything extra.
+    dirty_rects_add(rects, &num_rects, {10, 0, 15, 20}, 100, 100);
+    EXPECT_EQ(num_rects, 1);
+    EXPECT_EQ(rects[0].width, 25);
+    EXPECT_EQ(dirty_rects_area(rects, num_rects), 25 * 20);
+
+    // A thin rectangle touching a corner stays separate rather than growing a square.
+    dirty_rects_add(rects, &num_rects, {25, 20, 1, 60}, 100, 100);
+    EXPECT_EQ(num_rects, 2);
+
+    // A rectangle covering both merges them all.
+    dirty_rects_add(rects, &num_rects, {0, 0, 30, 80}, 100, 100);
+    EXPECT_EQ(num_rects, 1);
+    EXPECT_EQ(dirty_rects_area(rects, num_rects), 30 * 80);
+    EXPECT_FALSE(dirty_rects_cover_frame(rects, num_rects, 100, 100));
+
+    // When the list is full, new damage is still covered.
+    num_rects = 0;
+    for (int i = 0; i < MAX_DIRTY_RECTS + 4; i++) {
+        dirty_rects_add(rects, &num_rects, {(i % 5) * 20, (i / 5) * 20, 2, 2}, 100, 100);
+    }
+    EXPECT_LE(num_rects, MAX_DIRTY_RECTS);
+    for (int i = 0; i < MAX_DIRTY_RECTS + 4; i++) {
+        int x = (i % 5) * 20, y = (i / 5) * 20;
+        bool covered = false;
+        for (int j = 0; j < num_rects; j++) {
+            covered |= rects[j].x <= x && rects[j].y <= y && rects[j].x + rects[j].width >= x + 2 &&
+                       rects[j].y + rects[j].height >= y + 2;
+        }
+        EXPECT_TRUE(covered);
+    }
+
+    dirty_rects_add(rects, &num_rects, {0, 0, 100, 100}, 100, 100);
+    EXPECT_TRUE(dirty_rects_cover_frame(rects, num_rects, 100, 100));
+}
+
+TEST_F(CodecTest, RGBToYUVTest) {
+    // Not a multiple of any vector width, so the kernels finish rows with the scalar code, and
+    // tall enough to be split between threads.
+    const int width = 322, height = 258, rgb_pitch = width * 4 + 12;
+    const int pitches[3] = {width + 2, width / 2 + 2, width / 2 + 2};
+    const size_t plane_sizes[3] = {(size_t)pitches[0] * height, (size_t)pitches[1] * height / 2,
+                                   (size_t)pitches[2] * height / 2};
+
+    uint8_t *rgb = (uint8_t *)safe_malloc(rgb_pitch * height);
+    srand(42);
+    for (int i = 0; i < rgb_pitch * height; i++) {
+        rgb[i] = rand() & 0xff;
+    }
+    // Solid white and black blocks, which have exact limited-range values.
+    for (int y = 0; y < 2; y++) {
+        memset(rgb + y * rgb_pitch, 0xff, 8);
+        memset(rgb + y * rgb_pitch + 8, 0x00, 8);
+    }
+
+    uint8_t *reference[3], *output[3];
+    for (int i = 0; i < 3; i++) {
+        reference[i] = (uint8_t *)safe_malloc(plane_sizes[i]);
+        output[i] = (uint8_t *)safe_malloc(plane_sizes[i]);
+    }
+
+    rgb_to_yuv_set_max_kernel(RGB_TO_YUV_KERNEL_SCALAR);
+    RGBToYUVConverter *converter = create_rgb_to_yuv_converter(1);
+    rgb_to_yuv_convert(converter, rgb, rgb_pitch, reference, pitches, width, height);
+    destroy_rgb_to_yuv_converter(converter);
+
+    EXPECT_EQ(reference[0][0], 235);
+    EXPECT_EQ(reference[1][0], 128);
+    EXPECT_EQ(reference[2][0], 128);
+    EXPECT_EQ(reference[0][2], 16);
+    EXPECT_EQ(reference[1][1], 128);
+    EXPECT_EQ(reference[2][1], 128);
+
+    // Every supported kernel must match the scalar one exactly, whether or not the frame is split
+    // between threads.
+    for (int kernel = RGB_TO_YUV_KERNEL_SCALAR; kernel <= RGB_TO_YUV_KERNEL_AVX2; kernel++) {
+        rgb_to_yuv_set_max_kernel((RGBToYUVKernel)kernel);
+        if (rgb_to_yuv_get_kernel() != kernel) {
+            continue;
+        }
+        for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+            converter = create_rgb_to_yuv_converter(num_threads);
+            for (int i = 0; i < 3; i++) {
+                memset(output[i], 0, plane_sizes[i]);
+            }
+            rgb_to_yuv_convert(converter, rgb, rgb_pitch, output, pitches, width, height);
+            destroy_rgb_to_yuv_converter(converter);
+            for (int i = 0; i < 3; i++) {
+                int plane_width = i == 0 ? width : width / 2;
+                int plane_height = i == 0 ? height : height / 2;
+                for (int y = 0; y < plane_height; y++) {
+                    EXPECT_EQ(memcmp(output[i] + y * pitches[i], reference[i] + y * pitches[i],
+                                     plane_width),
+                              0)
+                        << rgb_to_yuv_kernel_to_str((RGBToYUVKernel)kernel) << " with "
+                        << num_threads << " threads, plane " << i << ", row " << y;
+                }
+            }
+        }
+    }
+    rgb_to_yuv_set_max_kernel(RGB_TO_YUV_KERNEL_AVX2);
+
+    for (int i = 0; i < 3; i++) {
+        free(reference[i]);
+        free(output[i]);
+    }
+    free(rgb);
+}
+
+TEST_F(CodecTest, TileHashTest) {
+    // Not a multiple of the tile size, or of any vector width, so the edge tiles are cut short and
+    // the kernels finish rows with the scalar code.
+    const int width = 203, height = 150, pitch = width * 4 + 12;
+    const int num_tiles = 4 * 3;
+
+    uint8_t *pixels = (uint8_t *)safe_malloc(pitch * height);
+    srand(42);
+    for (int i = 0; i < pitch * height; i++) {
+        pixels[i] = rand() & 0xff;
+    }
+
+    // Every supported kernel must match the scalar one exactly.
+    for (int tile_width = 1; tile_width <= TILE_HASH_SIZE; tile_width++) {
+        tile_hash_set_max_kernel(TILE_HASH_KERNEL_SCALAR);
+        uint64_t reference = tile_hash(pixels, pitch, tile_width, TILE_HASH_SIZE);
+        for (int kernel = TILE_HASH_KERNEL_SCALAR; kernel <= TILE_HASH_KERNEL_SSE2; kernel++) {
+            tile_hash_set_max_kernel((TileHashKernel)kernel);
+            if (tile_hash_get_kernel() != kernel) {
+                continue;
+            }
+            EXPECT_EQ(tile_hash(pixels, pitch, tile_width, TILE_HASH_SIZE), reference)
+                << tile_hash_kernel_to_str((TileHashKernel)kernel) << " with width "
+                << tile_width;
+        }
+    }
+    tile_hash_set_max_kernel(TILE_HASH_KERNEL_SSE2);
+
+    // Any single changed pixel changes the hash.
+    uint64_t hash = tile_hash(pixels, pitch, TILE_HASH_SIZE, TILE_HASH_SIZE);
+    for (int y = 0; y < TILE_HASH_SIZE; y += 7) {
+        for (int x = 0; x < TILE_HASH_SIZE * 4; x += 5) {
+            pixels[y * pitch + x] ^= 1;
+            EXPECT_NE(tile_hash(pixels, pitch, TILE_HASH_SIZE, TILE_HASH_SIZE), hash);
+            pixels[y * pitch + x] ^= 1;
+        }
+    }
+
+    // At first, every damaged tile counts as changed.
+    TileHasher *hasher = create_tile_hasher();
+    WhistRect rects[MAX_DIRTY_RECTS] = {{0, 0, width, height}};
+    int num_rects = 1;
+    EXPECT_EQ(tile_hasher_update(hasher, pixels, pitch, width, height, rects, &num_rects),
+              num_tiles);
+    EXPECT_EQ(tile_hasher_get_num_tiles(hasher), num_tiles);
+    EXPECT_EQ(num_rects, 1);
+    EXPECT_EQ(dirty_rects_area(rects, num_rects), width * height);
+
+    // Damage that doesn't change any pixels is dropped.
+    rects[0] = {10, 10, 100, 100};
+    num_rects = 1;
+    EXPECT_EQ(tile_hasher_update(hasher, pixels, pitch, width, height, rects, &num_rects), 0);
+    EXPECT_EQ(num_rects, 0);
+
+    // Damage is narrowed down to the changed tiles.
+    pixels[100 * pitch + 70 * 4] ^= 0xff;
+    rects[0] = {10, 10, 100, 100};
+    rects[1] = {150, 100, 20, 20};
+    num_rects = 2;
+    EXPECT_EQ(tile_hasher_update(hasher, pixels, pitch, width, height, rects, &num_rects), 1);
+    EXPECT_EQ(num_rects, 1);
+    EXPECT_EQ(rects[0].x, 64);
+    EXPECT_EQ(rects[0].y, 64);
+    EXPECT_EQ(rects[0].width, 46);
+    EXPECT_EQ(rects[0].height, 46);
+
+    // After a reset, nothing is known again.
+    tile_hasher_reset(hasher);
+    rects[0] = {0, 0, 1, 1};
+    num_rects = 1;
+    EXPECT_EQ(tile_hasher_update(hasher, pixels, pitch, width, height, rects, &num_rects), 1);
+    EXPECT_EQ(num_rects, 1);
+
+    destroy_tile_hasher(hasher);
+    free(pixels);
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file aes_benchmark.c
+ * @brief AES packet encryption benchmark.
+ *
+ * Measures how many packets per second a single core can encrypt and
+ * decrypt, both with the stateless encrypt_packet/decrypt_packet functions,
+ * which set up a new cipher context for every packet, and with an
+ * AESSession, which reuses pre-keyed cipher contexts.
+ */
+
+#include <whist/core/whist.h>
+#include "whist/utils/aes.h"
+#include "whist/utils/clock.h"
+#include "whist/utils/command_line.h"
+
+static int num_packets = 1000000;
+static int packet_size = 1400;
+
+COMMAND_LINE_INT_OPTION(num_packets, 'n', "packets", 1, INT_MAX,
+                        "Number of packets to encrypt and decrypt in each test.")
+COMMAND_LINE_INT_OPTION(packet_size, 's', "size", 1, 65536, "Size of each packet, in bytes.")
+
+typedef enum {
+    BENCHMARK_ENCRYPT,
+    BENCHMARK_DECRYPT,
+    BENCHMARK_SESSION_ENCRYPT,
+    BENCHMARK_SESSION_DECRYPT,
+} BenchmarkMode;
+
+static const char *mode_names[] = {
+    "encrypt_packet",
+    "decrypt_packet",
+    "aes_session_encrypt_packet",
+    "aes_session_decrypt_packet",
+};
+
+static double run_benchmark(BenchmarkMode mode, AESSession *session, const char *key,
+                            char *plaintext, char *ciphertext, AESMetadata *metadata) {
+    WhistIOVec plaintext_iov = {plaintext, packet_size};
+    WhistTimer timer;
+    start_timer(&timer);
+    for (int i = 0; i < num_packets; i++) {
+        int len;
+        switch (mode) {
+            case BENCHMARK_ENCRYPT: {
+                len = encrypt_packet(ciphertext, metadata, plaintext, packet_size, key);
+                break;
+            }
+            case BENCHMARK_DECRYPT: {
+                len = decrypt_packet(plaintext, packet_size, *metadata, ciphertext, packet_size,
+                                     key);
+                break;
+            }
+            case BENCHMARK_SESSION_ENCRYPT: {
+                len = aes_session_encrypt_packet(session, ciphertext, metadata, &plaintext_iov, 1);
+                break;
+            }
+            case BENCHMARK_SESSION_DECRYPT: {
+                len = aes_session_decrypt_packet(session, plaintext, packet_size, metadata,
+                                                 ciphertext, packet_size);
+                break;
+            }
+            default: {
+                LOG_FATAL("Unknown benchmark mode %d", mode);
+            }
+        }
+        if (len != packet_size) {
+            LOG_FATAL("%s failed on packet %d", mode_names[mode], i);
+        }
+    }
+    return num_packets / get_timer(&timer);
+}
+
+int main(int argc, const char **argv) {
+    WhistStatus err = whist_parse_command_line(argc, argv, NULL);
+    if (err != WHIST_SUCCESS) {
+        LOG_ERROR("Failed to parse command line: %s.", whist_error_string(err));
+        return 1;
+    }
+
+    whist_init_subsystems();
+
+    const char key[KEY_SIZE] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+                                0x0f, 0xed, 0xcb, 0xa9, 0x87, 0x65, 0x43, 0x21};
+    char *plaintext = safe_malloc(packet_size);
+    char *ciphertext = safe_malloc(packet_size + MAX_ENCRYPTION_SIZE_INCREASE);
+    for (int i = 0; i < packet_size; i++) {
+        plaintext[i] = (char)i;
+    }
+    AESMetadata metadata;
+
+    AESSession *session = create_aes_session(key, true);
+    if (session == NULL) {
+        LOG_ERROR("Failed to create AES session.");
+        return 1;
+    }
+
+    LOG_INFO("Running %d packets of %d bytes on a single thread.", num_packets, packet_size);
+
+    // Each decrypt benchmark decrypts the last packet of the preceding encrypt benchmark
+    double packets_per_sec[4];
+    for (int mode = BENCHMARK_ENCRYPT; mode <= BENCHMARK_SESSION_DECRYPT; mode++) {
+        packets_per_sec[mode] = run_benchmark(mode, session, key, plaintext, ciphertext, &metadata);
+        LOG_INFO("%-28s %12.0f packets/sec, %8.1f MB/sec", mode_names[mode], packets_per_sec[mode],
+                 packets_per_sec[mode] * packet_size / (BYTES_IN_KILOBYTE * BYTES_IN_KILOBYTE));
+    }
+    LOG_INFO("Session speedup: %.2fx encrypt, %.2fx decrypt",
+             packets_per_sec[BENCHMARK_SESSION_ENCRYPT] / packets_per_sec[BENCHMARK_ENCRYPT],
+             packets_per_sec[BENCHMARK_SESSION_DECRYPT] / packets_per_sec[BENCHMARK_DECRYPT]);
+
+    destroy_aes_session(session);
+    free(plaintext);
+    free(ciphertext);
+
+    destroy_logger();
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file gf256_benchmark.c
+ * @brief GF(256) multiply kernel benchmark.
+ *
+ * For every multiply kernel the CPU supports, measures the throughput of
+ * gf256_muladd_mem and gf256_mul_mem over the k original blocks of a
+ * cm256 encode, and of the whole cm256_encode, for the block sizes and
+ * original block counts that video frames use.
+ */
+
+#include <whist/core/whist.h>
+#include "whist/fec/gf256/gf256.h"
+#include "whist/fec/gf256/gf256_cpuinfo.h"
+#include "whist/fec/cm256/cm256.h"
+#include "whist/utils/clock.h"
+#include "whist/utils/command_line.h"
+
+static int block_size = 1285;
+static int fec_percent = 10;
+static int target_ms = 200;
+
+COMMAND_LINE_INT_OPTION(block_size, 's', "size", 1, 65536, "Size of each block, in bytes.")
+COMMAND_LINE_INT_OPTION(fec_percent, 'r', "fec-percent", 1, 100,
+                        "Recovery blocks per original block for cm256_encode, in percent.")
+COMMAND_LINE_INT_OPTION(target_ms, 't', "time", 1, 60000,
+                        "How long to run each measurement for, in milliseconds.")
+
+// The original block counts to measure
+static const int original_counts[] = {20, 32, 64, 128, 256};
+
+typedef enum {
+    BENCHMARK_MULADD,
+    BENCHMARK_MUL,
+    BENCHMARK_CM256_ENCODE,
+} BenchmarkMode;
+
+static const char *mode_names[] = {
+    "gf256_muladd_mem",
+    "gf256_mul_mem",
+    "cm256_encode",
+};
+
+static int get_recovery_count(int num_originals) {
+    return max(num_originals * fec_percent / 100, 1);
+}
+
+static double run_benchmark(BenchmarkMode mode, int num_originals, uint8_t *originals,
+                            uint8_t *recovery) {
+    cm256_block blocks[256];
+    cm256_encoder_params params;
+    if (mode == BENCHMARK_CM256_ENCODE) {
+        params.OriginalCount = num_originals;
+        params.RecoveryCount = get_recovery_count(num_originals);
+        params.BlockBytes = block_size;
+        for (int i = 0; i < num_originals; i++) {
+            blocks[i].Block = originals + (size_t)i * block_size;
+            blocks[i].Index = cm256_get_original_block_index(params, i);
+        }
+    }
+
+    // Every pass reads all of the originals once
+    size_t bytes_per_pass = (size_t)num_originals * block_size;
+    long long passes = 0;
+    WhistTimer timer;
+    start_timer(&timer);
+    double elapsed;
+    do {
+        for (int rep = 0; rep < 16; rep++) {
+            switch (mode) {
+                case BENCHMARK_MULADD: {
+                    for (int i = 0; i < num_originals; i++) {
+                        gf256_muladd_mem(recovery, (uint8_t)(i % 254 + 2),
+                                         originals + (size_t)i * block_size, block_size);
+                    }
+                    break;
+                }
+                case BENCHMARK_MUL: {
+                    for (int i = 0; i < num_originals; i++) {
+                        gf256_mul_mem(recovery, originals + (size_t)i * block_size,
+                                      (uint8_t)(i % 254 + 2), block_size);
+                    }
+                    break;
+                }
+                case BENCHMARK_CM256_ENCODE: {
+                    if (cm256_encode(params, blocks, recovery) != 0) {
+                        LOG_FATAL("cm256_encode failed with k=%d m=%d", params.OriginalCount,
+                                  params.RecoveryCount);
+                    }
+                    break;
+                }
+                default: {
+                    LOG_FATAL("Unknown benchmark mode %d", mode);
+                }
+            }
+        }
+        passes += 16;
+        elapsed = get_timer(&timer);
+    } while (elapsed * MS_IN_SECOND < target_ms);
+
+    return (double)passes * bytes_per_pass / elapsed / (1024.0 * 1024.0 * 1024.0);
+}
+
+int main(int argc, const char **argv) {
+    WhistStatus err = whist_parse_command_line(argc, argv, NULL);
+    if (err != WHIST_SUCCESS) {
+        LOG_ERROR("Failed to parse command line: %s.", whist_error_string(err));
+        return 1;
+    }
+
+    whist_init_subsystems();
+
+    if (gf256_init() != 0 || cm256_init() != 0) {
+        LOG_ERROR("Failed to initialize gf256.");
+        return 1;
+    }
+
+    uint8_t *originals = safe_malloc((size_t)256 * block_size);
+    uint8_t *recovery = safe_malloc((size_t)256 * block_size);
+    for (size_t i = 0; i < (size_t)256 * block_size; i++) {
+        originals[i] = (uint8_t)(i * 7 + 1);
+    }
+    memset(recovery, 0, (size_t)256 * block_size);
+
+    Gf256Kernel fastest_kernel = gf256_get_kernel();
+    LOG_INFO("Block size %d bytes, %d%% recovery blocks for cm256_encode, fastest kernel %s.",
+             block_size, fec_percent, gf256_kernel_to_str(fastest_kernel));
+
+    // Go from the fastest kernel down, so that the scalar numbers come last
+    for (int kernel = fastest_kernel; kernel >= GF256_KERNEL_SCALAR; kernel--) {
+        gf256_set_max_kernel((Gf256Kernel)kernel);
+        for (int mode = BENCHMARK_MULADD; mode <= BENCHMARK_CM256_ENCODE; mode++) {
+            for (size_t i = 0; i < ARRAY_LENGTH(original_counts); i++) {
+                int num_originals = original_counts[i];
+                if (mode == BENCHMARK_CM256_ENCODE) {
+                    // cm256 needs all block indices to fit in a byte
+                    num_originals = min(num_originals, 256 - get_recovery_count(num_originals));
+                }
+                double gb_per_sec = run_benchmark(mode, num_originals, originals, recovery);
+                LOG_INFO("%-6s %-16s k=%-3d %8.2f GB/sec", gf256_kernel_to_str(kernel),
+                         mode_names[mode], num_originals, gb_per_sec);
+            }
+        }
+    }
+    gf256_set_max_kernel(fastest_kernel);
+
+    free(originals);
+    free(recovery);
+
+    destroy_logger();
+
+    return 0;
+}
@@ -0,0 +1,778 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file network_emulator.c
+ * @brief Trace-driven network emulator, for benchmarking congestion control.
+ *
+ * Streams synthetic video frames from a server UDP context to a client UDP
+ * context on the same machine, through a loopback proxy that emulates the
+ * link between them: a bandwidth trace feeding a drop-tail queue, delay,
+ * jitter, reordering and Gilbert-Elliott loss. The UDP stack itself runs
+ * unmodified, so nacking, FEC and congestion control all react to the
+ * emulated link as they would to a real one.
+ *
+ * At the end, it reports how much of the link's capacity was used, the
+ * latency of the frames, how often the stream stalled, and how much FEC
+ * and nacking cost on top of the frames themselves.
+ *
+ * The bandwidth trace has a "<seconds> <bits per second>" pair per line,
+ * and each bitrate holds from its time until the next line's, the last one
+ * holding until the end of the run. Time zero is when the first video
+ * segment reaches the proxy, so the handshake doesn't eat into the trace.
+ *
+ * The frame trace has a frame size per line, in any unit, e.g. the sizes
+ * of the frames of a real encode. The sizes are scaled so that the frames
+ * average out to the bitrate that congestion control asks for, and the
+ * trace is looped if the run is longer than it. Without a frame trace, the
+ * frame sizes vary randomly around that bitrate, with larger keyframes.
+ */
+
+#include <whist/core/whist.h>
+#include "whist/core/whist_frame.h"
+#include "whist/network/network.h"
+#include "whist/network/network_algorithm.h"
+#include "whist/network/udp.h"
+#include "whist/utils/atomic.h"
+#include "whist/utils/clock.h"
+#include "whist/utils/command_line.h"
+#include "whist/utils/threads.h"
+#include "whist/logging/log_statistic.h"
+
+// Bytes of IP and UDP headers that each datagram costs on the emulated link
+#define EMULATOR_DATAGRAM_OVERHEAD 28
+// The most datagrams that can be in flight on each direction of the link
+#define EMULATOR_MAX_PACKETS_IN_FLIGHT 8192
+// How much bigger a keyframe is than an average frame, without a frame trace
+#define EMULATOR_KEYFRAME_SIZE_RATIO 4.0
+// How long to wait for the UDP handshake
+#define EMULATOR_CONNECTION_TIMEOUT_MS 5000
+
+static int duration = 30;
+static int fps = 60;
+static int bitrate = 20000000;
+static const char *bandwidth_trace_file = NULL;
+static const char *frame_trace_file = NULL;
+static int delay_ms = 20;
+static int jitter_ms = 0;
+static int reorder_permille = 0;
+static int reorder_ms = 10;
+static int queue_ms = 100;
+static int loss_enter_permille = 0;
+static int loss_exit_permille = 300;
+static int loss_bad_permille = 1000;
+static int loss_good_permille = 0;
+static int stall_ms = 200;
+static int width = 1920;
+static int height = 1080;
+static int dpi = 96;
+static int port = 32000;
+static int seed = 1;
+
+COMMAND_LINE_INT_OPTION(duration, 'd', "duration", 1, 3600, "How long to stream for, in seconds.")
+COMMAND_LINE_INT_OPTION(fps, 0, "fps", 1, 240, "Frames per second to send.")
+COMMAND_LINE_INT_OPTION(bitrate, 'b', "bitrate", 1, INT_MAX,
+                        "Bandwidth of the link, in bits per second, without a bandwidth trace.")
+COMMAND_LINE_STRING_OPTION(bandwidth_trace_file, 't', "bandwidth-trace", 4096,
+                           "File of \"<seconds> <bits per second>\" lines to vary the bandwidth "
+                           "with.")
+COMMAND_LINE_STRING_OPTION(frame_trace_file, 'f', "frame-trace", 4096,
+                           "File of frame sizes, one per line, to replay.")
+COMMAND_LINE_INT_OPTION(delay_ms, 0, "delay", 0, 10000, "One-way delay of the link, in ms.")
+COMMAND_LINE_INT_OPTION(jitter_ms, 0, "jitter", 0, 10000,
+                        "Most extra delay that a datagram can randomly get, in ms.")
+COMMAND_LINE_INT_OPTION(reorder_permille, 0, "reorder-chance", 0, 1000,
+                        "Chance of a datagram being held back, in thousandths.")
+COMMAND_LINE_INT_OPTION(reorder_ms, 0, "reorder-delay", 0, 10000,
+                        "How long reordered datagrams are held back for, in ms.")
+COMMAND_LINE_INT_OPTION(queue_ms, 0, "queue", 1, 10000,
+                        "Length of the bottleneck queue, in ms of the current bandwidth.")
+COMMAND_LINE_INT_OPTION(loss_enter_permille, 0, "loss-enter", 0, 1000,
+                        "Chance of the Gilbert-Elliott loss model going from the good state to "
+                        "the bad state on each datagram, in thousandths.")
+COMMAND_LINE_INT_OPTION(loss_exit_permille, 0, "loss-exit", 0, 1000,
+                        "Chance of the Gilbert-Elliott loss model going from the bad state back "
+                        "to the good state on each datagram, in thousandths.")
+COMMAND_LINE_INT_OPTION(loss_bad_permille, 0, "loss-bad", 0, 1000,
+                        "Chance of losing a datagram in the bad state, in thousandths.")
+COMMAND_LINE_INT_OPTION(loss_good_permille, 0, "loss-good", 0, 1000,
+                        "Chance of losing a datagram in the good state, in thousandths.")
+COMMAND_LINE_INT_OPTION(stall_ms, 0, "stall", 1, 100000,
+                        "Time between received frames that counts as a stall, in ms.")
+COMMAND_LINE_INT_OPTION(width, 0, "width", 2, 8192, "Width of the emulated screen.")
+COMMAND_LINE_INT_OPTION(height, 0, "height", 2, 8192, "Height of the emulated screen.")
+COMMAND_LINE_INT_OPTION(dpi, 0, "dpi", 1, 1000, "DPI of the emulated screen.")
+COMMAND_LINE_INT_OPTION(port, 'p', "port", 1, 65534,
+                        "Loopback port of the proxy, the server listens on the next one.")
+COMMAND_LINE_INT_OPTION(seed, 0, "seed", 0, INT_MAX, "Seed of the random numbers.")
+
+/*
+============================
+Custom Types
+============================
+*/
+
+typedef struct {
+    // When the datagram gets to the other end of the link
+    timestamp_us delivery_time;
+    int size;
+    char *data;
+} EmulatedPacket;
+
+// A FIFO of datagrams, whose delivery times never decrease
+typedef struct {
+    EmulatedPacket packets[EMULATOR_MAX_PACKETS_IN_FLIGHT];
+    int head;
+    int count;
+} PacketQueue;
+
+// One direction of the emulated link
+typedef struct {
+    // Whether the datagrams are limited by the bandwidth trace, or only delayed and lost
+    bool throttled;
+    // When the bottleneck finishes sending the datagrams that are queued on it
+    timestamp_us link_free_time;
+    // When the latest in-order datagram gets delivered, so that jitter doesn't reorder
+    timestamp_us last_delivery_time;
+    // Whether the Gilbert-Elliott loss model is in its bad state
+    bool loss_state_bad;
+    PacketQueue in_order;
+    PacketQueue reordered;
+
+    uint64_t num_datagrams;
+    uint64_t num_bytes_delivered;
+    uint64_t num_queue_drops;
+    uint64_t num_random_losses;
+    uint64_t num_reordered;
+} EmulatedLink;
+
+typedef struct {
+    atomic_int run;
+    SocketContext server_context;
+
+    // The bandwidth trace, sorted by time
+    double *trace_times;
+    int *trace_bitrates;
+    int trace_length;
+    // When the bandwidth trace started, or 0 if it hasn't yet
+    timestamp_us trace_start_time;
+    timestamp_us trace_end_time;
+
+    // The frame trace, normalized to average to 1.0
+    double *frame_weights;
+    int num_frame_weights;
+
+    EmulatedLink downstream;
+    EmulatedLink upstream;
+
+    // What the server has sent
+    int num_frames_sent;
+    int num_keyframes_sent;
+    int num_frames_dropped;
+    uint64_t num_frame_bytes_sent;
+    double total_video_bitrate;
+    double total_fec_ratio;
+    UDPSendStatistics send_statistics;
+    atomic_int server_failed;
+} EmulatorState;
+
+/*
+============================
+Private Functions
+============================
+*/
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static bool random_chance(uint64_t *state, int permille) {
+    return (int)(next_random(state) % 1000) < permille;
+}
+
+static double random_double(uint64_t *state) {
+    return (double)(next_random(state) >> 11) / (double)(1ULL << 53);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bool load_bandwidth_trace(EmulatorState *state) {
+    if (bandwidth_trace_file == NULL) {
+        state->trace_times = safe_malloc(sizeof(double));
+        state->trace_bitrates = safe_malloc(sizeof(int));
+        state->trace_times[0] = 0.0;
+        state->trace_bitrates[0] = bitrate;
+        state->trace_length = 1;
+        return true;
+    }
+    FILE *file = fopen(bandwidth_trace_file, "r");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open bandwidth trace %s.", bandwidth_trace_file);
+        return false;
+    }
+    int capacity = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        double time;
+        int trace_bitrate;
+        if (sscanf(line, "%lf %d", &time, &trace_bitrate) != 2) {
+            continue;
+        }
+        if (trace_bitrate <= 0 ||
+            (state->trace_length > 0 && time <= state->trace_times[state->trace_length - 1])) {
+            LOG_ERROR("Bandwidth trace lines need increasing times and positive bitrates: %s",
+                      line);
+            fclose(file);
+            return false;
+        }
+        if (state->trace_length == capacity) {
+            capacity = max(2 * capacity, 64);
+            state->trace_times = safe_realloc(state->trace_times, sizeof(double) * capacity);
+            state->trace_bitrates = safe_realloc(state->trace_bitrates, sizeof(int) * capacity);
+        }
+        state->trace_times[state->trace_length] = time;
+        state->trace_bitrates[state->trace_length] = trace_bitrate;
+        state->trace_length++;
+    }
+    fclose(file);
+    if (state->trace_length == 0) {
+        LOG_ERROR("Bandwidth trace %s is empty.", bandwidth_trace_file);
+        return false;
+    }
+    // The first bitrate also holds before its time
+    state->trace_times[0] = 0.0;
+    return true;
+}
+
+static bool load_frame_trace(EmulatorState *state) {
+    if (frame_trace_file == NULL) {
+        return true;
+    }
+    FILE *file = fopen(frame_trace_file, "r");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open frame trace %s.", frame_trace_file);
+        return false;
+    }
+    int capacity = 0;
+    double total = 0.0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        double size;
+        if (sscanf(line, "%lf", &size) != 1 || size <= 0.0) {
+            continue;
+        }
+        if (state->num_frame_weights == capacity) {
+            capacity = max(2 * capacity, 1024);
+            state->frame_weights = safe_realloc(state->frame_weights, sizeof(double) * capacity);
+        }
+        state->frame_weights[state->num_frame_weights++] = size;
+        total += size;
+    }
+    fclose(file);
+    if (state->num_frame_weights == 0) {
+        LOG_ERROR("Frame trace %s is empty.", frame_trace_file);
+        return false;
+    }
+    double mean = total / state->num_frame_weights;
+    for (int i = 0; i < state->num_frame_weights; i++) {
+        state->frame_weights[i] /= mean;
+    }
+    return true;
+}
+
+static int bandwidth_at(EmulatorState *state, double time) {
+    int i = 0;
+    while (i + 1 < state->trace_length && state->trace_times[i + 1] <= time) {
+        i++;
+    }
+    return state->trace_bitrates[i];
+}
+
+// The number of bits that the link could have carried in the first `time` seconds of the trace
+static double capacity_until(EmulatorState *state, double time) {
+    double bits = 0.0;
+    for (int i = 0; i < state->trace_length && state->trace_times[i] < time; i++) {
+        double end = i + 1 < state->trace_length ? min(state->trace_times[i + 1], time) : time;
+        bits += (end - state->trace_times[i]) * state->trace_bitrates[i];
+    }
+    return bits;
+}
+
+static void init_packet_queue(PacketQueue *queue, int max_packet_size) {
+    for (int i = 0; i < EMULATOR_MAX_PACKETS_IN_FLIGHT; i++) {
+        queue->packets[i].data = safe_malloc(max_packet_size);
+    }
+}
+
+static void destroy_packet_queue(PacketQueue *queue) {
+    for (int i = 0; i < EMULATOR_MAX_PACKETS_IN_FLIGHT; i++) {
+        free(queue->packets[i].data);
+    }
+}
+
+static bool push_packet(PacketQueue *queue, const char *data, int size,
+                        timestamp_us delivery_time) {
+    if (queue->count == EMULATOR_MAX_PACKETS_IN_FLIGHT) {
+        return false;
+    }
+    EmulatedPacket *packet =
+        &queue->packets[(queue->head + queue->count) % EMULATOR_MAX_PACKETS_IN_FLIGHT];
+    memcpy(packet->data, data, size);
+    packet->size = size;
+    packet->delivery_time = delivery_time;
+    queue->count++;
+    return true;
+}
+
+/**
+ * @brief                          Put a datagram onto a direction of the emulated link, or drop
+ *                                 it if the link loses it
+ *
+ * @param state                    The emulator state
+ * @param link                     The direction that the datagram is going in
+ * @param data                     The datagram
+ * @param size                     The size of the datagram
+ * @param now                      When the datagram got to the link
+ * @param random_state             The random number generator of the proxy
+ */
+static void send_on_link(EmulatorState *state, EmulatedLink *link, const char *data, int size,
+                         timestamp_us now, uint64_t *random_state) {
+    link->num_datagrams++;
+
+    // Gilbert-Elliott loss, whose state changes once per datagram
+    if (link->loss_state_bad) {
+        link->loss_state_bad = !random_chance(random_state, loss_exit_permille);
+    } else {
+        link->loss_state_bad = random_chance(random_state, loss_enter_permille);
+    }
+    if (random_chance(random_state,
+                      link->loss_state_bad ? loss_bad_permille : loss_good_permille)) {
+        link->num_random_losses++;
+        return;
+    }
+
+    // The bottleneck sends the datagrams one at a time, at the bandwidth that the trace is at when
+    // the datagram gets queued, and drops the datagrams that would wait for too long
+    timestamp_us leave_time = now;
+    if (link->throttled) {
+        double time = (double)(now - state->trace_start_time) / US_IN_SECOND;
+        timestamp_us start_time = max(now, link->link_free_time);
+        if (start_time - now > (timestamp_us)queue_ms * US_IN_MS) {
+            link->num_queue_drops++;
+            return;
+        }
+        double serialization_time =
+            (double)(size + EMULATOR_DATAGRAM_OVERHEAD) * BITS_IN_BYTE / bandwidth_at(state, time);
+        link->link_free_time = start_time + (timestamp_us)(serialization_time * US_IN_SECOND);
+        leave_time = link->link_free_time;
+    }
+
+    timestamp_us delivery_time =
+        leave_time + (timestamp_us)(delay_ms + jitter_ms * random_double(random_state)) * US_IN_MS;
+    delivery_time = max(delivery_time, link->last_delivery_time);
+    bool queued;
+    if (random_chance(random_state, reorder_permille)) {
+        // Held back datagrams don't hold back the ones behind them
+        queued = push_packet(&link->reordered, data, size,
+                             delivery_time + (timestamp_us)reorder_ms * US_IN_MS);
+        link->num_reordered++;
+    } else {
+        link->last_delivery_time = delivery_time;
+        queued = push_packet(&link->in_order, data, size, delivery_time);
+    }
+    if (!queued) {
+        link->num_queue_drops++;
+    }
+}
+
+/**
+ * @brief                          Send every datagram of a queue that has gotten to the other
+ *                                 end of the link
+ *
+ * @returns                        Whether any were sent
+ */
+static bool deliver_packets(EmulatedLink *link, PacketQueue *queue, SOCKET socket,
+                            const struct sockaddr_in *addr, timestamp_us now) {
+    bool delivered = false;
+    while (queue->count > 0 && queue->packets[queue->head].delivery_time <= now) {
+        EmulatedPacket *packet = &queue->packets[queue->head];
+        sendto(socket, packet->data, packet->size, 0, (const struct sockaddr *)addr,
+               sizeof(*addr));
+        link->num_bytes_delivered += packet->size + EMULATOR_DATAGRAM_OVERHEAD;
+        queue->head = (queue->head + 1) % EMULATOR_MAX_PACKETS_IN_FLIGHT;
+        queue->count--;
+        delivered = true;
+    }
+    return delivered;
+}
+
+static SOCKET create_proxy_socket(int bind_port) {
+    SOCKET socket = socketp_udp();
+    if (socket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons((unsigned short)bind_port);
+    if (bind(socket, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        LOG_ERROR("Failed to bind the proxy to port %d: %d", bind_port, get_last_network_error());
+        closesocket(socket);
+        return INVALID_SOCKET;
+    }
+    // Never block, the proxy polls both sockets
+    set_timeout(socket, 0);
+    return socket;
+}
+
+// Relays the datagrams between the client and the server, through the emulated link
+static int32_t multithreaded_proxy(void *opaque) {
+    EmulatorState *state = (EmulatorState *)opaque;
+    uint64_t random_state = (uint64_t)seed * 2 + 1;
+
+    SOCKET client_socket = create_proxy_socket(port);
+    SOCKET server_socket = create_proxy_socket(0);
+    if (client_socket == INVALID_SOCKET || server_socket == INVALID_SOCKET) {
+        atomic_store(&state->run, 0);
+        return -1;
+    }
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    server_addr.sin_port = htons((unsigned short)(port + 1));
+    struct sockaddr_in client_addr = {0};
+    bool found_client = false;
+
+    int max_packet_size = (int)udp_packet_max_size();
+    char *buffer = safe_malloc(max_packet_size);
+    init_packet_queue(&state->downstream.in_order, max_packet_size);
+    init_packet_queue(&state->downstream.reordered, max_packet_size);
+    init_packet_queue(&state->upstream.in_order, max_packet_size);
+    init_packet_queue(&state->upstream.reordered, max_packet_size);
+
+    while (atomic_load(&state->run)) {
+        bool did_work = false;
+        timestamp_us now = current_time_us();
+
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int size;
+        while ((size = recvfrom(client_socket, buffer, max_packet_size, 0,
+                                (struct sockaddr *)&addr, &addr_len)) > 0) {
+            // The client's address is learned from its handshake
+            client_addr = addr;
+            found_client = true;
+            send_on_link(state, &state->upstream, buffer, size, now, &random_state);
+            addr_len = sizeof(addr);
+            did_work = true;
+        }
+        while ((size = recvfrom(server_socket, buffer, max_packet_size, 0, NULL, NULL)) > 0) {
+            if (state->trace_start_time == 0) {
+                state->trace_start_time = now;
+            }
+            send_on_link(state, &state->downstream, buffer, size, now, &random_state);
+            did_work = true;
+        }
+
+        if (found_client) {
+            did_work |= deliver_packets(&state->downstream, &state->downstream.in_order,
+                                        client_socket, &client_addr, now);
+            did_work |= deliver_packets(&state->downstream, &state->downstream.reordered,
+                                        client_socket, &client_addr, now);
+        }
+        did_work |= deliver_packets(&state->upstream, &state->upstream.in_order, server_socket,
+                                    &server_addr, now);
+        did_work |= deliver_packets(&state->upstream, &state->upstream.reordered, server_socket,
+                                    &server_addr, now);
+
+        if (!did_work) {
+            whist_usleep(50);
+        }
+    }
+    state->trace_end_time = current_time_us();
+
+    destroy_packet_queue(&state->downstream.in_order);
+    destroy_packet_queue(&state->downstream.reordered);
+    destroy_packet_queue(&state->upstream.in_order);
+    destroy_packet_queue(&state->upstream.reordered);
+    free(buffer);
+    closesocket(client_socket);
+    closesocket(server_socket);
+    return 0;
+}
+
+// Receives the nacks, pings and network settings of the client, like the server's receive thread
+static int32_t multithreaded_server_receive(void *opaque) {
+    EmulatorState *state = (EmulatorState *)opaque;
+    while (atomic_load(&state->run)) {
+        socket_update(&state->server_context);
+    }
+    return 0;
+}
+
+// Sends a frame at every frame interval, at the bitrate that congestion control asks for, and
+// serves the nacks and pads the link in between, like the server's video send thread
+static int32_t multithreaded_server(void *opaque) {
+    EmulatorState *state = (EmulatorState *)opaque;
+    SocketContext *context = &state->server_context;
+    if (!create_udp_socket_context(context, NULL, port + 1, 1, EMULATOR_CONNECTION_TIMEOUT_MS,
+                                   false, DEFAULT_BINARY_PRIVATE_KEY)) {
+        LOG_ERROR("Failed to create the server's UDP context.");
+        atomic_store(&state->server_failed, 1);
+        return -1;
+    }
+    udp_register_nack_buffer(context, PACKET_VIDEO, PACKET_HEADER_SIZE + LARGEST_VIDEOFRAME_SIZE,
+                             VIDEO_NACKBUFFER_SIZE);
+    udp_handle_network_settings(context->context,
+                                get_default_network_settings(width, height, dpi));
+    WhistThread receive_thread =
+        whist_create_thread(multithreaded_server_receive, "multithreaded_server_receive", state);
+
+    uint64_t random_state = (uint64_t)seed * 2 + 3;
+    // Random bytes stand in for the encoded video
+    char *videodata = safe_malloc(LARGEST_VIDEOFRAME_SIZE);
+    for (int i = 0; i < LARGEST_VIDEOFRAME_SIZE; i++) {
+        videodata[i] = (char)next_random(&random_state);
+    }
+
+    double frame_interval = 1.0 / fps;
+    double next_frame_time = 0.0;
+    int frame_id = 0;
+    bool send_keyframe = true;
+    int resend_index = 0;
+    WhistTimer stream_timer;
+    start_timer(&stream_timer);
+    while (atomic_load(&state->run)) {
+        if (get_pending_stream_reset(context, PACKET_VIDEO)) {
+            send_keyframe = true;
+        }
+
+        double now = get_timer(&stream_timer);
+        if (now < next_frame_time) {
+            // Till the next frame, send any nacked packets, or else pad the link with duplicates
+            // of the last frame if congestion control wants the bandwidth to be saturated
+            bool did_work = udp_handle_pending_nacks(context->context);
+            if (!did_work && frame_id > 0 && udp_get_network_settings(context).saturate_bandwidth) {
+                udp_resend_packet(context, PACKET_VIDEO, frame_id, resend_index);
+                int num_indices = udp_get_num_indices(context, PACKET_VIDEO, frame_id);
+                resend_index = num_indices > 0 ? (resend_index + 1) % num_indices : 0;
+                did_work = true;
+            }
+            if (!did_work) {
+                whist_usleep(100);
+            }
+            continue;
+        }
+
+        // The frames that came due while the previous one was still being sent are dropped,
+        // as the server's encoder would have to skip them
+        int num_missed_frames = (int)((now - next_frame_time) / frame_interval);
+        state->num_frames_dropped += num_missed_frames;
+        next_frame_time += (num_missed_frames + 1) * frame_interval;
+
+        NetworkSettings network_settings = udp_get_network_settings(context);
+        double video_bitrate =
+            network_settings.video_bitrate * (1.0 - network_settings.video_fec_ratio);
+        double weight;
+        if (state->num_frame_weights > 0) {
+            weight = state->frame_weights[frame_id % state->num_frame_weights];
+        } else {
+            weight = 0.7 + 0.6 * random_double(&random_state);
+            if (send_keyframe) {
+                weight *= EMULATOR_KEYFRAME_SIZE_RATIO;
+            }
+        }
+        int frame_size = (int)(video_bitrate / fps / BITS_IN_BYTE * weight);
+        frame_size = max(min(frame_size, LARGEST_VIDEOFRAME_SIZE), (int)sizeof(VideoFrame));
+
+        frame_id++;
+        VideoFrame frame = {0};
+        frame.width = width;
+        frame.height = height;
+        frame.codec_type = network_settings.desired_codec;
+        frame.frame_type = send_keyframe ? VIDEO_FRAME_TYPE_INTRA : VIDEO_FRAME_TYPE_NORMAL;
+        frame.frame_id = frame_id;
+        frame.videodata_length = frame_size - (int)sizeof(VideoFrame);
+        frame.server_timestamp = current_time_us();
+        WhistIOVec frame_iov[2] = {{&frame, sizeof(VideoFrame)},
+                                   {videodata, frame.videodata_length}};
+        if (udp_send_packet_iov(context, PACKET_VIDEO, frame_iov, 2, frame_id, send_keyframe) !=
+            0) {
+            LOG_WARNING("Failed to send frame %d!", frame_id);
+        }
+        udp_reset_duplicate_packet_counter(context, PACKET_VIDEO);
+        resend_index = 0;
+
+        state->num_frames_sent++;
+        state->num_keyframes_sent += send_keyframe;
+        state->num_frame_bytes_sent += frame_size;
+        state->total_video_bitrate += network_settings.video_bitrate;
+        state->total_fec_ratio += network_settings.video_fec_ratio;
+        send_keyframe = false;
+    }
+
+    state->send_statistics = udp_get_send_statistics(context, PACKET_VIDEO);
+    whist_wait_thread(receive_thread, NULL);
+    destroy_socket_context(context);
+    free(videodata);
+    return 0;
+}
+
+static void log_link_statistics(const char *name, const EmulatedLink *link) {
+    LOG_INFO("%s: %" PRIu64 " datagrams, %" PRIu64 " lost, %" PRIu64
+             " dropped by the queue, %" PRIu64 " reordered",
+             name, link->num_datagrams, link->num_random_losses, link->num_queue_drops,
+             link->num_reordered);
+}
+
+static double percent_of(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0 : 100.0 * (double)part / (double)whole;
+}
+
+int main(int argc, const char **argv) {
+    WhistStatus err = whist_parse_command_line(argc, argv, NULL);
+    if (err != WHIST_SUCCESS) {
+        LOG_ERROR("Failed to parse command line: %s.", whist_error_string(err));
+        return 1;
+    }
+
+    whist_init_subsystems();
+    // The UDP stack logs its own statistics, but we only care about our own numbers
+    whist_init_statistic_logger(3600);
+
+    EmulatorState *state = safe_zalloc(sizeof(EmulatorState));
+    if (!load_bandwidth_trace(state) || !load_frame_trace(state)) {
+        return 1;
+    }
+    atomic_init(&state->run, 1);
+    atomic_init(&state->server_failed, 0);
+    state->downstream.throttled = true;
+
+    // The client and the server share the screen, and so the bitrate limits
+    network_algo_set_dimensions(width, height);
+    network_algo_set_dpi(dpi);
+
+    WhistThread proxy_thread =
+        whist_create_thread(multithreaded_proxy, "multithreaded_proxy", state);
+    WhistThread server_thread =
+        whist_create_thread(multithreaded_server, "multithreaded_server", state);
+
+    SocketContext client_context;
+    if (!create_udp_socket_context(&client_context, "127.0.0.1", port, 1,
+                                   EMULATOR_CONNECTION_TIMEOUT_MS, false,
+                                   DEFAULT_BINARY_PRIVATE_KEY)) {
+        LOG_ERROR("Failed to create the client's UDP context.");
+        atomic_store(&state->run, 0);
+        whist_wait_thread(server_thread, NULL);
+        whist_wait_thread(proxy_thread, NULL);
+        return 1;
+    }
+    udp_register_ring_buffer(&client_context, PACKET_VIDEO, LARGEST_VIDEOFRAME_SIZE, 256);
+    udp_start_receive_thread(&client_context);
+
+    LOG_INFO("Streaming for %d seconds at %d FPS, with %d ms of delay, %d ms of jitter, and a "
+             "%d ms queue.",
+             duration, fps, delay_ms, jitter_ms, queue_ms);
+
+    // No more frames can be received than are sent
+    int max_frames = (duration + 1) * fps;
+    double *latencies = safe_malloc(sizeof(double) * max_frames);
+    int num_frames_received = 0;
+    uint64_t num_frame_bytes_received = 0;
+    int first_frame_id = -1;
+    int last_frame_id = -1;
+    int num_stalls = 0;
+    double stall_time = 0.0;
+    WhistTimer last_frame_timer;
+    WhistTimer run_timer;
+    start_timer(&run_timer);
+    while (get_timer(&run_timer) < duration && !atomic_load(&state->server_failed)) {
+        if (!socket_update(&client_context)) {
+            LOG_ERROR("The client lost its connection.");
+            break;
+        }
+        WhistPacket *packet;
+        while ((packet = (WhistPacket *)get_packet(&client_context, PACKET_VIDEO)) != NULL) {
+            VideoFrame *frame = (VideoFrame *)packet->data;
+            if (num_frames_received < max_frames) {
+                latencies[num_frames_received] =
+                    (double)(current_time_us() - frame->server_timestamp) / US_IN_MS;
+            }
+            if (first_frame_id == -1) {
+                first_frame_id = packet->id;
+            } else {
+                double gap = get_timer(&last_frame_timer);
+                if (gap * MS_IN_SECOND > stall_ms) {
+                    num_stalls++;
+                    stall_time += gap;
+                }
+            }
+            start_timer(&last_frame_timer);
+            last_frame_id = packet->id;
+            num_frames_received++;
+            num_frame_bytes_received += packet->payload_size;
+            free_packet(&client_context, packet);
+        }
+    }
+
+    atomic_store(&state->run, 0);
+    whist_wait_thread(server_thread, NULL);
+    destroy_socket_context(&client_context);
+    whist_wait_thread(proxy_thread, NULL);
+
+    if (num_frames_received == 0 || state->trace_start_time == 0) {
+        LOG_ERROR("No frames were received.");
+        return 1;
+    }
+
+    double stream_time = (double)(state->trace_end_time - state->trace_start_time) / US_IN_SECOND;
+    double capacity = capacity_until(state, stream_time);
+    double delivered_bits = (double)state->downstream.num_bytes_delivered * BITS_IN_BYTE;
+    double frame_bits = (double)num_frame_bytes_received * BITS_IN_BYTE;
+    int num_latencies = min(num_frames_received, max_frames);
+    qsort(latencies, num_latencies, sizeof(double), compare_doubles);
+    const UDPSendStatistics *send_statistics = &state->send_statistics;
+
+    LOG_INFO("Sent %d frames in %.1f seconds, %d of which were keyframes, and dropped %d frames.",
+             state->num_frames_sent, stream_time, state->num_keyframes_sent,
+             state->num_frames_dropped);
+    LOG_INFO("Congestion control asked for %.0f bps on average, with a %.1f%% FEC ratio.",
+             state->total_video_bitrate / max(state->num_frames_sent, 1),
+             100.0 * state->total_fec_ratio / max(state->num_frames_sent, 1));
+    LOG_INFO("Link utilization: %.2f%% of %.0f bps, of which %.2f%% was frames.",
+             100.0 * delivered_bits / capacity, capacity / stream_time,
+             100.0 * frame_bits / capacity);
+    LOG_INFO("Frame latency: median %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms",
+             latencies[num_latencies / 2], latencies[(int)(num_latencies * 0.9)],
+             latencies[(int)(num_latencies * 0.99)], latencies[num_latencies - 1]);
+    LOG_INFO("Received %d frames, skipping %d, with %d stalls over %d ms, for %.2f s in total.",
+             num_frames_received, last_frame_id - first_frame_id + 1 - num_frames_received,
+             num_stalls, stall_ms, stall_time);
+    LOG_INFO("Overhead on the %" PRIu64
+             " original segments: FEC %.2f%%, nacks %.2f%%, padding %.2f%%",
+             send_statistics->num_original_segments,
+             percent_of(send_statistics->num_fec_segments, send_statistics->num_original_segments),
+             percent_of(send_statistics->num_nacked_segments,
+                        send_statistics->num_original_segments),
+             percent_of(send_statistics->num_duplicate_segments,
+                        send_statistics->num_original_segments));
+    log_link_statistics("Downstream", &state->downstream);
+    log_link_statistics("Upstream", &state->upstream);
+
+    free(latencies);
+    free(state->frame_weights);
+    free(state->trace_times);
+    free(state->trace_bitrates);
+    free(state);
+
+    destroy_statistic_logger();
+    destroy_logger();
+
+    return 0;
+}
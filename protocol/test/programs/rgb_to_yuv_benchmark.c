@@ -0,0 +1,223 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv_benchmark.c
+ * @brief RGB32 to YUV420P conversion benchmark.
+ *
+ * Measures how long the software encoder takes to convert a captured frame
+ * to YUV at common screen sizes: first through the FFmpeg filter graph
+ * that it used to use (buffer -> format -> scale -> buffersink), then with
+ * every conversion kernel the CPU supports, on 1 up to --threads threads.
+ * Each result also reports the largest difference from the filter graph's
+ * output, since the two don't round chroma quite the same way.
+ */
+
+#include <whist/core/whist.h>
+#include "whist/video/rgb_to_yuv/rgb_to_yuv.h"
+#include "whist/utils/clock.h"
+#include "whist/utils/command_line.h"
+
+static int max_threads = 8;
+static int target_ms = 1000;
+
+COMMAND_LINE_INT_OPTION(max_threads, 'j', "threads", 1, 8,
+                        "Most threads to split each conversion between.")
+COMMAND_LINE_INT_OPTION(target_ms, 't', "time", 1, 60000,
+                        "How long to run each measurement for, in milliseconds.")
+
+typedef struct {
+    int width;
+    int height;
+} FrameSize;
+
+// The frame sizes to measure
+static const FrameSize frame_sizes[] = {
+    {1920, 1080},
+    {2560, 1440},
+    {3840, 2160},
+};
+
+// The filter graph that the software encoder used to convert frames with
+typedef struct {
+    AVFilterGraph *graph;
+    AVFilterContext *source;
+    AVFilterContext *sink;
+} ConversionGraph;
+
+static bool create_conversion_graph(ConversionGraph *graph, int width, int height) {
+    memset(graph, 0, sizeof(ConversionGraph));
+    graph->graph = avfilter_graph_alloc();
+    if (!graph->graph) {
+        return false;
+    }
+
+    char source_args[128];
+    snprintf(source_args, sizeof(source_args), "video_size=%dx%d:pix_fmt=%s:time_base=1/%d",
+             width, height, av_get_pix_fmt_name(AV_PIX_FMT_RGB32), MAX_FPS);
+    char scale_args[64];
+    snprintf(scale_args, sizeof(scale_args), "w=%d:h=%d", width, height);
+
+    AVFilterContext *format = NULL, *scale = NULL;
+    if (avfilter_graph_create_filter(&graph->source, avfilter_get_by_name("buffer"), "src",
+                                     source_args, NULL, graph->graph) < 0 ||
+        avfilter_graph_create_filter(&format, avfilter_get_by_name("format"), "format",
+                                     av_get_pix_fmt_name(AV_PIX_FMT_YUV420P), NULL,
+                                     graph->graph) < 0 ||
+        avfilter_graph_create_filter(&scale, avfilter_get_by_name("scale"), "scale", scale_args,
+                                     NULL, graph->graph) < 0 ||
+        avfilter_graph_create_filter(&graph->sink, avfilter_get_by_name("buffersink"), "sink",
+                                     NULL, NULL, graph->graph) < 0) {
+        return false;
+    }
+    if (avfilter_link(graph->source, 0, format, 0) < 0 || avfilter_link(format, 0, scale, 0) < 0 ||
+        avfilter_link(scale, 0, graph->sink, 0) < 0) {
+        return false;
+    }
+    return avfilter_graph_config(graph->graph, NULL) >= 0;
+}
+
+// Fill a frame with something like a desktop: flat areas, gradients and noise
+static void fill_test_frame(uint8_t *rgb, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = rgb + (size_t)y * width * 4;
+        for (int x = 0; x < width; x++) {
+            uint8_t *pixel = row + 4 * x;
+            if (y < height / 3) {
+                pixel[0] = 0xf0;
+                pixel[1] = 0xf0;
+                pixel[2] = 0xf0;
+            } else if (y < 2 * height / 3) {
+                pixel[0] = (uint8_t)(x * 255 / width);
+                pixel[1] = (uint8_t)(y * 255 / height);
+                pixel[2] = (uint8_t)((x + y) & 0xff);
+            } else {
+                pixel[0] = (uint8_t)rand();
+                pixel[1] = (uint8_t)rand();
+                pixel[2] = (uint8_t)rand();
+            }
+            pixel[3] = 0xff;
+        }
+    }
+}
+
+// Largest difference between two frames, over all three planes
+static int max_difference(AVFrame *a, AVFrame *b, int width, int height) {
+    int max_diff = 0;
+    for (int plane = 0; plane < 3; plane++) {
+        int plane_width = plane == 0 ? width : width / 2;
+        int plane_height = plane == 0 ? height : height / 2;
+        for (int y = 0; y < plane_height; y++) {
+            const uint8_t *row_a = a->data[plane] + (size_t)y * a->linesize[plane];
+            const uint8_t *row_b = b->data[plane] + (size_t)y * b->linesize[plane];
+            for (int x = 0; x < plane_width; x++) {
+                max_diff = max(max_diff, abs(row_a[x] - row_b[x]));
+            }
+        }
+    }
+    return max_diff;
+}
+
+// Convert through the filter graph, leaving the last conversion in output
+static double run_graph_benchmark(AVFrame *rgb_frame, AVFrame *output, int width, int height) {
+    ConversionGraph graph;
+    if (!create_conversion_graph(&graph, width, height)) {
+        LOG_FATAL("Unable to create the filter graph for %dx%d", width, height);
+    }
+
+    long long frames = 0;
+    WhistTimer timer;
+    start_timer(&timer);
+    double elapsed;
+    do {
+        av_frame_unref(output);
+        rgb_frame->pts = frames;
+        if (av_buffersrc_write_frame(graph.source, rgb_frame) < 0 ||
+            av_buffersink_get_frame(graph.sink, output) < 0) {
+            LOG_FATAL("Unable to convert a frame through the filter graph");
+        }
+        frames++;
+        elapsed = get_timer(&timer);
+    } while (elapsed * MS_IN_SECOND < target_ms);
+
+    avfilter_graph_free(&graph.graph);
+    return elapsed * MS_IN_SECOND / frames;
+}
+
+// Convert with a converter, leaving the last conversion in output
+static double run_converter_benchmark(int num_threads, const uint8_t *rgb, AVFrame *output,
+                                      int width, int height) {
+    RGBToYUVConverter *converter = create_rgb_to_yuv_converter(num_threads);
+
+    long long frames = 0;
+    WhistTimer timer;
+    start_timer(&timer);
+    double elapsed;
+    do {
+        rgb_to_yuv_convert(converter, rgb, width * 4, output->data, output->linesize, width,
+                           height);
+        frames++;
+        elapsed = get_timer(&timer);
+    } while (elapsed * MS_IN_SECOND < target_ms);
+
+    destroy_rgb_to_yuv_converter(converter);
+    return elapsed * MS_IN_SECOND / frames;
+}
+
+int main(int argc, const char **argv) {
+    WhistStatus err = whist_parse_command_line(argc, argv, NULL);
+    if (err != WHIST_SUCCESS) {
+        LOG_ERROR("Failed to parse command line: %s.", whist_error_string(err));
+        return 1;
+    }
+
+    whist_init_subsystems();
+
+    RGBToYUVKernel fastest_kernel = rgb_to_yuv_get_kernel();
+    LOG_INFO("Up to %d threads, fastest kernel %s.", max_threads,
+             rgb_to_yuv_kernel_to_str(fastest_kernel));
+
+    for (size_t i = 0; i < ARRAY_LENGTH(frame_sizes); i++) {
+        int width = frame_sizes[i].width;
+        int height = frame_sizes[i].height;
+
+        AVFrame *rgb_frame = av_frame_alloc();
+        rgb_frame->format = AV_PIX_FMT_RGB32;
+        rgb_frame->width = width;
+        rgb_frame->height = height;
+        AVFrame *graph_output = av_frame_alloc();
+        AVFrame *output = av_frame_alloc();
+        output->format = AV_PIX_FMT_YUV420P;
+        output->width = width;
+        output->height = height;
+        if (av_frame_get_buffer(rgb_frame, 0) < 0 || av_frame_get_buffer(output, 0) < 0) {
+            LOG_FATAL("Unable to allocate frames for %dx%d", width, height);
+        }
+        FATAL_ASSERT(rgb_frame->linesize[0] == width * 4);
+        fill_test_frame(rgb_frame->data[0], width, height);
+
+        double graph_ms = run_graph_benchmark(rgb_frame, graph_output, width, height);
+        LOG_INFO("%dx%d %-12s %8.3f ms/frame", width, height, "filter graph", graph_ms);
+
+        // Go from the fastest kernel down, so that the scalar numbers come last
+        for (int kernel = fastest_kernel; kernel >= RGB_TO_YUV_KERNEL_SCALAR; kernel--) {
+            rgb_to_yuv_set_max_kernel((RGBToYUVKernel)kernel);
+            if (rgb_to_yuv_get_kernel() != (RGBToYUVKernel)kernel) {
+                continue;
+            }
+            for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+                double ms = run_converter_benchmark(num_threads, rgb_frame->data[0], output,
+                                                    width, height);
+                LOG_INFO("%dx%d %-6s x%-5d %8.3f ms/frame, %5.2fx, max diff %d", width, height,
+                         rgb_to_yuv_kernel_to_str(kernel), num_threads, ms, graph_ms / ms,
+                         max_difference(graph_output, output, width, height));
+            }
+        }
+        rgb_to_yuv_set_max_kernel(fastest_kernel);
+
+        av_frame_free(&rgb_frame);
+        av_frame_free(&graph_output);
+        av_frame_free(&output);
+    }
+
+    destroy_logger();
+    return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file throttle_benchmark.c
+ * @brief Network throttler pacing benchmark.
+ *
+ * Pushes packets through a network throttler as fast as it lets them
+ * through, and measures how closely the bursts follow the configured
+ * burst bitrate: the achieved bitrate, and the jitter of the time between
+ * the starts of consecutive packet groups, relative to the coin bucket
+ * interval.
+ */
+
+#include <whist/core/whist.h>
+#include "whist/network/throttle.h"
+#include "whist/utils/clock.h"
+#include "whist/utils/command_line.h"
+#include "whist/logging/log_statistic.h"
+
+static int burst_bitrate = 100000000;
+static int num_packets = 100000;
+static int packet_size = 1400;
+static int coin_bucket_us = 5000;
+
+COMMAND_LINE_INT_OPTION(burst_bitrate, 'b', "bitrate", 1, INT_MAX,
+                        "Burst bitrate to throttle to, in bits per second.")
+COMMAND_LINE_INT_OPTION(num_packets, 'n', "packets", 1, INT_MAX, "Number of packets to send.")
+COMMAND_LINE_INT_OPTION(packet_size, 's', "size", 1, 65536, "Size of each packet, in bytes.")
+COMMAND_LINE_INT_OPTION(coin_bucket_us, 0, "bucket-us", 100, 1000000,
+                        "Length of a coin bucket interval, in microseconds.")
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, const char **argv) {
+    WhistStatus err = whist_parse_command_line(argc, argv, NULL);
+    if (err != WHIST_SUCCESS) {
+        LOG_ERROR("Failed to parse command line: %s.", whist_error_string(err));
+        return 1;
+    }
+
+    whist_init_subsystems();
+    // The throttler logs its delays, but we only care about our own numbers
+    whist_init_statistic_logger(3600);
+
+    double coin_bucket_ms = (double)coin_bucket_us / US_IN_MS;
+    NetworkThrottleContext *throttler = network_throttler_create(coin_bucket_ms, false);
+    network_throttler_set_burst_bitrate(throttler, burst_bitrate);
+
+    // The time at which each group of packets was released, relative to the first group
+    double *group_start_times = safe_malloc(sizeof(double) * num_packets);
+    int num_groups = 0;
+    int last_group_id = -1;
+    // The index of the first packet of the second group, which is the first paced group
+    int first_paced_packet = 0;
+
+    LOG_INFO("Throttling %d packets of %d bytes to %d bps, with %d us coin buckets.", num_packets,
+             packet_size, burst_bitrate, coin_bucket_us);
+
+    WhistTimer timer;
+    start_timer(&timer);
+    for (int i = 0; i < num_packets; i++) {
+        int group_id = network_throttler_wait_byte_allocation(throttler, (size_t)packet_size);
+        if (group_id != last_group_id) {
+            group_start_times[num_groups++] = get_timer(&timer);
+            last_group_id = group_id;
+            if (num_groups == 2) {
+                first_paced_packet = i;
+            }
+        }
+    }
+    network_throttler_destroy(throttler);
+
+    // The first group spends the initial coins, and isn't paced
+    if (num_groups < 3) {
+        LOG_ERROR("Only %d groups were sent, send more packets.", num_groups);
+        return 1;
+    }
+
+    // The jitter of each group is how far the time since the previous group's start
+    // is off from the length of a coin bucket interval
+    int num_intervals = num_groups - 2;
+    double *jitters = safe_malloc(sizeof(double) * num_intervals);
+    double total_jitter = 0.0;
+    for (int i = 0; i < num_intervals; i++) {
+        double interval = group_start_times[i + 2] - group_start_times[i + 1];
+        jitters[i] = fabs(interval * US_IN_SECOND - coin_bucket_us);
+        total_jitter += jitters[i];
+    }
+    qsort(jitters, num_intervals, sizeof(double), compare_doubles);
+
+    // Measure the achieved bitrate over the paced groups only,
+    // counting the last group as taking up its whole interval
+    double paced_time = group_start_times[num_groups - 1] + coin_bucket_ms / MS_IN_SECOND -
+                        group_start_times[1];
+    double achieved_bitrate =
+        (double)(num_packets - first_paced_packet) * packet_size * BITS_IN_BYTE / paced_time;
+
+    LOG_INFO("Sent %d groups in %.3f seconds, achieving %.0f bps (%.2f%% of the burst bitrate)",
+             num_groups, paced_time, achieved_bitrate, 100.0 * achieved_bitrate / burst_bitrate);
+    LOG_INFO("Group interval jitter: mean %.1f us, median %.1f us, p99 %.1f us, max %.1f us",
+             total_jitter / num_intervals, jitters[num_intervals / 2],
+             jitters[(int)(num_intervals * 0.99)], jitters[num_intervals - 1]);
+
+    free(jitters);
+    free(group_start_times);
+
+    destroy_statistic_logger();
+    destroy_logger();
+
+    return 0;
+}
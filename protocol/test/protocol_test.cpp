@@ -35,6 +35,10 @@ extern "C" {
 #include <whist/core/whist_string.h>
 #include <whist/utils/os_utils.h>
 #include <whist/network/ringbuffer.h>
+#include <whist/network/udp.h>
+#include <whist/network/udp_test.h>
+#include <whist/network/network_algorithm.h>
+#include <whist/network/throttle.h>
 #include <client/audio.h>
 #include <client/frontend/frontend.h>
 #include <client/frontend/sdl/common.h>
@@ -56,12 +60,16 @@ extern "C" {
 #include <whist/utils/atomic.h>
 #include <whist/utils/linked_list.h>
 #include <whist/utils/queue.h>
+#include <whist/utils/timing_wheel.h>
+#include <whist/utils/triple_buffer.h>
 #include <whist/utils/command_line.h>
 #include <whist/fec/fec.h>
 #include <whist/fec/rs_wrapper.h>
 #include <whist/fec/fec_controller.h>
 #include "whist/utils/string_buffer.h"
 #include <whist/fec/wirehair_test.h>
+#include <whist/fec/gf256/gf256.h>
+#include <whist/fec/gf256/gf256_cpuinfo.h>
 #include "whist/core/error_codes.h"
 #include <whist/core/features.h>
 
@@ -802,6 +810,67 @@ TEST_F(ProtocolTest, BadDecrypt) {
     check_stdout_line(::testing::HasSubstr("OpenSSL Error caught"));
 }
 
+// This test encrypts packets with the session of one end of a connection,
+// decrypts them with the session of the other end, and checks that no IV is ever reused
+TEST_F(ProtocolTest, SessionEncryptAndDecrypt) {
+    AESSession* server_session = create_aes_session(DEFAULT_BINARY_PRIVATE_KEY, true);
+    AESSession* client_session = create_aes_session(DEFAULT_BINARY_PRIVATE_KEY, false);
+    ASSERT_TRUE(server_session != NULL);
+    ASSERT_TRUE(client_session != NULL);
+
+    // The plaintext is split in two, to check that the pieces are encrypted as one packet
+    const char* data = "testing...testing";
+    int len = (int)strlen(data);
+    WhistIOVec plaintext_iov[2] = {{data, 7}, {data + 7, len - 7}};
+
+    char encrypted_data[2][64];
+    AESMetadata aes_metadata[2];
+    for (int i = 0; i < 2; i++) {
+        int encrypted_len = aes_session_encrypt_packet(server_session, encrypted_data[i],
+                                                       &aes_metadata[i], plaintext_iov, 2);
+        EXPECT_EQ(encrypted_len, len);
+
+        char decrypted_data[64];
+        int decrypted_len = aes_session_decrypt_packet(client_session, decrypted_data,
+                                                       sizeof(decrypted_data), &aes_metadata[i],
+                                                       encrypted_data[i], encrypted_len);
+        EXPECT_EQ(decrypted_len, len);
+        EXPECT_EQ(memcmp(decrypted_data, data, len), 0);
+    }
+
+    // Consecutive packets must not share an IV
+    EXPECT_NE(memcmp(aes_metadata[0].iv, aes_metadata[1].iv, IV_SIZE), 0);
+    EXPECT_NE(memcmp(encrypted_data[0], encrypted_data[1], len), 0);
+
+    // The other direction must not share an IV either
+    AESMetadata client_aes_metadata;
+    char client_encrypted_data[64];
+    aes_session_encrypt_packet(client_session, client_encrypted_data, &client_aes_metadata,
+                               plaintext_iov, 2);
+    EXPECT_NE(memcmp(client_aes_metadata.iv, aes_metadata[0].iv, IV_SIZE), 0);
+
+    // Neither must a later session of the same direction and key, like that of a reconnection
+    AESSession* reconnected_session = create_aes_session(DEFAULT_BINARY_PRIVATE_KEY, true);
+    ASSERT_TRUE(reconnected_session != NULL);
+    AESMetadata reconnected_aes_metadata;
+    char reconnected_encrypted_data[64];
+    aes_session_encrypt_packet(reconnected_session, reconnected_encrypted_data,
+                               &reconnected_aes_metadata, plaintext_iov, 2);
+    EXPECT_NE(memcmp(reconnected_aes_metadata.iv, aes_metadata[0].iv, IV_SIZE), 0);
+    destroy_aes_session(reconnected_session);
+
+    // A tampered packet must fail to decrypt
+    char decrypted_data[64];
+    encrypted_data[0][0] ^= 1;
+    EXPECT_EQ(aes_session_decrypt_packet(client_session, decrypted_data, sizeof(decrypted_data),
+                                         &aes_metadata[0], encrypted_data[0], len),
+              -1);
+    check_stdout_line(::testing::HasSubstr("OpenSSL Error caught"));
+
+    destroy_aes_session(server_session);
+    destroy_aes_session(client_session);
+}
+
 /**
  * file/file_synchronizer.c
  **/
@@ -1352,6 +1421,63 @@ TEST_F(ProtocolTest, Atomics) {
     EXPECT_EQ(atomic_load(&atomic_test_xor), 0);
 }
 
+TEST_F(ProtocolTest, BufferPoolTest) {
+    BufferPoolStats start_stats;
+    get_buffer_pool_stats(&start_stats);
+
+    // A freed buffer is reused by the next allocation of the same size class
+    char* buffer = (char*)allocate_pooled_buffer(1000);
+    memset(buffer, 1, 1000);
+    free_pooled_buffer(buffer);
+    BufferPoolStats stats;
+    get_buffer_pool_stats(&stats);
+    buffer = (char*)allocate_pooled_buffer(900);
+    BufferPoolStats reuse_stats;
+    get_buffer_pool_stats(&reuse_stats);
+    EXPECT_EQ(reuse_stats.hits, stats.hits + 1);
+    EXPECT_EQ(reuse_stats.misses, stats.misses);
+    EXPECT_EQ(reuse_stats.buffers_in_use, start_stats.buffers_in_use + 1);
+
+    // Buffers that are too large to be pooled work all the same
+    size_t large_size = 16 * BYTES_IN_KILOBYTE * BYTES_IN_KILOBYTE;
+    char* large_buffer = (char*)allocate_pooled_buffer(large_size);
+    large_buffer[large_size - 1] = 1;
+    get_buffer_pool_stats(&stats);
+    EXPECT_EQ(stats.misses, reuse_stats.misses + 1);
+    EXPECT_GE(stats.high_water_buffers, start_stats.buffers_in_use + 2);
+
+    free_pooled_buffer(large_buffer);
+    free_pooled_buffer(buffer);
+    get_buffer_pool_stats(&stats);
+    EXPECT_EQ(stats.buffers_in_use, start_stats.buffers_in_use);
+
+    // The buffers that a thread has cached are handed to the other threads when it exits
+    const int num_thread_buffers = 8;
+    WhistThread thread = whist_create_thread(
+        [](void*) {
+            char* buffers[num_thread_buffers];
+            for (int i = 0; i < num_thread_buffers; i++) {
+                buffers[i] = (char*)allocate_pooled_buffer(1000);
+            }
+            for (int i = 0; i < num_thread_buffers; i++) {
+                free_pooled_buffer(buffers[i]);
+            }
+            return 0;
+        },
+        "buffer_pool_test_thread", NULL);
+    whist_wait_thread(thread, NULL);
+    get_buffer_pool_stats(&stats);
+    char* buffers[num_thread_buffers];
+    for (int i = 0; i < num_thread_buffers; i++) {
+        buffers[i] = (char*)allocate_pooled_buffer(1000);
+    }
+    get_buffer_pool_stats(&reuse_stats);
+    EXPECT_EQ(reuse_stats.hits, stats.hits + num_thread_buffers);
+    for (int i = 0; i < num_thread_buffers; i++) {
+        free_pooled_buffer(buffers[i]);
+    }
+}
+
 #if !OS_IS(OS_MACOS)
 int client_test_thread(void* raw_client) {
     Client* client = (Client*)raw_client;
@@ -1439,6 +1565,60 @@ TEST_F(ProtocolTest, ClientStruct) {
 }
 #endif
 
+// Check that the network throttler groups packets per coin bucket interval,
+// and paces the next group until the next interval
+TEST_F(ProtocolTest, NetworkThrottlerGroupTest) {
+    // 50000 bytes per 100ms coin bucket. The intervals are long, so that a scheduling delay of
+    // the test can't push the first allocations into the next interval.
+    // The intervals start at the creation of the throttler, which is after this timer starts.
+    WhistTimer creation_timer;
+    start_timer(&creation_timer);
+    NetworkThrottleContext* throttler = network_throttler_create(100.0, true);
+    network_throttler_set_burst_bitrate(throttler, 4000000);
+
+    // The initial coin bucket can be spent right away, all in the same group
+    int first_group_id;
+    EXPECT_TRUE(network_throttler_try_byte_allocation(throttler, 25000, &first_group_id));
+    int group_id;
+    EXPECT_TRUE(network_throttler_try_byte_allocation(throttler, 25000, &group_id));
+    EXPECT_EQ(group_id, first_group_id);
+
+    // Now the bucket is empty, so the next packet must wait for the next group,
+    // which can't start before the first interval is over
+    EXPECT_FALSE(network_throttler_try_byte_allocation(throttler, 1000, &group_id));
+    group_id = network_throttler_wait_byte_allocation(throttler, 1000);
+    EXPECT_EQ(group_id, first_group_id + 1);
+    EXPECT_GE(get_timer(&creation_timer), 0.100);
+
+    // Which then shares its bucket with the following packets
+    EXPECT_EQ(network_throttler_wait_byte_allocation(throttler, 1000), first_group_id + 1);
+
+    network_throttler_destroy(throttler);
+}
+
+#if OS_IS(OS_LINUX)
+TEST_F(ProtocolTest, NetworkThrottlerScheduleTest) {
+    // 1000 bytes take 2ms at 4Mbps
+    NetworkThrottleContext* throttler = network_throttler_create(20.0, true);
+    network_throttler_set_burst_bitrate(throttler, 4000000);
+
+    // The first packet may leave right away, and the following ones are spaced out evenly,
+    // without blocking the caller
+    uint64_t first_launch_time;
+    network_throttler_schedule_byte_allocation(throttler, 1000, &first_launch_time);
+    EXPECT_NE(first_launch_time, (uint64_t)0);
+    // If the test gets delayed, a packet may only be scheduled later, but never earlier
+    uint64_t launch_time;
+    network_throttler_schedule_byte_allocation(throttler, 1000, &launch_time);
+    EXPECT_GE(launch_time - first_launch_time, (uint64_t)2 * NS_IN_MS);
+    uint64_t second_launch_time = launch_time;
+    network_throttler_schedule_byte_allocation(throttler, 1000, &launch_time);
+    EXPECT_GE(launch_time - second_launch_time, (uint64_t)2 * NS_IN_MS);
+
+    network_throttler_destroy(throttler);
+}
+#endif
+
 // Dummy nack and stream reset functions
 
 void dummy_nack(SocketContext* socket_context, WhistPacketType frame_type, int id, int index) {
@@ -1455,7 +1635,7 @@ TEST_F(ProtocolTest, RingBufferTest) {
     int size = 275;
     // Initialize a ring buffer
     RingBuffer* video_buffer = init_ring_buffer(PACKET_VIDEO, LARGEST_VIDEOFRAME_SIZE, size, NULL,
-                                                dummy_nack, dummy_stream_reset);
+                                                dummy_nack, NULL, dummy_stream_reset);
 
     EXPECT_FALSE(video_buffer == NULL);
     EXPECT_EQ(video_buffer->ring_buffer_size, size);
@@ -1534,6 +1714,144 @@ TEST_F(ProtocolTest, RingBufferTest) {
     destroy_ring_buffer(video_buffer);
 }
 
+// The indices that recording_nack and recording_nack_bit_array were called with
+static std::vector<int> recorded_nack_indices;
+// The number of times that recording_nack_bit_array was called
+static int recorded_nack_batches;
+
+static void recording_nack(SocketContext* socket_context, WhistPacketType frame_type, int id,
+                           int index) {
+    recorded_nack_indices.push_back(index);
+}
+
+static void recording_nack_bit_array(SocketContext* socket_context, WhistPacketType frame_type,
+                                     int id, const uint64_t* indices, int num_indices) {
+    for (int index = 0; index < num_indices; index++) {
+        if ((indices[index / 64] >> (index % 64)) & 1) {
+            recorded_nack_indices.push_back(index);
+        }
+    }
+    recorded_nack_batches++;
+}
+
+TEST_F(ProtocolTest, RingBufferNackTest) {
+    RingBuffer* video_buffer = init_ring_buffer(PACKET_VIDEO, LARGEST_VIDEOFRAME_SIZE, 10, NULL,
+                                                recording_nack, recording_nack_bit_array,
+                                                dummy_stream_reset);
+    const int num_indices = 130;
+    // Spread across all three bitset words, and the end of the frame
+    const std::vector<int> missing_indices = {3, 63, 64, 65, 127, 128, 129};
+
+    WhistSegment segment = {};
+    segment.segment_size = 10;
+    // Frame 1 is missing some indices
+    segment.id = 1;
+    segment.num_indices = num_indices;
+    for (int index = 0; index < num_indices; index++) {
+        if (std::find(missing_indices.begin(), missing_indices.end(), index) ==
+            missing_indices.end()) {
+            segment.index = index;
+            ring_buffer_receive_segment(video_buffer, &segment);
+        }
+    }
+    // Frame 2 has arrived, so all of frame 1's missing indices are nackable
+    segment.id = 2;
+    segment.index = 0;
+    segment.num_indices = 1;
+    ring_buffer_receive_segment(video_buffer, &segment);
+
+    NetworkSettings network_settings = {};
+    network_settings.video_bitrate = 100000000;
+    network_settings.burst_bitrate = 1000000000;
+    const double latency = 0.010;
+    WhistTimer current_time;
+
+    // Every missing index gets nacked once, all in the same batch
+    recorded_nack_indices.clear();
+    recorded_nack_batches = 0;
+    start_timer(&current_time);
+    try_recovering_missing_packets_or_frames(video_buffer, latency, 0, &network_settings,
+                                             &current_time);
+    EXPECT_EQ(recorded_nack_indices, missing_indices);
+    EXPECT_EQ(recorded_nack_batches, 1);
+
+    // Those nacks are still in flight, so nothing is nacked again
+    recorded_nack_indices.clear();
+    start_timer(&current_time);
+    try_recovering_missing_packets_or_frames(video_buffer, latency, 0, &network_settings,
+                                             &current_time);
+    EXPECT_TRUE(recorded_nack_indices.empty());
+
+    // Receive one of the nacked indices
+    segment.id = 1;
+    segment.index = 64;
+    segment.num_indices = num_indices;
+    segment.is_a_nack = true;
+    ring_buffer_receive_segment(video_buffer, &segment);
+
+    // Once the nacks may have been lost, the indices that are still missing get nacked again
+    whist_sleep(50);
+    recorded_nack_indices.clear();
+    recorded_nack_batches = 0;
+    start_timer(&current_time);
+    try_recovering_missing_packets_or_frames(video_buffer, latency, 0, &network_settings,
+                                             &current_time);
+    std::vector<int> still_missing_indices = missing_indices;
+    still_missing_indices.erase(
+        std::find(still_missing_indices.begin(), still_missing_indices.end(), 64));
+    EXPECT_EQ(recorded_nack_indices, still_missing_indices);
+    EXPECT_EQ(recorded_nack_batches, 1);
+
+    destroy_ring_buffer(video_buffer);
+}
+
+TEST_F(ProtocolTest, RingBufferPrefixTest) {
+    RingBuffer* video_buffer = init_ring_buffer(PACKET_VIDEO, LARGEST_VIDEOFRAME_SIZE, 10, NULL,
+                                                dummy_nack, NULL, dummy_stream_reset);
+    const int num_indices = 3;
+    const int last_segment_size = 10;
+    const int frame_size = 2 * MAX_PACKET_SEGMENT_SIZE + last_segment_size;
+    char* frame = (char*)safe_malloc(video_buffer->largest_frame_size);
+
+    // Nothing can be read of a frame that isn't being received
+    EXPECT_EQ(ring_buffer_read_frame_prefix(video_buffer, 1, frame, 0), -1);
+
+    WhistSegment segment = {};
+    segment.id = 1;
+    segment.num_indices = num_indices;
+    auto receive_index = [&](int index) {
+        segment.index = index;
+        segment.segment_size =
+            index == num_indices - 1 ? last_segment_size : MAX_PACKET_SEGMENT_SIZE;
+        memset(segment.segment_data, index + 1, segment.segment_size);
+        ring_buffer_receive_segment(video_buffer, &segment);
+    };
+
+    // Without the first packet, none of the frame can be read
+    receive_index(1);
+    EXPECT_EQ(ring_buffer_read_frame_prefix(video_buffer, 1, frame, 0), 0);
+
+    // The first packet makes both of the first two readable
+    receive_index(0);
+    EXPECT_EQ(ring_buffer_read_frame_prefix(video_buffer, 1, frame, 0),
+              2 * MAX_PACKET_SEGMENT_SIZE);
+    EXPECT_EQ(frame[0], 1);
+    EXPECT_EQ(frame[2 * MAX_PACKET_SEGMENT_SIZE - 1], 2);
+
+    // Only the rest of the frame gets read after that
+    memset(frame, 0, 2 * MAX_PACKET_SEGMENT_SIZE);
+    receive_index(2);
+    EXPECT_EQ(ring_buffer_read_frame_prefix(video_buffer, 1, frame, 2 * MAX_PACKET_SEGMENT_SIZE),
+              frame_size);
+    EXPECT_EQ(frame[0], 0);
+    EXPECT_EQ(frame[2 * MAX_PACKET_SEGMENT_SIZE], 3);
+    EXPECT_EQ(frame[frame_size - 1], 3);
+    EXPECT_TRUE(is_ready_to_render(video_buffer, 1));
+
+    free(frame);
+    destroy_ring_buffer(video_buffer);
+}
+
 TEST_F(ProtocolTest, FECTest) {
 #define NUM_FEC_PACKETS 4
 
@@ -1618,6 +1936,154 @@ TEST_F(ProtocolTest, FECTest) {
     destroy_fec_decoder(fec_decoder);
 }
 
+TEST_F(ProtocolTest, FECDecodeWithoutLossTest) {
+    const int num_real_buffers = 8;
+    const int num_fec_buffers = 2;
+    const int segment_size = 1280;
+    const int buffer_size = num_real_buffers * (segment_size - FEC_HEADER_SIZE) - 30;
+
+    EXPECT_EQ(init_fec(), 0);
+
+    char original_buffer[buffer_size];
+    for (int i = 0; i < buffer_size; i++) {
+        original_buffer[i] = (char)(i * 7);
+    }
+
+    FECEncoder* fec_encoder = create_fec_encoder(num_real_buffers, num_fec_buffers, segment_size);
+    fec_encoder_register_buffer(fec_encoder, original_buffer, buffer_size);
+    void* encoded_buffers[num_real_buffers + num_fec_buffers];
+    int encoded_buffer_sizes[num_real_buffers + num_fec_buffers];
+    fec_get_encoded_buffers(fec_encoder, encoded_buffers, encoded_buffer_sizes);
+
+    // Register every original buffer, in reverse order, and no FEC buffers
+    FECDecoder* fec_decoder = create_fec_decoder(num_real_buffers, num_fec_buffers, segment_size);
+    for (int i = num_real_buffers - 1; i >= 0; i--) {
+        EXPECT_EQ(fec_get_decoded_buffer(fec_decoder, NULL), -1);
+        fec_decoder_register_buffer(fec_decoder, i, encoded_buffers[i], encoded_buffer_sizes[i]);
+    }
+
+    char decoded_buffer[buffer_size];
+    EXPECT_EQ(fec_get_decoded_buffer(fec_decoder, decoded_buffer), buffer_size);
+    EXPECT_EQ(memcmp(decoded_buffer, original_buffer, buffer_size), 0);
+
+    // Nothing was recovered, so the only work done was copying out the decoded buffer
+    EXPECT_EQ(fec_decoder_get_bytes_processed(fec_decoder), buffer_size);
+
+    destroy_fec_decoder(fec_decoder);
+    destroy_fec_encoder(fec_encoder);
+}
+
+static int fec_encode_thread(void* opaque) {
+    fec_encode_redundant_buffers((FECEncoder*)opaque);
+    return 0;
+}
+
+TEST_F(ProtocolTest, FECPipelinedEncodeTest) {
+    const int num_real_buffers = 40;
+    const int num_fec_buffers = 10;
+    const int num_total_buffers = num_real_buffers + num_fec_buffers;
+    const int segment_size = 1280;
+    const int buffer_size = num_real_buffers * (segment_size - FEC_HEADER_SIZE) - 500;
+
+    EXPECT_EQ(init_fec(), 0);
+
+    std::vector<char> original_buffer(buffer_size);
+    for (int i = 0; i < buffer_size; i++) {
+        original_buffer[i] = (char)(i * 13);
+    }
+
+    for (FECScheme scheme : {FEC_SCHEME_REED_SOLOMON, FEC_SCHEME_WIREHAIR}) {
+        FECEncoder* expected_encoder = create_fec_encoder_with_scheme(
+            scheme, num_real_buffers, num_fec_buffers, segment_size);
+        fec_encoder_register_buffer(expected_encoder, original_buffer.data(), buffer_size);
+        void* expected_buffers[num_total_buffers];
+        int expected_buffer_sizes[num_total_buffers];
+        fec_get_encoded_buffers(expected_encoder, expected_buffers, expected_buffer_sizes);
+
+        // Get the original buffers first, and compute the FEC buffers on another thread
+        FECEncoder* fec_encoder = create_fec_encoder_with_scheme(scheme, num_real_buffers,
+                                                                 num_fec_buffers, segment_size);
+        fec_encoder_register_buffer(fec_encoder, original_buffer.data(), buffer_size);
+        void* encoded_buffers[num_total_buffers];
+        int encoded_buffer_sizes[num_total_buffers];
+        fec_get_original_buffers(fec_encoder, encoded_buffers, encoded_buffer_sizes);
+        WhistThread thread = whist_create_thread(fec_encode_thread, "FEC Encode Thread",
+                                                 fec_encoder);
+        for (int i = 0; i < num_real_buffers; i++) {
+            EXPECT_EQ(encoded_buffer_sizes[i], expected_buffer_sizes[i]);
+            EXPECT_EQ(memcmp(encoded_buffers[i], expected_buffers[i], encoded_buffer_sizes[i]), 0);
+        }
+        whist_wait_thread(thread, NULL);
+
+        fec_get_encoded_buffers(fec_encoder, encoded_buffers, encoded_buffer_sizes);
+        for (int i = 0; i < num_total_buffers; i++) {
+            EXPECT_EQ(encoded_buffer_sizes[i], expected_buffer_sizes[i]);
+            EXPECT_EQ(memcmp(encoded_buffers[i], expected_buffers[i], encoded_buffer_sizes[i]), 0);
+        }
+
+        destroy_fec_encoder(fec_encoder);
+        destroy_fec_encoder(expected_encoder);
+    }
+}
+
+TEST_F(ProtocolTest, FECReusableEncoderTest) {
+    const int segment_size = 1280;
+    const int max_num_buffers = 300;
+
+    EXPECT_EQ(init_fec(), 0);
+
+    // Frames of different sizes and schemes, each split into a few pieces
+    struct {
+        FECScheme scheme;
+        int num_real_buffers;
+        int num_fec_buffers;
+        int buffer_size;
+    } frames[] = {
+        {FEC_SCHEME_REED_SOLOMON, 40, 10, 40 * (segment_size - FEC_HEADER_SIZE) - 500},
+        {FEC_SCHEME_WIREHAIR, 200, 40, 200 * (segment_size - FEC_HEADER_SIZE) - 7},
+        {FEC_SCHEME_REED_SOLOMON, 3, 1, 3 * (segment_size - FEC_HEADER_SIZE)},
+        {FEC_SCHEME_REED_SOLOMON, 250, 50, 250 * (segment_size - FEC_HEADER_SIZE) - 1000},
+        {FEC_SCHEME_WIREHAIR, 20, 5, 20 * (segment_size - FEC_HEADER_SIZE) - 100},
+    };
+
+    FECEncoder* fec_encoder = create_reusable_fec_encoder(max_num_buffers, segment_size);
+    for (const auto& frame : frames) {
+        int num_total_buffers = frame.num_real_buffers + frame.num_fec_buffers;
+        std::vector<char> original_buffer(frame.buffer_size);
+        for (int i = 0; i < frame.buffer_size; i++) {
+            original_buffer[i] = (char)(i * 7 + frame.num_real_buffers);
+        }
+
+        FECEncoder* expected_encoder = create_fec_encoder_with_scheme(
+            frame.scheme, frame.num_real_buffers, frame.num_fec_buffers, segment_size);
+        fec_encoder_register_buffer(expected_encoder, original_buffer.data(), frame.buffer_size);
+        std::vector<void*> expected_buffers(num_total_buffers);
+        std::vector<int> expected_buffer_sizes(num_total_buffers);
+        fec_get_encoded_buffers(expected_encoder, expected_buffers.data(),
+                                expected_buffer_sizes.data());
+
+        // Register the same frame in three uneven pieces, into the reused encoder
+        fec_encoder_reset(fec_encoder, frame.scheme, frame.num_real_buffers,
+                          frame.num_fec_buffers);
+        const void* pieces[3] = {original_buffer.data(), original_buffer.data() + 10,
+                                 original_buffer.data() + frame.buffer_size / 2};
+        int piece_sizes[3] = {10, frame.buffer_size / 2 - 10,
+                              frame.buffer_size - frame.buffer_size / 2};
+        fec_encoder_register_pieces(fec_encoder, pieces, piece_sizes, 3);
+        std::vector<void*> encoded_buffers(num_total_buffers);
+        std::vector<int> encoded_buffer_sizes(num_total_buffers);
+        fec_get_encoded_buffers(fec_encoder, encoded_buffers.data(), encoded_buffer_sizes.data());
+
+        for (int i = 0; i < num_total_buffers; i++) {
+            EXPECT_EQ(encoded_buffer_sizes[i], expected_buffer_sizes[i]);
+            EXPECT_EQ(memcmp(encoded_buffers[i], expected_buffers[i], encoded_buffer_sizes[i]), 0);
+        }
+
+        destroy_fec_encoder(expected_encoder);
+    }
+    destroy_fec_encoder(fec_encoder);
+}
+
 TEST_F(ProtocolTest, FECTest2) {
     WhistTimer timer;
     WhistTimer timer2;
@@ -1794,6 +2260,111 @@ TEST_F(ProtocolTest, WirehairTest) {
     EXPECT_EQ(wirehair_auto_test(), 0);
 }
 
+TEST_F(ProtocolTest, FECWirehairSchemeTest) {
+    const int segment_size = 1280;
+    const int num_real_buffers = 600;
+    const int num_fec_buffers = 60;
+    const int num_total_buffers = num_real_buffers + num_fec_buffers;
+    const int buffer_size = num_real_buffers * (segment_size - FEC_HEADER_SIZE) - 100;
+
+    EXPECT_EQ(init_fec(), 0);
+
+    // Only frames that Reed-Solomon would have to partition are coded with Wirehair
+    EXPECT_EQ(fec_get_frame_scheme(FEC_SCHEME_REED_SOLOMON, num_real_buffers, num_fec_buffers),
+              FEC_SCHEME_REED_SOLOMON);
+    EXPECT_EQ(fec_get_frame_scheme(FEC_SCHEME_WIREHAIR, 100, 20), FEC_SCHEME_REED_SOLOMON);
+    EXPECT_EQ(fec_get_frame_scheme(FEC_SCHEME_WIREHAIR, num_real_buffers, num_fec_buffers),
+              FEC_SCHEME_WIREHAIR);
+
+    std::vector<char> original_buffer(buffer_size);
+    std::mt19937 g(1234);
+    for (int i = 0; i < buffer_size; i++) {
+        original_buffer[i] = (char)g();
+    }
+
+    FECEncoder* fec_encoder = create_fec_encoder_with_scheme(
+        FEC_SCHEME_WIREHAIR, num_real_buffers, num_fec_buffers, segment_size);
+    fec_encoder_register_buffer(fec_encoder, original_buffer.data(), buffer_size);
+    std::vector<void*> encoded_buffers(num_total_buffers);
+    std::vector<int> encoded_buffer_sizes(num_total_buffers);
+    fec_get_encoded_buffers(fec_encoder, encoded_buffers.data(), encoded_buffer_sizes.data());
+
+    // The original buffers are sent as-is
+    for (int i = 0; i < num_real_buffers - 1; i++) {
+        EXPECT_EQ(encoded_buffer_sizes[i], encoded_buffer_sizes[num_real_buffers]);
+    }
+
+    // Lose a burst of original buffers, and feed the rest in a shuffled order,
+    // starting with the last original buffer, which is shorter than the others
+    std::vector<int> indices;
+    for (int i = 50; i < num_total_buffers; i++) {
+        if (i != num_real_buffers - 1) indices.push_back(i);
+    }
+    std::shuffle(indices.begin(), indices.end(), g);
+    indices.insert(indices.begin(), num_real_buffers - 1);
+
+    FECDecoder* fec_decoder = create_fec_decoder_with_scheme(
+        FEC_SCHEME_WIREHAIR, num_real_buffers, num_fec_buffers, segment_size);
+    std::vector<char> decoded_buffer(buffer_size + segment_size);
+    int decoded_size = -1;
+    int num_fed = 0;
+    for (int index : indices) {
+        fec_decoder_register_buffer(fec_decoder, index, encoded_buffers[index],
+                                    encoded_buffer_sizes[index]);
+        num_fed++;
+        decoded_size = fec_get_decoded_buffer(fec_decoder, decoded_buffer.data());
+        if (decoded_size != -1) break;
+    }
+
+    EXPECT_EQ(decoded_size, buffer_size);
+    EXPECT_EQ(memcmp(decoded_buffer.data(), original_buffer.data(), buffer_size), 0);
+    // Wirehair rarely needs more than one buffer beyond the number of original buffers
+    EXPECT_LE(num_fed, num_real_buffers + 2);
+
+    destroy_fec_decoder(fec_decoder);
+    destroy_fec_encoder(fec_encoder);
+}
+
+TEST_F(ProtocolTest, GF256KernelTest) {
+    EXPECT_EQ(gf256_init(), 0);
+
+    // Odd sizes and offsets exercise the tail handling of every kernel
+    const int max_size = 1400;
+    std::vector<uint8_t> x(max_size + 64);
+    std::vector<uint8_t> z(max_size + 64);
+    std::vector<uint8_t> expected(max_size + 64);
+    std::mt19937 g(1234);
+
+    Gf256Kernel fastest_kernel = gf256_get_kernel();
+    for (int kernel = fastest_kernel; kernel >= GF256_KERNEL_SCALAR; kernel--) {
+        gf256_set_max_kernel((Gf256Kernel)kernel);
+        EXPECT_EQ(gf256_get_kernel(), kernel);
+        for (int iteration = 0; iteration < 200; iteration++) {
+            int size = g() % max_size;
+            int offset = g() % 64;
+            uint8_t y = (uint8_t)g();
+            for (size_t i = 0; i < x.size(); i++) {
+                x[i] = (uint8_t)g();
+                z[i] = (uint8_t)g();
+            }
+
+            expected = z;
+            for (int i = 0; i < size; i++) {
+                expected[offset + i] ^= gf256_mul(x[i], y);
+            }
+            gf256_muladd_mem(z.data() + offset, y, x.data(), size);
+            EXPECT_EQ(z, expected) << "muladd with " << gf256_kernel_to_str((Gf256Kernel)kernel);
+
+            for (int i = 0; i < size; i++) {
+                expected[offset + i] = gf256_mul(x[i], y);
+            }
+            gf256_mul_mem(z.data() + offset, x.data(), y, size);
+            EXPECT_EQ(z, expected) << "mul with " << gf256_kernel_to_str((Gf256Kernel)kernel);
+        }
+    }
+    gf256_set_max_kernel(fastest_kernel);
+}
+
 typedef struct {
     LINKED_LIST_HEADER;
     int id;
@@ -1931,6 +2502,134 @@ TEST_F(ProtocolTest, QueueTest) {
     EXPECT_EQ(fifo_queue_enqueue_item(NULL, &item), -1);
 }
 
+TEST_F(ProtocolTest, TripleBufferTest) {
+    int slots[TRIPLE_BUFFER_SLOTS];
+    TripleBuffer* buffer = triple_buffer_create();
+    ASSERT_TRUE(buffer != NULL);
+
+    // Nothing has been published yet
+    EXPECT_FALSE(triple_buffer_is_pending(buffer));
+    EXPECT_EQ(triple_buffer_acquire(buffer), -1);
+    EXPECT_FALSE(triple_buffer_wait(buffer, 10));
+
+    // One item goes through, and leaves its slot with the consumer
+    int first_slot = triple_buffer_get_write_slot(buffer);
+    slots[first_slot] = 1;
+    EXPECT_FALSE(triple_buffer_publish(buffer));
+    EXPECT_TRUE(triple_buffer_is_pending(buffer));
+    EXPECT_NE(triple_buffer_get_write_slot(buffer), first_slot);
+    EXPECT_TRUE(triple_buffer_wait(buffer, 10));
+    EXPECT_EQ(triple_buffer_acquire(buffer), first_slot);
+    EXPECT_EQ(slots[first_slot], 1);
+    EXPECT_FALSE(triple_buffer_is_pending(buffer));
+    EXPECT_EQ(triple_buffer_acquire(buffer), -1);
+
+    // The producer never gets the slot that the consumer holds
+    int held_slot = first_slot;
+    for (int i = 2; i < 10; i++) {
+        int slot = triple_buffer_get_write_slot(buffer);
+        EXPECT_NE(slot, held_slot);
+        slots[slot] = i;
+        // Every item after the first of this loop replaces the previous one
+        EXPECT_EQ(triple_buffer_publish(buffer), i > 2);
+    }
+    int latest_slot = triple_buffer_acquire(buffer);
+    ASSERT_GE(latest_slot, 0);
+    EXPECT_NE(latest_slot, held_slot);
+    EXPECT_EQ(slots[latest_slot], 9);
+    EXPECT_EQ(triple_buffer_acquire(buffer), -1);
+
+    // Waking the consumer doesn't give it an item
+    triple_buffer_wake(buffer);
+    EXPECT_TRUE(triple_buffer_wait(buffer, 10));
+
+    triple_buffer_destroy(buffer);
+}
+
+typedef struct {
+    TimingWheelTimer timer;
+    int id;
+} TestTimer;
+
+// The IDs of the test timers that fired, in order
+static std::vector<int> fired_timer_ids;
+
+static void record_fired_timer(void* opaque, TimingWheelTimer* timer) {
+    TestTimer* test_timer = (TestTimer*)timer;
+    EXPECT_FALSE(test_timer->timer.scheduled);
+    fired_timer_ids.push_back(test_timer->id);
+    // Rescheduling a timer that fired for right now only fires it again on the next advance
+    if (opaque != NULL) {
+        timing_wheel_schedule((TimingWheel*)opaque, timer, test_timer->timer.deadline);
+    }
+}
+
+static void reschedule_timer_one_turn_later(void* opaque, TimingWheelTimer* timer) {
+    TestTimer* test_timer = (TestTimer*)timer;
+    fired_timer_ids.push_back(test_timer->id);
+    // 64 ticks later, which is back in the same slot of the lowest level
+    timing_wheel_schedule((TimingWheel*)opaque, timer,
+                          (test_timer->timer.deadline_tick + 64.5) * 0.001);
+}
+
+TEST_F(ProtocolTest, TimingWheelTest) {
+    TimingWheel* wheel = timing_wheel_create(0.001);
+    TestTimer timers[4] = {};
+    for (int i = 0; i < 4; i++) {
+        timers[i].id = i;
+    }
+    WhistTimer now;
+    start_timer(&now);
+    double start = timing_wheel_get_time(wheel, &now);
+    timing_wheel_schedule(wheel, &timers[0].timer, start + 0.002);
+    // This one is on a higher level of the wheel, and has to be cascaded down
+    timing_wheel_schedule(wheel, &timers[1].timer, start + 0.080);
+    timing_wheel_schedule(wheel, &timers[2].timer, start + 0.030);
+    timing_wheel_schedule(wheel, &timers[3].timer, start + 10.0);
+    timing_wheel_cancel(wheel, &timers[2].timer);
+    EXPECT_FALSE(timers[2].timer.scheduled);
+
+    // Nothing is due yet
+    fired_timer_ids.clear();
+    EXPECT_EQ(timing_wheel_advance(wheel, &now, record_fired_timer, NULL), 0);
+
+    whist_sleep(20);
+    start_timer(&now);
+    EXPECT_EQ(timing_wheel_advance(wheel, &now, record_fired_timer, NULL), 1);
+    EXPECT_EQ(fired_timer_ids, std::vector<int>({0}));
+
+    whist_sleep(80);
+    start_timer(&now);
+    fired_timer_ids.clear();
+    EXPECT_EQ(timing_wheel_advance(wheel, &now, record_fired_timer, wheel), 1);
+    EXPECT_EQ(fired_timer_ids, std::vector<int>({1}));
+    EXPECT_TRUE(timers[1].timer.scheduled);
+
+    // The rescheduled timer, and a timer whose deadline has already passed, fire next time
+    timing_wheel_schedule(wheel, &timers[2].timer, start);
+    whist_sleep(2);
+    start_timer(&now);
+    fired_timer_ids.clear();
+    EXPECT_EQ(timing_wheel_advance(wheel, &now, record_fired_timer, NULL), 2);
+    EXPECT_EQ(fired_timer_ids, std::vector<int>({1, 2}));
+
+    // A timer that's rescheduled from its callback into the slot that's firing, a full turn of the
+    // wheel later, waits for that turn
+    start_timer(&now);
+    timing_wheel_schedule(wheel, &timers[0].timer, timing_wheel_get_time(wheel, &now));
+    whist_sleep(2);
+    start_timer(&now);
+    fired_timer_ids.clear();
+    EXPECT_EQ(timing_wheel_advance(wheel, &now, reschedule_timer_one_turn_later, wheel), 1);
+    EXPECT_EQ(fired_timer_ids, std::vector<int>({0}));
+    EXPECT_TRUE(timers[0].timer.scheduled);
+    timing_wheel_cancel(wheel, &timers[0].timer);
+
+    EXPECT_TRUE(timers[3].timer.scheduled);
+    timing_wheel_cancel(wheel, &timers[3].timer);
+    timing_wheel_destroy(wheel);
+}
+
 int test_virtual_intr(void* arg) {
 #define VIRTUAL_INTERRUPT_MS 500
     whist_usleep(VIRTUAL_INTERRUPT_MS * US_IN_MS);
@@ -1974,6 +2673,7 @@ TEST_F(ProtocolTest, VirtualEventTest) {
 
 TEST_F(ProtocolTest, WCCTest) {
     void* fec_controller = create_fec_controller(get_timestamp_sec());
+    CongestionController* wcc = create_congestion_controller(wcc_get_function_table());
 
     const int width = 1920;
     const int height = 1080;
@@ -1988,16 +2688,16 @@ TEST_F(ProtocolTest, WCCTest) {
     double packet_loss_ratio = 0.0;
 
     EXPECT_EQ(network_settings.saturate_bandwidth, true);
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     // No change in bitrates as timers would have just initialized in the first call.
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
     EXPECT_EQ(network_settings.saturate_bandwidth, true);
 
     // Wait for little more than NEW_BITRATE_DURATION_IN_SEC, for WCC to react
     whist_sleep((uint32_t)(NEW_BITRATE_DURATION_IN_SEC * 1.1 * MS_IN_SECOND));
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     expected_video_bitrate *= (1.0 + MAX_INCREASE_PERCENTAGE / 100.0);
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
     EXPECT_EQ(network_settings.burst_bitrate, network_settings.video_bitrate);
@@ -2006,14 +2706,14 @@ TEST_F(ProtocolTest, WCCTest) {
     // Cause congestion to see if WCC reacts.
     incoming_bitrate = 4000000;
     packet_loss_ratio = 0.11;
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     // No change in bitrate as congestion should be present for atleast
     // OVERUSE_TIME_THRESHOLD_IN_SEC
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
     whist_sleep(OVERUSE_TIME_THRESHOLD_IN_SEC * 1.1 * MS_IN_SECOND);
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     // Now bitrate should have dropped to something lesser than incoming_bitrate
     EXPECT_LT(network_settings.video_bitrate, incoming_bitrate);
     EXPECT_EQ(network_settings.saturate_bandwidth, true);
@@ -2023,15 +2723,15 @@ TEST_F(ProtocolTest, WCCTest) {
     incoming_bitrate = 2000000;
     packet_loss_ratio = 0.11;
     expected_video_bitrate = network_settings.video_bitrate;
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     whist_sleep(OVERUSE_TIME_THRESHOLD_IN_SEC * 1.1 * MS_IN_SECOND);
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
     whist_sleep((uint32_t)(NEW_BITRATE_DURATION_IN_SEC * 1.1 * MS_IN_SECOND));
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     EXPECT_LT(network_settings.video_bitrate, incoming_bitrate);
     EXPECT_EQ(network_settings.saturate_bandwidth, true);
 
@@ -2040,8 +2740,8 @@ TEST_F(ProtocolTest, WCCTest) {
     packet_loss_ratio = 0.11;
     expected_video_bitrate = width * height * MINIMUM_BITRATE_PER_PIXEL;
     whist_sleep((uint32_t)(NEW_BITRATE_DURATION_IN_SEC * 1.1 * MS_IN_SECOND));
-    whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
     EXPECT_EQ(network_settings.burst_bitrate, network_settings.video_bitrate);
     EXPECT_EQ(network_settings.saturate_bandwidth, true);
@@ -2052,8 +2752,9 @@ TEST_F(ProtocolTest, WCCTest) {
         packet_loss_ratio = 0.0;
         expected_video_bitrate = width * height * MINIMUM_BITRATE_PER_PIXEL;
         whist_sleep((uint32_t)(NEW_BITRATE_DURATION_IN_SEC * 1.1 * MS_IN_SECOND));
-        whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                    packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+        congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                     packet_loss_ratio, 0.0, 0.0, &network_settings,
+                                     fec_controller);
     }
     expected_video_bitrate = width * height * MAXIMUM_BITRATE_PER_PIXEL;
     EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
@@ -2072,13 +2773,80 @@ TEST_F(ProtocolTest, WCCTest) {
             packet_loss_ratio = 0.0;
         }
         whist_sleep((uint32_t)(NEW_BITRATE_DURATION_IN_SEC * 0.51 * MS_IN_SECOND));
-        whist_congestion_controller(&curr_group_stats, &prev_group_stats, incoming_bitrate,
-                                    packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+        congestion_controller_update(wcc, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                     packet_loss_ratio, 0.0, 0.0, &network_settings,
+                                     fec_controller);
     }
     EXPECT_LT(network_settings.video_bitrate, available_bandwidth);
     EXPECT_GT(network_settings.video_bitrate, available_bandwidth * CONVERGENCE_THRESHOLD_LOW);
     EXPECT_EQ(network_settings.saturate_bandwidth, false);
 
+    destroy_congestion_controller(wcc);
+    destroy_fec_controller(fec_controller);
+}
+
+TEST_F(ProtocolTest, DelayGradientCongestionControlTest) {
+    void* fec_controller = create_fec_controller(get_timestamp_sec());
+    CongestionController* dg = create_congestion_controller(delay_gradient_get_function_table());
+
+    const int width = 1920;
+    const int height = 1080;
+    network_algo_set_dimensions(width, height);
+    network_algo_set_dpi(192);
+    NetworkSettings network_settings = get_starting_network_settings();
+    int expected_video_bitrate = width * height * STARTING_BITRATE_PER_PIXEL;
+    GroupStats curr_group_stats = {0, 0, 0};
+    GroupStats prev_group_stats = {0, 0, 0};
+    int incoming_bitrate = expected_video_bitrate * 0.97;
+    double packet_loss_ratio = 0.0;
+
+    // No change in bitrates until the first phase is over
+    congestion_controller_update(dg, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+
+    // Startup grows the bitrate every phase, while saturating the bandwidth to measure it
+    whist_sleep((uint32_t)(DG_PHASE_DURATION_SEC * 1.1 * MS_IN_SECOND));
+    EXPECT_TRUE(congestion_controller_update(dg, &curr_group_stats, &prev_group_stats,
+                                             incoming_bitrate, packet_loss_ratio, 0.0, 0.0,
+                                             &network_settings, fec_controller));
+    expected_video_bitrate *= DG_STARTUP_GAIN;
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+    EXPECT_EQ(network_settings.saturate_bandwidth, true);
+
+    // Packet loss is congestion, which is reacted to right away
+    incoming_bitrate = 4000000;
+    packet_loss_ratio = 0.11;
+    congestion_controller_update(dg, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    expected_video_bitrate = (int)(incoming_bitrate * DG_DECREASE_RATIO);
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+    EXPECT_EQ(network_settings.saturate_bandwidth, false);
+    EXPECT_EQ(network_settings.congestion_detected, true);
+
+    // But the queue gets some time to drain before the next decrease
+    incoming_bitrate = 2000000;
+    congestion_controller_update(dg, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+
+    // Severe congestion starts over from the minimum bitrate, though not right after an update
+    whist_sleep(50);
+    EXPECT_TRUE(congestion_controller_handle_severe_congestion(dg, &network_settings));
+    expected_video_bitrate = width * height * MINIMUM_BITRATE_PER_PIXEL;
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+    EXPECT_EQ(network_settings.saturate_bandwidth, true);
+
+    // And the bandwidth is searched for again once the congestion is gone
+    incoming_bitrate = expected_video_bitrate;
+    packet_loss_ratio = 0.0;
+    whist_sleep((uint32_t)(DG_PHASE_DURATION_SEC * 1.1 * MS_IN_SECOND));
+    congestion_controller_update(dg, &curr_group_stats, &prev_group_stats, incoming_bitrate,
+                                 packet_loss_ratio, 0.0, 0.0, &network_settings, fec_controller);
+    expected_video_bitrate *= DG_STARTUP_GAIN;
+    EXPECT_EQ(network_settings.video_bitrate, expected_video_bitrate);
+
+    destroy_congestion_controller(dg);
     destroy_fec_controller(fec_controller);
 }
 
@@ -2579,6 +3347,283 @@ TEST_F(ProtocolTest, TCPSocketPairTest) {
     destroy_socket_context(&client);
 }
 
+#if OS_IS(OS_LINUX)
+TEST_F(ProtocolTest, UDPRecvTimestampTest) {
+    // Datagrams that weren't stamped get the fallback time
+    struct msghdr unstamped_hdr = {};
+    EXPECT_EQ(udp_get_recv_timestamp(&unstamped_hdr, 1234), 1234);
+
+    whist_init_networking();
+    SOCKET receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    SOCKET sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(receiver, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(getsockname(receiver, (struct sockaddr*)&addr, &addr_len), 0);
+    ASSERT_TRUE(udp_enable_recv_timestamps(receiver));
+
+    // Two datagrams that arrive apart, but are pulled out of the socket by the same recvmmsg,
+    // keep their own arrival times
+    char data[2] = {0, 1};
+    timestamp_us before_send = current_time_us();
+    sendto(sender, &data[0], 1, 0, (struct sockaddr*)&addr, sizeof(addr));
+    whist_sleep(20);
+    sendto(sender, &data[1], 1, 0, (struct sockaddr*)&addr, sizeof(addr));
+
+    char buffers[2];
+    struct iovec iovecs[2];
+    char control[2][CMSG_SPACE(sizeof(struct timespec))];
+    struct mmsghdr msgs[2] = {};
+    for (int i = 0; i < 2; i++) {
+        iovecs[i].iov_base = &buffers[i];
+        iovecs[i].iov_len = 1;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+    ASSERT_EQ(recvmmsg(receiver, msgs, 2, MSG_WAITFORONE, NULL), 2);
+    timestamp_us first_arrival = udp_get_recv_timestamp(&msgs[0].msg_hdr, 0);
+    timestamp_us second_arrival = udp_get_recv_timestamp(&msgs[1].msg_hdr, 0);
+    EXPECT_GE(first_arrival, before_send);
+    // Sleeps never end early, so only a lower bound is safe to check
+    EXPECT_GE(second_arrival - first_arrival, 20 * US_IN_MS);
+
+    closesocket(sender);
+    closesocket(receiver);
+}
+#endif
+
+TEST_F(ProtocolTest, UDPSendPacketIovTest) {
+    whist_init_logger();
+    whist_init_networking();
+    SocketContext server, client;
+    const char* aes_key = "9d3ff73c663e13bce0780d1b95c89582";
+    WhistThread server_thread = whist_create_thread(
+        [](void* s) {
+            const char* k = "9d3ff73c663e13bce0780d1b95c89582";
+            return (int)create_udp_socket_context((SocketContext*)s, NULL, BASE_UDP_PORT, 1, 1000,
+                                                  false, k);
+        },
+        "udp_server_thread", &server);
+    EXPECT_TRUE(
+        create_udp_socket_context(&client, "127.0.0.1", BASE_UDP_PORT, 1, 1000, false, aes_key));
+    int server_ret;
+    whist_wait_thread(server_thread, &server_ret);
+    EXPECT_EQ(server_ret, 1);
+
+    const int frame_size = 5000;
+    udp_register_nack_buffer(&server, PACKET_VIDEO, PACKET_HEADER_SIZE + frame_size, 4);
+    udp_handle_network_settings(server.context, get_default_network_settings(1920, 1080, 96));
+    udp_register_ring_buffer(&client, PACKET_VIDEO, frame_size, 16);
+
+    // A frame split into a header piece and a data piece, which spans several segments
+    VideoFrame frame = {0};
+    frame.frame_type = VIDEO_FRAME_TYPE_INTRA;
+    frame.videodata_length = frame_size - (int)sizeof(VideoFrame);
+    std::vector<uint8_t> videodata(frame.videodata_length);
+    for (size_t i = 0; i < videodata.size(); i++) {
+        videodata[i] = (uint8_t)(i * 7 + 3);
+    }
+    WhistIOVec frame_iov[2] = {{&frame, sizeof(VideoFrame)},
+                               {videodata.data(), frame.videodata_length}};
+    EXPECT_EQ(udp_send_packet_iov(&server, PACKET_VIDEO, frame_iov, 2, 1, true), 0);
+
+    // The payload must land on data[] exactly as it was sent
+    WhistPacket* packet = NULL;
+    WhistTimer timer;
+    start_timer(&timer);
+    while (!packet && get_timer(&timer) < 5.0) {
+        socket_update(&client);
+        packet = (WhistPacket*)get_packet(&client, PACKET_VIDEO);
+    }
+    ASSERT_TRUE(packet != NULL);
+    EXPECT_EQ(packet->id, 1);
+    EXPECT_EQ(packet->payload_size, frame_size);
+    EXPECT_EQ(memcmp(packet->data, &frame, sizeof(VideoFrame)), 0);
+    EXPECT_EQ(memcmp(packet->data + sizeof(VideoFrame), videodata.data(), videodata.size()), 0);
+    free_packet(&client, packet);
+
+    destroy_socket_context(&server);
+    destroy_socket_context(&client);
+}
+
+TEST_F(ProtocolTest, UDPCompactSegmentRoundTripTest) {
+    whist_init_logger();
+    whist_init_networking();
+    SocketContext server, client;
+    const char* aes_key = "9d3ff73c663e13bce0780d1b95c89582";
+    WhistThread server_thread = whist_create_thread(
+        [](void* s) {
+            const char* k = "9d3ff73c663e13bce0780d1b95c89582";
+            return (int)create_udp_socket_context((SocketContext*)s, NULL, BASE_UDP_PORT, 1, 1000,
+                                                  false, k);
+        },
+        "udp_server_thread", &server);
+    EXPECT_TRUE(
+        create_udp_socket_context(&client, "127.0.0.1", BASE_UDP_PORT, 1, 1000, false, aes_key));
+    int server_ret;
+    whist_wait_thread(server_thread, &server_ret);
+    EXPECT_EQ(server_ret, 1);
+
+    WhistSegment sent = {};
+    sent.whist_type = PACKET_VIDEO;
+    sent.id = 123456;
+    sent.index = 7;
+    sent.num_indices = 40;
+    sent.num_fec_indices = 4;
+    sent.segment_size = 5;
+    sent.prev_frame_num_duplicates = 2;
+    memcpy(sent.segment_data, "whist", 5);
+
+    // Step the group ID and departure time across several 16-bit and 32-bit wraparounds,
+    // by less than half of their range each time, so that they can be unwrapped
+    const int group_id_step = 1 << 14;
+    const timestamp_us departure_time_step = (timestamp_us)1 << 30;
+    int first_group_id = 65530;
+    timestamp_us first_departure_time = current_time_us() + ((timestamp_us)1 << 32) - 100;
+    int received_first_group_id = 0;
+    timestamp_us received_first_departure_time = 0;
+    for (int i = 0; i < 12; i++) {
+        WhistSegment segment = sent;
+        segment.departure_time = first_departure_time + i * departure_time_step;
+        int group_id = first_group_id + i * group_id_step;
+        // The retransmission flags share the first byte with the format and WhistPacketType
+        segment.is_a_nack = i % 3 == 1;
+        segment.is_a_duplicate = i % 3 == 2;
+        ASSERT_TRUE(udp_round_trip_compact_segment(server.context, client.context, &segment,
+                                                   &group_id));
+
+        EXPECT_EQ(segment.whist_type, PACKET_VIDEO);
+        EXPECT_EQ(segment.is_a_nack, i % 3 == 1);
+        EXPECT_EQ(segment.is_a_duplicate, i % 3 == 2);
+        EXPECT_EQ(segment.id, sent.id);
+        EXPECT_EQ(segment.index, sent.index);
+        EXPECT_EQ(segment.num_indices, sent.num_indices);
+        EXPECT_EQ(segment.num_fec_indices, sent.num_fec_indices);
+        EXPECT_EQ(segment.segment_size, sent.segment_size);
+        EXPECT_EQ(segment.prev_frame_num_duplicates, sent.prev_frame_num_duplicates);
+        EXPECT_EQ(memcmp(segment.segment_data, sent.segment_data, sent.segment_size), 0);
+
+        // Only differences matter, so they're compared against the first received segment
+        if (i == 0) {
+            received_first_group_id = group_id;
+            received_first_departure_time = segment.departure_time;
+        } else {
+            EXPECT_EQ(group_id - received_first_group_id, i * group_id_step);
+            EXPECT_EQ(segment.departure_time - received_first_departure_time,
+                      i * departure_time_step);
+        }
+    }
+
+    destroy_socket_context(&server);
+    destroy_socket_context(&client);
+}
+
+TEST_F(ProtocolTest, UDPRangeNackPackingTest) {
+    const int max_bits = BITS_TO_CHARS(MAX_VIDEO_PACKETS) * CHAR_BIT;
+    const int num_indices = 4 * max_bits;
+    const int num_words = (num_indices + 63) / 64;
+    struct {
+        std::vector<int> nacked;
+        int num_messages;
+    } cases[] = {
+        {{}, 0},
+        {{0}, 1},
+        // Byte and word boundaries, packed at an offset of 7
+        {{7, 8, 63, 64, 127, 128}, 1},
+        // The first and last bit of a full bitarray
+        {{1000, 1000 + max_bits - 1}, 1},
+        {{1000, 1000 + max_bits}, 2},
+        {{5, 6, 600, 601, 1200}, 3},
+        {{num_indices - 1}, 1},
+    };
+    for (const auto& test_case : cases) {
+        std::vector<uint64_t> indices(num_words, 0);
+        for (int index : test_case.nacked) {
+            indices[index / 64] |= (uint64_t)1 << (index % 64);
+        }
+        std::vector<uint64_t> received_indices(num_words, 0);
+        EXPECT_EQ(udp_round_trip_range_nacks(indices.data(), num_indices, received_indices.data()),
+                  test_case.num_messages);
+        EXPECT_EQ(received_indices, indices);
+    }
+
+    // Malformed nacks from the peer are dropped
+    EXPECT_TRUE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 1, 1000, max_bits));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 1, 1000, 0));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 1, 1000, max_bits + 1));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 1, -1, 8));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 1, INT_MAX, 8));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_AUDIO, 1, 0, 8));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(true, PACKET_VIDEO, 0, 0, 8));
+    // A UDP_BITARRAY_NACK's index is the first of its bits that's a nack
+    EXPECT_TRUE(udp_accepts_bitarray_nack(false, PACKET_VIDEO, 1, 3, 10));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(false, PACKET_VIDEO, 1, 10, 10));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(false, PACKET_VIDEO, 1, -1, 10));
+    EXPECT_FALSE(udp_accepts_bitarray_nack(false, PACKET_VIDEO, 1, 0, max_bits + 1));
+}
+
+TEST_F(ProtocolTest, UDPReceiveQueueTest) {
+    whist_init_logger();
+    whist_init_networking();
+    SocketContext server, client;
+    const char* aes_key = "9d3ff73c663e13bce0780d1b95c89582";
+    WhistThread server_thread = whist_create_thread(
+        [](void* s) {
+            const char* k = "9d3ff73c663e13bce0780d1b95c89582";
+            return (int)create_udp_socket_context((SocketContext*)s, NULL, BASE_UDP_PORT, 1, 1000,
+                                                  false, k);
+        },
+        "udp_server_thread", &server);
+    EXPECT_TRUE(
+        create_udp_socket_context(&client, "127.0.0.1", BASE_UDP_PORT, 1, 1000, false, aes_key));
+    int server_ret;
+    whist_wait_thread(server_thread, &server_ret);
+    EXPECT_EQ(server_ret, 1);
+
+    // Datagrams that are already waiting when the receive thread starts come in one batch,
+    // whose last datagram can't be decrypted. The packets before it must still be signalled.
+    const int num_decryptable = 3;
+    for (int i = 0; i < num_decryptable; i++) {
+        EXPECT_TRUE(udp_send_test_datagram(server.context, true));
+    }
+    EXPECT_TRUE(udp_send_test_datagram(server.context, false));
+    whist_sleep(50);
+    udp_start_receive_thread(&client);
+    EXPECT_TRUE(udp_wait_for_received_packets(client.context, 1000));
+    // Leftover connection confirmations may have been queued as well
+    EXPECT_GE(udp_get_num_received_packets(client.context), num_decryptable);
+    EXPECT_EQ(udp_get_num_dropped_packets(client.context), 0);
+
+    // Nothing is taken out of the queue, so it fills up, after which packets are dropped,
+    // while the receive thread keeps draining the socket
+    const int num_flood = 1500;
+    for (int i = 0; i < num_flood; i++) {
+        EXPECT_TRUE(udp_send_test_datagram(server.context, true));
+        if (i % 50 == 49) {
+            // Don't overflow the socket's buffer before the receive thread gets to it
+            whist_sleep(2);
+        }
+    }
+    WhistTimer timer;
+    start_timer(&timer);
+    int num_received, num_dropped;
+    do {
+        whist_sleep(10);
+        num_received = udp_get_num_received_packets(client.context);
+        num_dropped = udp_get_num_dropped_packets(client.context);
+    } while (num_received + num_dropped < num_decryptable + num_flood && get_timer(&timer) < 5.0);
+    EXPECT_GT(num_dropped, 0);
+    EXPECT_GT(num_received, num_flood / 2);
+    EXPECT_LE(num_received + num_dropped, num_decryptable + num_flood + 16);
+
+    destroy_socket_context(&server);
+    destroy_socket_context(&client);
+}
+
 /*
 ============================
 Run Tests
@@ -39,6 +39,31 @@ static WhistFeatureDescriptor feature_list[] = {
         .enabled = LTR_DEFAULT_SETTING,
         .name = "long-term reference frames",
     },
+    {
+        .feature = WHIST_FEATURE_PARALLEL_ENCRYPTION,
+        .enabled = false,
+        .name = "parallel encryption",
+    },
+    {
+        .feature = WHIST_FEATURE_KERNEL_PACING,
+        .enabled = false,
+        .name = "kernel pacing",
+    },
+    {
+        .feature = WHIST_FEATURE_WIREHAIR_FEC,
+        .enabled = false,
+        .name = "wirehair fec",
+    },
+    {
+        .feature = WHIST_FEATURE_PIPELINED_FEC,
+        .enabled = false,
+        .name = "pipelined fec",
+    },
+    {
+        .feature = WHIST_FEATURE_DELAY_GRADIENT_CONGESTION_CONTROL,
+        .enabled = false,
+        .name = "delay gradient congestion control",
+    },
 };
 
 static const WhistFeatureDescriptor *get_feature_descriptor(WhistFeature feature) {
@@ -34,6 +34,49 @@ typedef enum {
      * side.
      */
     WHIST_FEATURE_LONG_TERM_REFERENCE_FRAMES,
+    /**
+     * Encrypt the segments of a video frame in parallel.
+     *
+     * This hands the encryption of video segments to a pool of worker
+     * threads on the server side, so that the video send thread only
+     * has to throttle the segments and send them out.
+     */
+    WHIST_FEATURE_PARALLEL_ENCRYPTION,
+    /**
+     * Pace video packets in the kernel, rather than in the send thread.
+     *
+     * This gives each video packet a launch time with SO_TXTIME, so that
+     * the send thread never sleeps between bursts.  It only works on Linux
+     * servers whose network interface uses the fq qdisc; otherwise the
+     * server falls back to the regular network throttler.
+     */
+    WHIST_FEATURE_KERNEL_PACING,
+    /**
+     * Offer the Wirehair fountain code for FEC on video frames.
+     *
+     * Video frames that are too large for a single Reed-Solomon group
+     * are then coded with Wirehair, which can recover the whole frame
+     * from almost any set of as many packets as it has original packets.
+     * It is only used if the client also supports it, which is decided
+     * in the UDP handshake.
+     */
+    WHIST_FEATURE_WIREHAIR_FEC,
+    /**
+     * Compute the FEC packets of a video frame while sending it.
+     *
+     * The original packets of a frame don't depend on its FEC packets,
+     * so the server sends them right away, while a helper thread
+     * computes the FEC packets, which are sent after the originals.
+     */
+    WHIST_FEATURE_PIPELINED_FEC,
+    /**
+     * Use the delay-gradient congestion controller instead of WCC.
+     *
+     * It backs off when the trend of the packet delays shows a queue
+     * building up, and otherwise keeps the bitrate at the bandwidth
+     * that it measures, probing for more of it every few seconds.
+     */
+    WHIST_FEATURE_DELAY_GRADIENT_CONGESTION_CONTROL,
     /**
      * Number of supported feature flags.
      *
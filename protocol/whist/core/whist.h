@@ -230,6 +230,10 @@ Defines
 // frame sizes. But since LTR is enabled, I-frames are generated rarely with no/minimal effect on
 // streaming performance. Hence we would like keep this on par with Inter QP to avoid pixelation.
 #define MAX_INTRA_QP (MAX_QP)
+// Number of slices that the software encoder splits each frame into. Each slice is sent as its own
+// packet of the frame, so the client can decode the slices that have arrived while the rest of the
+// frame is still on the way.
+#define VIDEO_ENCODER_SLICES 4
 
 #define DEFAULT_BINARY_PRIVATE_KEY \
     ((const void*)"\xED\x5E\xF3\x3C\xD7\x28\xD1\x7D\xB8\x06\x45\x81\x42\x8D\x19\xEF")
@@ -18,6 +18,12 @@ Includes
 */
 
 #include <whist/core/whist.h>
+#include <whist/utils/atomic.h>
+
+#if !OS_IS(OS_WIN32)
+// Thread-exit destructors for the buffer pool's thread caches
+#include <pthread.h>
+#endif
 
 /*
 ============================
@@ -520,3 +526,413 @@ void deallocate_region(void* region) {
     }
 #endif
 }
+
+// ------------------------------------
+// Implementation of a size-classed buffer pool,
+// with a thread cache for small buffers
+// and a shared depot for everything else
+// ------------------------------------
+
+/*
+============================
+Defines
+============================
+*/
+
+// Size classes go up by half-powers of two, i.e. 4KB, 6KB, 8KB, 12KB, ... up to 8MB.
+// The sizes include the RegionHeader, so that every class is a whole number of pages.
+#define BUFFER_POOL_MIN_CLASS_SHIFT 12
+#define BUFFER_POOL_NUM_CLASSES 23
+// Buffers of this size class and below are cached per thread, up to THREAD_CACHE_BYTES per class,
+// and are moved to the depot when the thread exits. Bigger buffers always go through the depot.
+#define BUFFER_POOL_MAX_THREAD_CACHE_CLASS 8
+#define BUFFER_POOL_THREAD_CACHE_BYTES (256 * BYTES_IN_KILOBYTE)
+#define BUFFER_POOL_MAX_THREAD_CACHE_SIZE 16
+// How many buffers the depot keeps around per size class, like MAX_FREES of the block allocator
+#define BUFFER_POOL_MAX_DEPOT_SIZE MAX_FREES
+
+#if OS_IS(OS_WIN32)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// Tells the CPU that we're spinning on the depot lock, which saves power and lets the other
+// hyperthread of the core, which may well be holding the lock, run at full speed
+#if OS_IS(OS_WIN32)
+#define BUFFER_POOL_SPIN_PAUSE() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define BUFFER_POOL_SPIN_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define BUFFER_POOL_SPIN_PAUSE() __asm__ __volatile__("yield")
+#else
+#define BUFFER_POOL_SPIN_PAUSE()
+#endif
+
+/*
+============================
+Custom Types
+============================
+*/
+
+typedef struct {
+    int num_cached[BUFFER_POOL_MAX_THREAD_CACHE_CLASS + 1];
+    void* cached[BUFFER_POOL_MAX_THREAD_CACHE_CLASS + 1][BUFFER_POOL_MAX_THREAD_CACHE_SIZE];
+} BufferPoolThreadCache;
+
+typedef struct {
+    // Spinlock, since the critical sections are only a few instructions long,
+    // and since it needs no initialization
+    atomic_int lock;
+    int num_free_buffers;
+    void* free_buffers[BUFFER_POOL_MAX_DEPOT_SIZE];
+} BufferPoolDepot;
+
+typedef struct BufferPoolThreadCounters {
+    // Only ever written by their own thread, so that counting doesn't bounce a shared
+    // cache line between the cores. get_buffer_pool_stats sums them up without synchronizing
+    // with the thread, so a sum may miss the thread's latest operations.
+    int64_t hits;
+    int64_t misses;
+    int64_t allocations;
+    int64_t frees;
+    struct BufferPoolThreadCounters* prev;
+    struct BufferPoolThreadCounters* next;
+} BufferPoolThreadCounters;
+
+/*
+============================
+Globals
+============================
+*/
+
+static THREAD_LOCAL BufferPoolThreadCache buffer_pool_thread_cache;
+static THREAD_LOCAL BufferPoolThreadCounters buffer_pool_thread_counters;
+// Whether this thread will be flushed when it exits
+static THREAD_LOCAL bool buffer_pool_thread_registered;
+// Whether this thread has been flushed, after which it doesn't use its cache and counters anymore
+static THREAD_LOCAL bool buffer_pool_thread_exited;
+static BufferPoolDepot buffer_pool_depots[BUFFER_POOL_NUM_CLASSES];
+
+// The key whose destructor flushes a thread's cache when the thread exits
+#if OS_IS(OS_WIN32)
+static DWORD buffer_pool_thread_cache_key;
+static INIT_ONCE buffer_pool_thread_cache_key_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_key_t buffer_pool_thread_cache_key;
+static pthread_once_t buffer_pool_thread_cache_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+// The counters of the registered threads, the sums of those that have exited,
+// and the high water mark, all guarded by buffer_pool_counters_lock
+static atomic_int buffer_pool_counters_lock;
+static BufferPoolThreadCounters* buffer_pool_live_counters;
+static BufferPoolThreadCounters buffer_pool_exited_counters;
+static int64_t buffer_pool_high_water_buffers;
+
+/*
+============================
+Private Function Implementations
+============================
+*/
+
+static size_t get_buffer_class_size(int size_class) {
+    /*
+        Get the size of the regions of a size class, including their RegionHeader
+    */
+    size_t half_power = (size_t)1 << (BUFFER_POOL_MIN_CLASS_SHIFT + size_class / 2);
+    return size_class % 2 == 0 ? half_power : half_power + half_power / 2;
+}
+
+static int get_buffer_class_to_allocate(size_t region_size) {
+    /*
+        Get the smallest size class whose regions can hold region_size bytes,
+        or -1 if region_size is too large to be pooled
+    */
+    for (int size_class = 0; size_class < BUFFER_POOL_NUM_CLASSES; size_class++) {
+        if (get_buffer_class_size(size_class) >= region_size) {
+            return size_class;
+        }
+    }
+    return -1;
+}
+
+static int get_buffer_class_to_free(size_t region_size) {
+    /*
+        Get the largest size class that a region of region_size bytes can serve,
+        or -1 if it's too large to be pooled. This isn't always the class that it was
+        allocated for, since allocate_region rounds up to the OS page size.
+    */
+    if (region_size > get_buffer_class_size(BUFFER_POOL_NUM_CLASSES - 1)) {
+        return -1;
+    }
+    int size_class = 0;
+    while (size_class + 1 < BUFFER_POOL_NUM_CLASSES &&
+           get_buffer_class_size(size_class + 1) <= region_size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+static int get_thread_cache_size(int size_class) {
+    /*
+        Get how many buffers of a size class, up to BUFFER_POOL_MAX_THREAD_CACHE_CLASS,
+        may be cached per thread
+    */
+    return (int)min(BUFFER_POOL_THREAD_CACHE_BYTES / get_buffer_class_size(size_class),
+                    BUFFER_POOL_MAX_THREAD_CACHE_SIZE);
+}
+
+static void lock_buffer_pool(atomic_int* lock) {
+    int unlocked = 0;
+    while (!atomic_compare_exchange_weak(lock, &unlocked, 1)) {
+        // Only read the lock until it's free, so that we don't keep stealing its cache line
+        // from the thread that holds it
+        do {
+            BUFFER_POOL_SPIN_PAUSE();
+        } while (atomic_load(lock) != 0);
+        unlocked = 0;
+    }
+}
+
+static void unlock_buffer_pool(atomic_int* lock) { atomic_store(lock, 0); }
+
+static void add_buffer_pool_counters(BufferPoolThreadCounters* sums,
+                                     const BufferPoolThreadCounters* counters) {
+    sums->hits += counters->hits;
+    sums->misses += counters->misses;
+    sums->allocations += counters->allocations;
+    sums->frees += counters->frees;
+}
+
+static void release_to_buffer_pool_depot(int size_class, void* buffer) {
+    /*
+        Puts an unused buffer of a size class in the depot,
+        or frees it at an OS-level if the depot is full
+    */
+    BufferPoolDepot* depot = &buffer_pool_depots[size_class];
+    mark_unused_region(buffer);
+    lock_buffer_pool(&depot->lock);
+    if (depot->num_free_buffers < BUFFER_POOL_MAX_DEPOT_SIZE) {
+        depot->free_buffers[depot->num_free_buffers++] = buffer;
+        buffer = NULL;
+    }
+    unlock_buffer_pool(&depot->lock);
+    if (buffer != NULL) {
+        // The depot is full, so actually free the buffer at an OS-level
+        deallocate_region(buffer);
+    }
+}
+
+static void flush_buffer_pool_thread(void* opaque) {
+    /*
+        Moves the buffers of an exiting thread's cache to the depot, so that they aren't leaked,
+        and its counters to the exited sums. This is the destructor of
+        buffer_pool_thread_cache_key.
+    */
+    BufferPoolThreadCache* cache = (BufferPoolThreadCache*)opaque;
+    if (cache == NULL) {
+        return;
+    }
+    for (int size_class = 0; size_class <= BUFFER_POOL_MAX_THREAD_CACHE_CLASS; size_class++) {
+        while (cache->num_cached[size_class] > 0) {
+            release_to_buffer_pool_depot(
+                size_class, cache->cached[size_class][--cache->num_cached[size_class]]);
+        }
+    }
+
+    lock_buffer_pool(&buffer_pool_counters_lock);
+    BufferPoolThreadCounters* counters = &buffer_pool_thread_counters;
+    add_buffer_pool_counters(&buffer_pool_exited_counters, counters);
+    if (counters->prev != NULL) {
+        counters->prev->next = counters->next;
+    } else {
+        buffer_pool_live_counters = counters->next;
+    }
+    if (counters->next != NULL) {
+        counters->next->prev = counters->prev;
+    }
+    unlock_buffer_pool(&buffer_pool_counters_lock);
+    // Other destructors may still use the buffer pool after this one, but this thread's
+    // storage is about to go away, so they bypass the cache and counters
+    buffer_pool_thread_exited = true;
+}
+
+#if OS_IS(OS_WIN32)
+static VOID WINAPI flush_buffer_pool_thread_callback(PVOID opaque) {
+    flush_buffer_pool_thread(opaque);
+}
+
+static BOOL CALLBACK create_buffer_pool_thread_cache_key(PINIT_ONCE init_once, PVOID parameter,
+                                                         PVOID* context) {
+    UNUSED(init_once);
+    UNUSED(parameter);
+    UNUSED(context);
+    // Fiber local storage callbacks are also called when a thread exits
+    buffer_pool_thread_cache_key = FlsAlloc(flush_buffer_pool_thread_callback);
+    if (buffer_pool_thread_cache_key == FLS_OUT_OF_INDEXES) {
+        LOG_FATAL("FlsAlloc failed!");
+    }
+    return TRUE;
+}
+#else
+static void create_buffer_pool_thread_cache_key(void) {
+    if (pthread_key_create(&buffer_pool_thread_cache_key, flush_buffer_pool_thread) != 0) {
+        LOG_FATAL("pthread_key_create failed!");
+    }
+}
+#endif
+
+static void register_buffer_pool_thread(void) {
+    /*
+        Makes sure that this thread's cache and counters are flushed when the thread exits,
+        and lets get_buffer_pool_stats see its counters until then
+    */
+#if OS_IS(OS_WIN32)
+    InitOnceExecuteOnce(&buffer_pool_thread_cache_key_once, create_buffer_pool_thread_cache_key,
+                        NULL, NULL);
+    FlsSetValue(buffer_pool_thread_cache_key, &buffer_pool_thread_cache);
+#else
+    pthread_once(&buffer_pool_thread_cache_key_once, create_buffer_pool_thread_cache_key);
+    // The destructor is only called for a non-NULL value
+    pthread_setspecific(buffer_pool_thread_cache_key, &buffer_pool_thread_cache);
+#endif
+    lock_buffer_pool(&buffer_pool_counters_lock);
+    buffer_pool_thread_counters.prev = NULL;
+    buffer_pool_thread_counters.next = buffer_pool_live_counters;
+    if (buffer_pool_live_counters != NULL) {
+        buffer_pool_live_counters->prev = &buffer_pool_thread_counters;
+    }
+    buffer_pool_live_counters = &buffer_pool_thread_counters;
+    unlock_buffer_pool(&buffer_pool_counters_lock);
+    buffer_pool_thread_registered = true;
+}
+
+static void count_buffer_pool_operation(size_t counter_offset) {
+    /*
+        Increments one of this thread's counters, given by its offset in BufferPoolThreadCounters
+    */
+    if (!buffer_pool_thread_exited) {
+        if (!buffer_pool_thread_registered) {
+            register_buffer_pool_thread();
+        }
+        *(int64_t*)((char*)&buffer_pool_thread_counters + counter_offset) += 1;
+    } else {
+        // This thread's counters have already been added to the exited sums
+        lock_buffer_pool(&buffer_pool_counters_lock);
+        *(int64_t*)((char*)&buffer_pool_exited_counters + counter_offset) += 1;
+        unlock_buffer_pool(&buffer_pool_counters_lock);
+    }
+}
+
+/*
+============================
+Public Function Implementations
+============================
+*/
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+void* allocate_pooled_buffer(size_t size) {
+    /*
+        Allocates a buffer of at least the given size from the buffer pool.
+        Unlike allocate_region, the buffer is not zero-initialized.
+
+        Arguments:
+            size (size_t): The size of the buffer to allocate
+
+        Returns:
+            (void*): The new buffer
+    */
+
+    int size_class = get_buffer_class_to_allocate(size + sizeof(RegionHeader));
+    count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, allocations));
+    if (size_class == -1) {
+        // Too large to pool
+        count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, misses));
+        return allocate_region(size);
+    }
+
+    // Try this thread's cache first, which doesn't need to synchronize with anyone
+    if (size_class <= BUFFER_POOL_MAX_THREAD_CACHE_CLASS) {
+        BufferPoolThreadCache* cache = &buffer_pool_thread_cache;
+        if (cache->num_cached[size_class] > 0) {
+            count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, hits));
+            return cache->cached[size_class][--cache->num_cached[size_class]];
+        }
+    }
+
+    // Then the depot
+    BufferPoolDepot* depot = &buffer_pool_depots[size_class];
+    void* buffer = NULL;
+    lock_buffer_pool(&depot->lock);
+    if (depot->num_free_buffers > 0) {
+        buffer = depot->free_buffers[--depot->num_free_buffers];
+    }
+    unlock_buffer_pool(&depot->lock);
+    if (buffer != NULL) {
+        count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, hits));
+        mark_used_region(buffer);
+        return buffer;
+    }
+
+    // Otherwise, create a new buffer that fills up the whole size class
+    count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, misses));
+    return allocate_region(get_buffer_class_size(size_class) - sizeof(RegionHeader));
+}
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+void free_pooled_buffer(void* buffer) {
+    /*
+        Returns a buffer allocated by allocate_pooled_buffer to the buffer pool
+
+        Arguments:
+            buffer (void*): The buffer to free
+    */
+
+    count_buffer_pool_operation(offsetof(BufferPoolThreadCounters, frees));
+    RegionHeader* p = TO_REGION_HEADER(buffer);
+    int size_class = get_buffer_class_to_free(p->size);
+    if (size_class == -1) {
+        deallocate_region(buffer);
+        return;
+    }
+
+    // Small buffers are kept in this thread's cache, as they are
+    if (size_class <= BUFFER_POOL_MAX_THREAD_CACHE_CLASS && !buffer_pool_thread_exited) {
+        BufferPoolThreadCache* cache = &buffer_pool_thread_cache;
+        if (cache->num_cached[size_class] < get_thread_cache_size(size_class)) {
+            cache->cached[size_class][cache->num_cached[size_class]++] = buffer;
+            return;
+        }
+    }
+
+    // Everything else goes to the depot, which lets the OS reclaim the pages in the meantime
+    release_to_buffer_pool_depot(size_class, buffer);
+}
+
+void get_buffer_pool_stats(BufferPoolStats* stats) {
+    /*
+        Gets the buffer pool's statistics, by summing up the counters of all threads
+
+        Arguments:
+            stats (BufferPoolStats*): Receives the statistics
+    */
+
+    lock_buffer_pool(&buffer_pool_counters_lock);
+    BufferPoolThreadCounters sums = buffer_pool_exited_counters;
+    for (BufferPoolThreadCounters* counters = buffer_pool_live_counters; counters != NULL;
+         counters = counters->next) {
+        add_buffer_pool_counters(&sums, counters);
+    }
+    int64_t buffers_in_use = sums.allocations - sums.frees;
+    buffer_pool_high_water_buffers = max(buffer_pool_high_water_buffers, buffers_in_use);
+    stats->hits = sums.hits;
+    stats->misses = sums.misses;
+    stats->buffers_in_use = buffers_in_use;
+    stats->high_water_buffers = buffer_pool_high_water_buffers;
+    unlock_buffer_pool(&buffer_pool_counters_lock);
+}
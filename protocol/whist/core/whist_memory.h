@@ -8,6 +8,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * @defgroup memory Memory
@@ -137,6 +138,69 @@ void destroy_block_allocator(BlockAllocator* block_allocator);
 
 /** @} */
 
+/**
+ * @defgroup buffer_pool Buffer Pool
+ *
+ * Size-classed pool of buffers of any size, for buffers that are
+ * allocated and freed all the time, such as packets.
+ *
+ * Buffers are grouped into size classes, and freed buffers are kept
+ * around for reuse by their size class. Small buffers are cached per
+ * thread, so that a thread that keeps allocating and freeing them never
+ * touches any shared state. Everything else goes through a shared depot,
+ * which marks the buffers that it holds as unused regions.
+ *
+ * A buffer may be freed on a different thread than it was allocated on.
+ *
+ * @{
+ */
+
+/**
+ * @brief   Buffer pool statistics.
+ * @details Counters of the buffer pool since the start of the process,
+ *          across all threads and size classes. Each thread counts on its own,
+ *          so the counts of threads that are using the pool meanwhile may lag behind.
+ */
+typedef struct {
+    // Allocations that reused a pooled buffer
+    int64_t hits;
+    // Allocations that had to allocate a new region
+    int64_t misses;
+    // Buffers that are currently allocated and not freed yet
+    int64_t buffers_in_use;
+    // The greatest number of buffers in use that get_buffer_pool_stats has seen,
+    // since buffers_in_use is only summed up when the statistics are read
+    int64_t high_water_buffers;
+} BufferPoolStats;
+
+/**
+ * @brief                          Allocates a buffer of at least the given size from the
+ *                                 buffer pool. Unlike allocate_region,
+ *                                 the buffer is not zero-initialized.
+ *
+ * @param size                     The size of the buffer to allocate
+ *
+ * @returns                        The new buffer
+ */
+void* allocate_pooled_buffer(size_t size);
+
+/**
+ * @brief                          Returns a buffer allocated by allocate_pooled_buffer
+ *                                 to the buffer pool
+ *
+ * @param buffer                   The buffer to free
+ */
+void free_pooled_buffer(void* buffer);
+
+/**
+ * @brief                          Gets the buffer pool's statistics
+ *
+ * @param stats                    Receives the statistics
+ */
+void get_buffer_pool_stats(BufferPoolStats* stats);
+
+/** @} */
+
 /**
  * @defgroup region_allocator Region Allocator
  *
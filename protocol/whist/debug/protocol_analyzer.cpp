@@ -161,6 +161,9 @@ struct FrameLevelInfo {
     bool fec_used = 0;
     bool fec_used_after_nack = 0;  // fec is used after nack
 
+    double fec_decode_time_ms = -1;  // time spent decoding the fec frame, once it's decodable
+    int fec_decode_bytes = -1;       // bytes copied or processed while decoding the fec frame
+
     int num_received = 0;  // number of segments arrived in the frames, without counting duplicate
 
     // number of segments arrived without the is_nack flag, without counting duplicate
@@ -306,6 +309,12 @@ struct ProtocolAnalyzer {
         }
     }
 
+    void record_fec_decode(int type, int id, double decode_time_ms, int bytes_processed) {
+        FrameLevelInfo &info = type_level_infos[type].frames[id];
+        info.fec_decode_time_ms = decode_time_ms;
+        info.fec_decode_bytes = bytes_processed;
+    }
+
     void record_ready_to_render(int type, int id, char *frame_buffer) {
         if (frame_buffer == NULL) return;
         FrameLevelInfo &info = type_level_infos[type].frames[id];
@@ -625,6 +634,11 @@ void whist_analyzer_record_reset_ringbuffer(int type, int from_id, int to_id) {
 
 void whist_analyzer_record_fec_used(int type, int id) { FUNC_WRAPPER(record_fec_used, type, id); }
 
+void whist_analyzer_record_fec_decode(int type, int id, double decode_time_ms,
+                                      int bytes_processed) {
+    FUNC_WRAPPER(record_fec_decode, type, id, decode_time_ms, bytes_processed);
+}
+
 void whist_analyzer_record_stream_reset(int type, int id) {
     FUNC_WRAPPER(record_stream_reset, type, id);
 }
@@ -730,6 +744,12 @@ string FrameLevelInfo::to_string(bool more_format) {
         ss << "fec_used"
            << ",";
     }
+    if (fec_decode_time_ms != -1) {
+        ss << "fec_decode_time=" << fec_decode_time_ms;
+        if (more_format) ss << "ms";
+        ss << ",";
+        ss << "fec_decode_bytes=" << fec_decode_bytes << ",";
+    }
     if (skip_to != -1) ss << "skip_to=" << skip_to << ",";
     if (reset_ringbuffer_from != -1) ss << "reset_ringbuffer_from=" << reset_ringbuffer_from << ",";
     if (reset_ringbuffer_to != -1) ss << "reset_ringbuffer_to=" << reset_ringbuffer_to << ",";
@@ -915,6 +935,11 @@ string ProtocolAnalyzer::get_stat(int type, int num_of_records, int skip_last) {
 
     long long rough_bitrate_sum = 0;  // for cal rough avg of bitrate
 
+    double fec_decode_time_sum = 0.0;  // for cal avg of fec decode time
+    double max_fec_decode_time = 0.0;
+    long long fec_decode_bytes_sum = 0;  // for cal avg of bytes processed by fec decode
+    int fec_decode_cnt = 0;              // num of frames with fec decode info
+
     Timestamp begin_ts = -1;  // time of first seen frame
     Timestamp end_ts = 0;     // time of last seen frame
 
@@ -948,6 +973,13 @@ string ProtocolAnalyzer::get_stat(int type, int num_of_records, int skip_last) {
             fec_info_cnt++;
         }
 
+        if (it->second.fec_decode_time_ms != -1) {
+            fec_decode_time_sum += it->second.fec_decode_time_ms;
+            max_fec_decode_time = max(max_fec_decode_time, it->second.fec_decode_time_ms);
+            fec_decode_bytes_sum += it->second.fec_decode_bytes;
+            fec_decode_cnt++;
+        }
+
         if (it->second.current_cc_info.latency != -1) {
             min_latency = min(min_latency, it->second.current_cc_info.latency);
             max_latency = max(max_latency, it->second.current_cc_info.latency);
@@ -1093,6 +1125,12 @@ string ProtocolAnalyzer::get_stat(int type, int num_of_records, int skip_last) {
         ss << endl;
         ss << "actual_fec_overhead_ratio="
            << (double)total_fec_segments_size / total_segments_size * 100.0 << "%" << endl;
+
+        if (fec_decode_cnt > 0) {
+            ss << "fec_decode_time_avg=" << fec_decode_time_sum / fec_decode_cnt << "ms" << endl;
+            ss << "fec_decode_time_max=" << max_fec_decode_time << "ms" << endl;
+            ss << "fec_decode_bytes_avg=" << fec_decode_bytes_sum / fec_decode_cnt << endl;
+        }
     }
 
     ss << endl;
@@ -70,6 +70,9 @@ void whist_analyzer_record_skip(int type, int from_id, int to_id);
 // record fec is used for recover the frame
 void whist_analyzer_record_fec_used(int type, int id);
 
+// record the time and the bytes processed decoding the fec of a frame
+void whist_analyzer_record_fec_decode(int type, int id, double decode_time_ms, int bytes_processed);
+
 // record a stream_reset, with the id as greatest_faild_id
 void whist_analyzer_record_stream_reset(int type, int id);
 
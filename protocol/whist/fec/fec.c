@@ -4,6 +4,7 @@
 #include "fec.h"
 #include "whist/core/whist.h"
 #include "whist/fec/rs_wrapper.h"
+#include "whist/fec/wirehair/wirehair.h"
 
 // lugi's original library, Vandermonde Maxtrix, O(N^3+ N*X*L) decode
 // N is number of original packets, X is num of lost packets, L is max packet length
@@ -42,30 +43,53 @@ Defines
 #define MAX_BUFFER_SIZE ((1 << (8 * FEC_HEADER_SIZE)) - 1)
 
 struct FECEncoder {
+    FECScheme scheme;
     int num_accepted_buffers;
     int num_buffers;
     int num_real_buffers;
     int max_buffer_size;  // static, max allowed size
+    int max_num_buffers;  // static, the capacity of buffers, buffer_sizes and blocks
     int* buffer_sizes;
     void** buffers;
     int max_packet_size;  // max (original) buffer size fed into encoder so far.
                           // TODO: rename into max_accepted_buffer_size
-    RSWrapper* rs_code;
-    bool encode_performed;
+    RSWrapper* rs_code;      // only for FEC_SCHEME_REED_SOLOMON, kept across resets
+    WirehairCodec wirehair;  // only for FEC_SCHEME_WIREHAIR, kept across resets
+    // The framed original buffers followed by the FEC buffers, end-to-end in blocks of
+    // sizeof(uint16_t) + max_packet_size bytes. This has room for max_num_buffers blocks of
+    // max_buffer_size bytes, so that it never has to be reallocated.
+    char* blocks;
+    int num_encoded_fec_buffers;  // how many of buffers[num_real_buffers, num_buffers) are
+                                  // computed, from the start
 };
 
 struct FECDecoder {
+    FECScheme scheme;
     int num_accepted_buffers;
     int num_accepted_real_buffers;
     int num_buffers;
     int num_real_buffers;
     int max_buffer_size;  // static, max allowed size
     int* buffer_sizes;
+    // The registered buffers, by index. These are never copied, and after recovery the
+    // first num_real_buffers entries point at the original buffers, recovered or not
     void** buffers;
     int max_packet_size;  // max buffer size fed into decoder so far.
                           // TODO: rename into max_accepted_buffer_size
-    RSWrapper* rs_code;
+    RSWrapper* rs_code;      // only for FEC_SCHEME_REED_SOLOMON
+    WirehairCodec wirehair;  // only for FEC_SCHEME_WIREHAIR, created by the first full-size buffer
+    int wirehair_block_size;
+    bool wirehair_can_decode;
+    char* wirehair_blocks;  // the recovered original buffers, padded to max_packet_size
     bool recovery_performed;
+    // Scratch arrays handed to the RS decoder, allocated once with the decoder
+    void** decode_buffers;
+    int* decode_indices;
+    // Zero-padded copies of the registered buffers that are shorter than max_packet_size,
+    // which is usually only the last original buffer
+    char* padded_buffers;
+    // The number of bytes copied or run through the RS decoder so far
+    int bytes_processed;
 };
 
 /*
@@ -86,13 +110,85 @@ void write_u16_to_buffer(char* p, uint16_t w);
 // read a 16bit uint from buffer
 uint16_t read_u16_from_buffer(char* p);
 
+/**
+ * @brief                          Encodes the framed original buffers of a Wirehair encoder,
+ *                                 into some of the FEC buffers
+ *
+ * @param fec_encoder              The FEC encoder to encode with
+ *
+ * @param first_fec_buffer         The first FEC buffer to compute, which creates the
+ *                                 Wirehair codec if it's 0
+ *
+ * @param end_fec_buffer           The FEC buffer to stop at, exclusive
+ */
+static void wirehair_encode_buffers(FECEncoder* fec_encoder, int first_fec_buffer,
+                                    int end_fec_buffer);
+
+/**
+ * @brief                          Recovers the missing original buffers of a decoder that
+ *                                 has enough buffers to decode, in place. Afterwards, the first
+ *                                 `num_real_buffers` entries of `fec_decoder->buffers` point at
+ *                                 the original buffers, in order.
+ *
+ * @param fec_decoder              The FEC decoder to recover the buffers of
+ *
+ * @note                           Registered FEC buffers may be overwritten with recovered
+ *                                 original buffers. Registered original buffers are never
+ *                                 written to, and only the buffers shorter than
+ *                                 `max_packet_size` are copied, to pad them.
+ */
+static void recover_missing_buffers(FECDecoder* fec_decoder);
+
+/**
+ * @brief                          Feeds a registered buffer into a Wirehair decoder,
+ *                                 creating the Wirehair codec if the buffer tells us
+ *                                 the block size.
+ *
+ * @param fec_decoder              The FEC decoder to feed
+ *
+ * @param index                    The index of the registered buffer to feed
+ */
+static void wirehair_feed_buffer(FECDecoder* fec_decoder, int index);
+
+/**
+ * @brief                          Recovers the missing original buffers of a Wirehair decoder
+ *                                 that has enough buffers to decode. Afterwards, the first
+ *                                 `num_real_buffers` entries of `fec_decoder->buffers` point at
+ *                                 the original buffers, in order.
+ *
+ * @param fec_decoder              The FEC decoder to recover the buffers of
+ */
+static void wirehair_recover_missing_buffers(FECDecoder* fec_decoder);
+
 /*
 ============================
 Public Function Implementations
 ============================
 */
 
-int init_fec(void) { return init_rs_wrapper(); }
+int init_fec(void) {
+    static bool wirehair_initialized = false;
+    if (!wirehair_initialized) {
+        WirehairResult result = wirehair_init();
+        if (result != Wirehair_Success) {
+            LOG_ERROR("Failed to initialize wirehair: %s", wirehair_result_string(result));
+            return -1;
+        }
+        wirehair_initialized = true;
+    }
+    return init_rs_wrapper();
+}
+
+FECScheme fec_get_frame_scheme(FECScheme stream_scheme, int num_real_buffers,
+                               int num_fec_buffers) {
+    // Frames that fit in a single RS group are decoded optimally by Reed-Solomon,
+    // while Wirehair only pays off once Reed-Solomon would have to partition the frame
+    if (stream_scheme == FEC_SCHEME_WIREHAIR && num_real_buffers >= 2 &&
+        num_real_buffers + num_fec_buffers > RS_FIELD_SIZE) {
+        return FEC_SCHEME_WIREHAIR;
+    }
+    return FEC_SCHEME_REED_SOLOMON;
+}
 
 double fec_ratio_to_fec_factor(double fec_ratio) { return 1.0 / (1.0 - fec_ratio); }
 
@@ -110,25 +206,64 @@ int get_num_fec_packets(int num_real_packets, double fec_packet_ratio) {
 }
 
 FECEncoder* create_fec_encoder(int num_real_buffers, int num_fec_buffers, int max_buffer_size) {
+    return create_fec_encoder_with_scheme(FEC_SCHEME_REED_SOLOMON, num_real_buffers,
+                                          num_fec_buffers, max_buffer_size);
+}
+
+FECEncoder* create_fec_encoder_with_scheme(FECScheme scheme, int num_real_buffers,
+                                           int num_fec_buffers, int max_buffer_size) {
+    FECEncoder* fec_encoder =
+        create_reusable_fec_encoder(num_real_buffers + num_fec_buffers, max_buffer_size);
+    fec_encoder_reset(fec_encoder, scheme, num_real_buffers, num_fec_buffers);
+    return fec_encoder;
+}
+
+FECEncoder* create_reusable_fec_encoder(int max_num_buffers, int max_buffer_size) {
     FATAL_ASSERT(max_buffer_size <= MAX_BUFFER_SIZE);
     FATAL_ASSERT(max_buffer_size >= FEC_HEADER_SIZE);
+    FATAL_ASSERT(max_num_buffers > 0);
 
     FECEncoder* fec_encoder = safe_malloc(sizeof(*fec_encoder));
 
     fec_encoder->max_buffer_size = max_buffer_size;
+    fec_encoder->max_num_buffers = max_num_buffers;
+    fec_encoder->buffers = safe_malloc(sizeof(void*) * max_num_buffers);
+    fec_encoder->buffer_sizes = safe_malloc(sizeof(int) * max_num_buffers);
+    // Only the blocks that frames actually use get paged in
+    fec_encoder->blocks = allocate_region((size_t)max_num_buffers * max_buffer_size);
+    fec_encoder->rs_code = NULL;
+    fec_encoder->wirehair = NULL;
+
+    fec_encoder->scheme = FEC_SCHEME_REED_SOLOMON;
+    fec_encoder->num_real_buffers = 0;
+    fec_encoder->num_buffers = 0;
     fec_encoder->num_accepted_buffers = 0;
-    fec_encoder->num_real_buffers = num_real_buffers;
+    fec_encoder->max_packet_size = -1;
+    fec_encoder->num_encoded_fec_buffers = 0;
+
+    return fec_encoder;
+}
+
+void fec_encoder_reset(FECEncoder* fec_encoder, FECScheme scheme, int num_real_buffers,
+                       int num_fec_buffers) {
+    FATAL_ASSERT(scheme != FEC_SCHEME_WIREHAIR || num_real_buffers >= 2);
     int num_total_buffers = num_real_buffers + num_fec_buffers;
+    FATAL_ASSERT(num_total_buffers <= fec_encoder->max_num_buffers);
+
+    fec_encoder->scheme = scheme;
+    fec_encoder->num_accepted_buffers = 0;
+    fec_encoder->num_real_buffers = num_real_buffers;
     fec_encoder->num_buffers = num_total_buffers;
-    fec_encoder->buffers = safe_malloc(sizeof(void*) * num_total_buffers);
-    memset(fec_encoder->buffers, 0, sizeof(void*) * num_total_buffers);
-    fec_encoder->buffer_sizes = safe_malloc(sizeof(int) * num_total_buffers);
     fec_encoder->max_packet_size = -1;
-    fec_encoder->encode_performed = false;
-
-    fec_encoder->rs_code = rs_wrapper_create(num_real_buffers, num_real_buffers + num_fec_buffers);
+    fec_encoder->num_encoded_fec_buffers = 0;
 
-    return fec_encoder;
+    if (scheme == FEC_SCHEME_REED_SOLOMON) {
+        if (fec_encoder->rs_code == NULL) {
+            fec_encoder->rs_code = rs_wrapper_create(num_real_buffers, num_total_buffers);
+        } else {
+            rs_wrapper_reset(fec_encoder->rs_code, num_real_buffers, num_total_buffers);
+        }
+    }
 }
 
 int fec_encoder_get_num_real_buffers(int buffer_size, int real_buffer_size) {
@@ -136,129 +271,168 @@ int fec_encoder_get_num_real_buffers(int buffer_size, int real_buffer_size) {
 }
 
 void fec_encoder_register_buffer(FECEncoder* fec_encoder, void* buffer, int buffer_size) {
-    FATAL_ASSERT(buffer != NULL);
-    FATAL_ASSERT(0 <= buffer_size);
-
-    char* current_buffer_location = buffer;
-    int remaining_buffer_size = buffer_size;
+    FATAL_ASSERT(buffer != NULL || buffer_size == 0);
+    const void* pieces[1] = {buffer};
+    fec_encoder_register_pieces(fec_encoder, pieces, &buffer_size, 1);
+}
 
-    // handle special case of buffer_size is 0
-    if (buffer_size == 0) {
-        fec_encoder->buffers[0] = buffer;
-        fec_encoder->buffer_sizes[0] = 0;
-        fec_encoder->max_packet_size = 0;
-        fec_encoder->num_accepted_buffers = 1;
-        return;
+void fec_encoder_register_pieces(FECEncoder* fec_encoder, const void* const* pieces,
+                                 const int* piece_sizes, int num_pieces) {
+    FATAL_ASSERT(fec_encoder->num_accepted_buffers == 0);
+    int buffer_size = 0;
+    for (int i = 0; i < num_pieces; i++) {
+        FATAL_ASSERT(0 <= piece_sizes[i]);
+        buffer_size += piece_sizes[i];
     }
 
-    // calculate the number of segments needed
-    int num_of_segments_needed = 0;
-    while (remaining_buffer_size > 0) {
-        int current_buffer_size =
-            min(remaining_buffer_size, fec_encoder->max_buffer_size - FEC_HEADER_SIZE);
-        num_of_segments_needed++;
-        remaining_buffer_size -= current_buffer_size;
-    }
+    // calculate the number of segments needed,
+    // an empty buffer still needs a segment to carry its size
+    int num_of_segments_needed =
+        fec_encoder_get_num_real_buffers(buffer_size, fec_encoder->max_buffer_size);
     FATAL_ASSERT(num_of_segments_needed == fec_encoder->num_real_buffers);
-    FATAL_ASSERT(remaining_buffer_size == 0);
-
-    remaining_buffer_size = buffer_size;
 
-    // evenly distribute the segment sizes
+    // evenly distribute the segment sizes, so that only the last segment can be shorter
     int expected_buffer_size = int_div_roundup(buffer_size, num_of_segments_needed);
+    fec_encoder->max_packet_size = expected_buffer_size;
+    int block_size = sizeof(uint16_t) + expected_buffer_size;
 
-    while (remaining_buffer_size > 0) {
+    // The cursor into the pieces
+    int piece_index = 0;
+    int piece_offset = 0;
+
+    int remaining_buffer_size = buffer_size;
+    for (int i = 0; i < num_of_segments_needed; i++) {
         // If the buffer we were given is larger than max_buffer_size,
         // Then we split it up
         int current_buffer_size = min(remaining_buffer_size, expected_buffer_size);
+        char* block = fec_encoder->blocks + (size_t)i * block_size;
+
+        // write a small header infront of buffer, which is protected by FEC.
+        // so that even if this buffer got loss, we can recover the buffer length.
+        write_u16_to_buffer(block, (uint16_t)current_buffer_size);
+
+        // gather the segment from the pieces, right behind the header
+        char* write_location = block + sizeof(uint16_t);
+        int remaining_segment_size = current_buffer_size;
+        while (remaining_segment_size > 0) {
+            int copy_size = min(piece_sizes[piece_index] - piece_offset, remaining_segment_size);
+            memcpy(write_location, (const char*)pieces[piece_index] + piece_offset, copy_size);
+            write_location += copy_size;
+            remaining_segment_size -= copy_size;
+            piece_offset += copy_size;
+            // Move on to the next piece, once this one has been used up
+            if (piece_offset == piece_sizes[piece_index]) {
+                piece_index++;
+                piece_offset = 0;
+            }
+        }
 
-        // Check that we're not about to accept too many buffers,
-        // and then pass the buffer segment into the list of buffer segments
-        FATAL_ASSERT(fec_encoder->num_accepted_buffers + 1 <= fec_encoder->num_real_buffers);
-        fec_encoder->buffers[fec_encoder->num_accepted_buffers] = current_buffer_location;
-        fec_encoder->buffer_sizes[fec_encoder->num_accepted_buffers] = current_buffer_size;
-        fec_encoder->max_packet_size = max(fec_encoder->max_packet_size, current_buffer_size);
-        fec_encoder->num_accepted_buffers++;
+        // rs encoder requires packets to have equal length, so only the short last segment
+        // has to be padded with zeroes
+        if (current_buffer_size < expected_buffer_size) {
+            memset(write_location, 0, expected_buffer_size - current_buffer_size);
+        }
 
-        // Progress the buffer tracker
-        current_buffer_location += current_buffer_size;
+        fec_encoder->buffers[i] = block;
+        fec_encoder->buffer_sizes[i] = sizeof(uint16_t) + current_buffer_size;
         remaining_buffer_size -= current_buffer_size;
     }
+    fec_encoder->num_accepted_buffers = num_of_segments_needed;
 
-    FATAL_ASSERT(fec_encoder->num_accepted_buffers == fec_encoder->num_real_buffers);
     FATAL_ASSERT(remaining_buffer_size == 0);
 }
 
-void fec_get_encoded_buffers(FECEncoder* fec_encoder, void** buffers, int* buffer_sizes) {
+void fec_get_original_buffers(FECEncoder* fec_encoder, void** buffers, int* buffer_sizes) {
     FATAL_ASSERT(fec_encoder->num_accepted_buffers == fec_encoder->num_real_buffers);
-    if (!fec_encoder->encode_performed) {
-        // the size of actual data feed into fec_encoder
-        int fec_payload_size = sizeof(uint16_t) + fec_encoder->max_packet_size;
-
-        // rs encoder requires packets to have equal length, so we pad packets to max_buffer_size
-        for (int i = 0; i < fec_encoder->num_real_buffers; i++) {
-            // save a copy of the original buffer pointer and size
-            char* original_buffer = fec_encoder->buffers[i];
-            int original_size = fec_encoder->buffer_sizes[i];
 
-            FATAL_ASSERT(fec_encoder->buffers[i] != NULL);
+    // The original buffers were framed when they were registered
+    for (int i = 0; i < fec_encoder->num_real_buffers; i++) {
+        buffers[i] = fec_encoder->buffers[i];
+        buffer_sizes[i] = fec_encoder->buffer_sizes[i];
+    }
+}
 
-            // malloc buffers for feeding into the encoder
-            fec_encoder->buffers[i] = safe_malloc(fec_payload_size);
-            fec_encoder->buffer_sizes[i] = sizeof(uint16_t) + original_size;
+void fec_encode_redundant_buffers(FECEncoder* fec_encoder) {
+    fec_encode_redundant_buffers_until(fec_encoder,
+                                       fec_encoder->num_buffers - fec_encoder->num_real_buffers);
+}
 
-            write_u16_to_buffer(fec_encoder->buffers[i], (uint16_t)original_size);
+void fec_encode_redundant_buffers_until(FECEncoder* fec_encoder, int num_fec_buffers) {
+    FATAL_ASSERT(fec_encoder->num_accepted_buffers == fec_encoder->num_real_buffers);
+    FATAL_ASSERT(num_fec_buffers <= fec_encoder->num_buffers - fec_encoder->num_real_buffers);
+    int first_fec_buffer = fec_encoder->num_encoded_fec_buffers;
+    if (num_fec_buffers <= first_fec_buffer) {
+        return;
+    }
 
-            // write a small header infront of buffer, which is protected by FEC.
-            // so that even if this buffer got loss, we can recover the buffer length.
-            memcpy((char*)fec_encoder->buffers[i] + sizeof(uint16_t), original_buffer,
-                   original_size);
-            memset((char*)fec_encoder->buffers[i] + fec_encoder->buffer_sizes[i], 0,
-                   fec_payload_size - fec_encoder->buffer_sizes[i]);
-            // TODO, protential optimization
-            // if it's the assumption that all packet has same length excpet the last one, and the
-            // last one is shorter then only the last one needs padding
+    if (fec_encoder->scheme == FEC_SCHEME_WIREHAIR) {
+        wirehair_encode_buffers(fec_encoder, first_fec_buffer, num_fec_buffers);
+    } else {
+        // the size of actual data feed into fec_encoder
+        int fec_payload_size = sizeof(uint16_t) + fec_encoder->max_packet_size;
 
-            // TODO we can optimize special case of fec_packet num equal to 1  (using XOR)
+        // call rs encoder to generate new packets, into the blocks after the original buffers
+        for (int i = first_fec_buffer; i < num_fec_buffers; i++) {
+            int index = fec_encoder->num_real_buffers + i;
+            fec_encoder->buffers[index] = fec_encoder->blocks + (size_t)index * fec_payload_size;
+            fec_encoder->buffer_sizes[index] = fec_payload_size;
         }
+        rs_wrapper_encode_range(fec_encoder->rs_code, (void**)fec_encoder->buffers,
+                                fec_encoder->buffers + fec_encoder->num_real_buffers,
+                                first_fec_buffer, num_fec_buffers - first_fec_buffer,
+                                fec_payload_size);
+    }
+    fec_encoder->num_encoded_fec_buffers = num_fec_buffers;
+}
 
-        // call rs encoder to generate new packets
-        for (int i = fec_encoder->num_real_buffers; i < fec_encoder->num_buffers; i++) {
-            fec_encoder->buffers[i] = safe_malloc(fec_payload_size);
-            fec_encoder->buffer_sizes[i] = fec_payload_size;
-        }
-        rs_wrapper_encode(fec_encoder->rs_code, (void**)fec_encoder->buffers,
-                          fec_encoder->buffers + fec_encoder->num_real_buffers, fec_payload_size);
-        fec_encoder->encode_performed = true;
+void fec_get_redundant_buffers(FECEncoder* fec_encoder, int first_fec_buffer,
+                               int num_fec_buffers, void** buffers, int* buffer_sizes) {
+    for (int i = first_fec_buffer; i < first_fec_buffer + num_fec_buffers; i++) {
+        int index = fec_encoder->num_real_buffers + i;
+        buffers[index] = fec_encoder->buffers[index];
+        buffer_sizes[index] = fec_encoder->buffer_sizes[index];
+    }
+}
 
-    }  // currently we allow fec_get_encoded_buffers to be called multiple times,
+void fec_get_encoded_buffers(FECEncoder* fec_encoder, void** buffers, int* buffer_sizes) {
+    // currently we allow fec_get_encoded_buffers to be called multiple times,
     // the code can be simplified a bit if only allow once
+    fec_get_original_buffers(fec_encoder, buffers, buffer_sizes);
+    fec_encode_redundant_buffers(fec_encoder);
 
-    // Populate buffers and buffer_sizes
-    for (int i = 0; i < fec_encoder->num_buffers; i++) {
+    // Populate the FEC buffers and buffer_sizes
+    for (int i = fec_encoder->num_real_buffers; i < fec_encoder->num_buffers; i++) {
         buffers[i] = fec_encoder->buffers[i];
         buffer_sizes[i] = fec_encoder->buffer_sizes[i];
     }
 }
 
 void destroy_fec_encoder(FECEncoder* fec_encoder) {
-    int num_total_buffers = fec_encoder->num_buffers;
-    if (fec_encoder->encode_performed) {
-        for (int i = 0; i < num_total_buffers; i++) {
-            if (fec_encoder->buffers[i] != NULL) free(fec_encoder->buffers[i]);
-        }
+    if (fec_encoder->wirehair) {
+        wirehair_free(fec_encoder->wirehair);
     }
+    if (fec_encoder->rs_code) {
+        rs_wrapper_destroy(fec_encoder->rs_code);
+    }
+    deallocate_region(fec_encoder->blocks);
     free(fec_encoder->buffers);
     free(fec_encoder->buffer_sizes);
-    rs_wrapper_destroy(fec_encoder->rs_code);
     free(fec_encoder);
 }
 
 FECDecoder* create_fec_decoder(int num_real_buffers, int num_fec_buffers, int max_buffer_size) {
+    return create_fec_decoder_with_scheme(FEC_SCHEME_REED_SOLOMON, num_real_buffers,
+                                          num_fec_buffers, max_buffer_size);
+}
+
+FECDecoder* create_fec_decoder_with_scheme(FECScheme scheme, int num_real_buffers,
+                                           int num_fec_buffers, int max_buffer_size) {
     FATAL_ASSERT(max_buffer_size <= MAX_BUFFER_SIZE);
+    FATAL_ASSERT(scheme != FEC_SCHEME_WIREHAIR || num_real_buffers >= 2);
 
     FECDecoder* fec_decoder = safe_malloc(sizeof(*fec_decoder));
 
+    fec_decoder->scheme = scheme;
     int num_total_buffers = num_real_buffers + num_fec_buffers;
 
     fec_decoder->max_buffer_size = max_buffer_size;
@@ -272,8 +446,20 @@ FECDecoder* create_fec_decoder(int num_real_buffers, int num_fec_buffers, int ma
     fec_decoder->num_accepted_buffers = 0;
     fec_decoder->num_accepted_real_buffers = 0;
     fec_decoder->max_packet_size = -1;
-    fec_decoder->rs_code = rs_wrapper_create(num_real_buffers, num_real_buffers + num_fec_buffers);
+    fec_decoder->rs_code = NULL;
+    if (scheme == FEC_SCHEME_REED_SOLOMON) {
+        fec_decoder->rs_code =
+            rs_wrapper_create(num_real_buffers, num_real_buffers + num_fec_buffers);
+    }
+    fec_decoder->wirehair = NULL;
+    fec_decoder->wirehair_block_size = -1;
+    fec_decoder->wirehair_can_decode = false;
+    fec_decoder->wirehair_blocks = NULL;
     fec_decoder->recovery_performed = false;
+    fec_decoder->decode_buffers = safe_malloc(sizeof(void*) * num_total_buffers);
+    fec_decoder->decode_indices = safe_malloc(sizeof(int) * num_total_buffers);
+    fec_decoder->padded_buffers = NULL;
+    fec_decoder->bytes_processed = 0;
     return fec_decoder;
 }
 
@@ -295,56 +481,35 @@ void fec_decoder_register_buffer(FECDecoder* fec_decoder, int index, void* buffe
     }
 
     fec_decoder->max_packet_size = max(fec_decoder->max_packet_size, buffer_size);
-    rs_wrapper_decode_helper_register_index(fec_decoder->rs_code, index);
+    if (fec_decoder->scheme == FEC_SCHEME_WIREHAIR) {
+        wirehair_feed_buffer(fec_decoder, index);
+    } else {
+        rs_wrapper_decode_helper_register_index(fec_decoder->rs_code, index);
+    }
 }
 
 int fec_get_decoded_buffer(FECDecoder* fec_decoder, void* buffer) {
-    if (rs_wrapper_decode_helper_can_decode(fec_decoder->rs_code) == false) {
+    bool all_real_buffers_accepted =
+        fec_decoder->num_accepted_real_buffers == fec_decoder->num_real_buffers;
+    if (fec_decoder->scheme == FEC_SCHEME_WIREHAIR) {
+        // Wirehair isn't MDS, so it decides for itself when it has enough buffers
+        if (!fec_decoder->wirehair_can_decode && !all_real_buffers_accepted) {
+            return -1;
+        }
+    } else if (rs_wrapper_decode_helper_can_decode(fec_decoder->rs_code) == false) {
         return -1;
     }
-    bool need_recovery = false;
-    // For optimization, we only need recovery, if we need to reconstruct a real packet
-    if (fec_decoder->num_accepted_real_buffers != fec_decoder->num_real_buffers) {
-        need_recovery = true;
-    }
-
-    if (need_recovery && !fec_decoder->recovery_performed) {
-        int cnt = 0;
-        int* index = safe_malloc(fec_decoder->num_accepted_buffers * sizeof(int));
-
-        for (int i = 0; i < fec_decoder->num_buffers; i++) {
-            if (fec_decoder->buffer_sizes[i] == -1) continue;
-            index[cnt] = i;  // and array required by rs decoder, stores the index of input packets
-            FATAL_ASSERT(cnt <= i);
-            char* original_buffer = fec_decoder->buffers[i];
-            int original_size = fec_decoder->buffer_sizes[i];
-            FATAL_ASSERT(fec_decoder->max_packet_size >= original_size);
-            fec_decoder->buffers[cnt] = safe_malloc(fec_decoder->max_packet_size);
-            memcpy(fec_decoder->buffers[cnt], original_buffer, original_size);
-            memset((char*)fec_decoder->buffers[cnt] + original_size, 0,
-                   fec_decoder->max_packet_size - original_size);
-            // just similiar padding as encoder
-            // TODO, protential optimization, similiar to the one in encoder
-            cnt++;
-        }
 
-        FATAL_ASSERT(cnt >= fec_decoder->num_real_buffers);
-        FATAL_ASSERT(cnt == fec_decoder->num_accepted_buffers);
-
-        for (int i = cnt; i < fec_decoder->num_buffers; i++) {
-            fec_decoder->buffers[i] = 0;
+    // If all of the original buffers arrived, there's nothing to recover,
+    // and we can read the frame straight out of the registered buffers.
+    // Otherwise, we only recover the missing original buffers, and only once.
+    if (!all_real_buffers_accepted && !fec_decoder->recovery_performed) {
+        if (fec_decoder->scheme == FEC_SCHEME_WIREHAIR) {
+            wirehair_recover_missing_buffers(fec_decoder);
+        } else {
+            recover_missing_buffers(fec_decoder);
         }
-
-        // decode
-        int res =
-            rs_wrapper_decode(fec_decoder->rs_code, (void**)fec_decoder->buffers, index,
-                              fec_decoder->num_accepted_buffers, fec_decoder->max_packet_size);
-        FATAL_ASSERT(
-            res == 0);  // should always success if called correcly,  except malloc fail inside lib
-        free(index);
-
         fec_decoder->recovery_performed = true;
-
     }  // currently we allow fec_get_decoded_buffer to be called again after succesfully recovered
     // the code can be simplify a bit if not allowing this
 
@@ -356,6 +521,7 @@ int fec_get_decoded_buffer(FECDecoder* fec_decoder, void* buffer) {
 
         if (buffer != NULL) {
             memcpy((char*)buffer + running_size, current_buf, current_size);
+            fec_decoder->bytes_processed += current_size;
         }
         running_size += current_size;
     }
@@ -363,15 +529,23 @@ int fec_get_decoded_buffer(FECDecoder* fec_decoder, void* buffer) {
     return running_size;
 }
 
+int fec_decoder_get_bytes_processed(FECDecoder* fec_decoder) {
+    return fec_decoder->bytes_processed;
+}
+
 void destroy_fec_decoder(FECDecoder* fec_decoder) {
-    if (fec_decoder->recovery_performed) {
-        for (int i = 0; i < fec_decoder->num_buffers; i++) {
-            free(fec_decoder->buffers[i]);
-        }
+    if (fec_decoder->wirehair) {
+        wirehair_free(fec_decoder->wirehair);
     }
+    free(fec_decoder->wirehair_blocks);
+    free(fec_decoder->padded_buffers);
+    free(fec_decoder->decode_buffers);
+    free(fec_decoder->decode_indices);
     free(fec_decoder->buffers);
     free(fec_decoder->buffer_sizes);
-    rs_wrapper_destroy(fec_decoder->rs_code);
+    if (fec_decoder->rs_code) {
+        rs_wrapper_destroy(fec_decoder->rs_code);
+    }
     free(fec_decoder);
 }
 
@@ -381,6 +555,152 @@ Private Function Implementations
 ============================
 */
 
+static void recover_missing_buffers(FECDecoder* fec_decoder) {
+    int packet_size = fec_decoder->max_packet_size;
+
+    // The RS decoder needs every buffer to be packet_size long,
+    // so we only need to pad the registered buffers that are shorter than that
+    int num_short_buffers = 0;
+    for (int i = 0; i < fec_decoder->num_buffers; i++) {
+        if (fec_decoder->buffer_sizes[i] != -1 && fec_decoder->buffer_sizes[i] < packet_size) {
+            num_short_buffers++;
+        }
+    }
+    if (num_short_buffers > 0) {
+        fec_decoder->padded_buffers = safe_malloc((size_t)num_short_buffers * packet_size);
+    }
+
+    // Pass every registered buffer to the RS decoder, in index order,
+    // which puts the received original buffers first
+    int cnt = 0;
+    int num_padded = 0;
+    for (int i = 0; i < fec_decoder->num_buffers; i++) {
+        int size = fec_decoder->buffer_sizes[i];
+        if (size == -1) continue;
+        FATAL_ASSERT(size <= packet_size);
+        fec_decoder->decode_indices[cnt] = i;
+        if (size < packet_size) {
+            char* padded_buffer = fec_decoder->padded_buffers + (size_t)num_padded * packet_size;
+            memcpy(padded_buffer, fec_decoder->buffers[i], size);
+            memset(padded_buffer + size, 0, packet_size - size);
+            fec_decoder->decode_buffers[cnt] = padded_buffer;
+            fec_decoder->bytes_processed += packet_size;
+            num_padded++;
+        } else {
+            fec_decoder->decode_buffers[cnt] = fec_decoder->buffers[i];
+        }
+        cnt++;
+    }
+    FATAL_ASSERT(cnt >= fec_decoder->num_real_buffers);
+    FATAL_ASSERT(cnt == fec_decoder->num_accepted_buffers);
+
+    // decode
+    int res = rs_wrapper_decode(fec_decoder->rs_code, fec_decoder->decode_buffers,
+                                fec_decoder->decode_indices, cnt, packet_size);
+    FATAL_ASSERT(
+        res == 0);  // should always success if called correcly,  except malloc fail inside lib
+
+    // The RS decoder reads num_real_buffers of the buffers, and writes the recovered ones
+    int num_recovered = fec_decoder->num_real_buffers - fec_decoder->num_accepted_real_buffers;
+    fec_decoder->bytes_processed += (fec_decoder->num_real_buffers + num_recovered) * packet_size;
+
+    for (int i = 0; i < fec_decoder->num_real_buffers; i++) {
+        fec_decoder->buffers[i] = fec_decoder->decode_buffers[i];
+    }
+}
+
+static void wirehair_encode_buffers(FECEncoder* fec_encoder, int first_fec_buffer,
+                                    int end_fec_buffer) {
+    // The framed original buffers are already laid out as a single message of equally-sized
+    // blocks. Wirehair is systematic, so the first num_real_buffers blocks are sent as-is,
+    // and the rest are its repair blocks. The codec of the previous frame is reused.
+    int block_size = sizeof(uint16_t) + fec_encoder->max_packet_size;
+    if (first_fec_buffer == 0) {
+        fec_encoder->wirehair = wirehair_encoder_create(
+            fec_encoder->wirehair, fec_encoder->blocks,
+            (uint64_t)fec_encoder->num_real_buffers * block_size, block_size);
+        FATAL_ASSERT(fec_encoder->wirehair != NULL);
+    }
+    for (int i = fec_encoder->num_real_buffers + first_fec_buffer;
+         i < fec_encoder->num_real_buffers + end_fec_buffer; i++) {
+        char* block = fec_encoder->blocks + (size_t)i * block_size;
+        uint32_t bytes_written = 0;
+        WirehairResult result =
+            wirehair_encode(fec_encoder->wirehair, i, block, block_size, &bytes_written);
+        FATAL_ASSERT(result == Wirehair_Success && (int)bytes_written == block_size);
+        fec_encoder->buffers[i] = block;
+        fec_encoder->buffer_sizes[i] = block_size;
+    }
+}
+
+static void wirehair_feed_buffer(FECDecoder* fec_decoder, int index) {
+    if (fec_decoder->wirehair_can_decode) {
+        // Wirehair doesn't take blocks after it has finished decoding
+        return;
+    }
+
+    if (fec_decoder->wirehair == NULL) {
+        // Every buffer but the last original buffer is a full block,
+        // so wait for one of those to learn the block size
+        if (index == fec_decoder->num_real_buffers - 1) {
+            return;
+        }
+        int block_size = fec_decoder->buffer_sizes[index];
+        fec_decoder->wirehair_block_size = block_size;
+        fec_decoder->wirehair = wirehair_decoder_create(
+            NULL, (uint64_t)fec_decoder->num_real_buffers * block_size, block_size);
+        FATAL_ASSERT(fec_decoder->wirehair != NULL);
+        // Catch up on the last original buffer, if it arrived first
+        if (fec_decoder->buffer_sizes[fec_decoder->num_real_buffers - 1] != -1) {
+            wirehair_feed_buffer(fec_decoder, fec_decoder->num_real_buffers - 1);
+            if (fec_decoder->wirehair_can_decode) return;
+        }
+    }
+
+    // Wirehair expects full blocks, so the last original buffer needs to be padded
+    int block_size = fec_decoder->wirehair_block_size;
+    void* block = fec_decoder->buffers[index];
+    int size = fec_decoder->buffer_sizes[index];
+    if (size > block_size) {
+        LOG_ERROR("Buffer %d of size %d is larger than the wirehair block size %d", index, size,
+                  block_size);
+        return;
+    }
+    if (size < block_size) {
+        if (fec_decoder->padded_buffers == NULL) {
+            fec_decoder->padded_buffers = safe_malloc(fec_decoder->max_buffer_size);
+        }
+        memcpy(fec_decoder->padded_buffers, block, size);
+        memset(fec_decoder->padded_buffers + size, 0, block_size - size);
+        block = fec_decoder->padded_buffers;
+        fec_decoder->bytes_processed += block_size;
+    }
+
+    WirehairResult result = wirehair_decode(fec_decoder->wirehair, index, block, block_size);
+    fec_decoder->bytes_processed += block_size;
+    if (result == Wirehair_Success) {
+        fec_decoder->wirehair_can_decode = true;
+    } else if (result != Wirehair_NeedMore) {
+        LOG_ERROR("Wirehair failed to decode buffer %d: %s", index,
+                  wirehair_result_string(result));
+    }
+}
+
+static void wirehair_recover_missing_buffers(FECDecoder* fec_decoder) {
+    int block_size = fec_decoder->wirehair_block_size;
+    uint64_t message_size = (uint64_t)fec_decoder->num_real_buffers * block_size;
+    fec_decoder->wirehair_blocks = safe_malloc(message_size);
+
+    WirehairResult result =
+        wirehair_recover(fec_decoder->wirehair, fec_decoder->wirehair_blocks, message_size);
+    FATAL_ASSERT(result == Wirehair_Success);
+    fec_decoder->bytes_processed += (int)message_size;
+
+    for (int i = 0; i < fec_decoder->num_real_buffers; i++) {
+        fec_decoder->buffers[i] = fec_decoder->wirehair_blocks + (size_t)i * block_size;
+    }
+}
+
 // the below two functions works based on the fact that all our supported platforms are little
 // endian, and unaligned memory access are supported
 
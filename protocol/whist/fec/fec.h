@@ -19,6 +19,20 @@ Defines
 typedef struct FECEncoder FECEncoder;
 typedef struct FECDecoder FECDecoder;
 
+/**
+ * @brief                          The codes that FEC buffers can be generated with.
+ *                                 Both schemes are systematic and frame the original buffers
+ *                                 the same way, so they only differ in the FEC buffers.
+ */
+typedef enum FECScheme {
+    // Reed-Solomon, which needs the fewest buffers to decode, but has to partition frames
+    // with more than RS_FIELD_SIZE buffers into groups
+    FEC_SCHEME_REED_SOLOMON = 0,
+    // The Wirehair fountain code, which encodes and decodes in O(N) for any number of buffers,
+    // but occasionally needs an extra buffer or two to decode, and at least 2 original buffers
+    FEC_SCHEME_WIREHAIR = 1,
+} FECScheme;
+
 /*
 ============================
 Public Functions
@@ -44,6 +58,23 @@ int init_fec(void);
  */
 int get_num_fec_packets(int num_real_packets, double fec_packet_ratio);
 
+/**
+ * @brief                          Picks the scheme to encode a frame with
+ *
+ * @param stream_scheme            The scheme negotiated for the frame's stream
+ *
+ * @param num_real_buffers         The numbers of buffers used in the original frame
+ *
+ * @param num_fec_buffers          The number of additional fec buffers of the frame
+ *
+ * @returns                        The scheme to create the frame's FEC encoder and decoder with
+ *
+ * @note                           Streams that negotiated Wirehair still use Reed-Solomon for
+ *                                 frames that fit in a single Reed-Solomon group
+ */
+FECScheme fec_get_frame_scheme(FECScheme stream_scheme, int num_real_buffers,
+                               int num_fec_buffers);
+
 /**
  * @brief                          Creates an FEC Encoder
  *
@@ -58,6 +89,47 @@ int get_num_fec_packets(int num_real_packets, double fec_packet_ratio);
  */
 FECEncoder* create_fec_encoder(int num_real_buffers, int num_fec_buffers, int max_buffer_size);
 
+/**
+ * @brief                          Creates an FEC Encoder that uses the given scheme,
+ *                                 see `create_fec_encoder`
+ *
+ * @param scheme                   The scheme to generate the FEC buffers with
+ *
+ * @returns                        The initialized FEC Encoder
+ */
+FECEncoder* create_fec_encoder_with_scheme(FECScheme scheme, int num_real_buffers,
+                                           int num_fec_buffers, int max_buffer_size);
+
+/**
+ * @brief                          Creates an FEC Encoder that can be reset and reused for many
+ *                                 frames. All of the memory it needs is allocated here, so that
+ *                                 encoding a frame doesn't allocate.
+ *
+ * @param max_num_buffers          The largest `num_real_buffers` + `num_fec_buffers`
+ *                                 that it will be reset to
+ *
+ * @param max_buffer_size          The largest valid size of a buffer
+ *
+ * @returns                        The FEC Encoder, which must be reset before its first use
+ */
+FECEncoder* create_reusable_fec_encoder(int max_num_buffers, int max_buffer_size);
+
+/**
+ * @brief                          Resets an FEC Encoder to encode a new frame. The buffers of
+ *                                 the previous frame are no longer valid afterwards.
+ *
+ * @param fec_encoder              The FEC encoder to reset
+ *
+ * @param scheme                   The scheme to generate the FEC buffers with
+ *
+ * @param num_real_buffers         The numbers of buffers used in the new frame
+ *
+ * @param num_fec_buffers          The number of additional buffers we want to have
+ *                                 after encoding with FEC
+ */
+void fec_encoder_reset(FECEncoder* fec_encoder, FECScheme scheme, int num_real_buffers,
+                       int num_fec_buffers);
+
 /**
  * @brief                          Calculate the num of real buffers needed, to hold the
  *                                 (input) buffer
@@ -84,11 +156,28 @@ int fec_encoder_get_num_real_buffers(int buffer_size, int real_buffer_size);
  * @param buffer_size              The size of the buffer that's being registered,
  *                                 must be <= `max_buffer_size`*`num_real_buffers`
  *
- * @note                           The data pointed to by the buffer being passed in, which
- *                                 must be held alive for as long as the fec_encoder is alive.
+ * @note                           The buffer is copied into the encoder, so it can be freed
+ *                                 once this returns.
  */
 void fec_encoder_register_buffer(FECEncoder* fec_encoder, void* buffer, int buffer_size);
 
+/**
+ * @brief                          Registers a buffer that is given as a list of pieces into the
+ *                                 encoder, as if their concatenation had been registered with
+ *                                 `fec_encoder_register_buffer`. The pieces are gathered
+ *                                 straight into the framed buffers.
+ *
+ * @param fec_encoder              The FEC encoder to use
+ *
+ * @param pieces                   The pieces of the buffer, in order
+ *
+ * @param piece_sizes              The size of each piece
+ *
+ * @param num_pieces               The number of pieces
+ */
+void fec_encoder_register_pieces(FECEncoder* fec_encoder, const void* const* pieces,
+                                 const int* piece_sizes, int num_pieces);
+
 /**
  * @brief                          Gets the encoded buffers
  *
@@ -105,12 +194,80 @@ void fec_encoder_register_buffer(FECEncoder* fec_encoder, void* buffer, int buff
  */
 void fec_get_encoded_buffers(FECEncoder* fec_encoder, void** buffers, int* buffer_sizes);
 
+/**
+ * @brief                          Gets the original buffers, framed the way they're sent,
+ *                                 without computing the FEC buffers. This lets the caller send
+ *                                 the original buffers while `fec_encode_redundant_buffers`
+ *                                 runs on another thread.
+ *
+ * @param fec_encoder              The FEC encoder to use
+ *
+ * @param buffers                  The array of `void*` buffers for the original packets
+ *
+ * @param buffer_sizes             The array of `int` buffer sizes of the original packets
+ *
+ * @note                           The two arrays given should be allocated to be of size
+ *                                 `num_real_buffers`. The buffers are the same as the first
+ *                                 `num_real_buffers` buffers of `fec_get_encoded_buffers`.
+ */
+void fec_get_original_buffers(FECEncoder* fec_encoder, void** buffers, int* buffer_sizes);
+
+/**
+ * @brief                          Computes the FEC buffers, if they haven't been computed yet
+ *
+ * @param fec_encoder              The FEC encoder to use
+ *
+ * @note                           `fec_get_original_buffers` must have been called first.
+ *                                 This may run on another thread while the original buffers
+ *                                 are being read, since it only reads those. The FEC encoder
+ *                                 must not be used otherwise until it has returned.
+ */
+void fec_encode_redundant_buffers(FECEncoder* fec_encoder);
+
+/**
+ * @brief                          Computes the FEC buffers up to the given one, if they haven't
+ *                                 been computed yet. This lets the FEC buffers be computed a few
+ *                                 at a time, so that the first ones can be sent while the rest
+ *                                 are still being computed.
+ *
+ * @param fec_encoder              The FEC encoder to use
+ *
+ * @param num_fec_buffers          How many FEC buffers, from the first one on, must have been
+ *                                 computed afterwards
+ *
+ * @note                           Like `fec_encode_redundant_buffers`, this may run on another
+ *                                 thread. The FEC buffers that it has already computed may be
+ *                                 read meanwhile, see `fec_get_redundant_buffers`.
+ */
+void fec_encode_redundant_buffers_until(FECEncoder* fec_encoder, int num_fec_buffers);
+
+/**
+ * @brief                          Gets some of the FEC buffers, which must have been computed
+ *                                 by `fec_encode_redundant_buffers_until`
+ *
+ * @param fec_encoder              The FEC encoder to use
+ *
+ * @param first_fec_buffer         The first FEC buffer to get
+ *
+ * @param num_fec_buffers          How many FEC buffers to get
+ *
+ * @param buffers                  The array of `void*` buffers, indexed like those of
+ *                                 `fec_get_encoded_buffers`
+ *
+ * @param buffer_sizes             The array of `int` buffer sizes, indexed like those of
+ *                                 `fec_get_encoded_buffers`
+ */
+void fec_get_redundant_buffers(FECEncoder* fec_encoder, int first_fec_buffer,
+                               int num_fec_buffers, void** buffers, int* buffer_sizes);
+
 /**
  * @brief                          Destroys an FEC Encoder
  *
  * @param fec_encoder              The FEC encoder to destroy
  *
- * @note                           Should be called for every `create_fec_encoder`
+ * @note                           Should be called for every `create_fec_encoder`,
+ *                                 `create_fec_encoder_with_scheme` and
+ *                                 `create_reusable_fec_encoder`
  */
 void destroy_fec_encoder(FECEncoder* fec_encoder);
 
@@ -130,6 +287,17 @@ void destroy_fec_encoder(FECEncoder* fec_encoder);
  */
 FECDecoder* create_fec_decoder(int num_real_buffers, int num_fec_buffers, int max_buffer_size);
 
+/**
+ * @brief                          Creates an FEC Decoder that uses the given scheme,
+ *                                 see `create_fec_decoder`
+ *
+ * @param scheme                   The scheme that the FEC buffers were generated with
+ *
+ * @returns                        The initialized FEC Decoder
+ */
+FECDecoder* create_fec_decoder_with_scheme(FECScheme scheme, int num_real_buffers,
+                                           int num_fec_buffers, int max_buffer_size);
+
 /**
  * @brief                          Registers a buffer into the decoder.
  *
@@ -148,6 +316,8 @@ FECDecoder* create_fec_decoder(int num_real_buffers, int num_fec_buffers, int ma
  *
  *                                 The data pointed to by the buffer being passed in, must be
  *                                 held alive for as long as the fec_decoder is alive.
+ *                                 The buffer is not copied, and if it's one of the FEC buffers,
+ *                                 it may be overwritten with a recovered original buffer.
  */
 void fec_decoder_register_buffer(FECDecoder* fec_decoder, int index, void* buffer, int buffer_size);
 
@@ -166,9 +336,25 @@ void fec_decoder_register_buffer(FECDecoder* fec_decoder, int index, void* buffe
  *
  * @note                           This refers to some buffer returned by `fec_get_encoded_buffers`,
  *                                 with `index` indexing into the arrays returned by that function.
+ *
+ *                                 This is cheap to call after every registered buffer: nothing
+ *                                 is decoded until enough buffers have been registered, the
+ *                                 RS decode is skipped if all of the original buffers arrived,
+ *                                 and otherwise only the missing original buffers are recovered,
+ *                                 once.
  */
 int fec_get_decoded_buffer(FECDecoder* fec_decoder, void* buffer);
 
+/**
+ * @brief                          Gets how much work the decoder has done
+ *
+ * @param fec_decoder              The FEC decoder to query
+ *
+ * @returns                        The number of bytes the decoder has copied,
+ *                                 or read and written while recovering buffers
+ */
+int fec_decoder_get_bytes_processed(FECDecoder* fec_decoder);
+
 /**
  * @brief                          Destroy an FEC Decoder
  *
@@ -30,6 +30,7 @@
 #include "gf256.h"
 #include "avx2/gf256_avx2.h"
 #include "ssse3/gf256_ssse3.h"
+#include "gfni/gf256_gfni.h"
 #include "gf256_cpuinfo.h"
 
 #ifdef LINUX_ARM
@@ -236,6 +237,27 @@ static bool CpuHasSSSE3 = false;
 #define CPUID_EDX_SSE2    0x04000000
 static bool CpuHasSSE2 = false;
 
+// WHIST_CHANGE: ADD
+// GFNI is only used together with AVX-512BW, and needs the OS to save the
+// AVX-512 state: XCR0 must have the SSE, AVX, opmask and ZMM bits set
+#define CPUID_EBX_AVX512F  0x00010000
+#define CPUID_EBX_AVX512BW 0x40000000
+#define CPUID_ECX_GFNI     0x00000100
+#define CPUID_ECX_OSXSAVE  0x08000000
+#define XCR0_AVX512_STATE  0x000000e6
+static bool CpuHasGFNI = false;
+
+static uint64_t _xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
 static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type)
 {
 #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86))
@@ -300,6 +322,10 @@ static void checkLinuxARMNeonCapabilities( bool& cpuHasNeon )
 #endif
 #endif // defined(GF256_TARGET_MOBILE)
 
+// WHIST_CHANGE: ADD
+// The fastest kernel gf256_set_max_kernel() allows us to use
+static Gf256Kernel MaxKernel = GF256_KERNEL_GFNI;
+
 static void gf256_architecture_init()
 {
     // Check for NEON support on Android platform
@@ -330,9 +356,24 @@ static void gf256_architecture_init()
     CpuHasSSSE3 = ((cpu_info[2] & CPUID_ECX_SSSE3) != 0);
     // WHIST_CHANGE: ADD
     CpuHasSSE2 = ((cpu_info[3] & CPUID_EDX_SSE2) != 0);
+    const bool os_saves_avx512 = ((cpu_info[2] & CPUID_ECX_OSXSAVE) != 0) &&
+                                 ((_xgetbv0() & XCR0_AVX512_STATE) == XCR0_AVX512_STATE);
 
     _cpuid(cpu_info, 7);
     CpuHasAVX2 = ((cpu_info[1] & CPUID_EBX_AVX2) != 0);
+    // WHIST_CHANGE: ADD
+    CpuHasGFNI = os_saves_avx512 && ((cpu_info[1] & CPUID_EBX_AVX512F) != 0) &&
+                 ((cpu_info[1] & CPUID_EBX_AVX512BW) != 0) &&
+                 ((cpu_info[2] & CPUID_ECX_GFNI) != 0);
+
+    // WHIST_CHANGE: ADD
+    // Drop the kernels that gf256_set_max_kernel() has ruled out
+    if (MaxKernel < GF256_KERNEL_GFNI)
+        CpuHasGFNI = false;
+    if (MaxKernel < GF256_KERNEL_AVX2)
+        CpuHasAVX2 = false;
+    if (MaxKernel < GF256_KERNEL_SSSE3)
+        CpuHasSSSE3 = false;
 
     // When AVX2 and SSSE3 are unavailable, Siamese takes 4x longer to decode
     // and 2.6x longer to encode.  Encoding requires a lot more simple XOR ops
@@ -589,6 +630,12 @@ static void gf256_mul_mem_init()
         {
             gf256_mul_mem_init_inner_avx2(table_lo,table_hi,y);
         }
+
+        // WHIST_CHANGE: ADD
+        if (CpuHasGFNI)
+        {
+            gf256_mul_mem_init_inner_gfni(y);
+        }
 #endif // GF256_TARGET_MOBILE
     }
 }
@@ -1055,6 +1102,12 @@ extern "C" void gf256_mul_mem(void * GF256_RESTRICT vz, const void * GF256_RESTR
         } while (bytes >= 16);
     }
 #else
+    // WHIST_CHANGE: ADD
+    // The GFNI kernel consumes all of the bytes, including the tail
+    if (CpuHasGFNI)
+    {
+        gf256_mul_mem_inner_gfni(z16,x16,y,bytes);
+    }
     if (bytes >= 32 && CpuHasAVX2)
     {
         gf256_mul_mem_inner_avx2(vz,vx,z16,x16,y,bytes);
@@ -1177,6 +1230,12 @@ extern "C" void gf256_muladd_mem(void * GF256_RESTRICT vz, uint8_t y,
         } while (bytes >= 16);
     }
 #else // GF256_TARGET_MOBILE
+    // WHIST_CHANGE: ADD
+    // The GFNI kernel consumes all of the bytes, including the tail
+    if (CpuHasGFNI)
+    {
+        gf256_muladd_mem_inner_gfni(z16,x16,y,bytes);
+    }
     if (bytes >= 32 && CpuHasAVX2)
     {
         gf256_muladd_mem_inner_avx2(z16,x16,y,bytes);
@@ -1343,6 +1402,7 @@ CpuInfo gf256_get_cpuinfo(void)
         info.cpu_type =CPU_TYPE_X86;
     #endif
     info.has_avx2 = CpuHasAVX2;
+    info.has_gfni = CpuHasGFNI;
     info.has_ssse3 = CpuHasSSSE3;
     info.has_sse2 = CpuHasSSE2;
 #elif defined(ANDROID) || defined(IOS) || defined(LINUX_ARM) || defined(MACOS_ARM)
@@ -1358,6 +1418,52 @@ CpuInfo gf256_get_cpuinfo(void)
     return info;
 }
 
+// limit the multiply kernels to kernel or slower ones
+void gf256_set_max_kernel(Gf256Kernel kernel)
+{
+    MaxKernel = kernel;
+    gf256_architecture_init();
+    // The SIMD tables are only filled in for the kernels that were allowed
+    // at initialization, so fill them in again
+    if (Initialized)
+        gf256_mul_mem_init();
+}
+
+// get the fastest kernel in use
+Gf256Kernel gf256_get_kernel(void)
+{
+#if !defined(GF256_TARGET_MOBILE)
+    if (CpuHasGFNI)
+        return GF256_KERNEL_GFNI;
+    if (CpuHasAVX2)
+        return GF256_KERNEL_AVX2;
+    if (CpuHasSSSE3)
+        return GF256_KERNEL_SSSE3;
+#endif
+    return GF256_KERNEL_SCALAR;
+}
+
+// convert Gf256Kernel to str
+const char * gf256_kernel_to_str(Gf256Kernel kernel) {
+    switch (kernel) {
+        case GF256_KERNEL_SCALAR: {
+            return "scalar";
+        }
+        case GF256_KERNEL_SSSE3: {
+            return "ssse3";
+        }
+        case GF256_KERNEL_AVX2: {
+            return "avx2";
+        }
+        case GF256_KERNEL_GFNI: {
+            return "gfni";
+        }
+        default: {
+            return "invalid";
+        }
+    }
+}
+
 // convert CpuType to str
 const char * cpu_type_to_str(CpuType cpu_type) {
     switch (cpu_type) {
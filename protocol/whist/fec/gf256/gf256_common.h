@@ -146,6 +146,11 @@ typedef struct
         GF256_ALIGNED GF256_M256 TABLE_LO_Y[256];
         GF256_ALIGNED GF256_M256 TABLE_HI_Y[256];
     } MM256;
+
+    // WHIST_CHANGE: ADD
+    /// Multiplying by y is linear over GF(2), so it is an 8x8 bit matrix,
+    /// laid out as the GF2P8AFFINEQB instruction expects it.
+    uint64_t GFNI_MATRIX_Y[256];
 #endif
 
     /// Mul/Div/Inv/Sqr tables
@@ -19,6 +19,16 @@ typedef enum
     CPU_TYPE_OTHER,
 } CpuType;
 
+// the multiply kernels, from slowest to fastest
+typedef enum
+{
+    GF256_KERNEL_SCALAR,
+    GF256_KERNEL_SSSE3,
+    GF256_KERNEL_AVX2,
+    // GFNI affine multiplies on 512-bit lanes, needs AVX-512BW
+    GF256_KERNEL_GFNI,
+} Gf256Kernel;
+
 // the struct containing cpu type and instruction support info
 typedef struct
 {
@@ -26,6 +36,7 @@ typedef struct
     bool has_sse2;
     bool has_ssse3;
     bool has_avx2;
+    bool has_gfni;
     bool has_neon;
 } CpuInfo;
 
@@ -42,6 +53,28 @@ CpuInfo gf256_get_cpuinfo(void);
  */
 const char * cpu_type_to_str(CpuType cpu_type);
 
+/**
+ * @brief                          limit gf256_mul_mem and gf256_muladd_mem to the given kernel,
+ *                                 or slower ones. All kernels the cpu supports are allowed by
+ *                                 default. This is meant for benchmarks and tests, and must not
+ *                                 be called while other threads are using gf256. Ignored on ARM.
+ * @param kernel                   the fastest kernel to allow
+ */
+void gf256_set_max_kernel(Gf256Kernel kernel);
+
+/**
+ * @brief                          get the kernel that gf256_mul_mem and gf256_muladd_mem use
+ * @returns                        the fastest kernel that is supported and allowed
+ */
+Gf256Kernel gf256_get_kernel(void);
+
+/**
+ * @brief                          convert Gf256Kernel to str
+ * @param kernel                   the kernel
+ * @returns                        the pointer to str
+ */
+const char * gf256_kernel_to_str(Gf256Kernel kernel);
+
 #ifdef __cplusplus
 }
 #endif
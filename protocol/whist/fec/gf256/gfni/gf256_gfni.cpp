@@ -0,0 +1,147 @@
+#include "../gf256_common.h"
+/**
+ * Copyright (c) 2021-2022 Whist Technologies, Inc.
+ * file gf256_gfni.cpp
+ * @brief Seperate out all GFNI/AVX-512 instructions of gf256 into a single file, in order to make the simd fallback work correctly.
+ */
+
+/*
+    GFNI multiply kernels
+
+    GFNI has two instructions that can multiply bytes in GF(256):
+
+        GF2P8MULB multiplies two vectors of bytes, but always reduces by the
+        AES polynomial 0x11b.  Our field uses GF256Ctx.Polynomial (0x14d by
+        default), so its products would be wrong for us.
+
+        GF2P8AFFINEQB multiplies each byte of a vector, viewed as a vector of
+        8 bits over GF(2), by an 8x8 bit matrix.  Multiplying by a constant y
+        is linear over GF(2) in any GF(256) field:
+
+            x * y = x[0] * (1 * y) xor x[1] * (2 * y) xor ... xor x[7] * (128 * y)
+
+        so it is exactly such a matrix, whose columns are the products
+        (1 << k) * y.
+
+    GF2P8AFFINEQB computes output bit i as the parity of (matrix byte 7 - i)
+    AND x, so row i of the matrix goes into byte 7 - i, and bit k of that row
+    is bit i of (1 << k) * y.
+
+    That replaces the two table lookups, shift, two masks and xor of the
+    AVX2 kernel with a single instruction, on 64 bytes at a time.  The final
+    partial vector is handled with masked loads and stores, so these kernels
+    always consume the whole buffer and there is no scalar tail.
+*/
+
+void gf256_mul_mem_init_inner_gfni(int &y)
+{
+        const uint8_t * table = GF256Ctx.GF256_MUL_TABLE + ((unsigned)y << 8);
+
+        uint64_t matrix = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t row = 0;
+            for (int k = 0; k < 8; ++k)
+                row |= (uint64_t)((table[1 << k] >> i) & 1) << k;
+            matrix |= row << (8 * (7 - i));
+        }
+        GF256Ctx.GFNI_MATRIX_Y[y] = matrix;
+}
+
+// Mask of the low bytes in a 64-byte vector, for 0 < bytes < 64
+static GF256_FORCE_INLINE __mmask64 gf256_gfni_tail_mask(int bytes)
+{
+        return (__mmask64)(~0ULL >> (64 - bytes));
+}
+
+void gf256_mul_mem_inner_gfni(GF256_M128 * GF256_RESTRICT &z16, const GF256_M128 * GF256_RESTRICT &x16,
+                              uint8_t &y, int &bytes)
+{
+        const __m512i matrix = _mm512_set1_epi64((long long)GF256Ctx.GFNI_MATRIX_Y[y]);
+
+        uint8_t * GF256_RESTRICT z1 = reinterpret_cast<uint8_t *>(z16);
+        const uint8_t * GF256_RESTRICT x1 = reinterpret_cast<const uint8_t *>(x16);
+
+        while (bytes >= 128)
+        {
+            __m512i v0 = _mm512_loadu_si512(x1);
+            __m512i v1 = _mm512_loadu_si512(x1 + 64);
+            v0 = _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0);
+            v1 = _mm512_gf2p8affine_epi64_epi8(v1, matrix, 0);
+            _mm512_storeu_si512(z1, v0);
+            _mm512_storeu_si512(z1 + 64, v1);
+
+            bytes -= 128, x1 += 128, z1 += 128;
+        }
+
+        if (bytes >= 64)
+        {
+            const __m512i v0 = _mm512_loadu_si512(x1);
+            _mm512_storeu_si512(z1, _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0));
+
+            bytes -= 64, x1 += 64, z1 += 64;
+        }
+
+        if (bytes > 0)
+        {
+            const __mmask64 mask = gf256_gfni_tail_mask(bytes);
+            const __m512i v0 = _mm512_maskz_loadu_epi8(mask, x1);
+            _mm512_mask_storeu_epi8(z1, mask, _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0));
+
+            x1 += bytes, z1 += bytes;
+            bytes = 0;
+        }
+
+        z16 = reinterpret_cast<GF256_M128 *>(z1);
+        x16 = reinterpret_cast<const GF256_M128 *>(x1);
+}
+
+void gf256_muladd_mem_inner_gfni(GF256_M128 * GF256_RESTRICT &z16, const GF256_M128 * GF256_RESTRICT &x16,
+                                 uint8_t &y, int &bytes)
+{
+        const __m512i matrix = _mm512_set1_epi64((long long)GF256Ctx.GFNI_MATRIX_Y[y]);
+
+        uint8_t * GF256_RESTRICT z1 = reinterpret_cast<uint8_t *>(z16);
+        const uint8_t * GF256_RESTRICT x1 = reinterpret_cast<const uint8_t *>(x16);
+
+        // Two independent vectors per iteration, which keeps both the load
+        // ports and the affine unit busy
+        while (bytes >= 128)
+        {
+            __m512i v0 = _mm512_loadu_si512(x1);
+            __m512i v1 = _mm512_loadu_si512(x1 + 64);
+            const __m512i w0 = _mm512_loadu_si512(z1);
+            const __m512i w1 = _mm512_loadu_si512(z1 + 64);
+            v0 = _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0);
+            v1 = _mm512_gf2p8affine_epi64_epi8(v1, matrix, 0);
+            _mm512_storeu_si512(z1, _mm512_xor_si512(v0, w0));
+            _mm512_storeu_si512(z1 + 64, _mm512_xor_si512(v1, w1));
+
+            bytes -= 128, x1 += 128, z1 += 128;
+        }
+
+        if (bytes >= 64)
+        {
+            __m512i v0 = _mm512_loadu_si512(x1);
+            const __m512i w0 = _mm512_loadu_si512(z1);
+            v0 = _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0);
+            _mm512_storeu_si512(z1, _mm512_xor_si512(v0, w0));
+
+            bytes -= 64, x1 += 64, z1 += 64;
+        }
+
+        if (bytes > 0)
+        {
+            const __mmask64 mask = gf256_gfni_tail_mask(bytes);
+            __m512i v0 = _mm512_maskz_loadu_epi8(mask, x1);
+            const __m512i w0 = _mm512_maskz_loadu_epi8(mask, z1);
+            v0 = _mm512_gf2p8affine_epi64_epi8(v0, matrix, 0);
+            _mm512_mask_storeu_epi8(z1, mask, _mm512_xor_si512(v0, w0));
+
+            x1 += bytes, z1 += bytes;
+            bytes = 0;
+        }
+
+        z16 = reinterpret_cast<GF256_M128 *>(z1);
+        x16 = reinterpret_cast<const GF256_M128 *>(x1);
+}
@@ -0,0 +1,16 @@
+#pragma once
+/**
+ * Copyright (c) 2021-2022 Whist Technologies, Inc.
+ * file gf256_gfni.h
+ * @brief Seperate out all GFNI/AVX-512 instructions of gf256 into a single file, in order to make the simd fallback work correctly.
+ */
+
+#include "../gf256_common.h"
+
+void gf256_mul_mem_init_inner_gfni(int &y);
+
+void gf256_mul_mem_inner_gfni(GF256_M128 * GF256_RESTRICT &z16, const GF256_M128 * GF256_RESTRICT &x16,
+                              uint8_t &y, int &bytes);
+
+void gf256_muladd_mem_inner_gfni(GF256_M128 * GF256_RESTRICT &z16, const GF256_M128 * GF256_RESTRICT &x16,
+                                 uint8_t &y, int &bytes);
@@ -39,6 +39,9 @@ struct RSWrapper {
     int group_max_num_real_buffers;  // the max num of real_buffers of all groups
     int group_max_num_fec_buffers;   // the max num of fec_buffers of all groups
     GroupInfo *group_infos;          // an array of GroupInfo
+    int group_infos_capacity;        // num of GroupInfo allocated, kept across rs_wrapper_reset()
+    void **encode_scratch;           // holds the src and dst subsets of a group during encoding
+    int encode_scratch_capacity;     // num of pointers allocated in encode_scratch
 };
 
 /*
@@ -83,11 +86,15 @@ with dup and dedup
  * @param src                      an arrary of original buffers
  * @param dst                      an arrary of redundant buffers, the memeroy should be already
  *                                 allocated before passing here
+ * @param first_fec                the first redundant buffer to compute
+ * @param num_fec                  num of redundant buffers to compute, from first_fec on.
+ *                                 only dst[first_fec, first_fec + num_fec) is written to
  * @param sz                       size of buffers
  *
  * @note                           when k is 1, n can be arbitrary large, otherwise k<=n<=256
  */
-static void rs_encode_or_dup(int k, int n, void *src[], void *dst[], int sz);
+static void rs_encode_or_dup(int k, int n, void *src[], void *dst[], int first_fec, int num_fec,
+                             int sz);
 
 /**
  * @brief                          do RS decode with the RS wrapper
@@ -146,17 +153,28 @@ static SubIndexInfo index_full_to_sub(RSWrapper *rs_wrapper, int index);
 static int index_sub_to_full(RSWrapper *rs_wrapper, int group_id, int sub_index);
 
 /**
- * @brief                          the inner version of rs_wrapper_create, with on extra parameter,
+ * @brief                          pick the num of groups to partition the buffers into, so that
+ *                                 the groups satisfy the max_group_size and max_group_overhead
+ *                                 limitation
+ *
+ * @param num_real_buffers         num of original buffers
+ * @param num_total_buffers        num of buffers in total
+ *
+ * @returns                        num of groups
+ */
+static int get_num_groups(int num_real_buffers, int num_total_buffers);
+
+/**
+ * @brief                          the inner version of rs_wrapper_reset, with on extra parameter,
  *                                 allow you to control of num of groups
  *
+ * @param rs_wrapper               RSwrapper object to fill the partition plan of
  * @param num_real_buffers         num of original buffers
  * @param num_total_buffers        num of buffers in total
  * @param num_groups               num of groups spliting into
- *
- * @returns                        The RS wrapper
  */
-static RSWrapper *rs_wrapper_create_inner(int num_real_buffers, int num_total_buffers,
-                                          int num_groups);
+static void rs_wrapper_reset_inner(RSWrapper *rs_wrapper, int num_real_buffers,
+                                   int num_total_buffers, int num_groups);
 
 /**
  * @brief                          defines and calculates the "overhead" of a group
@@ -201,8 +219,10 @@ int init_rs_wrapper(void) {
         case CM256: {
             CpuInfo cpu_info = gf256_get_cpuinfo();
             LOG_INFO("gf256 detected CPU type is %s", cpu_type_to_str(cpu_info.cpu_type));
-            LOG_INFO("cpu_info: has_avx2=%d has_ssse3=%d has_sse2=%d has_neon=%d",
-                     cpu_info.has_avx2, cpu_info.has_ssse3, cpu_info.has_sse2, cpu_info.has_neon);
+            LOG_INFO("cpu_info: has_gfni=%d has_avx2=%d has_ssse3=%d has_sse2=%d has_neon=%d",
+                     cpu_info.has_gfni, cpu_info.has_avx2, cpu_info.has_ssse3, cpu_info.has_sse2,
+                     cpu_info.has_neon);
+            LOG_INFO("gf256 multiply kernel is %s", gf256_kernel_to_str(gf256_get_kernel()));
 
             if (cpu_info.cpu_type == CPU_TYPE_X86 || cpu_info.cpu_type == CPU_TYPE_X64) {
                 // cpu without avx2 is not rare.
@@ -247,42 +267,26 @@ int init_rs_wrapper(void) {
 }
 
 RSWrapper *rs_wrapper_create(int num_real_buffers, int num_total_buffers) {
-    FATAL_ASSERT(num_real_buffers > 0);
-    FATAL_ASSERT(num_real_buffers <= num_real_buffers);
-
-    int num_fec_buffers = num_total_buffers - num_real_buffers;
-
-    int num_groups = -1;
-
-    // try each num of groups start from 1 to num_real_buffers - 1
-    // see if the num satifise the max_group_size and max_group_overhead limitation
-    for (int i = 1; i < num_real_buffers; i++) {
-        // compute the max num of packets inside each group, the assumption is the groups are
-        // partitoned evenly
-        int max_num_real_in_groups = int_div_roundup(num_real_buffers, i);
-        int max_num_fec_in_groups = int_div_roundup(num_fec_buffers, i);
-
-        // if this num of groups satisfies both the max_group_size and max_group_overhead
-        // limitation, use this num
-        if ((max_num_real_in_groups + max_num_fec_in_groups <= rs_wrapper_max_group_size) &&
-            (overhead_of_group(max_num_real_in_groups, max_num_fec_in_groups) <=
-             rs_wrapper_max_group_overhead)) {
-            num_groups = i;
-            break;
-        }
-    }
+    RSWrapper *rs_wrapper = (RSWrapper *)safe_zalloc(sizeof(RSWrapper));
+    rs_wrapper_reset(rs_wrapper, num_real_buffers, num_total_buffers);
+    return rs_wrapper;
+}
 
-    // if all attempt above fails, we always have the choice of doing duplicate sending by sending
-    // num_groups same as num_real_buffers
-    if (num_groups == -1) {
-        num_groups = num_real_buffers;
-    }
+void rs_wrapper_reset(RSWrapper *rs_wrapper, int num_real_buffers, int num_total_buffers) {
+    FATAL_ASSERT(num_real_buffers > 0);
+    FATAL_ASSERT(num_real_buffers <= num_total_buffers);
 
     // call inner function to do the rest works
-    return rs_wrapper_create_inner(num_real_buffers, num_total_buffers, num_groups);
+    rs_wrapper_reset_inner(rs_wrapper, num_real_buffers, num_total_buffers,
+                           get_num_groups(num_real_buffers, num_total_buffers));
 }
 
 void rs_wrapper_encode(RSWrapper *rs_wrapper, void **src, void **dst, int sz) {
+    rs_wrapper_encode_range(rs_wrapper, src, dst, 0, rs_wrapper->num_fec_buffers, sz);
+}
+
+void rs_wrapper_encode_range(RSWrapper *rs_wrapper, void **src, void **dst, int first_fec,
+                             int num_fec, int sz) {
     FATAL_ASSERT(rs_wrapper->num_groups > 0);
 
     // if num of groups is one, we can simply pass the encode request to the underlying lib without
@@ -292,23 +296,40 @@ void rs_wrapper_encode(RSWrapper *rs_wrapper, void **src, void **dst, int sz) {
         int n = k + rs_wrapper->group_infos[0].num_fec_buffers;
 
         // call encode interface
-        rs_encode_or_dup(k, n, src, dst, sz);
+        rs_encode_or_dup(k, n, src, dst, first_fec, num_fec, sz);
         return;
     }
 
-    // buffers to store a subset of src and dst
-    void **src_sub = safe_malloc(sizeof(void *) * rs_wrapper->group_max_num_real_buffers);
-    void **dst_sub = safe_malloc(sizeof(void *) * rs_wrapper->group_max_num_fec_buffers);
+    // buffers to store a subset of src and dst, which are kept for the next encode
+    int scratch_size =
+        rs_wrapper->group_max_num_real_buffers + rs_wrapper->group_max_num_fec_buffers;
+    if (rs_wrapper->encode_scratch_capacity < scratch_size) {
+        free(rs_wrapper->encode_scratch);
+        rs_wrapper->encode_scratch = safe_malloc(sizeof(void *) * scratch_size);
+        rs_wrapper->encode_scratch_capacity = scratch_size;
+    }
+    void **src_sub = rs_wrapper->encode_scratch;
+    void **dst_sub = rs_wrapper->encode_scratch + rs_wrapper->group_max_num_real_buffers;
 
     // perform the encoding group-wise
-    for (int i = 0; i < rs_wrapper->num_groups; i++) {
+    int num_groups = rs_wrapper->num_groups;
+    for (int i = 0; i < num_groups; i++) {
+        // the fec buffers are dealt out to the groups in turn, so the j-th fec buffer of
+        // group i is fec buffer i + j * num_groups. find the ones inside the range.
+        int first_sub_fec = (first_fec - i + num_groups - 1) / num_groups;
+        int end_sub_fec = min((first_fec + num_fec - i + num_groups - 1) / num_groups,
+                              rs_wrapper->group_infos[i].num_fec_buffers);
+        if (first_sub_fec >= end_sub_fec) {
+            continue;
+        }
+
         // find the subset of src for current group and store them into src_sub
         for (int j = 0; j < rs_wrapper->group_infos[i].num_real_buffers; j++) {
             int full_index = index_sub_to_full(rs_wrapper, i, j);
             src_sub[j] = src[full_index];
         }
         // find the subset of dst for current group and store them into dst_sub
-        for (int j = 0; j < rs_wrapper->group_infos[i].num_fec_buffers; j++) {
+        for (int j = first_sub_fec; j < end_sub_fec; j++) {
             int sub_index = rs_wrapper->group_infos[i].num_real_buffers + j;
             int full_index = index_sub_to_full(rs_wrapper, i, sub_index);
             dst_sub[j] = dst[full_index - rs_wrapper->num_real_buffers];
@@ -319,11 +340,8 @@ void rs_wrapper_encode(RSWrapper *rs_wrapper, void **src, void **dst, int sz) {
         int n = k + rs_wrapper->group_infos[i].num_fec_buffers;
 
         // call encode interface
-        rs_encode_or_dup(k, n, src_sub, dst_sub, sz);
+        rs_encode_or_dup(k, n, src_sub, dst_sub, first_sub_fec, end_sub_fec - first_sub_fec, sz);
     }
-
-    free(src_sub);
-    free(dst_sub);
 }
 
 int rs_wrapper_decode(RSWrapper *rs_wrapper, void **pkt, int *index, int num_pkt, int sz) {
@@ -419,6 +437,7 @@ int rs_wrapper_decode(RSWrapper *rs_wrapper, void **pkt, int *index, int num_pkt
 
 void rs_wrapper_destroy(RSWrapper *rs_wrapper) {
     free(rs_wrapper->group_infos);
+    free(rs_wrapper->encode_scratch);
     free(rs_wrapper);
 }
 
@@ -476,17 +495,16 @@ Private Function Implementations
 ============================
 */
 
-static void rs_encode_or_dup(int k, int n, void *src[], void *dst[], int sz) {
+static void rs_encode_or_dup(int k, int n, void *src[], void *dst[], int first_fec, int num_fec,
+                             int sz) {
     FATAL_ASSERT(k >= 0 && k < RS_FIELD_SIZE);
     FATAL_ASSERT(n >= 0);
     FATAL_ASSERT(k <= n);
-
-    // the num of fec packets
-    int fec_num = n - k;
+    FATAL_ASSERT(0 <= first_fec && num_fec >= 0 && first_fec + num_fec <= n - k);
 
     // handle k==1 case with duplication
     if (k == 1) {
-        for (int i = 0; i < fec_num; i++) {
+        for (int i = first_fec; i < first_fec + num_fec; i++) {
             memcpy(dst[i], src[0], sz);
         }
         return;
@@ -502,23 +520,21 @@ static void rs_encode_or_dup(int k, int n, void *src[], void *dst[], int sz) {
             params.RecoveryCount = n - k;
             params.BlockBytes = sz;
 
-            cm256_block *blocks = safe_malloc(params.OriginalCount * sizeof(cm256_block));
-
-            // TODO inefficient code
+            // k < RS_FIELD_SIZE, so the blocks fit on the stack
+            cm256_block blocks[RS_FIELD_SIZE];
             for (int i = 0; i < params.OriginalCount; i++) {
                 blocks[i].Block = src[i];
                 blocks[i].Index = i;
             }
 
-            for (int i = 0; i < fec_num; i++) {
+            for (int i = first_fec; i < first_fec + num_fec; i++) {
                 cm256_encode_block(params, blocks, k + i, dst[i]);
             }
-            free(blocks);
             break;
         }
         case LUGI_RS: {
             RSCode *rs_code = lugi_rs_extra_get_rs_code(k, n);
-            for (int i = 0; i < fec_num; i++) {
+            for (int i = first_fec; i < first_fec + num_fec; i++) {
                 rs_encode(rs_code, src, dst[i], k + i, sz);
             }
             break;
@@ -549,8 +565,8 @@ static int rs_decode_or_dedup(int k, int n, void *pkt[], int index[], int sz) {
             params.RecoveryCount = n - k;
             params.BlockBytes = sz;
 
-            cm256_block *blocks = safe_malloc(params.OriginalCount * sizeof(cm256_block));
-
+            // k < RS_FIELD_SIZE, so the blocks fit on the stack
+            cm256_block blocks[RS_FIELD_SIZE];
             for (int i = 0; i < params.OriginalCount; i++) {
                 blocks[i].Index = index[i];
                 blocks[i].Block = pkt[i];
@@ -562,8 +578,6 @@ static int rs_decode_or_dedup(int k, int n, void *pkt[], int index[], int sz) {
             for (int i = 0; i < params.OriginalCount; i++) {
                 pkt[blocks[i].Index] = (char *)blocks[i].Block;
             }
-
-            free(blocks);
             return r;
         }
         case LUGI_RS: {
@@ -626,21 +640,51 @@ static int index_sub_to_full(RSWrapper *rs_wrapper, int group_id, int sub_index)
     }
 }
 
-static RSWrapper *rs_wrapper_create_inner(int num_real_buffers, int num_total_buffers,
-                                          int num_groups) {
+static int get_num_groups(int num_real_buffers, int num_total_buffers) {
+    int num_fec_buffers = num_total_buffers - num_real_buffers;
+
+    // try each num of groups start from 1 to num_real_buffers - 1
+    // see if the num satifise the max_group_size and max_group_overhead limitation
+    for (int i = 1; i < num_real_buffers; i++) {
+        // compute the max num of packets inside each group, the assumption is the groups are
+        // partitoned evenly
+        int max_num_real_in_groups = int_div_roundup(num_real_buffers, i);
+        int max_num_fec_in_groups = int_div_roundup(num_fec_buffers, i);
+
+        // if this num of groups satisfies both the max_group_size and max_group_overhead
+        // limitation, use this num
+        if ((max_num_real_in_groups + max_num_fec_in_groups <= rs_wrapper_max_group_size) &&
+            (overhead_of_group(max_num_real_in_groups, max_num_fec_in_groups) <=
+             rs_wrapper_max_group_overhead)) {
+            return i;
+        }
+    }
+
+    // if all attempt above fails, we always have the choice of doing duplicate sending by sending
+    // num_groups same as num_real_buffers
+    return num_real_buffers;
+}
+
+static void rs_wrapper_reset_inner(RSWrapper *rs_wrapper, int num_real_buffers,
+                                   int num_total_buffers, int num_groups) {
     FATAL_ASSERT(num_real_buffers > 0);
-    FATAL_ASSERT(num_real_buffers <= num_real_buffers);
+    FATAL_ASSERT(num_real_buffers <= num_total_buffers);
     FATAL_ASSERT(num_groups <= num_real_buffers);
 
-    RSWrapper *rs_wrapper = (RSWrapper *)safe_zalloc(sizeof(RSWrapper));
-
     int num_fec_buffers = num_total_buffers - num_real_buffers;
 
     // init elementary data
     rs_wrapper->num_groups = num_groups;
     rs_wrapper->num_real_buffers = num_real_buffers;
     rs_wrapper->num_fec_buffers = num_fec_buffers;
-    rs_wrapper->group_infos = safe_malloc(sizeof(GroupInfo) * num_groups);
+    rs_wrapper->group_max_num_real_buffers = 0;
+    rs_wrapper->group_max_num_fec_buffers = 0;
+    // the group infos are only reallocated if there are more groups than ever before
+    if (rs_wrapper->group_infos_capacity < num_groups) {
+        free(rs_wrapper->group_infos);
+        rs_wrapper->group_infos = safe_malloc(sizeof(GroupInfo) * num_groups);
+        rs_wrapper->group_infos_capacity = num_groups;
+    }
 
     // get the partition plan, based on the elementary data
     fill_partition_plan(rs_wrapper);
@@ -672,7 +716,6 @@ static RSWrapper *rs_wrapper_create_inner(int num_real_buffers, int num_total_bu
 
     // set the decode helper counters to zero
     rs_wrapper_decode_helper_reset(rs_wrapper);
-    return rs_wrapper;
 }
 
 static double overhead_of_group(int num_real_buffers, int num_fec_buffers) {
@@ -50,6 +50,17 @@ the below 4 functions are wrappers of the original rs_lib, with a very similiar
  */
 RSWrapper *rs_wrapper_create(int num_real_buffers, int num_total_buffers);
 
+/**
+ * @brief                          Re-plan an RS wrapper for a different num of buffers, as if it
+ *                                 had just been created by rs_wrapper_create(), but reusing its
+ *                                 allocations where possible
+ *
+ * @param rs_wrapper               RSwrapper object created by rs_wrapper_create()
+ * @param num_real_buffers         num of original buffers
+ * @param num_total_buffers        num of buffers in total
+ */
+void rs_wrapper_reset(RSWrapper *rs_wrapper, int num_real_buffers, int num_total_buffers);
+
 /**
  * @brief                          do RS encode with the RS wrapper
  *
@@ -61,6 +72,23 @@ RSWrapper *rs_wrapper_create(int num_real_buffers, int num_total_buffers);
  */
 void rs_wrapper_encode(RSWrapper *rs_wrapper, void **src, void **dst, int sz);
 
+/**
+ * @brief                          do RS encode with the RS wrapper, but only compute some of
+ *                                 the redundant buffers, so that they can be computed a few at
+ *                                 a time
+ *
+ * @param rs_wrapper               RSwrapper object created by rs_wrapper_create()
+ * @param src                      an arrary of original buffers
+ * @param dst                      an arrary of redundant buffers, the memeroy should be already
+ *                                 allocated before passing here
+ * @param first_fec                the first redundant buffer to compute
+ * @param num_fec                  num of redundant buffers to compute, from first_fec on.
+ *                                 only dst[first_fec, first_fec + num_fec) is written to
+ * @param sz                       size of buffers
+ */
+void rs_wrapper_encode_range(RSWrapper *rs_wrapper, void **src, void **dst, int first_fec,
+                             int num_fec, int sz);
+
 /**
  * @brief                          do RS decode with the RS wrapper
  *
@@ -42,6 +42,7 @@ static StatisticInfo statistic_info[NUM_METRICS] = {
     // {"key", is_max_needed, is_min_needed, aggregation_type};
     // Common metrics
     [NETWORK_RTT_UDP] = {"NETWORK_RTT_UDP", true, true, AVERAGE},
+    [NETWORK_UDP_PACKETS_PER_RECV] = {"UDP_PACKETS_PER_RECV", true, false, AVERAGE},
 
     // Server side metrics
     [AUDIO_ENCODE_TIME] = {"AUDIO_ENCODE_TIME", true, false, AVERAGE},
@@ -52,10 +53,15 @@ static StatisticInfo statistic_info[NUM_METRICS] = {
     [VIDEO_CAPTURE_UPDATE_TIME] = {"VIDEO_CAPTURE_UPDATE_TIME", true, false, AVERAGE},
     [VIDEO_CAPTURE_SCREEN_TIME] = {"VIDEO_CAPTURE_SCREEN_TIME", true, false, AVERAGE},
     [VIDEO_CAPTURE_TRANSFER_TIME] = {"VIDEO_CAPTURE_TRANSFER_TIME", true, false, AVERAGE},
+    [VIDEO_CAPTURE_COPY_TIME] = {"VIDEO_CAPTURE_COPY_TIME", true, false, AVERAGE},
+    [VIDEO_TILE_HASH_TIME] = {"VIDEO_TILE_HASH_TIME", true, false, AVERAGE},
+    [VIDEO_CHANGED_TILE_PERCENTAGE] = {"VIDEO_CHANGED_TILE_PERCENTAGE", true, true, AVERAGE},
     [VIDEO_ENCODER_UPDATE_TIME] = {"VIDEO_ENCODER_UPDATE_TIME", true, false, AVERAGE},
     [VIDEO_ENCODE_TIME] = {"VIDEO_ENCODE_TIME", true, false, AVERAGE},
     [VIDEO_FPS_SENT] = {"VIDEO_FPS_SENT", false, false, AVERAGE_OVER_TIME},
     [VIDEO_FRAMES_SKIPPED_IN_CAPTURE] = {"VIDEO_FRAMES_SKIPPED_IN_CAPTURE", false, false, SUM},
+    [VIDEO_FRAMES_DROPPED_IN_QUEUE] = {"VIDEO_FRAMES_DROPPED_IN_QUEUE", false, false, SUM},
+    [VIDEO_FRAME_QUEUE_TIME] = {"VIDEO_FRAME_QUEUE_TIME", true, false, AVERAGE},
     [VIDEO_FRAME_SIZE] = {"VIDEO_FRAME_SIZE", true, false, AVERAGE},
     [VIDEO_FRAME_PROCESSING_TIME] = {"VIDEO_FRAME_PROCESSING_TIME", true, false, AVERAGE},
     [VIDEO_GET_CURSOR_TIME] = {"GET_CURSOR_TIME", true, false, AVERAGE},
@@ -63,6 +69,10 @@ static StatisticInfo statistic_info[NUM_METRICS] = {
     [VIDEO_FRAME_SATD] = {"VIDEO_FRAME_SATD", true, false, AVERAGE},
     [VIDEO_NUM_RECOVERY_FRAMES] = {"VIDEO_NUM_RECOVERY_FRAMES", false, false, SUM},
     [VIDEO_SEND_TIME] = {"VIDEO_SEND_TIME", true, false, AVERAGE},
+    [VIDEO_SEND_WAIT_TIME] = {"VIDEO_SEND_WAIT_TIME", true, false, AVERAGE},
+    [VIDEO_ENCRYPT_TIME] = {"VIDEO_ENCRYPT_TIME", true, false, AVERAGE},
+    [VIDEO_FEC_ENCODE_TIME] = {"VIDEO_FEC_ENCODE_TIME", true, false, AVERAGE},
+    [VIDEO_FEC_WAIT_TIME] = {"VIDEO_FEC_WAIT_TIME", true, false, AVERAGE},
     [DBUS_MSGS_RECEIVED] = {"DBUS_MSGS_RECEIVED", false, false, SUM},
     [SERVER_CPU_USAGE] = {"SERVER_CPU_USAGE", false, false, AVERAGE},
 
@@ -71,6 +81,7 @@ static StatisticInfo statistic_info[NUM_METRICS] = {
     [AUDIO_FRAMES_SKIPPED] = {"AUDIO_FRAMES_SKIPPED", false, false, SUM},
     [NETWORK_READ_PACKET_TCP] = {"READ_PACKET_TIME_TCP", true, false, AVERAGE},
     [NETWORK_READ_PACKET_UDP] = {"READ_PACKET_TIME_UDP", true, false, AVERAGE},
+    [NETWORK_NACK_TIMER_LATENESS] = {"NACK_TIMER_LATENESS", true, false, AVERAGE},
     [SERVER_HANDLE_MESSAGE_TCP] = {"HANDLE_SERVER_MESSAGE_TIME_TCP", true, false, AVERAGE},
     [VIDEO_AVCODEC_RECEIVE_TIME] = {"AVCODEC_RECEIVE_TIME", true, false, AVERAGE},
     [VIDEO_AV_HWFRAME_TRANSFER_TIME] = {"AV_HWFRAME_TRANSFER_TIME", true, false, AVERAGE},
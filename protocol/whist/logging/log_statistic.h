@@ -47,6 +47,7 @@ Public enums
 typedef enum {
     // Common metrics
     NETWORK_RTT_UDP,
+    NETWORK_UDP_PACKETS_PER_RECV,
 
     // Server side metrics
     AUDIO_ENCODE_TIME,
@@ -57,10 +58,15 @@ typedef enum {
     VIDEO_CAPTURE_UPDATE_TIME,
     VIDEO_CAPTURE_SCREEN_TIME,
     VIDEO_CAPTURE_TRANSFER_TIME,
+    VIDEO_CAPTURE_COPY_TIME,
+    VIDEO_TILE_HASH_TIME,
+    VIDEO_CHANGED_TILE_PERCENTAGE,
     VIDEO_ENCODER_UPDATE_TIME,
     VIDEO_ENCODE_TIME,
     VIDEO_FPS_SENT,
     VIDEO_FRAMES_SKIPPED_IN_CAPTURE,
+    VIDEO_FRAMES_DROPPED_IN_QUEUE,
+    VIDEO_FRAME_QUEUE_TIME,
     VIDEO_FRAME_SIZE,
     VIDEO_FRAME_PROCESSING_TIME,
     VIDEO_GET_CURSOR_TIME,
@@ -68,6 +74,10 @@ typedef enum {
     VIDEO_FRAME_SATD,
     VIDEO_NUM_RECOVERY_FRAMES,
     VIDEO_SEND_TIME,
+    VIDEO_SEND_WAIT_TIME,
+    VIDEO_ENCRYPT_TIME,
+    VIDEO_FEC_ENCODE_TIME,
+    VIDEO_FEC_WAIT_TIME,
     DBUS_MSGS_RECEIVED,
     SERVER_CPU_USAGE,
 
@@ -76,6 +86,7 @@ typedef enum {
     AUDIO_FRAMES_SKIPPED,
     NETWORK_READ_PACKET_TCP,
     NETWORK_READ_PACKET_UDP,
+    NETWORK_NACK_TIMER_LATENESS,
     SERVER_HANDLE_MESSAGE_TCP,
     VIDEO_AVCODEC_RECEIVE_TIME,
     VIDEO_AV_HWFRAME_TRANSFER_TIME,
@@ -211,6 +211,16 @@ typedef struct {
 // Unencrypted)
 //                  = PACKET_HEADER_SIZE + cipher_len (If Encrypted)
 
+/**
+ * @brief                          A piece of a buffer that's scattered in memory,
+ *                                 so that it can be sent without first being copied
+ *                                 into one contiguous buffer
+ */
+typedef struct {
+    const void* data;
+    int size;
+} WhistIOVec;
+
 typedef struct {
     unsigned int ip;
     unsigned short private_port;
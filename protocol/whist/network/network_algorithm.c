@@ -7,13 +7,11 @@
 Usage
 ============================
 Place to put any predictive/adaptive bitrate algorithms. In the current setup, each algorithm is a
-function that takes in inputs through a NetworkStatistics struct. The function is responsible for
-maintaining any internal state necessary for the algorithm (possibly through the use of custom types
-or helpers), and should update client_max_bitrate when necessary.
+CongestionControllerFunctionTable, whose create function allocates the state that the algorithm
+needs for a connection, and whose update function updates the network settings when necessary.
 
-To change the algorithm the client uses, set `calculate_new_bitrate` to the desired algorithm.
-The function assigned to `calculate_new_bitrate` should have signature such that it takes
-one argument of type `NetworkStatistics` and returns type `NetworkSettings`.
+To add an algorithm, give it a function table and a function that returns it, like
+wcc_get_function_table. The client picks the algorithm that it uses in udp.cpp.
 
 For more details about the individual algorithms, please visit
 https://www.notion.so/whisthq/Adaptive-Bitrate-Algorithms-a6ea0987adc04e8d84792fc9dcbc7fc7
@@ -40,7 +38,6 @@ Globals
 
 static volatile int network_algo_width;
 static volatile int network_algo_height;
-static volatile bool network_algo_insufficient_bandwidth;
 
 /*
 ============================
@@ -82,7 +79,143 @@ static NetworkSettings default_network_settings = {
 #define STARTING_BURST_BITRATE (STARTING_BITRATE * BURST_BITRATE_RATIO)
 
 static int dpi = -1;
-static WhistTimer last_update_timer;
+
+// Latest delay variation gets this weightage. Older value gets a weightage of (1 - EWMA_FACTOR)
+#define EWMA_FACTOR 0.3
+// Latest max bitrate gets this weightage.
+#define MAX_BITRATE_EWMA_FACTOR 0.05
+#define DELAY_VARIATION_THRESHOLD_IN_SEC 0.01   // 10ms
+#define LONG_OVERUSE_TIME_THRESHOLD_IN_SEC 0.1  // 100ms
+#define DECREASE_RATIO 0.95
+#define BANDWITH_USED_THRESHOLD 0.95
+// Higher value will mean increased latency. Lower value will increase false positives for
+// congestion. Right now set to 50ms based on tradeoff between acceptable E2E latency vs false
+// positives.
+#define MIN_LATENCY_THRESHOLD_SEC 0.05  // 50ms
+#define MIN_UPDATE_INTERVAL_SEVERE_CONGESTION_SEC 0.025  // 25ms
+
+struct CongestionController {
+    const CongestionControllerFunctionTable *call;
+    void *state;
+};
+
+typedef enum {
+    DELAY_CONTROLLER_INCREASE,
+    DELAY_CONTROLLER_HOLD,
+    DELAY_CONTROLLER_DECREASE
+} DelayControllerState;
+
+// The state of WCC for a connection
+typedef struct {
+    WhistTimer overuse_timer;
+    WhistTimer last_decrease_timer;
+    WhistTimer last_update_timer;
+    bool delay_controller_initialized;
+
+    double filtered_delay_variation;
+    double increase_percentage;
+    bool burst_mode;
+    int max_bitrate_available;
+    int last_successful_bitrate;
+    bool maybe_overuse;
+    DelayControllerState delay_controller_state;
+    bool insufficient_bandwidth;
+} WCCState;
+
+// How many of the latest groups the trend of the delay variation is estimated over
+#define DG_TRENDLINE_WINDOW 20
+// Latest accumulated delay gets a weightage of (1 - DG_TRENDLINE_SMOOTHING)
+#define DG_TRENDLINE_SMOOTHING 0.9
+// The trend is scaled by this, and by the number of groups it's been estimated over up to
+// DG_TRENDLINE_MAX_GROUPS, before it's compared against the overuse threshold
+#define DG_TRENDLINE_GAIN 4.0
+#define DG_TRENDLINE_MAX_GROUPS 60
+// The overuse threshold adapts to the scaled trend, within these bounds, so that the controller
+// isn't starved by concurrent flows. All of these are in milliseconds.
+#define DG_INITIAL_THRESHOLD_MS 12.5
+#define DG_MIN_THRESHOLD_MS 6.0
+#define DG_MAX_THRESHOLD_MS 600.0
+#define DG_THRESHOLD_GAIN_UP 0.0087
+#define DG_THRESHOLD_GAIN_DOWN 0.039
+#define DG_MAX_THRESHOLD_UPDATE_MS 100.0
+#define DG_OVERUSE_TIME_THRESHOLD_SEC 0.01  // 10ms
+// Packet loss above this ratio means congestion, whatever the delay does
+#define DG_LOSS_THRESHOLD 0.1
+// A latency of more than this on top of the minimum latency means that a queue has built up
+#define DG_MAX_QUEUING_DELAY_SEC 0.05  // 50ms
+// The minimum latency is the lowest latency of the last this long, so that it's forgotten in case
+// the route changed. It's tracked as the minimum of each of DG_MIN_LATENCY_WINDOW_BUCKETS slices of
+// the window, so that a latency only ages out once every lower one of the window has.
+#define DG_MIN_LATENCY_WINDOW_SEC 10.0
+#define DG_MIN_LATENCY_WINDOW_BUCKETS 10
+// The bottleneck bandwidth is the highest bitrate that got through in the last this many phases
+#define DG_BANDWIDTH_WINDOW_PHASES 10
+// Startup is over once the bottleneck bandwidth hasn't grown by DG_STARTUP_GAIN for this many
+// phases
+#define DG_STARTUP_FULL_BANDWIDTH_PHASES 3
+// Incoming bitrates below this ratio of the bitrate, while not saturating the bandwidth, are
+// limited by the encoder rather than by the network, so they don't measure the bandwidth
+#define DG_APP_LIMITED_RATIO 0.9
+// Decreases are spaced out by this much, so that the queue can drain and the latency settle
+#define DG_MIN_DECREASE_INTERVAL_SEC 0.5
+// The gain cycle of the bandwidth probing, one gain per phase. The probing phase saturates the
+// bandwidth to see if more of it is available, and the next one drains the queue that it built.
+static const double dg_probe_gains[] = {1.25, 0.9, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+#define DG_NUM_PROBE_GAINS ((int)(sizeof(dg_probe_gains) / sizeof(dg_probe_gains[0])))
+// The phase that the cycle resumes at after a decrease
+#define DG_FIRST_CRUISE_PHASE 2
+
+typedef enum {
+    DG_UNDERUSE_SIGNAL,
+    DG_NORMAL_SIGNAL,
+    DG_OVERUSE_SIGNAL,
+} DelayGradientSignal;
+
+typedef enum {
+    // Grow the bitrate every phase to find the bottleneck bandwidth
+    DG_STARTUP,
+    // Keep the bitrate at the bottleneck bandwidth, probing for more of it every cycle of gains
+    DG_PROBE_BANDWIDTH,
+} DelayGradientMode;
+
+// The state of the delay-gradient controller for a connection
+typedef struct {
+    bool initialized;
+    DelayGradientMode mode;
+    int probe_phase;
+    WhistTimer phase_timer;
+    WhistTimer last_decrease_timer;
+    WhistTimer last_update_timer;
+
+    // Delay trend estimation, over the arrival times and smoothed accumulated delays of the
+    // latest DG_TRENDLINE_WINDOW groups
+    timestamp_us first_arrival_time;
+    double accumulated_delay_ms;
+    double smoothed_delay_ms;
+    double trendline_arrival_ms[DG_TRENDLINE_WINDOW];
+    double trendline_delay_ms[DG_TRENDLINE_WINDOW];
+    int num_groups;
+    double prev_trend;
+
+    // Overuse detection
+    double threshold_ms;
+    double last_threshold_update_ms;
+    bool maybe_overuse;
+    WhistTimer overuse_timer;
+
+    // Bandwidth and latency estimation
+    int phase_max_bandwidth;
+    int bandwidth_window[DG_BANDWIDTH_WINDOW_PHASES];
+    int bandwidth_window_index;
+    int full_bandwidth;
+    int full_bandwidth_phases;
+    double min_latency;
+    // The minimum latency of each slice of the window, or 0 if nothing was measured in it
+    double min_latency_buckets[DG_MIN_LATENCY_WINDOW_BUCKETS];
+    int min_latency_bucket_index;
+    WhistTimer min_latency_bucket_timer;
+    bool insufficient_bandwidth;
+} DelayGradientState;
 
 /*
 ============================
@@ -90,6 +223,83 @@ Private Function Declarations
 ============================
 */
 
+static void *wcc_create(void);
+static void wcc_destroy(void *state);
+static bool wcc_update(void *state, GroupStats *curr_group_stats, GroupStats *prev_group_stats,
+                       int incoming_bitrate, double packet_loss_ratio, double short_term_latency,
+                       double long_term_latency, NetworkSettings *network_settings,
+                       void *fec_controller);
+static bool wcc_handle_severe_congestion(void *state, NetworkSettings *network_settings);
+static bool wcc_is_insufficient_bandwidth(void *state);
+
+static void *delay_gradient_create(void);
+static void delay_gradient_destroy(void *state);
+static bool delay_gradient_update(void *state, GroupStats *curr_group_stats,
+                                  GroupStats *prev_group_stats, int incoming_bitrate,
+                                  double packet_loss_ratio, double short_term_latency,
+                                  double long_term_latency, NetworkSettings *network_settings,
+                                  void *fec_controller);
+static bool delay_gradient_handle_severe_congestion(void *state,
+                                                    NetworkSettings *network_settings);
+static bool delay_gradient_is_insufficient_bandwidth(void *state);
+
+/**
+ * @brief                   Add a group to the delay trend of the delay-gradient controller, and
+ *                          detect over/under use from the trend
+ *
+ * @param dg                The delay-gradient controller state
+ * @param curr_group_stats  The group that was just completed
+ * @param prev_group_stats  The group before it
+ *
+ * @returns                 The over/under use signal
+ */
+static DelayGradientSignal delay_gradient_detect_overuse(DelayGradientState *dg,
+                                                         GroupStats *curr_group_stats,
+                                                         GroupStats *prev_group_stats);
+
+/**
+ * @brief                   Get the bottleneck bandwidth that the delay-gradient controller has
+ *                          measured, which is the highest bitrate that got through recently
+ *
+ * @param dg                The delay-gradient controller state
+ *
+ * @returns                 The bottleneck bandwidth, or 0 if nothing has been measured yet
+ */
+static int delay_gradient_get_bottleneck_bandwidth(DelayGradientState *dg);
+
+/**
+ * @brief                   Forget the bandwidth measurements of the delay-gradient controller,
+ *                          and start over from a single measurement
+ *
+ * @param dg                The delay-gradient controller state
+ * @param bandwidth         The bandwidth to start over from
+ */
+static void delay_gradient_reset_bandwidth(DelayGradientState *dg, int bandwidth);
+
+/**
+ * @brief                   Add a latency measurement to the window of the delay-gradient
+ *                          controller's minimum latency, and update the minimum latency
+ *
+ * @param dg                The delay-gradient controller state
+ * @param latency           The latency that was measured, or 0 if there's none
+ */
+static void delay_gradient_update_min_latency(DelayGradientState *dg, double latency);
+
+/**
+ * @brief                   Feed a bitrate decision to the FEC controller, and apply the FEC ratio
+ *                          that it comes up with
+ *
+ * @param fec_controller    The FEC controller
+ * @param op                Whether the bitrate was increased, decreased or left as it is
+ * @param packet_loss_ratio The current packet loss ratio
+ * @param old_bitrate       The bitrate before the decision
+ * @param network_settings  The network settings, whose video FEC ratio gets updated
+ *
+ * @returns                 Whether the video FEC ratio changed
+ */
+static bool update_fec_ratio(void *fec_controller, WccOp op, double packet_loss_ratio,
+                             int old_bitrate, NetworkSettings *network_settings);
+
 static int get_video_bitrate(int width, int height, int screen_dpi, double bitrate_per_pixel) {
     // We have to scale-up the bitrates for lower DPI screens. This is because Chrome renders more
     // content in lower DPI screens and hence higher level of details. So the same bitrate cannot be
@@ -129,45 +339,117 @@ void network_algo_set_dimensions(int width, int height) {
     network_algo_height = height;
 }
 
-bool network_algo_is_insufficient_bandwidth(void) { return network_algo_insufficient_bandwidth; }
+CongestionController *create_congestion_controller(const CongestionControllerFunctionTable *call) {
+    CongestionController *controller = safe_malloc(sizeof(CongestionController));
+    controller->call = call;
+    controller->state = call->create();
+    return controller;
+}
+
+const char *congestion_controller_get_name(CongestionController *controller) {
+    return controller->call->name;
+}
+
+bool congestion_controller_update(CongestionController *controller, GroupStats *curr_group_stats,
+                                  GroupStats *prev_group_stats, int incoming_bitrate,
+                                  double packet_loss_ratio, double short_term_latency,
+                                  double long_term_latency, NetworkSettings *network_settings,
+                                  void *fec_controller) {
+    return controller->call->update(controller->state, curr_group_stats, prev_group_stats,
+                                    incoming_bitrate, packet_loss_ratio, short_term_latency,
+                                    long_term_latency, network_settings, fec_controller);
+}
+
+bool congestion_controller_handle_severe_congestion(CongestionController *controller,
+                                                    NetworkSettings *network_settings) {
+    return controller->call->handle_severe_congestion(controller->state, network_settings);
+}
+
+bool congestion_controller_is_insufficient_bandwidth(CongestionController *controller) {
+    return controller->call->is_insufficient_bandwidth(controller->state);
+}
+
+void destroy_congestion_controller(CongestionController *controller) {
+    controller->call->destroy(controller->state);
+    free(controller);
+}
+
+const CongestionControllerFunctionTable *wcc_get_function_table(void) {
+    static const CongestionControllerFunctionTable wcc_function_table = {
+        .name = "WCC",
+        .create = wcc_create,
+        .destroy = wcc_destroy,
+        .update = wcc_update,
+        .handle_severe_congestion = wcc_handle_severe_congestion,
+        .is_insufficient_bandwidth = wcc_is_insufficient_bandwidth,
+    };
+    return &wcc_function_table;
+}
+
+const CongestionControllerFunctionTable *delay_gradient_get_function_table(void) {
+    static const CongestionControllerFunctionTable delay_gradient_function_table = {
+        .name = "delay gradient",
+        .create = delay_gradient_create,
+        .destroy = delay_gradient_destroy,
+        .update = delay_gradient_update,
+        .handle_severe_congestion = delay_gradient_handle_severe_congestion,
+        .is_insufficient_bandwidth = delay_gradient_is_insufficient_bandwidth,
+    };
+    return &delay_gradient_function_table;
+}
+
+/*
+============================
+Private Function Implementations
+============================
+*/
+
+bool update_fec_ratio(void *fec_controller, WccOp op, double packet_loss_ratio, int old_bitrate,
+                      NetworkSettings *network_settings) {
+    // get current time
+    double current_time = get_timestamp_sec();
+    // feed info to fec controller
+    fec_controller_feed_info(fec_controller, current_time, op, packet_loss_ratio, old_bitrate,
+                             network_settings->video_bitrate, MINIMUM_BITRATE,
+                             network_settings->saturate_bandwidth);
+    // get fec result from fec controller
+    double total_fec_ratio = fec_controller_get_total_fec_ratio(fec_controller, current_time,
+                                                                network_settings->video_fec_ratio);
+
+    // see if there is a value change
+    if (total_fec_ratio != network_settings->video_fec_ratio) {
+        network_settings->video_fec_ratio = total_fec_ratio;
+        return true;
+    }
+    return false;
+}
+
+void *wcc_create(void) {
+    WCCState *wcc = safe_zalloc(sizeof(WCCState));
+    wcc->increase_percentage = MAX_INCREASE_PERCENTAGE;
+    wcc->delay_controller_state = DELAY_CONTROLLER_HOLD;
+    return wcc;
+}
+
+void wcc_destroy(void *state) { free(state); }
 
 // The theory behind all the code in this function is documented in WCC.md file. Please go thru that
 // document before reviewing this file. Also if you make any modifications to this algo, remember to
 // update the WCC.md file as well so that the documentation remains upto date.
-bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_group_stats,
-                                 int incoming_bitrate, double packet_loss_ratio,
-                                 double short_term_latency, double long_term_latency,
-                                 NetworkSettings *network_settings, void *fec_controller) {
-// Latest delay variation gets this weightage. Older value gets a weightage of (1 - EWMA_FACTOR)
-#define EWMA_FACTOR 0.3
-// Latest max bitrate gets this weightage.
-#define MAX_BITRATE_EWMA_FACTOR 0.05
-#define DELAY_VARIATION_THRESHOLD_IN_SEC 0.01   // 10ms
-#define LONG_OVERUSE_TIME_THRESHOLD_IN_SEC 0.1  // 100ms
-#define DECREASE_RATIO 0.95
-#define BANDWITH_USED_THRESHOLD 0.95
-// Higher value will mean increased latency. Lower value will increase false positives for
-// congestion. Right now set to 50ms based on tradeoff between acceptable E2E latency vs false
-// positives.
-#define MIN_LATENCY_THRESHOLD_SEC 0.05  // 50ms
+bool wcc_update(void *state, GroupStats *curr_group_stats, GroupStats *prev_group_stats,
+                int incoming_bitrate, double packet_loss_ratio, double short_term_latency,
+                double long_term_latency, NetworkSettings *network_settings,
+                void *fec_controller) {
     if (incoming_bitrate <= 0) {
         // Not enough data to take any decision. Let the bits start flowing.
         return false;
     }
-    static WhistTimer overuse_timer;
-    static WhistTimer last_decrease_timer;
-    static bool delay_controller_initialized = false;
-
-    static double filtered_delay_variation;
-    static double increase_percentage = MAX_INCREASE_PERCENTAGE;
-    static bool burst_mode = false;
-    static int max_bitrate_available = 0;
-    static int last_successful_bitrate = 0;
-
-    if (!delay_controller_initialized) {
-        start_timer(&overuse_timer);
-        start_timer(&last_update_timer);
-        start_timer(&last_decrease_timer);
+    WCCState *wcc = (WCCState *)state;
+
+    if (!wcc->delay_controller_initialized) {
+        start_timer(&wcc->overuse_timer);
+        start_timer(&wcc->last_update_timer);
+        start_timer(&wcc->last_decrease_timer);
     }
     int max_bitrate = MAXIMUM_BITRATE;
     int new_bitrate = network_settings->video_bitrate;
@@ -179,12 +461,6 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
         OVERUSE_SIGNAL,
     } overuse_detector_signal = NORMAL_SIGNAL;
 
-    static enum {
-        DELAY_CONTROLLER_INCREASE,
-        DELAY_CONTROLLER_HOLD,
-        DELAY_CONTROLLER_DECREASE
-    } delay_controller_state = DELAY_CONTROLLER_HOLD;
-
     double inter_departure_time =
         (double)(curr_group_stats->departure_time - prev_group_stats->departure_time) /
         US_IN_SECOND;
@@ -192,26 +468,25 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
         (double)(curr_group_stats->arrival_time - prev_group_stats->arrival_time) / US_IN_SECOND;
     double delay_variation = inter_arrival_time - inter_departure_time;
 
-    if (!delay_controller_initialized) {
-        filtered_delay_variation = delay_variation;
+    if (!wcc->delay_controller_initialized) {
+        wcc->filtered_delay_variation = delay_variation;
     } else {
-        filtered_delay_variation =
-            filtered_delay_variation * (1.0 - EWMA_FACTOR) + delay_variation * EWMA_FACTOR;
+        wcc->filtered_delay_variation =
+            wcc->filtered_delay_variation * (1.0 - EWMA_FACTOR) + delay_variation * EWMA_FACTOR;
     }
 
-    delay_controller_initialized = true;
+    wcc->delay_controller_initialized = true;
 
-    static bool maybe_overuse = false;
     // Detect over/under use using state machine outlined in spec
     // In burst mode delay gradient might increase, but it doesn't mean congestion. In burst
     // mode we will rely for packet loss ratio for overuse detection
-    if ((DELAY_VARIATION_THRESHOLD_IN_SEC < filtered_delay_variation && !burst_mode) ||
+    if ((DELAY_VARIATION_THRESHOLD_IN_SEC < wcc->filtered_delay_variation && !wcc->burst_mode) ||
         packet_loss_ratio > 0.1) {
-        if (!maybe_overuse) {
-            start_timer(&overuse_timer);
-            maybe_overuse = true;
+        if (!wcc->maybe_overuse) {
+            start_timer(&wcc->overuse_timer);
+            wcc->maybe_overuse = true;
             LOG_INFO("Maybe overuse!, filtered_delay_variation = %0.3f, packet_loss_ratio = %.2f",
-                     filtered_delay_variation, packet_loss_ratio);
+                     wcc->filtered_delay_variation, packet_loss_ratio);
         }
         double overuse_time_threshold;
         if (network_settings->saturate_bandwidth) {
@@ -226,19 +501,19 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
         // detected for at least overuse_time_th milliseconds.  However, if m(i)
         // < m(i-1), over-use will not be signaled even if all the above
         // conditions are met.
-        if (get_timer(&overuse_timer) > overuse_time_threshold) {
+        if (get_timer(&wcc->overuse_timer) > overuse_time_threshold) {
             overuse_detector_signal = OVERUSE_SIGNAL;
         } else {
             // If neither over-use nor under-use is detected, the detector will be in the normal
             // state.
             overuse_detector_signal = NORMAL_SIGNAL;
         }
-    } else if (-DELAY_VARIATION_THRESHOLD_IN_SEC > filtered_delay_variation) {
+    } else if (-DELAY_VARIATION_THRESHOLD_IN_SEC > wcc->filtered_delay_variation) {
         overuse_detector_signal = UNDERUSE_SIGNAL;
-        maybe_overuse = false;
+        wcc->maybe_overuse = false;
     } else {
         overuse_detector_signal = NORMAL_SIGNAL;
-        maybe_overuse = false;
+        wcc->maybe_overuse = false;
     }
 
     // The state transitions (with blank fields meaning "remain in state")
@@ -255,15 +530,15 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
     // |  Under-use  |           |   Hold     |  Hold  |
     // +-------------+-----------+------------+--------+
     if (overuse_detector_signal == OVERUSE_SIGNAL) {
-        delay_controller_state = DELAY_CONTROLLER_DECREASE;
+        wcc->delay_controller_state = DELAY_CONTROLLER_DECREASE;
     } else if (overuse_detector_signal == NORMAL_SIGNAL) {
-        if (delay_controller_state == DELAY_CONTROLLER_HOLD) {
-            delay_controller_state = DELAY_CONTROLLER_INCREASE;
-        } else if (delay_controller_state == DELAY_CONTROLLER_DECREASE) {
-            delay_controller_state = DELAY_CONTROLLER_HOLD;
+        if (wcc->delay_controller_state == DELAY_CONTROLLER_HOLD) {
+            wcc->delay_controller_state = DELAY_CONTROLLER_INCREASE;
+        } else if (wcc->delay_controller_state == DELAY_CONTROLLER_DECREASE) {
+            wcc->delay_controller_state = DELAY_CONTROLLER_HOLD;
         }
     } else if (overuse_detector_signal == UNDERUSE_SIGNAL) {
-        delay_controller_state = DELAY_CONTROLLER_HOLD;
+        wcc->delay_controller_state = DELAY_CONTROLLER_HOLD;
     }
 
     // If the latency suddenly increases, then it might mean congestion due to longer queue length.
@@ -276,7 +551,7 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
 #define LATENCY_MULTIPLIER_HOLD_STATE 1.1
     // Using a higher latency threshold for burst mode, as sending packets in a burst can
     // momentarily cause congestion that will get cleared up immediately.
-    if (burst_mode)
+    if (wcc->burst_mode)
         latency_threshold_decrease_state = long_term_latency * LATENCY_MULTIPLIER_BURST_MODE;
     else
         latency_threshold_decrease_state = long_term_latency * LATENCY_MULTIPLIER_NORMAL_MODE;
@@ -288,10 +563,10 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
     latency_threshold_hold_state = max(latency_threshold_hold_state, MIN_LATENCY_THRESHOLD_SEC);
 
     if (short_term_latency > latency_threshold_decrease_state) {
-        delay_controller_state = DELAY_CONTROLLER_DECREASE;
+        wcc->delay_controller_state = DELAY_CONTROLLER_DECREASE;
     } else if (short_term_latency > latency_threshold_hold_state &&
-               delay_controller_state == DELAY_CONTROLLER_INCREASE) {
-        delay_controller_state = DELAY_CONTROLLER_HOLD;
+               wcc->delay_controller_state == DELAY_CONTROLLER_INCREASE) {
+        wcc->delay_controller_state = DELAY_CONTROLLER_HOLD;
     }
 
     WccOp op = WCC_NO_OP;
@@ -302,47 +577,50 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
     // as congestion is detected, and otherwise at least once every second.
     // It is RECOMMENDED that the routine to update A_hat(i) is run at least
     // once every response_time interval.
-    if (delay_controller_state == DELAY_CONTROLLER_INCREASE &&
-        get_timer(&last_update_timer) > NEW_BITRATE_DURATION_IN_SEC &&
+    if (wcc->delay_controller_state == DELAY_CONTROLLER_INCREASE &&
+        get_timer(&wcc->last_update_timer) > NEW_BITRATE_DURATION_IN_SEC &&
         incoming_bitrate > (network_settings->video_bitrate * BANDWITH_USED_THRESHOLD)) {
-        last_successful_bitrate = network_settings->video_bitrate;
+        wcc->last_successful_bitrate = network_settings->video_bitrate;
         // Looks like the network has found a new max bitrate. Let find the new max bandwidth.
-        if (last_successful_bitrate > max_bitrate_available) {
-            max_bitrate_available = last_successful_bitrate;
+        if (wcc->last_successful_bitrate > wcc->max_bitrate_available) {
+            wcc->max_bitrate_available = wcc->last_successful_bitrate;
             network_settings->saturate_bandwidth = true;
-            increase_percentage = MAX_INCREASE_PERCENTAGE;
+            wcc->increase_percentage = MAX_INCREASE_PERCENTAGE;
         }
         // If in saturate bandwidth mode and no congestion is detected, then increase percentage
         // should be made higher to quickly find the new max bitrate
         if (network_settings->saturate_bandwidth == true) {
-            increase_percentage = MAX_INCREASE_PERCENTAGE;
+            wcc->increase_percentage = MAX_INCREASE_PERCENTAGE;
         }
-        LOG_INFO("Increase bitrate by %.3f percent", increase_percentage);
-        new_bitrate = network_settings->video_bitrate * (1.0 + increase_percentage / 100.0);
+        LOG_INFO("Increase bitrate by %.3f percent", wcc->increase_percentage);
+        new_bitrate = network_settings->video_bitrate * (1.0 + wcc->increase_percentage / 100.0);
         op = WCC_INCREASE_BWD;
-    } else if ((delay_controller_state == DELAY_CONTROLLER_DECREASE) &&
-               get_timer(&last_decrease_timer) > NEW_BITRATE_DURATION_IN_SEC) {
+    } else if ((wcc->delay_controller_state == DELAY_CONTROLLER_DECREASE) &&
+               get_timer(&wcc->last_decrease_timer) > NEW_BITRATE_DURATION_IN_SEC) {
         LOG_INFO(
             "Decrease bitrate filtered_delay_variation = %.3f packet_loss_ratio = %.2f, "
             "short_term_latency = %0.3f, long_term_latency = %.3f",
-            filtered_delay_variation, packet_loss_ratio, short_term_latency * MS_IN_SECOND,
+            wcc->filtered_delay_variation, packet_loss_ratio, short_term_latency * MS_IN_SECOND,
             long_term_latency * MS_IN_SECOND);
         // Decrease the max_bitrate_available gradually, if congestion is detected at a lower
         // bitrate
-        if (last_successful_bitrate < max_bitrate_available) {
-            max_bitrate_available = max_bitrate_available * (1.0 - MAX_BITRATE_EWMA_FACTOR) +
-                                    last_successful_bitrate * MAX_BITRATE_EWMA_FACTOR;
+        if (wcc->last_successful_bitrate < wcc->max_bitrate_available) {
+            wcc->max_bitrate_available =
+                wcc->max_bitrate_available * (1.0 - MAX_BITRATE_EWMA_FACTOR) +
+                wcc->last_successful_bitrate * MAX_BITRATE_EWMA_FACTOR;
         }
         // Use incoming bitrate only when saturate_bandwidth is on OR if it is within the
         // convergence range
         if (network_settings->saturate_bandwidth ||
-            incoming_bitrate * DECREASE_RATIO > max_bitrate_available * CONVERGENCE_THRESHOLD_LOW) {
+            incoming_bitrate * DECREASE_RATIO >
+                wcc->max_bitrate_available * CONVERGENCE_THRESHOLD_LOW) {
             new_bitrate = incoming_bitrate * DECREASE_RATIO;
             // If we are reaching convergence than reduce the increase percentage and switch off
             // saturate bandwidth
-            if (new_bitrate >= max_bitrate_available * CONVERGENCE_THRESHOLD_LOW) {
+            if (new_bitrate >= wcc->max_bitrate_available * CONVERGENCE_THRESHOLD_LOW) {
                 network_settings->saturate_bandwidth = false;
-                increase_percentage = max(increase_percentage / 2.0, MIN_INCREASE_PERCENTAGE);
+                wcc->increase_percentage =
+                    max(wcc->increase_percentage / 2.0, MIN_INCREASE_PERCENTAGE);
             }
         } else {
             // When saturate bandwidth is OFF, then incoming_bitrate is not reliable. So just reduce
@@ -354,19 +632,19 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
             network_settings->saturate_bandwidth = true;
         }
         network_settings->congestion_detected = true;
-        start_timer(&last_decrease_timer);
+        start_timer(&wcc->last_decrease_timer);
         op = WCC_DECREASE_BWD;
     }
 
     if (op != WCC_NO_OP) {
         // Till we reach CONVERGENCE_THRESHOLD_LOW of max bitrate in session, bitrate
         // increases will be aggressive
-        if (new_bitrate < max_bitrate_available * CONVERGENCE_THRESHOLD_LOW ||
-            max_bitrate_available == 0) {
+        if (new_bitrate < wcc->max_bitrate_available * CONVERGENCE_THRESHOLD_LOW ||
+            wcc->max_bitrate_available == 0) {
             network_settings->saturate_bandwidth = true;
-            increase_percentage = MAX_INCREASE_PERCENTAGE;
+            wcc->increase_percentage = MAX_INCREASE_PERCENTAGE;
         }
-        start_timer(&last_update_timer);
+        start_timer(&wcc->last_update_timer);
         int min_bitrate = MINIMUM_BITRATE;
         if (new_bitrate < min_bitrate) {
             LOG_WARNING("Requested bitrate %d bps is lesser than minimum acceptable bitrate %d bps",
@@ -375,12 +653,12 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
             // If we have reached the min_bitrate for two consecutive times, then signal
             // insufficient bandwidth
             if (network_settings->video_bitrate == min_bitrate) {
-                network_algo_insufficient_bandwidth = true;
+                wcc->insufficient_bandwidth = true;
             }
         } else {
-            network_algo_insufficient_bandwidth = false;
+            wcc->insufficient_bandwidth = false;
         }
-        burst_mode = false;
+        wcc->burst_mode = false;
 
         if (new_bitrate >= max_bitrate) {
             network_settings->saturate_bandwidth = false;
@@ -388,20 +666,20 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
             new_bitrate = max_bitrate;
             // More bandwidth than max_bitrate could be available. Switch to burst mode for reduced
             // latency
-            burst_mode = true;
+            wcc->burst_mode = true;
         }
 
         int burst_bitrate = new_bitrate;
-        if (burst_mode) burst_bitrate *= BURST_BITRATE_RATIO;
+        if (wcc->burst_mode) burst_bitrate *= BURST_BITRATE_RATIO;
         network_settings->burst_bitrate = burst_bitrate;
         network_settings->video_bitrate = new_bitrate;
         LOG_INFO(
             "New bitrate = %d, burst_bitrate = %d, saturate bandwidth = %d, "
             "max_bitrate_available = %d",
             network_settings->video_bitrate, network_settings->burst_bitrate,
-            network_settings->saturate_bandwidth, max_bitrate_available);
+            network_settings->saturate_bandwidth, wcc->max_bitrate_available);
         send_network_settings = true;
-    } else if (network_settings->saturate_bandwidth && get_timer(&last_update_timer) > 5.0) {
+    } else if (network_settings->saturate_bandwidth && get_timer(&wcc->last_update_timer) > 5.0) {
         // Prevent being stuck in saturate_bandwidth loop, without any bitrate update. This can
         // happen when the network bandwidth on this session worsens lesser than
         // (max_bitrate_available  * CONVERGENCE_THRESHOLD_LOW) for a long period of time. In such
@@ -412,22 +690,9 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
         send_network_settings = true;
     }
 
-    if (ENABLE_FEC) {
-        // get current time
-        double current_time = get_timestamp_sec();
-        // feed info to fec controller
-        fec_controller_feed_info(fec_controller, current_time, op, packet_loss_ratio, old_bitrate,
-                                 network_settings->video_bitrate, MINIMUM_BITRATE,
-                                 network_settings->saturate_bandwidth);
-        // get fec result from fec controller
-        double total_fec_ratio = fec_controller_get_total_fec_ratio(
-            fec_controller, current_time, network_settings->video_fec_ratio);
-
-        // see if there is a value change
-        if (total_fec_ratio != network_settings->video_fec_ratio) {
-            network_settings->video_fec_ratio = total_fec_ratio;
-            send_network_settings = true;
-        }
+    if (ENABLE_FEC &&
+        update_fec_ratio(fec_controller, op, packet_loss_ratio, old_bitrate, network_settings)) {
+        send_network_settings = true;
     }
     whist_analyzer_record_current_cc_info(PACKET_VIDEO, packet_loss_ratio, short_term_latency,
                                           network_settings->video_bitrate, incoming_bitrate);
@@ -441,9 +706,9 @@ bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_
 
 // Should be called in times of severe congestion. Right now we are just setting the bitrate to
 // MINIMUM_BITRATE to handle severe congestion.
-bool whist_congestion_controller_handle_severe_congestion(NetworkSettings *network_settings) {
-#define MIN_UPDATE_INTERVAL_SEVERE_CONGESTION_SEC 0.025  // 25ms
-    if (get_timer(&last_update_timer) < MIN_UPDATE_INTERVAL_SEVERE_CONGESTION_SEC) {
+bool wcc_handle_severe_congestion(void *state, NetworkSettings *network_settings) {
+    WCCState *wcc = (WCCState *)state;
+    if (get_timer(&wcc->last_update_timer) < MIN_UPDATE_INTERVAL_SEVERE_CONGESTION_SEC) {
         return false;
     }
     network_settings->burst_bitrate = network_settings->video_bitrate = MINIMUM_BITRATE;
@@ -451,6 +716,317 @@ bool whist_congestion_controller_handle_severe_congestion(NetworkSettings *netwo
     network_settings->saturate_bandwidth = true;
     LOG_INFO_RATE_LIMITED(5, 1, "Severe congestion detected. New bitrate = %d",
                           network_settings->video_bitrate);
-    start_timer(&last_update_timer);
+    start_timer(&wcc->last_update_timer);
     return true;
 }
+
+bool wcc_is_insufficient_bandwidth(void *state) {
+    return ((WCCState *)state)->insufficient_bandwidth;
+}
+
+void *delay_gradient_create(void) {
+    DelayGradientState *dg = safe_zalloc(sizeof(DelayGradientState));
+    dg->mode = DG_STARTUP;
+    dg->threshold_ms = DG_INITIAL_THRESHOLD_MS;
+    return dg;
+}
+
+void delay_gradient_destroy(void *state) { free(state); }
+
+DelayGradientSignal delay_gradient_detect_overuse(DelayGradientState *dg,
+                                                  GroupStats *curr_group_stats,
+                                                  GroupStats *prev_group_stats) {
+    // Accumulate the delay variations into the delay relative to the first group, as in WCC.md
+    double inter_departure_ms =
+        (double)(curr_group_stats->departure_time - prev_group_stats->departure_time) / US_IN_MS;
+    double inter_arrival_ms =
+        (double)(curr_group_stats->arrival_time - prev_group_stats->arrival_time) / US_IN_MS;
+    if (dg->num_groups == 0) {
+        dg->first_arrival_time = curr_group_stats->arrival_time;
+    }
+    dg->accumulated_delay_ms += inter_arrival_ms - inter_departure_ms;
+    dg->smoothed_delay_ms = DG_TRENDLINE_SMOOTHING * dg->smoothed_delay_ms +
+                            (1.0 - DG_TRENDLINE_SMOOTHING) * dg->accumulated_delay_ms;
+    double arrival_ms =
+        (double)(curr_group_stats->arrival_time - dg->first_arrival_time) / US_IN_MS;
+    dg->trendline_arrival_ms[dg->num_groups % DG_TRENDLINE_WINDOW] = arrival_ms;
+    dg->trendline_delay_ms[dg->num_groups % DG_TRENDLINE_WINDOW] = dg->smoothed_delay_ms;
+    dg->num_groups++;
+
+    // The trend is the slope of the least squares line through the window
+    int num_samples = min(dg->num_groups, DG_TRENDLINE_WINDOW);
+    double trend = dg->prev_trend;
+    if (num_samples == DG_TRENDLINE_WINDOW) {
+        double mean_arrival = 0.0;
+        double mean_delay = 0.0;
+        for (int i = 0; i < num_samples; i++) {
+            mean_arrival += dg->trendline_arrival_ms[i];
+            mean_delay += dg->trendline_delay_ms[i];
+        }
+        mean_arrival /= num_samples;
+        mean_delay /= num_samples;
+        double numerator = 0.0;
+        double denominator = 0.0;
+        for (int i = 0; i < num_samples; i++) {
+            double arrival_offset = dg->trendline_arrival_ms[i] - mean_arrival;
+            numerator += arrival_offset * (dg->trendline_delay_ms[i] - mean_delay);
+            denominator += arrival_offset * arrival_offset;
+        }
+        if (denominator != 0.0) {
+            trend = numerator / denominator;
+        }
+    }
+
+    double modified_trend =
+        min(dg->num_groups, DG_TRENDLINE_MAX_GROUPS) * trend * DG_TRENDLINE_GAIN;
+    DelayGradientSignal signal;
+    if (modified_trend > dg->threshold_ms) {
+        if (!dg->maybe_overuse) {
+            start_timer(&dg->overuse_timer);
+            dg->maybe_overuse = true;
+        }
+        // Only signal overuse once it's lasted a while, and as long as the trend isn't easing off
+        if (get_timer(&dg->overuse_timer) > DG_OVERUSE_TIME_THRESHOLD_SEC &&
+            trend >= dg->prev_trend) {
+            signal = DG_OVERUSE_SIGNAL;
+        } else {
+            signal = DG_NORMAL_SIGNAL;
+        }
+    } else if (modified_trend < -dg->threshold_ms) {
+        signal = DG_UNDERUSE_SIGNAL;
+        dg->maybe_overuse = false;
+    } else {
+        signal = DG_NORMAL_SIGNAL;
+        dg->maybe_overuse = false;
+    }
+    dg->prev_trend = trend;
+
+    // Move the threshold towards the scaled trend, unless the trend is an outlier
+    double elapsed_ms = min(arrival_ms - dg->last_threshold_update_ms, DG_MAX_THRESHOLD_UPDATE_MS);
+    dg->last_threshold_update_ms = arrival_ms;
+    double distance = fabs(modified_trend) - dg->threshold_ms;
+    if (distance < 15.0 && elapsed_ms > 0.0) {
+        double gain = distance < 0.0 ? DG_THRESHOLD_GAIN_DOWN : DG_THRESHOLD_GAIN_UP;
+        dg->threshold_ms += gain * distance * elapsed_ms;
+        dg->threshold_ms = max(min(dg->threshold_ms, DG_MAX_THRESHOLD_MS), DG_MIN_THRESHOLD_MS);
+    }
+
+    return signal;
+}
+
+int delay_gradient_get_bottleneck_bandwidth(DelayGradientState *dg) {
+    int bottleneck_bandwidth = dg->phase_max_bandwidth;
+    for (int i = 0; i < DG_BANDWIDTH_WINDOW_PHASES; i++) {
+        bottleneck_bandwidth = max(bottleneck_bandwidth, dg->bandwidth_window[i]);
+    }
+    return bottleneck_bandwidth;
+}
+
+void delay_gradient_reset_bandwidth(DelayGradientState *dg, int bandwidth) {
+    memset(dg->bandwidth_window, 0, sizeof(dg->bandwidth_window));
+    dg->bandwidth_window[0] = bandwidth;
+    dg->bandwidth_window_index = 1;
+    dg->phase_max_bandwidth = 0;
+}
+
+void delay_gradient_update_min_latency(DelayGradientState *dg, double latency) {
+    const double bucket_duration = DG_MIN_LATENCY_WINDOW_SEC / DG_MIN_LATENCY_WINDOW_BUCKETS;
+    // Start a new slice for every slice duration that has passed, forgetting the oldest ones
+    int num_elapsed_buckets = (int)(get_timer(&dg->min_latency_bucket_timer) / bucket_duration);
+    if (num_elapsed_buckets > 0) {
+        for (int i = 0; i < min(num_elapsed_buckets, DG_MIN_LATENCY_WINDOW_BUCKETS); i++) {
+            dg->min_latency_bucket_index =
+                (dg->min_latency_bucket_index + 1) % DG_MIN_LATENCY_WINDOW_BUCKETS;
+            dg->min_latency_buckets[dg->min_latency_bucket_index] = 0.0;
+        }
+        start_timer(&dg->min_latency_bucket_timer);
+    }
+
+    double *bucket = &dg->min_latency_buckets[dg->min_latency_bucket_index];
+    if (latency > 0.0 && (latency < *bucket || *bucket <= 0.0)) {
+        *bucket = latency;
+    }
+
+    dg->min_latency = 0.0;
+    for (int i = 0; i < DG_MIN_LATENCY_WINDOW_BUCKETS; i++) {
+        if (dg->min_latency_buckets[i] > 0.0 &&
+            (dg->min_latency_buckets[i] < dg->min_latency || dg->min_latency <= 0.0)) {
+            dg->min_latency = dg->min_latency_buckets[i];
+        }
+    }
+}
+
+bool delay_gradient_update(void *state, GroupStats *curr_group_stats,
+                           GroupStats *prev_group_stats, int incoming_bitrate,
+                           double packet_loss_ratio, double short_term_latency,
+                           double long_term_latency, NetworkSettings *network_settings,
+                           void *fec_controller) {
+    if (incoming_bitrate <= 0) {
+        // Not enough data to take any decision. Let the bits start flowing.
+        return false;
+    }
+    DelayGradientState *dg = (DelayGradientState *)state;
+    if (!dg->initialized) {
+        start_timer(&dg->phase_timer);
+        start_timer(&dg->last_update_timer);
+        start_timer(&dg->min_latency_bucket_timer);
+        // Allow a decrease right away
+        start_timer(&dg->last_decrease_timer);
+        adjust_timer(&dg->last_decrease_timer, -(int)ceil(DG_MIN_DECREASE_INTERVAL_SEC));
+        dg->initialized = true;
+    }
+
+    DelayGradientSignal signal =
+        delay_gradient_detect_overuse(dg, curr_group_stats, prev_group_stats);
+
+    delay_gradient_update_min_latency(dg, short_term_latency);
+
+    // What got through only measures the bandwidth if the network, rather than the encoder,
+    // limited it. Right after a decrease, it still includes the bitrate that caused congestion.
+    bool app_limited = !network_settings->saturate_bandwidth &&
+                       incoming_bitrate < network_settings->video_bitrate * DG_APP_LIMITED_RATIO;
+    if (!app_limited && get_timer(&dg->last_decrease_timer) > DG_MIN_DECREASE_INTERVAL_SEC) {
+        dg->phase_max_bandwidth = max(dg->phase_max_bandwidth, incoming_bitrate);
+    }
+
+    bool congested = signal == DG_OVERUSE_SIGNAL || packet_loss_ratio > DG_LOSS_THRESHOLD ||
+                     short_term_latency - dg->min_latency > DG_MAX_QUEUING_DELAY_SEC;
+
+    int max_bitrate = MAXIMUM_BITRATE;
+    int old_bitrate = network_settings->video_bitrate;
+    int new_bitrate = old_bitrate;
+    bool old_saturate_bandwidth = network_settings->saturate_bandwidth;
+    bool update_bitrate = false;
+    if (congested && get_timer(&dg->last_decrease_timer) > DG_MIN_DECREASE_INTERVAL_SEC) {
+        LOG_INFO(
+            "Decrease bitrate trend = %.4f, packet_loss_ratio = %.2f, short_term_latency = %.3f, "
+            "min_latency = %.3f",
+            dg->prev_trend, packet_loss_ratio, short_term_latency * MS_IN_SECOND,
+            dg->min_latency * MS_IN_SECOND);
+        new_bitrate = (int)(min(incoming_bitrate, old_bitrate) * DG_DECREASE_RATIO);
+        // The bandwidth that was measured before doesn't hold anymore
+        delay_gradient_reset_bandwidth(dg, new_bitrate);
+        dg->mode = DG_PROBE_BANDWIDTH;
+        dg->probe_phase = DG_FIRST_CRUISE_PHASE;
+        start_timer(&dg->phase_timer);
+        start_timer(&dg->last_decrease_timer);
+        network_settings->saturate_bandwidth = false;
+        network_settings->congestion_detected = true;
+        update_bitrate = true;
+    } else if (get_timer(&dg->phase_timer) > DG_PHASE_DURATION_SEC) {
+        // Start the next phase
+        dg->bandwidth_window[dg->bandwidth_window_index] = dg->phase_max_bandwidth;
+        dg->bandwidth_window_index = (dg->bandwidth_window_index + 1) % DG_BANDWIDTH_WINDOW_PHASES;
+        dg->phase_max_bandwidth = 0;
+        start_timer(&dg->phase_timer);
+        int bottleneck_bandwidth = delay_gradient_get_bottleneck_bandwidth(dg);
+
+        double gain;
+        if (dg->mode == DG_STARTUP) {
+            if (bottleneck_bandwidth >= dg->full_bandwidth * DG_STARTUP_GAIN) {
+                dg->full_bandwidth = bottleneck_bandwidth;
+                dg->full_bandwidth_phases = 0;
+            } else {
+                dg->full_bandwidth_phases++;
+            }
+            if (dg->full_bandwidth_phases >= DG_STARTUP_FULL_BANDWIDTH_PHASES ||
+                old_bitrate >= max_bitrate) {
+                LOG_INFO("Startup found the bottleneck bandwidth : %d bps", bottleneck_bandwidth);
+                dg->mode = DG_PROBE_BANDWIDTH;
+                // Drain the queue that startup may have built up
+                dg->probe_phase = 1;
+            }
+        } else {
+            dg->probe_phase = (dg->probe_phase + 1) % DG_NUM_PROBE_GAINS;
+        }
+        if (dg->mode == DG_STARTUP) {
+            // Keep growing, even if the measurements lag behind the bitrate
+            gain = DG_STARTUP_GAIN;
+            bottleneck_bandwidth = max(bottleneck_bandwidth, old_bitrate);
+        } else {
+            gain = dg_probe_gains[dg->probe_phase];
+            if (gain < 1.0 && old_bitrate >= max_bitrate) {
+                // Probing was capped at the maximum bitrate, so there's no queue to drain
+                gain = 1.0;
+            }
+        }
+        if (bottleneck_bandwidth <= 0) {
+            bottleneck_bandwidth = old_bitrate;
+        }
+        new_bitrate = (int)(bottleneck_bandwidth * gain);
+        // Saturate the bandwidth while probing, so that what gets through measures the bandwidth
+        network_settings->saturate_bandwidth = gain > 1.0;
+        network_settings->congestion_detected = false;
+        update_bitrate = true;
+    }
+
+    WccOp op = WCC_NO_OP;
+    if (update_bitrate) {
+        int min_bitrate = MINIMUM_BITRATE;
+        if (new_bitrate < min_bitrate) {
+            LOG_WARNING("Requested bitrate %d bps is lesser than minimum acceptable bitrate %d bps",
+                        new_bitrate, min_bitrate);
+            new_bitrate = min_bitrate;
+            // If we have reached the min_bitrate for two consecutive times, then signal
+            // insufficient bandwidth
+            if (old_bitrate == min_bitrate) {
+                dg->insufficient_bandwidth = true;
+            }
+        } else {
+            dg->insufficient_bandwidth = false;
+        }
+        int burst_bitrate = new_bitrate;
+        if (new_bitrate >= max_bitrate) {
+            new_bitrate = max_bitrate;
+            // More bandwidth than max_bitrate could be available. Send in bursts for reduced
+            // latency, and there's no point in saturating the bandwidth anymore.
+            burst_bitrate = max_bitrate * BURST_BITRATE_RATIO;
+            network_settings->saturate_bandwidth = false;
+        }
+        if (new_bitrate != old_bitrate) {
+            op = new_bitrate > old_bitrate ? WCC_INCREASE_BWD : WCC_DECREASE_BWD;
+            start_timer(&dg->last_update_timer);
+            LOG_INFO("New bitrate = %d, burst_bitrate = %d, saturate bandwidth = %d, mode = %d",
+                     new_bitrate, burst_bitrate, network_settings->saturate_bandwidth,
+                     (int)dg->mode);
+        }
+        network_settings->video_bitrate = new_bitrate;
+        network_settings->burst_bitrate = burst_bitrate;
+    }
+    bool send_network_settings = op != WCC_NO_OP ||
+                                 network_settings->saturate_bandwidth != old_saturate_bandwidth;
+
+    if (ENABLE_FEC &&
+        update_fec_ratio(fec_controller, op, packet_loss_ratio, old_bitrate, network_settings)) {
+        send_network_settings = true;
+    }
+    whist_analyzer_record_current_cc_info(PACKET_VIDEO, packet_loss_ratio, short_term_latency,
+                                          network_settings->video_bitrate, incoming_bitrate);
+
+    return send_network_settings;
+}
+
+// Severe congestion starts the search for the bandwidth over, from the minimum bitrate
+bool delay_gradient_handle_severe_congestion(void *state, NetworkSettings *network_settings) {
+    DelayGradientState *dg = (DelayGradientState *)state;
+    if (dg->initialized &&
+        get_timer(&dg->last_update_timer) < MIN_UPDATE_INTERVAL_SEVERE_CONGESTION_SEC) {
+        return false;
+    }
+    network_settings->burst_bitrate = network_settings->video_bitrate = MINIMUM_BITRATE;
+    network_settings->congestion_detected = true;
+    network_settings->saturate_bandwidth = true;
+    delay_gradient_reset_bandwidth(dg, 0);
+    dg->mode = DG_STARTUP;
+    dg->full_bandwidth = 0;
+    dg->full_bandwidth_phases = 0;
+    start_timer(&dg->phase_timer);
+    LOG_INFO_RATE_LIMITED(5, 1, "Severe congestion detected. New bitrate = %d",
+                          network_settings->video_bitrate);
+    start_timer(&dg->last_update_timer);
+    return true;
+}
+
+bool delay_gradient_is_insufficient_bandwidth(void *state) {
+    return ((DelayGradientState *)state)->insufficient_bandwidth;
+}
@@ -9,8 +9,10 @@
 ============================
 Usage
 ============================
-The client should periodically call calculate_new_bitrate with any new network statistics, such as
-throughput or number of nacks. This will return a new network settings as needed
+Each connection creates its own congestion controller with create_congestion_controller, from the
+function table of the algorithm that it wants to use, such as wcc_get_function_table. The client
+then calls congestion_controller_update for every new group of packets, which updates the network
+settings as needed, and destroys the controller with destroy_congestion_controller when it's done.
 */
 
 /*
@@ -53,6 +55,15 @@ Private Defines. Made public only for unit testing
 #define OVERUSE_TIME_THRESHOLD_IN_SEC 0.01  // 10ms
 #define CONVERGENCE_THRESHOLD_LOW 0.75
 
+// The delay-gradient controller's internal constants
+// How long each phase of the controller lasts. The bitrate only changes at the start of a phase,
+// unless congestion is detected.
+#define DG_PHASE_DURATION_SEC 0.5
+// The bitrate is multiplied by this every phase, until the bottleneck bandwidth is found
+#define DG_STARTUP_GAIN 1.25
+// On congestion, the bitrate is set to this ratio of the bitrate that is getting through
+#define DG_DECREASE_RATIO 0.85
+
 /*
 ============================
 Structures
@@ -66,6 +77,30 @@ typedef struct {
     int throughput_per_second;
 } NetworkStatistics;
 
+/**
+ * @brief   The functions of a congestion control algorithm, all of which take the per-connection
+ *          state that the algorithm's create function returned.
+ *          See congestion_controller_update, congestion_controller_handle_severe_congestion and
+ *          congestion_controller_is_insufficient_bandwidth for what the rest of them do.
+ */
+typedef struct CongestionControllerFunctionTable {
+    // The name of the algorithm, for logging
+    const char *name;
+    void *(*create)(void);
+    void (*destroy)(void *state);
+    bool (*update)(void *state, GroupStats *curr_group_stats, GroupStats *prev_group_stats,
+                   int incoming_bitrate, double packet_loss_ratio, double short_term_latency,
+                   double long_term_latency, NetworkSettings *network_settings,
+                   void *fec_controller);
+    bool (*handle_severe_congestion)(void *state, NetworkSettings *network_settings);
+    bool (*is_insufficient_bandwidth)(void *state);
+} CongestionControllerFunctionTable;
+
+/**
+ * @brief   A congestion controller of a connection, which runs the algorithm of its function table
+ */
+typedef struct CongestionController CongestionController;
+
 /*
 ============================
 Public Functions
@@ -73,8 +108,46 @@ Public Functions
 */
 
 /**
- * @brief               This function will estimate the new bitrate based on whist congestion
- *                      control algo
+ * @brief               Get the function table of Whist Congestion Control, as documented in WCC.md
+ *
+ * @returns             The function table of WCC
+ */
+const CongestionControllerFunctionTable *wcc_get_function_table(void);
+
+/**
+ * @brief               Get the function table of the delay-gradient congestion controller.
+ *                      It detects congestion from the trend of the inter-group delay variation,
+ *                      like Google Congestion Control, and otherwise keeps the bitrate at the
+ *                      bottleneck bandwidth that it measures, which it probes for periodically,
+ *                      like BBR.
+ *
+ * @returns             The function table of the delay-gradient congestion controller
+ */
+const CongestionControllerFunctionTable *delay_gradient_get_function_table(void);
+
+/**
+ * @brief               Create a congestion controller for a connection
+ *
+ * @param call          The function table of the congestion control algorithm to use
+ *
+ * @returns             The new congestion controller
+ */
+CongestionController *create_congestion_controller(const CongestionControllerFunctionTable *call);
+
+/**
+ * @brief               Get the name of the algorithm that a congestion controller runs
+ *
+ * @param controller    The congestion controller
+ *
+ * @returns             The name of its algorithm
+ */
+const char *congestion_controller_get_name(CongestionController *controller);
+
+/**
+ * @brief               This function will estimate the new bitrate based on the congestion
+ *                      control algorithm of the controller
+ *
+ * @param controller    The congestion controller of the connection
  *
  * @param curr_group_stats Pointer to struct containing any current group of packets' departure time
  *                         and arrival time
@@ -98,18 +171,39 @@ Public Functions
  *
  * @returns             Whether network_settings struct was updated with new values or not
  */
-bool whist_congestion_controller(GroupStats *curr_group_stats, GroupStats *prev_group_stats,
-                                 int incoming_bitrate, double packet_loss_ratio,
-                                 double short_term_latency, double long_term_latency,
-                                 NetworkSettings *network_settings, void *fec_controller);
+bool congestion_controller_update(CongestionController *controller, GroupStats *curr_group_stats,
+                                  GroupStats *prev_group_stats, int incoming_bitrate,
+                                  double packet_loss_ratio, double short_term_latency,
+                                  double long_term_latency, NetworkSettings *network_settings,
+                                  void *fec_controller);
 
 /**
+ * @param controller    The congestion controller of the connection
+ *
  * @param network_settings Pointer to the struct containing previous network_settings. Also the new
  *                         network settings will be updated in this struct.
  *
  * @returns             Whether network_settings struct was updated with new values or not
  */
-bool whist_congestion_controller_handle_severe_congestion(NetworkSettings *network_settings);
+bool congestion_controller_handle_severe_congestion(CongestionController *controller,
+                                                    NetworkSettings *network_settings);
+
+/**
+ * @brief               Check whether a connection's bandwidth is too low to stream at even the
+ *                      minimum bitrate, as its congestion controller found it to be
+ *
+ * @param controller    The congestion controller of the connection
+ *
+ * @returns             Whether the bitrate had to stay at the minimum bitrate
+ */
+bool congestion_controller_is_insufficient_bandwidth(CongestionController *controller);
+
+/**
+ * @brief               Destroy a congestion controller
+ *
+ * @param controller    The congestion controller to destroy
+ */
+void destroy_congestion_controller(CongestionController *controller);
 
 /**
  * @brief               This function will return the default network settings for a given video
@@ -146,6 +240,4 @@ void network_algo_set_dpi(int dpi);
 
 void network_algo_set_dimensions(int width, int height);
 
-bool network_algo_is_insufficient_bandwidth(void);
-
 #endif
@@ -12,6 +12,9 @@ Includes
 #include <whist/debug/debug_console.h>
 #include "whist/logging/logging.h"
 #include "whist/utils/string_buffer.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 /*
 ============================
@@ -35,6 +38,93 @@ Defines
 // The max number of times we can NACK for a packet
 #define MAX_PACKET_NACKS 2
 
+// The number of slots in a frame's nack retry wheel. Every round of nacks for the frame takes up
+// a slot, until the nacks may have been lost and the indices can be nacked again.
+#define NACK_RETRY_WHEEL_SLOTS 16
+
+// How precisely the recovery timers fire
+#define RECOVERY_WHEEL_TICK_SEC 0.001
+
+// The intervals that the burst and average nacking bandwidth are limited over
+#define NACK_BURST_INTERVAL_SEC 0.005
+#define NACK_AVG_INTERVAL_SEC 0.100
+
+// Acceptable staleness = Time to transmit that frame + (RTT + Network Jitter) *
+//                        MAX_PACKET_NACKS.
+// If any Frame is "Acceptable staleness" or older,
+// Request yet another I-Frame on top of "X".
+// This recovers from the situation where we fail to receive "X".
+// The below constants are limits for acceptable staleness.
+#define MIN_ACCEPTABLE_STALENESS_MS 100.0
+#define MAX_ACCEPTABLE_STALENESS_MS 300.0
+
+// Only frames this close to max_id can be considered failed
+#define MAX_STALE_FRAME_DISTANCE 60
+
+/*
+============================
+Custom Types
+============================
+*/
+
+/**
+ * @brief The per-index nacking state of a frame.
+ * @details Rather than keeping a timer for every index, the indices that are nacked in the same
+ * round share a slot of a small retry wheel, which remembers when that round was sent. An index
+ * can't be nacked again while it's in an active slot, and a slot is released once its round of
+ * nacks may have been lost. This is only needed for frames that are missing packets, so it's
+ * allocated on demand, sized to the frame's number of indices.
+ */
+struct FrameNackState {
+    // The ID of the frame that this belongs to, or -1 if it doesn't belong to any frame
+    int id;
+    // The number of indices that this was allocated for
+    int max_num_indices;
+    // The number of words in the index bitsets of the current frame
+    int num_words;
+    // The total number of nacks sent for the indices of the current frame
+    int num_nacks_sent;
+    // Bitmask of the wheel slots that hold rounds of nacks in flight
+    uint32_t active_slots;
+    // The slot that holds the most recent round of nacks
+    int newest_slot;
+    WhistTimer slot_nack_times[NACK_RETRY_WHEEL_SLOTS];
+    // NACK_RETRY_WHEEL_SLOTS bitsets of max_num_indices indices, of the indices in each slot
+    uint64_t* slot_indices;
+    // How many times each index has been nacked
+    uint8_t* num_times_index_nacked;
+};
+
+typedef enum RecoveryTimerType {
+    // Nack the missing frame, or the missing indices of the frame
+    RECOVERY_TIMER_NACK,
+    // Check whether the frame is so stale that it has failed
+    RECOVERY_TIMER_STALENESS,
+    // Request a stream reset for the greatest failed ID, if it still needs one
+    RECOVERY_TIMER_STREAM_RESET,
+} RecoveryTimerType;
+
+/**
+ * @brief A timer on the ringbuffer's recovery wheel.
+ * @details Frames are only looked at for recovery when they may need it: a nack timer is
+ * scheduled when a gap in a frame, or a missing frame, is detected, and again for when the nacks
+ * that are sent may have been lost. A staleness timer is scheduled for when a frame may have
+ * become too stale to ever be received.
+ */
+struct RecoveryTimer {
+    // The wheel's timer, which is first so that the wheel's timers can be cast to RecoveryTimer
+    TimingWheelTimer wheel_timer;
+    RecoveryTimerType type;
+    // The ID of the frame that the timer is for
+    int id;
+};
+
+// What the recovery timers are handled with when they fire
+typedef struct RecoveryTimerContext {
+    RingBuffer* ring_buffer;
+    WhistTimer* current_time;
+} RecoveryTimerContext;
+
 /*
 ============================
 Private Function Declarations
@@ -80,6 +170,19 @@ static void reset_ring_buffer(RingBuffer* ring_buffer);
  */
 static void nack_single_packet(RingBuffer* ring_buffer, int id, int index);
 
+/**
+ * @brief                         Nack a set of packets of a frame together, in a single batch
+ *                                if the ring buffer has a nack_bit_array function
+ *
+ * @param ring_buffer             Ring buffer to nack with
+ * @param id                      The ID of the frame we're nacking for
+ * @param indices                 Bitset of the indices to nack
+ * @param num_indices             The number of indices that the bitset covers
+ * @param count                   The number of bits that are set in indices
+ */
+static void nack_packets(RingBuffer* ring_buffer, int id, const uint64_t* indices, int num_indices,
+                         int count);
+
 /**
  * @brief                         Nack all of the missing packets up to end_index
  *
@@ -95,28 +198,179 @@ static int nack_missing_packets_up_to_index(RingBuffer* ring_buffer, FrameData*
                                             WhistTimer* current_time);
 
 /**
- * @brief If any packets are still missing, and it's been too long, try nacking for them.
- *        Ideally, this gets called quite rapidly, it has internal timers to throttle nacks.
- *        The more rapidly the better, just need to balance CPU usage, 5-10ms should be fine.
+ * @brief                         Get the number of nacks that may be sent now, within the nacking
+ *                                bandwidth limits of ring_buffer->network_settings
+ *
+ * @param ring_buffer             The ring buffer to nack with
+ * @param current_time            The current time
+ *
+ * @returns                       The number of nacks that may be sent, which is <= 0 if nacking
+ *                                is throttled or saturated
+ */
+static int update_nack_budget(RingBuffer* ring_buffer, WhistTimer* current_time);
+
+/**
+ * @brief                         Schedule the nack timer of a frame, which may be missing
+ *
+ * @param ring_buffer             The ring buffer containing the frame
+ * @param id                      The ID of the frame
+ * @param deadline                When the timer should fire, in recovery wheel time
+ */
+static void schedule_frame_recovery(RingBuffer* ring_buffer, int id, double deadline);
+
+/**
+ * @brief                         Handle a recovery timer that fired, as a TimingWheelCallback
+ *
+ * @param opaque                  The RecoveryTimerContext to handle it with
+ * @param wheel_timer             The timer that fired
+ */
+static void handle_recovery_timer(void* opaque, TimingWheelTimer* wheel_timer);
+
+/**
+ * @brief                         Nack for the frame of a nack timer, if it's missing or missing
+ *                                packets, and schedule the timer for when it should be looked at
+ *                                again
  *
- * @param ring_buffer The ring buffer to try nacking with
+ * @param ring_buffer             The ring buffer containing the frame
+ * @param timer                   The nack timer that fired
+ * @param current_time            The current time
+ */
+static void handle_nack_timer(RingBuffer* ring_buffer, RecoveryTimer* timer,
+                              WhistTimer* current_time);
+
+/**
+ * @brief                         Mark the frame of a staleness timer as failed if it's too stale,
+ *                                or schedule the timer for when it would be
  *
- * @param latency The round-trip latency of the connection. Helpful with nacking logic
+ * @param ring_buffer             The ring buffer containing the frame
+ * @param timer                   The staleness timer that fired
+ * @param current_time            The current time
+ */
+static void handle_staleness_timer(RingBuffer* ring_buffer, RecoveryTimer* timer,
+                                   WhistTimer* current_time);
+
+/**
+ * @brief                         Request a stream reset for the greatest failed ID, throttled to
+ *                                every half round trip, for as long as that frame is pending
  *
- * @param max_unordered_packets Maximum number of packets that can arrive out-of-order
+ * @param ring_buffer             The ring buffer to request the stream reset for
+ * @param current_time            The current time
+ */
+static void request_stream_reset_if_failed(RingBuffer* ring_buffer, WhistTimer* current_time);
+
+/**
+ * @brief                         Get the frame that we're currently trying our best to receive,
+ *                                either the next-to-render frame, or the very first frame if we
+ *                                haven't rendered yet
  *
- * @param network_settings Pointer to NetworkSettings structure for accessing the bitrate and
- *                         burst_bitrate
+ * @param ring_buffer             The ring buffer to use
  *
- * @returns     True if nacking succeded,
- *              False if we've bandwidth saturated our ability to nack.
+ * @returns                       The ID of that frame
  */
-static bool try_nacking(RingBuffer* ring_buffer, double latency, int max_unordered_packets,
-                        NetworkSettings* network_settings, WhistTimer* current_time);
+static int get_currently_pending_id(RingBuffer* ring_buffer);
+
+/**
+ * @brief                         Get the nacking state of a frame, allocating it,
+ *                                or claiming the slot's stale nacking state, if necessary
+ *
+ * @param frame_data              The frame to get the nacking state of
+ *
+ * @returns                       The frame's nacking state
+ */
+static FrameNackState* get_frame_nack_state(FrameData* frame_data);
+
+/**
+ * @brief                         Get the number of times an index of a frame has been nacked
+ *
+ * @param frame_data              The frame containing the index
+ * @param index                   The index to check
+ *
+ * @returns                       The number of times that index has been nacked
+ */
+static int get_num_times_index_nacked(FrameData* frame_data, int index);
+
+/**
+ * @brief                         Collect the indices whose nacks are still in flight
+ *
+ * @param nack_state              The nacking state of the frame
+ * @param in_flight               Bitset of nack_state->num_words words to write
+ *                                the in-flight indices into
+ * @param retry_interval          How long nacks are in flight for, in seconds
+ * @param current_time            The current time
+ * @param expire                  Whether to release the slots whose nacks are no longer in flight
+ */
+static void get_in_flight_nacks(FrameNackState* nack_state, uint64_t* in_flight,
+                                double retry_interval, WhistTimer* current_time, bool expire);
+
+/**
+ * @brief                         Start a new round of nacks, in a slot of the retry wheel.
+ *                                If all of the slots are in flight, the newest round is extended,
+ *                                which only delays retrying its indices.
+ *
+ * @param nack_state              The nacking state of the frame
+ * @param current_time            The time that the round is being sent at
+ *
+ * @returns                       The bitset to mark the indices nacked in this round in
+ */
+static uint64_t* start_nack_round(FrameNackState* nack_state, WhistTimer* current_time);
 
 // TODO: document this
 char* get_framebuffer(RingBuffer* ring_buffer, FrameData* current_frame);
 
+/**
+ * @brief                          Extend the frame's received prefix over the original packets
+ *                                 right after it that have been received.
+ *
+ * @param frame_data               The frame to update
+ *
+ * @note                           This function is in the hotpath. Each packet is only
+ *                                 looked at once over the lifetime of the frame.
+ */
+static void update_received_prefix(FrameData* frame_data);
+
+/**
+ * @brief                          Get the size of the data that each original packet of a frame
+ *                                 holds, except for the last one, which may hold less. With FEC,
+ *                                 that data is behind a 16-bit size header.
+ *
+ * @param frame_data               The frame, whose first packet must have been received
+ *
+ * @returns                        The size of the data in each packet, in bytes
+ */
+static int get_packet_data_size(FrameData* frame_data);
+
+static inline bool is_index_received(FrameData* frame_data, int index) {
+    return (frame_data->received_indices[index / 64] >> (index % 64)) & 1;
+}
+
+static inline int bitset_lowest_bit(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+static inline int bitset_highest_bit(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(word);
+#endif
+}
+
+static inline int bitset_count_bits(uint64_t word) {
+#if defined(_MSC_VER)
+    return (int)__popcnt64(word);
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
 static double latency_plus_jitter(double latency) {
     // In addition to network latency and jitter, throttler could also add a latency of
     // UDP_NETWORK_THROTTLER_BUCKET_MS
@@ -132,7 +386,7 @@ Public Function Implementations
 
 RingBuffer* init_ring_buffer(WhistPacketType type, int max_frame_size, int ring_buffer_size,
                              SocketContext* socket_context, NackPacketFn nack_packet,
-                             StreamResetFn request_stream_reset) {
+                             NackBitArrayFn nack_bit_array, StreamResetFn request_stream_reset) {
     /*
         Initialize the ring buffer; malloc space for all the frames and set their IDs to -1.
 
@@ -153,6 +407,7 @@ RingBuffer* init_ring_buffer(WhistPacketType type, int max_frame_size, int ring_
     ring_buffer->receiving_frames = safe_malloc(ring_buffer_size * sizeof(FrameData));
     ring_buffer->socket_context = socket_context;
     ring_buffer->nack_packet = nack_packet;
+    ring_buffer->nack_bit_array = nack_bit_array;
     ring_buffer->request_stream_reset = request_stream_reset;
 
     // Mark all the frames as uninitialized
@@ -160,15 +415,32 @@ RingBuffer* init_ring_buffer(WhistPacketType type, int max_frame_size, int ring_
         FrameData* frame_data = &ring_buffer->receiving_frames[i];
         frame_data->id = frame_data->entire_frame_nacked_id = -1;
         frame_data->packet_buffer = NULL;
+        frame_data->nack_state = NULL;
     }
 
     // determine largest frame size, including the WhistPacket header
     ring_buffer->largest_frame_size = sizeof(WhistPacket) - MAX_PAYLOAD_SIZE + max_frame_size;
+    // Until the stream negotiates otherwise
+    ring_buffer->fec_scheme = FEC_SCHEME_REED_SOLOMON;
 
-    ring_buffer->packet_buffer_allocator = create_block_allocator(ring_buffer->largest_frame_size);
     ring_buffer->currently_rendering_id = -1;
     ring_buffer->last_rendered_id = -1;
 
+    // Create the recovery timers, none of which are scheduled yet
+    ring_buffer->recovery_wheel = timing_wheel_create(RECOVERY_WHEEL_TICK_SEC);
+    ring_buffer->nack_timers = safe_zalloc(ring_buffer_size * sizeof(RecoveryTimer));
+    ring_buffer->staleness_timers = safe_zalloc(ring_buffer_size * sizeof(RecoveryTimer));
+    ring_buffer->stream_reset_timer = safe_zalloc(sizeof(RecoveryTimer));
+    for (int i = 0; i < ring_buffer_size; i++) {
+        ring_buffer->nack_timers[i].type = RECOVERY_TIMER_NACK;
+        ring_buffer->staleness_timers[i].type = RECOVERY_TIMER_STALENESS;
+    }
+    ring_buffer->stream_reset_timer->type = RECOVERY_TIMER_STREAM_RESET;
+    ring_buffer->latency = 0.0;
+    ring_buffer->max_unordered_packets = 0;
+    memset(&ring_buffer->network_settings, 0, sizeof(ring_buffer->network_settings));
+    ring_buffer->nacks_remaining = 0;
+
     // set all additional metadata for frames and ring buffer
     reset_ring_buffer(ring_buffer);
     // reset bitrate stat variables
@@ -270,9 +542,9 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
                                     dropped_frame_data->num_original_packets,
                                     is_recovery_point ? "(Recovery Frame)" : "");
                         for (int j = 0; j < dropped_frame_data->num_original_packets; j++) {
-                            if (!dropped_frame_data->received_indices[j]) {
+                            if (!is_index_received(dropped_frame_data, j)) {
                                 LOG_WARNING("Did not receive ID %d, Index %d. Nacked %d times.", i,
-                                            j, dropped_frame_data->num_times_index_nacked[j]);
+                                            j, get_num_times_index_nacked(dropped_frame_data, j));
                             }
                         }
                     } else {
@@ -305,6 +577,7 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
                    segment->prev_frame_num_duplicates);
 
         // Update the ringbuffer's min/max id, with this new frame's ID
+        int previous_max_id = ring_buffer->max_id;
         ring_buffer->max_id = max(ring_buffer->max_id, frame_data->id);
         if (ring_buffer->min_id == -1) {
             // Initialize min_id
@@ -313,6 +586,19 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
             // Update min_id
             ring_buffer->min_id = min(ring_buffer->min_id, frame_data->id);
         }
+
+        if (previous_max_id != -1 && segment_id > previous_max_id) {
+            // The frames that were skipped over are missing, and the two frames before this one
+            // may now have packets that are late enough to be considered lost
+            WhistTimer now;
+            start_timer(&now);
+            double deadline = timing_wheel_get_time(ring_buffer->recovery_wheel, &now);
+            for (int id = max(min(previous_max_id, segment_id - 2),
+                              segment_id - ring_buffer->ring_buffer_size + 1);
+                 id < segment_id; id++) {
+                schedule_frame_recovery(ring_buffer, id, deadline);
+            }
+        }
     }
 
     // Now, the frame_data should be ready to accept the packet
@@ -328,7 +614,7 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
         ring_buffer->num_nacks_received++;
         // Server simulates a nack for audio all the time. Hence log only for video.
         if (type == PACKET_VIDEO) {
-            if (!frame_data->received_indices[segment_index]) {
+            if (!is_index_received(frame_data, segment_index)) {
                 if (LOG_NACKING) {
                     LOG_INFO("NACK for video ID %d, Index %d received!", segment_id, segment_index);
                 }
@@ -345,7 +631,7 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
         ring_buffer->num_original_packets_received++;
         // Reset timer since the last time we received a non-nack packet
         start_timer(&frame_data->last_nonnack_packet_timer);
-        if (frame_data->num_times_index_nacked[segment_index] > 0) {
+        if (get_num_times_index_nacked(frame_data, segment_index) > 0) {
             ring_buffer->num_unnecessary_original_packets_received++;
             if (LOG_NACKING) {
                 LOG_INFO("Received original %s ID %d, Index %d, but we had NACK'ed for it.",
@@ -355,12 +641,12 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
     }
 
     // If we have already received this packet anyway, just drop this packet
-    if (frame_data->received_indices[segment_index]) {
+    if (is_index_received(frame_data, segment_index)) {
         if (!segment->is_a_nack) {
             frame_data->duplicate_packets_received++;
         }
         // The only way it should possible to receive a packet twice, is if nacking got involved
-        if (type == PACKET_VIDEO && frame_data->num_times_index_nacked[segment_index] == 0 &&
+        if (type == PACKET_VIDEO && get_num_times_index_nacked(frame_data, segment_index) == 0 &&
             !segment->is_a_duplicate && segment->is_a_nack) {
             LOG_ERROR(
                 "We received a video packet (ID %d / index %d) twice, but we had never nacked for "
@@ -377,7 +663,7 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
 
     // Track whether the index we received is one of the N original packets,
     // or one of the M FEC packets
-    frame_data->received_indices[segment_index] = true;
+    frame_data->received_indices[segment_index / 64] |= (uint64_t)1 << (segment_index % 64);
     if (segment_index < frame_data->num_original_packets) {
         frame_data->original_packets_received++;
         FATAL_ASSERT(frame_data->original_packets_received <= frame_data->num_original_packets);
@@ -406,10 +692,15 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
         frame_data->frame_buffer_size += segment_size;
     }
 
+    if (segment_index == frame_data->num_prefix_packets_received) {
+        update_received_prefix(frame_data);
+    }
+
     // If this is an FEC frame, and we haven't yet decoded the frame successfully,
     // Try decoding the FEC frame
     if (frame_data->num_fec_packets > 0 && !frame_data->successful_fec_recovery) {
-        // Register this packet into the FEC decoder
+        // Register this packet into the FEC decoder. The decoder reads it in place,
+        // and may recover a missing original packet into it if it's an FEC packet.
         fec_decoder_register_buffer(frame_data->fec_decoder, segment_index,
                                     frame_data->packet_buffer + buffer_offset, segment_size);
 
@@ -432,6 +723,9 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
                 }
                 whist_analyzer_record_fec_used(type, segment_id);
             }
+            whist_analyzer_record_fec_decode(
+                type, segment_id, decode_time,
+                fec_decoder_get_bytes_processed(frame_data->fec_decoder));
             // Save the frame buffer size of the fec frame,
             // And mark the fec recovery as succeeded
             frame_data->frame_buffer_size = frame_size;
@@ -439,11 +733,25 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
         }
     }
 
-    if (is_ready_to_render(ring_buffer, segment_id) && !was_already_ready) {
+    bool is_ready = is_ready_to_render(ring_buffer, segment_id);
+    if (is_ready && !was_already_ready) {
         ring_buffer->frames_received++;
         ring_buffer->num_pending_ready_frames++;
     }
 
+    // A new highest original index leaves a gap if any of the indices before it are missing,
+    // and moves up the indices that are late enough to be considered lost, so nack when due
+    if (segment_index < frame_data->num_original_packets &&
+        segment_index > frame_data->highest_original_index_received) {
+        frame_data->highest_original_index_received = segment_index;
+        if (!is_ready && frame_data->original_packets_received <= segment_index) {
+            WhistTimer now;
+            start_timer(&now);
+            schedule_frame_recovery(ring_buffer, segment_id,
+                                    timing_wheel_get_time(ring_buffer->recovery_wheel, &now));
+        }
+    }
+
     return !ringbuffer_overflowed;
 }
 
@@ -451,6 +759,36 @@ FrameData* get_frame_at_id(RingBuffer* ring_buffer, int id) {
     return &ring_buffer->receiving_frames[id % ring_buffer->ring_buffer_size];
 }
 
+int ring_buffer_read_frame_prefix(RingBuffer* ring_buffer, int id, char* buffer, int offset) {
+    FrameData* frame_data = get_frame_at_id(ring_buffer, id);
+    if (frame_data->id != id || frame_data->packet_buffer == NULL ||
+        id <= ring_buffer->currently_rendering_id) {
+        return -1;
+    }
+
+    int prefix_size = frame_data->prefix_size_received;
+    if (offset >= prefix_size) {
+        return prefix_size;
+    }
+
+    // Copy the data of each packet from the one that offset is in, leaving out the FEC headers
+    int header_size = frame_data->num_fec_packets > 0 ? (int)sizeof(uint16_t) : 0;
+    int data_size = get_packet_data_size(frame_data);
+    int index = offset / data_size;
+    int position = offset;
+    while (position < prefix_size) {
+        int packet_start = index * data_size;
+        int packet_end = min(packet_start + data_size, prefix_size);
+        memcpy(buffer + position,
+               frame_data->packet_buffer + index * MAX_PACKET_SEGMENT_SIZE + header_size +
+                   (position - packet_start),
+               packet_end - position);
+        position = packet_end;
+        index++;
+    }
+    return prefix_size;
+}
+
 double get_packet_loss_ratio(RingBuffer* ring_buffer, double latency) {
     int num_packets_received = 0;
     int num_packets_sent = 0;
@@ -470,14 +808,15 @@ double get_packet_loss_ratio(RingBuffer* ring_buffer, double latency) {
         num_packets_received += frame->fec_packets_received;
 
         int nacks_sent = 0;
-        for (int i = 0; i < frame->num_original_packets + frame->num_fec_packets; i++) {
-            if (frame->num_times_index_nacked[i]) {
-                nacks_sent += frame->num_times_index_nacked[i];
-                // Don't consider the NACKs in flight
-                if (diff_timer(&frame->last_nacked_timer[i], &end_time) <
-                    latency_plus_jitter(latency)) {
-                    nacks_sent--;
-                }
+        FrameNackState* nack_state = frame->nack_state;
+        if (nack_state != NULL && nack_state->id == frame->id) {
+            nacks_sent = nack_state->num_nacks_sent;
+            // Don't consider the NACKs in flight
+            uint64_t in_flight[FRAME_INDEX_BITSET_WORDS];
+            get_in_flight_nacks(nack_state, in_flight, latency_plus_jitter(latency), &end_time,
+                                false);
+            for (int word = 0; word < nack_state->num_words; word++) {
+                nacks_sent -= bitset_count_bits(in_flight[word]);
             }
         }
         // Whatever we considered as "NACKs in flight" could have arrived earlier. So if the actual
@@ -563,6 +902,9 @@ FrameData* set_rendering(RingBuffer* ring_buffer, int id) {
     FATAL_ASSERT(current_frame->id == id);
     ring_buffer->currently_rendering_id = id;
     ring_buffer->currently_rendering_frame = *current_frame;
+    // The nacking state stays with the ringbuffer slot, which keeps using it
+    // for the packet loss calculation
+    ring_buffer->currently_rendering_frame.nack_state = NULL;
 
     // Invalidate the current_frame, without deallocating its data with reset_frame,
     // Since currently_rendering_frame now owns that data
@@ -616,9 +958,9 @@ void reset_stream(RingBuffer* ring_buffer, int id) {
                                     frame_data->original_packets_received,
                                     frame_data->num_original_packets);
                         for (int j = 0; j < frame_data->num_original_packets; j++) {
-                            if (!frame_data->received_indices[j]) {
+                            if (!is_index_received(frame_data, j)) {
                                 LOG_INFO("Did not receive ID %d, Index %d. Nacked %d times.", i, j,
-                                         frame_data->num_times_index_nacked[j]);
+                                         get_num_times_index_nacked(frame_data, j));
                             }
                         }
                     }
@@ -684,106 +1026,26 @@ void try_recovering_missing_packets_or_frames(RingBuffer* ring_buffer, double la
         return;
     }
 
-    // Try to nack for any missing packets
-    try_nacking(ring_buffer, latency, max_unordered_packets, network_settings, current_time);
-
-    // =============
-    // Stream Reset Logic
-    // =============
+    ring_buffer->latency = latency;
+    ring_buffer->max_unordered_packets = max_unordered_packets;
+    ring_buffer->network_settings = *network_settings;
 
-    // Acceptable staleness = Time to transmit that frame + (RTT + Network Jitter) *
-    //                        MAX_PACKET_NACKS.
-    // If any Frame is "Acceptable staleness" or older,
-    // Request yet another I-Frame on top of "X".
-    // This recovers from the situation where we fail to receive "X".
-    // The below constants are limits for acceptable staleness.
-#define MIN_ACCEPTABLE_STALENESS_MS 100.0
-#define MAX_ACCEPTABLE_STALENESS_MS 300.0
+    // Handle the frames whose recovery timers are due, within the nacking budget
+    int max_nacks = max(update_nack_budget(ring_buffer, current_time), 0);
+    ring_buffer->nacks_remaining = max_nacks;
+    RecoveryTimerContext context = {ring_buffer, current_time};
+    timing_wheel_advance(ring_buffer->recovery_wheel, current_time, handle_recovery_timer,
+                         &context);
+    // A missing frame can be nacked for more than what's left of the budget
+    int num_packets_nacked = max_nacks - ring_buffer->nacks_remaining;
 
-    // The Frame that we're currently trying our best to receive and make progress,
-    // Either the next-to-render frame, or the very first frame if we haven't rendered yet.
-    int currently_pending_id = ring_buffer->last_rendered_id == -1
-                                   ? ring_buffer->min_id
-                                   : ring_buffer->last_rendered_id + 1;
-
-    // Track the greatest ID of any "failed" frames
-    // Failed is a frame that's so far behind that we think we probably won't get it
-    int greatest_failed_id = -1;
-
-    // Only requesting a single I-Frame isn't enough, since that I-Frame could fail to receive.
-    // This marks any stale frames as failed as well.
-    // We only check the last 60 frames, to prevent this for-loop from taking too long
-    for (int id = max(currently_pending_id, ring_buffer->max_id - 60); id <= ring_buffer->max_id;
-         id++) {
-        FrameData* ctx = get_frame_at_id(ring_buffer, id);
-
-        if (ctx->id == id) {
-            double frame_staleness = diff_timer(&ctx->frame_creation_timer, current_time);
-            double time_to_transmit = ((ctx->num_original_packets + ctx->num_fec_packets) *
-                                       MAX_PAYLOAD_SIZE * BITS_IN_BYTE) /
-                                      (double)network_settings->burst_bitrate;
-            // Adding Network Jitter + One round-trip latency to account for nack response time
-            double acceptable_staleness_ms =
-                (time_to_transmit + (latency_plus_jitter(latency) * MAX_PACKET_NACKS)) *
-                MS_IN_SECOND;
-            acceptable_staleness_ms = max(acceptable_staleness_ms, MIN_ACCEPTABLE_STALENESS_MS);
-            // If the frame is completely received, double the threshold(subject to the absolute
-            // max) as there is a chance to catchup.
-            if (is_ready_to_render(ring_buffer, currently_pending_id)) {
-                acceptable_staleness_ms *= 2;
-            }
-            acceptable_staleness_ms = min(acceptable_staleness_ms, MAX_ACCEPTABLE_STALENESS_MS);
-
-            if (frame_staleness * MS_IN_SECOND > acceptable_staleness_ms) {
-                greatest_failed_id = max(greatest_failed_id, id);
-            }
-        }
+    if (LOG_NACKING && num_packets_nacked > 0) {
+        LOG_INFO("Nacked %d/%d packets this Nacking round", num_packets_nacked, max_nacks);
     }
 
-    // If we have any failed IDs, we tell the server,
-    // So that it can try to give us an I-Frame
-    if (greatest_failed_id != -1) {
-        // Throttle the requests to prevent network upload saturation, however
-        if (diff_timer(&ring_buffer->last_stream_reset_request_timer, current_time) >
-            latency / 2.0) {
-            whist_analyzer_record_stream_reset(ring_buffer->type, greatest_failed_id);
-            ring_buffer->request_stream_reset(ring_buffer->socket_context, ring_buffer->type,
-                                              greatest_failed_id);
-
-            // If a newer frame has failed, log it
-            if (greatest_failed_id > ring_buffer->last_stream_reset_request_id) {
-                FrameData* pending_ctx = get_frame_at_id(ring_buffer, currently_pending_id);
-                if (pending_ctx->id != currently_pending_id) {
-                    pending_ctx = NULL;
-                }
-                FrameData* greatest_failed_ctx = get_frame_at_id(ring_buffer, greatest_failed_id);
-                if (greatest_failed_ctx->id != greatest_failed_id) {
-                    greatest_failed_ctx = NULL;
-                }
-                LOG_INFO(
-                    "The most recent ID %d is %d frames ahead of currently pending %d (%d/%d "
-                    "packets received). A stream reset is now being requested to catch-up, ID's <= "
-                    "%d(%d/%d packets received) are considered lost.",
-                    ring_buffer->max_id, ring_buffer->max_id - currently_pending_id,
-                    currently_pending_id, pending_ctx ? pending_ctx->original_packets_received : -1,
-                    pending_ctx ? pending_ctx->num_original_packets : -1, greatest_failed_id,
-                    greatest_failed_ctx ? greatest_failed_ctx->original_packets_received : -1,
-                    greatest_failed_ctx ? greatest_failed_ctx->num_original_packets : -1);
-
-                FrameData* ctx = get_frame_at_id(ring_buffer, currently_pending_id);
-                if (ctx->id == currently_pending_id) {
-                    double next_render_staleness =
-                        diff_timer(&ctx->frame_creation_timer, current_time);
-                    LOG_INFO("We've been trying to receive Frame %d for %fms.",
-                             currently_pending_id, next_render_staleness * MS_IN_SECOND);
-                }
-
-                ring_buffer->last_stream_reset_request_id = greatest_failed_id;
-            }
-
-            start_timer(&ring_buffer->last_stream_reset_request_timer);
-        }
-    }
+    // Update the counters to track max nack bitrate
+    ring_buffer->burst_counter += num_packets_nacked;
+    ring_buffer->avg_counter += num_packets_nacked;
 }
 
 void destroy_ring_buffer(RingBuffer* ring_buffer) {
@@ -794,10 +1056,17 @@ void destroy_ring_buffer(RingBuffer* ring_buffer) {
     if (ring_buffer->currently_rendering_id != -1) {
         reset_frame(ring_buffer, &ring_buffer->currently_rendering_frame);
     }
+    // free the nacking state of every slot
+    for (int i = 0; i < ring_buffer->ring_buffer_size; i++) {
+        free(ring_buffer->receiving_frames[i].nack_state);
+    }
+    // free the recovery timers, which reset_ring_buffer has unscheduled
+    timing_wheel_destroy(ring_buffer->recovery_wheel);
+    free(ring_buffer->nack_timers);
+    free(ring_buffer->staleness_timers);
+    free(ring_buffer->stream_reset_timer);
     // free received_frames
     free(ring_buffer->receiving_frames);
-    // destroy the block allocator
-    destroy_block_allocator(ring_buffer->packet_buffer_allocator);
     // free the ring_buffer
     free(ring_buffer);
 }
@@ -820,30 +1089,55 @@ void init_frame(RingBuffer* ring_buffer, int id, int num_original_indices, int n
         num_entire_frame_nacked = frame_data->num_entire_frame_nacked;
         last_frame_nack_timer = frame_data->last_frame_nack_timer;
     }
-    // Initialize new framedata
+    // Initialize new framedata, keeping the slot's nacking state around for reuse
+    FrameNackState* nack_state = frame_data->nack_state;
+    if (nack_state != NULL) {
+        nack_state->id = -1;
+    }
     memset(frame_data, 0, sizeof(*frame_data));
+    frame_data->nack_state = nack_state;
     frame_data->id = id;
-    frame_data->packet_buffer = allocate_block(ring_buffer->packet_buffer_allocator);
+    frame_data->highest_original_index_received = -1;
+    frame_data->packet_buffer = allocate_pooled_buffer(ring_buffer->largest_frame_size);
     frame_data->num_original_packets = num_original_indices;
     frame_data->num_fec_packets = num_fec_indices;
     frame_data->prev_frame_num_duplicate_packets = prev_frame_num_duplicates;
     // If the entire frame was nacked already, then set the packet nack counters and timers
     // appropriately
     if (num_entire_frame_nacked) {
+        int num_indices = num_original_indices + num_fec_indices;
         frame_data->num_entire_frame_nacked = num_entire_frame_nacked;
-        memset(frame_data->num_times_index_nacked, num_entire_frame_nacked,
-               num_original_indices + num_fec_indices);
-        for (int i = 0; i < num_original_indices + num_fec_indices; i++) {
-            frame_data->last_nacked_timer[i] = last_frame_nack_timer;
+        nack_state = get_frame_nack_state(frame_data);
+        memset(nack_state->num_times_index_nacked, num_entire_frame_nacked, num_indices);
+        nack_state->num_nacks_sent = num_entire_frame_nacked * num_indices;
+        // All of the indices were nacked in the same round, when the frame was nacked
+        uint64_t* round = start_nack_round(nack_state, &last_frame_nack_timer);
+        for (int word = 0; word < nack_state->num_words; word++) {
+            round[word] = ~(uint64_t)0;
+        }
+        if (num_indices % 64 != 0) {
+            round[nack_state->num_words - 1] = ((uint64_t)1 << (num_indices % 64)) - 1;
         }
     }
     start_timer(&frame_data->frame_creation_timer);
 
+    // The frame can't fail before the minimum acceptable staleness,
+    // the actual threshold is figured out when the timer fires
+    RecoveryTimer* staleness_timer =
+        &ring_buffer->staleness_timers[id % ring_buffer->ring_buffer_size];
+    staleness_timer->id = id;
+    timing_wheel_schedule(
+        ring_buffer->recovery_wheel, &staleness_timer->wheel_timer,
+        timing_wheel_get_time(ring_buffer->recovery_wheel, &frame_data->frame_creation_timer) +
+            MIN_ACCEPTABLE_STALENESS_MS / MS_IN_SECOND);
+
     // Initialize FEC-related things, if we need to
     if (num_fec_indices > 0) {
-        frame_data->fec_decoder =
-            create_fec_decoder(num_original_indices, num_fec_indices, MAX_PACKET_SEGMENT_SIZE);
-        frame_data->fec_frame_buffer = allocate_block(ring_buffer->packet_buffer_allocator);
+        FECScheme fec_scheme =
+            fec_get_frame_scheme(ring_buffer->fec_scheme, num_original_indices, num_fec_indices);
+        frame_data->fec_decoder = create_fec_decoder_with_scheme(
+            fec_scheme, num_original_indices, num_fec_indices, MAX_PACKET_SEGMENT_SIZE);
+        frame_data->fec_frame_buffer = allocate_pooled_buffer(ring_buffer->largest_frame_size);
         frame_data->successful_fec_recovery = false;
     }
 }
@@ -862,7 +1156,7 @@ void reset_frame(RingBuffer* ring_buffer, FrameData* frame_data) {
         }
     }
     // Free the frame's data
-    free_block(ring_buffer->packet_buffer_allocator, frame_data->packet_buffer);
+    free_pooled_buffer(frame_data->packet_buffer);
     frame_data->packet_buffer = NULL;
     // Free FEC-related data, if any exists
     if (frame_data->fec_decoder) {
@@ -870,7 +1164,7 @@ void reset_frame(RingBuffer* ring_buffer, FrameData* frame_data) {
         frame_data->fec_decoder = NULL;
     }
     if (frame_data->fec_frame_buffer) {
-        free_block(ring_buffer->packet_buffer_allocator, frame_data->fec_frame_buffer);
+        free_pooled_buffer(frame_data->fec_frame_buffer);
         frame_data->fec_frame_buffer = NULL;
     }
 }
@@ -883,8 +1177,20 @@ void reset_ring_buffer(RingBuffer* ring_buffer) {
         if (frame_data->packet_buffer != NULL) {
             reset_frame(ring_buffer, frame_data);
         }
+        // The nacking state stays allocated, but no longer belongs to any frame
+        FrameNackState* nack_state = frame_data->nack_state;
+        if (nack_state != NULL) {
+            nack_state->id = -1;
+        }
         memset(frame_data, 0, sizeof(*frame_data));
+        frame_data->nack_state = nack_state;
+        // None of the frames need recovering anymore
+        timing_wheel_cancel(ring_buffer->recovery_wheel, &ring_buffer->nack_timers[i].wheel_timer);
+        timing_wheel_cancel(ring_buffer->recovery_wheel,
+                            &ring_buffer->staleness_timers[i].wheel_timer);
     }
+    timing_wheel_cancel(ring_buffer->recovery_wheel, &ring_buffer->stream_reset_timer->wheel_timer);
+    ring_buffer->greatest_failed_id = -1;
     ring_buffer->max_id = -1;
     ring_buffer->min_id = -1;
     ring_buffer->frames_received = 0;
@@ -914,6 +1220,41 @@ char* get_framebuffer(RingBuffer* ring_buffer, FrameData* current_frame) {
     }
 }
 
+void update_received_prefix(FrameData* frame_data) {
+    while (frame_data->num_prefix_packets_received < frame_data->num_original_packets &&
+           is_index_received(frame_data, frame_data->num_prefix_packets_received)) {
+        int index = frame_data->num_prefix_packets_received;
+        if (frame_data->num_fec_packets > 0) {
+            uint16_t size;
+            memcpy(&size, frame_data->packet_buffer + index * MAX_PACKET_SEGMENT_SIZE,
+                   sizeof(size));
+            frame_data->prefix_size_received += size;
+        }
+        frame_data->num_prefix_packets_received++;
+    }
+
+    // Without FEC, every packet but the last is full
+    if (frame_data->num_fec_packets == 0) {
+        if (frame_data->num_prefix_packets_received == frame_data->num_original_packets) {
+            frame_data->prefix_size_received = frame_data->frame_buffer_size;
+        } else {
+            frame_data->prefix_size_received =
+                frame_data->num_prefix_packets_received * MAX_PACKET_SEGMENT_SIZE;
+        }
+    }
+}
+
+int get_packet_data_size(FrameData* frame_data) {
+    if (frame_data->num_fec_packets == 0) {
+        return MAX_PACKET_SEGMENT_SIZE;
+    }
+    // The FEC encoder spreads the frame evenly over the packets, so all but the last are as
+    // large as the first
+    uint16_t size;
+    memcpy(&size, frame_data->packet_buffer, sizeof(size));
+    return size;
+}
+
 void nack_single_packet(RingBuffer* ring_buffer, int id, int index) {
     ring_buffer->num_packets_nacked++;
     // If a nacking function was passed in, use it
@@ -923,6 +1264,26 @@ void nack_single_packet(RingBuffer* ring_buffer, int id, int index) {
     }
 }
 
+void nack_packets(RingBuffer* ring_buffer, int id, const uint64_t* indices, int num_indices,
+                  int count) {
+    if (ring_buffer->nack_bit_array == NULL) {
+        for (int i = 0; i < num_indices; i++) {
+            if ((indices[i / 64] >> (i % 64)) & 1) {
+                nack_single_packet(ring_buffer, id, i);
+            }
+        }
+        return;
+    }
+    ring_buffer->num_packets_nacked += count;
+    for (int i = 0; i < num_indices; i++) {
+        if ((indices[i / 64] >> (i % 64)) & 1) {
+            whist_analyzer_record_nack(ring_buffer->type, id, i);
+        }
+    }
+    ring_buffer->nack_bit_array(ring_buffer->socket_context, ring_buffer->type, id, indices,
+                                num_indices);
+}
+
 // Maximum nack bitrate in terms of ratio of total bitrate
 #define MAX_NACK_BITRATE_RATIO 0.5
 
@@ -938,22 +1299,54 @@ int nack_missing_packets_up_to_index(RingBuffer* ring_buffer, FrameData* frame_d
     }
 
     int num_packets_nacked = 0;
-    for (int i = 0; i <= end_index && num_packets_nacked < max_packets_to_nack; i++) {
-        // If we can NACK for i, NACK for i
-        if (!frame_data->received_indices[i] &&
-            (frame_data->num_times_index_nacked[i] == 0 ||
-             diff_timer(&frame_data->last_nacked_timer[i], current_time) >
-                 latency_plus_jitter(latency))) {
-            nack_single_packet(ring_buffer, frame_data->id, i);
+    if (end_index < 0) {
+        return num_packets_nacked;
+    }
+    int num_words = end_index / 64 + 1;
+
+    // The indices that were nacked recently can't be nacked yet
+    uint64_t in_flight[FRAME_INDEX_BITSET_WORDS] = {0};
+    FrameNackState* nack_state = frame_data->nack_state;
+    if (nack_state != NULL && nack_state->id == frame_data->id) {
+        get_in_flight_nacks(nack_state, in_flight, latency_plus_jitter(latency), current_time,
+                            true);
+    } else {
+        // Nothing has been nacked for this frame yet
+        nack_state = NULL;
+    }
+
+    // The round of nacks sent by this call, which is only started once there's something to nack
+    uint64_t* round = NULL;
+    // The indices that this call nacks, which are sent together once they've all been found
+    uint64_t nacked[FRAME_INDEX_BITSET_WORDS] = {0};
+    for (int word = 0; word < num_words && num_packets_nacked < max_packets_to_nack; word++) {
+        // If we can NACK for an index, NACK for it
+        uint64_t nackable = ~frame_data->received_indices[word] & ~in_flight[word];
+        if (word == num_words - 1 && end_index % 64 != 63) {
+            nackable &= ((uint64_t)1 << (end_index % 64 + 1)) - 1;
+        }
+        while (nackable != 0 && num_packets_nacked < max_packets_to_nack) {
+            int i = word * 64 + bitset_lowest_bit(nackable);
+            nackable &= nackable - 1;
+            if (round == NULL) {
+                nack_state = get_frame_nack_state(frame_data);
+                round = start_nack_round(nack_state, current_time);
+            }
+            nacked[word] |= (uint64_t)1 << (i % 64);
             if (LOG_NACKING) {
                 string_buffer_printf(&buf, "%s%d", num_packets_nacked == 0 ? "" : ", ", i);
             }
-            frame_data->num_times_index_nacked[i]++;
-            start_timer(&frame_data->last_nacked_timer[i]);
+            round[word] |= (uint64_t)1 << (i % 64);
+            nack_state->num_times_index_nacked[i]++;
+            nack_state->num_nacks_sent++;
             num_packets_nacked++;
         }
     }
 
+    if (num_packets_nacked > 0) {
+        nack_packets(ring_buffer, frame_data->id, nacked, end_index + 1, num_packets_nacked);
+    }
+
     if (LOG_NACKING && num_packets_nacked > 0) {
         LOG_INFO("%s", nack_log_buffer);
     }
@@ -961,13 +1354,13 @@ int nack_missing_packets_up_to_index(RingBuffer* ring_buffer, FrameData* frame_d
     return num_packets_nacked;
 }
 
-bool try_nacking(RingBuffer* ring_buffer, double latency, int max_unordered_packets,
-                 NetworkSettings* network_settings, WhistTimer* current_time) {
+int update_nack_budget(RingBuffer* ring_buffer, WhistTimer* current_time) {
     // We should receive at least one packet for nacking to make sense
     FATAL_ASSERT(ring_buffer->min_id != -1);
 
-    const double burst_interval = 5.0 / MS_IN_SECOND;
-    const double avg_interval = 100.0 / MS_IN_SECOND;
+    const double burst_interval = NACK_BURST_INTERVAL_SEC;
+    const double avg_interval = NACK_AVG_INTERVAL_SEC;
+    NetworkSettings* network_settings = &ring_buffer->network_settings;
 
     if (diff_timer(&ring_buffer->burst_timer, current_time) > burst_interval) {
         ring_buffer->burst_counter = 0;
@@ -998,12 +1391,12 @@ bool try_nacking(RingBuffer* ring_buffer, double latency, int max_unordered_pack
     // Note how the order-of-ops ensures arithmetic is done with double's for higher accuracy
 
     if (max_nacks <= 0) {
-        // We can't nack, so just exit. Also takes care of negative case from above calculation.
+        // We can't nack. The nack timers that fire will be retried once the budget refills.
 
         // However, if we also have no average nacks remaining,
         // That means that we've fundamentally saturated NACKing,
         // Rather than simply throttling NACKing
-        double saturated_nacking = avg_nacks_remaining <= 0;
+        bool saturated_nacking = avg_nacks_remaining <= 0;
 
         if (ring_buffer->last_nack_possibility && saturated_nacking) {
             if (LOG_NACKING && ring_buffer->type == PACKET_VIDEO) {
@@ -1013,9 +1406,6 @@ bool try_nacking(RingBuffer* ring_buffer, double latency, int max_unordered_pack
             ring_buffer->last_nack_possibility = false;
             ring_buffer->num_times_nacking_saturated++;
         }
-        // Nacking has failed when avg_nacks has been saturated.
-        // If max_nacks has been saturated, that's just burst bitrate distribution
-        return !saturated_nacking;
     } else {
         if (!ring_buffer->last_nack_possibility) {
             if (LOG_NACKING && ring_buffer->type == PACKET_VIDEO) {
@@ -1024,113 +1414,353 @@ bool try_nacking(RingBuffer* ring_buffer, double latency, int max_unordered_pack
             ring_buffer->last_nack_possibility = true;
         }
     }
+    return max_nacks;
+}
 
-    // Track how many nacks we've made this call, to keep it under max_nacks
-    int num_packets_nacked = 0;
+void schedule_frame_recovery(RingBuffer* ring_buffer, int id, double deadline) {
+    RecoveryTimer* timer = &ring_buffer->nack_timers[id % ring_buffer->ring_buffer_size];
+    // A timer that's already due soon enough for this frame can be left as it is
+    if (timer->wheel_timer.scheduled && timer->id == id &&
+        timer->wheel_timer.deadline <= deadline) {
+        return;
+    }
+    timer->id = id;
+    timing_wheel_schedule(ring_buffer->recovery_wheel, &timer->wheel_timer, deadline);
+}
 
-    // last_missing_frame_nack is strictly increasing so it doesn't need to be throttled
-    // Non recovery mode last_packet index is strictly increasing so it doesn't need to be throttled
-    // Recovery mode cycles through trying to nack, and we throttle to ~latency,
-    // longer during consecutive cycles
+void handle_recovery_timer(void* opaque, TimingWheelTimer* wheel_timer) {
+    RecoveryTimerContext* context = (RecoveryTimerContext*)opaque;
+    RecoveryTimer* timer = (RecoveryTimer*)wheel_timer;
+    switch (timer->type) {
+        case RECOVERY_TIMER_NACK: {
+            handle_nack_timer(context->ring_buffer, timer, context->current_time);
+            break;
+        }
+        case RECOVERY_TIMER_STALENESS: {
+            handle_staleness_timer(context->ring_buffer, timer, context->current_time);
+            break;
+        }
+        case RECOVERY_TIMER_STREAM_RESET: {
+            request_stream_reset_if_failed(context->ring_buffer, context->current_time);
+            break;
+        }
+    }
+}
 
-    // Nack all the packets we might want to nack about,
-    // from oldest to newest, up to max_nacks times
+void handle_nack_timer(RingBuffer* ring_buffer, RecoveryTimer* timer, WhistTimer* current_time) {
+    int id = timer->id;
+    // Only nack for the frames that are still going to be rendered.
     // If we haven't rendered yet, we'll only nack for the most recent 5 frames when looking for an
     // I-Frame
-    for (int id = ring_buffer->last_rendered_id == -1
-                      ? max(ring_buffer->max_id - 5, ring_buffer->min_id)
-                      : ring_buffer->last_rendered_id + 1;
-         id <= ring_buffer->max_id && num_packets_nacked < max_nacks; id++) {
-        FrameData* frame_data = get_frame_at_id(ring_buffer, id);
-        // If this frame doesn't exist, NACK for the missing frame and then continue
-        if (frame_data->id != id) {
-            bool nack_frame = false;
-            if (frame_data->entire_frame_nacked_id != id) {
-                frame_data->entire_frame_nacked_id = id;
-                frame_data->num_entire_frame_nacked = 1;
-                nack_frame = true;
-            } else if (diff_timer(&frame_data->last_frame_nack_timer, current_time) >
-                           latency_plus_jitter(latency) &&
-                       frame_data->num_entire_frame_nacked < MAX_PACKET_NACKS) {
-                frame_data->num_entire_frame_nacked++;
-                nack_frame = true;
-            }
-            if (nack_frame) {
-                if (LOG_NACKING) {
-                    LOG_INFO("NACKing for missing Frame ID %d", id);
-                }
-                nack_single_packet(ring_buffer, id, -1);
-                frame_data->last_frame_nack_timer = *current_time;
-                // Assume a frame size that's half the average size, and update the
-                // num_packets_nacked accordingly. Usually smaller sized frames are the ones that
-                // are lost completely. For average/bigger sized sized frames, one or two packets
-                // will usually get through.
-                double bytes_per_frame =
-                    network_settings->video_bitrate / (MAX_FPS * BITS_IN_BYTE * 2);
-                num_packets_nacked += max((int)round(bytes_per_frame / MAX_PAYLOAD_SIZE), 1);
+    int first_id = ring_buffer->last_rendered_id == -1
+                       ? max(ring_buffer->max_id - 5, ring_buffer->min_id)
+                       : ring_buffer->last_rendered_id + 1;
+    if (id < first_id || id > ring_buffer->max_id) {
+        return;
+    }
+
+    TimingWheel* wheel = ring_buffer->recovery_wheel;
+    double now = timing_wheel_get_time(wheel, current_time);
+    if (ring_buffer->type == PACKET_VIDEO) {
+        log_double_statistic(NETWORK_NACK_TIMER_LATENESS,
+                             (now - timer->wheel_timer.deadline) * MS_IN_SECOND);
+    }
+    if (ring_buffer->nacks_remaining <= 0) {
+        // Try again once the burst budget has been refilled
+        timing_wheel_schedule(wheel, &timer->wheel_timer, now + NACK_BURST_INTERVAL_SEC);
+        return;
+    }
+
+    double latency = ring_buffer->latency;
+    double retry_interval = latency_plus_jitter(latency);
+    FrameData* frame_data = get_frame_at_id(ring_buffer, id);
+    // If this frame doesn't exist, NACK for the missing frame
+    if (frame_data->id != id) {
+        bool nack_frame = false;
+        if (frame_data->entire_frame_nacked_id != id) {
+            frame_data->entire_frame_nacked_id = id;
+            frame_data->num_entire_frame_nacked = 1;
+            nack_frame = true;
+        } else if (diff_timer(&frame_data->last_frame_nack_timer, current_time) > retry_interval &&
+                   frame_data->num_entire_frame_nacked < MAX_PACKET_NACKS) {
+            frame_data->num_entire_frame_nacked++;
+            nack_frame = true;
+        }
+        if (nack_frame) {
+            if (LOG_NACKING) {
+                LOG_INFO("NACKing for missing Frame ID %d", id);
             }
-            continue;
+            nack_single_packet(ring_buffer, id, -1);
+            frame_data->last_frame_nack_timer = *current_time;
+            // Assume a frame size that's half the average size, and update the
+            // nacks_remaining accordingly. Usually smaller sized frames are the ones that
+            // are lost completely. For average/bigger sized sized frames, one or two packets
+            // will usually get through.
+            double bytes_per_frame =
+                ring_buffer->network_settings.video_bitrate / (MAX_FPS * BITS_IN_BYTE * 2);
+            ring_buffer->nacks_remaining -= max((int)round(bytes_per_frame / MAX_PAYLOAD_SIZE), 1);
+        }
+        // Nack for it again once that nack may have been lost
+        if (frame_data->num_entire_frame_nacked < MAX_PACKET_NACKS) {
+            timing_wheel_schedule(
+                wheel, &timer->wheel_timer,
+                timing_wheel_get_time(wheel, &frame_data->last_frame_nack_timer) + retry_interval);
         }
+        return;
+    }
 
-        // If this frame has been entirely received, there's nothing to nack for
-        if (is_ready_to_render(ring_buffer, id)) {
-            continue;
+    // If this frame has been entirely received, there's nothing to nack for
+    if (is_ready_to_render(ring_buffer, id)) {
+        return;
+    }
+
+    // =======
+    // Go through the frame looking for packets to nack
+    // =======
+
+    // Get the last index we received
+    int nack_upto_index = 0;
+    if (id < ring_buffer->max_id) {
+        nack_upto_index = frame_data->num_original_packets - 1;
+    } else {
+        nack_upto_index = max(frame_data->highest_original_index_received, 0);
+    }
+
+    int unordered_packets = ring_buffer->max_unordered_packets;
+    // If packets from future frames are already received, then adjust unordered_packets
+    // accordingly
+    for (int future_id = id + 1; future_id < ring_buffer->max_id && unordered_packets > 0;
+         future_id++) {
+        FrameData* future_frame = get_frame_at_id(ring_buffer, future_id);
+        if (future_id == future_frame->id)
+            unordered_packets = max(unordered_packets - future_frame->original_packets_received, 0);
+    }
+
+    // we nack for packets that are more than unordered_packets "out of order"
+    // E.g., if we get 1 2 3 4 5 9, and unordered_packets = 3, then
+    // 5 is considered to be too far from 9 to still be unreceived simply due to UDP
+    // reordering.
+    int packets_nacked_this_frame = nack_missing_packets_up_to_index(
+        ring_buffer, frame_data, nack_upto_index - unordered_packets, ring_buffer->nacks_remaining,
+        latency, current_time);
+    if (LOG_NACKING && packets_nacked_this_frame > 0) {
+        LOG_INFO("~~ Frame ID %d Nacked for %d out-of-order packets", id,
+                 packets_nacked_this_frame);
+    }
+    ring_buffer->nacks_remaining -= packets_nacked_this_frame;
+
+    // Look at the frame again once the oldest nacks in flight may have been lost, or once we can
+    // nack again if we ran out of budget. Packets that are still within the unordered allowance
+    // are looked at again when more packets arrive.
+    bool reschedule = false;
+    double deadline = 0.0;
+    FrameNackState* nack_state = frame_data->nack_state;
+    if (nack_state != NULL && nack_state->id == id) {
+        uint32_t slots = nack_state->active_slots;
+        while (slots != 0) {
+            int slot = bitset_lowest_bit(slots);
+            slots &= slots - 1;
+            double slot_deadline =
+                timing_wheel_get_time(wheel, &nack_state->slot_nack_times[slot]) + retry_interval;
+            deadline = reschedule ? min(deadline, slot_deadline) : slot_deadline;
+            reschedule = true;
         }
+    }
+    if (ring_buffer->nacks_remaining <= 0) {
+        double budget_deadline = now + NACK_BURST_INTERVAL_SEC;
+        deadline = reschedule ? min(deadline, budget_deadline) : budget_deadline;
+        reschedule = true;
+    }
+    if (reschedule) {
+        timing_wheel_schedule(wheel, &timer->wheel_timer, deadline);
+    }
+}
 
-        // =======
-        // Go through the frame looking for packets to nack
-        // =======
+void handle_staleness_timer(RingBuffer* ring_buffer, RecoveryTimer* timer,
+                            WhistTimer* current_time) {
+    int id = timer->id;
+    FrameData* frame_data = get_frame_at_id(ring_buffer, id);
+    int currently_pending_id = get_currently_pending_id(ring_buffer);
+    // Only the frames that haven't been rendered or skipped can fail
+    if (frame_data->id != id || id < currently_pending_id ||
+        id < ring_buffer->max_id - MAX_STALE_FRAME_DISTANCE) {
+        return;
+    }
 
-        // Get the last index we received
-        int nack_upto_index = 0;
-        if (id < ring_buffer->max_id) {
-            nack_upto_index = frame_data->num_original_packets - 1;
-        } else {
-            for (int i = frame_data->num_original_packets - 1; i >= 0; i--) {
-                if (frame_data->received_indices[i]) {
-                    nack_upto_index = i;
-                    break;
-                }
+    double time_to_transmit = 0.0;
+    if (ring_buffer->network_settings.burst_bitrate > 0) {
+        time_to_transmit =
+            ((frame_data->num_original_packets + frame_data->num_fec_packets) * MAX_PAYLOAD_SIZE *
+             BITS_IN_BYTE) /
+            (double)ring_buffer->network_settings.burst_bitrate;
+    }
+    // Adding Network Jitter + One round-trip latency to account for nack response time
+    double acceptable_staleness_ms =
+        (time_to_transmit + (latency_plus_jitter(ring_buffer->latency) * MAX_PACKET_NACKS)) *
+        MS_IN_SECOND;
+    acceptable_staleness_ms = max(acceptable_staleness_ms, MIN_ACCEPTABLE_STALENESS_MS);
+    // If the frame is completely received, double the threshold(subject to the absolute
+    // max) as there is a chance to catchup.
+    if (is_ready_to_render(ring_buffer, currently_pending_id)) {
+        acceptable_staleness_ms *= 2;
+    }
+    acceptable_staleness_ms = min(acceptable_staleness_ms, MAX_ACCEPTABLE_STALENESS_MS);
+
+    // If it isn't stale yet, check again when it would be
+    double frame_staleness = diff_timer(&frame_data->frame_creation_timer, current_time);
+    if (frame_staleness * MS_IN_SECOND <= acceptable_staleness_ms) {
+        TimingWheel* wheel = ring_buffer->recovery_wheel;
+        timing_wheel_schedule(wheel, &timer->wheel_timer,
+                              timing_wheel_get_time(wheel, &frame_data->frame_creation_timer) +
+                                  acceptable_staleness_ms / MS_IN_SECOND);
+        return;
+    }
+
+    // Failed is a frame that's so far behind that we think we probably won't get it.
+    // Only requesting a single I-Frame isn't enough, since that I-Frame could fail to receive,
+    // so any stale frames are marked as failed as well.
+    ring_buffer->greatest_failed_id = max(ring_buffer->greatest_failed_id, id);
+    request_stream_reset_if_failed(ring_buffer, current_time);
+}
+
+void request_stream_reset_if_failed(RingBuffer* ring_buffer, WhistTimer* current_time) {
+    TimingWheel* wheel = ring_buffer->recovery_wheel;
+    timing_wheel_cancel(wheel, &ring_buffer->stream_reset_timer->wheel_timer);
+
+    // The failed frame no longer matters once it's been rendered or skipped,
+    // or is too far behind
+    int currently_pending_id = get_currently_pending_id(ring_buffer);
+    int greatest_failed_id = ring_buffer->greatest_failed_id;
+    if (greatest_failed_id == -1 || greatest_failed_id < currently_pending_id ||
+        greatest_failed_id < ring_buffer->max_id - MAX_STALE_FRAME_DISTANCE) {
+        ring_buffer->greatest_failed_id = -1;
+        return;
+    }
+
+    // If we have any failed IDs, we tell the server,
+    // So that it can try to give us an I-Frame
+    // Throttle the requests to prevent network upload saturation, however
+    double latency = ring_buffer->latency;
+    if (diff_timer(&ring_buffer->last_stream_reset_request_timer, current_time) > latency / 2.0) {
+        whist_analyzer_record_stream_reset(ring_buffer->type, greatest_failed_id);
+        ring_buffer->request_stream_reset(ring_buffer->socket_context, ring_buffer->type,
+                                          greatest_failed_id);
+
+        // If a newer frame has failed, log it
+        if (greatest_failed_id > ring_buffer->last_stream_reset_request_id) {
+            FrameData* pending_ctx = get_frame_at_id(ring_buffer, currently_pending_id);
+            if (pending_ctx->id != currently_pending_id) {
+                pending_ctx = NULL;
+            }
+            FrameData* greatest_failed_ctx = get_frame_at_id(ring_buffer, greatest_failed_id);
+            if (greatest_failed_ctx->id != greatest_failed_id) {
+                greatest_failed_ctx = NULL;
+            }
+            LOG_INFO(
+                "The most recent ID %d is %d frames ahead of currently pending %d (%d/%d "
+                "packets received). A stream reset is now being requested to catch-up, ID's <= "
+                "%d(%d/%d packets received) are considered lost.",
+                ring_buffer->max_id, ring_buffer->max_id - currently_pending_id,
+                currently_pending_id, pending_ctx ? pending_ctx->original_packets_received : -1,
+                pending_ctx ? pending_ctx->num_original_packets : -1, greatest_failed_id,
+                greatest_failed_ctx ? greatest_failed_ctx->original_packets_received : -1,
+                greatest_failed_ctx ? greatest_failed_ctx->num_original_packets : -1);
+
+            if (pending_ctx != NULL) {
+                double next_render_staleness =
+                    diff_timer(&pending_ctx->frame_creation_timer, current_time);
+                LOG_INFO("We've been trying to receive Frame %d for %fms.", currently_pending_id,
+                         next_render_staleness * MS_IN_SECOND);
             }
-        }
 
-        int packets_nacked_this_frame = 0;
-        int unordered_packets = max_unordered_packets;
-        // If packets from future frames are already received, then adjust unordered_packets
-        // accordingly
-        for (int future_id = id + 1; future_id < ring_buffer->max_id && unordered_packets > 0;
-             future_id++) {
-            FrameData* future_frame = get_frame_at_id(ring_buffer, future_id);
-            if (future_id == future_frame->id)
-                unordered_packets =
-                    max(unordered_packets - future_frame->original_packets_received, 0);
+            ring_buffer->last_stream_reset_request_id = greatest_failed_id;
         }
 
-        // we nack for packets that are more than unordered_packets "out of order"
-        // E.g., if we get 1 2 3 4 5 9, and unordered_packets = 3, then
-        // 5 is considered to be too far from 9 to still be unreceived simply due to UDP
-        // reordering.
-        packets_nacked_this_frame += nack_missing_packets_up_to_index(
-            ring_buffer, frame_data, nack_upto_index - unordered_packets,
-            max_nacks - num_packets_nacked, latency, current_time);
-        if (LOG_NACKING && packets_nacked_this_frame > 0) {
-            LOG_INFO("~~ Frame ID %d Nacked for %d out-of-order packets", id,
-                     packets_nacked_this_frame);
-        }
-        // Add to total
-        num_packets_nacked += packets_nacked_this_frame;
+        start_timer(&ring_buffer->last_stream_reset_request_timer);
     }
 
-    if (LOG_NACKING && num_packets_nacked > 0) {
-        LOG_INFO("Nacked %d/%d packets this Nacking round", num_packets_nacked, max_nacks);
+    // Keep requesting it for as long as the failed frame is pending
+    timing_wheel_schedule(
+        wheel, &ring_buffer->stream_reset_timer->wheel_timer,
+        timing_wheel_get_time(wheel, &ring_buffer->last_stream_reset_request_timer) +
+            latency / 2.0);
+}
+
+int get_currently_pending_id(RingBuffer* ring_buffer) {
+    return ring_buffer->last_rendered_id == -1 ? ring_buffer->min_id
+                                               : ring_buffer->last_rendered_id + 1;
+}
+
+FrameNackState* get_frame_nack_state(FrameData* frame_data) {
+    FrameNackState* nack_state = frame_data->nack_state;
+    if (nack_state != NULL && nack_state->id == frame_data->id) {
+        return nack_state;
     }
 
-    // Update the counters to track max nack bitrate
-    ring_buffer->burst_counter += num_packets_nacked;
-    ring_buffer->avg_counter += num_packets_nacked;
+    int num_indices = frame_data->num_original_packets + frame_data->num_fec_packets;
+    int num_words = (num_indices + 63) / 64;
+    if (nack_state == NULL || nack_state->max_num_indices < num_indices) {
+        // Allocate the slot bitsets and the nack counters along with the struct
+        free(nack_state);
+        size_t slot_indices_size = sizeof(uint64_t) * NACK_RETRY_WHEEL_SLOTS * num_words;
+        nack_state = safe_malloc(sizeof(FrameNackState) + slot_indices_size + num_indices);
+        nack_state->max_num_indices = num_indices;
+        nack_state->slot_indices = (uint64_t*)(nack_state + 1);
+        nack_state->num_times_index_nacked = (uint8_t*)nack_state->slot_indices + slot_indices_size;
+        frame_data->nack_state = nack_state;
+    }
+
+    // Only the part that this frame uses has to be cleared
+    nack_state->id = frame_data->id;
+    nack_state->num_words = num_words;
+    nack_state->num_nacks_sent = 0;
+    nack_state->active_slots = 0;
+    nack_state->newest_slot = 0;
+    memset(nack_state->num_times_index_nacked, 0, num_indices);
+    return nack_state;
+}
 
-    // Nacking succeeded
-    return true;
+int get_num_times_index_nacked(FrameData* frame_data, int index) {
+    FrameNackState* nack_state = frame_data->nack_state;
+    if (nack_state == NULL || nack_state->id != frame_data->id) {
+        return 0;
+    }
+    return nack_state->num_times_index_nacked[index];
+}
+
+void get_in_flight_nacks(FrameNackState* nack_state, uint64_t* in_flight, double retry_interval,
+                         WhistTimer* current_time, bool expire) {
+    int num_words = nack_state->num_words;
+    memset(in_flight, 0, sizeof(uint64_t) * num_words);
+    uint32_t slots = nack_state->active_slots;
+    while (slots != 0) {
+        int slot = bitset_lowest_bit(slots);
+        slots &= slots - 1;
+        if (diff_timer(&nack_state->slot_nack_times[slot], current_time) > retry_interval) {
+            // These nacks may have been lost, so the indices can be nacked again
+            if (expire) {
+                nack_state->active_slots &= ~((uint32_t)1 << slot);
+            }
+            continue;
+        }
+        uint64_t* slot_indices = nack_state->slot_indices + (size_t)slot * num_words;
+        for (int word = 0; word < num_words; word++) {
+            in_flight[word] |= slot_indices[word];
+        }
+    }
+}
+
+uint64_t* start_nack_round(FrameNackState* nack_state, WhistTimer* current_time) {
+    int num_words = nack_state->num_words;
+    uint32_t free_slots = ~nack_state->active_slots & (((uint32_t)1 << NACK_RETRY_WHEEL_SLOTS) - 1);
+    if (free_slots != 0) {
+        nack_state->newest_slot = bitset_lowest_bit(free_slots);
+        nack_state->active_slots |= (uint32_t)1 << nack_state->newest_slot;
+        memset(nack_state->slot_indices + (size_t)nack_state->newest_slot * num_words, 0,
+               sizeof(uint64_t) * num_words);
+    }
+    nack_state->slot_nack_times[nack_state->newest_slot] = *current_time;
+    return nack_state->slot_indices + (size_t)nack_state->newest_slot * num_words;
 }
 
 int get_num_pending_ready_frames(RingBuffer* ring_buffer) {
@@ -23,6 +23,7 @@ Includes
 #include <whist/fec/fec.h>
 #include <whist/network/network_algorithm.h>
 #include "whist/utils/linked_list.h"
+#include "whist/utils/timing_wheel.h"
 
 /*
 ============================
@@ -32,6 +33,16 @@ Defines
 
 #define PACKET_LOSS_DURATION_IN_SEC 1
 
+// The number of 64-bit words in a bitset with a bit for every index of a frame
+#define FRAME_INDEX_BITSET_WORDS ((MAX_PACKETS + 63) / 64)
+
+// The per-index nacking state of a frame, which is private to ringbuffer.c
+typedef struct FrameNackState FrameNackState;
+
+// A timer that fires when a frame may need nacking or a stream reset, which is private to
+// ringbuffer.c
+typedef struct RecoveryTimer RecoveryTimer;
+
 /**
  * @brief FrameData struct containing content and metadata of encoded frames.
  * @details This is used to handle reconstruction of encoded frames from UDP packets. It contains
@@ -50,8 +61,14 @@ typedef struct FrameData {
     int duplicate_packets_received;
     int nack_packets_received;
     int unnecessary_nack_packets_received;
-    bool received_indices[MAX_PACKETS];
-    WhistTimer last_nacked_timer[MAX_PACKETS];
+    // The highest original index received so far, or -1 if none has been
+    int highest_original_index_received;
+    // Bitset of the indices that have been received, bit i of word i / 64 is index i
+    uint64_t received_indices[FRAME_INDEX_BITSET_WORDS];
+    // The number of original packets at the start of the frame that have all been received,
+    // and the number of bytes of the frame that they hold
+    int num_prefix_packets_received;
+    int prefix_size_received;
     char* packet_buffer;
 
     // When the FrameData is being rendered,
@@ -68,7 +85,10 @@ typedef struct FrameData {
     uint8_t num_entire_frame_nacked;
     int entire_frame_nacked_id;
     WhistTimer last_frame_nack_timer;
-    uint8_t num_times_index_nacked[MAX_PACKETS];
+    // How many times each index has been nacked, and when it may be nacked again.
+    // This is only allocated once the frame needs an index nacked, and is kept by the
+    // ringbuffer slot for its later frames. It belongs to this frame only if its ID matches.
+    FrameNackState* nack_state;
     WhistTimer last_nonnack_packet_timer;
     WhistTimer frame_creation_timer;
 } FrameData;
@@ -76,6 +96,10 @@ typedef struct FrameData {
 // Handler that gets called when the ring buffer wants to nack for a packet
 typedef void (*NackPacketFn)(SocketContext* socket_context, WhistPacketType frame_type, int id,
                              int index);
+// Handler that gets called to nack for several packets of a frame at once, where the packets are
+// the indices i < num_indices whose bit i % 64 of indices[i / 64] is set
+typedef void (*NackBitArrayFn)(SocketContext* socket_context, WhistPacketType frame_type, int id,
+                               const uint64_t* indices, int num_indices);
 typedef void (*StreamResetFn)(SocketContext* socket_context, WhistPacketType frame_type,
                               int last_failed_id);
 
@@ -89,15 +113,18 @@ typedef struct RingBuffer {
     int ring_buffer_size;
     FrameData* receiving_frames;
     WhistPacketType type;
+    // Size of the frame buffers, which are allocated from the buffer pool
     int largest_frame_size;
+    // The FEC scheme negotiated for this stream, which frames are decoded with
+    // according to fec_get_frame_scheme
+    FECScheme fec_scheme;
 
     // networking interface
     SocketContext* socket_context;
     NackPacketFn nack_packet;
+    NackBitArrayFn nack_bit_array;
     StreamResetFn request_stream_reset;
 
-    BlockAllocator* packet_buffer_allocator;  // unused if audio
-
     int currently_rendering_id;
     FrameData currently_rendering_frame;
 
@@ -120,6 +147,23 @@ typedef struct RingBuffer {
     int most_recent_reset_id;
     WhistTimer last_stream_reset_request_timer;
     int last_stream_reset_request_id;
+    // The greatest ID of any frame that's so stale that we probably won't get it, or -1
+    int greatest_failed_id;
+
+    // Recovery is event-driven: every ringbuffer slot has a nack timer and a staleness timer,
+    // which are scheduled on the recovery wheel when the frame in that slot needs attention, so
+    // only those frames are looked at on each call to try_recovering_missing_packets_or_frames
+    TimingWheel* recovery_wheel;
+    RecoveryTimer* nack_timers;
+    RecoveryTimer* staleness_timers;
+    RecoveryTimer* stream_reset_timer;
+    // The conditions given to the latest try_recovering_missing_packets_or_frames,
+    // which the recovery timers are handled with
+    double latency;
+    int max_unordered_packets;
+    NetworkSettings network_settings;
+    // The number of nacks that may still be sent while handling the current recovery timers
+    int nacks_remaining;
 
     // Nacking bandwidth tracker
     WhistTimer burst_timer;
@@ -159,6 +203,10 @@ Public Functions
  * @param nack_packet               A lambda function that will be called when the ring buffer
  *                                  wants to nack for something. NULL will disable nacking.
  *
+ * @param nack_bit_array            A lambda function that will be called when the ring buffer
+ *                                  wants to nack for several packets of a frame at once.
+ *                                  NULL will nack for them one at a time with nack_packet.
+ *
  * @param request_stream_reset      A temporary lambda function to make the refactor work
  *                                  NULL to disable
  *                                  TODO: Remove
@@ -167,7 +215,7 @@ Public Functions
  */
 RingBuffer* init_ring_buffer(WhistPacketType type, int max_frame_size, int ring_buffer_size,
                              SocketContext* socket_context, NackPacketFn nack_packet,
-                             StreamResetFn request_stream_reset);
+                             NackBitArrayFn nack_bit_array, StreamResetFn request_stream_reset);
 
 /**
  * @brief Add a packet to the ring buffer, and initialize the corresponding frame if necessary. Also
@@ -192,6 +240,25 @@ bool ring_buffer_receive_segment(RingBuffer* ring_buffer, WhistSegment* segment)
  */
 FrameData* get_frame_at_id(RingBuffer* ring_buffer, int id);
 
+/**
+ * @brief Read the start of a frame that's still being received, i.e. the part of the frame held by
+ * the original packets before the first one that's missing. That part never changes once it has
+ * been received, so the frame can be read piece by piece as it arrives.
+ *
+ * @param ring_buffer Ring buffer containing the frame
+ *
+ * @param id ID of the frame to read
+ *
+ * @param buffer Buffer to read the frame into, which must be large enough for any frame
+ *
+ * @param offset The number of bytes at the start of the frame that are already in buffer from an
+ * earlier call, which won't be read again
+ *
+ * @returns The number of bytes at the start of the frame that are now in buffer, or -1 if the
+ * frame isn't being received
+ */
+int ring_buffer_read_frame_prefix(RingBuffer* ring_buffer, int id, char* buffer, int offset);
+
 /**
  * @brief Calculates the packet loss ratio of non-rendered frames in the last 250ms.
  *
@@ -80,6 +80,8 @@ typedef struct {
     struct sockaddr_in addr;
     WhistMutex mutex;
     char binary_aes_private_key[16];
+    // Pre-keyed cipher contexts, shared by the sending and receiving threads
+    AESSession* aes_session;
     // Used for ting TCP packets
     int reading_packet_len;
     DynamicBuffer* encrypted_tcp_packet_buffer;
@@ -319,10 +321,10 @@ static int tcp_send_packet(void* raw_context, WhistPacketType type, void* data,
         LOG_ERROR("ID should be -1 when sending over TCP!");
     }
 
-    // Use our block allocator
+    // Use the buffer pool
     // This function fragments the heap too much to use malloc here
     int packet_size = PACKET_HEADER_SIZE + len;
-    TCPPacket* tcp_packet = allocate_region(sizeof(TCPPacket) + packet_size);
+    TCPPacket* tcp_packet = allocate_pooled_buffer(sizeof(TCPPacket) + packet_size);
     tcp_packet->type = TCP_WHIST_PACKET;
     WhistPacket* packet = (WhistPacket*)&tcp_packet->whist_packet_data.whist_packet;
 
@@ -339,7 +341,7 @@ static int tcp_send_packet(void* raw_context, WhistPacketType type, void* data,
     int ret = tcp_send_constructed_packet(context, tcp_packet);
 
     // Free the packet
-    deallocate_region(tcp_packet);
+    free_pooled_buffer(tcp_packet);
 
     // Return success code
     return ret;
@@ -434,18 +436,18 @@ static void* tcp_get_packet(void* raw_context, WhistPacketType packet_type) {
         // we're ready to try to decrypt it
         if (context->reading_packet_len >= tcp_network_packet_size) {
             // The resulting packet will be <= the encrypted size
-            TCPPacket* tcp_packet = allocate_region(tcp_network_packet->payload_size);
+            TCPPacket* tcp_packet = allocate_pooled_buffer(tcp_network_packet->payload_size);
 
             if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
                 // Decrypt into whist_packet
-                int decrypted_len = decrypt_packet(
-                    tcp_packet, tcp_network_packet->payload_size, tcp_network_packet->aes_metadata,
-                    tcp_network_packet->payload, tcp_network_packet->payload_size,
-                    context->binary_aes_private_key);
+                int decrypted_len = aes_session_decrypt_packet(
+                    context->aes_session, tcp_packet, tcp_network_packet->payload_size,
+                    &tcp_network_packet->aes_metadata, tcp_network_packet->payload,
+                    tcp_network_packet->payload_size);
                 if (decrypted_len == -1) {
                     // Deallocate and prepare to return NULL on decryption failure
                     LOG_WARNING("Could not decrypt TCP message!");
-                    deallocate_region(tcp_packet);
+                    free_pooled_buffer(tcp_packet);
                     tcp_packet = NULL;
                 } else {
                     // Verify that the length matches what the TCPPacket's length should be
@@ -483,17 +485,17 @@ static void* tcp_get_packet(void* raw_context, WhistPacketType packet_type) {
                     if (whist_packet->type != packet_type) {
                         LOG_ERROR("Got a TCP whist packet of type that didn't match %d! %d",
                                   (int)packet_type, (int)whist_packet->type);
-                        deallocate_region(tcp_packet);
+                        free_pooled_buffer(tcp_packet);
                         return NULL;
                     }
                     // Return the whist packet
-                    // Note that the allocate_region is offset by offsetof(TCPPacket,
+                    // Note that the pooled buffer is offset by offsetof(TCPPacket,
                     // whist_packet_data.whist_packet)
                     return whist_packet;
                 } else {
                     // Handle the TCPPacket message
                     tcp_handle_message(context, tcp_packet);
-                    deallocate_region(tcp_packet);
+                    free_pooled_buffer(tcp_packet);
                     // There might still be a pending WhistPacket,
                     // So we make a recursive call to check again
                     return tcp_get_packet(raw_context, packet_type);
@@ -510,7 +512,7 @@ static void tcp_free_packet(void* raw_context, WhistPacket* whist_packet) {
     // Free the underlying TCP Packet
     TCPPacket* tcp_packet =
         (TCPPacket*)((char*)whist_packet - offsetof(TCPPacket, whist_packet_data.whist_packet));
-    deallocate_region(tcp_packet);
+    free_pooled_buffer(tcp_packet);
 }
 
 static bool tcp_get_pending_stream_reset(void* raw_context, WhistPacketType packet_type) {
@@ -536,6 +538,7 @@ static void tcp_destroy_socket_context(void* raw_context) {
     closesocket(context->listen_socket);
     whist_destroy_mutex(context->mutex);
     free_dynamic_buffer(context->encrypted_tcp_packet_buffer);
+    destroy_aes_session(context->aes_session);
     free(context);
 }
 
@@ -607,6 +610,16 @@ bool create_tcp_socket_context(SocketContext* network_context, const char* desti
 
     int ret;
 
+    context->aes_session = create_aes_session(binary_aes_private_key, destination == NULL);
+    if (context->aes_session == NULL) {
+        LOG_ERROR("Failed to create the AES session");
+        whist_destroy_mutex(context->mutex);
+        free_dynamic_buffer(context->encrypted_tcp_packet_buffer);
+        free(context);
+        network_context->context = NULL;
+        return false;
+    }
+
     if (destination == NULL) {
         context->is_server = true;
         ret = create_tcp_server_context(context, port, connection_timeout_ms);
@@ -616,6 +629,7 @@ bool create_tcp_socket_context(SocketContext* network_context, const char* desti
     }
 
     if (ret == -1) {
+        destroy_aes_session(context->aes_session);
         free(context);
         network_context->context = NULL;
         return false;
@@ -632,6 +646,7 @@ bool create_tcp_socket_context(SocketContext* network_context, const char* desti
         //     return false
         if (context->send_queue) fifo_queue_destroy(context->send_queue);
         if (context->send_semaphore) whist_destroy_semaphore(context->send_semaphore);
+        destroy_aes_session(context->aes_session);
         free(context);
         network_context->context = NULL;
         return false;
@@ -808,13 +823,15 @@ int tcp_send_constructed_packet(TCPContext* context, TCPPacket* packet) {
     int packet_size = get_tcp_packet_size(packet);
 
     // Allocate a buffer for the encrypted packet
-    TCPNetworkPacket* network_packet =
-        allocate_region(sizeof(TCPNetworkPacket) + packet_size + MAX_ENCRYPTION_SIZE_INCREASE);
+    TCPNetworkPacket* network_packet = allocate_pooled_buffer(
+        sizeof(TCPNetworkPacket) + packet_size + MAX_ENCRYPTION_SIZE_INCREASE);
 
     if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
         // If we're encrypting packets, encrypt the packet into tcp_packet
-        int encrypted_len = encrypt_packet(network_packet->payload, &network_packet->aes_metadata,
-                                           packet, packet_size, context->binary_aes_private_key);
+        WhistIOVec plaintext_iov = {packet, packet_size};
+        int encrypted_len =
+            aes_session_encrypt_packet(context->aes_session, network_packet->payload,
+                                       &network_packet->aes_metadata, &plaintext_iov, 1);
         network_packet->payload_size = encrypted_len;
     } else {
         // Otherwise, just write it to tcp_packet directly
@@ -887,7 +904,7 @@ int multithreaded_tcp_send(void* opaque) {
         }
 
         // Free the encrypted allocation
-        deallocate_region(network_packet);
+        free_pooled_buffer(network_packet);
     }
 
     return 0;
@@ -6,26 +6,185 @@
 #include "throttle.h"
 #include <whist/network/network_algorithm.h>
 
+#if OS_IS(OS_LINUX)
+#include <time.h>
+#endif
+
 // Set this to something very low. Throttler will work as expected only if
 // network_throttler_set_burst_bitrate() is called with the required bitrate
 #define STARTING_THROTTLER_BITRATE 1000000
 
+// OS sleeps overshoot by tens of microseconds, so the last stretch of a wait
+// is busy-waited instead, to release each burst right on time.
+#define PACING_BUSY_WAIT_US 100
+
+// Tells the CPU that we're busy-waiting, which saves power and lets the other hyperthread of
+// the core, which may well be the one that's encrypting and sending our packets, run at full speed
+#if OS_IS(OS_WIN32)
+#define PACING_SPIN_PAUSE() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define PACING_SPIN_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define PACING_SPIN_PAUSE() __asm__ __volatile__("yield")
+#else
+#define PACING_SPIN_PAUSE()
+#endif
+
+// The coin bucket and the group that its coins belong to are packed into one atomic_int,
+// so that a refill publishes both at once. The low bits hold the coins, and the high bits
+// the low bits of the group ID, which are enough to tell which group_id the coins belong to.
+#define COIN_BUCKET_GROUP_SHIFT 24
+#define COIN_BUCKET_MAX_COINS ((1 << COIN_BUCKET_GROUP_SHIFT) - 1)
+
+/*
+    The throttler is a token bucket, whose coins are only ever touched with atomic operations,
+    so that allocating bytes never takes a lock.
+
+    The bucket is refilled on a fixed grid of coin_bucket_ms long intervals, measured from the
+    creation of the throttler. The first allocation in a new interval refills the bucket and
+    starts a new group of packets, so all of the packets of a group leave in the same burst.
+    Refilling on a fixed grid, rather than coin_bucket_ms after the previous refill,
+    also keeps late wakeups from eating into the burst bitrate.
+
+    A thread that runs out of coins paces itself until the next interval starts: it sleeps until
+    shortly before the refill, and then busy-waits the rest of the way.
+
+    Since the group that spent coins belong to is packed into the same atomic_int as the coins,
+    bytes are always tagged with the group whose refill added the coins that they were given,
+    even if a refill races with the allocation.
+*/
 struct NetworkThrottleContext {
-    double coin_bucket_ms;   //<<< The size of the coin bucket in milliseconds.
-    size_t coin_bucket_max;  //<<< The maximum size of the coin bucket for the current burst bitrate
-                             // and coin_bucket_ms.
-    size_t coin_bucket;      //<<< The coin bucket for the current burst bitrate.
-    int burst_bitrate;       //<<< The current burst bitrate.
-    WhistMutex queue_lock;   //<<< The lock to protect the queue.
-    WhistCondition queue_cond;         //<<< The condition variable which regulates the queue.
-    WhistTimer coin_bucket_last_fill;  //<<< The timer for the coin bucket's last fill.
-    atomic_int next_queue_id;          //<<< The next queue id to use.
-    atomic_int current_queue_id;       //<<< The currently-processed queue id.
-    unsigned int group_id;       //<<< id of the group of packets being sent in the current burst.
-    bool destroying;             //<<< Whether the context is being destroyed.
+    double coin_bucket_ms;       //<<< The size of the coin bucket in milliseconds.
+    atomic_int coin_bucket_max;  //<<< The maximum size of the coin bucket for the current burst
+                                 // bitrate and coin_bucket_ms.
+    atomic_int coin_bucket;      //<<< The coin bucket for the current burst bitrate, packed
+                                 // with its group, see COIN_BUCKET_GROUP_SHIFT.
+    atomic_int burst_bitrate;    //<<< The current burst bitrate.
+    WhistTimer creation_timer;   //<<< The timer that the refill intervals are measured with.
+    atomic_int last_fill_interval;  //<<< The index of the interval of the last refill.
+    atomic_int group_id;     //<<< id of the group of packets being sent in the current burst.
+    atomic_int num_waiters;  //<<< The number of threads in network_throttler_wait_byte_allocation
+    atomic_int destroying;   //<<< Whether the context is being destroyed.
     bool fill_bucket_initially;  //<<< Whether the coin bucket should be filled up initially
+    uint64_t next_launch_time_ns;   //<<< The earliest launch time of the next scheduled packet.
+    uint64_t last_launch_interval;  //<<< The refill interval of the last scheduled launch time.
 };
 
+static int get_current_interval(NetworkThrottleContext* ctx) {
+    /*
+        Get the index of the refill interval that we're currently in.
+    */
+    return (int)(get_timer(&ctx->creation_timer) * MS_IN_SECOND / ctx->coin_bucket_ms);
+}
+
+static int pack_coin_bucket(int group_id, int coins) {
+    return (int)(((unsigned int)group_id << COIN_BUCKET_GROUP_SHIFT) | (unsigned int)coins);
+}
+
+static int get_coins(int packed_coin_bucket) {
+    return packed_coin_bucket & COIN_BUCKET_MAX_COINS;
+}
+
+static int get_coin_group_id(int packed_coin_bucket, int group_id) {
+    /*
+        Get the full ID of the group that a packed coin bucket's coins belong to, given a
+        group_id that was read right before the coin bucket. The coin bucket's group is
+        at most one refill behind, or a few refills ahead of it.
+    */
+    int8_t delta = (int8_t)(((unsigned int)packed_coin_bucket >> COIN_BUCKET_GROUP_SHIFT) -
+                            ((unsigned int)group_id & 0xFF));
+    return group_id + delta;
+}
+
+static bool refill_coin_bucket(NetworkThrottleContext* ctx) {
+    /*
+        Refill the coin bucket, if a new interval has started since the last fill.
+        Any thread may call this, the bucket is refilled at most once per interval.
+
+        Returns:
+            (bool): True if this call refilled the bucket, which starts a new group.
+    */
+    int last_fill_interval = atomic_load(&ctx->last_fill_interval);
+    int current_interval = get_current_interval(ctx);
+    if (current_interval <= last_fill_interval ||
+        !atomic_compare_exchange_strong(&ctx->last_fill_interval, &last_fill_interval,
+                                        current_interval)) {
+        // Either it's too early, or another thread has just refilled the bucket
+        return false;
+    }
+
+    // The new group ID is published before the coins that carry its low bits,
+    // see get_coin_group_id
+    int group_id = atomic_fetch_add(&ctx->group_id, 1) + 1;
+
+    int coin_bucket_max = atomic_load(&ctx->coin_bucket_max);
+    int coin_bucket = atomic_load(&ctx->coin_bucket);
+    int new_coin_bucket;
+    do {
+        // If the previous bucket is almost consumed(less than one UDP packet available), then
+        // add remaining coins to the next bucket. Otherwise ignore the remaining coins.
+        int coins = get_coins(coin_bucket);
+        if (coins < (int)udp_packet_max_size())
+            new_coin_bucket = min(coins + coin_bucket_max, COIN_BUCKET_MAX_COINS);
+        else
+            new_coin_bucket = coin_bucket_max;
+    } while (!atomic_compare_exchange_weak(&ctx->coin_bucket, &coin_bucket,
+                                           pack_coin_bucket(group_id, new_coin_bucket)));
+    return true;
+}
+
+static bool try_spend_coins(NetworkThrottleContext* ctx, int bytes, int* group_id) {
+    /*
+        Take `bytes` coins out of the coin bucket, if there are enough of them.
+
+        Arguments:
+            ctx (NetworkThrottlerContext*): The network throttler context.
+            bytes (int): The number of coins to take.
+            group_id (int*): Receives the ID of the group that the coins belong to.
+
+        Returns:
+            (bool): True if the coins were taken.
+    */
+    int latest_group_id;
+    int coin_bucket;
+    do {
+        // The group ID must be read first, see get_coin_group_id
+        latest_group_id = atomic_load(&ctx->group_id);
+        coin_bucket = atomic_load(&ctx->coin_bucket);
+        if (bytes > get_coins(coin_bucket)) {
+            return false;
+        }
+        // Fails if a refill got in between, so the coins that we take are those of the
+        // group that coin_bucket says they are
+    } while (!atomic_compare_exchange_weak(&ctx->coin_bucket, &coin_bucket, coin_bucket - bytes));
+    *group_id = get_coin_group_id(coin_bucket, latest_group_id);
+    return true;
+}
+
+static void pace_until(NetworkThrottleContext* ctx, double deadline_sec) {
+    /*
+        Block the current thread until `deadline_sec` seconds after the creation of the
+        throttler. The thread sleeps until PACING_BUSY_WAIT_US before the deadline,
+        and busy-waits from there on.
+    */
+    double sleep_sec = deadline_sec - get_timer(&ctx->creation_timer) -
+                       (double)PACING_BUSY_WAIT_US / US_IN_SECOND;
+    if (sleep_sec > 0.0) {
+#if OS_IS(OS_LINUX)
+        struct timespec sleep_time;
+        sleep_time.tv_sec = (time_t)sleep_sec;
+        sleep_time.tv_nsec = (long)((sleep_sec - (double)sleep_time.tv_sec) * US_IN_SECOND *
+                                    NS_IN_US);
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep_time, NULL);
+#else
+        whist_usleep((uint32_t)(sleep_sec * US_IN_SECOND));
+#endif
+    }
+    while (get_timer(&ctx->creation_timer) < deadline_sec) {
+        PACING_SPIN_PAUSE();
+    }
+}
+
 NetworkThrottleContext* network_throttler_create(double coin_bucket_ms,
                                                  bool fill_bucket_initially) {
     /*
@@ -36,22 +195,24 @@ NetworkThrottleContext* network_throttler_create(double coin_bucket_ms,
     */
     NetworkThrottleContext* ctx = safe_malloc(sizeof(NetworkThrottleContext));
     ctx->coin_bucket_ms = coin_bucket_ms;
-    ctx->coin_bucket_max = (size_t)((ctx->coin_bucket_ms / MS_IN_SECOND) *
-                                    (STARTING_THROTTLER_BITRATE / BITS_IN_BYTE));
+    int coin_bucket_max = (int)((ctx->coin_bucket_ms / MS_IN_SECOND) *
+                                (STARTING_THROTTLER_BITRATE / BITS_IN_BYTE));
+    atomic_init(&ctx->coin_bucket_max, coin_bucket_max);
+    // The coins belong to group 0
     if (fill_bucket_initially) {
-        ctx->coin_bucket = ctx->coin_bucket_max;
+        atomic_init(&ctx->coin_bucket, pack_coin_bucket(0, coin_bucket_max));
     } else {
-        ctx->coin_bucket = 0;
+        atomic_init(&ctx->coin_bucket, pack_coin_bucket(0, 0));
     }
-    ctx->burst_bitrate = STARTING_THROTTLER_BITRATE;
-    ctx->queue_lock = whist_create_mutex();
-    ctx->queue_cond = whist_create_cond();
-    atomic_init(&ctx->next_queue_id, 0);
-    atomic_init(&ctx->current_queue_id, 0);
-    ctx->group_id = 0;
-    ctx->destroying = false;
+    atomic_init(&ctx->burst_bitrate, STARTING_THROTTLER_BITRATE);
+    atomic_init(&ctx->last_fill_interval, 0);
+    atomic_init(&ctx->group_id, 0);
+    atomic_init(&ctx->num_waiters, 0);
+    atomic_init(&ctx->destroying, 0);
     ctx->fill_bucket_initially = fill_bucket_initially;
-    start_timer(&ctx->coin_bucket_last_fill);
+    ctx->next_launch_time_ns = 0;
+    ctx->last_launch_interval = 0;
+    start_timer(&ctx->creation_timer);
 
     return ctx;
 }
@@ -65,27 +226,22 @@ void network_throttler_destroy(NetworkThrottleContext* ctx) {
     */
     if (!ctx) return;
 
-    LOG_INFO("Flushing queue for network throttler %p", ctx);
+    LOG_INFO("Waiting for the pacing threads of network throttler %p", ctx);
 
-    ctx->destroying = true;
+    atomic_store(&ctx->destroying, 1);
 
-    while (atomic_load(&ctx->current_queue_id) != atomic_load(&ctx->next_queue_id)) {
-        // Wait until the packet queue is empty
+    while (atomic_load(&ctx->num_waiters) > 0) {
+        // Waiters are done within one refill interval
         whist_sleep(10);
     }
 
     LOG_INFO("Destroying and freeing network throttler %p", ctx);
 
-    // At this point, we have guaranteed that no thread is waiting
-    // on the condition variable and that no thread is currently
-    // in charge of processing the queue. So we can safely destroy
-    // everything. Note that technically, we should also ensure
-    // that no thread is trying to set the burst bitrate at this
-    // moment, but for now we just assume that the caller is
-    // smart about that.
+    // At this point, we have guaranteed that no thread is waiting for coins.
+    // Note that technically, we should also ensure that no thread is trying
+    // to set the burst bitrate at this moment, but for now we just assume
+    // that the caller is smart about that.
 
-    whist_destroy_mutex(ctx->queue_lock);
-    whist_destroy_cond(ctx->queue_cond);
     free(ctx);
 }
 
@@ -99,20 +255,28 @@ void network_throttler_set_burst_bitrate(NetworkThrottleContext* ctx, int burst_
     */
     if (!ctx) return;
 
-    size_t coin_bucket_max =
-        (size_t)((ctx->coin_bucket_ms / MS_IN_SECOND) * (burst_bitrate / BITS_IN_BYTE));
+    // The coin bucket can't hold more than COIN_BUCKET_MAX_COINS, which is over 25Gbps for 5ms
+    int coin_bucket_max =
+        (int)min((ctx->coin_bucket_ms / MS_IN_SECOND) * (burst_bitrate / BITS_IN_BYTE),
+                 (double)COIN_BUCKET_MAX_COINS);
+
+    // We assume that only one thread is writing this at a time.
+    // Multiple threads may read this concurrently.
+    int old_coin_bucket_max = atomic_exchange(&ctx->coin_bucket_max, coin_bucket_max);
+    atomic_store(&ctx->burst_bitrate, burst_bitrate);
 
     // Add difference between previous max value and current max value to account for change in
     // bitrate
     if (ctx->fill_bucket_initially) {
-        ctx->coin_bucket = max(ctx->coin_bucket + coin_bucket_max - ctx->coin_bucket_max, 0);
+        int coin_bucket = atomic_load(&ctx->coin_bucket);
+        int new_coin_bucket;
+        do {
+            // The coins stay in the group that they belong to
+            int coins = get_coins(coin_bucket) + coin_bucket_max - old_coin_bucket_max;
+            new_coin_bucket = coin_bucket - get_coins(coin_bucket) +
+                              min(max(coins, 0), COIN_BUCKET_MAX_COINS);
+        } while (!atomic_compare_exchange_weak(&ctx->coin_bucket, &coin_bucket, new_coin_bucket));
     }
-    // We assume that only one thread is writing this at a time.
-    // Multiple threads may read this concurrently. If we want
-    // to support multiple threads, we need to lock a mutex around
-    // accesses to `burst_bitrate`.
-    ctx->burst_bitrate = burst_bitrate;
-    ctx->coin_bucket_max = coin_bucket_max;
 }
 
 int network_throttler_wait_byte_allocation(NetworkThrottleContext* ctx, size_t bytes) {
@@ -123,46 +287,118 @@ int network_throttler_wait_byte_allocation(NetworkThrottleContext* ctx, size_t b
             ctx (NetworkThrottlerContext*): The network throttler context.
             bytes (size_t): The number of bytes that will be sent.
     */
-    if (!ctx || ctx->burst_bitrate <= 0 || ctx->destroying) return -1;
+    if (!ctx || atomic_load(&ctx->burst_bitrate) <= 0 || atomic_load(&ctx->destroying)) return -1;
 
-    int queue_id = atomic_fetch_add(&ctx->next_queue_id, 1);
-    whist_lock_mutex(ctx->queue_lock);
-    while (queue_id > atomic_load(&ctx->current_queue_id)) {
-        whist_wait_cond(ctx->queue_cond, ctx->queue_lock);
-    }
-    whist_unlock_mutex(ctx->queue_lock);
+    atomic_fetch_add(&ctx->num_waiters, 1);
 
-    // Now we have the guarantee that this is the next quued packet.
-    // This thread now assumes the responsiblity of adding to the
-    // coin bucket at a rate of `burst_bitrate` bytes per second.
-    // Once there are enough coins in the bucket, we can actually
-    // send the packet.
+    // Once there are enough coins in the bucket, we can actually send the packet.
+    // Otherwise, wait for the refill at the start of the next interval.
     WhistTimer start;
     start_timer(&start);
-    do {
-        if ((get_timer(&ctx->coin_bucket_last_fill) * MS_IN_SECOND) > ctx->coin_bucket_ms) {
-            // If the previous bucket is almost consumed(less than one UDP packet available), then
-            // add remaining coins to the next bucket. Otherwise ignore the remaining coins.
-            if (ctx->coin_bucket < udp_packet_max_size())
-                ctx->coin_bucket += ctx->coin_bucket_max;
-            else
-                ctx->coin_bucket = ctx->coin_bucket_max;
-            ctx->group_id++;
-            start_timer(&ctx->coin_bucket_last_fill);
-        } else if (bytes > ctx->coin_bucket) {
-            whist_usleep((ctx->coin_bucket_ms * US_IN_MS) -
-                         (get_timer(&ctx->coin_bucket_last_fill) * US_IN_SECOND));
+    int group_id;
+    while (true) {
+        refill_coin_bucket(ctx);
+        if (try_spend_coins(ctx, (int)bytes, &group_id)) {
+            break;
         }
-    } while (bytes > ctx->coin_bucket);
-    ctx->coin_bucket -= bytes;
+        int next_fill_interval = atomic_load(&ctx->last_fill_interval) + 1;
+        pace_until(ctx, next_fill_interval * ctx->coin_bucket_ms / MS_IN_SECOND);
+    }
 
-    // Wake up the next waiter in the queue.
     double time = get_timer(&start);
     log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY, time * MS_IN_SECOND);
     log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY_RATE, time * MS_IN_SECOND / (double)bytes);
-    whist_lock_mutex(ctx->queue_lock);
-    atomic_fetch_add(&ctx->current_queue_id, 1);
-    whist_broadcast_cond(ctx->queue_cond);
-    whist_unlock_mutex(ctx->queue_lock);
-    return ctx->group_id;
+    atomic_fetch_sub(&ctx->num_waiters, 1);
+    return group_id;
+}
+
+bool network_throttler_try_byte_allocation(NetworkThrottleContext* ctx, size_t bytes,
+                                           int* group_id) {
+    /*
+        Try to allocate bytes from the network throttler, without blocking.
+
+        Arguments:
+            ctx (NetworkThrottlerContext*): The network throttler context.
+            bytes (size_t): The number of bytes that will be sent.
+            group_id (int*): Receives the ID of the current burst's group of packets.
+
+        Returns:
+            (bool): True if the bytes were allocated.
+    */
+    if (!ctx || atomic_load(&ctx->burst_bitrate) <= 0 || atomic_load(&ctx->destroying)) {
+        // Mirror network_throttler_wait_byte_allocation, which doesn't throttle in these cases
+        *group_id = -1;
+        return true;
+    }
+
+    refill_coin_bucket(ctx);
+    if (!try_spend_coins(ctx, (int)bytes, group_id)) {
+        return false;
+    }
+
+    // Keep the delay statistics comparable with network_throttler_wait_byte_allocation
+    log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY, 0.0);
+    log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY_RATE, 0.0);
+    return true;
+}
+
+#if OS_IS(OS_LINUX)
+int network_throttler_schedule_byte_allocation(NetworkThrottleContext* ctx, size_t bytes,
+                                               uint64_t* launch_time_ns) {
+    /*
+        Schedule bytes to be sent at the burst bitrate, by giving them a launch time
+        for the kernel to hold them until, rather than blocking until they may be sent.
+
+        Arguments:
+            ctx (NetworkThrottlerContext*): The network throttler context.
+            bytes (size_t): The number of bytes that will be sent.
+            launch_time_ns (uint64_t*): Receives the CLOCK_MONOTONIC time at which the bytes
+                may be sent, in nanoseconds, or 0 if they may be sent right away.
+
+        Returns:
+            (int): The ID of the group of packets that the bytes belong to.
+    */
+    *launch_time_ns = 0;
+    if (!ctx || atomic_load(&ctx->destroying)) {
+        return -1;
+    }
+    int burst_bitrate = atomic_load(&ctx->burst_bitrate);
+    if (burst_bitrate <= 0) {
+        return -1;
+    }
+
+    struct timespec now_time;
+    clock_gettime(CLOCK_MONOTONIC, &now_time);
+    uint64_t now = (uint64_t)now_time.tv_sec * US_IN_SECOND * NS_IN_US + now_time.tv_nsec;
+    uint64_t coin_bucket_ns = (uint64_t)(ctx->coin_bucket_ms * NS_IN_MS);
+
+    // Don't let the kernel hold on to more than a coin bucket's worth of packets,
+    // since they would otherwise pile up in the socket's send buffer
+    if (ctx->next_launch_time_ns > now + coin_bucket_ns) {
+        uint64_t wait_ns = ctx->next_launch_time_ns - coin_bucket_ns - now;
+        pace_until(ctx,
+                   get_timer(&ctx->creation_timer) + (double)wait_ns / NS_IN_MS / MS_IN_SECOND);
+        now += wait_ns;
+    }
+
+    // Packets are spaced out evenly at the burst bitrate, rather than sent in bursts.
+    // An idle throttler doesn't build up any credit.
+    uint64_t launch_time = max(ctx->next_launch_time_ns, now);
+    ctx->next_launch_time_ns =
+        launch_time + (uint64_t)(bytes * BITS_IN_BYTE * US_IN_SECOND * NS_IN_US / burst_bitrate);
+
+    // The packets that launch in the same coin bucket interval form a group
+    uint64_t launch_interval = launch_time / coin_bucket_ns;
+    if (launch_interval != ctx->last_launch_interval) {
+        ctx->last_launch_interval = launch_interval;
+        atomic_fetch_add(&ctx->group_id, 1);
+    }
+
+    double delay_ms = (double)(launch_time - now) / NS_IN_MS;
+    log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY, delay_ms);
+    log_double_statistic(NETWORK_THROTTLED_PACKET_DELAY_RATE, delay_ms / (double)bytes);
+
+    *launch_time_ns = launch_time;
+    return atomic_load(&ctx->group_id);
 }
+#endif  // Linux
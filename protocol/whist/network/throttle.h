@@ -2,6 +2,7 @@
 #define WHIST_NETWORK_THROTTLE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #if !OS_IS(OS_WIN32)
 #include <sys/types.h>
@@ -46,4 +47,42 @@ void network_throttler_set_burst_bitrate(NetworkThrottleContext* ctx, int burst_
  */
 int network_throttler_wait_byte_allocation(NetworkThrottleContext* ctx, size_t bytes);
 
+/**
+ * @brief                    Try to allocate bytes from the network throttler,
+ *                           without ever blocking the current thread.
+ *
+ * @param ctx                The network throttler context.
+ * @param bytes              The number of bytes that will be sent.
+ * @param group_id           Receives the ID of group of packets that are being sent in the current
+ *                           burst interval, if the allocation succeeded
+ *
+ * @return                   True if the bytes were allocated, false if the caller would have to
+ *                           wait in network_throttler_wait_byte_allocation instead
+ */
+bool network_throttler_try_byte_allocation(NetworkThrottleContext* ctx, size_t bytes,
+                                           int* group_id);
+
+#if OS_IS(OS_LINUX)
+/**
+ * @brief                    Allocate bytes from the network throttler without waiting for the
+ *                           coin bucket, by scheduling them to be sent at the burst bitrate.
+ *                           The caller must hand the launch time to the kernel with SO_TXTIME,
+ *                           which holds on to the packet until then.
+ *                           This only blocks if more than a coin bucket's worth of bytes has
+ *                           already been scheduled ahead of time.
+ *                           Only one thread may schedule bytes at a time.
+ *
+ * @param ctx                The network throttler context.
+ * @param bytes              The number of bytes that will be sent.
+ * @param launch_time_ns     Receives the CLOCK_MONOTONIC time at which the bytes may be sent,
+ *                           in nanoseconds, or 0 if they may be sent right away
+ *
+ * @return                   Returns the ID of the group of packets that the bytes belong to,
+ *                           where a group is made of the packets launched in the same coin
+ *                           bucket interval
+ */
+int network_throttler_schedule_byte_allocation(NetworkThrottleContext* ctx, size_t bytes,
+                                               uint64_t* launch_time_ns);
+#endif  // Linux
+
 #endif  // WHIST_NETWORK_THROTTLE_H
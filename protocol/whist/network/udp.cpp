@@ -14,9 +14,11 @@ Includes
 extern "C" {
 #include <stddef.h>
 #include "udp.h"
+#include "udp_test.h"
 #include <whist/utils/aes.h>
 #include <whist/fec/fec.h>
 #include <whist/utils/queue.h>
+#include <whist/utils/atomic.h>
 #include <whist/network/network_algorithm.h>
 #include <whist/network/ringbuffer.h>
 #include <whist/logging/log_statistic.h>
@@ -30,6 +32,15 @@ extern "C" {
 #include <fcntl.h>
 #endif
 
+#if OS_IS(OS_LINUX)
+#include <sys/socket.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
+#endif
+
 /*
 ============================
 Defines
@@ -46,6 +57,7 @@ typedef enum {
     UDP_NETWORK_SETTINGS,
     UDP_CONNECTION_ATTEMPT,
     UDP_CONNECTION_CONFIRMATION,
+    UDP_RANGE_NACK,
 } UDPPacketType;
 
 // A struct for UDPPacket,
@@ -70,6 +82,8 @@ typedef struct {
         } udp_nack_data;
 
         // UDP_BITARRAY_NACK
+        // Nacks for index i of frame id, for every bit i from index up to numBits
+        // that's set in ba_raw, in the bit order of BitArray
         struct {
             WhistPacketType type;
             int id;
@@ -78,6 +92,17 @@ typedef struct {
             unsigned char ba_raw[BITS_TO_CHARS(MAX_VIDEO_PACKETS)];
         } udp_bitarray_nack_data;
 
+        // UDP_RANGE_NACK
+        // Nacks for first_index + i of frame id, for every bit i that's set in ba_raw,
+        // in the bit order of BitArray. Only the bytes that hold num_bits bits are sent.
+        struct {
+            WhistPacketType type;
+            int id;
+            int first_index;
+            int num_bits;
+            unsigned char ba_raw[BITS_TO_CHARS(MAX_VIDEO_PACKETS)];
+        } udp_range_nack_data;
+
         // UDP_STREAM_RESET
         struct {
             WhistPacketType whist_type;
@@ -104,6 +129,13 @@ typedef struct {
     };
 } UDPPacket;
 
+// Retransmissions are marked as a response to a nack, or as a duplicate that's sent to saturate
+// the bandwidth, inside of the encrypted segment, so that the flags are authenticated like the
+// rest of it. Compact segments carry these flags in their first byte, see
+// UDP_COMPACT_SEGMENT_HEADER_SIZE, and full segments in is_a_nack and is_a_duplicate.
+#define UDP_RETRANSMISSION_FLAG_NACK 0x01
+#define UDP_RETRANSMISSION_FLAG_DUPLICATE 0x02
+
 // The struct that actually gets sent over the network
 typedef struct {
     // AES Metadata needed to decrypt the payload
@@ -142,6 +174,78 @@ typedef struct {
 // Let's choose a nearest power of two, greater than (UDP_PONG_TIMEOUT_SEC / UDP_PING_INTERVAL_SEC)
 #define MAX_PINGS_IN_FLIGHT 256
 
+// Whether or not to pull several datagrams out of the socket with a single recvmmsg() call.
+// recvmmsg is Linux-only, other platforms will receive one datagram per recv() call.
+#define UDP_RECV_BATCHING OS_IS(OS_LINUX)
+// Maximum number of datagrams that a single recvmmsg() call will pull out of the socket
+#define UDP_RECV_BATCH_SIZE 32
+// Maximum number of datagrams that a single udp_update call will process,
+// before it returns so that nacking/stream resets get a chance to run
+#define UDP_RECV_PACKET_BUDGET UDP_RECV_BATCH_SIZE
+
+// Whether or not to send throttled video segments in batches with a single sendmmsg() call.
+// sendmmsg is Linux-only, other platforms will send one datagram per send() call.
+#define UDP_SEND_BATCHING OS_IS(OS_LINUX)
+// Maximum number of datagrams that a single sendmmsg() call will send out
+#define UDP_SEND_BATCH_SIZE 64
+// Whether or not the kernel can pace throttled video segments with SO_TXTIME, when the
+// KERNEL_PACING feature is enabled. The launch times are handed over through the send batch.
+#define UDP_KERNEL_PACING UDP_SEND_BATCHING
+// Maximum number of pieces that a payload passed to udp_send_packet_iov may be scattered across
+#define UDP_MAX_SEND_IOVECS 32
+// Number of crypto workers that encrypt the segments of a video frame in parallel,
+// when the PARALLEL_ENCRYPTION feature is enabled
+#define UDP_NUM_ENCRYPTION_WORKERS 3
+// How many FEC buffers the FEC worker computes at a time, before handing them to the video send
+// thread, so that the first FEC buffers can go out while the rest are still being computed
+#define UDP_FEC_WORKER_BATCH_SIZE 4
+// Size of the part of a whist segment's UDPPacket that precedes the segment's data
+#define UDP_WHIST_SEGMENT_HEADER_SIZE offsetof(UDPPacket, udp_whist_segment_data.segment_data)
+
+// The peers agree on a wire format during the handshake, which is a version of the whist segment
+// header, plus a set of independent UDP_CAPABILITY_* bits. The client offers the newest version
+// and all capabilities that it knows, in the group_id of its UDP_CONNECTION_ATTEMPT, and the
+// server answers with the version and capabilities that both sides will use, in the group_id of
+// its UDP_CONNECTION_CONFIRMATION. Both are tagged with UDP_WIRE_FORMAT_MAGIC. Peers that predate
+// this leave the group_id of their handshake packets uninitialized, so anything but an exactly
+// tagged group_id is taken to come from such a peer, which gets the full UDPPacket header and no
+// capabilities. Either header can always be received, since they can be told apart by their
+// first byte.
+#define UDP_WIRE_VERSION_FULL 0
+// Compact whist segment headers
+#define UDP_WIRE_VERSION_COMPACT 1
+#define UDP_WIRE_VERSION_NEWEST UDP_WIRE_VERSION_COMPACT
+// Video frames may use Wirehair FEC, for the frames that fec_get_frame_scheme picks it for.
+// The server only accepts this when the WIREHAIR_FEC feature is enabled.
+#define UDP_CAPABILITY_WIREHAIR_FEC 0x01
+// The missing indices of a frame are nacked together, with UDP_RANGE_NACK messages
+#define UDP_CAPABILITY_RANGE_NACK 0x02
+#define UDP_CAPABILITIES_KNOWN (UDP_CAPABILITY_WIREHAIR_FEC | UDP_CAPABILITY_RANGE_NACK)
+#define UDP_WIRE_FORMAT_MAGIC 0x57460000
+// A tagged group_id holds the capabilities in its low byte, and the version above them,
+// in the 3 bits that a compact header has for it
+#define UDP_WIRE_FORMAT_CAPABILITIES_MASK 0x00FF
+#define UDP_WIRE_FORMAT_VERSION_SHIFT 8
+#define UDP_WIRE_FORMAT_VERSION_MASK 0x0700
+// A compact whist segment header is packed little-endian, as follows:
+//   [0]      Bit 7 is always set, which tells it apart from the UDPPacketType that a full
+//            UDPPacket starts with. Bits 4-6 are the wire version, bits 2-3 the
+//            UDP_RETRANSMISSION_FLAG_*, and bits 0-1 the WhistPacketType.
+//   [1, 3)   The low 16 bits of the group ID, which are unwrapped by the receiver
+//   [3, 7)   The departure time in microseconds since departure_time_base, modulo 2^32,
+//            which is unwrapped by the receiver. Only departure time differences matter.
+//   [7, 11)  id
+//   [11, 21) index, num_indices, num_fec_indices, segment_size, prev_frame_num_duplicates
+// This saves 19 of the 40 bytes that a full UDPPacket header takes up.
+#define UDP_COMPACT_SEGMENT_HEADER_SIZE 21
+#define UDP_COMPACT_SEGMENT_FLAG 0x80
+#define UDP_COMPACT_SEGMENT_RETRANSMISSION_SHIFT 2
+#define UDP_COMPACT_SEGMENT_RETRANSMISSION_MASK 0x0C
+#define UDP_COMPACT_SEGMENT_TYPE_MASK 0x03
+// Number of decrypted packets that the receive thread can queue up for udp_update,
+// which is ~100ms of video at 100Mbps
+#define UDP_RECV_QUEUE_SIZE 1024
+
 typedef struct {
     bool pending_stream_reset;
     int greatest_failed_id;
@@ -152,18 +256,111 @@ typedef struct IncomingBitrate {
     int num_bits;
 } IncomingBitrate;
 
-typedef struct NackID {
+// The nacks of a single nack message, which the video thread services together
+typedef struct NackBatch {
     int frame_id;
-    int packet_index;
-} NackID;
+    // The first index that's nacked, or -1 to nack every index of the frame
+    int first_index;
+    // The number of bits in indices, bit i being set if first_index + i is nacked
+    int num_bits;
+    unsigned char indices[BITS_TO_CHARS(MAX_VIDEO_PACKETS)];
+} NackBatch;
+
+// How many nack batches can be queued up for each frame in the video nack buffer
+#define NACK_BATCHES_PER_FRAME 32
+
+// A video segment that has been allocated bytes by the network throttler,
+// and is waiting for a crypto worker to encrypt it into the nack buffer
+typedef struct {
+    // The segment's header in the negotiated wire format, since the UDPPacket lives on the stack
+    alignas(UDPPacket) char udp_packet_header[UDP_WHIST_SEGMENT_HEADER_SIZE];
+    // The header, followed by the pieces of the segment's data
+    WhistIOVec plaintext_iov[UDP_MAX_SEND_IOVECS + 1];
+    int plaintext_iov_count;
+    UDPNetworkPacket* udp_network_packet;
+    // The time at which the kernel should send the segment, or 0 to send it right away
+    uint64_t launch_time_ns;
+    // The nack buffer validity of the segment, which is set once the segment has been sent
+    bool* nack_buffer_valid;
+} UDPEncryptionJob;
+
+// A pool of crypto workers, that encrypt the segments of a video frame in parallel,
+// while the video send thread keeps throttling the segments and sending them out in order
+typedef struct {
+    WhistThread workers[UDP_NUM_ENCRYPTION_WORKERS];
+    bool run_workers;
+    // Posted once for every submitted job, and once for every worker when shutting down
+    WhistSemaphore job_semaphore;
+    // Posted once for every finished job
+    WhistSemaphore done_semaphore;
+    // The jobs of the frame that's currently being sent.
+    // jobs[0, num_submitted) have been submitted, and jobs[0, num_transmitted) have been sent
+    UDPEncryptionJob* jobs;
+    atomic_int* job_done;
+    int max_jobs;
+    int num_submitted;
+    int num_transmitted;
+    // The index of the next job that a worker will pick up
+    atomic_int next_job;
+    // The number of done_semaphore posts that the send thread has consumed for this frame
+    int num_done_waited;
+} UDPEncryptionPool;
+
+// A helper thread that computes the FEC buffers of a video frame,
+// while the video send thread is already sending out the frame's original buffers
+typedef struct {
+    WhistThread thread;
+    bool run_worker;
+    // Posted once for every submitted FEC encoder, and once when shutting down
+    WhistSemaphore job_semaphore;
+    // Posted once for every UDP_FEC_WORKER_BATCH_SIZE FEC buffers of the submitted FEC encoder
+    // that have been computed, in order, the last batch being posted even if it's smaller
+    WhistSemaphore done_semaphore;
+    // The FEC encoder of the frame that's currently being sent, and its number of FEC buffers
+    FECEncoder* fec_encoder;
+    int num_fec_buffers;
+    // The time it took to compute its FEC buffers, in seconds
+    double encode_time;
+    // How many FEC buffers the send thread has taken so far,
+    // and how long it has waited for them, in seconds
+    int num_taken;
+    double wait_time;
+} UDPFECWorker;
+
+// A packet that the receive thread has pulled from the socket and decrypted
+typedef struct {
+    UDPPacket udp_packet;
+    timestamp_us arrival_time;
+    int network_payload_size;
+} UDPReceivedPacket;
+
+// A bounded single-producer single-consumer queue of received packets,
+// from the receive thread to the thread that calls udp_update.
+// packets[head, tail) are ready to be processed, and one slot is always left empty,
+// so that head == tail means that the queue is empty.
+typedef struct {
+    WhistThread thread;
+    atomic_int run_thread;
+    // Posted whenever the receive thread has queued up a batch of packets.
+    // Stale posts are drained by the consumer before it waits on an empty queue.
+    WhistSemaphore packets_available;
+    // Only written to by the consumer
+    atomic_int head;
+    // Only written to by the receive thread
+    atomic_int tail;
+    // Packets that had to be dropped since the queue was full
+    atomic_int num_dropped;
+    UDPReceivedPacket packets[UDP_RECV_QUEUE_SIZE];
+} UDPReceiveQueue;
 
 // An instance of the UDP Context
 typedef struct {
     int timeout;
     SOCKET socket;
     int ack;
-    WhistMutex mutex;
     char binary_aes_private_key[16];
+    // Pre-keyed cipher contexts, shared by the sending and receiving threads
+    AESSession* aes_session;
     NetworkThrottleContext* network_throttler;
 
     double fec_packet_ratios[NUM_PACKET_TYPES];
@@ -193,15 +390,25 @@ typedef struct {
     int last_start_of_stream_id[NUM_PACKET_TYPES];
 
     // Nack Buffer Data
-    UDPPacket** nack_buffers[NUM_PACKET_TYPES];
+    // The segments are stored wire-ready, i.e. already encrypted,
+    // so that nacks can be served without encrypting them again
+    UDPNetworkPacket** nack_buffers[NUM_PACKET_TYPES];
     // Whether or not a nack buffer is being used right now
     bool** nack_buffer_valid[NUM_PACKET_TYPES];
+    // The ID and number of indices of the packet stored in each nack buffer,
+    // since the stored segments themselves can't be read without decrypting them
+    int* nack_buffer_ids[NUM_PACKET_TYPES];
+    int* nack_buffer_num_indices[NUM_PACKET_TYPES];
+    // The FEC encoder of each type, which is reset for every packet that needs to be FEC encoded,
+    // so that encoding doesn't allocate
+    FECEncoder* fec_encoders[NUM_PACKET_TYPES];
     // This mutex will protect the data in nack_buffers
     WhistMutex nack_mutex[NUM_PACKET_TYPES];
     int nack_num_buffers[NUM_PACKET_TYPES];
     int nack_buffer_max_indices[NUM_PACKET_TYPES];
     int nack_buffer_max_payload_size[NUM_PACKET_TYPES];
     int num_duplicate_packets[NUM_PACKET_TYPES];
+    UDPSendStatistics send_statistics[NUM_PACKET_TYPES];
     RingBuffer* ring_buffers[NUM_PACKET_TYPES];
 
     StreamResetData reset_data[NUM_PACKET_TYPES];
@@ -224,6 +431,71 @@ typedef struct {
     void* nack_queue;
 
     void* fec_controller;
+    // Created on first use, since the features that pick its algorithm are only known once the
+    // server has sent them
+    CongestionController* congestion_controller;
+
+#if UDP_RECV_BATCHING
+    // Datagrams that have been pulled from the socket by recvmmsg, but not yet processed.
+    // Only recv_batch_packets[recv_batch_index, recv_batch_count) are still pending.
+    UDPNetworkPacket recv_batch_packets[UDP_RECV_BATCH_SIZE];
+    struct mmsghdr recv_batch_msgs[UDP_RECV_BATCH_SIZE];
+    struct iovec recv_batch_iovecs[UDP_RECV_BATCH_SIZE];
+    struct sockaddr_in recv_batch_addrs[UDP_RECV_BATCH_SIZE];
+    // Receives the SO_TIMESTAMPNS arrival time of each datagram
+    char recv_batch_control[UDP_RECV_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+    int recv_batch_count;
+    int recv_batch_index;
+    // The time at which each datagram of the current batch arrived
+    timestamp_us recv_batch_arrival_times[UDP_RECV_BATCH_SIZE];
+#endif
+
+#if UDP_SEND_BATCHING
+    // Encrypted video segments of the current throttler group, that have been allocated bytes by
+    // the network throttler but haven't been handed to sendmmsg yet.
+    // The iovecs point straight into the video nack buffer, which is only written to by the
+    // video send thread, so only the video send thread may touch these, see udp_transmit_segment
+    struct mmsghdr send_batch_msgs[UDP_SEND_BATCH_SIZE];
+    struct iovec send_batch_iovecs[UDP_SEND_BATCH_SIZE];
+    // Retransmissions are encrypted again into the slot of their place in the batch instead,
+    // since the nack buffer slot that they're resent from may be pointed at by the batch
+    UDPNetworkPacket send_batch_resends[UDP_SEND_BATCH_SIZE];
+    int send_batch_count;
+    // The throttler group ID that all of the batched segments belong to
+    int send_batch_group_id;
+#endif
+
+#if UDP_KERNEL_PACING
+    // Whether the kernel paces the video segments, in which case the throttler only hands out
+    // launch times, which are attached to the batched segments as SCM_TXTIME control messages
+    bool kernel_pacing;
+    alignas(struct cmsghdr) char
+        send_batch_control[UDP_SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint64_t))];
+#endif
+
+    // Packets received by the receive thread,
+    // or NULL if udp_update reads the socket by itself
+    UDPReceiveQueue* recv_queue;
+
+    // The version of the whist segment header, as negotiated during the handshake
+    int wire_version;
+    // The UDP_CAPABILITY_* that both peers support, as negotiated during the handshake
+    int wire_capabilities;
+    // The time that the departure times of compact segments are sent relative to
+    timestamp_us departure_time_base;
+    // The last group ID and departure time of a received compact video segment,
+    // which the next ones are unwrapped against. Only touched by the receiving thread.
+    bool received_compact_video;
+    int last_received_group_id;
+    timestamp_us last_received_departure_time;
+
+    // Crypto workers for video segments, or NULL if segments are encrypted on the send thread
+    UDPEncryptionPool* encryption_pool;
+    // Time that the video send thread has spent encrypting, or waiting on the crypto workers,
+    // for the frame that's currently being sent
+    double frame_encrypt_time;
+    // FEC helper for video frames, or NULL if FEC buffers are computed before sending a frame
+    UDPFECWorker* fec_worker;
 } UDPContext;
 
 // Define how many times to retry sending a UDP packet in case of Error 55 (buffer full). The
@@ -384,9 +656,129 @@ int create_udp_client_context(UDPContext* context, const char* destination, int
  *
  * @param udp_packet             The UDPPacket to send.
  *                               This buffer is expected to be of size sizeof(UDPPacket)
+ *
+ * @note                         Whist segments must be sent with udp_send_whist_segment instead
  */
 static int udp_send_udp_packet(UDPContext* context, UDPPacket* udp_packet);
 
+/**
+ * @brief                        Stamps, throttles and encrypts a whist segment, and sends it.
+ *                               The segment's data is gathered from segment_iov while encrypting,
+ *                               and the ciphertext is written straight into udp_network_packet,
+ *                               so that nacks can later resend it as-is with
+ *                               udp_send_network_packet.
+ *
+ * @param udp_packet             The segment's UDPPacket. Only the header is read,
+ *                               i.e. everything before udp_whist_segment_data.segment_data
+ * @param segment_iov            The pieces of the segment's data
+ * @param segment_iov_count      The number of pieces in segment_iov
+ * @param udp_network_packet     The wire-ready packet to write to, usually a nack buffer slot
+ *
+ * @note                         Throttled video segments are batched per throttler group,
+ *                               so udp_network_packet must stay untouched until
+ *                               udp_flush_send_batch has been called.
+ *                               Video segments may only be sent by the video send thread,
+ *                               which must call udp_flush_send_batch when it's done sending
+ */
+static void udp_send_whist_segment(UDPContext* context, UDPPacket* udp_packet,
+                                   const WhistIOVec* segment_iov, int segment_iov_count,
+                                   UDPNetworkPacket* udp_network_packet);
+
+/**
+ * @brief                        Resends a whist segment that has already been encrypted by
+ *                               udp_send_whist_segment, marked as a retransmission.
+ *                               It's encrypted again with the retransmission flags set,
+ *                               without writing to udp_network_packet.
+ *                               Video segments are throttled and batched like in
+ *                               udp_send_whist_segment.
+ *
+ * @param type                   The WhistPacketType of the segment
+ * @param udp_network_packet     The stored wire-ready packet to resend
+ * @param retransmission_flags   UDP_RETRANSMISSION_FLAG_NACK and/or
+ *                               UDP_RETRANSMISSION_FLAG_DUPLICATE
+ */
+static void udp_send_network_packet(UDPContext* context, WhistPacketType type,
+                                    const UDPNetworkPacket* udp_network_packet,
+                                    int retransmission_flags);
+
+/**
+ * @brief                        Sends out any video segments that are pending in the send batch
+ */
+static void udp_flush_send_batch(UDPContext* context);
+
+/**
+ * @brief                        Starts the crypto workers that encrypt video segments in parallel
+ *
+ * @param max_jobs               The maximum number of segments in a video frame
+ */
+static void udp_start_encryption_workers(UDPContext* context, int max_jobs);
+
+/**
+ * @brief                        Stops the crypto workers, if they were started
+ */
+static void udp_stop_encryption_workers(UDPContext* context);
+
+/**
+ * @brief                        Stamps and throttles a video segment, like
+ *                               udp_send_whist_segment, but hands its encryption to the crypto
+ *                               workers. The segment is sent out once it has been encrypted,
+ *                               after every segment that was submitted before it.
+ *
+ * @param udp_packet             The segment's UDPPacket. Only the header is read,
+ *                               and it's copied, so it may be reused right away
+ * @param segment_iov            The pieces of the segment's data,
+ *                               which must stay alive until udp_finish_encryption_jobs
+ * @param segment_iov_count      The number of pieces in segment_iov
+ * @param udp_network_packet     The nack buffer slot to encrypt the segment into
+ * @param nack_buffer_valid      The validity of that nack buffer slot,
+ *                               which is set once the segment has been sent
+ */
+static void udp_submit_whist_segment(UDPContext* context, UDPPacket* udp_packet,
+                                     const WhistIOVec* segment_iov, int segment_iov_count,
+                                     UDPNetworkPacket* udp_network_packet,
+                                     bool* nack_buffer_valid);
+
+/**
+ * @brief                        Sends out the submitted video segments that the crypto workers
+ *                               have finished encrypting, in the order they were submitted
+ *
+ * @param wait_for_all           Whether to wait for every submitted segment to be encrypted,
+ *                               rather than stopping at the first one that isn't done yet.
+ *                               The send batch is flushed whenever this has to wait, so that
+ *                               each segment leaves as soon as it and the ones before it are done
+ */
+static void udp_collect_encryption_jobs(UDPContext* context, bool wait_for_all);
+
+/**
+ * @brief                        Sends out every submitted video segment, and waits until the
+ *                               crypto workers are idle, so that the next frame can reuse the jobs
+ */
+static void udp_finish_encryption_jobs(UDPContext* context);
+
+/**
+ * @brief                        Starts the FEC helper thread, that computes the FEC buffers of
+ *                               video frames while their original buffers are being sent
+ */
+static void udp_start_fec_worker(UDPContext* context);
+
+/**
+ * @brief                        Stops the FEC helper thread, if it was started
+ */
+static void udp_stop_fec_worker(UDPContext* context);
+
+/**
+ * @brief                        Waits until the FEC helper thread has computed an FEC buffer
+ *                               of the frame that's being sent, and gets the FEC buffers that
+ *                               have been handed over with it
+ *
+ * @param fec_encoder            The FEC encoder that was handed to the FEC helper thread
+ * @param fec_index              The FEC buffer that's needed next, counting from 0
+ * @param buffers                The encoded buffers of the frame, see fec_get_encoded_buffers
+ * @param buffer_sizes           The sizes of the encoded buffers
+ */
+static void udp_wait_fec_worker(UDPContext* context, FECEncoder* fec_encoder, int fec_index,
+                                char** buffers, int* buffer_sizes);
+
 /**
  * @brief                        Gets and decrypts a UDPPacket over the network
  *
@@ -408,6 +800,59 @@ static int udp_send_udp_packet(UDPContext* context, UDPPacket* udp_packet);
 static bool udp_get_udp_packet(UDPContext* context, UDPPacket* udp_packet,
                                timestamp_us* arrival_time, int* network_payload_size);
 
+/**
+ * @brief                        Whether or not datagrams from a previous recvmmsg() call
+ *                               are still waiting to be processed.
+ *                               If so, the next udp_get_udp_packet call won't touch the socket.
+ *
+ * @param context                The UDPContext to check
+ *
+ * @returns                      True if there are batched datagrams pending
+ */
+static bool udp_has_batched_packets(UDPContext* context);
+
+/**
+ * @brief                        Gets the next packet of the receive queue
+ *
+ * @param context                The UDPContext whose receive thread is running
+ * @param wait                   Whether to wait up to the socket's timeout for a packet,
+ *                               if the queue is empty
+ *
+ * @returns                      The packet, which stays valid until udp_pop_received_packet,
+ *                               or NULL if none was received
+ */
+static UDPReceivedPacket* udp_peek_received_packet(UDPContext* context, bool wait);
+
+/**
+ * @brief                        Releases the packet returned by udp_peek_received_packet,
+ *                               handing its slot back to the receive thread
+ *
+ * @param context                The UDPContext whose receive thread is running
+ */
+static void udp_pop_received_packet(UDPContext* context);
+
+/**
+ * @brief                        Stops the receive thread, if it's running
+ *
+ * @param context                The UDPContext to stop receiving for
+ */
+static void udp_stop_receive_thread(UDPContext* context);
+
+#if UDP_KERNEL_PACING
+/**
+ * @brief                        Whether the qdisc that the socket's packets leave through
+ *                               holds them until their SO_TXTIME launch time.
+ *                               setsockopt(SO_TXTIME) succeeds on any qdisc, but only fq and
+ *                               etf honor the launch times, the others send right away.
+ *
+ * @param socket_fd              The connected socket to check
+ *
+ * @returns                      True if the interface's root qdisc is fq or etf, or a
+ *                               multiqueue root with only fq or etf under it
+ */
+static bool udp_kernel_pacing_is_enforced(SOCKET socket_fd);
+#endif
+
 /**
  * @brief                        Returns the size, in bytes, of the relevant part of
  *                               the UDPPacket, that must be sent over the network
@@ -420,6 +865,43 @@ static bool udp_get_udp_packet(UDPContext* context, UDPPacket* udp_packet,
  */
 static int get_udp_packet_size(UDPPacket* udp_packet);
 
+/**
+ * @brief                        Writes the header of a whist segment's UDPPacket
+ *                               in the negotiated wire format
+ *
+ * @param context                The UDPContext to send the segment with
+ * @param udp_packet             The whist segment's UDPPacket
+ * @param header                 The buffer to write the header to,
+ *                               of size UDP_WHIST_SEGMENT_HEADER_SIZE
+ *
+ * @returns                      The size of the header, which the segment's data follows
+ */
+static int udp_write_whist_segment_header(UDPContext* context, UDPPacket* udp_packet,
+                                          char* header);
+
+/**
+ * @brief                        Expands a decrypted compact whist segment into a full UDPPacket
+ *
+ * @param context                The UDPContext that received the segment
+ * @param udp_packet             The UDPPacket that the compact segment was decrypted into,
+ *                               which is rewritten in place
+ * @param decrypted_len          The size of the decrypted compact segment
+ *
+ * @returns                      True if udp_packet now holds a valid packet, false otherwise
+ */
+static bool udp_expand_compact_segment(UDPContext* context, UDPPacket* udp_packet,
+                                       int decrypted_len);
+
+/**
+ * @brief                        Gets the FEC scheme negotiated for a stream
+ *
+ * @param context                The UDPContext of the stream
+ * @param type                   The WhistPacketType of the stream
+ *
+ * @returns                      The scheme to pass to fec_get_frame_scheme for the stream's frames
+ */
+static FECScheme udp_get_fec_scheme(UDPContext* context, WhistPacketType type);
+
 // TODO: document
 static void udp_update_ping(UDPContext* context, WhistTimer* current_time);
 
@@ -441,6 +923,10 @@ static void udp_handle_message(UDPContext* context, UDPPacket* packet);
 // Handler functions for the various UDP messages
 static void udp_handle_nack(UDPContext* context, WhistPacketType type, int id, int index,
                             bool is_duplicate);
+// udp_handle_nack, for when the caller holds the type's nack mutex
+static void udp_handle_nack_locked(UDPContext* context, WhistPacketType type, int id, int index,
+                                   bool is_duplicate);
+static void udp_handle_nack_batch(UDPContext* context, const NackBatch* nack_batch);
 static void udp_handle_ping(UDPContext* context, int id, timestamp_us timestamp);
 static void udp_handle_pong(UDPContext* context, int id, timestamp_us ping_send_timestamp);
 static void udp_handle_stream_reset(UDPContext* context, WhistPacketType type,
@@ -473,6 +959,137 @@ static void udp_nack_packet(SocketContext* socket_context, WhistPacketType type,
     udp_send_udp_packet(context, &packet);
 }
 
+/**
+ * @brief                    Pack the nacked indices of a bitset, starting from *index,
+ *                           into a UDP_RANGE_NACK that covers as many of them as fit
+ *                           in its bitarray
+ *
+ * @param packet             The packet to pack the UDP_RANGE_NACK into
+ * @param type               type of packet
+ * @param id                 ID of the frame
+ * @param indices            Bitset of the indices to nack, bit i of word i / 64 being index i
+ * @param num_indices        The number of indices that the bitset covers
+ * @param index              The first index to pack, which is moved past the packed ones
+ *
+ * @returns                  True if the packet nacks anything, false if no index was left
+ */
+static bool udp_pack_range_nack(UDPPacket* packet, WhistPacketType type, int id,
+                                const uint64_t* indices, int num_indices, int* index) {
+    packet->type = UDP_RANGE_NACK;
+    packet->udp_range_nack_data.type = type;
+    packet->udp_range_nack_data.id = id;
+    packet->udp_range_nack_data.first_index = -1;
+    packet->udp_range_nack_data.num_bits = 0;
+    memset(packet->udp_range_nack_data.ba_raw, 0, sizeof(packet->udp_range_nack_data.ba_raw));
+    const int max_bits = (int)sizeof(packet->udp_range_nack_data.ba_raw) * CHAR_BIT;
+    int i;
+    for (i = *index; i < num_indices; i++) {
+        if (indices[i / 64] == 0) {
+            // Skip the rest of this word, since it has nothing to nack
+            i |= 63;
+            continue;
+        }
+        if (((indices[i / 64] >> (i % 64)) & 1) == 0) {
+            continue;
+        }
+        int first_index = packet->udp_range_nack_data.first_index;
+        if (first_index == -1) {
+            first_index = packet->udp_range_nack_data.first_index = i;
+        } else if (i - first_index >= max_bits) {
+            // This one is out of the message's range, so it starts the next one
+            break;
+        }
+        int bit = i - first_index;
+        packet->udp_range_nack_data.ba_raw[bit / CHAR_BIT] |=
+            (unsigned char)(1 << (CHAR_BIT - 1 - bit % CHAR_BIT));
+        packet->udp_range_nack_data.num_bits = bit + 1;
+    }
+    *index = min(i, num_indices);
+    return packet->udp_range_nack_data.first_index != -1;
+}
+
+/**
+ * @brief                    Unpack a received UDP_BITARRAY_NACK or UDP_RANGE_NACK
+ *                           into a nack batch. Everything in it comes from the peer,
+ *                           so it's validated before it's trusted.
+ *
+ * @param packet             The received nack message
+ * @param nack_batch         The nack batch to fill in
+ *
+ * @returns                  True on success, false if the message is malformed
+ *                           and must be dropped
+ */
+static bool udp_unpack_bitarray_nack(const UDPPacket* packet, NackBatch* nack_batch) {
+    const int max_bits = (int)sizeof(nack_batch->indices) * CHAR_BIT;
+    WhistPacketType type;
+    int first_index;
+    int num_bits;
+    if (packet->type == UDP_RANGE_NACK) {
+        type = packet->udp_range_nack_data.type;
+        nack_batch->frame_id = packet->udp_range_nack_data.id;
+        first_index = packet->udp_range_nack_data.first_index;
+        num_bits = packet->udp_range_nack_data.num_bits;
+        if (num_bits <= 0 || num_bits > max_bits || first_index < 0 ||
+            first_index > INT_MAX - num_bits) {
+            return false;
+        }
+        memcpy(nack_batch->indices, packet->udp_range_nack_data.ba_raw, BITS_TO_CHARS(num_bits));
+    } else {
+        // Bit i is index i itself, and the bits before index aren't nacks
+        type = packet->udp_bitarray_nack_data.type;
+        nack_batch->frame_id = packet->udp_bitarray_nack_data.id;
+        int start_bit = packet->udp_bitarray_nack_data.index;
+        num_bits = packet->udp_bitarray_nack_data.numBits;
+        if (num_bits <= 0 || num_bits > max_bits || start_bit < 0 || start_bit >= num_bits) {
+            return false;
+        }
+        first_index = 0;
+        memcpy(nack_batch->indices, packet->udp_bitarray_nack_data.ba_raw,
+               BITS_TO_CHARS(num_bits));
+        for (int bit = 0; bit < start_bit; bit++) {
+            nack_batch->indices[bit / CHAR_BIT] &=
+                (unsigned char)~(1 << (CHAR_BIT - 1 - bit % CHAR_BIT));
+        }
+    }
+    // Only video is nacked, and ID 0 is never a frame
+    if (type != PACKET_VIDEO || nack_batch->frame_id <= 0) {
+        return false;
+    }
+    nack_batch->first_index = first_index;
+    nack_batch->num_bits = num_bits;
+    return true;
+}
+
+/**
+ * @brief                    Send nacks to the server for all of the packets of a frame that the
+ *                           client is missing, in as few UDP_RANGE_NACK messages as possible
+ *
+ * @param socket_context     the context we're sending the nacks over
+ * @param type               type of packet
+ * @param id                 ID of the frame
+ * @param indices            Bitset of the indices to nack, bit i of word i / 64 being index i
+ * @param num_indices        The number of indices that the bitset covers
+ */
+static void udp_nack_bit_array(SocketContext* socket_context, WhistPacketType type, int id,
+                               const uint64_t* indices, int num_indices) {
+    UDPContext* context = (UDPContext*)socket_context->context;
+    if (!(context->wire_capabilities & UDP_CAPABILITY_RANGE_NACK)) {
+        // The server only knows how to handle nacks one index at a time
+        for (int index = 0; index < num_indices; index++) {
+            if ((indices[index / 64] >> (index % 64)) & 1) {
+                udp_nack_packet(socket_context, type, id, index);
+            }
+        }
+        return;
+    }
+
+    UDPPacket packet = {};
+    int index = 0;
+    while (udp_pack_range_nack(&packet, type, id, indices, num_indices, &index)) {
+        udp_send_udp_packet(context, &packet);
+    }
+}
+
 static void udp_request_stream_reset(SocketContext* socket_context, WhistPacketType type,
                                      int greatest_failed_id) {
     UDPContext* context = (UDPContext*)socket_context->context;
@@ -502,6 +1119,26 @@ static void send_desired_network_settings(UDPContext* context) {
     start_timer(&context->last_network_settings_send_time);
 }
 
+/**
+ * @brief                        Get the congestion controller of the connection, creating it with
+ *                               the algorithm that the features pick if there isn't one yet
+ *
+ * @param context                The UDPContext of the connection
+ *
+ * @returns                      The congestion controller
+ */
+static CongestionController* udp_get_congestion_controller(UDPContext* context) {
+    if (context->congestion_controller == NULL) {
+        context->congestion_controller = create_congestion_controller(
+            FEATURE_ENABLED(DELAY_GRADIENT_CONGESTION_CONTROL)
+                ? delay_gradient_get_function_table()
+                : wcc_get_function_table());
+        LOG_INFO("Using %s congestion control",
+                 congestion_controller_get_name(context->congestion_controller));
+    }
+    return context->congestion_controller;
+}
+
 static void udp_congestion_control(UDPContext* context, timestamp_us departure_time,
                                    timestamp_us arrival_time, int group_id) {
     whist_lock_mutex(context->congestion_control_mutex);
@@ -552,10 +1189,10 @@ static void udp_congestion_control(UDPContext* context, timestamp_us departure_t
                     }
                 }
             }
-            send_network_settings = whist_congestion_controller(
-                curr_group_stats, prev_group_stats, incoming_bitrate, packet_loss_ratio,
-                context->short_term_latency, context->long_term_latency, &context->network_settings,
-                context->fec_controller);
+            send_network_settings = congestion_controller_update(
+                udp_get_congestion_controller(context), curr_group_stats, prev_group_stats,
+                incoming_bitrate, packet_loss_ratio, context->short_term_latency,
+                context->long_term_latency, &context->network_settings, context->fec_controller);
         }
         context->prev_group_id = context->curr_group_id;
         context->curr_group_id = group_id;
@@ -569,6 +1206,67 @@ static void udp_congestion_control(UDPContext* context, timestamp_us departure_t
     whist_unlock_mutex(context->congestion_control_mutex);
 }
 
+/**
+ * @brief                        Process a UDPPacket that has just been received,
+ *                               by either storing it into the relevant ringbuffer/pending packet
+ *                               or handling it as a UDP message
+ *
+ * @param context                The UDPContext that received the packet
+ * @param udp_packet             The decrypted UDPPacket
+ * @param arrival_time           The arrival time of the packet
+ * @param network_payload_size   The size of the packet over the network
+ */
+static void udp_handle_received_packet(UDPContext* context, UDPPacket* udp_packet,
+                                       timestamp_us arrival_time, int network_payload_size) {
+    // if the packet is a whist_segment, store the data to give later via get_packet
+    // Otherwise, pass it to udp_handle_message
+    if (udp_packet->type == UDP_WHIST_SEGMENT) {
+        WhistPacketType packet_type = udp_packet->udp_whist_segment_data.whist_type;
+        if (packet_type == PACKET_VIDEO) {
+            add_incoming_bits(context, arrival_time, network_payload_size * BITS_IN_BYTE);
+            if (!udp_packet->udp_whist_segment_data.is_a_nack &&
+                !udp_packet->udp_whist_segment_data.is_a_duplicate) {
+                update_max_unordered_packets(&context->unordered_packet_info,
+                                             udp_packet->udp_whist_segment_data.id,
+                                             udp_packet->udp_whist_segment_data.index);
+                if (udp_packet->group_id >= context->curr_group_id) {
+                    udp_congestion_control(context,
+                                           udp_packet->udp_whist_segment_data.departure_time,
+                                           arrival_time, udp_packet->group_id);
+                }
+            }
+        }
+        // If there's a ringbuffer, store in the ringbuffer to reconstruct the original packet
+        if (context->ring_buffers[packet_type] != NULL) {
+            if (!ring_buffer_receive_segment(context->ring_buffers[packet_type],
+                                             &udp_packet->udp_whist_segment_data)) {
+                // Log when the ringbuffer overflows
+                LOG_ERROR("Ringbuffer overflowed; stream resets have been failing to recover.");
+                // Optionally mark the connection has lost during such an event
+                // context->connection_lost = true;
+            }
+        } else {
+            FATAL_ASSERT(udp_packet->udp_whist_segment_data.num_indices == 1);
+            FATAL_ASSERT(udp_packet->udp_whist_segment_data.num_fec_indices == 0);
+            // if there is no ring buffer (packet is message), store it in the 1-packet buffer
+            // instead memcpy the segment_data (WhistPacket*) into pending_packets
+            memcpy(&context->pending_packets[packet_type],
+                   &udp_packet->udp_whist_segment_data.segment_data,
+                   udp_packet->udp_whist_segment_data.segment_size);
+            if (context->has_pending_packet[packet_type]) {
+                LOG_ERROR(
+                    "get_packet has not been called, unclaimed PACKET_MESSAGE being "
+                    "overwritten!");
+            } else {
+                context->has_pending_packet[packet_type] = true;
+            }
+        }
+    } else {
+        // Handle the UDP message
+        udp_handle_message(context, udp_packet);
+    }
+}
+
 static bool udp_update(void* raw_context) {
     /*
      * Read a WhistPacket from the socket, decrypt it if necessary, and store the decrypted data for
@@ -602,7 +1300,7 @@ static bool udp_update(void* raw_context) {
     }
 
     // *************
-    // Pull a packet from the network, if any is there
+    // Pull packets from the network, if any are there
     // *************
     static WhistTimer last_recv_timer;
     // Initialize the timer
@@ -615,63 +1313,51 @@ static bool udp_update(void* raw_context) {
         LOG_WARNING_RATE_LIMITED(1, 1, "Time between recv() calls is too long: %fms",
                                  last_recv * MS_IN_SECOND);
     }
-    UDPPacket udp_packet;
-    timestamp_us arrival_time;
-    int network_payload_size;
-    bool received_packet =
-        udp_get_udp_packet(context, &udp_packet, &arrival_time, &network_payload_size);
-    start_timer(&last_recv_timer);
-    current_time = last_recv_timer;
-
-    if (received_packet) {
-        // if the packet is a whist_segment, store the data to give later via get_packet
-        // Otherwise, pass it to udp_handle_message
-        if (udp_packet.type == UDP_WHIST_SEGMENT) {
-            WhistPacketType packet_type = udp_packet.udp_whist_segment_data.whist_type;
-            if (packet_type == PACKET_VIDEO) {
-                add_incoming_bits(context, arrival_time, network_payload_size * BITS_IN_BYTE);
-                if (!udp_packet.udp_whist_segment_data.is_a_nack &&
-                    !udp_packet.udp_whist_segment_data.is_a_duplicate) {
-                    update_max_unordered_packets(&context->unordered_packet_info,
-                                                 udp_packet.udp_whist_segment_data.id,
-                                                 udp_packet.udp_whist_segment_data.index);
-                    if (udp_packet.group_id >= context->curr_group_id) {
-                        udp_congestion_control(context,
-                                               udp_packet.udp_whist_segment_data.departure_time,
-                                               arrival_time, udp_packet.group_id);
-                    }
-                }
+    int num_packets_processed = 0;
+    if (context->recv_queue != NULL) {
+        // The receive thread has already pulled the packets from the socket and decrypted them,
+        // so only wait for it if it has nothing for us
+        UDPReceivedPacket* received_packet = udp_peek_received_packet(context, true);
+        start_timer(&last_recv_timer);
+        current_time = last_recv_timer;
+        while (received_packet != NULL) {
+            udp_handle_received_packet(context, &received_packet->udp_packet,
+                                       received_packet->arrival_time,
+                                       received_packet->network_payload_size);
+            udp_pop_received_packet(context);
+            num_packets_processed++;
+            if (num_packets_processed >= UDP_RECV_PACKET_BUDGET) {
+                break;
             }
-            // If there's a ringbuffer, store in the ringbuffer to reconstruct the original packet
-            if (context->ring_buffers[packet_type] != NULL) {
-                if (!ring_buffer_receive_segment(context->ring_buffers[packet_type],
-                                                 &udp_packet.udp_whist_segment_data)) {
-                    // Log when the ringbuffer overflows
-                    LOG_ERROR("Ringbuffer overflowed; stream resets have been failing to recover.");
-                    // Optionally mark the connection has lost during such an event
-                    // context->connection_lost = true;
-                }
-            } else {
-                FATAL_ASSERT(udp_packet.udp_whist_segment_data.num_indices == 1);
-                FATAL_ASSERT(udp_packet.udp_whist_segment_data.num_fec_indices == 0);
-                // if there is no ring buffer (packet is message), store it in the 1-packet buffer
-                // instead memcpy the segment_data (WhistPacket*) into pending_packets
-                memcpy(&context->pending_packets[packet_type],
-                       &udp_packet.udp_whist_segment_data.segment_data,
-                       udp_packet.udp_whist_segment_data.segment_size);
-                if (context->has_pending_packet[packet_type]) {
-                    LOG_ERROR(
-                        "get_packet has not been called, unclaimed PACKET_MESSAGE being "
-                        "overwritten!");
-                } else {
-                    context->has_pending_packet[packet_type] = true;
-                }
+            received_packet = udp_peek_received_packet(context, false);
+        }
+    } else {
+        // Process up to UDP_RECV_PACKET_BUDGET packets. When recvmmsg batching is used,
+        // only the first udp_get_udp_packet call may hit the socket,
+        // the rest drains the datagrams that the same syscall has already received.
+        UDPPacket udp_packet;
+        timestamp_us arrival_time;
+        int network_payload_size;
+        bool received_packet =
+            udp_get_udp_packet(context, &udp_packet, &arrival_time, &network_payload_size);
+        start_timer(&last_recv_timer);
+        current_time = last_recv_timer;
+
+        while (received_packet) {
+            udp_handle_received_packet(context, &udp_packet, arrival_time, network_payload_size);
+            num_packets_processed++;
+            if (num_packets_processed >= UDP_RECV_PACKET_BUDGET ||
+                !udp_has_batched_packets(context)) {
+                break;
             }
-        } else {
-            // Handle the UDP message
-            udp_handle_message(context, &udp_packet);
+            received_packet =
+                udp_get_udp_packet(context, &udp_packet, &arrival_time, &network_payload_size);
         }
     }
+    if (num_packets_processed > 1) {
+        // Processing a batch may take a while, so refresh the time used by nacking below
+        start_timer(&current_time);
+    }
 
     // *************
     // Try nacking or requesting a stream reset
@@ -680,7 +1366,8 @@ static bool udp_update(void* raw_context) {
     if (context->ring_buffers[PACKET_VIDEO] != NULL) {
         // If no pong is received for UDP_PONG_CONGESTION_SEC, then we signal severe congestion.
         if (diff_timer(&context->last_pong_timer, &current_time) > UDP_PONG_CONGESTION_SEC &&
-            whist_congestion_controller_handle_severe_congestion(&context->network_settings)) {
+            congestion_controller_handle_severe_congestion(udp_get_congestion_controller(context),
+                                                           &context->network_settings)) {
             send_desired_network_settings(context);
         }
         try_recovering_missing_packets_or_frames(
@@ -692,15 +1379,46 @@ static bool udp_update(void* raw_context) {
     return true;
 }
 
+/**
+ * @brief                        Collects the pieces of whist_packet_iov that make up the next
+ *                               segment_size bytes, starting at the cursor
+ *                               (*iov_index, *iov_offset), and advances the cursor past them
+ *
+ * @param whist_packet_iov       The pieces of the whole WhistPacket
+ * @param iov_index              The piece that the cursor is in
+ * @param iov_offset             The offset of the cursor within that piece
+ * @param segment_size           The number of bytes to collect
+ * @param segment_iov            The array to write the segment's pieces to
+ *
+ * @returns                      The number of pieces written to segment_iov
+ */
+static int udp_gather_segment_iov(const WhistIOVec* whist_packet_iov, int* iov_index,
+                                  int* iov_offset, int segment_size, WhistIOVec* segment_iov) {
+    int segment_iov_count = 0;
+    while (segment_size > 0) {
+        const WhistIOVec* piece = &whist_packet_iov[*iov_index];
+        int piece_size = min(piece->size - *iov_offset, segment_size);
+        segment_iov[segment_iov_count].data = (const char*)piece->data + *iov_offset;
+        segment_iov[segment_iov_count].size = piece_size;
+        segment_iov_count++;
+        segment_size -= piece_size;
+        *iov_offset += piece_size;
+        // Move on to the next piece, once this one has been used up
+        if (*iov_offset == piece->size) {
+            (*iov_index)++;
+            *iov_offset = 0;
+        }
+    }
+    return segment_iov_count;
+}
+
 // NOTE that this function is in the hotpath.
 // The hotpath *must* return in under ~10000 assembly instructions.
 // Please pass this comment into any non-trivial function that this function calls.
 // Don't call this function in hotpath for video packets, as it can wait in throttle.
-static int udp_send_packet(void* raw_context, WhistPacketType packet_type,
-                           void* whist_packet_payload, int whist_packet_payload_size, int packet_id,
-                           bool start_of_stream) {
-    FATAL_ASSERT(raw_context != NULL);
-    UDPContext* context = (UDPContext*)raw_context;
+static int udp_send_payload_iov(UDPContext* context, WhistPacketType packet_type,
+                                const WhistIOVec* payload_iov, int payload_iov_count,
+                                int packet_id, bool start_of_stream) {
     FATAL_ASSERT(context != NULL);
 
     if (context->connection_lost) {
@@ -717,7 +1435,8 @@ static int udp_send_packet(void* raw_context, WhistPacketType packet_type,
     FATAL_ASSERT(packet_id != 0);
 
     // Get the nack_buffer, if there is one for this type of packet
-    UDPPacket* nack_buffer = NULL;
+    UDPNetworkPacket* nack_buffer = NULL;
+    int nack_buffer_index = 0;
 
     int type_index = (int)packet_type;
     FATAL_ASSERT(type_index < NUM_PACKET_TYPES);
@@ -725,20 +1444,37 @@ static int udp_send_packet(void* raw_context, WhistPacketType packet_type,
         // Sending payloads that must be split into multiple packets,
         // is only allowed for WhistPacketType's that have a nack buffer
         // This includes allowing the application to fec_ratio at all
-        nack_buffer =
-            context->nack_buffers[type_index][packet_id % context->nack_num_buffers[type_index]];
+        nack_buffer_index = packet_id % context->nack_num_buffers[type_index];
+        nack_buffer = context->nack_buffers[type_index][nack_buffer_index];
         // Packets that are using a nack buffer need a positive ID
         FATAL_ASSERT(packet_id > 0);
     }
 
-    // Construct the WhistPacket based on the parameters given
-    WhistPacket* whist_packet =
-        (WhistPacket*)allocate_region(PACKET_HEADER_SIZE + whist_packet_payload_size);
-    whist_packet->id = packet_id;
-    whist_packet->type = packet_type;
-    whist_packet->payload_size = whist_packet_payload_size;
-    memcpy(whist_packet->data, whist_packet_payload, whist_packet_payload_size);
-    int whist_packet_size = get_packet_size(whist_packet);
+    // The WhistPacket is never assembled in memory. Instead, its header is sent in front of the
+    // pieces of the payload, and each segment is gathered from those pieces while it's encrypted.
+    // Only the fields in front of data[] are sent, since the payload has to land right on data[],
+    // which PACKET_HEADER_SIZE can overshoot because of the struct's tail padding.
+    alignas(WhistPacket) char whist_packet_header_buffer[PACKET_HEADER_SIZE];
+    WhistPacket* whist_packet_header = (WhistPacket*)whist_packet_header_buffer;
+    whist_packet_header->id = packet_id;
+    whist_packet_header->type = packet_type;
+    const int whist_packet_header_size = (int)offsetof(WhistPacket, data);
+
+    FATAL_ASSERT(payload_iov_count <= UDP_MAX_SEND_IOVECS);
+    WhistIOVec whist_packet_iov[UDP_MAX_SEND_IOVECS + 1];
+    whist_packet_iov[0].data = whist_packet_header;
+    whist_packet_iov[0].size = whist_packet_header_size;
+    int whist_packet_iov_count = 1;
+    int whist_packet_payload_size = 0;
+    for (int i = 0; i < payload_iov_count; i++) {
+        // Empty pieces are skipped, so that every piece contributes to some segment
+        if (payload_iov[i].size > 0) {
+            whist_packet_iov[whist_packet_iov_count++] = payload_iov[i];
+            whist_packet_payload_size += payload_iov[i].size;
+        }
+    }
+    whist_packet_header->payload_size = whist_packet_payload_size;
+    int whist_packet_size = whist_packet_header_size + whist_packet_payload_size;
 
     // Calculate number of packets needed to send the payload, rounding up.
     int num_indices_if_no_fec =
@@ -777,103 +1513,191 @@ static int udp_send_packet(void* raw_context, WhistPacketType packet_type,
         (nack_buffer && whist_packet_size > context->nack_buffer_max_payload_size[type_index]) ||
         (!nack_buffer && num_total_packets > 1)) {
         LOG_ERROR("Packet is too large to send the payload! %d/%d", num_indices, num_total_packets);
-        deallocate_region(whist_packet);
         return -1;
     }
 
     FECEncoder* fec_encoder = NULL;
+    // Whether the FEC buffers are being computed by the FEC worker
+    bool pipeline_fec = false;
     if (num_fec_packets > 0) {
-        fec_encoder = create_fec_encoder(num_indices, num_fec_packets, MAX_PACKET_SEGMENT_SIZE);
-        // Pass the buffer that we'll be encoding with FEC
-        fec_encoder_register_buffer(fec_encoder, (char*)whist_packet, whist_packet_size);
-
-        WhistTimer encode_timer;
-        start_timer(&encode_timer);
-        // If using FEC, populate the UDP payload buffers with the FEC encoded buffers
-        fec_get_encoded_buffers(fec_encoder, (void**)buffers, buffer_sizes);
-        double encode_time = get_timer(&encode_timer) * MS_IN_SECOND;
-        if (LOG_FEC_ENCODE) {
-            LOG_INFO("[FEC] encoded %d original + %d redundant buffers, in %f ms", num_indices,
-                     num_fec_packets, encode_time);
+        FECScheme fec_scheme = fec_get_frame_scheme(udp_get_fec_scheme(context, packet_type),
+                                                    num_indices, num_fec_packets);
+        fec_encoder = context->fec_encoders[type_index];
+        fec_encoder_reset(fec_encoder, fec_scheme, num_indices, num_fec_packets);
+        // Pass the pieces of the WhistPacket that we'll be encoding with FEC,
+        // which get gathered straight into the framed original buffers
+        const void* pieces[UDP_MAX_SEND_IOVECS + 1];
+        int piece_sizes[UDP_MAX_SEND_IOVECS + 1];
+        for (int i = 0; i < whist_packet_iov_count; i++) {
+            pieces[i] = whist_packet_iov[i].data;
+            piece_sizes[i] = (int)whist_packet_iov[i].size;
         }
-    } else {
-        // When not using FEC, split up the packets using MAX_PACKET_SEGMENT_SIZE
-        int current_position = 0;
-        for (int packet_index = 0; packet_index < num_indices; packet_index++) {
-            // Populate the buffers directly when not using FEC
-            int udp_packet_payload_size =
-                min(whist_packet_size - current_position, MAX_PACKET_SEGMENT_SIZE);
-            buffers[packet_index] = (char*)whist_packet + current_position;
-            buffer_sizes[packet_index] = udp_packet_payload_size;
-            // Progress the pointer by this payload's size
-            current_position += udp_packet_payload_size;
+        fec_encoder_register_pieces(fec_encoder, pieces, piece_sizes, whist_packet_iov_count);
+        // If using FEC, populate the UDP payload buffers with the framed original buffers
+        fec_get_original_buffers(fec_encoder, (void**)buffers, buffer_sizes);
+
+        if (packet_type == PACKET_VIDEO && context->fec_worker != NULL) {
+            // The original buffers don't depend on the FEC buffers, so they're sent right away,
+            // while the FEC worker computes the FEC buffers
+            pipeline_fec = true;
+            UDPFECWorker* worker = context->fec_worker;
+            worker->fec_encoder = fec_encoder;
+            worker->num_fec_buffers = num_fec_packets;
+            worker->num_taken = 0;
+            worker->wait_time = 0.0;
+            whist_post_semaphore(worker->job_semaphore);
+        } else {
+            WhistTimer encode_timer;
+            start_timer(&encode_timer);
+            fec_get_encoded_buffers(fec_encoder, (void**)buffers, buffer_sizes);
+            double encode_time = get_timer(&encode_timer) * MS_IN_SECOND;
+            if (packet_type == PACKET_VIDEO) {
+                log_double_statistic(VIDEO_FEC_ENCODE_TIME, encode_time);
+                log_double_statistic(VIDEO_FEC_WAIT_TIME, encode_time);
+            }
+            if (LOG_FEC_ENCODE) {
+                LOG_INFO("[FEC] encoded %d original + %d redundant buffers, in %f ms",
+                         num_indices, num_fec_packets, encode_time);
+            }
         }
-        FATAL_ASSERT(current_position == whist_packet_size);
     }
 
+    if (nack_buffer) {
+        // Claim the nack buffer for this packet,
+        // which invalidates the segments of the packet that was stored in it before
+        whist_lock_mutex(context->nack_mutex[type_index]);
+        memset(context->nack_buffer_valid[type_index][nack_buffer_index], 0,
+               sizeof(bool) * context->nack_buffer_num_indices[type_index][nack_buffer_index]);
+        context->nack_buffer_ids[type_index][nack_buffer_index] = packet_id;
+        context->nack_buffer_num_indices[type_index][nack_buffer_index] = num_total_packets;
+        whist_unlock_mutex(context->nack_mutex[type_index]);
+    }
+
+    // The wire-ready packet to use when there's no nack buffer.
+    // This lives outside of the loop, since a video segment stays batched until the flush below.
+    UDPNetworkPacket local_network_packet;
+    // When not using FEC, the segments are cut straight out of whist_packet_iov,
+    // at MAX_PACKET_SEGMENT_SIZE intervals, tracked by this cursor
+    int iov_index = 0;
+    int iov_offset = 0;
+    int current_position = 0;
+
+    // Video segments are encrypted by the crypto workers if there are any,
+    // since a keyframe can have thousands of segments
+    bool encrypt_in_parallel =
+        nack_buffer && packet_type == PACKET_VIDEO && context->encryption_pool != NULL;
+
     int prev_frame_num_duplicates = context->num_duplicate_packets[packet_type];
     // Send all the packets, and write them into the nack buffer if there is one
     for (int packet_index = 0; packet_index < num_total_packets; packet_index++) {
-        if (nack_buffer) {
-            // Lock on a per-loop basis to not starve nack() calls
-            whist_lock_mutex(context->nack_mutex[type_index]);
+        // Before sending the video packets for current frame, handle any nack requests for
+        // previous frames.
+        if (packet_type == PACKET_VIDEO) {
+            udp_handle_pending_nacks(context);
         }
 
-        // The UDPPacket that we will construct
-        UDPPacket local_packet;
-        UDPPacket* packet = &local_packet;
+        // All of the original buffers have been sent, so the FEC buffers are up next,
+        // which are handed over by the FEC worker as it computes them
+        if (pipeline_fec && packet_index >= num_indices) {
+            udp_wait_fec_worker(context, fec_encoder, packet_index - num_indices, buffers,
+                                buffer_sizes);
+        }
 
-        // Potentially use the nack buffer instead though
-        if (nack_buffer) {
-            packet = &nack_buffer[packet_index];
-            context
-                ->nack_buffer_valid[type_index][packet_id % context->nack_num_buffers[type_index]]
-                                   [packet_index] = true;
-        }
-
-        // Construct the UDPPacket, potentially into the nack buffer
-        packet->type = UDP_WHIST_SEGMENT;
-        packet->udp_whist_segment_data.whist_type = packet_type;
-        packet->udp_whist_segment_data.id = packet_id;
-        packet->udp_whist_segment_data.index = (unsigned short)packet_index;
-        packet->udp_whist_segment_data.num_indices = (unsigned short)num_total_packets;
-        packet->udp_whist_segment_data.num_fec_indices = (unsigned short)num_fec_packets;
-        packet->udp_whist_segment_data.prev_frame_num_duplicates =
+        WhistIOVec segment_iov[UDP_MAX_SEND_IOVECS + 1];
+        int segment_iov_count;
+        int segment_size;
+        if (fec_encoder) {
+            segment_iov[0].data = buffers[packet_index];
+            segment_iov[0].size = buffer_sizes[packet_index];
+            segment_iov_count = 1;
+            segment_size = buffer_sizes[packet_index];
+        } else {
+            segment_size = min(whist_packet_size - current_position, MAX_PACKET_SEGMENT_SIZE);
+            segment_iov_count = udp_gather_segment_iov(whist_packet_iov, &iov_index, &iov_offset,
+                                                       segment_size, segment_iov);
+            current_position += segment_size;
+        }
+
+        // Construct the header of the UDPPacket, the data itself is only ever read from
+        // segment_iov, while it's encrypted into the wire-ready packet
+        UDPPacket packet;
+        packet.type = UDP_WHIST_SEGMENT;
+        packet.udp_whist_segment_data.whist_type = packet_type;
+        packet.udp_whist_segment_data.id = packet_id;
+        packet.udp_whist_segment_data.index = (unsigned short)packet_index;
+        packet.udp_whist_segment_data.num_indices = (unsigned short)num_total_packets;
+        packet.udp_whist_segment_data.num_fec_indices = (unsigned short)num_fec_packets;
+        packet.udp_whist_segment_data.prev_frame_num_duplicates =
             (unsigned short)prev_frame_num_duplicates;
-        packet->udp_whist_segment_data.is_a_nack = false;
-        packet->udp_whist_segment_data.is_a_duplicate = false;
-        packet->udp_whist_segment_data.segment_size = buffer_sizes[packet_index];
+        packet.udp_whist_segment_data.is_a_nack = false;
+        packet.udp_whist_segment_data.is_a_duplicate = false;
+        packet.udp_whist_segment_data.segment_size = (unsigned short)segment_size;
 
-        FATAL_ASSERT(packet->udp_whist_segment_data.segment_size <=
-                     sizeof(packet->udp_whist_segment_data.segment_data));
-        memcpy(packet->udp_whist_segment_data.segment_data, buffers[packet_index],
-               buffer_sizes[packet_index]);
+        FATAL_ASSERT(segment_size <= (int)sizeof(packet.udp_whist_segment_data.segment_data));
 
-        // Before sending the video packets for current frame, handle any nack requests for
-        // previous frames.
-        if (packet_type == PACKET_VIDEO) {
-            udp_handle_pending_nacks(raw_context);
+        if (packet_index < num_indices) {
+            context->send_statistics[type_index].num_original_segments++;
+        } else {
+            context->send_statistics[type_index].num_fec_segments++;
+        }
+
+        if (encrypt_in_parallel) {
+            udp_submit_whist_segment(
+                context, &packet, segment_iov, segment_iov_count, &nack_buffer[packet_index],
+                &context->nack_buffer_valid[type_index][nack_buffer_index][packet_index]);
+            continue;
+        }
+
+        if (nack_buffer) {
+            // Lock on a per-loop basis to not starve nack() calls
+            whist_lock_mutex(context->nack_mutex[type_index]);
         }
 
-        // Send the packet
+        // Encrypt straight into the nack buffer if there is one,
+        // so that nacks can just resend the ciphertext
+        UDPNetworkPacket* udp_network_packet =
+            nack_buffer ? &nack_buffer[packet_index] : &local_network_packet;
+
+        // Send the packet, video segments will be batched per throttler group
         // We don't need to propagate the return code because it's lossy anyway,
         // The client will just have to nack
-        udp_send_udp_packet(context, packet);
+        udp_send_whist_segment(context, &packet, segment_iov, segment_iov_count,
+                               udp_network_packet);
 
         if (nack_buffer) {
+            context->nack_buffer_valid[type_index][nack_buffer_index][packet_index] = true;
             whist_unlock_mutex(context->nack_mutex[type_index]);
         }
     }
-
-    // Cleanup
-    if (fec_encoder) {
-        destroy_fec_encoder(fec_encoder);
+    FATAL_ASSERT(fec_encoder || current_position == whist_packet_size);
+    if (packet_type == PACKET_VIDEO) {
+        // Send out the tail of the frame
+        if (encrypt_in_parallel) {
+            udp_finish_encryption_jobs(context);
+        }
+        udp_flush_send_batch(context);
+        log_double_statistic(VIDEO_ENCRYPT_TIME, context->frame_encrypt_time * MS_IN_SECOND);
+        context->frame_encrypt_time = 0.0;
     }
-    deallocate_region(whist_packet);
+
+    // The FEC encoder is kept for the next packet of this type
 
     return 0;
 }
 
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+// Don't call this function in hotpath for video packets, as it can wait in throttle.
+static int udp_send_packet(void* raw_context, WhistPacketType packet_type,
+                           void* whist_packet_payload, int whist_packet_payload_size, int packet_id,
+                           bool start_of_stream) {
+    FATAL_ASSERT(raw_context != NULL);
+    WhistIOVec payload_iov = {whist_packet_payload, whist_packet_payload_size};
+    return udp_send_payload_iov((UDPContext*)raw_context, packet_type, &payload_iov, 1, packet_id,
+                                start_of_stream);
+}
+
 static void* udp_get_packet(void* raw_context, WhistPacketType type) {
     FATAL_ASSERT(raw_context != NULL);
     UDPContext* context = (UDPContext*)raw_context;
@@ -1028,6 +1852,12 @@ static void udp_destroy_socket_context(void* raw_context) {
     FATAL_ASSERT(raw_context != NULL);
     UDPContext* context = (UDPContext*)raw_context;
 
+    // Stop the crypto workers before the nack buffers that they write to are gone
+    udp_stop_encryption_workers(context);
+    udp_stop_fec_worker(context);
+    // Stop the receive thread before the socket that it reads from is gone
+    udp_stop_receive_thread(context);
+
     // Deallocate the nack buffers
     for (int type_id = 0; type_id < NUM_PACKET_TYPES; type_id++) {
         if (context->nack_buffers[type_id] != NULL) {
@@ -1037,6 +1867,9 @@ static void udp_destroy_socket_context(void* raw_context) {
             }
             free(context->nack_buffers[type_id]);
             free(context->nack_buffer_valid[type_id]);
+            free(context->nack_buffer_ids[type_id]);
+            free(context->nack_buffer_num_indices[type_id]);
+            destroy_fec_encoder(context->fec_encoders[type_id]);
             whist_destroy_mutex(context->nack_mutex[type_id]);
             context->nack_buffers[type_id] = NULL;
         }
@@ -1058,13 +1891,16 @@ static void udp_destroy_socket_context(void* raw_context) {
     if (context->fec_controller != NULL) {
         destroy_fec_controller(context->fec_controller);
     }
+    if (context->congestion_controller != NULL) {
+        destroy_congestion_controller(context->congestion_controller);
+    }
     if (context->network_throttler != NULL) {
         network_throttler_destroy(context->network_throttler);
     }
     if (context->nack_queue != NULL) {
         fifo_queue_destroy((QueueContext*)context->nack_queue);
     }
-    whist_destroy_mutex(context->mutex);
+    destroy_aes_session(context->aes_session);
     free(context);
 }
 
@@ -1095,6 +1931,10 @@ bool create_udp_socket_context(SocketContext* network_context, const char* desti
     context->unordered_packet_info.max_unordered_packets = 0.0;
     start_timer(&context->last_network_settings_send_time);
     start_timer(&context->last_bottleneck_timer);
+    // Until the handshake says otherwise, only the full wire format is known to the peer
+    context->wire_version = UDP_WIRE_VERSION_FULL;
+    context->wire_capabilities = 0;
+    context->departure_time_base = current_time_us();
     // Just reduce it by the nearest integer to WCC_HOLD_TIME_AFTER_UDP_BOTTLENECK_SEC to ensure
     // that bottleneck related logic doesn't get triggered in start-up.
     adjust_timer(&context->last_bottleneck_timer,
@@ -1106,9 +1946,16 @@ bool create_udp_socket_context(SocketContext* network_context, const char* desti
     }
     port = port_mappings[port];
     context->timeout = recvfrom_timeout_ms;
-    context->mutex = whist_create_mutex();
     memcpy(context->binary_aes_private_key, binary_aes_private_key,
            sizeof(context->binary_aes_private_key));
+    context->aes_session = create_aes_session(binary_aes_private_key, destination == NULL);
+    if (context->aes_session == NULL) {
+        LOG_ERROR("Failed to create the AES session");
+        whist_destroy_mutex(context->timestamp_mutex);
+        whist_destroy_mutex(context->congestion_control_mutex);
+        free(context);
+        return false;
+    }
     for (int i = 0; i < NUM_PACKET_TYPES; i++) {
         context->reset_data[i].greatest_failed_id = -1;
         context->reset_data[i].pending_stream_reset = true;
@@ -1131,6 +1978,27 @@ bool create_udp_socket_context(SocketContext* network_context, const char* desti
                 -1) {
                 LOG_ERROR("Error setting socket opt: %d", get_last_network_error());
             }
+#if UDP_KERNEL_PACING
+            if (FEATURE_ENABLED(KERNEL_PACING)) {
+                // The launch times are only honored by the fq and etf qdiscs, so the server's
+                // interface has to use one, e.g. with `tc qdisc replace dev eth0 root fq`
+                struct sock_txtime txtime_config;
+                txtime_config.clockid = CLOCK_MONOTONIC;
+                txtime_config.flags = 0;
+                if (!udp_kernel_pacing_is_enforced(context->socket)) {
+                    LOG_WARNING(
+                        "The video socket's qdisc doesn't honor launch times, "
+                        "falling back to the throttler");
+                } else if (setsockopt(context->socket, SOL_SOCKET, SO_TXTIME, &txtime_config,
+                                      sizeof(txtime_config)) == -1) {
+                    LOG_WARNING("Failed to enable SO_TXTIME, falling back to the throttler: %d",
+                                get_last_network_error());
+                } else {
+                    LOG_INFO("Video packets will be paced by the kernel");
+                    context->kernel_pacing = true;
+                }
+            }
+#endif
         }
     } else {
         // The client doesn't use a network throttler
@@ -1143,6 +2011,11 @@ bool create_udp_socket_context(SocketContext* network_context, const char* desti
     }
 
     if (ret == 0) {
+#if UDP_RECV_BATCHING
+        // A recvmmsg batch only gets one syscall return time, so let the kernel stamp each
+        // datagram with the time it arrived at instead
+        udp_enable_recv_timestamps(context->socket);
+#endif
         // Populate function pointer table
         network_context->context = context;
         network_context->get_packet = udp_get_packet;
@@ -1158,6 +2031,7 @@ bool create_udp_socket_context(SocketContext* network_context, const char* desti
         return true;
     } else {
         memset(network_context, 0, sizeof(*network_context));
+        destroy_aes_session(context->aes_session);
         free(context);
         return false;
     }
@@ -1186,8 +2060,15 @@ void udp_register_nack_buffer(SocketContext* socket_context, WhistPacketType typ
     // Allocate buffers than can handle the above maximum sizes
     // Memory isn't an issue here, because we'll use our region allocator,
     // so unused memory never gets allocated by the kernel
-    context->nack_buffers[type_index] = (UDPPacket**)malloc(sizeof(UDPPacket*) * num_buffers);
+    context->nack_buffers[type_index] =
+        (UDPNetworkPacket**)malloc(sizeof(UDPNetworkPacket*) * num_buffers);
     context->nack_buffer_valid[type_index] = (bool**)malloc(sizeof(bool*) * num_buffers);
+    context->nack_buffer_ids[type_index] = (int*)calloc(num_buffers, sizeof(int));
+    context->nack_buffer_num_indices[type_index] = (int*)calloc(num_buffers, sizeof(int));
+    // The FEC encoder's buffers are only touched when the packet needs to be FEC encoded,
+    // so they're usually never paged in
+    context->fec_encoders[type_index] =
+        create_reusable_fec_encoder(max_num_ids, MAX_PACKET_SEGMENT_SIZE);
     context->nack_mutex[type_index] = whist_create_mutex();
     context->nack_num_buffers[type_index] = num_buffers;
     // This is just used to sanitize the pre-FEC buffer that's passed into send_packet
@@ -1196,9 +2077,9 @@ void udp_register_nack_buffer(SocketContext* socket_context, WhistPacketType typ
 
     // Allocate each nack buffer, based on num_buffers
     for (int i = 0; i < num_buffers; i++) {
-        // Allocate a buffer of max_num_ids WhistPacket's
+        // Allocate a buffer of max_num_ids wire-ready segments
         context->nack_buffers[type_index][i] =
-            (UDPPacket*)allocate_region(sizeof(UDPPacket) * max_num_ids);
+            (UDPNetworkPacket*)allocate_region(sizeof(UDPNetworkPacket) * max_num_ids);
         // Allocate nack buffer validity
         // We hold this separately, since writing anything to the region causes it to allocate
         context->nack_buffer_valid[type_index][i] = (bool*)malloc(sizeof(bool) * max_num_ids);
@@ -1206,6 +2087,15 @@ void udp_register_nack_buffer(SocketContext* socket_context, WhistPacketType typ
             context->nack_buffer_valid[type_index][i][j] = false;
         }
     }
+
+    // Video frames can be large enough for encryption to hold up the video send thread
+    if (type == PACKET_VIDEO && FEATURE_ENABLED(PACKET_ENCRYPTION) &&
+        FEATURE_ENABLED(PARALLEL_ENCRYPTION)) {
+        udp_start_encryption_workers(context, max_num_ids);
+    }
+    if (type == PACKET_VIDEO && FEATURE_ENABLED(PIPELINED_FEC)) {
+        udp_start_fec_worker(context);
+    }
 }
 
 /*
@@ -1233,6 +2123,31 @@ int udp_get_num_pending_frames(SocketContext* socket_context, WhistPacketType ty
     }
 }
 
+int udp_get_next_frame_id(SocketContext* socket_context, WhistPacketType type) {
+    FATAL_ASSERT(socket_context != NULL);
+    UDPContext* context = (UDPContext*)socket_context->context;
+    FATAL_ASSERT(context != NULL);
+
+    RingBuffer* ring_buffer = context->ring_buffers[(int)type];
+    if (context->connection_lost || ring_buffer == NULL) {
+        return -1;
+    }
+    return ring_buffer->last_rendered_id + 1;
+}
+
+int udp_read_frame_prefix(SocketContext* socket_context, WhistPacketType type, int id,
+                          char* buffer, int offset) {
+    FATAL_ASSERT(socket_context != NULL);
+    UDPContext* context = (UDPContext*)socket_context->context;
+    FATAL_ASSERT(context != NULL);
+
+    RingBuffer* ring_buffer = context->ring_buffers[(int)type];
+    if (context->connection_lost || ring_buffer == NULL) {
+        return -1;
+    }
+    return ring_buffer_read_frame_prefix(ring_buffer, id, buffer, offset);
+}
+
 // TODO: This is weird logic, connecting to higher-level structures
 // This should be fixed
 int create_udp_listen_socket(SOCKET* sock, int port, int timeout_ms) {
@@ -1276,7 +2191,8 @@ void udp_register_ring_buffer(SocketContext* socket_context, WhistPacketType typ
 
     context->ring_buffers[type_index] =
         init_ring_buffer(type, max_frame_size, num_buffers, socket_context, udp_nack_packet,
-                         udp_request_stream_reset);
+                         udp_nack_bit_array, udp_request_stream_reset);
+    context->ring_buffers[type_index]->fec_scheme = udp_get_fec_scheme(context, type);
 
     // We'll want to increase the UDP buffer size,
     // when we know we may be accepting high-volume packets
@@ -1286,12 +2202,80 @@ void udp_register_ring_buffer(SocketContext* socket_context, WhistPacketType typ
     }
 }
 
+// Pulls packets from the socket and decrypts them into the receive queue, until it's stopped
+static int udp_receive_thread(void* opaque) {
+    UDPContext* context = (UDPContext*)opaque;
+    UDPReceiveQueue* queue = context->recv_queue;
+    // Packets that don't fit in the queue are still pulled from the socket, but dropped
+    UDPReceivedPacket dropped_packet;
+    // Packets have to be pulled from the socket as soon as they arrive
+    whist_set_thread_priority(WHIST_THREAD_PRIORITY_REALTIME);
+    // Whether packets have been queued since packets_available was last posted
+    bool queued_packets = false;
+
+    while (atomic_load(&queue->run_thread)) {
+        int tail = atomic_load(&queue->tail);
+        int next_tail = (tail + 1) % UDP_RECV_QUEUE_SIZE;
+        bool queue_full = next_tail == atomic_load(&queue->head);
+        UDPReceivedPacket* received_packet =
+            queue_full ? &dropped_packet : &queue->packets[tail];
+
+        // This waits for up to the socket's timeout, so that we notice when we're stopped
+        if (udp_get_udp_packet(context, &received_packet->udp_packet,
+                               &received_packet->arrival_time,
+                               &received_packet->network_payload_size)) {
+            if (queue_full) {
+                // The client will just have to nack
+                int num_dropped = atomic_fetch_add(&queue->num_dropped, 1) + 1;
+                LOG_WARNING_RATE_LIMITED(
+                    1, 1, "UDP receive queue is full, %d packets dropped so far", num_dropped);
+            } else {
+                atomic_store(&queue->tail, next_tail);
+                queued_packets = true;
+            }
+        }
+        // Wake up udp_update once per recvmmsg batch, rather than once per packet.
+        // This also has to happen when the batch's last datagram was rejected.
+        if (queued_packets && !udp_has_batched_packets(context)) {
+            whist_post_semaphore(queue->packets_available);
+            queued_packets = false;
+        }
+    }
+    return 0;
+}
+
+void udp_start_receive_thread(SocketContext* socket_context) {
+    FATAL_ASSERT(socket_context != NULL);
+    FATAL_ASSERT(socket_context->context != NULL);
+    UDPContext* context = (UDPContext*)socket_context->context;
+    FATAL_ASSERT(context->recv_queue == NULL);
+
+    UDPReceiveQueue* queue = (UDPReceiveQueue*)safe_malloc(sizeof(UDPReceiveQueue));
+    atomic_init(&queue->run_thread, 1);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->num_dropped, 0);
+    queue->packets_available = whist_create_semaphore(0);
+
+    context->recv_queue = queue;
+    queue->thread = whist_create_thread(udp_receive_thread, "udp_receive_thread", context);
+    FATAL_ASSERT(queue->thread != NULL);
+}
+
 NetworkSettings udp_get_network_settings(SocketContext* socket_context) {
     UDPContext* context = (UDPContext*)socket_context->context;
 
     return context->network_settings;
 }
 
+UDPSendStatistics udp_get_send_statistics(SocketContext* socket_context, WhistPacketType type) {
+    FATAL_ASSERT(socket_context != NULL);
+    FATAL_ASSERT(socket_context->context != NULL);
+    FATAL_ASSERT((int)type < NUM_PACKET_TYPES);
+    UDPContext* context = (UDPContext*)socket_context->context;
+    return context->send_statistics[type];
+}
+
 // TODO: Pull E2E calculations inside of udp.c
 timestamp_us udp_get_client_input_timestamp(SocketContext* socket_context) {
     FATAL_ASSERT(socket_context != NULL);
@@ -1319,6 +2303,16 @@ timestamp_us udp_get_client_input_timestamp(SocketContext* socket_context) {
     return client_input_timestamp;
 }
 
+int udp_send_packet_iov(SocketContext* socket_context, WhistPacketType type,
+                        const WhistIOVec* payload_iov, int payload_iov_count, int packet_id,
+                        bool start_of_stream) {
+    FATAL_ASSERT(socket_context != NULL);
+    FATAL_ASSERT(socket_context->context != NULL);
+    UDPContext* context = (UDPContext*)socket_context->context;
+    return udp_send_payload_iov(context, type, payload_iov, payload_iov_count, packet_id,
+                                start_of_stream);
+}
+
 void udp_resend_packet(SocketContext* socket_context, WhistPacketType type, int id, int index) {
     FATAL_ASSERT(socket_context != NULL);
     FATAL_ASSERT(socket_context->context != NULL);
@@ -1331,6 +2325,10 @@ void udp_resend_packet(SocketContext* socket_context, WhistPacketType type, int
     context->num_duplicate_packets[type]++;
     // Treat this the same as a nack, but set duplicate flag as true
     udp_handle_nack(context, type, id, index, true);
+    if (type == PACKET_VIDEO) {
+        // Video is only resent from the video send thread, which owns the send batch
+        udp_flush_send_batch(context);
+    }
 }
 
 void udp_reset_duplicate_packet_counter(SocketContext* socket_context, WhistPacketType type) {
@@ -1340,26 +2338,28 @@ void udp_reset_duplicate_packet_counter(SocketContext* socket_context, WhistPack
 
 int udp_get_num_indices(SocketContext* socket_context, WhistPacketType type, int packet_id) {
     UDPContext* context = (UDPContext*)socket_context->context;
-    UDPPacket* packet =
-        &context->nack_buffers[type][packet_id % context->nack_num_buffers[type]][0];
-    if (packet->udp_whist_segment_data.id == packet_id) {
-        return packet->udp_whist_segment_data.num_indices;
+    int nack_buffer_index = packet_id % context->nack_num_buffers[type];
+    int stored_id = context->nack_buffer_ids[type][nack_buffer_index];
+    if (stored_id == packet_id) {
+        return context->nack_buffer_num_indices[type][nack_buffer_index];
     } else {
         LOG_WARNING("%s packet %d not found, ID %d was located instead.",
-                    type == PACKET_VIDEO ? "video" : "audio", packet_id,
-                    packet->udp_whist_segment_data.id);
+                    type == PACKET_VIDEO ? "video" : "audio", packet_id, stored_id);
         return -1;
     }
 }
 
 bool udp_handle_pending_nacks(void* raw_context) {
     UDPContext* context = (UDPContext*)raw_context;
-    NackID nack_id;
+    NackBatch nack_batch;
     bool ret = false;
-    while (fifo_queue_dequeue_item((QueueContext*)context->nack_queue, &nack_id) != -1) {
-        udp_handle_nack(context, PACKET_VIDEO, nack_id.frame_id, nack_id.packet_index, false);
+    while (fifo_queue_dequeue_item((QueueContext*)context->nack_queue, &nack_batch) != -1) {
+        udp_handle_nack_batch(context, &nack_batch);
         ret = true;
     }
+    if (ret) {
+        udp_flush_send_batch(context);
+    }
     return ret;
 }
 
@@ -1379,12 +2379,48 @@ void udp_handle_resize(SocketContext* socket_context, int dpi) {
     }
     whist_unlock_mutex(context->congestion_control_mutex);
 }
+
+bool udp_is_insufficient_bandwidth(SocketContext* socket_context) {
+    UDPContext* context = (UDPContext*)socket_context->context;
+    if (context == NULL) {
+        return false;
+    }
+    whist_lock_mutex(context->congestion_control_mutex);
+    bool insufficient_bandwidth =
+        context->congestion_controller != NULL &&
+        congestion_controller_is_insufficient_bandwidth(context->congestion_controller);
+    whist_unlock_mutex(context->congestion_control_mutex);
+    return insufficient_bandwidth;
+}
 /*
 ============================
 Private Function Implementation
 ============================
 */
 
+// Reads the wire version and capabilities out of the group_id of the peer's handshake packet,
+// limited to the ones that we know
+static void udp_parse_wire_format(UDPContext* context, int peer_group_id) {
+    // Every bit must match, since a peer that predates wire format negotiation
+    // sends whatever was on its stack
+    if ((peer_group_id & ~(UDP_WIRE_FORMAT_VERSION_MASK | UDP_WIRE_FORMAT_CAPABILITIES_MASK)) !=
+        UDP_WIRE_FORMAT_MAGIC) {
+        context->wire_version = UDP_WIRE_VERSION_FULL;
+        context->wire_capabilities = 0;
+        return;
+    }
+    int peer_wire_version =
+        (peer_group_id & UDP_WIRE_FORMAT_VERSION_MASK) >> UDP_WIRE_FORMAT_VERSION_SHIFT;
+    context->wire_version = min(peer_wire_version, UDP_WIRE_VERSION_NEWEST);
+    context->wire_capabilities = peer_group_id & UDP_CAPABILITIES_KNOWN;
+}
+
+// Tags a wire version and capabilities, for the group_id of a handshake packet
+static int udp_make_wire_format(int wire_version, int wire_capabilities) {
+    return UDP_WIRE_FORMAT_MAGIC | (wire_version << UDP_WIRE_FORMAT_VERSION_SHIFT) |
+           wire_capabilities;
+}
+
 int create_udp_server_context(UDPContext* context, int port, int connection_timeout_ms) {
     // Track the time we spend in this function, to keep it under connection_timeout_ms
     WhistTimer server_creation_timer;
@@ -1419,6 +2455,11 @@ int create_udp_server_context(UDPContext* context, int port, int connection_time
         if (udp_get_udp_packet(context, &client_packet, NULL, NULL)) {
             if (client_packet.type == UDP_CONNECTION_ATTEMPT) {
                 received_connection_attempt = true;
+                udp_parse_wire_format(context, client_packet.group_id);
+                // Wirehair FEC is opt-in on the server
+                if (!FEATURE_ENABLED(WIREHAIR_FEC)) {
+                    context->wire_capabilities &= ~UDP_CAPABILITY_WIREHAIR_FEC;
+                }
             }
         }
     }
@@ -1442,12 +2483,15 @@ int create_udp_server_context(UDPContext* context, int port, int connection_time
     // Send a confirmation message back to the client
     // We send several, as a best attempt against the Two Generals' Problem
     for (int i = 0; i < NUM_CONFIRMATION_MESSAGES; i++) {
-        UDPPacket confirmation_packet;
+        UDPPacket confirmation_packet = {};
         confirmation_packet.type = UDP_CONNECTION_CONFIRMATION;
+        // Tell the client which wire format we've settled on
+        confirmation_packet.group_id =
+            udp_make_wire_format(context->wire_version, context->wire_capabilities);
         udp_send_udp_packet(context, &confirmation_packet);
     }
     context->nack_queue =
-        fifo_queue_create(sizeof(NackID), VIDEO_NACKBUFFER_SIZE * MAX_VIDEO_PACKETS);
+        fifo_queue_create(sizeof(NackBatch), VIDEO_NACKBUFFER_SIZE * NACK_BATCHES_PER_FRAME);
 
     // Connection successful!
     LOG_INFO("Client received on %d from %s:%d over UDP!\n", port,
@@ -1488,8 +2532,11 @@ int create_udp_client_context(UDPContext* context, const char* destination, int
             get_timer(&client_creation_timer) * MS_IN_SECOND <= connection_timeout_ms) &&
            !connection_succeeded) {
         // Send a UDP_CONNECTION_ATTEMPT
-        UDPPacket client_request;
+        UDPPacket client_request = {};
         client_request.type = UDP_CONNECTION_ATTEMPT;
+        // Tell the server which wire formats we know
+        client_request.group_id =
+            udp_make_wire_format(UDP_WIRE_VERSION_NEWEST, UDP_CAPABILITIES_KNOWN);
         udp_send_udp_packet(context, &client_request);
 
         // Wait for a connection confirmation, using the remaining time available,
@@ -1511,6 +2558,7 @@ int create_udp_client_context(UDPContext* context, const char* destination, int
         if (udp_get_udp_packet(context, &server_response, NULL, NULL)) {
             if (server_response.type == UDP_CONNECTION_CONFIRMATION) {
                 connection_succeeded = true;
+                udp_parse_wire_format(context, server_response.group_id);
             }
         }
     }
@@ -1545,6 +2593,11 @@ int get_udp_packet_size(UDPPacket* udp_packet) {
             return offsetof(UDPPacket, udp_bitarray_nack_data) +
                    sizeof(udp_packet->udp_bitarray_nack_data);
         }
+        case UDP_RANGE_NACK: {
+            // Only the bytes that hold num_bits bits are sent
+            return offsetof(UDPPacket, udp_range_nack_data.ba_raw) +
+                   BITS_TO_CHARS(udp_packet->udp_range_nack_data.num_bits);
+        }
         case UDP_STREAM_RESET: {
             return offsetof(UDPPacket, udp_stream_reset_data) +
                    sizeof(udp_packet->udp_stream_reset_data);
@@ -1570,93 +2623,1093 @@ int get_udp_packet_size(UDPPacket* udp_packet) {
     }
 }
 
+// Little-endian helpers for the compact wire format
+static void write_le16(char* buffer, unsigned int value) {
+    buffer[0] = (char)(value & 0xFF);
+    buffer[1] = (char)((value >> 8) & 0xFF);
+}
+
+static void write_le32(char* buffer, uint32_t value) {
+    write_le16(buffer, value & 0xFFFF);
+    write_le16(buffer + 2, value >> 16);
+}
+
+static unsigned int read_le16(const unsigned char* buffer) {
+    return (unsigned int)buffer[0] | ((unsigned int)buffer[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char* buffer) {
+    return (uint32_t)read_le16(buffer) | ((uint32_t)read_le16(buffer + 2) << 16);
+}
+
+int udp_write_whist_segment_header(UDPContext* context, UDPPacket* udp_packet, char* header) {
+    if (context->wire_version < UDP_WIRE_VERSION_COMPACT) {
+        memcpy(header, udp_packet, UDP_WHIST_SEGMENT_HEADER_SIZE);
+        return (int)UDP_WHIST_SEGMENT_HEADER_SIZE;
+    }
+
+    WhistSegment* segment = &udp_packet->udp_whist_segment_data;
+    int retransmission_flags = (segment->is_a_nack ? UDP_RETRANSMISSION_FLAG_NACK : 0) |
+                               (segment->is_a_duplicate ? UDP_RETRANSMISSION_FLAG_DUPLICATE : 0);
+    header[0] = (char)(UDP_COMPACT_SEGMENT_FLAG | (context->wire_version << 4) |
+                       (retransmission_flags << UDP_COMPACT_SEGMENT_RETRANSMISSION_SHIFT) |
+                       (segment->whist_type & UDP_COMPACT_SEGMENT_TYPE_MASK));
+    write_le16(header + 1, (unsigned int)udp_packet->group_id & 0xFFFF);
+    write_le32(header + 3, (uint32_t)(segment->departure_time - context->departure_time_base));
+    write_le32(header + 7, (uint32_t)segment->id);
+    write_le16(header + 11, segment->index);
+    write_le16(header + 13, segment->num_indices);
+    write_le16(header + 15, segment->num_fec_indices);
+    write_le16(header + 17, segment->segment_size);
+    write_le16(header + 19, segment->prev_frame_num_duplicates);
+    return UDP_COMPACT_SEGMENT_HEADER_SIZE;
+}
+
+FECScheme udp_get_fec_scheme(UDPContext* context, WhistPacketType type) {
+    // Only video frames get large enough to benefit from Wirehair
+    if (type == PACKET_VIDEO && (context->wire_capabilities & UDP_CAPABILITY_WIREHAIR_FEC)) {
+        return FEC_SCHEME_WIREHAIR;
+    }
+    return FEC_SCHEME_REED_SOLOMON;
+}
+
+bool udp_expand_compact_segment(UDPContext* context, UDPPacket* udp_packet, int decrypted_len) {
+    // Copy the header out, since the full header that it's expanded into overlaps it
+    unsigned char header[UDP_COMPACT_SEGMENT_HEADER_SIZE];
+    if (decrypted_len < UDP_COMPACT_SEGMENT_HEADER_SIZE) {
+        LOG_WARNING("Compact segment of size %d is too small", decrypted_len);
+        return false;
+    }
+    memcpy(header, udp_packet, UDP_COMPACT_SEGMENT_HEADER_SIZE);
+
+    int wire_version = (header[0] >> 4) & 0x07;
+    int whist_type = header[0] & UDP_COMPACT_SEGMENT_TYPE_MASK;
+    int retransmission_flags =
+        (header[0] & UDP_COMPACT_SEGMENT_RETRANSMISSION_MASK) >>
+        UDP_COMPACT_SEGMENT_RETRANSMISSION_SHIFT;
+    int segment_size = (int)read_le16(header + 17);
+    if (wire_version < UDP_WIRE_VERSION_COMPACT || wire_version > UDP_WIRE_VERSION_NEWEST ||
+        whist_type >= NUM_PACKET_TYPES ||
+        segment_size > MAX_PACKET_SEGMENT_SIZE ||
+        UDP_COMPACT_SEGMENT_HEADER_SIZE + segment_size != decrypted_len) {
+        LOG_WARNING("Invalid compact segment of version %d, type %d, and size %d/%d", wire_version,
+                    whist_type, segment_size, decrypted_len);
+        return false;
+    }
+
+    // Move the data into place first, since the full header would overwrite it
+    WhistSegment* segment = &udp_packet->udp_whist_segment_data;
+    memmove(segment->segment_data, (char*)udp_packet + UDP_COMPACT_SEGMENT_HEADER_SIZE,
+            segment_size);
+
+    udp_packet->type = UDP_WHIST_SEGMENT;
+    segment->whist_type = (WhistPacketType)whist_type;
+    segment->is_a_nack = (retransmission_flags & UDP_RETRANSMISSION_FLAG_NACK) != 0;
+    segment->is_a_duplicate = (retransmission_flags & UDP_RETRANSMISSION_FLAG_DUPLICATE) != 0;
+    segment->id = (int)read_le32(header + 7);
+    segment->index = (unsigned short)read_le16(header + 11);
+    segment->num_indices = (unsigned short)read_le16(header + 13);
+    segment->num_fec_indices = (unsigned short)read_le16(header + 15);
+    segment->segment_size = (unsigned short)segment_size;
+    segment->prev_frame_num_duplicates = (unsigned short)read_le16(header + 19);
+
+    // Unwrap the group ID and departure time to the values nearest to the last ones,
+    // which is what congestion control compares them against.
+    // Only video is throttled, so other segments don't carry meaningful values.
+    if (whist_type == PACKET_VIDEO && !context->received_compact_video) {
+        // The first one is taken as it is
+        context->received_compact_video = true;
+        context->last_received_group_id = (int)read_le16(header + 1);
+        context->last_received_departure_time = read_le32(header + 3);
+        udp_packet->group_id = context->last_received_group_id;
+        segment->departure_time = context->last_received_departure_time;
+    } else if (whist_type == PACKET_VIDEO) {
+        int16_t group_id_delta =
+            (int16_t)(read_le16(header + 1) - ((unsigned int)context->last_received_group_id));
+        int32_t departure_time_delta = (int32_t)(
+            read_le32(header + 3) - (uint32_t)context->last_received_departure_time);
+        context->last_received_group_id += group_id_delta;
+        context->last_received_departure_time += departure_time_delta;
+        udp_packet->group_id = context->last_received_group_id;
+        segment->departure_time = context->last_received_departure_time;
+    } else {
+        udp_packet->group_id = 0;
+        segment->departure_time = 0;
+    }
+    return true;
+}
+
+// Handles a failed send()/sendmmsg() call.
+// Returns true if the send should be retried, false if the packet(s) should be dropped
+static bool udp_handle_send_error(UDPContext* context, int* num_retries) {
+    int error = get_last_network_error();
+    if (error == WHIST_ECONNREFUSED) {
+        if (context->connected) {
+            // The connection has been lost
+            LOG_WARNING("UDP connection Lost: ECONNREFUSED");
+            context->connection_lost = true;
+        }
+        return false;
+    } else if (error == WHIST_ENOBUFS && ++*num_retries < RETRIES_ON_BUFFER_FULL) {
+        LOG_WARNING("Unexpected UDP Packet Error: %d (Retrying to send packet!)", error);
+        return true;
+    } else {
+        LOG_WARNING("Unexpected UDP Packet Error: %d", error);
+        return false;
+    }
+}
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+// Encrypts the plaintext scattered across plaintext_iov into udp_network_packet,
+// returning the number of bytes of udp_network_packet that must be sent over the network
+static int udp_encrypt_iov(UDPContext* context, const WhistIOVec* plaintext_iov,
+                           int plaintext_iov_count, UDPNetworkPacket* udp_network_packet) {
+    if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
+        // Encrypt the packet during normal operation
+        udp_network_packet->payload_size = aes_session_encrypt_packet(
+            context->aes_session, udp_network_packet->payload, &udp_network_packet->aes_metadata,
+            plaintext_iov, plaintext_iov_count);
+    } else {
+        // Or, just memcpy the pieces if PACKET_ENCRYPTION is disabled
+        int payload_size = 0;
+        for (int i = 0; i < plaintext_iov_count; i++) {
+            memcpy(udp_network_packet->payload + payload_size, plaintext_iov[i].data,
+                   plaintext_iov[i].size);
+            payload_size += plaintext_iov[i].size;
+        }
+        udp_network_packet->payload_size = payload_size;
+    }
+    // The size of the udp packet that actually needs to be sent over the network
+    int udp_network_packet_size = UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet->payload_size;
+    if (LOG_NETWORKING) {
+        LOG_INFO("Sending a WhistPacket of size %d (Total %d) over UDP",
+                 udp_network_packet->payload_size, udp_network_packet_size);
+    }
+    return udp_network_packet_size;
+}
+
+// Sends a single datagram, retrying a few times if the system is out of buffer space.
+// send() is thread-safe, so no locking is needed here.
+static int udp_send_datagram(UDPContext* context, const void* data, int size) {
+    int num_retries = 0;
+    while (send(context->socket, (const char*)data, (size_t)size, 0) < 0) {
+        if (!udp_handle_send_error(context, &num_retries)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 // NOTE that this function is in the hotpath.
 // The hotpath *must* return in under ~10000 assembly instructions.
 // Please pass this comment into any non-trivial function that this function calls.
-// Don't call this function in hotpath for video packets, as it can wait in throttle.
 int udp_send_udp_packet(UDPContext* context, UDPPacket* udp_packet) {
     FATAL_ASSERT(context != NULL);
-    int udp_packet_size = get_udp_packet_size(udp_packet);
-    bool throttle = false;
-    if (udp_packet->type == UDP_WHIST_SEGMENT) {
-        udp_packet->udp_whist_segment_data.departure_time = current_time_us();
-        // Throttle only video packet. Audio packets are very small and run on reserved bandwidth
-        // and ping/pong packets use negligible bandwidth.
-        if (udp_packet->udp_whist_segment_data.whist_type == PACKET_VIDEO) {
-            throttle = true;
+    FATAL_ASSERT(udp_packet->type != UDP_WHIST_SEGMENT);
+    WhistIOVec plaintext_iov = {udp_packet, get_udp_packet_size(udp_packet)};
+
+    UDPNetworkPacket udp_network_packet;
+    int udp_network_packet_size = udp_encrypt_iov(context, &plaintext_iov, 1, &udp_network_packet);
+
+    return udp_send_datagram(context, &udp_network_packet, udp_network_packet_size);
+}
+
+#if UDP_KERNEL_PACING
+// Converts a CLOCK_MONOTONIC launch time from the throttler into the departure time of a
+// segment, which is what the segment will actually leave at, rather than when it's scheduled
+static timestamp_us udp_launch_time_to_departure_time(uint64_t launch_time_ns) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timestamp_us departure_time = current_time_us();
+    uint64_t now_ns = (uint64_t)now.tv_sec * US_IN_SECOND * NS_IN_US + (uint64_t)now.tv_nsec;
+    if (launch_time_ns > now_ns) {
+        departure_time += (timestamp_us)((launch_time_ns - now_ns) / NS_IN_US);
+    }
+    return departure_time;
+}
+#endif
+
+// Waits until the network throttler has allocated `bytes` bytes of video,
+// and returns the ID of the throttler group that they belong to.
+// Segments of the same throttler group are allowed to leave back-to-back,
+// so the send batch only needs to go to the socket when the throttler would make us wait,
+// or when it has started a new group.
+// With kernel pacing, the throttler schedules the bytes instead of waiting for them,
+// and *launch_time_ns receives the time at which they should leave, or 0 otherwise.
+// If departure_time is non-NULL, it's then moved to that launch time.
+// Don't call this function in hotpath, as it can wait in throttle.
+static int udp_throttle_video_bytes(UDPContext* context, size_t bytes, uint64_t* launch_time_ns,
+                                    timestamp_us* departure_time) {
+#if UDP_KERNEL_PACING
+    if (context->kernel_pacing) {
+        int group_id = network_throttler_schedule_byte_allocation(context->network_throttler,
+                                                                  bytes, launch_time_ns);
+        if (departure_time != NULL && *launch_time_ns != 0) {
+            *departure_time = udp_launch_time_to_departure_time(*launch_time_ns);
+        }
+        // A batch only holds one group's worth of launch times, so that the kernel is never
+        // more than a coin bucket behind on the segments that we've handed it.
+        // Segments that are still being encrypted aren't waited for, since the kernel holds on
+        // to them until their launch time anyways, so they just go out with the next batch.
+        if (group_id != context->send_batch_group_id) {
+            udp_collect_encryption_jobs(context, false);
+            udp_flush_send_batch(context);
+        }
+        context->send_batch_group_id = group_id;
+        return group_id;
+    }
+#endif
+    UNUSED(departure_time);
+    *launch_time_ns = 0;
+#if UDP_SEND_BATCHING
+    int group_id;
+    bool allocated =
+        network_throttler_try_byte_allocation(context->network_throttler, bytes, &group_id);
+    if (!allocated || group_id != context->send_batch_group_id) {
+        // Segments that are still being encrypted belong to the batch as well
+        udp_collect_encryption_jobs(context, true);
+        udp_flush_send_batch(context);
+        if (!allocated) {
+            group_id = network_throttler_wait_byte_allocation(context->network_throttler, bytes);
         }
     }
+    context->send_batch_group_id = group_id;
+    return group_id;
+#else
+    // Don't hold on to encrypted segments while waiting for the throttler
+    udp_collect_encryption_jobs(context, true);
+    return network_throttler_wait_byte_allocation(context->network_throttler, bytes);
+#endif
+}
+
+// Hands the first udp_network_packet_size bytes of a wire-ready whist segment to the socket.
+// If batch is set, it's only added to the send batch, which points at udp_network_packet until
+// the batch is flushed.
+// A non-zero launch_time_ns is passed on to the kernel, which holds the segment until then.
+static void udp_transmit_segment(UDPContext* context, UDPNetworkPacket* udp_network_packet,
+                                 int udp_network_packet_size, bool batch,
+                                 uint64_t launch_time_ns) {
+#if UDP_SEND_BATCHING
+    if (batch) {
+        int batch_index = context->send_batch_count++;
+        // The socket is connected, so no msg_name is needed
+        context->send_batch_iovecs[batch_index].iov_base = udp_network_packet;
+        context->send_batch_iovecs[batch_index].iov_len = (size_t)udp_network_packet_size;
+        struct msghdr* hdr = &context->send_batch_msgs[batch_index].msg_hdr;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_iov = &context->send_batch_iovecs[batch_index];
+        hdr->msg_iovlen = 1;
+#if UDP_KERNEL_PACING
+        if (launch_time_ns != 0) {
+            hdr->msg_control = context->send_batch_control[batch_index];
+            hdr->msg_controllen = sizeof(context->send_batch_control[batch_index]);
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_TXTIME;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            memcpy(CMSG_DATA(cmsg), &launch_time_ns, sizeof(uint64_t));
+        }
+#endif
+
+        if (context->send_batch_count == UDP_SEND_BATCH_SIZE) {
+            udp_flush_send_batch(context);
+        }
+        return;
+    }
+#else
+    UNUSED(batch);
+#endif
+    // Unbatched segments are never kernel paced
+    UNUSED(launch_time_ns);
+    // We don't need to propagate the return code because it's lossy anyway,
+    // The client will just have to nack
+    udp_send_datagram(context, udp_network_packet, udp_network_packet_size);
+}
 
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+// Don't call this function in hotpath for video packets, as it can wait in throttle.
+void udp_send_whist_segment(UDPContext* context, UDPPacket* udp_packet,
+                            const WhistIOVec* segment_iov, int segment_iov_count,
+                            UDPNetworkPacket* udp_network_packet) {
+    FATAL_ASSERT(context != NULL);
+    FATAL_ASSERT(udp_packet->type == UDP_WHIST_SEGMENT);
+    FATAL_ASSERT(segment_iov_count <= UDP_MAX_SEND_IOVECS);
+    bool compact = context->wire_version >= UDP_WIRE_VERSION_COMPACT;
+    int header_size = compact ? UDP_COMPACT_SEGMENT_HEADER_SIZE : UDP_WHIST_SEGMENT_HEADER_SIZE;
+    int udp_packet_size = header_size + udp_packet->udp_whist_segment_data.segment_size;
+    // Throttle only video packet. Audio packets are very small and run on reserved bandwidth
+    // and ping/pong packets use negligible bandwidth.
+    bool throttle = udp_packet->udp_whist_segment_data.whist_type == PACKET_VIDEO;
+    uint64_t launch_time_ns = 0;
+
+    udp_packet->udp_whist_segment_data.departure_time = current_time_us();
     // NOTE: This doesn't interfere with clientside hotpath,
     // since the throttler only throttles the serverside
     if (throttle) {
-        udp_packet->group_id = network_throttler_wait_byte_allocation(
-            context->network_throttler, (size_t)(UDPNETWORKPACKET_HEADER_SIZE + udp_packet_size));
+        udp_packet->group_id = udp_throttle_video_bytes(
+            context, (size_t)(UDPNETWORKPACKET_HEADER_SIZE + udp_packet_size), &launch_time_ns,
+            &udp_packet->udp_whist_segment_data.departure_time);
     }
 
-    UDPNetworkPacket udp_network_packet;
+    // The plaintext is the segment's header, followed by the pieces of the segment's data.
+    // A full header is just the start of the UDPPacket itself.
+    alignas(UDPPacket) char compact_header[UDP_COMPACT_SEGMENT_HEADER_SIZE];
+    WhistIOVec plaintext_iov[UDP_MAX_SEND_IOVECS + 1];
+    if (compact) {
+        udp_write_whist_segment_header(context, udp_packet, compact_header);
+        plaintext_iov[0].data = compact_header;
+    } else {
+        plaintext_iov[0].data = udp_packet;
+    }
+    plaintext_iov[0].size = header_size;
+    for (int i = 0; i < segment_iov_count; i++) {
+        plaintext_iov[i + 1] = segment_iov[i];
+    }
+    WhistTimer encrypt_timer;
+    start_timer(&encrypt_timer);
+    int udp_network_packet_size =
+        udp_encrypt_iov(context, plaintext_iov, segment_iov_count + 1, udp_network_packet);
+    if (throttle) {
+        context->frame_encrypt_time += get_timer(&encrypt_timer);
+    }
+
+    // Throttled video segments are batched per throttler group
+    udp_transmit_segment(context, udp_network_packet, udp_network_packet_size, throttle,
+                         launch_time_ns);
+
+    // If encryption has added any extra bytes due to padding, then network throttler should be
+    // called again to adjust for these extra bytes, so that the requested bitrate limit is not
+    // exceeded.
+    if (throttle && udp_network_packet->payload_size > udp_packet_size) {
+        udp_throttle_video_bytes(context,
+                                 (size_t)(udp_network_packet->payload_size - udp_packet_size),
+                                 &launch_time_ns, NULL);
+    }
+}
+
+// Encrypts a stored whist segment again into resend_packet, with the given retransmission flags
+// set inside of it. The stored segment is only read, since a pending send batch may still point
+// at it, and the new ciphertext gets a fresh nonce, like any other encryption.
+static bool udp_reencrypt_segment(UDPContext* context, const UDPNetworkPacket* udp_network_packet,
+                                  int retransmission_flags, UDPNetworkPacket* resend_packet) {
+    UDPPacket udp_packet;
+    int decrypted_len;
     if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
-        // Encrypt the packet during normal operation
-        int encrypted_len =
-            (int)encrypt_packet(udp_network_packet.payload, &udp_network_packet.aes_metadata,
-                                udp_packet, udp_packet_size, context->binary_aes_private_key);
-        udp_network_packet.payload_size = encrypted_len;
+        decrypted_len = aes_session_decrypt_packet(
+            context->aes_session, &udp_packet, sizeof(UDPPacket),
+            &udp_network_packet->aes_metadata, udp_network_packet->payload,
+            udp_network_packet->payload_size);
+        if (decrypted_len < 0) {
+            LOG_ERROR("Failed to decrypt a stored segment for retransmission");
+            return false;
+        }
+    } else {
+        decrypted_len = udp_network_packet->payload_size;
+        memcpy(&udp_packet, udp_network_packet->payload, decrypted_len);
+    }
+    if (decrypted_len > 0 && (*(unsigned char*)&udp_packet & UDP_COMPACT_SEGMENT_FLAG)) {
+        unsigned char* header = (unsigned char*)&udp_packet;
+        int flag_bits = retransmission_flags << UDP_COMPACT_SEGMENT_RETRANSMISSION_SHIFT;
+        header[0] =
+            (unsigned char)((header[0] & ~UDP_COMPACT_SEGMENT_RETRANSMISSION_MASK) | flag_bits);
     } else {
-        // Or, just memcpy the segment if PACKET_ENCRYPTION is disabled
-        memcpy(udp_network_packet.payload, udp_packet, udp_packet_size);
-        udp_network_packet.payload_size = udp_packet_size;
+        udp_packet.udp_whist_segment_data.is_a_nack =
+            (retransmission_flags & UDP_RETRANSMISSION_FLAG_NACK) != 0;
+        udp_packet.udp_whist_segment_data.is_a_duplicate =
+            (retransmission_flags & UDP_RETRANSMISSION_FLAG_DUPLICATE) != 0;
     }
+    WhistIOVec plaintext_iov = {&udp_packet, decrypted_len};
+    udp_encrypt_iov(context, &plaintext_iov, 1, resend_packet);
+    return true;
+}
 
-    // The size of the udp packet that actually needs to be sent over the network
-    int udp_network_packet_size = UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet.payload_size;
-
-    // If sending fails because of no buffer space available on the system, retry a few times.
-    for (int i = 0; i < RETRIES_ON_BUFFER_FULL; i++) {
-        // TODO: Remove this mutex? send() is already thread-safe
-        whist_lock_mutex(context->mutex);
-        int ret;
-        if (LOG_NETWORKING) {
-            LOG_INFO("Sending a WhistPacket of size %d (Total %d) over UDP", udp_packet_size,
-                     udp_network_packet_size);
-        }
-        // Send the UDPPacket over the network
-        ret = send(context->socket, (const char*)&udp_network_packet,
-                   (size_t)udp_network_packet_size, 0);
-        whist_unlock_mutex(context->mutex);
+// Don't call this function in hotpath for video packets, as it can wait in throttle.
+void udp_send_network_packet(UDPContext* context, WhistPacketType type,
+                             const UDPNetworkPacket* udp_network_packet,
+                             int retransmission_flags) {
+    FATAL_ASSERT(context != NULL);
+    // The plaintext doesn't change size, so neither does the ciphertext
+    int udp_network_packet_size = UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet->payload_size;
+
+    bool throttle = type == PACKET_VIDEO;
+    uint64_t launch_time_ns = 0;
+    if (throttle) {
+        // The departure time and group ID inside of the ciphertext are those of the original
+        // transmission, which is fine since retransmissions are ignored by congestion control
+        udp_throttle_video_bytes(context, (size_t)udp_network_packet_size, &launch_time_ns,
+                                 NULL);
+    }
+
+    // Batched segments are pointed at until the batch is flushed, so each one gets the resend
+    // slot of its place in the batch. The throttler may have just flushed the batch.
+    UDPNetworkPacket local_resend_packet;
+    UDPNetworkPacket* resend_packet = &local_resend_packet;
+#if UDP_SEND_BATCHING
+    if (throttle) {
+        resend_packet = &context->send_batch_resends[context->send_batch_count];
+    }
+#endif
+    if (!udp_reencrypt_segment(context, udp_network_packet, retransmission_flags,
+                               resend_packet)) {
+        return;
+    }
+    udp_transmit_segment(context, resend_packet, udp_network_packet_size, throttle,
+                         launch_time_ns);
+}
+
+void udp_flush_send_batch(UDPContext* context) {
+#if UDP_SEND_BATCHING
+    int num_sent = 0;
+    int num_retries = 0;
+    while (num_sent < context->send_batch_count) {
+        // sendmmsg may send only part of the batch, in which case we continue from there
+        int ret = sendmmsg(context->socket, &context->send_batch_msgs[num_sent],
+                           (unsigned int)(context->send_batch_count - num_sent), 0);
         if (ret < 0) {
-            int error = get_last_network_error();
-            if (error == WHIST_ECONNREFUSED) {
-                if (context->connected) {
-                    // The connection has been lost
-                    LOG_WARNING("UDP connection Lost: ECONNREFUSED");
-                    context->connection_lost = true;
-                    return -1;
-                }
+            if (!udp_handle_send_error(context, &num_retries)) {
+                // Drop the rest of the batch, the client will just have to nack
                 break;
-            } else if (error == WHIST_ENOBUFS) {
-                LOG_WARNING("Unexpected UDP Packet Error: %d (Retrying to send packet!)", error);
-                continue;
-            } else {
-                LOG_WARNING("Unexpected UDP Packet Error: %d", error);
-                return -1;
             }
         } else {
+            num_sent += ret;
+        }
+    }
+    context->send_batch_count = 0;
+#else
+    UNUSED(context);
+#endif
+}
+
+// Encrypts the segments that the video send thread submits, until the pool is stopped
+static int udp_encryption_worker(void* opaque) {
+    UDPContext* context = (UDPContext*)opaque;
+    UDPEncryptionPool* pool = context->encryption_pool;
+    // The video send thread waits on us
+    whist_set_thread_priority(WHIST_THREAD_PRIORITY_REALTIME);
+
+    while (true) {
+        whist_wait_semaphore(pool->job_semaphore);
+        if (!pool->run_workers) {
             break;
         }
+        // Jobs are picked up in order, but may finish in any order
+        int job_index = atomic_fetch_add(&pool->next_job, 1);
+        UDPEncryptionJob* job = &pool->jobs[job_index];
+        udp_encrypt_iov(context, job->plaintext_iov, job->plaintext_iov_count,
+                        job->udp_network_packet);
+        atomic_store(&pool->job_done[job_index], 1);
+        whist_post_semaphore(pool->done_semaphore);
     }
+    return 0;
+}
 
-    // If encryption has added any extra bytes due to padding, then network throttler should be
-    // called again to adjust for these extra bytes, so that the requested bitrate limit is not
-    // exceeded.
-    if (throttle && udp_network_packet.payload_size > udp_packet_size) {
-        network_throttler_wait_byte_allocation(context->network_throttler,
-                                               udp_network_packet.payload_size - udp_packet_size);
+void udp_start_encryption_workers(UDPContext* context, int max_jobs) {
+    UDPEncryptionPool* pool = (UDPEncryptionPool*)safe_malloc(sizeof(UDPEncryptionPool));
+    pool->jobs = (UDPEncryptionJob*)safe_malloc(sizeof(UDPEncryptionJob) * max_jobs);
+    pool->job_done = (atomic_int*)safe_malloc(sizeof(atomic_int) * max_jobs);
+    for (int i = 0; i < max_jobs; i++) {
+        atomic_init(&pool->job_done[i], 0);
+    }
+    pool->max_jobs = max_jobs;
+    pool->num_submitted = 0;
+    pool->num_transmitted = 0;
+    pool->num_done_waited = 0;
+    atomic_init(&pool->next_job, 0);
+    pool->job_semaphore = whist_create_semaphore(0);
+    pool->done_semaphore = whist_create_semaphore(0);
+    pool->run_workers = true;
+
+    context->encryption_pool = pool;
+    for (int i = 0; i < UDP_NUM_ENCRYPTION_WORKERS; i++) {
+        pool->workers[i] = whist_create_thread(udp_encryption_worker, "udp_encryption_worker",
+                                               context);
+        FATAL_ASSERT(pool->workers[i] != NULL);
+    }
+}
+
+void udp_stop_encryption_workers(UDPContext* context) {
+    UDPEncryptionPool* pool = context->encryption_pool;
+    if (pool == NULL) {
+        return;
+    }
+    pool->run_workers = false;
+    for (int i = 0; i < UDP_NUM_ENCRYPTION_WORKERS; i++) {
+        whist_post_semaphore(pool->job_semaphore);
+    }
+    for (int i = 0; i < UDP_NUM_ENCRYPTION_WORKERS; i++) {
+        whist_wait_thread(pool->workers[i], NULL);
+    }
+    whist_destroy_semaphore(pool->job_semaphore);
+    whist_destroy_semaphore(pool->done_semaphore);
+    free(pool->jobs);
+    free(pool->job_done);
+    free(pool);
+    context->encryption_pool = NULL;
+}
+
+// Don't call this function in hotpath, as it can wait in throttle.
+void udp_submit_whist_segment(UDPContext* context, UDPPacket* udp_packet,
+                              const WhistIOVec* segment_iov, int segment_iov_count,
+                              UDPNetworkPacket* udp_network_packet, bool* nack_buffer_valid) {
+    UDPEncryptionPool* pool = context->encryption_pool;
+    FATAL_ASSERT(udp_packet->udp_whist_segment_data.whist_type == PACKET_VIDEO);
+    FATAL_ASSERT(segment_iov_count <= UDP_MAX_SEND_IOVECS);
+    FATAL_ASSERT(pool->num_submitted < pool->max_jobs);
+    int header_size = context->wire_version >= UDP_WIRE_VERSION_COMPACT
+                          ? UDP_COMPACT_SEGMENT_HEADER_SIZE
+                          : (int)UDP_WHIST_SEGMENT_HEADER_SIZE;
+    int udp_packet_size = header_size + udp_packet->udp_whist_segment_data.segment_size;
+
+    // The departure time and group ID are part of the ciphertext, so the throttler has to be done
+    // with the segment before it's encrypted. The worst-case encryption padding is allocated
+    // right away, since it can't be allocated afterwards like udp_send_whist_segment does.
+    udp_packet->udp_whist_segment_data.departure_time = current_time_us();
+    uint64_t launch_time_ns;
+    udp_packet->group_id = udp_throttle_video_bytes(
+        context,
+        (size_t)(UDPNETWORKPACKET_HEADER_SIZE + udp_packet_size + MAX_ENCRYPTION_SIZE_INCREASE),
+        &launch_time_ns, &udp_packet->udp_whist_segment_data.departure_time);
+
+    int job_index = pool->num_submitted;
+    UDPEncryptionJob* job = &pool->jobs[job_index];
+    udp_write_whist_segment_header(context, udp_packet, job->udp_packet_header);
+    job->plaintext_iov[0].data = job->udp_packet_header;
+    job->plaintext_iov[0].size = header_size;
+    for (int i = 0; i < segment_iov_count; i++) {
+        job->plaintext_iov[i + 1] = segment_iov[i];
+    }
+    job->plaintext_iov_count = segment_iov_count + 1;
+    job->udp_network_packet = udp_network_packet;
+    job->launch_time_ns = launch_time_ns;
+    job->nack_buffer_valid = nack_buffer_valid;
+    atomic_store(&pool->job_done[job_index], 0);
+
+    pool->num_submitted++;
+    whist_post_semaphore(pool->job_semaphore);
+
+    // Send out whatever the workers have finished in the meantime, without waiting on them
+    udp_collect_encryption_jobs(context, false);
+}
+
+void udp_collect_encryption_jobs(UDPContext* context, bool wait_for_all) {
+    UDPEncryptionPool* pool = context->encryption_pool;
+    if (pool == NULL) {
+        return;
+    }
+
+    while (pool->num_transmitted < pool->num_submitted) {
+        int job_index = pool->num_transmitted;
+        if (!atomic_load(&pool->job_done[job_index])) {
+            if (!wait_for_all) {
+                break;
+            }
+            // Send out what's done so far, rather than holding it back until the rest is done
+            udp_flush_send_batch(context);
+            // Every finished job posts once, so this wakes up whenever any job is done
+            WhistTimer wait_timer;
+            start_timer(&wait_timer);
+            whist_wait_semaphore(pool->done_semaphore);
+            pool->num_done_waited++;
+            context->frame_encrypt_time += get_timer(&wait_timer);
+            continue;
+        }
+
+        // Segments go out in the order that they were submitted in, i.e. the wire order
+        UDPEncryptionJob* job = &pool->jobs[job_index];
+        udp_transmit_segment(
+            context, job->udp_network_packet,
+            UDPNETWORKPACKET_HEADER_SIZE + job->udp_network_packet->payload_size, true,
+            job->launch_time_ns);
+        pool->num_transmitted++;
+
+        whist_lock_mutex(context->nack_mutex[PACKET_VIDEO]);
+        *job->nack_buffer_valid = true;
+        whist_unlock_mutex(context->nack_mutex[PACKET_VIDEO]);
+    }
+}
+
+void udp_finish_encryption_jobs(UDPContext* context) {
+    UDPEncryptionPool* pool = context->encryption_pool;
+    udp_collect_encryption_jobs(context, true);
+
+    // Consume the posts of the jobs that were done before we had to wait on them.
+    // Once every job's post has been consumed, every worker is done touching the jobs.
+    while (pool->num_done_waited < pool->num_submitted) {
+        whist_wait_semaphore(pool->done_semaphore);
+        pool->num_done_waited++;
+    }
+    pool->num_submitted = 0;
+    pool->num_transmitted = 0;
+    pool->num_done_waited = 0;
+    atomic_store(&pool->next_job, 0);
+}
+
+// Computes the FEC buffers of the video frames that the video send thread submits,
+// until the worker is stopped
+static int udp_fec_worker(void* opaque) {
+    UDPFECWorker* worker = (UDPFECWorker*)opaque;
+    // The video send thread waits on us once it's done sending the original buffers
+    whist_set_thread_priority(WHIST_THREAD_PRIORITY_REALTIME);
+
+    while (true) {
+        whist_wait_semaphore(worker->job_semaphore);
+        if (!worker->run_worker) {
+            break;
+        }
+        WhistTimer encode_timer;
+        start_timer(&encode_timer);
+        int num_fec_buffers = worker->num_fec_buffers;
+        for (int num_encoded = 0; num_encoded < num_fec_buffers;) {
+            num_encoded = min(num_encoded + UDP_FEC_WORKER_BATCH_SIZE, num_fec_buffers);
+            fec_encode_redundant_buffers_until(worker->fec_encoder, num_encoded);
+            if (num_encoded == num_fec_buffers) {
+                // The send thread only reads this after the last post
+                worker->encode_time = get_timer(&encode_timer);
+            }
+            whist_post_semaphore(worker->done_semaphore);
+        }
     }
     return 0;
 }
 
+void udp_start_fec_worker(UDPContext* context) {
+    UDPFECWorker* worker = (UDPFECWorker*)safe_malloc(sizeof(UDPFECWorker));
+    worker->run_worker = true;
+    worker->job_semaphore = whist_create_semaphore(0);
+    worker->done_semaphore = whist_create_semaphore(0);
+    worker->fec_encoder = NULL;
+    worker->num_fec_buffers = 0;
+    worker->encode_time = 0.0;
+    worker->num_taken = 0;
+    worker->wait_time = 0.0;
+    worker->thread = whist_create_thread(udp_fec_worker, "udp_fec_worker", worker);
+    FATAL_ASSERT(worker->thread != NULL);
+    context->fec_worker = worker;
+}
+
+void udp_stop_fec_worker(UDPContext* context) {
+    UDPFECWorker* worker = context->fec_worker;
+    if (worker == NULL) {
+        return;
+    }
+    // The send thread always waits for the submitted encoder, so the worker is idle here
+    worker->run_worker = false;
+    whist_post_semaphore(worker->job_semaphore);
+    whist_wait_thread(worker->thread, NULL);
+    whist_destroy_semaphore(worker->job_semaphore);
+    whist_destroy_semaphore(worker->done_semaphore);
+    free(worker);
+    context->fec_worker = NULL;
+}
+
+void udp_wait_fec_worker(UDPContext* context, FECEncoder* fec_encoder, int fec_index,
+                         char** buffers, int* buffer_sizes) {
+    UDPFECWorker* worker = context->fec_worker;
+
+    // Every post hands over the next batch, so take them in order until fec_index is in one
+    while (worker->num_taken <= fec_index) {
+        FATAL_ASSERT(worker->fec_encoder == fec_encoder);
+        WhistTimer wait_timer;
+        start_timer(&wait_timer);
+        whist_wait_semaphore(worker->done_semaphore);
+        worker->wait_time += get_timer(&wait_timer);
+
+        int num_batch_buffers =
+            min(UDP_FEC_WORKER_BATCH_SIZE, worker->num_fec_buffers - worker->num_taken);
+        fec_get_redundant_buffers(fec_encoder, worker->num_taken, num_batch_buffers,
+                                  (void**)buffers, buffer_sizes);
+        worker->num_taken += num_batch_buffers;
+
+        if (worker->num_taken == worker->num_fec_buffers) {
+            // That was the last batch, so the worker is idle again
+            worker->fec_encoder = NULL;
+            log_double_statistic(VIDEO_FEC_ENCODE_TIME, worker->encode_time * MS_IN_SECOND);
+            log_double_statistic(VIDEO_FEC_WAIT_TIME, worker->wait_time * MS_IN_SECOND);
+            if (LOG_FEC_ENCODE) {
+                LOG_INFO("[FEC] encoded redundant buffers in %f ms, waited %f ms for them",
+                         worker->encode_time * MS_IN_SECOND, worker->wait_time * MS_IN_SECOND);
+            }
+        }
+    }
+}
+
+// Handles a failed recv()/recvmmsg() call, marking the connection as lost if necessary
+static void udp_handle_recv_error(UDPContext* context) {
+    int error = get_last_network_error();
+    switch (error) {
+        case WHIST_ETIMEDOUT:
+        case WHIST_EWOULDBLOCK:
+#if !OS_IS(OS_WIN32)
+        case EINTR:
+#endif
+            // Break on expected network errors
+            break;
+        case WHIST_ECONNREFUSED: {
+            if (context->connected) {
+                // The connection has been lost
+                LOG_WARNING("UDP connection Lost: ECONNREFUSED");
+                context->connection_lost = true;
+            }
+            break;
+        }
+        default:
+            LOG_WARNING("Unexpected Packet Error: %d", error);
+            break;
+    }
+}
+
+static bool udp_has_batched_packets(UDPContext* context) {
+#if UDP_RECV_BATCHING
+    return context->recv_batch_index < context->recv_batch_count;
+#else
+    UNUSED(context);
+    return false;
+#endif
+}
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+static UDPReceivedPacket* udp_peek_received_packet(UDPContext* context, bool wait) {
+    UDPReceiveQueue* queue = context->recv_queue;
+    int head = atomic_load(&queue->head);
+    if (head == atomic_load(&queue->tail)) {
+        if (!wait) {
+            return NULL;
+        }
+        // The receive thread posts once per batch, but we only wait when the queue is empty,
+        // so drain the posts of batches that have already been consumed. A batch that's queued
+        // up after the drain posts again, and one that was queued up before it is seen below.
+        while (whist_wait_timeout_semaphore(queue->packets_available, 0)) {
+        }
+        // Wait on the receive thread like we would otherwise wait on the socket
+        if (head == atomic_load(&queue->tail) &&
+            (!whist_wait_timeout_semaphore(queue->packets_available, context->timeout) ||
+             head == atomic_load(&queue->tail))) {
+            return NULL;
+        }
+    }
+    return &queue->packets[head];
+}
+
+static void udp_pop_received_packet(UDPContext* context) {
+    UDPReceiveQueue* queue = context->recv_queue;
+    atomic_store(&queue->head, (atomic_load(&queue->head) + 1) % UDP_RECV_QUEUE_SIZE);
+}
+
+static void udp_stop_receive_thread(UDPContext* context) {
+    UDPReceiveQueue* queue = context->recv_queue;
+    if (queue == NULL) {
+        return;
+    }
+    atomic_store(&queue->run_thread, 0);
+    whist_wait_thread(queue->thread, NULL);
+    whist_destroy_semaphore(queue->packets_available);
+    free(queue);
+    context->recv_queue = NULL;
+}
+
+#if UDP_KERNEL_PACING
+static bool udp_is_pacing_qdisc(const char* kind) {
+    return strcmp(kind, "fq") == 0 || strcmp(kind, "etf") == 0;
+}
+
+static bool udp_kernel_pacing_is_enforced(SOCKET socket_fd) {
+    // Find the interface that the connected socket sends through, by its source address
+    struct sockaddr_in local_addr;
+    socklen_t local_addr_len = sizeof(local_addr);
+    if (getsockname(socket_fd, (struct sockaddr*)&local_addr, &local_addr_len) == -1 ||
+        local_addr.sin_family != AF_INET) {
+        return false;
+    }
+    struct ifaddrs* interfaces;
+    if (getifaddrs(&interfaces) == -1) {
+        return false;
+    }
+    unsigned int ifindex = 0;
+    for (struct ifaddrs* interface = interfaces; interface != NULL;
+         interface = interface->ifa_next) {
+        if (interface->ifa_addr != NULL && interface->ifa_addr->sa_family == AF_INET &&
+            ((struct sockaddr_in*)interface->ifa_addr)->sin_addr.s_addr ==
+                local_addr.sin_addr.s_addr) {
+            ifindex = if_nametoindex(interface->ifa_name);
+            break;
+        }
+    }
+    freeifaddrs(interfaces);
+    if (ifindex == 0) {
+        return false;
+    }
+
+    // Dump the qdiscs over rtnetlink. Older kernels ignore the ifindex filter of a dump,
+    // so the replies are filtered again below.
+    int netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (netlink_fd == -1) {
+        return false;
+    }
+    struct {
+        struct nlmsghdr header;
+        struct tcmsg tc;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+    request.header.nlmsg_type = RTM_GETQDISC;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.tc.tcm_family = AF_UNSPEC;
+    request.tc.tcm_ifindex = (int)ifindex;
+    if (send(netlink_fd, &request, request.header.nlmsg_len, 0) == -1) {
+        close(netlink_fd);
+        return false;
+    }
+
+    // The root qdisc has to hold packets until their launch time itself, or, for multiqueue
+    // roots like mq, every qdisc under it (i.e. on each transmit queue) has to
+    char root_kind[IFNAMSIZ] = "";
+    int num_children = 0;
+    bool children_pace = true;
+    bool done = false;
+    bool failed = false;
+    alignas(struct nlmsghdr) char buffer[8192];
+    while (!done && !failed) {
+        ssize_t len = recv(netlink_fd, buffer, sizeof(buffer), 0);
+        if (len <= 0) {
+            failed = true;
+            break;
+        }
+        for (struct nlmsghdr* header = (struct nlmsghdr*)buffer; NLMSG_OK(header, (size_t)len);
+             header = NLMSG_NEXT(header, len)) {
+            if (header->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+            if (header->nlmsg_type == NLMSG_ERROR) {
+                failed = true;
+                break;
+            }
+            struct tcmsg* tc = (struct tcmsg*)NLMSG_DATA(header);
+            if (header->nlmsg_type != RTM_NEWQDISC || tc->tcm_ifindex != (int)ifindex ||
+                tc->tcm_parent == TC_H_INGRESS) {
+                continue;
+            }
+            const char* kind = NULL;
+            int attrs_len = (int)TCA_PAYLOAD(header);
+            for (struct rtattr* attr = TCA_RTA(tc); RTA_OK(attr, attrs_len);
+                 attr = RTA_NEXT(attr, attrs_len)) {
+                if (attr->rta_type == TCA_KIND) {
+                    kind = (const char*)RTA_DATA(attr);
+                }
+            }
+            if (kind == NULL) {
+                continue;
+            }
+            if (tc->tcm_parent == TC_H_ROOT) {
+                snprintf(root_kind, sizeof(root_kind), "%s", kind);
+            } else {
+                num_children++;
+                children_pace = children_pace && udp_is_pacing_qdisc(kind);
+            }
+        }
+    }
+    close(netlink_fd);
+    if (failed) {
+        return false;
+    }
+
+    LOG_INFO("Root qdisc of the video socket's interface: %s", root_kind);
+    if (udp_is_pacing_qdisc(root_kind)) {
+        return true;
+    }
+    bool multiqueue_root = strcmp(root_kind, "mq") == 0 || strcmp(root_kind, "mqprio") == 0;
+    return multiqueue_root && num_children > 0 && children_pace;
+}
+#endif
+
+#if UDP_RECV_BATCHING
+bool udp_enable_recv_timestamps(SOCKET socket) {
+    int enable = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == -1) {
+        LOG_WARNING("Failed to enable SO_TIMESTAMPNS, arrival times will be taken per batch: %d",
+                    get_last_network_error());
+        return false;
+    }
+    return true;
+}
+
+timestamp_us udp_get_recv_timestamp(const struct msghdr* hdr, timestamp_us fallback) {
+    // SO_TIMESTAMPNS uses CLOCK_REALTIME, like current_time_us
+    for (const struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR((struct msghdr*)hdr, (struct cmsghdr*)cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec timestamp;
+            memcpy(&timestamp, CMSG_DATA(cmsg), sizeof(timestamp));
+            return (timestamp_us)timestamp.tv_sec * US_IN_SECOND + timestamp.tv_nsec / NS_IN_US;
+        }
+    }
+    return fallback;
+}
+
+// Pull up to UDP_RECV_BATCH_SIZE datagrams out of the socket with a single syscall.
+// Returns true if at least one datagram is now pending in the batch.
+static bool udp_recv_batch(UDPContext* context) {
+    static double last_time_after_recv = 0;
+
+    if (PLOT_UDP_RECV_GAP) {
+        double current_time = get_timestamp_sec();
+        double gap = current_time - last_time_after_recv;
+        whist_plotter_insert_sample("udp_recv_gap", current_time, gap * MS_IN_SECOND);
+    }
+
+    for (int i = 0; i < UDP_RECV_BATCH_SIZE; i++) {
+        // recvmmsg overwrites msg_namelen/msg_len, so the headers must be reset on every call
+        context->recv_batch_iovecs[i].iov_base = &context->recv_batch_packets[i];
+        context->recv_batch_iovecs[i].iov_len = sizeof(UDPNetworkPacket);
+        struct msghdr* hdr = &context->recv_batch_msgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &context->recv_batch_addrs[i];
+        hdr->msg_namelen = sizeof(context->recv_batch_addrs[i]);
+        hdr->msg_iov = &context->recv_batch_iovecs[i];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = context->recv_batch_control[i];
+        hdr->msg_controllen = sizeof(context->recv_batch_control[i]);
+        context->recv_batch_msgs[i].msg_len = 0;
+    }
+
+    // MSG_WAITFORONE waits for the socket's timeout only until the first datagram arrives,
+    // and then returns with whatever else was already queued
+    int num_received = recvmmsg(context->socket, context->recv_batch_msgs, UDP_RECV_BATCH_SIZE,
+                                MSG_WAITFORONE, NULL);
+
+    if (PLOT_UDP_RECV_GAP) {
+        last_time_after_recv = get_timestamp_sec();
+    }
+
+    context->recv_batch_index = 0;
+    if (num_received <= 0) {
+        context->recv_batch_count = 0;
+        if (num_received < 0) {
+            udp_handle_recv_error(context);
+        }
+        return false;
+    }
+
+    context->recv_batch_count = num_received;
+    // The datagrams of a batch may have arrived over several milliseconds, which is exactly the
+    // spacing that congestion control measures, so each gets its own kernel timestamp
+    timestamp_us recv_time = current_time_us();
+    for (int i = 0; i < num_received; i++) {
+        context->recv_batch_arrival_times[i] =
+            udp_get_recv_timestamp(&context->recv_batch_msgs[i].msg_hdr, recv_time);
+    }
+    log_double_statistic(NETWORK_UDP_PACKETS_PER_RECV, (double)num_received);
+    return true;
+}
+#endif
+
+/**
+ * @brief                        Verifies and decrypts a UDPNetworkPacket that was received
+ *
+ * @param context                The UDPContext that received the packet
+ * @param udp_packet             The UDPPacket buffer to write to.
+ *                               This buffer is expected to be of size sizeof(UDPPacket)
+ * @param udp_network_packet     The UDPNetworkPacket that was received over the network
+ * @param recv_len               The number of bytes that were received
+ * @param network_payload_size   Writes the payload size of the packet over the network (if
+ *                               non-NULL)
+ *
+ * @returns                      True if udp_packet now holds a valid packet, false otherwise
+ */
+static bool udp_decode_network_packet(UDPContext* context, UDPPacket* udp_packet,
+                                      UDPNetworkPacket* udp_network_packet, int recv_len,
+                                      int* network_payload_size) {
+    int decrypted_len;
+
+    // Verify the reported packet length
+    // This is before the `decrypt_packet` call, so the packet might be malicious
+    // ~ We check recv_len against UDPNETWORKPACKET_HEADER_SIZE first, to ensure that
+    //  the access to udp_network_packet->{payload_size/aes_metadata} is in-bounds
+    // ~ We check bounds on udp_network_packet->payload_size, so that the
+    //  the addition check on payload_size doesn't maliciously overflow
+    // ~ We make an addition check, to ensure that the payload_size matches recv_len
+    if (recv_len < UDPNETWORKPACKET_HEADER_SIZE || udp_network_packet->payload_size < 0 ||
+        (int)sizeof(udp_network_packet->payload) < udp_network_packet->payload_size ||
+        UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet->payload_size != recv_len) {
+        LOG_WARNING("The UDPPacket's payload size %d doesn't agree with recv_len %d!",
+                    udp_network_packet->payload_size, recv_len);
+        return false;
+    }
+
+    if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
+        // Decrypt the packet, into udp_packet
+        decrypted_len = aes_session_decrypt_packet(
+            context->aes_session, udp_packet, sizeof(UDPPacket), &udp_network_packet->aes_metadata,
+            udp_network_packet->payload, udp_network_packet->payload_size);
+        // If there was an issue decrypting it, warn and return NULL
+        if (decrypted_len < 0) {
+            // This is warning, since it could just be someone else sending packets,
+            // Not necessarily our fault
+            LOG_WARNING("Failed to decrypt packet");
+            return false;
+        }
+        // AFTER THIS LINE,
+        // The contents of udp_packet are confirmed to be from the server,
+        // And thus can be trusted as not maliciously formed.
+    } else {
+        // The decrypted packet is just in the payload, during no-encryption dev mode
+        decrypted_len = udp_network_packet->payload_size;
+        memcpy(udp_packet, udp_network_packet->payload, udp_network_packet->payload_size);
+    }
+    if (LOG_NETWORKING) {
+        LOG_INFO("Received a WhistPacket of size %d over UDP", decrypted_len);
+    }
+    if (network_payload_size) {
+        *network_payload_size = (UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet->payload_size);
+    }
+
+    // Compact whist segments are expanded into a full UDPPacket, for the rest of the code
+    bool compact = decrypted_len > 0 && (*(unsigned char*)udp_packet & UDP_COMPACT_SEGMENT_FLAG);
+    if (compact) {
+        if (!udp_expand_compact_segment(context, udp_packet, decrypted_len)) {
+            return false;
+        }
+        decrypted_len = get_udp_packet_size(udp_packet);
+    }
+
+    // Verify the UDP Packet's size
+    FATAL_ASSERT(decrypted_len == get_udp_packet_size(udp_packet));
+
+    return true;
+}
+
 static bool udp_get_udp_packet(UDPContext* context, UDPPacket* udp_packet,
                                timestamp_us* arrival_time, int* network_payload_size) {
+#if UDP_RECV_BATCHING
+    // Only go to the socket once every datagram of the previous batch has been consumed
+    if (!udp_has_batched_packets(context) && !udp_recv_batch(context)) {
+        return false;
+    }
+
+    int batch_index = context->recv_batch_index++;
+    UDPNetworkPacket* udp_network_packet = &context->recv_batch_packets[batch_index];
+    int recv_len = (int)context->recv_batch_msgs[batch_index].msg_len;
+    context->last_addr = context->recv_batch_addrs[batch_index];
+
+    if (recv_len <= 0) {
+        // Ignore packets of size 0
+        return false;
+    }
+
+    // Tracks arrival time for congestion control algo
+    if (arrival_time) {
+        *arrival_time = context->recv_batch_arrival_times[batch_index];
+    }
+
+    return udp_decode_network_packet(context, udp_packet, udp_network_packet, recv_len,
+                                     network_payload_size);
+#else
     // Wait to receive a packet over UDP, until timing out
     UDPNetworkPacket udp_network_packet;
     socklen_t slen = sizeof(context->last_addr);
@@ -1684,88 +3737,24 @@ static bool udp_get_udp_packet(UDPContext* context, UDPPacket* udp_packet,
 
     // If the packet was successfully received, decrypt and process it it
     if (recv_len > 0) {
-        int decrypted_len;
-
         // Tracks arrival time for congestion control algo
         if (arrival_time) {
             *arrival_time = current_time_us();
         }
 
-        // Verify the reported packet length
-        // This is before the `decrypt_packet` call, so the packet might be malicious
-        // ~ We check recv_len against UDPNETWORKPACKET_HEADER_SIZE first, to ensure that
-        //  the access to udp_network_packet.{payload_size/aes_metadata} is in-bounds
-        // ~ We check bounds on udp_network_packet.payload_size, so that the
-        //  the addition check on payload_size doesn't maliciously overflow
-        // ~ We make an addition check, to ensure that the payload_size matches recv_len
-        if (recv_len < UDPNETWORKPACKET_HEADER_SIZE || udp_network_packet.payload_size < 0 ||
-            (int)sizeof(udp_network_packet.payload) < udp_network_packet.payload_size ||
-            UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet.payload_size != recv_len) {
-            LOG_WARNING("The UDPPacket's payload size %d doesn't agree with recv_len %d!",
-                        udp_network_packet.payload_size, recv_len);
-            return false;
-        }
-
-        if (FEATURE_ENABLED(PACKET_ENCRYPTION)) {
-            // Decrypt the packet, into udp_packet
-            decrypted_len =
-                decrypt_packet(udp_packet, sizeof(UDPPacket), udp_network_packet.aes_metadata,
-                               udp_network_packet.payload, udp_network_packet.payload_size,
-                               context->binary_aes_private_key);
-            // If there was an issue decrypting it, warn and return NULL
-            if (decrypted_len < 0) {
-                // This is warning, since it could just be someone else sending packets,
-                // Not necessarily our fault
-                LOG_WARNING("Failed to decrypt packet");
-                return false;
-            }
-            // AFTER THIS LINE,
-            // The contents of udp_packet are confirmed to be from the server,
-            // And thus can be trusted as not maliciously formed.
-        } else {
-            // The decrypted packet is just in the payload, during no-encryption dev mode
-            decrypted_len = udp_network_packet.payload_size;
-            memcpy(udp_packet, udp_network_packet.payload, udp_network_packet.payload_size);
-        }
-        if (LOG_NETWORKING) {
-            LOG_INFO("Received a WhistPacket of size %d over UDP", decrypted_len);
-        }
-        if (network_payload_size) {
-            *network_payload_size =
-                (UDPNETWORKPACKET_HEADER_SIZE + udp_network_packet.payload_size);
-        }
-
-        // Verify the UDP Packet's size
-        FATAL_ASSERT(decrypted_len == get_udp_packet_size(udp_packet));
-
-        return true;
+        return udp_decode_network_packet(context, udp_packet, &udp_network_packet, recv_len,
+                                         network_payload_size);
     } else {
         // Network error or no packets to receive
         if (recv_len < 0) {
-            int error = get_last_network_error();
-            switch (error) {
-                case WHIST_ETIMEDOUT:
-                case WHIST_EWOULDBLOCK:
-                    // Break on expected network errors
-                    break;
-                case WHIST_ECONNREFUSED: {
-                    if (context->connected) {
-                        // The connection has been lost
-                        LOG_WARNING("UDP connection Lost: ECONNREFUSED");
-                        context->connection_lost = true;
-                    }
-                    break;
-                }
-                default:
-                    LOG_WARNING("Unexpected Packet Error: %d", error);
-                    break;
-            }
+            udp_handle_recv_error(context);
         } else {
             // Ignore packets of size 0
         }
 
         return false;
     }
+#endif
 }
 
 /*
@@ -1777,61 +3766,37 @@ UDP Message Handling
 void udp_handle_message(UDPContext* context, UDPPacket* packet) {
     switch (packet->type) {
         case UDP_NACK: {
-            FATAL_ASSERT(packet->udp_nack_data.whist_type == PACKET_VIDEO);
-            NackID nack_id;
-            nack_id.frame_id = packet->udp_nack_data.id;
+            if (packet->udp_nack_data.whist_type != PACKET_VIDEO || packet->udp_nack_data.id <= 0) {
+                LOG_WARNING("Dropping a malformed nack for type %d, ID %d",
+                            (int)packet->udp_nack_data.whist_type, packet->udp_nack_data.id);
+                break;
+            }
+            NackBatch nack_batch = {};
+            nack_batch.frame_id = packet->udp_nack_data.id;
             if ((short)packet->udp_nack_data.index >= 0) {
-                nack_id.packet_index = packet->udp_nack_data.index;
-                if (fifo_queue_enqueue_item((QueueContext*)context->nack_queue, &nack_id) < 0) {
-                    LOG_ERROR("Failed to enqueue NACK request");
-                }
+                nack_batch.first_index = packet->udp_nack_data.index;
+                nack_batch.num_bits = 1;
+                nack_batch.indices[0] = 1 << (CHAR_BIT - 1);
             } else {
                 // NACK for all packets in a frame when index is negative
-                whist_lock_mutex(context->nack_mutex[PACKET_VIDEO]);
-                UDPPacket* first_packet =
-                    &context
-                         ->nack_buffers[PACKET_VIDEO][nack_id.frame_id %
-                                                      context->nack_num_buffers[PACKET_VIDEO]][0];
-                if (first_packet->udp_whist_segment_data.id != nack_id.frame_id) {
-                    LOG_WARNING("NACKed video packet %d not found, ID %d was located instead.",
-                                nack_id.frame_id, first_packet->udp_whist_segment_data.id);
-                    whist_unlock_mutex(context->nack_mutex[PACKET_VIDEO]);
-                    break;
-                }
-                for (int i = 0; i < first_packet->udp_whist_segment_data.num_indices; i++) {
-                    nack_id.packet_index = i;
-                    if (LOG_NACKING) {
-                        LOG_INFO("Generating Nack for Frame ID %d, index %d", nack_id.frame_id, i);
-                    }
-                    if (fifo_queue_enqueue_item((QueueContext*)context->nack_queue, &nack_id) < 0) {
-                        LOG_ERROR("Failed to enqueue NACK request");
-                    }
-                }
-                whist_unlock_mutex(context->nack_mutex[PACKET_VIDEO]);
+                nack_batch.first_index = -1;
+            }
+            if (fifo_queue_enqueue_item((QueueContext*)context->nack_queue, &nack_batch) < 0) {
+                LOG_ERROR("Failed to enqueue NACK request");
             }
             break;
         }
-        case UDP_BITARRAY_NACK: {
-            // nack for everything in the bitarray
-            BitArray* bit_arr = bit_array_create(packet->udp_bitarray_nack_data.numBits);
-            bit_array_clear_all(bit_arr);
-
-            memcpy(bit_array_get_bits(bit_arr), packet->udp_bitarray_nack_data.ba_raw,
-                   BITS_TO_CHARS(packet->udp_bitarray_nack_data.numBits));
-
-            FATAL_ASSERT(packet->udp_bitarray_nack_data.type == PACKET_VIDEO);
-            NackID nack_id;
-            nack_id.frame_id = packet->udp_bitarray_nack_data.id;
-            for (int i = packet->udp_bitarray_nack_data.index;
-                 i < packet->udp_bitarray_nack_data.numBits; i++) {
-                if (bit_array_test_bit(bit_arr, i)) {
-                    nack_id.packet_index = i;
-                    if (fifo_queue_enqueue_item((QueueContext*)context->nack_queue, &nack_id) < 0) {
-                        LOG_ERROR("Failed to enqueue NACK request");
-                    }
-                }
+        case UDP_BITARRAY_NACK:
+        case UDP_RANGE_NACK: {
+            // nack for everything in the bitarray, which is serviced as a single batch
+            NackBatch nack_batch;
+            if (!udp_unpack_bitarray_nack(packet, &nack_batch)) {
+                LOG_WARNING("Dropping a malformed bitarray nack");
+                break;
+            }
+            if (fifo_queue_enqueue_item((QueueContext*)context->nack_queue, &nack_batch) < 0) {
+                LOG_ERROR("Failed to enqueue NACK request");
             }
-            bit_array_free(bit_arr);
             break;
         }
         case UDP_PING: {
@@ -1871,6 +3836,47 @@ void udp_handle_nack(UDPContext* context, WhistPacketType type, int packet_id, i
      * Respond to a client nack by sending the requested packet from the nack buffer if possible.
      */
 
+    whist_lock_mutex(context->nack_mutex[type]);
+    udp_handle_nack_locked(context, type, packet_id, packet_index, is_duplicate);
+    whist_unlock_mutex(context->nack_mutex[type]);
+}
+
+void udp_handle_nack_batch(UDPContext* context, const NackBatch* nack_batch) {
+    /*
+     * Respond to all of the nacks of a batch, while holding the video nack mutex just once.
+     */
+
+    whist_lock_mutex(context->nack_mutex[PACKET_VIDEO]);
+    if (nack_batch->first_index == -1) {
+        // Nack every index of the frame
+        int nack_buffer_index = nack_batch->frame_id % context->nack_num_buffers[PACKET_VIDEO];
+        int stored_id = context->nack_buffer_ids[PACKET_VIDEO][nack_buffer_index];
+        if (stored_id != nack_batch->frame_id) {
+            LOG_WARNING("NACKed video packet %d not found, ID %d was located instead.",
+                        nack_batch->frame_id, stored_id);
+        } else {
+            int num_indices = context->nack_buffer_num_indices[PACKET_VIDEO][nack_buffer_index];
+            for (int i = 0; i < num_indices; i++) {
+                if (LOG_NACKING) {
+                    LOG_INFO("Generating Nack for Frame ID %d, index %d", nack_batch->frame_id,
+                             i);
+                }
+                udp_handle_nack_locked(context, PACKET_VIDEO, nack_batch->frame_id, i, false);
+            }
+        }
+    } else {
+        for (int i = 0; i < nack_batch->num_bits; i++) {
+            if (nack_batch->indices[i / CHAR_BIT] & (1 << (CHAR_BIT - 1 - i % CHAR_BIT))) {
+                udp_handle_nack_locked(context, PACKET_VIDEO, nack_batch->frame_id,
+                                       nack_batch->first_index + i, false);
+            }
+        }
+    }
+    whist_unlock_mutex(context->nack_mutex[PACKET_VIDEO]);
+}
+
+void udp_handle_nack_locked(UDPContext* context, WhistPacketType type, int packet_id,
+                            int packet_index, bool is_duplicate) {
     int type_index = (int)type;
     FATAL_ASSERT(type_index < NUM_PACKET_TYPES);
     FATAL_ASSERT(context->nack_buffers[type_index] != NULL);
@@ -1887,28 +3893,31 @@ void udp_handle_nack(UDPContext* context, WhistPacketType type, int packet_id, i
         return;
     }
 
-    // retrieve the WhistPacket from the nack buffer and send using `udp_send_udp_packet`
-    // TODO: change to WhistUDPPacket
-    whist_lock_mutex(context->nack_mutex[type_index]);
-
+    // retrieve the wire-ready segment from the nack buffer and resend it
+    int nack_buffer_index = packet_id % context->nack_num_buffers[type_index];
+    int stored_id = context->nack_buffer_ids[type_index][nack_buffer_index];
     // Check if the nack buffer we're looking for is valid
-    if (context->nack_buffer_valid[type_index][packet_id % context->nack_num_buffers[type_index]]
-                                  [packet_index]) {
-        UDPPacket* packet =
-            &context->nack_buffers[type_index][packet_id % context->nack_num_buffers[type_index]]
-                                  [packet_index];
+    if (context->nack_buffer_valid[type_index][nack_buffer_index][packet_index]) {
+        UDPNetworkPacket* udp_network_packet =
+            &context->nack_buffers[type_index][nack_buffer_index][packet_index];
 
         // Check that the nack buffer ID's match
-        if (packet->udp_whist_segment_data.id == packet_id) {
-            packet->udp_whist_segment_data.is_a_nack = !is_duplicate;
-            packet->udp_whist_segment_data.is_a_duplicate = is_duplicate;
+        if (stored_id == packet_id) {
             // Wrap in PACKET_VIDEO to prevent verbose audio.c logs
             // TODO: Fix this by making resend_packet not trigger nack logs
             if (LOG_NACKING && type == PACKET_VIDEO && !is_duplicate) {
                 LOG_INFO("NACKed video packet ID %d Index %d found of length %d. Relaying!",
-                         packet_id, packet_index, packet->udp_whist_segment_data.segment_size);
+                         packet_id, packet_index, udp_network_packet->payload_size);
+            }
+            if (is_duplicate) {
+                context->send_statistics[type_index].num_duplicate_segments++;
+            } else {
+                context->send_statistics[type_index].num_nacked_segments++;
             }
-            udp_send_udp_packet(context, packet);
+            // The caller is responsible for flushing any batched video segments
+            udp_send_network_packet(context, type, udp_network_packet,
+                                    is_duplicate ? UDP_RETRANSMISSION_FLAG_DUPLICATE
+                                                 : UDP_RETRANSMISSION_FLAG_NACK);
         } else {
             // TODO: Calculate an aggregate and LOG_WARNING that,
             // Insteads of per-packet logging
@@ -1916,8 +3925,7 @@ void udp_handle_nack(UDPContext* context, WhistPacketType type, int packet_id, i
                 LOG_WARNING(
                     "NACKed %s packet %d %d not found, ID %d was "
                     "located instead.",
-                    type == PACKET_VIDEO ? "video" : "audio", packet_id, packet_index,
-                    packet->udp_whist_segment_data.id);
+                    type == PACKET_VIDEO ? "video" : "audio", packet_id, packet_index, stored_id);
             }
         }
     } else {
@@ -1928,8 +3936,6 @@ void udp_handle_nack(UDPContext* context, WhistPacketType type, int packet_id, i
                         type == PACKET_VIDEO ? "video" : "audio", packet_id, packet_index);
         }
     }
-
-    whist_unlock_mutex(context->nack_mutex[type_index]);
 }
 
 void udp_handle_stream_reset(UDPContext* context, WhistPacketType type, int greatest_failed_id) {
@@ -2067,3 +4073,105 @@ int udp_get_socket_queue_len(void* raw_context) {
     UDPContext* context = (UDPContext*)raw_context;
     return socket_get_queue_len(context->socket);
 }
+
+bool udp_send_test_datagram(void* raw_context, bool decryptable) {
+    UDPContext* context = (UDPContext*)raw_context;
+    if (decryptable) {
+        UDPPacket ping = {};
+        ping.type = UDP_PING;
+        ping.udp_ping_data.send_timestamp = current_time_us();
+        return udp_send_udp_packet(context, &ping) == 0;
+    } else {
+        char garbage[64];
+        memset(garbage, 0xAB, sizeof(garbage));
+        return send(context->socket, garbage, sizeof(garbage), 0) == (int)sizeof(garbage);
+    }
+}
+
+bool udp_wait_for_received_packets(void* raw_context, int timeout_ms) {
+    UDPContext* context = (UDPContext*)raw_context;
+    return whist_wait_timeout_semaphore(context->recv_queue->packets_available, timeout_ms);
+}
+
+int udp_get_num_received_packets(void* raw_context) {
+    UDPContext* context = (UDPContext*)raw_context;
+    UDPReceiveQueue* queue = context->recv_queue;
+    return (atomic_load(&queue->tail) - atomic_load(&queue->head) + UDP_RECV_QUEUE_SIZE) %
+           UDP_RECV_QUEUE_SIZE;
+}
+
+int udp_get_num_dropped_packets(void* raw_context) {
+    UDPContext* context = (UDPContext*)raw_context;
+    return atomic_load(&context->recv_queue->num_dropped);
+}
+
+bool udp_round_trip_compact_segment(void* raw_sender_context, void* raw_receiver_context,
+                                    WhistSegment* segment, int* group_id) {
+    UDPContext* sender_context = (UDPContext*)raw_sender_context;
+    UDPContext* receiver_context = (UDPContext*)raw_receiver_context;
+    if (sender_context->wire_version < UDP_WIRE_VERSION_COMPACT) {
+        return false;
+    }
+
+    UDPPacket sent_packet = {};
+    sent_packet.type = UDP_WHIST_SEGMENT;
+    sent_packet.group_id = *group_id;
+    sent_packet.udp_whist_segment_data = *segment;
+    // The header is written right where the receiver decrypts to, followed by the data
+    UDPPacket received_packet;
+    int header_size =
+        udp_write_whist_segment_header(sender_context, &sent_packet, (char*)&received_packet);
+    memcpy((char*)&received_packet + header_size, segment->segment_data, segment->segment_size);
+    if (!udp_expand_compact_segment(receiver_context, &received_packet,
+                                    header_size + segment->segment_size)) {
+        return false;
+    }
+    *segment = received_packet.udp_whist_segment_data;
+    *group_id = received_packet.group_id;
+    return true;
+}
+
+int udp_round_trip_range_nacks(const uint64_t* indices, int num_indices,
+                               uint64_t* received_indices) {
+    UDPPacket packet;
+    int num_messages = 0;
+    int index = 0;
+    while (udp_pack_range_nack(&packet, PACKET_VIDEO, 1, indices, num_indices, &index)) {
+        // Only the bytes that are sent reach the peer
+        UDPPacket received_packet;
+        memset(&received_packet, 0xFF, sizeof(received_packet));
+        memcpy(&received_packet, &packet, get_udp_packet_size(&packet));
+        NackBatch nack_batch;
+        if (!udp_unpack_bitarray_nack(&received_packet, &nack_batch)) {
+            return -1;
+        }
+        for (int i = 0; i < nack_batch.num_bits; i++) {
+            if (nack_batch.indices[i / CHAR_BIT] & (1 << (CHAR_BIT - 1 - i % CHAR_BIT))) {
+                int nacked_index = nack_batch.first_index + i;
+                received_indices[nacked_index / 64] |= (uint64_t)1 << (nacked_index % 64);
+            }
+        }
+        num_messages++;
+    }
+    return num_messages;
+}
+
+bool udp_accepts_bitarray_nack(bool range, WhistPacketType type, int id, int index,
+                               int num_bits) {
+    UDPPacket packet = {};
+    if (range) {
+        packet.type = UDP_RANGE_NACK;
+        packet.udp_range_nack_data.type = type;
+        packet.udp_range_nack_data.id = id;
+        packet.udp_range_nack_data.first_index = index;
+        packet.udp_range_nack_data.num_bits = num_bits;
+    } else {
+        packet.type = UDP_BITARRAY_NACK;
+        packet.udp_bitarray_nack_data.type = type;
+        packet.udp_bitarray_nack_data.id = id;
+        packet.udp_bitarray_nack_data.index = index;
+        packet.udp_bitarray_nack_data.numBits = num_bits;
+    }
+    NackBatch nack_batch;
+    return udp_unpack_bitarray_nack(&packet, &nack_batch);
+}
@@ -66,6 +66,18 @@ typedef struct {
     timestamp_us arrival_time;    // This time is measured in client's clock
 } GroupStats;
 
+// Counts of the segments that a UDP context has sent of a WhistPacketType, since it was created
+typedef struct {
+    // Segments that carry the packets themselves, the first time that they're sent
+    uint64_t num_original_segments;
+    // Segments that carry FEC redundancy
+    uint64_t num_fec_segments;
+    // Segments that were resent because the peer nacked them
+    uint64_t num_nacked_segments;
+    // Segments that were resent by udp_resend_packet, to saturate the bandwidth
+    uint64_t num_duplicate_segments;
+} UDPSendStatistics;
+
 /*
 ============================
 Public Functions
@@ -145,6 +157,58 @@ int create_udp_listen_socket(SOCKET* sock, int port, int timeout_ms);
  */
 int udp_get_num_pending_frames(SocketContext* context, WhistPacketType type);
 
+/**
+ * @brief                          Get the ID of the next frame of the given type to render,
+ *                                 i.e. the one that get_packet will return once it's complete
+ *
+ * @param context                  The UDP Socket Context
+ * @param type                     The type of frames to query for
+ *
+ * @returns                        The ID of the next frame, or -1 if there's no ring buffer for
+ *                                 that type
+ */
+int udp_get_next_frame_id(SocketContext* context, WhistPacketType type);
+
+/**
+ * @brief                          Read the start of a frame that's still being received, as far
+ *                                 as all of its packets have arrived. See
+ *                                 ring_buffer_read_frame_prefix.
+ *
+ * @param context                  The UDP Socket Context
+ * @param type                     The type of the frame
+ * @param id                       The ID of the frame
+ * @param buffer                   The buffer to read the frame's WhistPacket into, which must be
+ *                                 large enough for any frame of that type
+ * @param offset                   The number of bytes already read into buffer by an earlier call
+ *                                 for the same frame
+ *
+ * @returns                        The number of bytes of the frame's WhistPacket in buffer,
+ *                                 or -1 if the frame isn't being received
+ */
+int udp_read_frame_prefix(SocketContext* context, WhistPacketType type, int id, char* buffer,
+                          int offset);
+
+/**
+ * @brief                          Like send_packet, but the payload is scattered across
+ *                                 payload_iov. The segments are gathered straight from the pieces
+ *                                 while they're encrypted into the nack buffer, so the payload is
+ *                                 never copied into one contiguous buffer first.
+ *
+ * @param context                  The UDP Socket Context
+ * @param type                     The WhistPacketType of the packet
+ * @param payload_iov              The pieces of the payload, in order.
+ *                                 They only need to stay valid until this function returns.
+ * @param payload_iov_count        The number of pieces in payload_iov
+ * @param packet_id                A Packet ID for the packet.
+ * @param start_of_stream          Whether or not the client may "skip" to this ID
+ *
+ * @returns                        Will return -1 on failure,
+ *                                 will return 0 on success
+ */
+int udp_send_packet_iov(SocketContext* context, WhistPacketType type,
+                        const WhistIOVec* payload_iov, int payload_iov_count, int packet_id,
+                        bool start_of_stream);
+
 // TODO: Is needed for audio.c, video.c redundancy, but should be pulled into udp.c somehow
 /**
  * @brief                          Resends the audio/video packet of specified frame id and packet
@@ -204,6 +268,21 @@ bool udp_handle_pending_nacks(void* raw_context);
 void udp_register_ring_buffer(SocketContext* context, WhistPacketType type, int max_frame_size,
                               int num_buffers);
 
+/**
+ * @brief                          Starts a realtime thread that keeps pulling packets from the
+ *                                 socket and decrypting them, so that the socket is drained even
+ *                                 while socket_update is busy reassembling frames.
+ *                                 From then on, socket_update processes the packets that this
+ *                                 thread has queued up, instead of reading the socket itself.
+ *                                 The thread is stopped when the socket context is destroyed.
+ *
+ * @param context                  The SocketContext to receive packets for
+ *
+ * @note                           This function is not thread-safe on SocketContext,
+ *                                 and socket_update must only be called from one thread
+ */
+void udp_start_receive_thread(SocketContext* context);
+
 /**
  * @brief                          Handle screen resize, by adjusting the bitrates accordingly
  *
@@ -213,6 +292,17 @@ void udp_register_ring_buffer(SocketContext* context, WhistPacketType type, int
  */
 void udp_handle_resize(SocketContext* context, int dpi);
 
+/**
+ * @brief                          Check whether the connection's bandwidth is too low to stream
+ *                                 at even the minimum bitrate
+ *
+ * @param context                  The UDP SocketContext
+ *
+ * @returns                        True if the congestion controller is stuck at the minimum
+ *                                 bitrate, false otherwise or if the context isn't connected
+ */
+bool udp_is_insufficient_bandwidth(SocketContext* context);
+
 // TODO: Move to network.h, and make it more generic (E.g., "avg bitrate" / "fec ratio")
 NetworkSettings udp_get_network_settings(SocketContext* context);
 
@@ -223,6 +313,19 @@ void udp_handle_network_settings(void* raw_context, NetworkSettings network_sett
 
 size_t udp_packet_max_size(void);
 
+/**
+ * @brief                          Get the counts of the segments that have been sent so far,
+ *                                 which is how much the FEC and the nacks cost on top of the
+ *                                 packets themselves
+ *
+ * @param context                  The UDP SocketContext
+ * @param type                     The WhistPacketType to get the counts of
+ *
+ * @returns                        The counts. They're updated by the sending threads without
+ *                                 locking, so they can be off by a few while those are running.
+ */
+UDPSendStatistics udp_get_send_statistics(SocketContext* context, WhistPacketType type);
+
 /**
  * @brief                          Get length queued in the udp socket of the context
  * @returns                        num of bytes queued in the udp socket
@@ -0,0 +1,144 @@
+#ifndef WHIST_UDP_TEST_H
+#define WHIST_UDP_TEST_H
+/**
+ * Copyright (c) 2022 Whist Technologies, Inc.
+ * @file udp_test.h
+ * @brief Internals of udp.cpp that the unit tests exercise directly.
+ *        Nothing but udp.cpp and the tests should include this.
+ */
+
+/*
+============================
+Includes
+============================
+*/
+#include <whist/core/whist.h>
+#include <whist/network/udp.h>
+
+#if OS_IS(OS_LINUX)
+#include <sys/socket.h>
+#endif
+
+/*
+============================
+Public Functions
+============================
+*/
+
+/**
+ * @brief                          Sends a whist segment's header through the compact wire
+ *                                 format, from one context to another, without the network
+ *
+ * @param raw_sender_context       The UDPContext that writes the compact header,
+ *                                 which must have negotiated compact headers
+ * @param raw_receiver_context     The UDPContext that expands it again,
+ *                                 and unwraps the group ID and departure time
+ * @param segment                  The segment to send, which is overwritten by the received one
+ * @param group_id                 The group ID to send, which is overwritten by the received one
+ *
+ * @returns                        True on success, false if the segment couldn't be sent or
+ *                                 expanded
+ */
+bool udp_round_trip_compact_segment(void* raw_sender_context, void* raw_receiver_context,
+                                    WhistSegment* segment, int* group_id);
+
+/**
+ * @brief                          Packs a bitset of nacked indices into UDP_RANGE_NACK
+ *                                 messages, the way the client sends them, and unpacks
+ *                                 each of them the way the server receives them
+ *
+ * @param indices                  Bitset of the indices to nack, bit i of word i / 64 being
+ *                                 index i
+ * @param num_indices              The number of indices that the bitset covers
+ * @param received_indices         Zeroed bitset of the same size, which every index that the
+ *                                 server would nack gets set in
+ *
+ * @returns                        The number of messages, or -1 if the server would have
+ *                                 dropped one of them
+ */
+int udp_round_trip_range_nacks(const uint64_t* indices, int num_indices,
+                               uint64_t* received_indices);
+
+/**
+ * @brief                          Checks whether the server would accept a received bitarray
+ *                                 nack, rather than drop it as malformed
+ *
+ * @param range                    Whether it's a UDP_RANGE_NACK, else a UDP_BITARRAY_NACK
+ * @param type                     The packet type that it nacks
+ * @param id                       The ID of the frame that it nacks
+ * @param index                    The first index of a UDP_RANGE_NACK, or the first bit
+ *                                 of a UDP_BITARRAY_NACK
+ * @param num_bits                 The number of bits in its bitarray
+ *
+ * @returns                        True if it would be accepted
+ */
+bool udp_accepts_bitarray_nack(bool range, WhistPacketType type, int id, int index,
+                               int num_bits);
+
+/**
+ * @brief                          Sends a datagram to the context's peer, straight through
+ *                                 the socket
+ *
+ * @param raw_context              The UDPContext to send from
+ * @param decryptable              Whether to send a ping that the peer can decrypt,
+ *                                 or garbage that it has to reject
+ *
+ * @returns                        True on success, false if the datagram couldn't be sent
+ */
+bool udp_send_test_datagram(void* raw_context, bool decryptable);
+
+/**
+ * @brief                          Waits for the receive thread to signal that it has queued
+ *                                 packets, without taking any out of the queue
+ *
+ * @param raw_context              The UDPContext whose receive thread is running
+ * @param timeout_ms               How long to wait for the signal
+ *
+ * @returns                        True if the receive thread signalled in time
+ */
+bool udp_wait_for_received_packets(void* raw_context, int timeout_ms);
+
+/**
+ * @brief                          Gets how many packets are waiting in the receive queue
+ *
+ * @param raw_context              The UDPContext whose receive thread is running
+ *
+ * @returns                        The number of queued packets
+ */
+int udp_get_num_received_packets(void* raw_context);
+
+/**
+ * @brief                          Gets how many packets the receive thread has dropped,
+ *                                 since the receive queue was full
+ *
+ * @param raw_context              The UDPContext whose receive thread is running
+ *
+ * @returns                        The number of dropped packets
+ */
+int udp_get_num_dropped_packets(void* raw_context);
+
+#if OS_IS(OS_LINUX)
+/**
+ * @brief                          Has the kernel stamp every datagram that the socket receives
+ *                                 with its arrival time, see udp_get_recv_timestamp
+ *
+ * @param socket                   The socket to stamp the datagrams of
+ *
+ * @returns                        True on success, false if the kernel doesn't support it
+ */
+bool udp_enable_recv_timestamps(SOCKET socket);
+
+/**
+ * @brief                          Gets the arrival time of a datagram received with recvmsg or
+ *                                 recvmmsg from a socket passed to udp_enable_recv_timestamps
+ *
+ * @param hdr                      The message header that the datagram was received with,
+ *                                 including its control messages
+ * @param fallback                 The time to return if the datagram wasn't stamped
+ *
+ * @returns                        The arrival time, in the clock of current_time_us
+ */
+timestamp_us udp_get_recv_timestamp(const struct msghdr* hdr, timestamp_us fallback);
+#endif
+
+#endif  // WHIST_UDP_TEST_H
@@ -29,7 +29,9 @@ Includes
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include <time.h>
+#include <whist/utils/atomic.h>
 
 /*
 ============================
@@ -48,6 +50,64 @@ Defines
         return -1;                         \
     } while (0)
 
+// Same as HANDLE_SSL_ERROR, but for a cipher context that's owned by the caller,
+// and thus must not be freed
+#define HANDLE_SSL_ERROR_KEEP_CTX()       \
+    do {                                  \
+        LOG_INFO("OpenSSL Error caught"); \
+        print_ssl_errors();               \
+        return -1;                        \
+    } while (0)
+
+// The number of pairs of cipher contexts that an AESSession can hand out at the same time.
+// Any further concurrent packets share one more pair of cipher contexts, behind a mutex.
+#define AES_SESSION_NUM_CONTEXTS 16
+
+// The IV is (salt)(session number)(cipher context index)(counter), see create_aes_session.
+// The nonce counter takes up the IV bytes that aren't used by the rest.
+#define NONCE_SALT_SIZE 4
+#define NONCE_SESSION_NUMBER_SIZE 2
+#define NONCE_COUNTER_SIZE (IV_SIZE - NONCE_SALT_SIZE - NONCE_SESSION_NUMBER_SIZE - 1)
+
+/*
+============================
+Private Types
+============================
+*/
+
+// A pair of cipher contexts, which is only ever used by one packet at a time
+typedef struct {
+    // Whether the cipher contexts have been keyed yet, which happens on first use
+    bool keyed;
+    EVP_CIPHER_CTX* encrypt_ctx;
+    EVP_CIPHER_CTX* decrypt_ctx;
+    // The number of packets that have been encrypted with this context, used as the nonce
+    uint64_t nonce_counter;
+} AESCipherContext;
+
+struct AESSession {
+    char private_key[KEY_SIZE];
+    // Random per-session salt, whose top bit is the direction of the session
+    uint32_t nonce_salt;
+    // The number of sessions that this process had created before this one, modulo 2^16
+    uint32_t session_number;
+    // Protects the shared cipher context
+    WhistMutex mutex;
+    // Bit i is set while cipher_contexts[i] isn't in use
+    atomic_int free_cipher_contexts;
+    // The last cipher context is shared by the packets that didn't get one of their own
+    AESCipherContext cipher_contexts[AES_SESSION_NUM_CONTEXTS + 1];
+};
+
+/*
+============================
+Globals
+============================
+*/
+
+// The number of sessions that this process has created
+static atomic_int num_aes_sessions = ATOMIC_VAR_INIT(0);
+
 /*
 ============================
 Private Function Declarations
@@ -58,8 +118,8 @@ Private Function Declarations
  * @brief                          AES-GCM Encrypt plaintext data, given the iv/key
  *
  * @param ciphertext               Pointer to buffer for receiving ciphertext
- * @param plaintext                Pointer to the plaintext to encrypt
- * @param plaintext_len            Length of the plaintext
+ * @param plaintext_iov            The pieces of the plaintext to encrypt, in order
+ * @param plaintext_iov_count      The number of pieces in plaintext_iov
  * @param private_key              AES Private Key used to encrypt the plaintext
  *                                   must be KEY_SIZE bytes
  * @param iv                       IV used to seed the AES encryption
@@ -69,9 +129,28 @@ Private Function Declarations
  * @returns                        Will return -1 on failure, else will return the
  *                                 length of the encrypted result
  */
-static int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_len,
+static int aes_encrypt(void* ciphertext, const WhistIOVec* plaintext_iov, int plaintext_iov_count,
                        const void* private_key, const void* iv, void* tag);
 
+/**
+ * @brief                          AES-GCM Encrypt plaintext data with a cipher context that has
+ *                                 already been keyed, so that only the IV needs to be set up
+ *
+ * @param ctx                      The pre-keyed cipher context to encrypt with
+ * @param ciphertext               Pointer to buffer for receiving ciphertext
+ * @param plaintext_iov            The pieces of the plaintext to encrypt, in order
+ * @param plaintext_iov_count      The number of pieces in plaintext_iov
+ * @param iv                       IV used to seed the AES encryption
+ *                                   must be IV_SIZE bytes
+ * @param tag                      tag output for verifying data integrity
+ *
+ * @returns                        Will return -1 on failure, else will return the
+ *                                 length of the encrypted result
+ */
+static int aes_encrypt_with_ctx(EVP_CIPHER_CTX* ctx, void* ciphertext,
+                                const WhistIOVec* plaintext_iov, int plaintext_iov_count,
+                                const void* iv, void* tag);
+
 /**
  * @brief                          AES Decrypt ciphertext data, given the iv/key and tag
  *
@@ -91,6 +170,63 @@ static int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_le
 static int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertext,
                        int ciphertext_len, const void* private_key, const void* iv, void* tag);
 
+/**
+ * @brief                          AES Decrypt ciphertext data with a cipher context that has
+ *                                 already been keyed, so that only the IV needs to be set up
+ *
+ * @param ctx                      The pre-keyed cipher context to decrypt with
+ * @param plaintext_buffer         Pointer to buffer for receiving plaintext
+ * @param plaintext_len            The size of the `plaintext` buffer
+ * @param ciphertext               Pointer to the ciphertext to encrypt
+ * @param ciphertext_len           Length of the ciphertext
+ * @param iv                       IV used to seed the AES encryption
+ *                                   must be IV_SIZE bytes
+ * @param tag                      tag value used for verifying data integrity
+ *
+ * @returns                        Will return the length of the decrypted result,
+ *                                 or -1 on failure
+ */
+static int aes_decrypt_with_ctx(EVP_CIPHER_CTX* ctx, void* plaintext_buffer, int plaintext_len,
+                                const void* ciphertext, int ciphertext_len, const void* iv,
+                                void* tag);
+
+/**
+ * @brief                          Create the cipher contexts of a cipher context pair,
+ *                                 and run the key schedule on them
+ *
+ * @param cipher_context           The cipher context to initialize
+ * @param private_key              AES Private Key to key the cipher contexts with
+ *                                   must be KEY_SIZE bytes
+ *
+ * @returns                        True on success, false on failure
+ */
+static bool init_aes_cipher_context(AESCipherContext* cipher_context, const void* private_key);
+
+/**
+ * @brief                          Take a cipher context that no other packet is using,
+ *                                 keying it on first use
+ *
+ * @param session                  The session to take a cipher context of
+ * @param shared                   Set to true if the shared cipher context was returned,
+ *                                 in which case session->mutex is held
+ *
+ * @returns                        The cipher context, which must be given back with
+ *                                 release_aes_cipher_context,
+ *                                 or NULL if it couldn't be keyed
+ */
+static AESCipherContext* acquire_aes_cipher_context(AESSession* session, bool* shared);
+
+/**
+ * @brief                          Give back a cipher context that was returned by
+ *                                 acquire_aes_cipher_context
+ *
+ * @param session                  The session that the cipher context belongs to
+ * @param cipher_context           The cipher context to give back
+ * @param shared                   The value that acquire_aes_cipher_context wrote to `shared`
+ */
+static void release_aes_cipher_context(AESSession* session, AESCipherContext* cipher_context,
+                                       bool shared);
+
 /**
  * @brief                          Log any OpenSSL errors
  */
@@ -198,7 +334,8 @@ int encrypt_packet(void* encrypted_data, AESMetadata* aes_metadata, const void*
     gen_iv(aes_metadata->iv);
 
     // Encrypt the data, and store the length in the metadata
-    int encrypted_len = aes_encrypt(encrypted_data, plaintext_data, plaintext_len, private_key,
+    WhistIOVec plaintext_iov = {plaintext_data, plaintext_len};
+    int encrypted_len = aes_encrypt(encrypted_data, &plaintext_iov, 1, private_key,
                                     aes_metadata->iv, aes_metadata->tag);
 
     // Return the length of the encrypted buffer
@@ -215,23 +352,121 @@ int decrypt_packet(void* plaintext_buffer, int plaintext_buffer_len, AESMetadata
     return decrypt_len;
 }
 
+AESSession* create_aes_session(const void* private_key, bool is_server) {
+    AESSession* session = safe_malloc(sizeof(AESSession));
+    memset(session, 0, sizeof(AESSession));
+    memcpy(session->private_key, private_key, KEY_SIZE);
+
+    // Sessions that use the same key, e.g. the UDP and TCP sessions of a connection and those of
+    // any reconnection, each start their counters at 0, so the rest of the IV must tell them
+    // apart. Sessions of the same process always differ in their session number, until it wraps
+    // after 2^16 sessions, and sessions of different processes almost surely differ in their
+    // salt. The top bit of the salt makes the nonces differ between the two directions.
+    if (RAND_bytes((unsigned char*)&session->nonce_salt, sizeof(session->nonce_salt)) != 1) {
+        LOG_ERROR("Failed to generate a random nonce salt");
+        print_ssl_errors();
+        free(session);
+        return NULL;
+    }
+    session->nonce_salt &= 0x7FFFFFFF;
+    if (is_server) {
+        session->nonce_salt |= 0x80000000;
+    }
+    session->session_number = (uint32_t)atomic_fetch_add(&num_aes_sessions, 1) & 0xFFFF;
+
+    // The cipher contexts are only keyed once they're used, since most sessions only ever
+    // encrypt and decrypt from a few threads at a time
+    session->mutex = whist_create_mutex();
+    atomic_init(&session->free_cipher_contexts, (1 << AES_SESSION_NUM_CONTEXTS) - 1);
+    return session;
+}
+
+void destroy_aes_session(AESSession* session) {
+    if (session == NULL) {
+        return;
+    }
+    for (int i = 0; i <= AES_SESSION_NUM_CONTEXTS; i++) {
+        // EVP_CIPHER_CTX_free ignores NULL contexts
+        EVP_CIPHER_CTX_free(session->cipher_contexts[i].encrypt_ctx);
+        EVP_CIPHER_CTX_free(session->cipher_contexts[i].decrypt_ctx);
+    }
+    if (session->mutex != NULL) {
+        whist_destroy_mutex(session->mutex);
+    }
+    OPENSSL_cleanse(session->private_key, sizeof(session->private_key));
+    free(session);
+}
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+int aes_session_encrypt_packet(AESSession* session, void* encrypted_data,
+                               AESMetadata* aes_metadata, const WhistIOVec* plaintext_iov,
+                               int plaintext_iov_count) {
+    bool shared;
+    AESCipherContext* cipher_context = acquire_aes_cipher_context(session, &shared);
+    if (cipher_context == NULL) {
+        return -1;
+    }
+
+    // The IV is unique per session and direction, and per cipher context, which only one packet
+    // uses at a time, so the context's counter makes it unique per packet
+    uint64_t counter = cipher_context->nonce_counter++;
+    FATAL_ASSERT(counter < ((uint64_t)1 << (NONCE_COUNTER_SIZE * (int)BITS_IN_BYTE)));
+    unsigned char* iv = (unsigned char*)aes_metadata->iv;
+    for (int i = 0; i < NONCE_SALT_SIZE; i++) {
+        iv[i] = (session->nonce_salt >> (i * (int)BITS_IN_BYTE)) & 0xFF;
+    }
+    for (int i = 0; i < NONCE_SESSION_NUMBER_SIZE; i++) {
+        iv[NONCE_SALT_SIZE + i] = (session->session_number >> (i * (int)BITS_IN_BYTE)) & 0xFF;
+    }
+    unsigned char* context_iv = iv + NONCE_SALT_SIZE + NONCE_SESSION_NUMBER_SIZE;
+    context_iv[0] = (unsigned char)(cipher_context - session->cipher_contexts);
+    for (int i = 0; i < NONCE_COUNTER_SIZE; i++) {
+        context_iv[1 + i] = (counter >> (i * (int)BITS_IN_BYTE)) & 0xFF;
+    }
+
+    int encrypted_len =
+        aes_encrypt_with_ctx(cipher_context->encrypt_ctx, encrypted_data, plaintext_iov,
+                             plaintext_iov_count, aes_metadata->iv, aes_metadata->tag);
+
+    release_aes_cipher_context(session, cipher_context, shared);
+    return encrypted_len;
+}
+
+// NOTE that this function is in the hotpath.
+// The hotpath *must* return in under ~10000 assembly instructions.
+// Please pass this comment into any non-trivial function that this function calls.
+int aes_session_decrypt_packet(AESSession* session, void* plaintext_buffer,
+                               int plaintext_buffer_len, const AESMetadata* aes_metadata,
+                               const void* encrypted_data, int encrypted_len) {
+    bool shared;
+    AESCipherContext* cipher_context = acquire_aes_cipher_context(session, &shared);
+    if (cipher_context == NULL) {
+        return -1;
+    }
+
+    // The tag is only read, but OpenSSL's interface takes a non-const pointer
+    AESMetadata metadata = *aes_metadata;
+    int decrypt_len =
+        aes_decrypt_with_ctx(cipher_context->decrypt_ctx, plaintext_buffer, plaintext_buffer_len,
+                             encrypted_data, encrypted_len, metadata.iv, metadata.tag);
+
+    release_aes_cipher_context(session, cipher_context, shared);
+    return decrypt_len;
+}
+
 /*
 ============================
 Private Function Implementations
 ============================
 */
 
-int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_len, const void* key,
-                const void* iv, void* tag) {
+int aes_encrypt(void* ciphertext, const WhistIOVec* plaintext_iov, int plaintext_iov_count,
+                const void* key, const void* iv, void* tag) {
     EVP_CIPHER_CTX* ctx = NULL;
     const EVP_CIPHER* cipher = EVP_aes_128_gcm();
 
-    int len;
-
-    int ciphertext_buffer_size = plaintext_len + MAX_ENCRYPTION_SIZE_INCREASE;
-
-    int ciphertext_bytes_written = 0;
-
     // Create and initialise the context
     if (!(ctx = EVP_CIPHER_CTX_new())) HANDLE_SSL_ERROR();
 
@@ -239,11 +474,37 @@ int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_len, cons
     FATAL_ASSERT(IV_SIZE == EVP_CIPHER_iv_length(cipher));
     FATAL_ASSERT(KEY_SIZE == EVP_CIPHER_key_length(cipher));
 
-    // Initialise the encryption operation.
-    if (1 !=
-        EVP_EncryptInit_ex(ctx, cipher, NULL, (const unsigned char*)key, (const unsigned char*)iv))
+    // Key the context, the IV is set by aes_encrypt_with_ctx
+    if (1 != EVP_EncryptInit_ex(ctx, cipher, NULL, (const unsigned char*)key, NULL))
         HANDLE_SSL_ERROR();
 
+    int ciphertext_len =
+        aes_encrypt_with_ctx(ctx, ciphertext, plaintext_iov, plaintext_iov_count, iv, tag);
+
+    // Free the context
+    EVP_CIPHER_CTX_free(ctx);
+
+    return ciphertext_len;
+}
+
+int aes_encrypt_with_ctx(EVP_CIPHER_CTX* ctx, void* ciphertext, const WhistIOVec* plaintext_iov,
+                         int plaintext_iov_count, const void* iv, void* tag) {
+    int len;
+
+    int plaintext_len = 0;
+    for (int i = 0; i < plaintext_iov_count; i++) {
+        plaintext_len += plaintext_iov[i].size;
+    }
+
+    int ciphertext_buffer_size = plaintext_len + MAX_ENCRYPTION_SIZE_INCREASE;
+
+    int ciphertext_bytes_written = 0;
+
+    // Initialise the encryption operation. The cipher and key are kept from the
+    // previous initialization, so only the IV has to be set up.
+    if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, (const unsigned char*)iv))
+        HANDLE_SSL_ERROR_KEEP_CTX();
+
     /*
         https://www.openssl.org/docs/man1.1.1/man3/EVP_EncryptUpdate.html
         For wrap cipher modes, the amount of data written can be anything from zero bytes to (inl +
@@ -254,15 +515,20 @@ int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_len, cons
         Verification that no buffer overflow can happen occurs in the following FATAL_ASSERT
     */
 
-    // Size of the remaining ciphertext buffer, must be >= inl + MAX_ENCRYPTION_SIZE_INCREASE
-    FATAL_ASSERT(ciphertext_buffer_size - ciphertext_bytes_written >=
-                 plaintext_len + MAX_ENCRYPTION_SIZE_INCREASE);
-
-    // Encrypt
-    if (1 != EVP_EncryptUpdate(ctx, (unsigned char*)ciphertext + ciphertext_bytes_written, &len,
-                               (const unsigned char*)plaintext, plaintext_len))
-        HANDLE_SSL_ERROR();
-    ciphertext_bytes_written += len;
+    // GCM is a stream cipher, so the pieces can be fed one after the other,
+    // and the result is the same as if the plaintext had been contiguous
+    for (int i = 0; i < plaintext_iov_count; i++) {
+        // Size of the remaining ciphertext buffer, must be >= inl + MAX_ENCRYPTION_SIZE_INCREASE
+        FATAL_ASSERT(ciphertext_buffer_size - ciphertext_bytes_written >=
+                     plaintext_iov[i].size + MAX_ENCRYPTION_SIZE_INCREASE);
+
+        // Encrypt
+        if (1 != EVP_EncryptUpdate(ctx, (unsigned char*)ciphertext + ciphertext_bytes_written,
+                                   &len, (const unsigned char*)plaintext_iov[i].data,
+                                   plaintext_iov[i].size))
+            HANDLE_SSL_ERROR_KEEP_CTX();
+        ciphertext_bytes_written += len;
+    }
 
     /*
         https://www.openssl.org/docs/man1.1.1/man3/EVP_EncryptUpdate.html
@@ -277,17 +543,14 @@ int aes_encrypt(void* ciphertext, const void* plaintext, int plaintext_len, cons
 
     // Finish encryption
     if (1 != EVP_EncryptFinal_ex(ctx, (unsigned char*)ciphertext + ciphertext_bytes_written, &len))
-        HANDLE_SSL_ERROR();
+        HANDLE_SSL_ERROR_KEEP_CTX();
     ciphertext_bytes_written += len;
 
     /* Get the tag */
     if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, tag)) {
-        HANDLE_SSL_ERROR();
+        HANDLE_SSL_ERROR_KEEP_CTX();
     }
 
-    // Free the context
-    EVP_CIPHER_CTX_free(ctx);
-
     FATAL_ASSERT(ciphertext_bytes_written == plaintext_len);
 
     return ciphertext_bytes_written;
@@ -298,11 +561,6 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
     EVP_CIPHER_CTX* ctx = NULL;
     const EVP_CIPHER* cipher = EVP_aes_128_gcm();
 
-    int len;
-
-    int plaintext_bytes_written = 0;
-    int ciphertext_bytes_read = 0;
-
     // Create and initialize the context
     if (!(ctx = EVP_CIPHER_CTX_new())) HANDLE_SSL_ERROR();
 
@@ -310,11 +568,31 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
     FATAL_ASSERT(IV_SIZE == EVP_CIPHER_iv_length(cipher));
     FATAL_ASSERT(KEY_SIZE == EVP_CIPHER_key_length(cipher));
 
-    // Initialize decryption
-    if (1 !=
-        EVP_DecryptInit_ex(ctx, cipher, NULL, (const unsigned char*)key, (const unsigned char*)iv))
+    // Key the context, the IV is set by aes_decrypt_with_ctx
+    if (1 != EVP_DecryptInit_ex(ctx, cipher, NULL, (const unsigned char*)key, NULL))
         HANDLE_SSL_ERROR();
 
+    int plaintext_bytes_written = aes_decrypt_with_ctx(ctx, plaintext_buffer, plaintext_len,
+                                                       ciphertext, ciphertext_len, iv, tag);
+
+    // Free context
+    EVP_CIPHER_CTX_free(ctx);
+
+    return plaintext_bytes_written;
+}
+
+int aes_decrypt_with_ctx(EVP_CIPHER_CTX* ctx, void* plaintext_buffer, int plaintext_len,
+                         const void* ciphertext, int ciphertext_len, const void* iv, void* tag) {
+    int len;
+
+    int plaintext_bytes_written = 0;
+    int ciphertext_bytes_read = 0;
+
+    // Initialize decryption. The cipher and key are kept from the
+    // previous initialization, so only the IV has to be set up.
+    if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, (const unsigned char*)iv))
+        HANDLE_SSL_ERROR_KEEP_CTX();
+
     /*
         https://www.openssl.org/docs/man1.1.1/man3/EVP_EncryptUpdate.html
         The parameters and restrictions are identical to the encryption operations except that if
@@ -335,7 +613,7 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
     if (safe_plaintext_len > 0) {
         if (1 != EVP_DecryptUpdate(ctx, (unsigned char*)plaintext_buffer, &len,
                                    (const unsigned char*)ciphertext, safe_plaintext_len))
-            HANDLE_SSL_ERROR();
+            HANDLE_SSL_ERROR_KEEP_CTX();
 
         ciphertext_bytes_read += safe_plaintext_len;
         plaintext_bytes_written += len;
@@ -357,7 +635,7 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
         if (1 != EVP_DecryptUpdate(ctx, temporary_buf, &len,
                                    (const unsigned char*)ciphertext + ciphertext_bytes_read,
                                    bytes_to_feed))
-            HANDLE_SSL_ERROR();
+            HANDLE_SSL_ERROR_KEEP_CTX();
         ciphertext_bytes_read += bytes_to_feed;
 
         // Move from temporary_buf to plaintext_buffer, if we have the room available
@@ -372,11 +650,11 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
 
     /* Set expected tag value */
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, tag)) {
-        HANDLE_SSL_ERROR();
+        HANDLE_SSL_ERROR_KEEP_CTX();
     }
 
     // Finish decryption
-    if (1 != EVP_DecryptFinal_ex(ctx, temporary_buf, &len)) HANDLE_SSL_ERROR();
+    if (1 != EVP_DecryptFinal_ex(ctx, temporary_buf, &len)) HANDLE_SSL_ERROR_KEEP_CTX();
 
     // Move from temporary_buf to plaintext_buffer, if we have the room available
     if (plaintext_bytes_written + len > plaintext_len) {
@@ -387,12 +665,84 @@ int aes_decrypt(void* plaintext_buffer, int plaintext_len, const void* ciphertex
     memcpy((char*)plaintext_buffer + plaintext_bytes_written, temporary_buf, len);
     plaintext_bytes_written += len;
 
-    // Free context
-    EVP_CIPHER_CTX_free(ctx);
-
     return plaintext_bytes_written;
 }
 
+bool init_aes_cipher_context(AESCipherContext* cipher_context, const void* private_key) {
+    const EVP_CIPHER* cipher = EVP_aes_128_gcm();
+
+    // Verify the constants of aes.h before usage
+    FATAL_ASSERT(IV_SIZE == EVP_CIPHER_iv_length(cipher));
+    FATAL_ASSERT(KEY_SIZE == EVP_CIPHER_key_length(cipher));
+
+    // Run the key schedule once, so that each packet only has to set up its IV
+    if (cipher_context->encrypt_ctx == NULL) {
+        cipher_context->encrypt_ctx = EVP_CIPHER_CTX_new();
+    }
+    if (cipher_context->decrypt_ctx == NULL) {
+        cipher_context->decrypt_ctx = EVP_CIPHER_CTX_new();
+    }
+    if (cipher_context->encrypt_ctx == NULL || cipher_context->decrypt_ctx == NULL ||
+        1 != EVP_EncryptInit_ex(cipher_context->encrypt_ctx, cipher, NULL,
+                                (const unsigned char*)private_key, NULL) ||
+        1 != EVP_DecryptInit_ex(cipher_context->decrypt_ctx, cipher, NULL,
+                                (const unsigned char*)private_key, NULL)) {
+        LOG_ERROR("Failed to initialize the AES cipher contexts");
+        print_ssl_errors();
+        return false;
+    }
+    cipher_context->nonce_counter = 0;
+    cipher_context->keyed = true;
+    return true;
+}
+
+AESCipherContext* acquire_aes_cipher_context(AESSession* session, bool* shared) {
+    *shared = false;
+
+    // Take the lowest free cipher context, so that a session that's only used by one thread at
+    // a time sticks to the same one. Contexts are given back after every packet, so any number
+    // of threads can come and go without using up the session's contexts.
+    AESCipherContext* cipher_context = NULL;
+    int free_cipher_contexts = atomic_load(&session->free_cipher_contexts);
+    while (free_cipher_contexts != 0) {
+        int index = 0;
+        while (!(free_cipher_contexts & (1 << index))) {
+            index++;
+        }
+        if (atomic_compare_exchange_weak(&session->free_cipher_contexts, &free_cipher_contexts,
+                                         free_cipher_contexts & ~(1 << index))) {
+            cipher_context = &session->cipher_contexts[index];
+            break;
+        }
+    }
+
+    if (cipher_context == NULL) {
+        // All of them are in use, so share the last one, and hold the mutex while it's in use
+        *shared = true;
+        whist_lock_mutex(session->mutex);
+        cipher_context = &session->cipher_contexts[AES_SESSION_NUM_CONTEXTS];
+    }
+
+    // Nobody else is using the context, so it can be keyed without further synchronization
+    if (!cipher_context->keyed &&
+        !init_aes_cipher_context(cipher_context, session->private_key)) {
+        // Give the context back, so that keying it is tried again next time
+        release_aes_cipher_context(session, cipher_context, *shared);
+        return NULL;
+    }
+    return cipher_context;
+}
+
+void release_aes_cipher_context(AESSession* session, AESCipherContext* cipher_context,
+                                bool shared) {
+    if (shared) {
+        whist_unlock_mutex(session->mutex);
+    } else {
+        atomic_fetch_or(&session->free_cipher_contexts,
+                        1 << (int)(cipher_context - session->cipher_contexts));
+    }
+}
+
 static void print_ssl_errors(void) { ERR_print_errors_cb(openssl_callback, NULL); }
 
 static int openssl_callback(const char* str, size_t len, void* opaque) {
@@ -12,6 +12,10 @@ Usage
 The function encrypt_packet gets called when a new packet of data needs to be
 sent over the network, while decrypt_packet, which calls decrypt_packet_n, gets
 called on the receiving end to re-obtain the data and process it.
+
+Connections that send many packets should instead create an AESSession with
+create_aes_session, and use aes_session_encrypt_packet/aes_session_decrypt_packet,
+which skip the per-packet cipher context allocation and key setup.
 */
 
 /*
@@ -48,6 +52,14 @@ typedef struct {
     char tag[TAG_SIZE];  // tag used for AES-GCM data integrity
 } AESMetadata;
 
+/**
+ * @brief    An encryption session over a single connection, which holds cipher contexts
+ *           that are keyed once and reused for every packet, and generates nonces that are
+ *           unique per session, direction and packet without any randomness per packet.
+ *           Any number of threads may encrypt and decrypt with the same session.
+ */
+typedef struct AESSession AESSession;
+
 /*
 ============================
 Public Functions
@@ -132,4 +144,65 @@ int encrypt_packet(void* encrypted_data, AESMetadata* aes_metadata, const void*
 int decrypt_packet(void* plaintext_buffer, int plaintext_buffer_len, AESMetadata aes_metadata,
                    const void* encrypted_data, int encrypted_len, const void* private_key);
 
+/**
+ * @brief                          Creates an encryption session for one end of a connection
+ *
+ * @param private_key              AES private key used to encrypt and decrypt
+ *                                   must be KEY_SIZE bytes
+ * @param is_server                Whether this is the server end of the connection,
+ *                                   so that both directions never use the same nonce
+ *
+ * @returns                        The new session, or NULL on failure
+ */
+AESSession* create_aes_session(const void* private_key, bool is_server);
+
+/**
+ * @brief                          Destroys an encryption session
+ *
+ * @param session                  The session to destroy, may be NULL
+ */
+void destroy_aes_session(AESSession* session);
+
+/**
+ * @brief                          Encrypts a data packet with a session.
+ *                                 The plaintext may be scattered in memory, the result is the
+ *                                 same as encrypting the concatenation of the pieces.
+ *
+ * @param session                  The session to encrypt with
+ * @param encrypted_data           Pointer to receive the encrypted data
+ *                                   NOTE: Buffer must be ENCRYPTION_SIZE_INCREASE bytes larger than
+ * the total plaintext length
+ * @param aes_metadata             Metadata about the encrypted packet gets into this struct
+ * @param plaintext_iov            The pieces of the plaintext to encrypt, in order
+ * @param plaintext_iov_count      The number of pieces in plaintext_iov
+ *
+ * @returns                        Will return the encrypted packet length,
+ *                                 or -1 on failure
+ */
+int aes_session_encrypt_packet(AESSession* session, void* encrypted_data,
+                               AESMetadata* aes_metadata, const WhistIOVec* plaintext_iov,
+                               int plaintext_iov_count);
+
+/**
+ * @brief                          Decrypts a packet that was encrypted with the same key,
+ *                                 using the session's pre-keyed cipher contexts
+ *
+ * @param session                  The session to decrypt with
+ * @param plaintext_buffer         Pointer to write the plaintext to
+ * @param plaintext_buffer_len     The size that the plaintext_buffer can take in,
+ *                                   passed as a parameter to prevent buffer overflows
+ * @param aes_metadata             Metadata about the encrypted packet,
+ *                                 which is needed for decryption
+ * @param encrypted_data           Pointer to the encrypted data
+ * @param encrypted_len            The length of the encrypted data buffer
+ *
+ * @returns                        Will return the decrypted packet length,
+ *                                 or -1 on failure
+ *                                   (Either because it was incorrectly signed/encrypted,
+ *                                    or if plaintext_buffer_len was too small)
+ */
+int aes_session_decrypt_packet(AESSession* session, void* plaintext_buffer,
+                               int plaintext_buffer_len, const AESMetadata* aes_metadata,
+                               const void* encrypted_data, int encrypted_len);
+
 #endif  // AES_H
@@ -8,6 +8,35 @@
 
 #include "avpacket_buffer.h"
 
+static void copy_to_avpacket(AVPacket** packet, const uint8_t* data, uint32_t size) {
+    /*
+        Copy data into a new refcounted buffer for a packet, allocating the packet if needed.
+
+        Arguments:
+            packet (AVPacket**): the packet to fill. Packets will be unreferenced before being
+                filled with new data.
+            data (const uint8_t*): the data of the packet
+            size (uint32_t): the size of the data
+    */
+    if (*packet == NULL) {
+        // Allocate a new packet.
+        *packet = av_packet_alloc();
+        FATAL_ASSERT(*packet);
+    } else {
+        // Unreference the previous packet (the decoder may still
+        // hold a reference to the data).
+        av_packet_unref(*packet);
+    }
+
+    // Allocate a new refcounted buffer for the packet data.
+    // (This also includes the necessary zeroed padding.)
+    int res = av_new_packet(*packet, size);
+    FATAL_ASSERT(res == 0);
+
+    // Copy the packet data to the packet.
+    memcpy((*packet)->data, data, size);
+}
+
 void write_avpackets_to_buffer(int num_packets, AVPacket** packets, uint8_t* buffer) {
     /*
         Store the first num_packets AVPackets contained in packets into buf. buf will contain
@@ -18,6 +47,28 @@ void write_avpackets_to_buffer(int num_packets, AVPacket** packets, uint8_t* buf
             packets (AVPacket*): array of packets to read packets from
             buffer (uint8_t*): memory buffer for storing the packets
     */
+    size_t pos = write_avpackets_header_to_buffer(num_packets, packets, buffer);
+
+    for (int i = 0; i < num_packets; i++) {
+        memcpy(buffer + pos, packets[i]->data, packets[i]->size);
+        pos += packets[i]->size;
+    }
+}
+
+size_t write_avpackets_header_to_buffer(int num_packets, AVPacket** packets, uint8_t* buffer) {
+    /*
+        Store the header of the first num_packets AVPackets contained in packets into buf, i.e.
+        (number of packets)(size of each packet). The caller is responsible for placing the data
+        of each packet right after it.
+
+        Arguments:
+            num_packets (int): the number of packets to store in buf
+            packets (AVPacket*): array of packets to read packet sizes from
+            buffer (uint8_t*): memory buffer for storing the header
+
+        Returns:
+            (size_t): the size of the header, in bytes
+    */
     if (num_packets > 10) {
         LOG_FATAL("Invalid number of packets to write to buffer: %d.", num_packets);
     }
@@ -30,10 +81,7 @@ void write_avpackets_to_buffer(int num_packets, AVPacket** packets, uint8_t* buf
         pos += 4;
     }
 
-    for (int i = 0; i < num_packets; i++) {
-        memcpy(buffer + pos, packets[i]->data, packets[i]->size);
-        pos += packets[i]->size;
-    }
+    return pos;
 }
 
 int extract_avpackets_from_buffer(uint8_t* buffer, size_t buffer_size, AVPacket** packets) {
@@ -65,16 +113,11 @@ int extract_avpackets_from_buffer(uint8_t* buffer, size_t buffer_size, AVPacket*
     // first entry: number of packets
     uint32_t num_packets = AV_RL32(buffer);
 
-    // We currently expect exactly one packet in each buffer, but
-    // previously larger numbers were allowed.  We accept but warn if
-    // there is more than one packet.
+    // Usually there is one packet in each buffer, or one per slice
+    // when the encoder splits frames into slices.
     if (num_packets < 1 || num_packets > 10) {
         LOG_FATAL("Invalid number of packets in buffer: %" PRIu32 " packets found.", num_packets);
     }
-    if (num_packets != 1) {
-        LOG_ERROR("Unexpected number of packets in buffer: %" PRIu32 " packets found.",
-                  num_packets);
-    }
 
     size_t size_pos = 4;
     size_t data_pos = size_pos + 4 * num_packets;
@@ -89,27 +132,69 @@ int extract_avpackets_from_buffer(uint8_t* buffer, size_t buffer_size, AVPacket*
                       data_pos);
         }
 
-        if (packets[p] == NULL) {
-            // Allocate a new packet.
-            packets[p] = av_packet_alloc();
-            FATAL_ASSERT(packets[p]);
-        } else {
-            // Unreference the previous packet (the decoder may still
-            // hold a reference to the data).
-            av_packet_unref(packets[p]);
-        }
-        AVPacket* pkt = packets[p];
-
-        // Allocate a new refcounted buffer for the packet data.
-        // (This also includes the necessary zeroed padding.)
-        int res = av_new_packet(pkt, packet_size);
-        FATAL_ASSERT(res == 0);
-
-        // Copy the packet data to the packet.
-        memcpy(pkt->data, buffer + data_pos, packet_size);
+        copy_to_avpacket(&packets[p], buffer + data_pos, packet_size);
         data_pos += packet_size;
     }
 
     // return number of packets
     return num_packets;
 }
+
+int extract_received_avpackets_from_buffer(uint8_t* buffer, size_t received_size, int first_packet,
+                                           AVPacket** packets) {
+    /*
+        Read the encoded packets that have been received completely into packets, skipping the
+        first first_packet of them. The buffer should have been filled using
+        write_avpackets_to_buffer, but only its first received_size bytes may have arrived.
+
+        Arguments:
+            buffer (uint8_t*): Buffer containing encoded packets, which is still being received
+
+            received_size (size_t): The number of bytes at the start of the buffer that have
+                arrived
+
+            first_packet (int): The index of the first packet to read
+
+            packets (AVPacket*): array of encoded packets, starting with the one at first_packet.
+                Packets will be unreferenced before being filled with new data.
+
+        Returns:
+            (int): the number of packets read, 0 if no more of them have been received
+    */
+
+    if (buffer == NULL) {
+        LOG_FATAL("Received a NULL buffer!");
+    }
+    if (received_size < 4) {
+        return 0;
+    }
+
+    uint32_t num_packets = AV_RL32(buffer);
+    if (num_packets < 1 || num_packets > 10) {
+        LOG_FATAL("Invalid number of packets in buffer: %" PRIu32 " packets found.", num_packets);
+    }
+    size_t data_pos = 4 + 4 * num_packets;
+    if (received_size < data_pos) {
+        return 0;
+    }
+
+    int num_extracted = 0;
+    for (uint32_t p = 0; p < num_packets; p++) {
+        uint32_t packet_size = AV_RL32(buffer + 4 + 4 * p);
+        if (packet_size == 0 || data_pos + packet_size > MAX_VIDEOFRAME_DATA_SIZE) {
+            LOG_FATAL("Invalid packet size: %" PRIu32 " bytes at position %zu.", packet_size,
+                      data_pos);
+        }
+        if (data_pos + packet_size > received_size) {
+            // This packet and the ones after it haven't arrived yet
+            break;
+        }
+        if ((int)p >= first_packet) {
+            copy_to_avpacket(&packets[num_extracted], buffer + data_pos, packet_size);
+            num_extracted++;
+        }
+        data_pos += packet_size;
+    }
+
+    return num_extracted;
+}
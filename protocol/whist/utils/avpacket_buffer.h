@@ -10,7 +10,8 @@ Usage
 ============================
 
 Use extract_avpackets_from_buffer to read packets from a buffer which has been filled using
-write_avpackets_to_buffer.
+write_avpackets_to_buffer. Use extract_received_avpackets_from_buffer to read the packets that are
+already complete in a buffer that is still being received.
 */
 
 /*
@@ -42,6 +43,28 @@ Public Functions
  */
 int extract_avpackets_from_buffer(uint8_t* buffer, size_t buffer_size, AVPacket** packets);
 
+/**
+ * @brief                       Read out the packets that have been received completely, in a
+ *                              buffer of which only the start has been received so far, into the
+ *                              AVPacket array packets.
+ *
+ * @param buffer                Buffer containing encoded packets, in the same format as for
+ *                              extract_avpackets_from_buffer
+ *
+ * @param received_size         The number of bytes at the start of buffer that have been received
+ *
+ * @param first_packet          The index of the first packet to read out, so that the packets which
+ *                              were read out before can be skipped
+ *
+ * @param packets               AVPacket array to store encoded packets, starting with the packet
+ *                              at index first_packet
+ *
+ * @returns                     The number of packets read out, which is 0 if no more of them are
+ *                              complete yet
+ */
+int extract_received_avpackets_from_buffer(uint8_t* buffer, size_t received_size, int first_packet,
+                                           AVPacket** packets);
+
 /**
  * @brief                       Store num_packets AVPackets, found in packets, into
  *                              a pre-allocated buffer.
@@ -55,4 +78,20 @@ int extract_avpackets_from_buffer(uint8_t* buffer, size_t buffer_size, AVPacket*
  */
 void write_avpackets_to_buffer(int num_packets, AVPacket** packets, uint8_t* buffer);
 
+/**
+ * @brief                       Store only the header of num_packets AVPackets, i.e. the number of
+ *                              packets and the size of each packet, into a pre-allocated buffer.
+ *                              The data of each packet is expected to follow right after it,
+ *                              e.g. when the packets are sent as separate pieces.
+ *
+ * @param num_packets           Number of packets to store from packets
+ *
+ * @param packets               Array of packets whose sizes should be stored
+ *
+ * @param buffer                Buffer to store the header in
+ *
+ * @returns                     The size of the header, in bytes
+ */
+size_t write_avpackets_header_to_buffer(int num_packets, AVPacket** packets, uint8_t* buffer);
+
 #endif  // DECODE_H
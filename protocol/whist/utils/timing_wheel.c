@@ -0,0 +1,168 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file timing_wheel.c
+ * @brief Implementation of a hierarchical timing wheel.
+ */
+
+/*
+============================
+Includes
+============================
+*/
+
+#include <math.h>
+#include "whist/logging/logging.h"
+#include "whist/utils/timing_wheel.h"
+
+/*
+============================
+Defines
+============================
+*/
+
+// Each level has 64 slots, and a slot of one level covers all of the slots of the level below it.
+// With 1ms ticks, the levels cover 64ms, 4s, 4min and 4.6h.
+#define TIMING_WHEEL_LEVELS 4
+#define TIMING_WHEEL_SLOT_BITS 6
+#define TIMING_WHEEL_SLOTS (1 << TIMING_WHEEL_SLOT_BITS)
+#define TIMING_WHEEL_SLOT_MASK (TIMING_WHEEL_SLOTS - 1)
+#define TIMING_WHEEL_MAX_DELTA ((uint64_t)1 << (TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOT_BITS))
+
+struct TimingWheel {
+    WhistTimer start_time;
+    double tick_duration;
+    // The next tick to fire, all of the earlier ones have been handled
+    uint64_t current_tick;
+    // The earliest tick that a newly scheduled timer can fire on, which is past the end of the
+    // advance during timing_wheel_advance, so that the callbacks can't make it loop
+    uint64_t earliest_tick;
+    int num_scheduled;
+    LinkedList slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS];
+};
+
+/*
+============================
+Private Functions
+============================
+*/
+
+/**
+ * @brief                          Put a timer into the slot for its deadline tick, relative to
+ *                                 the current tick of the wheel
+ *
+ * @param wheel                    The timing wheel
+ * @param timer                    The timer, which must not be in a slot
+ */
+static void place_timer(TimingWheel *wheel, TimingWheelTimer *timer) {
+    uint64_t tick = max(timer->deadline_tick, wheel->current_tick);
+    uint64_t delta = tick - wheel->current_tick;
+    if (delta >= TIMING_WHEEL_MAX_DELTA) {
+        // Park it in the last slot that we can reach, it'll be placed again when that's cascaded
+        delta = TIMING_WHEEL_MAX_DELTA - 1;
+        tick = wheel->current_tick + delta;
+    }
+    int level = 0;
+    while ((delta >> (TIMING_WHEEL_SLOT_BITS * (level + 1))) != 0) {
+        level++;
+    }
+    int slot = (int)((tick >> (TIMING_WHEEL_SLOT_BITS * level)) & TIMING_WHEEL_SLOT_MASK);
+    timer->slot = &wheel->slots[level][slot];
+    linked_list_add_tail(timer->slot, timer);
+}
+
+/**
+ * @brief                          Move the timers of the higher-level slots that start at a tick
+ *                                 down to the levels that they now belong to
+ *
+ * @param wheel                    The timing wheel, whose current tick is the tick to cascade
+ */
+static void cascade_timers(TimingWheel *wheel) {
+    uint64_t tick = wheel->current_tick;
+    for (int level = 1; level < TIMING_WHEEL_LEVELS; level++) {
+        if ((tick & (((uint64_t)1 << (TIMING_WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        int slot = (int)((tick >> (TIMING_WHEEL_SLOT_BITS * level)) & TIMING_WHEEL_SLOT_MASK);
+        LinkedList pending = wheel->slots[level][slot];
+        linked_list_init(&wheel->slots[level][slot]);
+        TimingWheelTimer *timer;
+        while ((timer = linked_list_extract_head(&pending)) != NULL) {
+            place_timer(wheel, timer);
+        }
+    }
+}
+
+/*
+============================
+Public Function Implementations
+============================
+*/
+
+TimingWheel *timing_wheel_create(double tick_duration) {
+    FATAL_ASSERT(tick_duration > 0.0);
+    TimingWheel *wheel = safe_zalloc(sizeof(TimingWheel));
+    start_timer(&wheel->start_time);
+    wheel->tick_duration = tick_duration;
+    return wheel;
+}
+
+double timing_wheel_get_time(TimingWheel *wheel, const WhistTimer *time) {
+    return diff_timer(&wheel->start_time, time);
+}
+
+void timing_wheel_schedule(TimingWheel *wheel, TimingWheelTimer *timer, double deadline) {
+    timing_wheel_cancel(wheel, timer);
+    timer->deadline = deadline;
+    timer->deadline_tick = deadline > 0.0 ? (uint64_t)floor(deadline / wheel->tick_duration) : 0;
+    timer->deadline_tick = max(timer->deadline_tick, wheel->earliest_tick);
+    timer->scheduled = true;
+    wheel->num_scheduled++;
+    place_timer(wheel, timer);
+}
+
+void timing_wheel_cancel(TimingWheel *wheel, TimingWheelTimer *timer) {
+    if (!timer->scheduled) {
+        return;
+    }
+    linked_list_remove(timer->slot, timer);
+    timer->slot = NULL;
+    timer->scheduled = false;
+    wheel->num_scheduled--;
+}
+
+int timing_wheel_advance(TimingWheel *wheel, const WhistTimer *now, TimingWheelCallback callback,
+                         void *opaque) {
+    double now_time = timing_wheel_get_time(wheel, now);
+    if (now_time < 0.0) {
+        return 0;
+    }
+    uint64_t now_tick = (uint64_t)floor(now_time / wheel->tick_duration);
+    int num_fired = 0;
+    wheel->earliest_tick = max(now_tick + 1, wheel->current_tick);
+    while (wheel->current_tick <= now_tick) {
+        if (wheel->num_scheduled == 0) {
+            // Nothing can fire, so skip straight to the end
+            wheel->current_tick = now_tick + 1;
+            break;
+        }
+        cascade_timers(wheel);
+        uint64_t tick = wheel->current_tick;
+        LinkedList *slot = &wheel->slots[0][tick & TIMING_WHEEL_SLOT_MASK];
+        wheel->current_tick++;
+        // A callback can schedule a timer into this same slot, a full turn of the wheel later.
+        // Those are added behind the due timers, so stop at the first timer that isn't due yet.
+        TimingWheelTimer *timer;
+        while ((timer = linked_list_head(slot)) != NULL && timer->deadline_tick <= tick) {
+            linked_list_remove(slot, timer);
+            timer->slot = NULL;
+            timer->scheduled = false;
+            wheel->num_scheduled--;
+            num_fired++;
+            callback(opaque, timer);
+        }
+    }
+    wheel->earliest_tick = wheel->current_tick;
+    return num_fired;
+}
+
+void timing_wheel_destroy(TimingWheel *wheel) { free(wheel); }
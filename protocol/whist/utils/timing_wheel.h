@@ -0,0 +1,151 @@
+/**
+ * @copyright Copyright 2022 Whist Technologies, Inc.
+ * @file timing_wheel.h
+ * @brief API of a hierarchical timing wheel.
+ */
+#ifndef WHIST_UTILS_TIMING_WHEEL_H
+#define WHIST_UTILS_TIMING_WHEEL_H
+/*
+============================
+Usage
+============================
+*/
+/**
+ * A hierarchical timing wheel fires timers once their deadlines pass, with O(1) scheduling and
+ * cancelling, and without looking at the timers that aren't due yet. Time is counted in ticks of
+ * a fixed duration since the wheel was created, and a timer fires on the first
+ * timing_wheel_advance() during or after the tick that its deadline is in, so it can fire up to a
+ * tick early.
+ *
+ * Timers are embedded in the caller's structures, and aren't owned by the wheel.
+ *
+ * Example:
+ * @code{.c}
+ * typedef struct {
+ *     TimingWheelTimer timer;
+ *     int id;
+ * } Foo;
+ *
+ * static void on_timer(void *opaque, TimingWheelTimer *timer) {
+ *     Foo *foo = (Foo *)timer;
+ *     LOG_INFO("Foo %d fired", foo->id);
+ * }
+ *
+ * TimingWheel *wheel = timing_wheel_create(0.001);
+ * Foo foo = {.id = 1};
+ * WhistTimer now;
+ * start_timer(&now);
+ * timing_wheel_schedule(wheel, &foo.timer, timing_wheel_get_time(wheel, &now) + 0.050);
+ * ...
+ * start_timer(&now);
+ * timing_wheel_advance(wheel, &now, on_timer, NULL);
+ * @endcode
+ */
+
+/*
+============================
+Includes
+============================
+*/
+
+#include <whist/core/whist.h>
+#include "whist/utils/clock.h"
+#include "whist/utils/linked_list.h"
+
+/*
+============================
+Custom Types
+============================
+*/
+
+/**
+ * @brief A timer in a timing wheel. A zero-initialized timer is valid and unscheduled.
+ */
+typedef struct TimingWheelTimer {
+    LINKED_LIST_HEADER;
+    // The slot that the timer is in, if it's scheduled
+    LinkedList *slot;
+    // The tick that the timer fires on
+    uint64_t deadline_tick;
+    // The time that the timer was scheduled for, in seconds since the wheel was created
+    double deadline;
+    // Whether the timer is in a wheel
+    bool scheduled;
+} TimingWheelTimer;
+
+typedef struct TimingWheel TimingWheel;
+
+/**
+ * @brief Callback for a timer that fired. The timer is no longer scheduled when this is called,
+ *        and it can be scheduled again from here.
+ */
+typedef void (*TimingWheelCallback)(void *opaque, TimingWheelTimer *timer);
+
+/*
+============================
+Public Functions
+============================
+*/
+
+/**
+ * @brief                          Create a timing wheel
+ *
+ * @param tick_duration            The length of a tick, in seconds, which is how precisely
+ *                                 timers fire
+ *
+ * @returns                        The timing wheel
+ */
+TimingWheel *timing_wheel_create(double tick_duration);
+
+/**
+ * @brief                          Get the time of the timing wheel
+ *
+ * @param wheel                    The timing wheel
+ * @param time                     The time to convert, as returned by start_timer()
+ *
+ * @returns                        That time, in seconds since the wheel was created
+ */
+double timing_wheel_get_time(TimingWheel *wheel, const WhistTimer *time);
+
+/**
+ * @brief                          Schedule a timer, or reschedule it if it's already scheduled
+ *
+ * @param wheel                    The timing wheel
+ * @param timer                    The timer to schedule
+ * @param deadline                 When the timer should fire, in seconds since the wheel was
+ *                                 created. If this has already passed, the timer fires on the
+ *                                 next timing_wheel_advance().
+ */
+void timing_wheel_schedule(TimingWheel *wheel, TimingWheelTimer *timer, double deadline);
+
+/**
+ * @brief                          Unschedule a timer, if it's scheduled
+ *
+ * @param wheel                    The timing wheel that the timer is scheduled in
+ * @param timer                    The timer to cancel
+ */
+void timing_wheel_cancel(TimingWheel *wheel, TimingWheelTimer *timer);
+
+/**
+ * @brief                          Fire every timer whose deadline is in or before the current
+ *                                 tick, in order of their ticks
+ *
+ * @param wheel                    The timing wheel
+ * @param now                      The current time, as returned by start_timer()
+ * @param callback                 The function to call for each timer that fires
+ * @param opaque                   Passed to the callback
+ *
+ * @returns                        The number of timers that fired
+ */
+int timing_wheel_advance(TimingWheel *wheel, const WhistTimer *now, TimingWheelCallback callback,
+                         void *opaque);
+
+/**
+ * @brief                          Destroy a timing wheel. The timers that are still scheduled
+ *                                 are left as they are, and must not be used with it anymore.
+ *
+ * @param wheel                    The timing wheel to destroy
+ */
+void timing_wheel_destroy(TimingWheel *wheel);
+
+#endif  // WHIST_UTILS_TIMING_WHEEL_H
@@ -0,0 +1,97 @@
+/**
+ * Copyright 2022 Whist Technologies, Inc.
+ * @file triple_buffer.c
+ * @brief Implementation of a lock-free single-producer, single-consumer triple buffer.
+ */
+
+/*
+============================
+Includes
+============================
+*/
+
+#include "whist/logging/logging.h"
+#include "whist/utils/atomic.h"
+#include "whist/utils/triple_buffer.h"
+
+/*
+============================
+Defines
+============================
+*/
+
+// The shared slot is stored with this bit set when it holds an item that hasn't been acquired
+#define TRIPLE_BUFFER_PENDING 0x4
+#define TRIPLE_BUFFER_SLOT_MASK 0x3
+
+struct TripleBuffer {
+    // Only touched by the producer
+    int write_slot;
+    // Only touched by the consumer
+    int read_slot;
+    // The slot in between, which the producer and consumer swap theirs with
+    atomic_int shared_slot;
+    // Posted on every publish and wake
+    WhistSemaphore published;
+};
+
+/*
+============================
+Public Function Implementations
+============================
+*/
+
+TripleBuffer *triple_buffer_create(void) {
+    TripleBuffer *buffer = safe_malloc(sizeof(TripleBuffer));
+    buffer->write_slot = 0;
+    buffer->read_slot = 1;
+    atomic_init(&buffer->shared_slot, 2);
+    buffer->published = whist_create_semaphore(0);
+    if (buffer->published == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+int triple_buffer_get_write_slot(TripleBuffer *buffer) { return buffer->write_slot; }
+
+bool triple_buffer_publish(TripleBuffer *buffer) {
+    int previous =
+        atomic_exchange(&buffer->shared_slot, buffer->write_slot | TRIPLE_BUFFER_PENDING);
+    buffer->write_slot = previous & TRIPLE_BUFFER_SLOT_MASK;
+    whist_post_semaphore(buffer->published);
+    return (previous & TRIPLE_BUFFER_PENDING) != 0;
+}
+
+bool triple_buffer_is_pending(TripleBuffer *buffer) {
+    return (atomic_load(&buffer->shared_slot) & TRIPLE_BUFFER_PENDING) != 0;
+}
+
+int triple_buffer_acquire(TripleBuffer *buffer) {
+    // Only the producer sets the pending bit, so if it's set here it's still set at the exchange
+    if (!triple_buffer_is_pending(buffer)) {
+        return -1;
+    }
+    int previous = atomic_exchange(&buffer->shared_slot, buffer->read_slot);
+    buffer->read_slot = previous & TRIPLE_BUFFER_SLOT_MASK;
+    return buffer->read_slot;
+}
+
+bool triple_buffer_wait(TripleBuffer *buffer, int timeout_ms) {
+    if (timeout_ms < 0) {
+        whist_wait_semaphore(buffer->published);
+        return true;
+    }
+    return whist_wait_timeout_semaphore(buffer->published, timeout_ms);
+}
+
+void triple_buffer_wake(TripleBuffer *buffer) { whist_post_semaphore(buffer->published); }
+
+void triple_buffer_destroy(TripleBuffer *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    whist_destroy_semaphore(buffer->published);
+    free(buffer);
+}
@@ -0,0 +1,133 @@
+/**
+ * @copyright Copyright 2022 Whist Technologies, Inc.
+ * @file triple_buffer.h
+ * @brief API of a lock-free single-producer, single-consumer triple buffer.
+ */
+#ifndef WHIST_UTILS_TRIPLE_BUFFER_H
+#define WHIST_UTILS_TRIPLE_BUFFER_H
+/*
+============================
+Usage
+============================
+*/
+/**
+ * A triple buffer hands the latest of a stream of items from one thread to another, without
+ * either thread ever waiting for the other. The items live in three slots owned by the caller,
+ * which the triple buffer only hands out the indices of: one slot is being written by the
+ * producer, one is being read by the consumer, and the third holds the latest published item.
+ *
+ * Publishing while the previous item is still unread replaces it (latest-item-wins), so the
+ * producer can always move on to its next item, and the consumer always gets the newest one.
+ *
+ * Example:
+ * @code{.c}
+ * Foo slots[TRIPLE_BUFFER_SLOTS];
+ * TripleBuffer *buffer = triple_buffer_create();
+ *
+ * // Producer
+ * Foo *foo = &slots[triple_buffer_get_write_slot(buffer)];
+ * fill_foo(foo);
+ * if (triple_buffer_publish(buffer)) {
+ *     LOG_INFO("The previous foo was never read");
+ * }
+ *
+ * // Consumer
+ * triple_buffer_wait(buffer, -1);
+ * int slot = triple_buffer_acquire(buffer);
+ * if (slot >= 0) {
+ *     use_foo(&slots[slot]);
+ * }
+ * @endcode
+ */
+
+#include <stdbool.h>
+
+/**
+ * The number of slots that the items of a triple buffer must be stored in.
+ */
+#define TRIPLE_BUFFER_SLOTS 3
+
+typedef struct TripleBuffer TripleBuffer;
+
+/**
+ * @brief                          Create a triple buffer.
+ *
+ * @returns                        The new triple buffer, or NULL on failure
+ */
+TripleBuffer *triple_buffer_create(void);
+
+/**
+ * @brief                          Get the slot that the producer should write its next item to.
+ *                                 The slot belongs to the producer until it's published.
+ *
+ * @param buffer                   The triple buffer
+ *
+ * @returns                        The index of the slot
+ */
+int triple_buffer_get_write_slot(TripleBuffer *buffer);
+
+/**
+ * @brief                          Publish the item in the write slot, and give the producer a new
+ *                                 slot to write to. This never waits, and wakes the consumer if
+ *                                 it's in triple_buffer_wait().
+ *
+ * @param buffer                   The triple buffer
+ *
+ * @returns                        True if this replaced a published item that was never acquired,
+ *                                 in which case that item's slot is the new write slot
+ */
+bool triple_buffer_publish(TripleBuffer *buffer);
+
+/**
+ * @brief                          Check whether a published item is waiting to be acquired.
+ *                                 Only the producer can make this go from false to true, so when
+ *                                 the producer sees false, the next item it publishes won't
+ *                                 replace anything.
+ *
+ * @param buffer                   The triple buffer
+ *
+ * @returns                        Whether an item is waiting
+ */
+bool triple_buffer_is_pending(TripleBuffer *buffer);
+
+/**
+ * @brief                          Take the latest published item. Its slot belongs to the consumer
+ *                                 until the next call to triple_buffer_acquire(), even if that one
+ *                                 doesn't find a new item.
+ *
+ * @param buffer                   The triple buffer
+ *
+ * @returns                        The index of the item's slot, or -1 if nothing was published
+ *                                 since the last acquire
+ */
+int triple_buffer_acquire(TripleBuffer *buffer);
+
+/**
+ * @brief                          Wait for an item to be published, or for triple_buffer_wake().
+ *                                 This can return without an item being available, so always
+ *                                 check the result of triple_buffer_acquire() afterwards.
+ *
+ * @param buffer                   The triple buffer
+ * @param timeout_ms               The number of milliseconds to wait for. -1 for wait without
+ *                                 timeout.
+ *
+ * @returns                        False if the timeout was exceeded, else true
+ */
+bool triple_buffer_wait(TripleBuffer *buffer, int timeout_ms);
+
+/**
+ * @brief                          Wake the consumer from triple_buffer_wait() without publishing,
+ *                                 e.g. to tell it to stop.
+ *
+ * @param buffer                   The triple buffer
+ */
+void triple_buffer_wake(TripleBuffer *buffer);
+
+/**
+ * @brief                          Destroy a triple buffer. The slots themselves are left alone.
+ *
+ * @param buffer                   The triple buffer
+ */
+void triple_buffer_destroy(TripleBuffer *buffer);
+
+#endif
@@ -21,6 +21,7 @@ Includes
 #include <whist/core/whist.h>
 #include <whist/utils/color.h>
 #include <whist/utils/linked_list.h>
+#include <whist/video/dirty_rects.h>
 #if OS_IS(OS_LINUX)
 #include <X11/Xlib.h>
 #include "nvidiacapture.h"
@@ -41,6 +42,10 @@ typedef struct CaptureDevice {
     void* frame_data;
     WhistWindow window_data[MAX_WINDOWS];
     WhistRGBColor corner_color;
+    // The regions that changed since the previous capture. Devices that can't tell which regions
+    // changed report the whole frame.
+    int num_dirty_rects;
+    WhistRect dirty_rects[MAX_DIRTY_RECTS];
     void* internal;
 
 #if OS_IS(OS_LINUX)
@@ -99,6 +104,8 @@ bool reconfigure_capture_device(CaptureDevice* device, uint32_t width, uint32_t
  *                                 The width/height of the image is guaranteed to be
  *                                 the width/height passed into create_/reconfigure_ capture device,
  *                                 If the screen dimensions changed, then -1 will be returned
+ *                                 The regions that changed since the previous capture are
+ *                                 stored in dirty_rects
  *
  * @param device                   The device used to capture the screen
  *
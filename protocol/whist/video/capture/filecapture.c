@@ -306,6 +306,12 @@ int capture_screen(CaptureDevice *device) {
         av_frame_move_ref(fc->output_frame, fc->decode_frame);
     }
 
+    // Every decoded frame is treated as entirely new.
+    device->num_dirty_rects = 0;
+    dirty_rects_add(device->dirty_rects, &device->num_dirty_rects,
+                    (WhistRect){0, 0, fc->output_width, fc->output_height}, fc->output_width,
+                    fc->output_height);
+
     return 0;
 }
 
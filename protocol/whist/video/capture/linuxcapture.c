@@ -311,7 +311,7 @@ int capture_screen(CaptureDevice* device) {
             device (CaptureDevice*): pointer to device we are using for capturing
 
         Returns:
-            (int): 0 on success, -1 on failure
+            (int): number of frames since the last capture on success, -1 on failure
     */
     if (!device) {
         LOG_ERROR("Tried to call capture_screen with a NULL CaptureDevice! We shouldn't do this!");
@@ -362,6 +362,13 @@ int capture_screen(CaptureDevice* device) {
                     // GPU captures need the pitch to just be width
                     device->pitch = device->nvidia_capture_device->pitch;
                     device->corner_color = device->nvidia_capture_device->corner_color;
+                    // NvFBC doesn't tell us which regions changed
+                    device->num_dirty_rects = 0;
+                    if (ret > 0) {
+                        dirty_rects_add(device->dirty_rects, &device->num_dirty_rects,
+                                        (WhistRect){0, 0, device->width, device->height},
+                                        device->width, device->height);
+                    }
                     return ret;
                 } else {
                     LOG_ERROR(
@@ -382,6 +389,9 @@ int capture_screen(CaptureDevice* device) {
                 device->frame_data = device->x11_capture_device->frame_data;
                 device->pitch = device->x11_capture_device->pitch;
                 device->corner_color = device->x11_capture_device->corner_color;
+                device->num_dirty_rects = device->x11_capture_device->num_dirty_rects;
+                memcpy(device->dirty_rects, device->x11_capture_device->dirty_rects,
+                       sizeof(device->dirty_rects));
             }
             return ret;
         default:
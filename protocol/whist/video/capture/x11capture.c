@@ -27,6 +27,16 @@ Includes
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
+/*
+============================
+Defines
+============================
+*/
+
+// When the damage covers more than this fraction of the screen, one full-screen capture is cheaper
+// than capturing each damaged region and copying it into place
+#define FULL_CAPTURE_DAMAGE_FRACTION 0.5
+
 /*
 ============================
 Private Functions Declarations
@@ -49,6 +59,36 @@ int handler(Display* display, XErrorEvent* error);
  */
 void init_atoms(X11CaptureDevice* device);
 
+/*
+ * @brief           Create a shared memory segment and attach it to the X server
+ *
+ * @param device    The X11 Device
+ * @param segment   The segment to fill in
+ * @param size      The size of the segment, in bytes
+ *
+ * @returns         true on success, false on failure
+ */
+static bool attach_shm_segment(X11CaptureDevice* device, XShmSegmentInfo* segment, size_t size);
+
+/*
+ * @brief           Detach a shared memory segment from the X server and free it, if it exists
+ *
+ * @param device    The X11 Device
+ * @param segment   The segment to free
+ */
+static void detach_shm_segment(X11CaptureDevice* device, XShmSegmentInfo* segment);
+
+/*
+ * @brief           Capture each of the device's dirty rectangles into the scratch segment, and
+ *                  copy it into place in frame_data
+ *
+ * @param device    The X11 Device
+ * @param screen    The screen that the root window is on
+ *
+ * @returns         true on success, false on failure
+ */
+static bool capture_dirty_rects(X11CaptureDevice* device, Screen* screen);
+
 /*
 ============================
 Private Function Implementations
@@ -80,6 +120,73 @@ void init_atoms(X11CaptureDevice* device) {
     INIT_ATOM(device, _NET_WM_STATE, "_NET_WM_STATE");
 }
 
+static bool attach_shm_segment(X11CaptureDevice* device, XShmSegmentInfo* segment, size_t size) {
+    segment->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0777);
+    if (segment->shmid < 0) {
+        LOG_ERROR("Could not shmget a segment of %zu bytes", size);
+        return false;
+    }
+    segment->shmaddr = shmat(segment->shmid, 0, 0);
+    segment->readOnly = False;
+    if (segment->shmaddr == (char*)-1) {
+        LOG_ERROR("Could not shmat the segment");
+        shmctl(segment->shmid, IPC_RMID, NULL);
+        segment->shmaddr = NULL;
+        return false;
+    }
+    bool attached = XShmAttach(device->display, segment);
+    // Once the X server has attached, mark the segment for removal, so that it's freed as soon as
+    // both of us detach
+    XSync(device->display, False);
+    shmctl(segment->shmid, IPC_RMID, NULL);
+    if (!attached) {
+        LOG_ERROR("Error while attaching display");
+        shmdt(segment->shmaddr);
+        segment->shmaddr = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void detach_shm_segment(X11CaptureDevice* device, XShmSegmentInfo* segment) {
+    if (segment->shmaddr == NULL) {
+        return;
+    }
+    XShmDetach(device->display, segment);
+    shmdt(segment->shmaddr);
+    segment->shmaddr = NULL;
+}
+
+static bool capture_dirty_rects(X11CaptureDevice* device, Screen* screen) {
+    for (int i = 0; i < device->num_dirty_rects; i++) {
+        WhistRect rect = device->dirty_rects[i];
+        // XShmGetImage captures a region the size of the image, packed at the start of the
+        // segment, so each region gets a temporary image header of its own size
+        XImage* region = XShmCreateImage(
+            device->display, DefaultVisualOfScreen(screen), DefaultDepthOfScreen(screen), ZPixmap,
+            device->region_segment.shmaddr, &device->region_segment, rect.width, rect.height);
+        if (region == NULL) {
+            LOG_ERROR("Could not XShmCreateImage for a %dx%d region!", rect.width, rect.height);
+            return false;
+        }
+        bool captured =
+            XShmGetImage(device->display, device->root, region, rect.x, rect.y, AllPlanes);
+        if (captured) {
+            int bytes_per_pixel = region->bits_per_pixel / 8;
+            char* dst = device->frame_data + rect.y * device->pitch + rect.x * bytes_per_pixel;
+            for (int row = 0; row < rect.height; row++) {
+                memcpy(dst + row * device->pitch, region->data + row * region->bytes_per_line,
+                       rect.width * bytes_per_pixel);
+            }
+        }
+        XFree(region);
+        if (!captured) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
 ============================
 Public Function Implementations
@@ -131,6 +238,8 @@ bool reconfigure_x11_capture_device(X11CaptureDevice* device, uint32_t width, ui
         XFree(device->image);
         device->image = NULL;
     }
+    detach_shm_segment(device, &device->segment);
+    detach_shm_segment(device, &device->region_segment);
     device->width = width;
     device->height = height;
     XWindowAttributes window_attributes;
@@ -153,32 +262,32 @@ bool reconfigure_x11_capture_device(X11CaptureDevice* device, uint32_t width, ui
         return false;
     }
 
-    device->segment.shmid = shmget(
-        IPC_PRIVATE, device->image->bytes_per_line * device->image->height, IPC_CREAT | 0777);
-
-    device->segment.shmaddr = device->image->data = shmat(device->segment.shmid, 0, 0);
-    device->segment.readOnly = False;
-
-    if (!XShmAttach(device->display, &device->segment)) {
-        LOG_ERROR("Error while attaching display");
+    // The scratch segment for damaged regions is the same size, so that it can hold any region
+    size_t segment_size = (size_t)device->image->bytes_per_line * device->image->height;
+    if (!attach_shm_segment(device, &device->segment, segment_size) ||
+        !attach_shm_segment(device, &device->region_segment, segment_size)) {
         destroy_x11_capture_device(device);
         return false;
     }
+    device->image->data = device->segment.shmaddr;
     device->frame_data = device->image->data;
     device->pitch = device->image->bytes_per_line;
+    device->needs_full_capture = true;
     return true;
 }
 
 int x11_capture_screen(X11CaptureDevice* device) {
     /*
-        Capture the screen using our X11 device. TODO: needs more documentation, I (Serina) am not
-       really sure what's happening here.
+        Capture the screen using our X11 device. The damage events since the last capture tell us
+       which regions of the screen changed. If they only cover a small part of the screen, we just
+       capture those regions and copy them into the persistent frame_data, otherwise we capture the
+       whole screen into it.
 
         Arguments:
             device (X11CaptureDevice*): device used to capture the screen
 
         Returns:
-            (int): 0 on success, -1 on failure
+            (int): The number of damage events since the last capture, or -1 on failure
     */
     if (!device) {
         LOG_ERROR(
@@ -187,57 +296,76 @@ int x11_capture_screen(X11CaptureDevice* device) {
     }
 
     int accumulated_frames = 0;
+    device->num_dirty_rects = 0;
     while (XPending(device->display)) {
-        // XDamageNotifyEvent* dev; unused, remove or is this needed and should
-        // be used?
         XEvent ev;
         XNextEvent(device->display, &ev);
         if (ev.type == device->event + XDamageNotify) {
             // accumulated_frames will eventually be the number of damage events (accumulated
             // frames)
             accumulated_frames++;
+            XDamageNotifyEvent* damage_event = (XDamageNotifyEvent*)&ev;
+            WhistRect rect = {damage_event->area.x, damage_event->area.y,
+                              damage_event->area.width, damage_event->area.height};
+            dirty_rects_add(device->dirty_rects, &device->num_dirty_rects, rect, device->width,
+                            device->height);
         }
     }
     // Don't Lock and UnLock Display unneccesarily, if there are no frames to capture
-    if (accumulated_frames == 0) return 0;
+    if (accumulated_frames == 0 && !device->needs_full_capture) return 0;
 
-    device->first = true;
     XLockDisplay(device->display);
-    if (accumulated_frames || device->first) {
-        device->first = false;
 
-        XDamageSubtract(device->display, device->damage, None, None);
+    XDamageSubtract(device->display, device->damage, None, None);
 
-        XWindowAttributes window_attributes;
-        if (!XGetWindowAttributes(device->display, device->root, &window_attributes)) {
-            LOG_ERROR("Couldn't get window width and height!");
-            accumulated_frames = -1;
-        } else if (device->width != window_attributes.width ||
-                   device->height != window_attributes.height) {
-            LOG_ERROR("Wrong width/height!");
+    XWindowAttributes window_attributes;
+    if (!XGetWindowAttributes(device->display, device->root, &window_attributes)) {
+        LOG_ERROR("Couldn't get window width and height!");
+        accumulated_frames = -1;
+    } else if (device->width != window_attributes.width ||
+               device->height != window_attributes.height) {
+        LOG_ERROR("Wrong width/height!");
+        accumulated_frames = -1;
+    } else {
+        if (device->needs_full_capture) {
+            device->num_dirty_rects = 0;
+            dirty_rects_add(device->dirty_rects, &device->num_dirty_rects,
+                            (WhistRect){0, 0, device->width, device->height}, device->width,
+                            device->height);
+        }
+        bool full_capture =
+            dirty_rects_area(device->dirty_rects, device->num_dirty_rects) >
+            FULL_CAPTURE_DAMAGE_FRACTION * device->width * device->height;
+
+        XErrorHandler prev_handler = XSetErrorHandler(handler);
+        bool captured;
+        if (full_capture) {
+            captured = XShmGetImage(device->display, device->root, device->image, 0, 0, AllPlanes);
+        } else {
+            captured = capture_dirty_rects(device, window_attributes.screen);
+        }
+        if (!captured) {
+            LOG_ERROR("Error while capturing the screen");
             accumulated_frames = -1;
         } else {
-            XErrorHandler prev_handler = XSetErrorHandler(handler);
-            if (!XShmGetImage(device->display, device->root, device->image, 0, 0, AllPlanes)) {
-                LOG_ERROR("Error while capturing the screen");
-                accumulated_frames = -1;
-            } else {
-                device->pitch = device->image->bytes_per_line;
-            }
-            if (accumulated_frames != -1) {
-                // get the color
-                XColor c;
-                c.pixel = XGetPixel(device->image, 0, 0);
-                XQueryColor(device->display,
-                            DefaultColormap(device->display, XDefaultScreen(device->display)), &c);
-                // Color format is r/g/b 0x0000-0xffff
-                // We just need the leading byte
-                device->corner_color.red = c.red >> 8;
-                device->corner_color.green = c.green >> 8;
-                device->corner_color.blue = c.blue >> 8;
-            }
-            XSetErrorHandler(prev_handler);
+            device->needs_full_capture = false;
+            device->pitch = device->image->bytes_per_line;
+            // get the color
+            XColor c;
+            c.pixel = XGetPixel(device->image, 0, 0);
+            XQueryColor(device->display,
+                        DefaultColormap(device->display, XDefaultScreen(device->display)), &c);
+            // Color format is r/g/b 0x0000-0xffff
+            // We just need the leading byte
+            device->corner_color.red = c.red >> 8;
+            device->corner_color.green = c.green >> 8;
+            device->corner_color.blue = c.blue >> 8;
         }
+        XSetErrorHandler(prev_handler);
+    }
+    if (accumulated_frames == -1) {
+        // The damage that we've drained is lost, so the next capture has to be full-screen
+        device->needs_full_capture = true;
     }
     XUnlockDisplay(device->display);
     return accumulated_frames;
@@ -258,6 +386,8 @@ void destroy_x11_capture_device(X11CaptureDevice* device) {
         XFree(device->image);
         device->image = NULL;
     }
+    detach_shm_segment(device, &device->segment);
+    detach_shm_segment(device, &device->region_segment);
     XCloseDisplay(device->display);
     free(device);
 }
@@ -27,6 +27,7 @@ Includes
 
 #include <whist/core/whist.h>
 #include <whist/utils/color.h>
+#include <whist/video/dirty_rects.h>
 
 /*
 ============================
@@ -36,7 +37,8 @@ Custom Types
 
 /**
  * @brief Struct to handle using X11 for capturing the screen. The screen capture data is saved in
- * frame_data.
+ * frame_data, which persists between captures so that only the damaged regions need to be captured
+ * again.
  */
 typedef struct X11CaptureDevice {
     Display* display;
@@ -50,7 +52,13 @@ typedef struct X11CaptureDevice {
     char* frame_data;
     Damage damage;
     int event;
-    bool first;
+    // Set when frame_data doesn't hold a capture yet, so the next capture has to be full-screen
+    bool needs_full_capture;
+    // The regions damaged since the previous capture
+    int num_dirty_rects;
+    WhistRect dirty_rects[MAX_DIRTY_RECTS];
+    // Damaged regions are captured into this scratch segment, then copied into frame_data
+    XShmSegmentInfo region_segment;
     WhistRGBColor corner_color;
     Atom _NET_ACTIVE_WINDOW;
     Atom _NET_WM_STATE_HIDDEN;
@@ -89,11 +97,11 @@ bool reconfigure_x11_capture_device(X11CaptureDevice* device, uint32_t width, ui
 
 /**
  * @brief           Capture the screen with given device. Afterwards, the frame capture is stored in
- * frame_data.
+ * frame_data, and the regions that changed since the previous capture are in dirty_rects.
  *
  * @param device    Device to use for screen captures
  *
- * @returns         0 on success, -1 on failure
+ * @returns         The number of damage events since the previous capture, or -1 on failure
  */
 int x11_capture_screen(X11CaptureDevice* device);
 
@@ -47,6 +47,7 @@ Private Functions
 static WhistStatus try_setup_video_decoder(VideoDecoder* decoder);
 static WhistStatus try_next_decoder(VideoDecoder* decoder);
 static void destroy_video_decoder_members(VideoDecoder* decoder);
+static void save_input_packets(VideoDecoder* decoder, int num_packets);
 
 /*
 ============================
@@ -240,6 +241,8 @@ static WhistStatus try_setup_video_decoder(VideoDecoder* decoder) {
     }
 
     decoder->context->opaque = decoder;
+    // Frames may be sent one slice at a time, so a packet isn't necessarily a whole frame
+    decoder->context->flags2 |= AV_CODEC_FLAG2_CHUNKS;
 
     if (decoder->decode_type == software_decode_type) {
         // Software decoder.
@@ -376,6 +379,26 @@ static void destroy_video_decoder_members(VideoDecoder* decoder) {
     // persist across reinitialisation for fallback to work.
 }
 
+static void save_input_packets(VideoDecoder* decoder, int num_packets) {
+    /*
+        Write the first num_packets input packets to the save_decoder_input file, if any.
+
+        Arguments:
+            decoder (VideoDecoder*): decoder whose input packets to save
+            num_packets (int): number of packets to save
+    */
+    if (!save_decoder_input || num_packets == 0) {
+        return;
+    }
+    for (int i = 0; i < num_packets; i++) {
+        AVPacket* pkt = decoder->packets[i];
+        fwrite(pkt->data, pkt->size, 1, decoder->save_input_file);
+    }
+    // Flush after every write - if the decoder fails on this input
+    // then we won't have an opportunity to flush later.
+    fflush(decoder->save_input_file);
+}
+
 /*
 ============================
 Public Function Implementations
@@ -471,15 +494,7 @@ int video_decoder_send_packets(VideoDecoder* decoder, void* buffer, size_t buffe
     int num_packets = extract_avpackets_from_buffer(buffer, buffer_size, decoder->packets);
     FATAL_ASSERT(num_packets > 0);
 
-    if (save_decoder_input) {
-        for (int i = 0; i < num_packets; i++) {
-            AVPacket* pkt = decoder->packets[i];
-            fwrite(pkt->data, pkt->size, 1, decoder->save_input_file);
-        }
-        // Flush after every write - if the decoder fails on this input
-        // then we won't have an opportunity to flush later.
-        fflush(decoder->save_input_file);
-    }
+    save_input_packets(decoder, num_packets);
 
     while (1) {
         int res = AVERROR_INVALIDDATA;
@@ -517,6 +532,44 @@ int video_decoder_send_packets(VideoDecoder* decoder, void* buffer, size_t buffe
     return 0;
 }
 
+int video_decoder_send_received_packets(VideoDecoder* decoder, void* buffer, size_t received_size,
+                                        int num_packets_sent) {
+    /*
+        Send the packets of a frame that have been received so far to the decoder, skipping the
+       ones that were sent before. The buffer format should be as described in
+       extract_avpackets_from_buffer.
+
+        Arguments:
+            decoder (VideoDecoder*): the decoder for decoding
+            buffer (void*): memory containing encoded packets, which is still being received
+            received_size (size_t): number of bytes at the start of buffer that have been received
+            num_packets_sent (int): number of packets of the frame that were sent before
+
+        Returns:
+            (int): the number of packets of the frame sent so far, or -1 on failure
+    */
+
+    if (!decoder->received_a_frame) {
+        // The first frame is only sent whole, so that a different decoder can be tried on it
+        return num_packets_sent;
+    }
+
+    int num_packets = extract_received_avpackets_from_buffer(buffer, received_size,
+                                                             num_packets_sent, decoder->packets);
+    save_input_packets(decoder, num_packets);
+
+    for (int i = 0; i < num_packets; i++) {
+        int res = avcodec_send_packet(decoder->context, decoder->packets[i]);
+        if (res < 0) {
+            LOG_WARNING("Send packet failed with decode type %d: %d (%s).", decoder->decode_type,
+                        res, av_err2str(res));
+            return -1;
+        }
+    }
+
+    return num_packets_sent + num_packets;
+}
+
 int video_decoder_decode_frame(VideoDecoder* decoder) {
     /*
         Get the next frame from the decoder. If we were using hardware decoding, also move the frame
@@ -155,6 +155,29 @@ void destroy_video_decoder(VideoDecoder* decoder);
 int video_decoder_send_packets(VideoDecoder* decoder, void* buffer, size_t buffer_size,
                                bool start_of_stream);
 
+/**
+ * @brief                           Send the packets of a frame that's still being received into
+ *                                  the decoder, as far as they have arrived. When the encoder
+ *                                  splits frames into slices, this lets the decoder start on a
+ *                                  frame before all of it has arrived.
+ *
+ * @param decoder                   The decoder we are using for decoding
+ *
+ * @param buffer                    The buffer containing the encoded packets
+ *
+ * @param received_size             The number of bytes at the start of buffer that have arrived
+ *
+ * @param num_packets_sent          The number of packets of the frame that were sent before,
+ *                                  which will be skipped
+ *
+ * @returns                         The number of packets of the frame sent so far, or -1 on
+ *                                  failure. Until the decoder has had a frame, no packets are
+ *                                  sent, so that the first frame can be retried on a different
+ *                                  decoder by video_decoder_send_packets.
+ */
+int video_decoder_send_received_packets(VideoDecoder* decoder, void* buffer, size_t received_size,
+                                        int num_packets_sent);
+
 /**
  * @brief                           Decode the next available frame from the decoder.
  *
@@ -23,6 +23,12 @@ Includes
 #define GOP_SIZE 999999
 #define MIN_NVENC_WIDTH 33
 #define MIN_NVENC_HEIGHT 17
+// QP offset for the regions of a frame that didn't change, as a fraction of the encoder's QP range.
+// Those macroblocks match the reference frame, so a coarser quantizer makes x264 skip them rather
+// than spend bits refining them.
+#define STATIC_REGION_QOFFSET av_make_q(1, 10)
+// Number of threads that convert each captured frame to YUV for the software encoder
+#define RGB_TO_YUV_THREADS 4
 
 /*
 ============================
@@ -35,6 +41,9 @@ static FFmpegEncoder *create_nvenc_encoder(int in_width, int in_height, int out_
                                            CodecType codec_type);
 static FFmpegEncoder *create_sw_encoder(int in_width, int in_height, int out_width, int out_height,
                                         int bitrate, int vbv_size, CodecType codec_type);
+static AVFrame *get_input_frame(FFmpegEncoder *encoder);
+static int find_start_code(const uint8_t *data, int size, int position);
+static int get_next_slice_end(FFmpegEncoder *encoder);
 
 /*
 ============================
@@ -60,6 +69,81 @@ static bool set_opt(FFmpegEncoder *encoder, char *option, char *value) {
     }
 }
 
+static AVFrame *get_input_frame(FFmpegEncoder *encoder) {
+    /*
+        Get the frame that the encoder is fed: the hardware frame, the frame converted to YUV, or
+       the captured frame itself.
+
+        Arguments:
+            encoder (FFmpegEncoder*): video encoder to get the frame of
+
+        Returns:
+            (AVFrame*): the frame to send to the filter graph or the encoder
+    */
+    if (encoder->hw_frame) {
+        return encoder->hw_frame;
+    } else if (encoder->yuv_frame) {
+        return encoder->yuv_frame;
+    } else {
+        return encoder->sw_frame;
+    }
+}
+
+static int find_start_code(const uint8_t *data, int size, int position) {
+    /*
+        Find the next Annex B start code in an H.264 bitstream. The zero byte in front of a 4-byte
+       start code is included, since it belongs to the NAL unit that follows.
+
+        Arguments:
+            data (const uint8_t*): the bitstream
+            size (int): the size of the bitstream
+            position (int): the position to start looking from
+
+        Returns:
+            (int): the position of the start code, or size if there is none
+    */
+    for (int i = position; i + 3 <= size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            return i > position && data[i - 1] == 0 ? i - 1 : i;
+        }
+    }
+    return size;
+}
+
+static int get_next_slice_end(FFmpegEncoder *encoder) {
+    /*
+        Find where the next slice of the sliced packet ends. The NAL units in front of a slice,
+       such as parameter sets and SEI, go with it, and the last slice takes the rest of the packet.
+
+        Arguments:
+            encoder (FFmpegEncoder*): encoder whose sliced packet to look at
+
+        Returns:
+            (int): the offset in the sliced packet that the slice at next_slice_offset ends at
+    */
+    const uint8_t *data = encoder->sliced_packet->data;
+    int size = encoder->sliced_packet->size;
+    if (encoder->num_slices_received == VIDEO_ENCODER_SLICES - 1) {
+        return size;
+    }
+
+    int nal = find_start_code(data, size, encoder->next_slice_offset);
+    while (nal < size) {
+        int header = nal + (data[nal + 2] == 1 ? 3 : 4);
+        if (header >= size) {
+            break;
+        }
+        int next_nal = find_start_code(data, size, header + 1);
+        int nal_type = data[header] & 0x1F;
+        // Non-IDR and IDR coded slices
+        if (nal_type == 1 || nal_type == 5) {
+            return next_nal;
+        }
+        nal = next_nal;
+    }
+    return size;
+}
+
 typedef FFmpegEncoder *(*FFmpegEncoderCreator)(int, int, int, int, int, int, CodecType);
 
 static FFmpegEncoder *create_nvenc_encoder(int in_width, int in_height, int out_width,
@@ -302,7 +386,7 @@ static FFmpegEncoder *create_sw_encoder(int in_width, int in_height, int out_wid
     enum AVPixelFormat in_format = AV_PIX_FMT_RGB32;
     enum AVPixelFormat out_format = AV_PIX_FMT_YUV420P;
 
-    // init intake format in sw_frame
+    // init intake format in sw_frame, which points at the captured pixels
 
     encoder->sw_frame = av_frame_alloc();
     encoder->sw_frame->format = in_format;
@@ -310,106 +394,36 @@ static FFmpegEncoder *create_sw_encoder(int in_width, int in_height, int out_wid
     encoder->sw_frame->height = encoder->in_height;
     encoder->sw_frame->pts = 0;
 
-    // set frame size and allocate memory for it
-    int frame_size =
-        av_image_get_buffer_size(out_format, encoder->out_width, encoder->out_height, 1);
-    encoder->sw_frame_buffer = safe_malloc(frame_size);
-
-    // fill picture with empty frame buffer
-    av_image_fill_arrays(encoder->sw_frame->data, encoder->sw_frame->linesize,
-                         (uint8_t *)encoder->sw_frame_buffer, out_format, encoder->out_width,
-                         encoder->out_height, 1);
-
-    // init resizing and resampling in filter_graph
-
-    encoder->filter_graph = avfilter_graph_alloc();
-    if (!encoder->filter_graph) {
-        LOG_WARNING("Unable to create filter graph");
-        destroy_ffmpeg_encoder(encoder);
-        return NULL;
-    }
-
-#define N_FILTERS_SW 4
-    // source -> format -> scale -> sink
-    const AVFilter *filters[N_FILTERS_SW] = {0};
-    filters[0] = avfilter_get_by_name("buffer");
-    filters[1] = avfilter_get_by_name("format");
-    filters[2] = avfilter_get_by_name("scale");
-    filters[3] = avfilter_get_by_name("buffersink");
-
-    for (int i = 0; i < N_FILTERS_SW; ++i) {
-        if (!filters[i]) {
-            LOG_WARNING("Could not find filter %d in the list!", i);
-            destroy_ffmpeg_encoder(encoder);
-            return NULL;
-        }
-    }
-
-    AVFilterContext *filter_contexts[N_FILTERS_SW] = {0};
-
-    // source buffer
-    filter_contexts[0] = avfilter_graph_alloc_filter(encoder->filter_graph, filters[0], "src");
-    av_opt_set_int(filter_contexts[0], "width", encoder->in_width, AV_OPT_SEARCH_CHILDREN);
-    av_opt_set_int(filter_contexts[0], "height", encoder->in_height, AV_OPT_SEARCH_CHILDREN);
-    av_opt_set(filter_contexts[0], "pix_fmt", av_get_pix_fmt_name(in_format),
-               AV_OPT_SEARCH_CHILDREN);
-    av_opt_set_q(filter_contexts[0], "time_base", (AVRational){1, MAX_FPS}, AV_OPT_SEARCH_CHILDREN);
-    if (avfilter_init_str(filter_contexts[0], NULL) < 0) {
-        LOG_WARNING("Unable to initialize buffer source");
-        destroy_ffmpeg_encoder(encoder);
-        return NULL;
-    }
-    encoder->filter_graph_source = filter_contexts[0];
-
-    // format
-    filter_contexts[1] = avfilter_graph_alloc_filter(encoder->filter_graph, filters[1], "format");
-    av_opt_set(filter_contexts[1], "pix_fmts", av_get_pix_fmt_name(out_format),
-               AV_OPT_SEARCH_CHILDREN);
-    if (avfilter_init_str(filter_contexts[1], NULL) < 0) {
-        LOG_WARNING("Unable to initialize format filter");
-        destroy_ffmpeg_encoder(encoder);
-        return NULL;
-    }
+    // init yuv_frame, which the captured pixels are converted into and the encoder reads from
 
-    // scale
-    filter_contexts[2] = avfilter_graph_alloc_filter(encoder->filter_graph, filters[2], "scale");
-    char options_string[60] = "";
-    snprintf(options_string, 60, "w=%d:h=%d", encoder->out_width, encoder->out_height);
-    if (avfilter_init_str(filter_contexts[2], options_string) < 0) {
-        LOG_WARNING("Unable to initialize scale filter");
+    encoder->yuv_frame = av_frame_alloc();
+    encoder->yuv_frame->format = out_format;
+    encoder->yuv_frame->width = encoder->out_width;
+    encoder->yuv_frame->height = encoder->out_height;
+    int err = av_frame_get_buffer(encoder->yuv_frame, 0);
+    if (err < 0) {
+        LOG_WARNING("Unable to allocate the YUV frame: %s", av_err2str(err));
         destroy_ffmpeg_encoder(encoder);
         return NULL;
     }
 
-    // sink buffer
-    if (avfilter_graph_create_filter(&filter_contexts[3], filters[3], "sink", NULL, NULL,
-                                     encoder->filter_graph) < 0) {
-        LOG_WARNING("Unable to initialize buffer sink");
-        destroy_ffmpeg_encoder(encoder);
-        return NULL;
-    }
-    encoder->filter_graph_sink = filter_contexts[3];
+    // init conversion, with our own converter unless the frame also has to be scaled
 
-    // connect the filters in a simple line
-    for (int i = 0; i < N_FILTERS_SW - 1; ++i) {
-        if (avfilter_link(filter_contexts[i], 0, filter_contexts[i + 1], 0) < 0) {
-            LOG_WARNING("Unable to link filters %d to %d", i, i + 1);
+    if (encoder->in_width == encoder->out_width && encoder->in_height == encoder->out_height) {
+        encoder->rgb_to_yuv = create_rgb_to_yuv_converter(RGB_TO_YUV_THREADS);
+        LOG_INFO("Converting frames to YUV with the %s kernel",
+                 rgb_to_yuv_kernel_to_str(rgb_to_yuv_get_kernel()));
+    } else {
+        encoder->sws_context = sws_getContext(encoder->in_width, encoder->in_height, in_format,
+                                              encoder->out_width, encoder->out_height, out_format,
+                                              SWS_BICUBIC, NULL, NULL, NULL);
+        if (!encoder->sws_context) {
+            LOG_WARNING("Unable to create the scaling context");
             destroy_ffmpeg_encoder(encoder);
             return NULL;
         }
     }
 
-    // configure the graph
-    int err = avfilter_graph_config(encoder->filter_graph, NULL);
-    if (err < 0) {
-        LOG_WARNING("Unable to configure the filter graph: %s", av_err2str(err));
-        destroy_ffmpeg_encoder(encoder);
-        return NULL;
-    }
-
-    // init transfer frame
-    encoder->filtered_frame = av_frame_alloc();
-
     // init encoder format in context
 
     if (encoder->codec_type == CODEC_TYPE_H264) {
@@ -430,6 +444,12 @@ static FFmpegEncoder *create_sw_encoder(int in_width, int in_height, int out_wid
     encoder->context->keyint_min = 5;
     encoder->context->pix_fmt = out_format;
     encoder->context->max_b_frames = 0;
+    if (encoder->codec_type == CODEC_TYPE_H264) {
+        // zerolatency encodes the slices on threads of their own, and the client can decode each
+        // one as soon as it has arrived
+        encoder->context->slices = VIDEO_ENCODER_SLICES;
+        encoder->sliced_packet = av_packet_alloc();
+    }
 
     set_opt(encoder, "preset", "fast");
     set_opt(encoder, "tune", "zerolatency");
@@ -540,6 +560,26 @@ int ffmpeg_encoder_frame_intake(FFmpegEncoder *encoder, void *rgb_pixels, int pi
     encoder->sw_frame->linesize[0] = pitch;
     encoder->sw_frame->pts++;
 
+    if (encoder->yuv_frame) {
+        // The encoder may still hold a reference to the previous frame
+        int res = av_frame_make_writable(encoder->yuv_frame);
+        if (res < 0) {
+            LOG_ERROR("Unable to make the YUV frame writable: %s", av_err2str(res));
+            return -1;
+        }
+        if (encoder->rgb_to_yuv) {
+            rgb_to_yuv_convert(encoder->rgb_to_yuv, (const uint8_t *)rgb_pixels, pitch,
+                               encoder->yuv_frame->data, encoder->yuv_frame->linesize,
+                               encoder->out_width, encoder->out_height);
+        } else {
+            sws_scale(encoder->sws_context, (const uint8_t *const *)encoder->sw_frame->data,
+                      encoder->sw_frame->linesize, 0, encoder->in_height, encoder->yuv_frame->data,
+                      encoder->yuv_frame->linesize);
+        }
+        encoder->yuv_frame->pts = encoder->sw_frame->pts;
+    }
+    av_frame_remove_side_data(get_input_frame(encoder), AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
     if (encoder->hw_frame) {
         int res = av_hwframe_transfer_data(encoder->hw_frame, encoder->sw_frame, 0);
         if (res < 0) {
@@ -550,6 +590,60 @@ int ffmpeg_encoder_frame_intake(FFmpegEncoder *encoder, void *rgb_pixels, int pi
     return 0;
 }
 
+void ffmpeg_encoder_set_dirty_rects(FFmpegEncoder *encoder, const WhistRect *rects,
+                                    int num_rects) {
+    /*
+        Attach the changed regions of the frame to the encoder's input frame as regions of
+       interest. The changed regions keep the encoder's quantizer, and the rest of the frame gets a
+       coarser one. Hardware encoders don't support regions of interest, so they ignore this.
+
+        Arguments:
+            encoder (FFmpegEncoder*): video encoder whose frame was just taken in
+            rects (const WhistRect*): the changed regions, in input frame coordinates
+            num_rects (int): the number of changed regions
+     */
+    if (!encoder) {
+        LOG_ERROR("ffmpeg_encoder_set_dirty_rects received NULL encoder!");
+        return;
+    }
+    AVFrame *input_frame = get_input_frame(encoder);
+    av_frame_remove_side_data(input_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (encoder->type != SOFTWARE_ENCODE ||
+        dirty_rects_cover_frame(rects, num_rects, encoder->in_width, encoder->in_height)) {
+        return;
+    }
+
+    // x264 applies the regions in order, with the first one taking precedence, so the changed
+    // regions go first and a final region covering the whole frame marks everything else static
+    AVFrameSideData *side_data =
+        av_frame_new_side_data(input_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                               (num_rects + 1) * sizeof(AVRegionOfInterest));
+    if (!side_data) {
+        LOG_WARNING("Could not allocate the regions of interest for %d dirty rects", num_rects);
+        return;
+    }
+    AVRegionOfInterest *regions = (AVRegionOfInterest *)side_data->data;
+    for (int i = 0; i < num_rects; i++) {
+        // The regions are in the coordinates of the encoded frame, after scaling
+        regions[i].self_size = sizeof(AVRegionOfInterest);
+        regions[i].left = rects[i].x * encoder->out_width / encoder->in_width;
+        regions[i].top = rects[i].y * encoder->out_height / encoder->in_height;
+        regions[i].right =
+            (rects[i].x + rects[i].width) * encoder->out_width / encoder->in_width;
+        regions[i].bottom =
+            (rects[i].y + rects[i].height) * encoder->out_height / encoder->in_height;
+        regions[i].qoffset = av_make_q(0, 1);
+    }
+    regions[num_rects] = (AVRegionOfInterest){
+        .self_size = sizeof(AVRegionOfInterest),
+        .top = 0,
+        .bottom = encoder->out_height,
+        .left = 0,
+        .right = encoder->out_width,
+        .qoffset = STATIC_REGION_QOFFSET,
+    };
+}
+
 void ffmpeg_set_iframe(FFmpegEncoder *encoder) {
     /*
         Set the next frame to be an IDR frame. Unreliable for FFmpeg.
@@ -587,9 +681,14 @@ void destroy_ffmpeg_encoder(FFmpegEncoder *encoder) {
         av_buffer_unref(&encoder->hw_device_ctx);
     }
 
+    destroy_rgb_to_yuv_converter(encoder->rgb_to_yuv);
+    sws_freeContext(encoder->sws_context);
+
     av_frame_free(&encoder->hw_frame);
     av_frame_free(&encoder->sw_frame);
+    av_frame_free(&encoder->yuv_frame);
     av_frame_free(&encoder->filtered_frame);
+    av_packet_free(&encoder->sliced_packet);
 
     // free the buffer and encoder
     free(encoder->sw_frame_buffer);
@@ -600,7 +699,7 @@ void destroy_ffmpeg_encoder(FFmpegEncoder *encoder) {
 // next one when the previous one doesn't work
 int ffmpeg_encoder_send_frame(FFmpegEncoder *encoder) {
     /*
-        Send a frame through the filter graph, then encode it.
+        Send a frame through the filter graph if the encoder has one, then encode it.
 
         Arguments:
             encoder (FFmpegEncoder*): encoder used to encode the frame
@@ -608,12 +707,7 @@ int ffmpeg_encoder_send_frame(FFmpegEncoder *encoder) {
         Returns:
             (int): 0 on success, -1 on failure
     */
-    AVFrame *active_frame = NULL;
-    if (encoder->hw_frame) {
-        active_frame = encoder->hw_frame;
-    } else {
-        active_frame = encoder->sw_frame;
-    }
+    AVFrame *active_frame = get_input_frame(encoder);
 
     if (encoder->wants_iframe) {
         if (encoder->type != SOFTWARE_ENCODE && encoder->type != NVENC_ENCODE) {
@@ -621,41 +715,52 @@ int ffmpeg_encoder_send_frame(FFmpegEncoder *encoder) {
         }
         active_frame->pict_type = AV_PICTURE_TYPE_I;
         active_frame->key_frame = 1;
+        // An intra frame codes every region from scratch, so none of them are static
+        av_frame_remove_side_data(active_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
     } else {
         active_frame->pict_type = AV_PICTURE_TYPE_NONE;
         active_frame->key_frame = 0;
     }
 
-    int res = av_buffersrc_add_frame(encoder->filter_graph_source, active_frame);
-    if (res < 0) {
-        LOG_WARNING("Error submitting frame to the filter graph: %s", av_err2str(res));
-    }
+    if (encoder->filter_graph) {
+        int res = av_buffersrc_add_frame(encoder->filter_graph_source, active_frame);
+        if (res < 0) {
+            LOG_WARNING("Error submitting frame to the filter graph: %s", av_err2str(res));
+        }
 
-    if (encoder->hw_frame) {
-        // have to re-create buffers after sending to filter graph
-        av_hwframe_get_buffer(encoder->context->hw_frames_ctx, encoder->hw_frame, 0);
-    }
+        if (encoder->hw_frame) {
+            // have to re-create buffers after sending to filter graph
+            av_hwframe_get_buffer(encoder->context->hw_frames_ctx, encoder->hw_frame, 0);
+        }
 
-    int res_buffer;
+        int res_buffer;
 
-    // submit all available frames to the encoder
-    while ((res_buffer = av_buffersink_get_frame(encoder->filter_graph_sink,
-                                                 encoder->filtered_frame)) >= 0) {
-        int res_encoder = avcodec_send_frame(encoder->context, encoder->filtered_frame);
+        // submit all available frames to the encoder
+        while ((res_buffer = av_buffersink_get_frame(encoder->filter_graph_sink,
+                                                     encoder->filtered_frame)) >= 0) {
+            int res_encoder = avcodec_send_frame(encoder->context, encoder->filtered_frame);
 
-        // unref the frame so it may be reused
-        av_frame_unref(encoder->filtered_frame);
+            // unref the frame so it may be reused
+            av_frame_unref(encoder->filtered_frame);
 
+            if (res_encoder < 0) {
+                LOG_WARNING("Error sending frame for encoding: %s", av_err2str(res_encoder));
+                return -1;
+            }
+        }
+        if (res_buffer < 0 && res_buffer != AVERROR(EAGAIN) && res_buffer != AVERROR_EOF) {
+            LOG_WARNING("Error getting frame from the filter graph: %d -- %s", res_buffer,
+                        av_err2str(res_buffer));
+            return -1;
+        }
+    } else {
+        // The frame was already converted at intake, so it goes straight to the encoder
+        int res_encoder = avcodec_send_frame(encoder->context, active_frame);
         if (res_encoder < 0) {
             LOG_WARNING("Error sending frame for encoding: %s", av_err2str(res_encoder));
             return -1;
         }
     }
-    if (res_buffer < 0 && res_buffer != AVERROR(EAGAIN) && res_buffer != AVERROR_EOF) {
-        LOG_WARNING("Error getting frame from the filter graph: %d -- %s", res_buffer,
-                    av_err2str(res_buffer));
-        return -1;
-    }
 
     // Wrap around GOP size
     if (encoder->frames_since_last_iframe % encoder->gop_size == 0) {
@@ -685,7 +790,8 @@ int ffmpeg_encoder_send_frame(FFmpegEncoder *encoder) {
 int ffmpeg_encoder_receive_packet(FFmpegEncoder *encoder, AVPacket *packet) {
     /*
         Wrapper around FFmpeg's avcodec_receive_packet. Get an encoded packet from the encoder
-       and store it in packet.
+       and store it in packet. For the software H.264 encoder, each packet is one slice of the
+       frame.
 
         Arguments:
             encoder (FFmpegEncoder*): encoder used to encode the frame
@@ -697,8 +803,17 @@ int ffmpeg_encoder_receive_packet(FFmpegEncoder *encoder, AVPacket *packet) {
     */
     int res_encoder;
 
-    // receive_packet already calls av_packet_unref, no need to reinitialize packet
-    res_encoder = avcodec_receive_packet(encoder->context, packet);
+    if (encoder->sliced_packet == NULL) {
+        // receive_packet already calls av_packet_unref, no need to reinitialize packet
+        res_encoder = avcodec_receive_packet(encoder->context, packet);
+    } else if (encoder->next_slice_offset < encoder->sliced_packet->size) {
+        // There are slices of the last frame left
+        res_encoder = 0;
+    } else {
+        res_encoder = avcodec_receive_packet(encoder->context, encoder->sliced_packet);
+        encoder->next_slice_offset = 0;
+        encoder->num_slices_received = 0;
+    }
     if (res_encoder == AVERROR(EAGAIN) || res_encoder == AVERROR(EOF)) {
         return 1;
     } else if (res_encoder < 0) {
@@ -706,5 +821,19 @@ int ffmpeg_encoder_receive_packet(FFmpegEncoder *encoder, AVPacket *packet) {
         return -1;
     }
 
+    if (encoder->sliced_packet != NULL) {
+        // Hand out the next slice, as a reference to the part of the frame that it's in
+        int slice_end = get_next_slice_end(encoder);
+        res_encoder = av_packet_ref(packet, encoder->sliced_packet);
+        if (res_encoder < 0) {
+            LOG_ERROR("Error referencing slice of encoded frame: %s", av_err2str(res_encoder));
+            return -1;
+        }
+        packet->data += encoder->next_slice_offset;
+        packet->size = slice_end - encoder->next_slice_offset;
+        encoder->next_slice_offset = slice_end;
+        encoder->num_slices_received++;
+    }
+
     return 0;
 }
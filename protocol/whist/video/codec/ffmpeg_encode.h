@@ -11,8 +11,9 @@ Usage
 Video is encoded to H264 via either a hardware encoder (currently, we use NVidia GPUs, so we use
 NVENC) or a software encoder if hardware encoding fails. H265 is also supported but not currently
 used. For encoders, create an H264 encoder via create_ffmpeg_encoder, and use it to encode frames
-via ffmpeg_encoder_send_frame. Retrieve encoded packets using ffmpeg_encoder_receive_packet. When
-finished, destroy the encoder using destroy_ffmpeg_encoder.
+via ffmpeg_encoder_send_frame. Retrieve encoded packets using ffmpeg_encoder_receive_packet, which
+for the software H.264 encoder returns each of the VIDEO_ENCODER_SLICES slices of a frame as a
+packet of its own. When finished, destroy the encoder using destroy_ffmpeg_encoder.
 */
 
 /*
@@ -23,6 +24,8 @@ Includes
 
 #include <whist/core/whist.h>
 #include <whist/video/ltr.h>
+#include <whist/video/dirty_rects.h>
+#include <whist/video/rgb_to_yuv/rgb_to_yuv.h>
 
 /*
 ============================
@@ -41,9 +44,10 @@ typedef enum FFmpegEncodeType {
 
 /**
  * @brief           Struct for handling ffmpeg encoding of video frames. If software encoding, the
- * codec and context determine the properties of the output frames, and scaling is done using the
- * filter_graph. Frames encoded on the GPU are stored in hw_frame, while frames encoded on the CPU
- * are stored in sw_frame.
+ * codec and context determine the properties of the output frames, and captured frames in sw_frame
+ * are converted straight into yuv_frame, by rgb_to_yuv when the size is unchanged or by
+ * sws_context when they must be scaled. Frames encoded on the GPU are stored in hw_frame, and
+ * scaled using the filter_graph.
  *
  */
 typedef struct FFmpegEncoder {
@@ -53,6 +57,8 @@ typedef struct FFmpegEncoder {
     AVFilterGraph* filter_graph;
     AVFilterContext* filter_graph_source;
     AVFilterContext* filter_graph_sink;
+    RGBToYUVConverter* rgb_to_yuv;
+    struct SwsContext* sws_context;
     AVBufferRef* hw_device_ctx;
     int frames_since_last_iframe;
     bool wants_iframe;
@@ -72,8 +78,15 @@ typedef struct FFmpegEncoder {
     // Various AVFrame's to be used for encoding
     AVFrame* hw_frame;
     AVFrame* sw_frame;
+    AVFrame* yuv_frame;
     AVFrame* filtered_frame;
     LTRAction ltr_action;
+
+    // The software H.264 encoder outputs all of a frame's slices in one packet, which is kept here
+    // and handed out one slice at a time by ffmpeg_encoder_receive_packet
+    AVPacket* sliced_packet;
+    int next_slice_offset;
+    int num_slices_received;
 } FFmpegEncoder;
 
 /*
@@ -117,12 +130,26 @@ bool ffmpeg_reconfigure_encoder(FFmpegEncoder* encoder, int in_width, int in_hei
  * @returns                        0 on success, else -1
  */
 int ffmpeg_encoder_frame_intake(FFmpegEncoder* encoder, void* rgb_pixels, int pitch);
+
+/**
+ * @brief                          Tell the encoder which regions of the frame that was just taken
+ *                                 in changed since the previous frame. The software encoder spends
+ *                                 fewer bits on the rest of the frame, so that it skips the
+ *                                 macroblocks there. Must be called after
+ *                                 ffmpeg_encoder_frame_intake, which clears the previous hints.
+ *
+ * @param encoder                  The encoder to use
+ * @param rects                    The changed regions, in input frame coordinates
+ * @param num_rects                The number of changed regions
+ */
+void ffmpeg_encoder_set_dirty_rects(FFmpegEncoder* encoder, const WhistRect* rects, int num_rects);
 int ffmpeg_encoder_receive_packet(FFmpegEncoder* encoder, AVPacket* packet);
 
 /**
- * @brief                          Encode the frame in `encoder->sw_frame` or
- *                                 `encoder->hw_frame`. The encoded packet(s)
- *                                 are stored in `encoder->packets`, and the
+ * @brief                          Encode the frame in `encoder->hw_frame`,
+ *                                 `encoder->yuv_frame` or `encoder->sw_frame`.
+ *                                 The encoded packet(s) are stored in
+ *                                 `encoder->packets`, and the
  *                                 size of the buffer necessary to store them
  *                                 is stored in `encoder->encoded_frame_size`
  *
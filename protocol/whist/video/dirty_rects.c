@@ -0,0 +1,87 @@
+/**
+ * @copyright Copyright 2022 Whist Technologies, Inc.
+ * @file dirty_rects.c
+ * @brief Merging of damaged screen regions into a short list of rectangles.
+ */
+#include "whist/core/whist.h"
+
+#include "dirty_rects.h"
+
+static int64_t rect_area(WhistRect rect) { return (int64_t)rect.width * rect.height; }
+
+static WhistRect rect_union(WhistRect a, WhistRect b) {
+    int left = min(a.x, b.x);
+    int top = min(a.y, b.y);
+    int right = max(a.x + a.width, b.x + b.width);
+    int bottom = max(a.y + a.height, b.y + b.height);
+    return (WhistRect){left, top, right - left, bottom - top};
+}
+
+// Whether the rectangles overlap or share an edge.
+static bool rects_touch(WhistRect a, WhistRect b) {
+    return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height &&
+           b.y <= a.y + a.height;
+}
+
+void dirty_rects_add(WhistRect *rects, int *num_rects, WhistRect rect, int width, int height) {
+    // Clip to the frame
+    int right = min(rect.x + rect.width, width);
+    int bottom = min(rect.y + rect.height, height);
+    rect.x = max(rect.x, 0);
+    rect.y = max(rect.y, 0);
+    rect.width = right - rect.x;
+    rect.height = bottom - rect.y;
+    if (rect.width <= 0 || rect.height <= 0) {
+        return;
+    }
+
+    // Each merge removes a rectangle from the list, and the merged one is then added again,
+    // since it might now touch rectangles that the original didn't.
+    while (true) {
+        int merge_index = -1;
+        for (int i = 0; i < *num_rects; i++) {
+            // Only merge when the union doesn't cover more pixels than the two separately,
+            // otherwise an L-shape of two thin rectangles would become a big square.
+            if (rects_touch(rects[i], rect) &&
+                rect_area(rect_union(rects[i], rect)) <= rect_area(rects[i]) + rect_area(rect)) {
+                merge_index = i;
+                break;
+            }
+        }
+        if (merge_index < 0 && *num_rects == MAX_DIRTY_RECTS) {
+            // The list is full, so merge into whichever rectangle grows the least
+            int64_t best_growth = INT64_MAX;
+            for (int i = 0; i < *num_rects; i++) {
+                int64_t growth = rect_area(rect_union(rects[i], rect)) - rect_area(rects[i]);
+                if (growth < best_growth) {
+                    best_growth = growth;
+                    merge_index = i;
+                }
+            }
+        }
+        if (merge_index < 0) {
+            rects[(*num_rects)++] = rect;
+            return;
+        }
+        rect = rect_union(rects[merge_index], rect);
+        rects[merge_index] = rects[--*num_rects];
+    }
+}
+
+int64_t dirty_rects_area(const WhistRect *rects, int num_rects) {
+    int64_t area = 0;
+    for (int i = 0; i < num_rects; i++) {
+        area += rect_area(rects[i]);
+    }
+    return area;
+}
+
+bool dirty_rects_cover_frame(const WhistRect *rects, int num_rects, int width, int height) {
+    for (int i = 0; i < num_rects; i++) {
+        if (rects[i].x <= 0 && rects[i].y <= 0 && rects[i].x + rects[i].width >= width &&
+            rects[i].y + rects[i].height >= height) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,65 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file dirty_rects.h
+ * @brief API for tracking the regions of the screen that changed between two captures.
+ */
+#ifndef WHIST_VIDEO_DIRTY_RECTS_H
+#define WHIST_VIDEO_DIRTY_RECTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Maximum number of dirty rectangles tracked for one frame.
+ *
+ * Once the list is full, new damage is merged into whichever existing
+ * rectangle grows the least, so the list always covers all of it.
+ */
+#define MAX_DIRTY_RECTS 16
+
+/**
+ * A rectangle of pixels within a frame.
+ */
+typedef struct WhistRect {
+    int x;
+    int y;
+    int width;
+    int height;
+} WhistRect;
+
+/**
+ * Add a damaged rectangle to a dirty rectangle list.
+ *
+ * The rectangle is clipped to the frame, and merged with the rectangles
+ * that it overlaps or touches, so that the list stays short and doesn't
+ * cover any pixel twice more often than necessary.
+ *
+ * @param rects      Dirty rectangle list, with room for MAX_DIRTY_RECTS.
+ * @param num_rects  Number of rectangles in the list, updated on return.
+ * @param rect       The damaged rectangle.
+ * @param width      Width of the frame.
+ * @param height     Height of the frame.
+ */
+void dirty_rects_add(WhistRect *rects, int *num_rects, WhistRect rect, int width, int height);
+
+/**
+ * Get the number of pixels covered by a dirty rectangle list.
+ *
+ * @param rects      Dirty rectangle list.
+ * @param num_rects  Number of rectangles in the list.
+ * @return           Sum of the areas of the rectangles.
+ */
+int64_t dirty_rects_area(const WhistRect *rects, int num_rects);
+
+/**
+ * Check whether a dirty rectangle list covers a whole frame.
+ *
+ * @param rects      Dirty rectangle list.
+ * @param num_rects  Number of rectangles in the list.
+ * @param width      Width of the frame.
+ * @param height     Height of the frame.
+ * @return           Whether one of the rectangles is the whole frame.
+ */
+bool dirty_rects_cover_frame(const WhistRect *rects, int num_rects, int width, int height);
+
+#endif /* WHIST_VIDEO_DIRTY_RECTS_H */
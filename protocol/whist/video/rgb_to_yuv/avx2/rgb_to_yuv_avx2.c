@@ -0,0 +1,100 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv_avx2.c
+ * @brief AVX2 RGB32 to YUV420P kernel, kept in its own file so that it's the only code built with
+ *        -mavx2.
+ */
+#include <immintrin.h>
+
+#include "../rgb_to_yuv_internal.h"
+
+/*
+    The 256-bit unpack, hadd and pack instructions work within each 128-bit lane, so the
+    intermediate results end up with the two lanes interleaved. Each step below notes the order,
+    and the results are put back in order right before they're stored.
+*/
+
+// Convert 8 RGB32 pixels to 8 luma samples, as 32-bit integers in order
+static inline __m256i luma8(const uint8_t *rgb) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i coefficients =
+        _mm256_setr_epi16(RGB_TO_Y_B, RGB_TO_Y_G, RGB_TO_Y_R, 0, RGB_TO_Y_B, RGB_TO_Y_G,
+                          RGB_TO_Y_R, 0, RGB_TO_Y_B, RGB_TO_Y_G, RGB_TO_Y_R, 0, RGB_TO_Y_B,
+                          RGB_TO_Y_G, RGB_TO_Y_R, 0);
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)rgb);
+    // Pixels 0, 1 | 4, 5 and pixels 2, 3 | 6, 7
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), coefficients);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), coefficients);
+    // Pixels 0, 1, 2, 3 | 4, 5, 6, 7
+    __m256i sums = _mm256_hadd_epi32(lo, hi);
+    return _mm256_srai_epi32(_mm256_add_epi32(sums, _mm256_set1_epi32(RGB_TO_Y_OFFSET)), 8);
+}
+
+// Convert 32 RGB32 pixels to 32 luma samples
+static inline __m256i luma32(const uint8_t *rgb) {
+    // Pixels 0-3, 8-11 | 4-7, 12-15 and 16-19, 24-27 | 20-23, 28-31
+    __m256i lo = _mm256_packs_epi32(luma8(rgb), luma8(rgb + 32));
+    __m256i hi = _mm256_packs_epi32(luma8(rgb + 64), luma8(rgb + 96));
+    // Groups of 4 pixels in the order 0, 2, 4, 6 | 1, 3, 5, 7
+    __m256i packed = _mm256_packus_epi16(lo, hi);
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+// Sum the 2x2 blocks of 8 RGB32 pixels in each of two rows, into 4 blocks of 16-bit B, G, R, X
+static inline __m256i block_sums(const uint8_t *rgb0, const uint8_t *rgb1) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i row0 = _mm256_loadu_si256((const __m256i *)rgb0);
+    __m256i row1 = _mm256_loadu_si256((const __m256i *)rgb1);
+    // Pixels 0, 1 | 4, 5 and pixels 2, 3 | 6, 7, summed vertically
+    __m256i lo =
+        _mm256_add_epi16(_mm256_unpacklo_epi8(row0, zero), _mm256_unpacklo_epi8(row1, zero));
+    __m256i hi =
+        _mm256_add_epi16(_mm256_unpackhi_epi8(row0, zero), _mm256_unpackhi_epi8(row1, zero));
+    // Then horizontally, into blocks 0, 1 | 2, 3
+    return _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+}
+
+// Convert the sums of 16 blocks to 16 chroma samples
+static inline __m128i chroma16(const __m256i sums[4], __m256i coefficients) {
+    const __m256i offset = _mm256_set1_epi32(RGB_TO_UV_OFFSET);
+    // Blocks 0, 1, 4, 5 | 2, 3, 6, 7 and 8, 9, 12, 13 | 10, 11, 14, 15
+    __m256i lo = _mm256_hadd_epi32(_mm256_madd_epi16(sums[0], coefficients),
+                                   _mm256_madd_epi16(sums[1], coefficients));
+    __m256i hi = _mm256_hadd_epi32(_mm256_madd_epi16(sums[2], coefficients),
+                                   _mm256_madd_epi16(sums[3], coefficients));
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, offset), 10);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, offset), 10);
+    // Blocks 0, 1, 4, 5, 8, 9, 12, 13 | 2, 3, 6, 7, 10, 11, 14, 15
+    __m256i packed = _mm256_packs_epi32(lo, hi);
+    __m128i bytes =
+        _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+    return _mm_shuffle_epi8(bytes,
+                            _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15));
+}
+
+void rgb_to_yuv_row_pair_avx2(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                              uint8_t *y1, uint8_t *u, uint8_t *v, int width) {
+    const __m256i u_coefficients = _mm256_setr_epi16(
+        RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R, 0, RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R, 0, RGB_TO_U_B,
+        RGB_TO_U_G, RGB_TO_U_R, 0, RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R, 0);
+    const __m256i v_coefficients = _mm256_setr_epi16(
+        RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R, 0, RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R, 0, RGB_TO_V_B,
+        RGB_TO_V_G, RGB_TO_V_R, 0, RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R, 0);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const uint8_t *p0 = rgb0 + 4 * x;
+        const uint8_t *p1 = rgb1 + 4 * x;
+        _mm256_storeu_si256((__m256i *)(y0 + x), luma32(p0));
+        _mm256_storeu_si256((__m256i *)(y1 + x), luma32(p1));
+
+        __m256i sums[4];
+        for (int i = 0; i < 4; i++) {
+            sums[i] = block_sums(p0 + 32 * i, p1 + 32 * i);
+        }
+        _mm_storeu_si128((__m128i *)(u + x / 2), chroma16(sums, u_coefficients));
+        _mm_storeu_si128((__m128i *)(v + x / 2), chroma16(sums, v_coefficients));
+    }
+    rgb_to_yuv_row_pair_scalar(rgb0 + 4 * x, rgb1 + 4 * x, y0 + x, y1 + x, u + x / 2, v + x / 2,
+                               width - x);
+}
@@ -0,0 +1,227 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv.c
+ * @brief RGB32 to YUV420P conversion, with a kernel picked for the CPU and frames split into bands
+ *        of rows that are converted in parallel.
+ */
+#include "whist/core/whist.h"
+
+#include "rgb_to_yuv.h"
+#include "rgb_to_yuv_internal.h"
+
+#if defined(_MSC_VER) && RGB_TO_YUV_HAVE_X86_KERNELS
+#include <intrin.h>
+#endif
+
+// The most threads that a converter will split a frame between
+#define RGB_TO_YUV_MAX_THREADS 8
+// Frames are only split into bands of at least this many rows, since waking up a thread for a
+// smaller band costs more than it saves
+#define RGB_TO_YUV_MIN_BAND_ROWS 64
+
+struct RGBToYUVConverter {
+    int num_threads;
+    // The worker threads, which convert bands 1 to num_threads - 1, while the calling thread
+    // converts band 0
+    WhistThread workers[RGB_TO_YUV_MAX_THREADS - 1];
+    bool run_workers;
+    // Posted to start a worker on its band, or to stop it
+    WhistSemaphore start_semaphores[RGB_TO_YUV_MAX_THREADS - 1];
+    // Posted once for every band that a worker has converted
+    WhistSemaphore done_semaphore;
+
+    // The conversion in progress
+    RGBToYUVRowPairKernel kernel;
+    const uint8_t *rgb;
+    int rgb_pitch;
+    uint8_t *planes[3];
+    int pitches[3];
+    int width;
+    int height;
+    int num_bands;
+};
+
+// Passed to a worker thread, to tell it which band is its own
+typedef struct {
+    RGBToYUVConverter *converter;
+    int band;
+} RGBToYUVWorkerArgs;
+
+// The fastest kernel that rgb_to_yuv_set_max_kernel() allows us to use
+static RGBToYUVKernel max_kernel = RGB_TO_YUV_KERNEL_AVX2;
+
+#if RGB_TO_YUV_HAVE_X86_KERNELS
+static bool cpu_has_avx2(void) {
+#if defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuid(cpu_info, 0);
+    if (cpu_info[0] < 7) {
+        return false;
+    }
+    // The OS has to save the YMM registers too
+    __cpuid(cpu_info, 1);
+    bool osxsave = (cpu_info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(cpu_info, 7, 0);
+    return (cpu_info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool cpu_has_ssse3(void) {
+#if defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuid(cpu_info, 1);
+    return (cpu_info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+#endif  // RGB_TO_YUV_HAVE_X86_KERNELS
+
+static RGBToYUVRowPairKernel get_row_pair_kernel(RGBToYUVKernel kernel) {
+    switch (kernel) {
+#if RGB_TO_YUV_HAVE_X86_KERNELS
+        case RGB_TO_YUV_KERNEL_AVX2:
+            return rgb_to_yuv_row_pair_avx2;
+        case RGB_TO_YUV_KERNEL_SSSE3:
+            return rgb_to_yuv_row_pair_ssse3;
+#endif
+#if RGB_TO_YUV_HAVE_NEON_KERNELS
+        case RGB_TO_YUV_KERNEL_NEON:
+            return rgb_to_yuv_row_pair_neon;
+#endif
+        default:
+            return rgb_to_yuv_row_pair_scalar;
+    }
+}
+
+// Convert the rows of a band, which are split evenly by row pairs
+static void convert_band(RGBToYUVConverter *converter, int band) {
+    int num_row_pairs = converter->height / 2;
+    int first_pair = num_row_pairs * band / converter->num_bands;
+    int end_pair = num_row_pairs * (band + 1) / converter->num_bands;
+    for (int pair = first_pair; pair < end_pair; pair++) {
+        int row = 2 * pair;
+        const uint8_t *rgb0 = converter->rgb + (size_t)row * converter->rgb_pitch;
+        uint8_t *y0 = converter->planes[0] + (size_t)row * converter->pitches[0];
+        converter->kernel(rgb0, rgb0 + converter->rgb_pitch, y0, y0 + converter->pitches[0],
+                          converter->planes[1] + (size_t)pair * converter->pitches[1],
+                          converter->planes[2] + (size_t)pair * converter->pitches[2],
+                          converter->width);
+    }
+}
+
+// Converts the worker's band every time it's started, until the converter is destroyed
+static int rgb_to_yuv_worker(void *opaque) {
+    RGBToYUVWorkerArgs args = *(RGBToYUVWorkerArgs *)opaque;
+    free(opaque);
+    RGBToYUVConverter *converter = args.converter;
+    // The encoder thread waits on us
+    whist_set_thread_priority(WHIST_THREAD_PRIORITY_REALTIME);
+
+    while (true) {
+        whist_wait_semaphore(converter->start_semaphores[args.band - 1]);
+        if (!converter->run_workers) {
+            break;
+        }
+        convert_band(converter, args.band);
+        whist_post_semaphore(converter->done_semaphore);
+    }
+    return 0;
+}
+
+RGBToYUVConverter *create_rgb_to_yuv_converter(int num_threads) {
+    RGBToYUVConverter *converter = safe_zalloc(sizeof(RGBToYUVConverter));
+    converter->num_threads = max(1, min(num_threads, RGB_TO_YUV_MAX_THREADS));
+    converter->run_workers = true;
+    converter->done_semaphore = whist_create_semaphore(0);
+    for (int i = 0; i < converter->num_threads - 1; i++) {
+        converter->start_semaphores[i] = whist_create_semaphore(0);
+        RGBToYUVWorkerArgs *args = safe_malloc(sizeof(RGBToYUVWorkerArgs));
+        args->converter = converter;
+        args->band = i + 1;
+        converter->workers[i] = whist_create_thread(rgb_to_yuv_worker, "rgb_to_yuv_worker", args);
+        FATAL_ASSERT(converter->workers[i] != NULL);
+    }
+    return converter;
+}
+
+void rgb_to_yuv_convert(RGBToYUVConverter *converter, const uint8_t *rgb, int rgb_pitch,
+                        uint8_t *const planes[3], const int pitches[3], int width, int height) {
+    FATAL_ASSERT(width % 2 == 0 && height % 2 == 0);
+    converter->kernel = get_row_pair_kernel(rgb_to_yuv_get_kernel());
+    converter->rgb = rgb;
+    converter->rgb_pitch = rgb_pitch;
+    for (int i = 0; i < 3; i++) {
+        converter->planes[i] = planes[i];
+        converter->pitches[i] = pitches[i];
+    }
+    converter->width = width;
+    converter->height = height;
+    converter->num_bands = max(1, min(converter->num_threads, height / RGB_TO_YUV_MIN_BAND_ROWS));
+
+    // The semaphores order the writes above before the workers' reads, and the workers' writes
+    // before our return
+    for (int band = 1; band < converter->num_bands; band++) {
+        whist_post_semaphore(converter->start_semaphores[band - 1]);
+    }
+    convert_band(converter, 0);
+    for (int band = 1; band < converter->num_bands; band++) {
+        whist_wait_semaphore(converter->done_semaphore);
+    }
+}
+
+void destroy_rgb_to_yuv_converter(RGBToYUVConverter *converter) {
+    if (converter == NULL) {
+        return;
+    }
+    converter->run_workers = false;
+    for (int i = 0; i < converter->num_threads - 1; i++) {
+        whist_post_semaphore(converter->start_semaphores[i]);
+    }
+    for (int i = 0; i < converter->num_threads - 1; i++) {
+        whist_wait_thread(converter->workers[i], NULL);
+        whist_destroy_semaphore(converter->start_semaphores[i]);
+    }
+    whist_destroy_semaphore(converter->done_semaphore);
+    free(converter);
+}
+
+void rgb_to_yuv_set_max_kernel(RGBToYUVKernel kernel) { max_kernel = kernel; }
+
+RGBToYUVKernel rgb_to_yuv_get_kernel(void) {
+#if RGB_TO_YUV_HAVE_X86_KERNELS
+    if (max_kernel >= RGB_TO_YUV_KERNEL_AVX2 && cpu_has_avx2()) {
+        return RGB_TO_YUV_KERNEL_AVX2;
+    }
+    if (max_kernel >= RGB_TO_YUV_KERNEL_SSSE3 && cpu_has_ssse3()) {
+        return RGB_TO_YUV_KERNEL_SSSE3;
+    }
+#endif
+#if RGB_TO_YUV_HAVE_NEON_KERNELS
+    // NEON is part of the baseline of every ARM target that we build for
+    if (max_kernel >= RGB_TO_YUV_KERNEL_NEON) {
+        return RGB_TO_YUV_KERNEL_NEON;
+    }
+#endif
+    return RGB_TO_YUV_KERNEL_SCALAR;
+}
+
+const char *rgb_to_yuv_kernel_to_str(RGBToYUVKernel kernel) {
+    switch (kernel) {
+        case RGB_TO_YUV_KERNEL_SCALAR:
+            return "scalar";
+        case RGB_TO_YUV_KERNEL_NEON:
+            return "neon";
+        case RGB_TO_YUV_KERNEL_SSSE3:
+            return "ssse3";
+        case RGB_TO_YUV_KERNEL_AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
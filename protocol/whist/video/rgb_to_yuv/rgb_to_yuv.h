@@ -0,0 +1,92 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv.h
+ * @brief API for converting captured RGB32 frames to YUV420P for the software encoder.
+ */
+#ifndef WHIST_VIDEO_RGB_TO_YUV_H
+#define WHIST_VIDEO_RGB_TO_YUV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Conversion kernels, from slowest to fastest.
+ *
+ * All of them produce exactly the same output: BT.601 limited-range
+ * YUV, with each chroma sample being the average of a 2x2 block.
+ */
+typedef enum RGBToYUVKernel {
+    RGB_TO_YUV_KERNEL_SCALAR,
+    RGB_TO_YUV_KERNEL_NEON,
+    RGB_TO_YUV_KERNEL_SSSE3,
+    RGB_TO_YUV_KERNEL_AVX2,
+} RGBToYUVKernel;
+
+/**
+ * RGB to YUV converter, which splits each frame into bands of rows
+ * that are converted in parallel.
+ */
+typedef struct RGBToYUVConverter RGBToYUVConverter;
+
+/**
+ * Create a new converter.
+ *
+ * @param num_threads  Number of threads that convert a frame, including
+ *                     the calling thread.  1 converts on the calling
+ *                     thread only.
+ * @return             The new converter.
+ */
+RGBToYUVConverter *create_rgb_to_yuv_converter(int num_threads);
+
+/**
+ * Convert an RGB32 frame to YUV420P.
+ *
+ * The RGB32 pixels are laid out as in AV_PIX_FMT_RGB32, so B, G, R, X
+ * in memory on little-endian machines.  The width and height must be
+ * even.  Returns once the whole frame has been converted.
+ *
+ * @param converter  Converter to use.
+ * @param rgb        RGB32 pixels.
+ * @param rgb_pitch  Number of bytes per row of RGB32 pixels.
+ * @param planes     Y, U and V planes to write to.
+ * @param pitches    Number of bytes per row of each plane.
+ * @param width      Width of the frame, in pixels.
+ * @param height     Height of the frame, in pixels.
+ */
+void rgb_to_yuv_convert(RGBToYUVConverter *converter, const uint8_t *rgb, int rgb_pitch,
+                        uint8_t *const planes[3], const int pitches[3], int width, int height);
+
+/**
+ * Destroy a converter, and stop its threads.
+ *
+ * @param converter  Converter to destroy.
+ */
+void destroy_rgb_to_yuv_converter(RGBToYUVConverter *converter);
+
+/**
+ * Limit the conversion to the given kernel, or slower ones.
+ *
+ * All kernels that the CPU supports are allowed by default.  This is
+ * meant for benchmarks and tests, and must not be called while a
+ * conversion is in progress.
+ *
+ * @param kernel  The fastest kernel to allow.
+ */
+void rgb_to_yuv_set_max_kernel(RGBToYUVKernel kernel);
+
+/**
+ * Get the kernel that conversions use.
+ *
+ * @return  The fastest kernel that is supported and allowed.
+ */
+RGBToYUVKernel rgb_to_yuv_get_kernel(void);
+
+/**
+ * Get the name of a kernel.
+ *
+ * @param kernel  The kernel.
+ * @return        Its name, as a static string.
+ */
+const char *rgb_to_yuv_kernel_to_str(RGBToYUVKernel kernel);
+
+#endif /* WHIST_VIDEO_RGB_TO_YUV_H */
@@ -0,0 +1,89 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv_internal.h
+ * @brief Conversion kernels shared between rgb_to_yuv.c and the instruction-set specific files.
+ */
+#ifndef WHIST_VIDEO_RGB_TO_YUV_INTERNAL_H
+#define WHIST_VIDEO_RGB_TO_YUV_INTERNAL_H
+
+#include <stdint.h>
+
+/*
+ * BT.601 limited-range coefficients, in 8-bit fixed point.  Luma is
+ * computed per pixel, and chroma from the sum of a 2x2 block, so the
+ * chroma sums are shifted by two more bits.  The offsets include the
+ * rounding and the +16/+128 bias of the output.
+ */
+#define RGB_TO_Y_R 66
+#define RGB_TO_Y_G 129
+#define RGB_TO_Y_B 25
+#define RGB_TO_Y_OFFSET (128 + (16 << 8))
+#define RGB_TO_U_R -38
+#define RGB_TO_U_G -74
+#define RGB_TO_U_B 112
+#define RGB_TO_V_R 112
+#define RGB_TO_V_G -94
+#define RGB_TO_V_B -18
+#define RGB_TO_UV_OFFSET (512 + (128 << 10))
+
+/**
+ * Convert a pair of rows of RGB32 pixels to two rows of luma and one
+ * row of each chroma plane.
+ *
+ * Each kernel converts as many pixels as it can with its vector width,
+ * and the scalar one handles what's left.
+ *
+ * @param rgb0   First row of RGB32 pixels.
+ * @param rgb1   Second row of RGB32 pixels.
+ * @param y0     First row of luma.
+ * @param y1     Second row of luma.
+ * @param u      Row of blue-difference chroma.
+ * @param v      Row of red-difference chroma.
+ * @param width  Number of pixels in each row, which must be even.
+ */
+typedef void (*RGBToYUVRowPairKernel)(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                                      uint8_t *y1, uint8_t *u, uint8_t *v, int width);
+
+static inline uint8_t rgb_to_yuv_luma(int r, int g, int b) {
+    return (uint8_t)((RGB_TO_Y_R * r + RGB_TO_Y_G * g + RGB_TO_Y_B * b + RGB_TO_Y_OFFSET) >> 8);
+}
+
+// Inline, so that the instruction-set specific libraries can finish their rows with it
+static inline void rgb_to_yuv_row_pair_scalar(const uint8_t *rgb0, const uint8_t *rgb1,
+                                              uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                              int width) {
+    for (int x = 0; x < width; x += 2) {
+        const uint8_t *p00 = rgb0 + 4 * x;
+        const uint8_t *p01 = p00 + 4;
+        const uint8_t *p10 = rgb1 + 4 * x;
+        const uint8_t *p11 = p10 + 4;
+        // RGB32 is B, G, R, X in memory
+        y0[x] = rgb_to_yuv_luma(p00[2], p00[1], p00[0]);
+        y0[x + 1] = rgb_to_yuv_luma(p01[2], p01[1], p01[0]);
+        y1[x] = rgb_to_yuv_luma(p10[2], p10[1], p10[0]);
+        y1[x + 1] = rgb_to_yuv_luma(p11[2], p11[1], p11[0]);
+        int b = p00[0] + p01[0] + p10[0] + p11[0];
+        int g = p00[1] + p01[1] + p10[1] + p11[1];
+        int r = p00[2] + p01[2] + p10[2] + p11[2];
+        u[x / 2] =
+            (uint8_t)((RGB_TO_U_R * r + RGB_TO_U_G * g + RGB_TO_U_B * b + RGB_TO_UV_OFFSET) >> 10);
+        v[x / 2] =
+            (uint8_t)((RGB_TO_V_R * r + RGB_TO_V_G * g + RGB_TO_V_B * b + RGB_TO_UV_OFFSET) >> 10);
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RGB_TO_YUV_HAVE_X86_KERNELS 1
+void rgb_to_yuv_row_pair_ssse3(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                               uint8_t *y1, uint8_t *u, uint8_t *v, int width);
+void rgb_to_yuv_row_pair_avx2(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                              uint8_t *y1, uint8_t *u, uint8_t *v, int width);
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RGB_TO_YUV_HAVE_NEON_KERNELS 1
+void rgb_to_yuv_row_pair_neon(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                              uint8_t *y1, uint8_t *u, uint8_t *v, int width);
+#endif
+
+#endif /* WHIST_VIDEO_RGB_TO_YUV_INTERNAL_H */
@@ -0,0 +1,68 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv_neon.c
+ * @brief NEON RGB32 to YUV420P kernel.
+ */
+#include <arm_neon.h>
+
+#include "rgb_to_yuv_internal.h"
+
+// Convert 8 pixels, given as separate B, G and R lanes, to 8 luma samples
+static inline uint8x8_t luma8(uint8x8_t b, uint8x8_t g, uint8x8_t r) {
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(RGB_TO_Y_R));
+    sum = vmlal_u8(sum, g, vdup_n_u8(RGB_TO_Y_G));
+    sum = vmlal_u8(sum, b, vdup_n_u8(RGB_TO_Y_B));
+    return vshrn_n_u16(vaddq_u16(sum, vdupq_n_u16(RGB_TO_Y_OFFSET)), 8);
+}
+
+// Convert 4 blocks, given as the sums of their B, G and R lanes, to 4 chroma samples as 16-bit
+// integers
+static inline int16x4_t chroma4(int16x4_t b, int16x4_t g, int16x4_t r, int16_t b_coefficient,
+                                int16_t g_coefficient, int16_t r_coefficient) {
+    int32x4_t sum = vmull_n_s16(r, r_coefficient);
+    sum = vmlal_n_s16(sum, g, g_coefficient);
+    sum = vmlal_n_s16(sum, b, b_coefficient);
+    return vshrn_n_s32(vaddq_s32(sum, vdupq_n_s32(RGB_TO_UV_OFFSET)), 10);
+}
+
+// Convert 8 blocks to 8 chroma samples
+static inline uint8x8_t chroma8(int16x8_t b, int16x8_t g, int16x8_t r, int16_t b_coefficient,
+                                int16_t g_coefficient, int16_t r_coefficient) {
+    int16x4_t lo = chroma4(vget_low_s16(b), vget_low_s16(g), vget_low_s16(r), b_coefficient,
+                           g_coefficient, r_coefficient);
+    int16x4_t hi = chroma4(vget_high_s16(b), vget_high_s16(g), vget_high_s16(r), b_coefficient,
+                           g_coefficient, r_coefficient);
+    return vqmovun_s16(vcombine_s16(lo, hi));
+}
+
+// Sum the 2x2 blocks of one lane of 16 pixels in each of two rows
+static inline int16x8_t block_sums(uint8x16_t row0, uint8x16_t row1) {
+    return vreinterpretq_s16_u16(vpadalq_u8(vpaddlq_u8(row0), row1));
+}
+
+void rgb_to_yuv_row_pair_neon(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1,
+                              uint8_t *u, uint8_t *v, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // Deinterleaved into B, G, R and X
+        uint8x16x4_t p0 = vld4q_u8(rgb0 + 4 * x);
+        uint8x16x4_t p1 = vld4q_u8(rgb1 + 4 * x);
+
+        vst1q_u8(y0 + x, vcombine_u8(luma8(vget_low_u8(p0.val[0]), vget_low_u8(p0.val[1]),
+                                           vget_low_u8(p0.val[2])),
+                                     luma8(vget_high_u8(p0.val[0]), vget_high_u8(p0.val[1]),
+                                           vget_high_u8(p0.val[2]))));
+        vst1q_u8(y1 + x, vcombine_u8(luma8(vget_low_u8(p1.val[0]), vget_low_u8(p1.val[1]),
+                                           vget_low_u8(p1.val[2])),
+                                     luma8(vget_high_u8(p1.val[0]), vget_high_u8(p1.val[1]),
+                                           vget_high_u8(p1.val[2]))));
+
+        int16x8_t b = block_sums(p0.val[0], p1.val[0]);
+        int16x8_t g = block_sums(p0.val[1], p1.val[1]);
+        int16x8_t r = block_sums(p0.val[2], p1.val[2]);
+        vst1_u8(u + x / 2, chroma8(b, g, r, RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R));
+        vst1_u8(v + x / 2, chroma8(b, g, r, RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R));
+    }
+    rgb_to_yuv_row_pair_scalar(rgb0 + 4 * x, rgb1 + 4 * x, y0 + x, y1 + x, u + x / 2, v + x / 2,
+                               width - x);
+}
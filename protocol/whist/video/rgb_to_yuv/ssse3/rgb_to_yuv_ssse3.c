@@ -0,0 +1,77 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file rgb_to_yuv_ssse3.c
+ * @brief SSSE3 RGB32 to YUV420P kernel, kept in its own file so that it's the only code built with
+ *        -mssse3.
+ */
+#include <tmmintrin.h>
+
+#include "../rgb_to_yuv_internal.h"
+
+// Convert 4 RGB32 pixels to 4 luma samples, as 32-bit integers
+static inline __m128i luma4(__m128i pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coefficients = _mm_setr_epi16(RGB_TO_Y_B, RGB_TO_Y_G, RGB_TO_Y_R, 0, RGB_TO_Y_B,
+                                                 RGB_TO_Y_G, RGB_TO_Y_R, 0);
+    // Widen to 16 bits, multiply, and sum the B, G and R terms of each pixel
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+    __m128i sums = _mm_hadd_epi32(lo, hi);
+    return _mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(RGB_TO_Y_OFFSET)), 8);
+}
+
+// Convert 16 RGB32 pixels to 16 luma samples
+static inline __m128i luma16(const uint8_t *rgb) {
+    __m128i lo = _mm_packs_epi32(luma4(_mm_loadu_si128((const __m128i *)rgb)),
+                                 luma4(_mm_loadu_si128((const __m128i *)(rgb + 16))));
+    __m128i hi = _mm_packs_epi32(luma4(_mm_loadu_si128((const __m128i *)(rgb + 32))),
+                                 luma4(_mm_loadu_si128((const __m128i *)(rgb + 48))));
+    return _mm_packus_epi16(lo, hi);
+}
+
+// Sum the 2x2 blocks of 4 RGB32 pixels in each of two rows, into two blocks of 16-bit B, G, R, X
+static inline __m128i block_sums(__m128i row0, __m128i row1) {
+    const __m128i zero = _mm_setzero_si128();
+    // Pixels 0 and 1, and pixels 2 and 3, summed vertically
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+    // Then horizontally, so pixels 0 + 1 and pixels 2 + 3
+    return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+}
+
+// Convert the sums of 4 blocks to 4 chroma samples, as 32-bit integers
+static inline __m128i chroma4(__m128i sums01, __m128i sums23, __m128i coefficients) {
+    __m128i weighted = _mm_hadd_epi32(_mm_madd_epi16(sums01, coefficients),
+                                      _mm_madd_epi16(sums23, coefficients));
+    return _mm_srai_epi32(_mm_add_epi32(weighted, _mm_set1_epi32(RGB_TO_UV_OFFSET)), 10);
+}
+
+void rgb_to_yuv_row_pair_ssse3(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                               uint8_t *y1, uint8_t *u, uint8_t *v, int width) {
+    const __m128i u_coefficients = _mm_setr_epi16(RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R, 0,
+                                                   RGB_TO_U_B, RGB_TO_U_G, RGB_TO_U_R, 0);
+    const __m128i v_coefficients = _mm_setr_epi16(RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R, 0,
+                                                   RGB_TO_V_B, RGB_TO_V_G, RGB_TO_V_R, 0);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *p0 = rgb0 + 4 * x;
+        const uint8_t *p1 = rgb1 + 4 * x;
+        _mm_storeu_si128((__m128i *)(y0 + x), luma16(p0));
+        _mm_storeu_si128((__m128i *)(y1 + x), luma16(p1));
+
+        __m128i sums[4];
+        for (int i = 0; i < 4; i++) {
+            sums[i] = block_sums(_mm_loadu_si128((const __m128i *)(p0 + 16 * i)),
+                                 _mm_loadu_si128((const __m128i *)(p1 + 16 * i)));
+        }
+        __m128i u16 = _mm_packs_epi32(chroma4(sums[0], sums[1], u_coefficients),
+                                      chroma4(sums[2], sums[3], u_coefficients));
+        __m128i v16 = _mm_packs_epi32(chroma4(sums[0], sums[1], v_coefficients),
+                                      chroma4(sums[2], sums[3], v_coefficients));
+        _mm_storel_epi64((__m128i *)(u + x / 2), _mm_packus_epi16(u16, u16));
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_packus_epi16(v16, v16));
+    }
+    rgb_to_yuv_row_pair_scalar(rgb0 + 4 * x, rgb1 + 4 * x, y0 + x, y1 + x, u + x / 2, v + x / 2,
+                               width - x);
+}
@@ -0,0 +1,70 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file tile_hash_sse2.c
+ * @brief SSE2 tile hashing kernel, kept in its own file so that it's the only code built with
+ *        -msse2.
+ */
+#include <emmintrin.h>
+
+#include "../tile_hash_internal.h"
+
+// Hash a 16-byte half of a stripe into the pair of accumulators that it belongs to
+static inline __m128i accumulate(__m128i acc, __m128i data, __m128i key) {
+    __m128i data_key = _mm_xor_si128(data, key);
+    // The high half of each word, moved down to be multiplied by its low half
+    __m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+    __m128i product = _mm_mul_epu32(data_key, data_key_hi);
+    // Each word is also added to the other accumulator of the pair
+    __m128i data_swap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(product, data_swap));
+}
+
+static inline __m128i scramble(__m128i acc, __m128i key) {
+    const __m128i prime = _mm_set1_epi32((int)TILE_HASH_PRIME32);
+    acc = _mm_xor_si128(_mm_xor_si128(acc, _mm_srli_epi64(acc, 47)), key);
+    // There's no 64-bit multiply, so multiply each half by the prime and add them back up
+    __m128i lo = _mm_mul_epu32(acc, prime);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+void tile_hash_rows_sse2(const uint8_t *pixels, int pitch, int width, int height,
+                         uint64_t acc[TILE_HASH_LANES]) {
+    // Accumulators 0 and 1, and 2 and 3, and the keys that go with them
+    __m128i acc01 = _mm_loadu_si128((const __m128i *)acc);
+    __m128i acc23 = _mm_loadu_si128((const __m128i *)(acc + 2));
+    __m128i keys[TILE_HASH_ROW_KEYS / 2];
+    for (int i = 0; i < TILE_HASH_ROW_KEYS / 2; i++) {
+        keys[i] = _mm_set_epi64x((long long)tile_hash_key(2 * i + 1),
+                                 (long long)tile_hash_key(2 * i));
+    }
+    const __m128i scramble_key01 = _mm_set_epi64x((long long)tile_hash_key(TILE_HASH_ROW_KEYS + 1),
+                                                  (long long)tile_hash_key(TILE_HASH_ROW_KEYS));
+    const __m128i scramble_key23 = _mm_set_epi64x((long long)tile_hash_key(TILE_HASH_ROW_KEYS + 3),
+                                                  (long long)tile_hash_key(TILE_HASH_ROW_KEYS + 2));
+
+    int row_bytes = width * 4;
+    int num_stripes = row_bytes / TILE_HASH_STRIPE_BYTES;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + (size_t)y * pitch;
+        for (int s = 0; s < num_stripes; s++) {
+            const uint8_t *stripe = row + s * TILE_HASH_STRIPE_BYTES;
+            acc01 = accumulate(acc01, _mm_loadu_si128((const __m128i *)stripe), keys[2 * s]);
+            acc23 =
+                accumulate(acc23, _mm_loadu_si128((const __m128i *)(stripe + 16)), keys[2 * s + 1]);
+        }
+        if (num_stripes * TILE_HASH_STRIPE_BYTES < row_bytes) {
+            // Only the tiles at the right edge of the frame get here
+            _mm_storeu_si128((__m128i *)acc, acc01);
+            _mm_storeu_si128((__m128i *)(acc + 2), acc23);
+            tile_hash_finish_row_scalar(row, num_stripes * TILE_HASH_STRIPE_BYTES, row_bytes, acc);
+            acc01 = _mm_loadu_si128((const __m128i *)acc);
+            acc23 = _mm_loadu_si128((const __m128i *)(acc + 2));
+        } else {
+            acc01 = scramble(acc01, scramble_key01);
+            acc23 = scramble(acc23, scramble_key23);
+        }
+    }
+    _mm_storeu_si128((__m128i *)acc, acc01);
+    _mm_storeu_si128((__m128i *)(acc + 2), acc23);
+}
@@ -0,0 +1,233 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file tile_hash.c
+ * @brief Tile hashing, with a kernel picked for the CPU, and the per-tile bookkeeping that narrows
+ *        a frame's damage down to the tiles that changed.
+ */
+#include <limits.h>
+
+#include "whist/core/whist.h"
+
+#include "tile_hash.h"
+#include "tile_hash_internal.h"
+
+#if defined(_MSC_VER) && TILE_HASH_HAVE_X86_KERNELS
+#include <intrin.h>
+#endif
+
+struct TileHasher {
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    uint64_t *hashes;
+    // Whether hashes[i] is the hash of tile i's current pixels
+    bool *is_hashed;
+    // The update that tile i was last hashed in, so that tiles touched by several dirty rects are
+    // only hashed once
+    uint32_t *hashed_in_update;
+    // Whether tile i changed in the update that it was last hashed in
+    bool *is_changed;
+    uint32_t update_id;
+};
+
+// The fastest kernel that tile_hash_set_max_kernel() allows us to use
+static TileHashKernel max_kernel = TILE_HASH_KERNEL_SSE2;
+
+#if TILE_HASH_HAVE_X86_KERNELS
+static bool cpu_has_sse2(void) {
+#if defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuid(cpu_info, 1);
+    return (cpu_info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif  // TILE_HASH_HAVE_X86_KERNELS
+
+static TileHashRowsKernel get_rows_kernel(TileHashKernel kernel) {
+    switch (kernel) {
+#if TILE_HASH_HAVE_X86_KERNELS
+        case TILE_HASH_KERNEL_SSE2:
+            return tile_hash_rows_sse2;
+#endif
+        default:
+            return tile_hash_rows_scalar;
+    }
+}
+
+// The splitmix64 finalizer, so that every bit of the accumulators affects every bit of the hash
+static uint64_t avalanche(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash_block(TileHashRowsKernel kernel, const uint8_t *pixels, int pitch, int width,
+                           int height) {
+    uint64_t acc[TILE_HASH_LANES];
+    for (int lane = 0; lane < TILE_HASH_LANES; lane++) {
+        acc[lane] = tile_hash_key(lane);
+    }
+    kernel(pixels, pitch, width, height, acc);
+    uint64_t hash = TILE_HASH_PRIME64 ^ ((uint64_t)width << 32 | (uint32_t)height);
+    for (int lane = 0; lane < TILE_HASH_LANES; lane++) {
+        hash = (hash ^ avalanche(acc[lane])) * TILE_HASH_PRIME64;
+    }
+    return avalanche(hash);
+}
+
+// Resize the hasher's tables for a frame, and forget all hashes if the frame changed size
+static void resize_tile_hasher(TileHasher *hasher, int width, int height) {
+    if (hasher->width == width && hasher->height == height) {
+        return;
+    }
+    free(hasher->hashes);
+    free(hasher->is_hashed);
+    free(hasher->hashed_in_update);
+    free(hasher->is_changed);
+    hasher->width = width;
+    hasher->height = height;
+    hasher->tiles_x = (width + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+    hasher->tiles_y = (height + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+    size_t num_tiles = (size_t)hasher->tiles_x * hasher->tiles_y;
+    hasher->hashes = safe_malloc(num_tiles * sizeof(uint64_t));
+    hasher->is_hashed = safe_zalloc(num_tiles * sizeof(bool));
+    hasher->hashed_in_update = safe_zalloc(num_tiles * sizeof(uint32_t));
+    hasher->is_changed = safe_zalloc(num_tiles * sizeof(bool));
+    hasher->update_id = 0;
+}
+
+/*
+============================
+Public Function Implementations
+============================
+*/
+
+TileHasher *create_tile_hasher(void) { return safe_zalloc(sizeof(TileHasher)); }
+
+uint64_t tile_hash(const uint8_t *pixels, int pitch, int width, int height) {
+    FATAL_ASSERT(width <= TILE_HASH_SIZE);
+    return hash_block(get_rows_kernel(tile_hash_get_kernel()), pixels, pitch, width, height);
+}
+
+int tile_hasher_update(TileHasher *hasher, const uint8_t *pixels, int pitch, int width,
+                       int height, WhistRect *rects, int *num_rects) {
+    resize_tile_hasher(hasher, width, height);
+    TileHashRowsKernel kernel = get_rows_kernel(tile_hash_get_kernel());
+    hasher->update_id++;
+    if (hasher->update_id == 0) {
+        // Wrapped around, so an old update could be mistaken for this one
+        memset(hasher->hashed_in_update, 0,
+               (size_t)hasher->tiles_x * hasher->tiles_y * sizeof(uint32_t));
+        hasher->update_id = 1;
+    }
+
+    // Hash every tile that the damage touches
+    int num_changed_tiles = 0;
+    for (int i = 0; i < *num_rects; i++) {
+        WhistRect rect = rects[i];
+        if (rect.width <= 0 || rect.height <= 0) {
+            continue;
+        }
+        for (int ty = rect.y / TILE_HASH_SIZE; ty <= (rect.y + rect.height - 1) / TILE_HASH_SIZE;
+             ty++) {
+            for (int tx = rect.x / TILE_HASH_SIZE;
+                 tx <= (rect.x + rect.width - 1) / TILE_HASH_SIZE; tx++) {
+                int tile = ty * hasher->tiles_x + tx;
+                if (hasher->hashed_in_update[tile] == hasher->update_id) {
+                    continue;
+                }
+                hasher->hashed_in_update[tile] = hasher->update_id;
+                int x = tx * TILE_HASH_SIZE;
+                int y = ty * TILE_HASH_SIZE;
+                uint64_t hash =
+                    hash_block(kernel, pixels + (size_t)y * pitch + (size_t)x * 4, pitch,
+                               min(TILE_HASH_SIZE, width - x), min(TILE_HASH_SIZE, height - y));
+                hasher->is_changed[tile] = !hasher->is_hashed[tile] || hasher->hashes[tile] != hash;
+                hasher->hashes[tile] = hash;
+                hasher->is_hashed[tile] = true;
+                if (hasher->is_changed[tile]) {
+                    num_changed_tiles++;
+                }
+            }
+        }
+    }
+
+    // Shrink each rect to the bounding box of its changed tiles. Every changed pixel is in a rect,
+    // and in a changed tile that the rect touches, so it stays covered.
+    int num_narrowed_rects = 0;
+    for (int i = 0; i < *num_rects; i++) {
+        WhistRect rect = rects[i];
+        if (rect.width <= 0 || rect.height <= 0) {
+            continue;
+        }
+        int left = INT_MAX, top = INT_MAX, right = INT_MIN, bottom = INT_MIN;
+        for (int ty = rect.y / TILE_HASH_SIZE; ty <= (rect.y + rect.height - 1) / TILE_HASH_SIZE;
+             ty++) {
+            for (int tx = rect.x / TILE_HASH_SIZE;
+                 tx <= (rect.x + rect.width - 1) / TILE_HASH_SIZE; tx++) {
+                if (hasher->is_changed[ty * hasher->tiles_x + tx]) {
+                    left = min(left, tx * TILE_HASH_SIZE);
+                    top = min(top, ty * TILE_HASH_SIZE);
+                    right = max(right, (tx + 1) * TILE_HASH_SIZE);
+                    bottom = max(bottom, (ty + 1) * TILE_HASH_SIZE);
+                }
+            }
+        }
+        if (left == INT_MAX) {
+            continue;
+        }
+        left = max(left, rect.x);
+        top = max(top, rect.y);
+        right = min(right, rect.x + rect.width);
+        bottom = min(bottom, rect.y + rect.height);
+        rects[num_narrowed_rects++] = (WhistRect){left, top, right - left, bottom - top};
+    }
+    *num_rects = num_narrowed_rects;
+    return num_changed_tiles;
+}
+
+int tile_hasher_get_num_tiles(TileHasher *hasher) { return hasher->tiles_x * hasher->tiles_y; }
+
+void tile_hasher_reset(TileHasher *hasher) {
+    if (hasher->is_hashed != NULL) {
+        memset(hasher->is_hashed, 0, (size_t)hasher->tiles_x * hasher->tiles_y * sizeof(bool));
+    }
+}
+
+void destroy_tile_hasher(TileHasher *hasher) {
+    if (hasher == NULL) {
+        return;
+    }
+    free(hasher->hashes);
+    free(hasher->is_hashed);
+    free(hasher->hashed_in_update);
+    free(hasher->is_changed);
+    free(hasher);
+}
+
+void tile_hash_set_max_kernel(TileHashKernel kernel) { max_kernel = kernel; }
+
+TileHashKernel tile_hash_get_kernel(void) {
+#if TILE_HASH_HAVE_X86_KERNELS
+    if (max_kernel >= TILE_HASH_KERNEL_SSE2 && cpu_has_sse2()) {
+        return TILE_HASH_KERNEL_SSE2;
+    }
+#endif
+    return TILE_HASH_KERNEL_SCALAR;
+}
+
+const char *tile_hash_kernel_to_str(TileHashKernel kernel) {
+    switch (kernel) {
+        case TILE_HASH_KERNEL_SCALAR:
+            return "scalar";
+        case TILE_HASH_KERNEL_SSE2:
+            return "sse2";
+        default:
+            return "unknown";
+    }
+}
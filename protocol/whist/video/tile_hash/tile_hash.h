@@ -0,0 +1,130 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file tile_hash.h
+ * @brief API for finding which tiles of a captured frame actually changed, by hashing them.
+ */
+#ifndef WHIST_VIDEO_TILE_HASH_H
+#define WHIST_VIDEO_TILE_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "whist/video/dirty_rects.h"
+
+/**
+ * Width and height of a tile, in pixels.
+ *
+ * Tiles at the right and bottom edges of a frame are cut short by the
+ * frame.
+ */
+#define TILE_HASH_SIZE 64
+
+/**
+ * Hashing kernels, from slowest to fastest.
+ *
+ * All of them produce exactly the same hashes.
+ */
+typedef enum TileHashKernel {
+    TILE_HASH_KERNEL_SCALAR,
+    TILE_HASH_KERNEL_SSE2,
+} TileHashKernel;
+
+/**
+ * Tile hasher, which remembers the hash of every tile of a frame, so
+ * that it can tell which tiles changed since they were last hashed.
+ *
+ * Screen damage is often reported for redraws that leave the pixels as
+ * they were, such as a blinking cursor or a compositor repaint, so the
+ * hashes tell real changes apart from those.
+ */
+typedef struct TileHasher TileHasher;
+
+/**
+ * Create a new tile hasher, which doesn't know the hash of any tile yet.
+ *
+ * @return  The new tile hasher.
+ */
+TileHasher *create_tile_hasher(void);
+
+/**
+ * Hash a block of RGB32 pixels.
+ *
+ * @param pixels  First pixel of the block.
+ * @param pitch   Number of bytes per row of pixels.
+ * @param width   Width of the block, at most TILE_HASH_SIZE.
+ * @param height  Height of the block.
+ * @return        The 64-bit hash of the block.
+ */
+uint64_t tile_hash(const uint8_t *pixels, int pitch, int width, int height);
+
+/**
+ * Hash the tiles that a frame's damage touches, and narrow the damage
+ * down to the tiles that changed.
+ *
+ * Tiles whose hash isn't known, because the hasher was just created or
+ * reset, or the frame changed size, always count as changed.  The tiles
+ * outside the damage are assumed to be unchanged, and aren't hashed.
+ *
+ * @param hasher     Tile hasher to use.
+ * @param pixels     RGB32 pixels of the frame.
+ * @param pitch      Number of bytes per row of pixels.
+ * @param width      Width of the frame.
+ * @param height     Height of the frame.
+ * @param rects      Dirty rectangle list of the frame.  Each rectangle is
+ *                   shrunk to the part of it that's covered by changed
+ *                   tiles, and removed if there isn't any.
+ * @param num_rects  Number of rectangles in the list, updated on return.
+ * @return           Number of tiles that changed.
+ */
+int tile_hasher_update(TileHasher *hasher, const uint8_t *pixels, int pitch, int width,
+                       int height, WhistRect *rects, int *num_rects);
+
+/**
+ * Get the number of tiles in the last frame given to the hasher.
+ *
+ * @param hasher  Tile hasher.
+ * @return        Number of tiles, or 0 if no frame was given yet.
+ */
+int tile_hasher_get_num_tiles(TileHasher *hasher);
+
+/**
+ * Forget the hashes of all tiles, e.g. when the frame changed without
+ * being hashed, so that they all count as changed the next time.
+ *
+ * @param hasher  Tile hasher to reset.
+ */
+void tile_hasher_reset(TileHasher *hasher);
+
+/**
+ * Destroy a tile hasher.
+ *
+ * @param hasher  Tile hasher to destroy.
+ */
+void destroy_tile_hasher(TileHasher *hasher);
+
+/**
+ * Limit hashing to the given kernel, or slower ones.
+ *
+ * All kernels that the CPU supports are allowed by default.  This is
+ * meant for benchmarks and tests.
+ *
+ * @param kernel  The fastest kernel to allow.
+ */
+void tile_hash_set_max_kernel(TileHashKernel kernel);
+
+/**
+ * Get the kernel that hashing uses.
+ *
+ * @return  The fastest kernel that is supported and allowed.
+ */
+TileHashKernel tile_hash_get_kernel(void);
+
+/**
+ * Get the name of a kernel.
+ *
+ * @param kernel  The kernel.
+ * @return        Its name, as a static string.
+ */
+const char *tile_hash_kernel_to_str(TileHashKernel kernel);
+
+#endif /* WHIST_VIDEO_TILE_HASH_H */
@@ -0,0 +1,91 @@
+/**
+ * @copyright Copyright (c) 2022 Whist Technologies, Inc.
+ * @file tile_hash_internal.h
+ * @brief Hashing kernels shared between tile_hash.c and the instruction-set specific files.
+ */
+#ifndef WHIST_VIDEO_TILE_HASH_INTERNAL_H
+#define WHIST_VIDEO_TILE_HASH_INTERNAL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tile_hash.h"
+
+/*
+ * The hash keeps four 64-bit accumulators, in the style of XXH3.  Each
+ * row is consumed as stripes of 32 bytes, one 64-bit word per
+ * accumulator: the word is mixed with a key that depends on its
+ * position in the row, multiplied by itself, and added to its own
+ * accumulator, while the raw word is added to the neighbouring one.
+ * The accumulators are scrambled at the end of every row, so that rows
+ * can't trade places unnoticed.
+ */
+#define TILE_HASH_PRIME32 0x9E3779B1U
+#define TILE_HASH_PRIME64 0x9E3779B185EBCA87ULL
+#define TILE_HASH_LANES 4
+#define TILE_HASH_STRIPE_BYTES (TILE_HASH_LANES * 8)
+// One key for every word of a row, then one for every accumulator's scramble
+#define TILE_HASH_ROW_KEYS (TILE_HASH_SIZE * 4 / 8)
+#define TILE_HASH_NUM_KEYS (TILE_HASH_ROW_KEYS + TILE_HASH_LANES)
+
+/**
+ * Hash the rows of a block of RGB32 pixels into the accumulators.
+ *
+ * Each kernel hashes as many whole stripes of a row as it can with its
+ * vector width, and the scalar code handles what's left.
+ *
+ * @param pixels  First pixel of the block.
+ * @param pitch   Number of bytes per row of pixels.
+ * @param width   Width of the block, at most TILE_HASH_SIZE.
+ * @param height  Height of the block.
+ * @param acc     The accumulators, updated on return.
+ */
+typedef void (*TileHashRowsKernel)(const uint8_t *pixels, int pitch, int width, int height,
+                                   uint64_t acc[TILE_HASH_LANES]);
+
+static inline uint64_t tile_hash_key(int index) {
+    return TILE_HASH_PRIME64 * (uint64_t)(2 * index + 1);
+}
+
+static inline void tile_hash_accumulate_word(uint64_t acc[TILE_HASH_LANES], int lane,
+                                             uint64_t word, uint64_t key) {
+    uint64_t word_key = word ^ key;
+    acc[lane ^ 1] += word;
+    acc[lane] += (word_key & 0xFFFFFFFF) * (word_key >> 32);
+}
+
+static inline void tile_hash_scramble(uint64_t acc[TILE_HASH_LANES]) {
+    for (int lane = 0; lane < TILE_HASH_LANES; lane++) {
+        uint64_t a = acc[lane] ^ (acc[lane] >> 47) ^ tile_hash_key(TILE_HASH_ROW_KEYS + lane);
+        acc[lane] = a * TILE_HASH_PRIME32;
+    }
+}
+
+// Hash the bytes of a row from the given offset on, and scramble the accumulators. Inline, so that
+// the instruction-set specific libraries can finish their rows with it.
+static inline void tile_hash_finish_row_scalar(const uint8_t *row, int offset, int row_bytes,
+                                               uint64_t acc[TILE_HASH_LANES]) {
+    for (; offset < row_bytes; offset += 8) {
+        // Rows are made of 4-byte pixels, so the last word may only be half there
+        uint64_t word = 0;
+        memcpy(&word, row + offset, row_bytes - offset >= 8 ? 8 : 4);
+        int index = offset / 8;
+        tile_hash_accumulate_word(acc, index % TILE_HASH_LANES, word, tile_hash_key(index));
+    }
+    tile_hash_scramble(acc);
+}
+
+static inline void tile_hash_rows_scalar(const uint8_t *pixels, int pitch, int width, int height,
+                                         uint64_t acc[TILE_HASH_LANES]) {
+    for (int y = 0; y < height; y++) {
+        tile_hash_finish_row_scalar(pixels + (size_t)y * pitch, 0, width * 4, acc);
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TILE_HASH_HAVE_X86_KERNELS 1
+void tile_hash_rows_sse2(const uint8_t *pixels, int pitch, int width, int height,
+                         uint64_t acc[TILE_HASH_LANES]);
+#endif
+
+#endif /* WHIST_VIDEO_TILE_HASH_INTERNAL_H */
@@ -1,16 +1,12 @@
 #include "transfercapture.h"
 #include "capture/capture.h"
 
-int transfer_capture(CaptureDevice* device, VideoEncoder* encoder, bool* force_iframe) {
-    if (device->width != encoder->in_width || device->height != encoder->in_height) {
+int transfer_capture(const CapturedFrame* frame, VideoEncoder* encoder, bool* force_iframe) {
+    if (frame->width != encoder->in_width || frame->height != encoder->in_height) {
         LOG_ERROR(
             "Tried to pass in a captured frame of dimension %dx%d, "
             "into an encoder that accepts %dx%d as input",
-            device->width, device->height, encoder->in_width, encoder->in_height);
-        return -1;
-    }
-    if (transfer_screen(device)) {
-        LOG_ERROR("Unable to transfer screen to CPU buffer.");
+            frame->width, frame->height, encoder->in_width, encoder->in_height);
         return -1;
     }
 
@@ -34,11 +30,11 @@ int transfer_capture(CaptureDevice* device, VideoEncoder* encoder, bool* force_i
             }
         }
         RegisteredResource resource_to_register = {0};
-        resource_to_register.width = device->width;
-        resource_to_register.height = device->height;
-        resource_to_register.pitch = device->pitch;
-        resource_to_register.device_type = device->last_capture_device;
-        resource_to_register.texture_pointer = device->frame_data;
+        resource_to_register.width = frame->width;
+        resource_to_register.height = frame->height;
+        resource_to_register.pitch = frame->pitch;
+        resource_to_register.device_type = frame->device_type;
+        resource_to_register.texture_pointer = frame->frame_data;
         return nvidia_encoder_frame_intake(encoder->nvidia_encoders[encoder->active_encoder_idx],
                                            resource_to_register);
     }
@@ -57,15 +53,12 @@ int transfer_capture(CaptureDevice* device, VideoEncoder* encoder, bool* force_i
     WhistTimer cpu_transfer_timer;
     start_timer(&cpu_transfer_timer);
 
-#if OS_IS(OS_WIN32)
-    if (ffmpeg_encoder_frame_intake(encoder->ffmpeg_encoder, device->frame_data, device->pitch)) {
-#elif OS_IS(OS_LINUX)
-    if (ffmpeg_encoder_frame_intake(encoder->ffmpeg_encoder, device->x11_capture_device->frame_data,
-                                    device->x11_capture_device->pitch)) {
-#endif
+    if (ffmpeg_encoder_frame_intake(encoder->ffmpeg_encoder, frame->frame_data, frame->pitch)) {
         LOG_ERROR("Unable to load data to AVFrame");
         return -1;
     }
+    ffmpeg_encoder_set_dirty_rects(encoder->ffmpeg_encoder, frame->dirty_rects,
+                                   frame->num_dirty_rects);
 
     times_measured++;
     time_spent += get_timer(&cpu_transfer_timer);
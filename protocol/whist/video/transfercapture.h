@@ -20,6 +20,29 @@ Includes
 #include "capture/capture.h"
 #include <whist/utils/color.h>
 
+/*
+============================
+Custom Types
+============================
+*/
+
+/**
+ * @brief                         A captured frame, as handed from the capture
+ *                                thread to the encode thread. The frame data
+ *                                is either a CPU buffer of BGRA pixels, or the
+ *                                capture device's GPU texture.
+ */
+typedef struct CapturedFrame {
+    int width;
+    int height;
+    int pitch;
+    CaptureDeviceType device_type;
+    void* frame_data;
+    // The regions that changed since the last frame that was transferred
+    int num_dirty_rects;
+    WhistRect dirty_rects[MAX_DIRTY_RECTS];
+} CapturedFrame;
+
 /*
 ============================
 Public Functions
@@ -27,17 +50,16 @@ Public Functions
 */
 
 /**
- * @brief                         Transfer the texture stored in the capture
- *                                device to the encoder, either via GPU or CPU
+ * @brief                         Transfer a captured frame to the encoder,
+ *                                either via GPU or CPU
  *
- * @param device                  The capture device from which to get the
- *                                texture
+ * @param frame                   The captured frame
  * @param encoder                 The encoder into which to load the frame data
  *
  * @param force_iframe            Whether an I-frame needs to be generated
  *
  * @returns                       0 on success, else -1
  */
-int transfer_capture(CaptureDevice* device, VideoEncoder* encoder, bool* force_iframe);
+int transfer_capture(const CapturedFrame* frame, VideoEncoder* encoder, bool* force_iframe);
 
 #endif  // TRANSFER_CAPTURE_H